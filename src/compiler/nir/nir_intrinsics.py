@@ -1291,6 +1291,18 @@ load("sampler_lod_parameters_pan", [1], flags=[CAN_ELIMINATE, CAN_REORDER])
 # Loads the sample position array on Bifrost, in a packed Arm-specific format
 system_value("sample_positions_pan", 1, bit_sizes=[64])
 
+# Loads a vertex shader input for an explicit vertex and instance. The vertex
+# is relative to the first vertex of the draw, like the vertex ID preloaded by
+# the hardware. Used by Bifrost transform feedback shaders, which fetch the
+# vertices of indexed draws from the index buffer themselves.
+# src[] = { vertex, instance, offset }
+load("attribute_pan", [1, 1, 1], [BASE, COMPONENT, DEST_TYPE, IO_SEMANTICS], [CAN_ELIMINATE, CAN_REORDER])
+
+# Index buffer of the draw of a transform feedback shader, as <address low,
+# address high, index size in bytes, index bias>. The size is zero for
+# non-indexed draws.
+system_value("xfb_indices_pan", 4)
+
 # R600 specific instrincs
 #
 # location where the tesselation data is stored in LDS
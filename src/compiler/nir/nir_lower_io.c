@@ -2720,6 +2720,7 @@ nir_get_io_offset_src(nir_intrinsic_instr *instr)
    case nir_intrinsic_store_ssbo:
    case nir_intrinsic_store_per_vertex_output:
    case nir_intrinsic_store_per_primitive_output:
+   case nir_intrinsic_load_attribute_pan:
       return &instr->src[2];
    default:
       return NULL;
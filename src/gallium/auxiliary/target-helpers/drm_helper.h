@@ -156,6 +156,12 @@ const driOptionDescription v3d_driconf[] = {
 };
 #endif
 
+#ifdef GALLIUM_PANFROST
+const driOptionDescription panfrost_driconf[] = {
+      #include "panfrost/driinfo_panfrost.h"
+};
+#endif
+
 #ifdef GALLIUM_KMSRO
 #include "kmsro/drm/kmsro_drm_public.h"
 
@@ -169,6 +175,8 @@ pipe_kmsro_create_screen(int fd, const struct pipe_screen_config *config)
 }
 #if defined(GALLIUM_VC4) || defined(GALLIUM_V3D)
 DRM_DRIVER_DESCRIPTOR(kmsro, v3d_driconf, ARRAY_SIZE(v3d_driconf))
+#elif defined(GALLIUM_PANFROST)
+DRM_DRIVER_DESCRIPTOR(kmsro, panfrost_driconf, ARRAY_SIZE(panfrost_driconf))
 #else
 DRM_DRIVER_DESCRIPTOR(kmsro, NULL, 0)
 #endif
@@ -347,10 +355,10 @@ pipe_panfrost_create_screen(int fd, const struct pipe_screen_config *config)
 {
    struct pipe_screen *screen;
 
-   screen = panfrost_drm_screen_create(fd);
+   screen = panfrost_drm_screen_create(fd, config);
    return screen ? debug_screen_wrap(screen) : NULL;
 }
-DRM_DRIVER_DESCRIPTOR(panfrost, NULL, 0)
+DRM_DRIVER_DESCRIPTOR(panfrost, panfrost_driconf, ARRAY_SIZE(panfrost_driconf))
 
 #else
 DRM_DRIVER_DESCRIPTOR_STUB(panfrost)
@@ -0,0 +1,10 @@
+// panfrost-specific driconf options
+
+DRI_CONF_SECTION_PERFORMANCE
+   DRI_CONF_PAN_TILER_HEAP_CHUNK_SIZE(2048)
+   DRI_CONF_PAN_TILER_HEAP_INITIAL_CHUNKS(2)
+   DRI_CONF_PAN_TILER_HEAP_MAX_CHUNKS(200)
+   DRI_CONF_PAN_TILER_HEAP_ADAPTIVE(true)
+   DRI_CONF_PAN_MEDIUMP_INT16(true)
+   DRI_CONF_PAN_THREAD_AFFINITY(true)
+DRI_CONF_SECTION_END
@@ -33,6 +33,7 @@
 #include "nir.h"
 
 struct panfrost_bo;
+struct panfrost_context;
 
 struct pan_blend_info {
         unsigned constant_mask : 4;
@@ -54,6 +55,10 @@ struct panfrost_blend_state {
         unsigned load_dest_mask : PIPE_MAX_COLOR_BUFS;
 };
 
+bool
+panfrost_blend_needs_shader(const struct panfrost_context *ctx, unsigned rt,
+                            enum pipe_format format);
+
 mali_ptr
 panfrost_get_blend(struct panfrost_batch *batch, unsigned rt, struct panfrost_bo **bo, unsigned *shader_offset);
 
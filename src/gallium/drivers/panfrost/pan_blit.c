@@ -29,7 +29,10 @@
 
 #include "pan_context.h"
 #include "pan_util.h"
+#include "nir/nir_builder.h"
 #include "util/format/u_format.h"
+#include "util/format_srgb.h"
+#include "util/u_sampler.h"
 
 void
 panfrost_blitter_save(struct panfrost_context *ctx, bool render_cond)
@@ -67,6 +70,58 @@ panfrost_blitter_save(struct panfrost_context *ctx, bool render_cond)
 
 }
 
+/* A blit writing every channel of a whole single-layer slice, without
+ * blending or a scissor, replaces the previous contents of the destination,
+ * which then don't need to be preloaded into the tile buffer. That saves a
+ * full read of the destination for every resolve of a multisampled render
+ * target into a window system buffer, and for full-surface copies. */
+
+static bool
+panfrost_blit_replaces_dst(const struct pipe_blit_info *info)
+{
+        const struct pipe_resource *dst = info->dst.resource;
+        unsigned level = info->dst.level;
+
+        /* A blit through a view lacking some channels of the resource
+         * leaves those channels alone */
+        if (info->dst.format != dst->format ||
+            util_format_is_depth_or_stencil(dst->format) ||
+            info->mask != util_format_get_mask(dst->format) ||
+            info->scissor_enable || info->render_condition_enable ||
+            info->alpha_blend)
+                return false;
+
+        if (dst->target != PIPE_TEXTURE_2D && dst->target != PIPE_TEXTURE_RECT)
+                return false;
+
+        return info->dst.box.x == 0 && info->dst.box.y == 0 &&
+               info->dst.box.width == u_minify(dst->width0, level) &&
+               info->dst.box.height == u_minify(dst->height0, level) &&
+               info->dst.box.depth == 1;
+}
+
+static void
+panfrost_blit_mark_replaced(struct panfrost_context *ctx,
+                            const struct pipe_blit_info *info)
+{
+        /* The blit was drawn in the most recently used batch */
+        for (unsigned i = 0; i < PAN_MAX_BATCHES; i++) {
+                struct panfrost_batch *batch = &ctx->batches.slots[i];
+                const struct pipe_surface *surf = batch->key.cbufs[0];
+
+                if (batch->seqnum != ctx->batches.seqnum)
+                        continue;
+
+                if (batch->key.nr_cbufs == 1 && surf &&
+                    surf->texture == info->dst.resource &&
+                    surf->u.tex.level == info->dst.level &&
+                    (batch->draws & PIPE_CLEAR_COLOR0))
+                        batch->replaced |= PIPE_CLEAR_COLOR0;
+
+                return;
+        }
+}
+
 void
 panfrost_blit(struct pipe_context *pipe,
               const struct pipe_blit_info *info)
@@ -77,9 +132,1155 @@ panfrost_blit(struct pipe_context *pipe,
             !panfrost_render_condition_check(ctx))
                 return;
 
+        /* The views and surfaces created for the blit are only legalized here
+         * when the context is threaded */
+        if (ctx->tc) {
+                pan_legalize_afbc_format(ctx, pan_resource(info->src.resource),
+                                         info->src.format);
+                pan_legalize_afbc_format(ctx, pan_resource(info->dst.resource),
+                                         info->dst.format);
+        }
+
+        /* Unless a batch already renders to the destination, in which case
+         * the blit is drawn in it, copy with a compute job recorded in the
+         * current batch instead of starting a render pass per blit. */
+        if (!_mesa_hash_table_search(ctx->writers, info->dst.resource) &&
+            panfrost_compute_copy(pipe, info))
+                return;
+
         if (!util_blitter_is_blit_supported(ctx->blitter, info))
                 unreachable("Unsupported blit\n");
 
         panfrost_blitter_save(ctx, info->render_condition_enable);
         util_blitter_blit(ctx->blitter, info);
+
+        if (panfrost_blit_replaces_dst(info))
+                panfrost_blit_mark_replaced(ctx, info);
+}
+
+/* Copies between resources of the same format may be done by a compute
+ * shader fetching the texels of the source and storing them to the
+ * destination bound as an image. That converts between tilings in a single
+ * pass, without the framebuffer setup, preload and fragment job of a blit,
+ * which matters for the latency of staged transfers. Only formats whose
+ * texels survive the round trip through the shader bit-exactly are copied
+ * this way, and images can't be AFBC, so the destination must not be. */
+
+#define PAN_COMPUTE_COPY_WG_SIZE 8
+
+/* Can the resource be stored to from a compute shader, bound as an image of
+ * the given format? Packed formats aren't image formats. */
+
+static bool
+panfrost_can_compute_store(struct pipe_screen *screen,
+                           const struct pipe_resource *rsrc,
+                           enum pipe_format format, unsigned bind)
+{
+        const struct util_format_description *desc =
+                util_format_description(format);
+
+        if ((rsrc->target != PIPE_TEXTURE_2D && rsrc->target != PIPE_TEXTURE_RECT) ||
+            rsrc->nr_samples > 1)
+                return false;
+
+        if (drm_is_afbc(pan_resource((struct pipe_resource *)rsrc)->image.layout.modifier))
+                return false;
+
+        if (desc->layout != UTIL_FORMAT_LAYOUT_PLAIN || !desc->is_array ||
+            util_format_is_depth_or_stencil(format))
+                return false;
+
+        return screen->is_format_supported(screen, util_format_linear(format),
+                                           rsrc->target, 0, 0,
+                                           bind | PIPE_BIND_SHADER_IMAGE);
+}
+
+static bool
+panfrost_can_compute_copy(struct pipe_screen *screen,
+                          const struct pipe_blit_info *info)
+{
+        const struct pipe_resource *src = info->src.resource;
+        enum pipe_format format = info->dst.format;
+
+        if (info->src.format != format ||
+            info->mask != util_format_get_mask(format) ||
+            info->scissor_enable || info->render_condition_enable ||
+            info->alpha_blend)
+                return false;
+
+        if ((src->target != PIPE_TEXTURE_2D && src->target != PIPE_TEXTURE_RECT) ||
+            src->nr_samples > 1)
+                return false;
+
+        if (info->dst.box.width <= 0 || info->dst.box.height <= 0 ||
+            info->src.box.width != info->dst.box.width ||
+            info->src.box.height != info->dst.box.height ||
+            info->src.box.depth != 1 || info->dst.box.depth != 1)
+                return false;
+
+        /* Signed normalized formats have two encodings of -1.0, which would
+         * not be preserved. */
+        if (util_format_is_snorm(format))
+                return false;
+
+        return panfrost_can_compute_store(screen, info->dst.resource, format,
+                                          PIPE_BIND_SAMPLER_VIEW);
+}
+
+static void *
+panfrost_get_compute_copy_shader(struct panfrost_context *ctx,
+                                 nir_alu_type type)
+{
+        unsigned idx = (type == nir_type_float32) ? 0 :
+                       (type == nir_type_uint32) ? 1 : 2;
+
+        if (ctx->compute_copy.shaders[idx])
+                return ctx->compute_copy.shaders[idx];
+
+        struct pipe_screen *screen = ctx->base.screen;
+        const nir_shader_compiler_options *options =
+                screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                             PIPE_SHADER_COMPUTE);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                               "panfrost_compute_copy(%s)",
+                                               idx == 0 ? "float" :
+                                               idx == 1 ? "uint" : "int");
+
+        b.shader->info.workgroup_size[0] = PAN_COMPUTE_COPY_WG_SIZE;
+        b.shader->info.workgroup_size[1] = PAN_COMPUTE_COPY_WG_SIZE;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ubos = 1;
+        b.shader->info.num_textures = 1;
+        b.shader->info.num_images = 1;
+        BITSET_SET(b.shader->info.textures_used, 0);
+        BITSET_SET(b.shader->info.textures_used_by_txf, 0);
+        BITSET_SET(b.shader->info.images_used, 0);
+
+        /* Parameters: source offset, destination offset and size */
+        nir_ssa_def *params = nir_load_ubo(&b, 4, 32, nir_imm_int(&b, 0),
+                                           nir_imm_int(&b, 0),
+                                           .align_mul = 16, .range = 16);
+        nir_ssa_def *size = nir_load_ubo(&b, 2, 32, nir_imm_int(&b, 0),
+                                         nir_imm_int(&b, 16),
+                                         .align_mul = 16, .range = 8);
+
+        nir_ssa_def *id =
+                nir_iadd(&b, nir_imul_imm(&b, nir_load_workgroup_id(&b, 32),
+                                          PAN_COMPUTE_COPY_WG_SIZE),
+                         nir_load_local_invocation_id(&b));
+        id = nir_channels(&b, id, 0x3);
+
+        nir_push_if(&b, nir_ball(&b, nir_ult(&b, id, size)));
+        {
+                nir_tex_instr *tex = nir_tex_instr_create(b.shader, 2);
+
+                tex->op = nir_texop_txf;
+                tex->dest_type = type;
+                tex->texture_index = 0;
+                tex->sampler_index = 0;
+                tex->sampler_dim = GLSL_SAMPLER_DIM_2D;
+
+                tex->src[0].src_type = nir_tex_src_coord;
+                tex->src[0].src = nir_src_for_ssa(
+                        nir_iadd(&b, id, nir_channels(&b, params, 0x3)));
+                tex->coord_components = 2;
+
+                tex->src[1].src_type = nir_tex_src_lod;
+                tex->src[1].src = nir_src_for_ssa(nir_imm_int(&b, 0));
+                nir_ssa_dest_init(&tex->instr, &tex->dest, 4, 32, NULL);
+                nir_builder_instr_insert(&b, &tex->instr);
+
+                nir_ssa_def *coord =
+                        nir_iadd(&b, id, nir_channels(&b, params, 0xc));
+
+                nir_image_store(&b, nir_imm_int(&b, 0),
+                                nir_pad_vector_imm_int(&b, coord, 0, 4),
+                                nir_ssa_undef(&b, 1, 32), &tex->dest.ssa,
+                                nir_imm_int(&b, 0),
+                                .image_dim = GLSL_SAMPLER_DIM_2D,
+                                .access = ACCESS_NON_READABLE,
+                                .src_type = type);
+        }
+        nir_pop_if(&b, NULL);
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+        };
+
+        ctx->compute_copy.shaders[idx] =
+                ctx->base.create_compute_state(&ctx->base, &cso);
+        ralloc_free(b.shader);
+
+        return ctx->compute_copy.shaders[idx];
+}
+
+/* Compute state clobbered by the compute helpers below, saved and restored
+ * around them so they may be called at any time */
+#define PAN_COMPUTE_MAX_IMAGES 4
+#define PAN_COMPUTE_MAX_SSBOS 2
+
+struct panfrost_compute_save {
+        void *shader;
+        struct pipe_image_view images[PAN_COMPUTE_MAX_IMAGES];
+        struct pipe_shader_buffer ssbos[PAN_COMPUTE_MAX_SSBOS];
+        struct pipe_constant_buffer cb;
+        bool has_cb;
+        struct pipe_sampler_view *view;
+        void *samplers[PIPE_MAX_SAMPLERS];
+        unsigned nr_samplers;
+};
+
+static void
+panfrost_compute_save_state(struct panfrost_context *ctx,
+                            struct panfrost_compute_save *save)
+{
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        memset(save, 0, sizeof(*save));
+        save->shader = ctx->uncompiled[st];
+
+        for (unsigned i = 0; i < PAN_COMPUTE_MAX_IMAGES; ++i)
+                util_copy_image_view(&save->images[i], &ctx->images[st][i]);
+
+        /* Unbound slots are saved with a NULL buffer, unbinding them again
+         * on restore */
+        for (unsigned i = 0; i < PAN_COMPUTE_MAX_SSBOS; ++i) {
+                if (!(ctx->ssbo_mask[st] & BITFIELD_BIT(i)))
+                        continue;
+
+                save->ssbos[i] = ctx->ssbo[st][i];
+                save->ssbos[i].buffer = NULL;
+                pipe_resource_reference(&save->ssbos[i].buffer,
+                                        ctx->ssbo[st][i].buffer);
+        }
+
+        save->has_cb = ctx->constant_buffer[st].enabled_mask & BITFIELD_BIT(0);
+        util_copy_constant_buffer(&save->cb, &ctx->constant_buffer[st].cb[0],
+                                  false);
+
+        pipe_sampler_view_reference(&save->view,
+                                    (struct pipe_sampler_view *)ctx->sampler_views[st][0]);
+
+        save->nr_samplers = ctx->sampler_count[st];
+        memcpy(save->samplers, ctx->samplers[st],
+               save->nr_samplers * sizeof(void *));
+}
+
+static void
+panfrost_compute_restore_state(struct panfrost_context *ctx,
+                               struct panfrost_compute_save *save)
+{
+        struct pipe_context *pipe = &ctx->base;
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        pipe->bind_compute_state(pipe, save->shader);
+        pipe->bind_sampler_states(pipe, st, 0, save->nr_samplers,
+                                  save->nr_samplers ? save->samplers : NULL);
+        pipe->set_sampler_views(pipe, st, 0, 1, 0, true, &save->view);
+        pipe->set_shader_images(pipe, st, 0, PAN_COMPUTE_MAX_IMAGES, 0,
+                                save->images);
+        pipe->set_shader_buffers(pipe, st, 0, PAN_COMPUTE_MAX_SSBOS,
+                                 save->ssbos, 0);
+        pipe->set_constant_buffer(pipe, st, 0, true,
+                                  save->has_cb ? &save->cb : NULL);
+
+        if (!save->has_cb)
+                pipe_resource_reference(&save->cb.buffer, NULL);
+
+        for (unsigned i = 0; i < PAN_COMPUTE_MAX_SSBOS; ++i)
+                pipe_resource_reference(&save->ssbos[i].buffer, NULL);
+
+        for (unsigned i = 0; i < PAN_COMPUTE_MAX_IMAGES; ++i)
+                pipe_resource_reference(&save->images[i].resource, NULL);
+}
+
+bool
+panfrost_compute_copy(struct pipe_context *pipe,
+                      const struct pipe_blit_info *info)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        if (!panfrost_can_compute_copy(pipe->screen, info))
+                return false;
+
+        enum pipe_format format = util_format_linear(info->dst.format);
+        nir_alu_type type = util_format_is_pure_uint(format) ? nir_type_uint32 :
+                            util_format_is_pure_sint(format) ? nir_type_int32 :
+                            nir_type_float32;
+
+        void *shader = panfrost_get_compute_copy_shader(ctx, type);
+        if (!shader)
+                return false;
+
+        if (!ctx->compute_copy.sampler) {
+                struct pipe_sampler_state sampler = {
+                        .wrap_s = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .wrap_t = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .wrap_r = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .min_img_filter = PIPE_TEX_FILTER_NEAREST,
+                        .mag_img_filter = PIPE_TEX_FILTER_NEAREST,
+                };
+
+                ctx->compute_copy.sampler =
+                        pipe->create_sampler_state(pipe, &sampler);
+        }
+
+        struct panfrost_compute_save save;
+        panfrost_compute_save_state(ctx, &save);
+
+        /* Bind the copy state */
+        uint32_t params[] = {
+                info->src.box.x, info->src.box.y,
+                info->dst.box.x, info->dst.box.y,
+                info->dst.box.width, info->dst.box.height,
+        };
+
+        struct pipe_constant_buffer cb = {
+                .buffer_size = sizeof(params),
+                .user_buffer = params,
+        };
+        pipe->set_constant_buffer(pipe, st, 0, false, &cb);
+
+        struct pipe_image_view image = {
+                .resource = info->dst.resource,
+                .format = format,
+                .access = PIPE_IMAGE_ACCESS_WRITE,
+                .shader_access = PIPE_IMAGE_ACCESS_WRITE,
+                .u.tex.level = info->dst.level,
+                .u.tex.first_layer = info->dst.box.z,
+                .u.tex.last_layer = info->dst.box.z,
+        };
+        pipe->set_shader_images(pipe, st, 0, 1, 0, &image);
+
+        struct pipe_sampler_view templ;
+        u_sampler_view_default_template(&templ, info->src.resource, format);
+        templ.u.tex.first_level = templ.u.tex.last_level = info->src.level;
+        templ.u.tex.first_layer = templ.u.tex.last_layer = info->src.box.z;
+
+        struct pipe_sampler_view *view =
+                pipe->create_sampler_view(pipe, info->src.resource, &templ);
+        pipe->set_sampler_views(pipe, st, 0, 1, 0, true, &view);
+        pipe->bind_sampler_states(pipe, st, 0, 1, &ctx->compute_copy.sampler);
+        pipe->bind_compute_state(pipe, shader);
+
+        struct pipe_grid_info grid = {
+                .block = { PAN_COMPUTE_COPY_WG_SIZE, PAN_COMPUTE_COPY_WG_SIZE, 1 },
+                .grid = {
+                        DIV_ROUND_UP(info->dst.box.width, PAN_COMPUTE_COPY_WG_SIZE),
+                        DIV_ROUND_UP(info->dst.box.height, PAN_COMPUTE_COPY_WG_SIZE),
+                        1
+                },
+        };
+        pipe->launch_grid(pipe, &grid);
+
+        panfrost_compute_restore_state(ctx, &save);
+        return true;
+}
+
+/* Partial clears of colour targets may be done by a compute shader storing
+ * the clear colour to the rectangle, bound as an image, instead of a render
+ * pass preloading the whole target around it. */
+
+static void *
+panfrost_get_compute_clear_shader(struct panfrost_context *ctx,
+                                  nir_alu_type type)
+{
+        unsigned idx = (type == nir_type_float32) ? 0 :
+                       (type == nir_type_uint32) ? 1 : 2;
+
+        if (ctx->compute_clear.shaders[idx])
+                return ctx->compute_clear.shaders[idx];
+
+        struct pipe_screen *screen = ctx->base.screen;
+        const nir_shader_compiler_options *options =
+                screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                             PIPE_SHADER_COMPUTE);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                               "panfrost_compute_clear(%s)",
+                                               idx == 0 ? "float" :
+                                               idx == 1 ? "uint" : "int");
+
+        b.shader->info.workgroup_size[0] = PAN_COMPUTE_COPY_WG_SIZE;
+        b.shader->info.workgroup_size[1] = PAN_COMPUTE_COPY_WG_SIZE;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ubos = 1;
+        b.shader->info.num_images = 1;
+        BITSET_SET(b.shader->info.images_used, 0);
+
+        /* Parameters: offset and size of the rectangle, then the colour */
+        nir_ssa_def *params = nir_load_ubo(&b, 4, 32, nir_imm_int(&b, 0),
+                                           nir_imm_int(&b, 0),
+                                           .align_mul = 16, .range = 32);
+        nir_ssa_def *color = nir_load_ubo(&b, 4, 32, nir_imm_int(&b, 0),
+                                          nir_imm_int(&b, 16),
+                                          .align_mul = 16, .range = 32);
+
+        nir_ssa_def *id =
+                nir_iadd(&b, nir_imul_imm(&b, nir_load_workgroup_id(&b, 32),
+                                          PAN_COMPUTE_COPY_WG_SIZE),
+                         nir_load_local_invocation_id(&b));
+        id = nir_channels(&b, id, 0x3);
+
+        nir_push_if(&b, nir_ball(&b, nir_ult(&b, id, nir_channels(&b, params, 0xc))));
+        {
+                nir_ssa_def *coord =
+                        nir_iadd(&b, id, nir_channels(&b, params, 0x3));
+
+                nir_image_store(&b, nir_imm_int(&b, 0),
+                                nir_pad_vector_imm_int(&b, coord, 0, 4),
+                                nir_ssa_undef(&b, 1, 32), color,
+                                nir_imm_int(&b, 0),
+                                .image_dim = GLSL_SAMPLER_DIM_2D,
+                                .access = ACCESS_NON_READABLE,
+                                .src_type = type);
+        }
+        nir_pop_if(&b, NULL);
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+        };
+
+        ctx->compute_clear.shaders[idx] =
+                ctx->base.create_compute_state(&ctx->base, &cso);
+        ralloc_free(b.shader);
+
+        return ctx->compute_clear.shaders[idx];
+}
+
+bool
+panfrost_compute_clear(struct pipe_context *pipe,
+                       struct pipe_surface *dst,
+                       const union pipe_color_union *color,
+                       unsigned dstx, unsigned dsty,
+                       unsigned width, unsigned height)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        if (!width || !height ||
+            dst->u.tex.first_layer != dst->u.tex.last_layer ||
+            !panfrost_can_compute_store(pipe->screen, dst->texture,
+                                        dst->format, 0))
+                return false;
+
+        enum pipe_format format = util_format_linear(dst->format);
+        nir_alu_type type = util_format_is_pure_uint(format) ? nir_type_uint32 :
+                            util_format_is_pure_sint(format) ? nir_type_int32 :
+                            nir_type_float32;
+
+        void *shader = panfrost_get_compute_clear_shader(ctx, type);
+        if (!shader)
+                return false;
+
+        /* The image is bound with the linear format, so encode sRGB here */
+        union pipe_color_union value = *color;
+
+        if (util_format_is_srgb(dst->format)) {
+                for (unsigned i = 0; i < 3; ++i)
+                        value.f[i] = util_format_linear_to_srgb_float(value.f[i]);
+        }
+
+        struct panfrost_compute_save save;
+        panfrost_compute_save_state(ctx, &save);
+
+        uint32_t params[] = {
+                dstx, dsty, width, height,
+                value.ui[0], value.ui[1], value.ui[2], value.ui[3],
+        };
+
+        struct pipe_constant_buffer cb = {
+                .buffer_size = sizeof(params),
+                .user_buffer = params,
+        };
+        pipe->set_constant_buffer(pipe, st, 0, false, &cb);
+
+        struct pipe_image_view image = {
+                .resource = dst->texture,
+                .format = format,
+                .access = PIPE_IMAGE_ACCESS_WRITE,
+                .shader_access = PIPE_IMAGE_ACCESS_WRITE,
+                .u.tex.level = dst->u.tex.level,
+                .u.tex.first_layer = dst->u.tex.first_layer,
+                .u.tex.last_layer = dst->u.tex.last_layer,
+        };
+        pipe->set_shader_images(pipe, st, 0, 1, 0, &image);
+        pipe->bind_compute_state(pipe, shader);
+
+        struct pipe_grid_info grid = {
+                .block = { PAN_COMPUTE_COPY_WG_SIZE, PAN_COMPUTE_COPY_WG_SIZE, 1 },
+                .grid = {
+                        DIV_ROUND_UP(width, PAN_COMPUTE_COPY_WG_SIZE),
+                        DIV_ROUND_UP(height, PAN_COMPUTE_COPY_WG_SIZE),
+                        1
+                },
+        };
+        pipe->launch_grid(pipe, &grid);
+
+        panfrost_compute_restore_state(ctx, &save);
+        return true;
+}
+
+/* Buffers are filled with a repeated pattern by a compute shader storing a
+ * word per invocation, rather than mapping them on the CPU, which would wait
+ * for the GPU to be done with them. */
+
+#define PAN_COMPUTE_FILL_WG_SIZE 64
+
+static void *
+panfrost_get_compute_fill_shader(struct panfrost_context *ctx)
+{
+        if (ctx->compute_clear.fill)
+                return ctx->compute_clear.fill;
+
+        struct pipe_screen *screen = ctx->base.screen;
+        const nir_shader_compiler_options *options =
+                screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                             PIPE_SHADER_COMPUTE);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                               "panfrost_compute_fill");
+
+        b.shader->info.workgroup_size[0] = PAN_COMPUTE_FILL_WG_SIZE;
+        b.shader->info.workgroup_size[1] = 1;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ubos = 1;
+        b.shader->info.num_ssbos = 1;
+
+        /* Parameters: words to store, words in the pattern, then the
+         * pattern */
+        nir_ssa_def *params = nir_load_ubo(&b, 2, 32, nir_imm_int(&b, 0),
+                                           nir_imm_int(&b, 0),
+                                           .align_mul = 16, .range = 32);
+
+        nir_ssa_def *id =
+                nir_iadd(&b, nir_imul_imm(&b, nir_load_workgroup_id(&b, 32),
+                                          PAN_COMPUTE_FILL_WG_SIZE),
+                         nir_load_local_invocation_id(&b));
+        id = nir_channel(&b, id, 0);
+
+        nir_push_if(&b, nir_ult(&b, id, nir_channel(&b, params, 0)));
+        {
+                nir_ssa_def *word = nir_umod(&b, id, nir_channel(&b, params, 1));
+                nir_ssa_def *value =
+                        nir_load_ubo(&b, 1, 32, nir_imm_int(&b, 0),
+                                     nir_iadd_imm(&b, nir_ishl_imm(&b, word, 2), 16),
+                                     .align_mul = 4, .range = 32);
+
+                nir_store_ssbo(&b, value, nir_imm_int(&b, 0),
+                               nir_ishl_imm(&b, id, 2),
+                               .access = ACCESS_NON_READABLE,
+                               .align_mul = 4);
+        }
+        nir_pop_if(&b, NULL);
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+        };
+
+        ctx->compute_clear.fill =
+                ctx->base.create_compute_state(&ctx->base, &cso);
+        ralloc_free(b.shader);
+
+        return ctx->compute_clear.fill;
+}
+
+bool
+panfrost_compute_fill_buffer(struct pipe_context *pipe,
+                             struct pipe_resource *res,
+                             unsigned offset, unsigned size,
+                             const void *value, int value_size)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        if (!size || (offset | size | value_size) & 3 || value_size > 16)
+                return false;
+
+        void *shader = panfrost_get_compute_fill_shader(ctx);
+        if (!shader)
+                return false;
+
+        struct panfrost_compute_save save;
+        panfrost_compute_save_state(ctx, &save);
+
+        uint32_t params[8] = { size / 4, value_size / 4 };
+        memcpy(&params[4], value, value_size);
+
+        struct pipe_constant_buffer cb = {
+                .buffer_size = sizeof(params),
+                .user_buffer = params,
+        };
+        pipe->set_constant_buffer(pipe, st, 0, false, &cb);
+
+        struct pipe_shader_buffer ssbo = {
+                .buffer = res,
+                .buffer_offset = offset,
+                .buffer_size = size,
+        };
+        pipe->set_shader_buffers(pipe, st, 0, 1, &ssbo, BITFIELD_BIT(0));
+        pipe->bind_compute_state(pipe, shader);
+
+        struct pipe_grid_info grid = {
+                .block = { PAN_COMPUTE_FILL_WG_SIZE, 1, 1 },
+                .grid = { DIV_ROUND_UP(size / 4, PAN_COMPUTE_FILL_WG_SIZE), 1, 1 },
+        };
+        pipe->launch_grid(pipe, &grid);
+
+        panfrost_compute_restore_state(ctx, &save);
+        return true;
+}
+
+/* Buffer ranges are copied a word per invocation, reusing the workgroup size
+ * of the fill shader */
+
+static void *
+panfrost_get_compute_copy_buffer_shader(struct panfrost_context *ctx)
+{
+        if (ctx->compute_copy.buffer)
+                return ctx->compute_copy.buffer;
+
+        struct pipe_screen *screen = ctx->base.screen;
+        const nir_shader_compiler_options *options =
+                screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                             PIPE_SHADER_COMPUTE);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                               "panfrost_compute_copy_buffer");
+
+        b.shader->info.workgroup_size[0] = PAN_COMPUTE_FILL_WG_SIZE;
+        b.shader->info.workgroup_size[1] = 1;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ubos = 1;
+        b.shader->info.num_ssbos = 2;
+
+        /* Parameters: words to copy */
+        nir_ssa_def *count = nir_load_ubo(&b, 1, 32, nir_imm_int(&b, 0),
+                                          nir_imm_int(&b, 0),
+                                          .align_mul = 16, .range = 16);
+
+        nir_ssa_def *id =
+                nir_iadd(&b, nir_imul_imm(&b, nir_load_workgroup_id(&b, 32),
+                                          PAN_COMPUTE_FILL_WG_SIZE),
+                         nir_load_local_invocation_id(&b));
+        id = nir_channel(&b, id, 0);
+
+        nir_push_if(&b, nir_ult(&b, id, count));
+        {
+                nir_ssa_def *offset = nir_ishl_imm(&b, id, 2);
+                nir_ssa_def *value =
+                        nir_load_ssbo(&b, 1, 32, nir_imm_int(&b, 1), offset,
+                                      .access = ACCESS_NON_WRITEABLE,
+                                      .align_mul = 4);
+
+                nir_store_ssbo(&b, value, nir_imm_int(&b, 0), offset,
+                               .access = ACCESS_NON_READABLE,
+                               .align_mul = 4);
+        }
+        nir_pop_if(&b, NULL);
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+        };
+
+        ctx->compute_copy.buffer =
+                ctx->base.create_compute_state(&ctx->base, &cso);
+        ralloc_free(b.shader);
+
+        return ctx->compute_copy.buffer;
+}
+
+bool
+panfrost_compute_copy_buffer(struct pipe_context *pipe,
+                             struct pipe_resource *dst, unsigned dst_offset,
+                             struct pipe_resource *src, unsigned src_offset,
+                             unsigned size)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        if (!size || (dst_offset | src_offset | size) & 3)
+                return false;
+
+        void *shader = panfrost_get_compute_copy_buffer_shader(ctx);
+        if (!shader)
+                return false;
+
+        struct panfrost_compute_save save;
+        panfrost_compute_save_state(ctx, &save);
+
+        uint32_t params[4] = { size / 4 };
+
+        struct pipe_constant_buffer cb = {
+                .buffer_size = sizeof(params),
+                .user_buffer = params,
+        };
+        pipe->set_constant_buffer(pipe, st, 0, false, &cb);
+
+        struct pipe_shader_buffer ssbos[2] = {
+                {
+                        .buffer = dst,
+                        .buffer_offset = dst_offset,
+                        .buffer_size = size,
+                },
+                {
+                        .buffer = src,
+                        .buffer_offset = src_offset,
+                        .buffer_size = size,
+                },
+        };
+        pipe->set_shader_buffers(pipe, st, 0, 2, ssbos, BITFIELD_BIT(0));
+        pipe->bind_compute_state(pipe, shader);
+
+        struct pipe_grid_info grid = {
+                .block = { PAN_COMPUTE_FILL_WG_SIZE, 1, 1 },
+                .grid = { DIV_ROUND_UP(size / 4, PAN_COMPUTE_FILL_WG_SIZE), 1, 1 },
+        };
+        pipe->launch_grid(pipe, &grid);
+
+        panfrost_compute_restore_state(ctx, &save);
+        return true;
+}
+
+/* Occlusion query results are summed over the cores and written to a buffer
+ * by a compute shader, so that reading them into a buffer neither waits for
+ * the query on the CPU nor flushes the batch writing it: the batch of the
+ * shader is just ordered after it. The counters are 64-bit, added 32 bits at
+ * a time. */
+
+static void *
+panfrost_get_compute_query_shader(struct panfrost_context *ctx)
+{
+        if (ctx->compute_query.shader)
+                return ctx->compute_query.shader;
+
+        struct pipe_screen *screen = ctx->base.screen;
+        const nir_shader_compiler_options *options =
+                screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                             PIPE_SHADER_COMPUTE);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                               "panfrost_compute_query");
+
+        b.shader->info.workgroup_size[0] = 1;
+        b.shader->info.workgroup_size[1] = 1;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ubos = 1;
+        b.shader->info.num_ssbos = 2;
+
+        /* Parameters: counters to sum and PAN_QUERY_RESULT flags */
+        nir_ssa_def *params = nir_load_ubo(&b, 2, 32, nir_imm_int(&b, 0),
+                                           nir_imm_int(&b, 0),
+                                           .align_mul = 16, .range = 16);
+        nir_ssa_def *count = nir_channel(&b, params, 0);
+        nir_ssa_def *flags = nir_channel(&b, params, 1);
+
+        nir_variable *lo_var =
+                nir_local_variable_create(b.impl, glsl_uint_type(), "lo");
+        nir_variable *hi_var =
+                nir_local_variable_create(b.impl, glsl_uint_type(), "hi");
+        nir_variable *idx_var =
+                nir_local_variable_create(b.impl, glsl_uint_type(), "idx");
+
+        nir_store_var(&b, lo_var, nir_imm_int(&b, 0), 1);
+        nir_store_var(&b, hi_var, nir_imm_int(&b, 0), 1);
+        nir_store_var(&b, idx_var, nir_imm_int(&b, 0), 1);
+
+        nir_loop *loop = nir_push_loop(&b);
+        {
+                nir_ssa_def *idx = nir_load_var(&b, idx_var);
+
+                nir_push_if(&b, nir_uge(&b, idx, count));
+                nir_jump(&b, nir_jump_break);
+                nir_pop_if(&b, NULL);
+
+                nir_ssa_def *counter =
+                        nir_load_ssbo(&b, 2, 32, nir_imm_int(&b, 0),
+                                      nir_ishl_imm(&b, idx, 3),
+                                      .align_mul = 8);
+                nir_ssa_def *counter_lo = nir_channel(&b, counter, 0);
+                nir_ssa_def *lo =
+                        nir_iadd(&b, nir_load_var(&b, lo_var), counter_lo);
+                nir_ssa_def *carry = nir_b2i32(&b, nir_ult(&b, lo, counter_lo));
+                nir_ssa_def *hi =
+                        nir_iadd(&b, nir_load_var(&b, hi_var),
+                                 nir_iadd(&b, nir_channel(&b, counter, 1), carry));
+
+                nir_store_var(&b, lo_var, lo, 1);
+                nir_store_var(&b, hi_var, hi, 1);
+                nir_store_var(&b, idx_var, nir_iadd_imm(&b, idx, 1), 1);
+        }
+        nir_pop_loop(&b, loop);
+
+        nir_ssa_def *lo = nir_load_var(&b, lo_var);
+        nir_ssa_def *hi = nir_load_var(&b, hi_var);
+
+        /* Midgard counts four samples per pixel of single-sampled targets */
+        nir_ssa_def *quarter = nir_test_mask(&b, flags, PAN_QUERY_RESULT_QUARTER);
+        lo = nir_bcsel(&b, quarter,
+                       nir_ior(&b, nir_ushr_imm(&b, lo, 2), nir_ishl_imm(&b, hi, 30)),
+                       lo);
+        hi = nir_bcsel(&b, quarter, nir_ushr_imm(&b, hi, 2), hi);
+
+        nir_ssa_def *passed = nir_b2i32(&b, nir_ine_imm(&b, nir_ior(&b, lo, hi), 0));
+        nir_ssa_def *boolean = nir_test_mask(&b, flags, PAN_QUERY_RESULT_BOOLEAN);
+        lo = nir_bcsel(&b, boolean, passed, lo);
+        hi = nir_bcsel(&b, boolean, nir_imm_int(&b, 0), hi);
+
+        /* The shader runs after the query is done, so it is available */
+        nir_ssa_def *avail = nir_test_mask(&b, flags, PAN_QUERY_RESULT_AVAILABILITY);
+        lo = nir_bcsel(&b, avail, nir_imm_int(&b, 1), lo);
+        hi = nir_bcsel(&b, avail, nir_imm_int(&b, 0), hi);
+
+        nir_push_if(&b, nir_test_mask(&b, flags, PAN_QUERY_RESULT_64BIT));
+        {
+                nir_store_ssbo(&b, nir_vec2(&b, lo, hi), nir_imm_int(&b, 1),
+                               nir_imm_int(&b, 0),
+                               .access = ACCESS_NON_READABLE,
+                               .align_mul = 4);
+        }
+        nir_push_else(&b, NULL);
+        {
+                /* 32-bit results saturate */
+                nir_ssa_def *max =
+                        nir_bcsel(&b, nir_test_mask(&b, flags, PAN_QUERY_RESULT_SIGNED),
+                                  nir_imm_int(&b, INT32_MAX),
+                                  nir_imm_int(&b, UINT32_MAX));
+                nir_ssa_def *value =
+                        nir_bcsel(&b, nir_ine_imm(&b, hi, 0), max,
+                                  nir_umin(&b, lo, max));
+
+                nir_store_ssbo(&b, value, nir_imm_int(&b, 1),
+                               nir_imm_int(&b, 0),
+                               .access = ACCESS_NON_READABLE,
+                               .align_mul = 4);
+        }
+        nir_pop_if(&b, NULL);
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+        };
+
+        ctx->compute_query.shader =
+                ctx->base.create_compute_state(&ctx->base, &cso);
+        ralloc_free(b.shader);
+
+        return ctx->compute_query.shader;
+}
+
+bool
+panfrost_compute_query_result(struct pipe_context *pipe,
+                              struct pipe_resource *counters,
+                              unsigned count, unsigned flags,
+                              struct pipe_resource *dst, unsigned offset)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        if (offset & 3)
+                return false;
+
+        void *shader = panfrost_get_compute_query_shader(ctx);
+        if (!shader)
+                return false;
+
+        struct panfrost_compute_save save;
+        panfrost_compute_save_state(ctx, &save);
+
+        uint32_t params[4] = { count, flags };
+
+        struct pipe_constant_buffer cb = {
+                .buffer_size = sizeof(params),
+                .user_buffer = params,
+        };
+        pipe->set_constant_buffer(pipe, st, 0, false, &cb);
+
+        struct pipe_shader_buffer ssbos[] = {
+                {
+                        .buffer = counters,
+                        .buffer_size = count * sizeof(uint64_t),
+                },
+                {
+                        .buffer = dst,
+                        .buffer_offset = offset,
+                        .buffer_size = (flags & PAN_QUERY_RESULT_64BIT) ? 8 : 4,
+                },
+        };
+        pipe->set_shader_buffers(pipe, st, 0, 2, ssbos, BITFIELD_BIT(1));
+        pipe->bind_compute_state(pipe, shader);
+
+        struct pipe_grid_info grid = {
+                .block = { 1, 1, 1 },
+                .grid = { 1, 1, 1 },
+        };
+        pipe->launch_grid(pipe, &grid);
+
+        panfrost_compute_restore_state(ctx, &save);
+        return true;
+}
+
+/* Mipmaps are generated by a downsampler in the style of AMD's single pass
+ * downsampler: each workgroup filters a 16x16 tile of the source level into
+ * the 8x8 texels of the next level, then keeps reducing them through shared
+ * memory, writing up to four levels per dispatch. Workgroups never wait for
+ * each other, so a dispatch stops at the level where a workgroup's tile is a
+ * single texel, and the next dispatch starts from there. */
+
+#define PAN_MIPMAP_WG_SIZE 8
+#define PAN_MIPMAP_LEVELS_PER_PASS 4
+
+static void *
+panfrost_get_compute_mipmap_shader(struct panfrost_context *ctx)
+{
+        if (ctx->compute_mipmap.shader)
+                return ctx->compute_mipmap.shader;
+
+        struct pipe_screen *screen = ctx->base.screen;
+        const nir_shader_compiler_options *options =
+                screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                             PIPE_SHADER_COMPUTE);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                               "panfrost_compute_mipmap");
+
+        b.shader->info.workgroup_size[0] = PAN_MIPMAP_WG_SIZE;
+        b.shader->info.workgroup_size[1] = PAN_MIPMAP_WG_SIZE;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.shared_size =
+                PAN_MIPMAP_WG_SIZE * PAN_MIPMAP_WG_SIZE * 16;
+        b.shader->info.num_ubos = 1;
+        b.shader->info.num_textures = 1;
+        b.shader->info.num_images = PAN_MIPMAP_LEVELS_PER_PASS;
+        BITSET_SET(b.shader->info.textures_used, 0);
+        BITSET_SET_RANGE(b.shader->info.images_used, 0,
+                         PAN_MIPMAP_LEVELS_PER_PASS - 1);
+
+        /* Parameters: the size of each level written, then the number of
+         * levels written */
+        nir_ssa_def *sizes[PAN_MIPMAP_LEVELS_PER_PASS];
+        for (unsigned k = 0; k < PAN_MIPMAP_LEVELS_PER_PASS; ++k) {
+                sizes[k] = nir_load_ubo(&b, 2, 32, nir_imm_int(&b, 0),
+                                        nir_imm_int(&b, k * 8),
+                                        .align_mul = 8, .range = 48);
+        }
+
+        nir_ssa_def *nr_levels = nir_load_ubo(&b, 1, 32, nir_imm_int(&b, 0),
+                                              nir_imm_int(&b, 32),
+                                              .align_mul = 16, .range = 48);
+
+        nir_ssa_def *lid = nir_channels(&b, nir_load_local_invocation_id(&b), 0x3);
+        nir_ssa_def *wg = nir_channels(&b, nir_load_workgroup_id(&b, 32), 0x3);
+
+        /* First level: bilinear filter of the source at the centre of each
+         * texel, averaging the 2x2 source texels it covers */
+        nir_ssa_def *coord =
+                nir_iadd(&b, nir_imul_imm(&b, wg, PAN_MIPMAP_WG_SIZE), lid);
+        nir_ssa_def *uv =
+                nir_fdiv(&b, nir_fadd_imm(&b, nir_u2f32(&b, coord), 0.5),
+                         nir_u2f32(&b, sizes[0]));
+
+        nir_tex_instr *tex = nir_tex_instr_create(b.shader, 2);
+        tex->op = nir_texop_txl;
+        tex->dest_type = nir_type_float32;
+        tex->texture_index = 0;
+        tex->sampler_index = 0;
+        tex->sampler_dim = GLSL_SAMPLER_DIM_2D;
+        tex->src[0].src_type = nir_tex_src_coord;
+        tex->src[0].src = nir_src_for_ssa(uv);
+        tex->src[1].src_type = nir_tex_src_lod;
+        tex->src[1].src = nir_src_for_ssa(nir_imm_float(&b, 0.0));
+        tex->coord_components = 2;
+        nir_ssa_dest_init(&tex->instr, &tex->dest, 4, 32, NULL);
+        nir_builder_instr_insert(&b, &tex->instr);
+
+        nir_ssa_def *color = &tex->dest.ssa;
+
+        for (unsigned k = 0; k < PAN_MIPMAP_LEVELS_PER_PASS; ++k) {
+                unsigned tile = PAN_MIPMAP_WG_SIZE >> k;
+
+                if (k) {
+                        /* Share the texels of the previous level, then
+                         * average 2x2 of them, clamped to the level */
+                        nir_ssa_def *prev_origin =
+                                nir_imul_imm(&b, wg, tile * 2);
+                        nir_ssa_def *limit =
+                                nir_isub(&b, nir_iadd_imm(&b, sizes[k - 1], -1),
+                                         prev_origin);
+
+                        nir_store_shared(&b, color,
+                                         nir_imul_imm(&b,
+                                                      nir_iadd(&b, nir_channel(&b, lid, 0),
+                                                               nir_imul_imm(&b, nir_channel(&b, lid, 1),
+                                                                            PAN_MIPMAP_WG_SIZE)),
+                                                      16),
+                                         .align_mul = 16);
+                        nir_memory_barrier_shared(&b);
+                        nir_control_barrier(&b);
+
+                        nir_ssa_def *sum = NULL;
+
+                        for (unsigned d = 0; d < 4; ++d) {
+                                nir_ssa_def *p =
+                                        nir_iadd(&b, nir_imul_imm(&b, lid, 2),
+                                                 nir_imm_ivec2(&b, d & 1, d >> 1));
+                                p = nir_imax(&b, nir_imin(&b, p, limit),
+                                             nir_imm_ivec2(&b, 0, 0));
+
+                                nir_ssa_def *offs =
+                                        nir_imul_imm(&b,
+                                                     nir_iadd(&b, nir_channel(&b, p, 0),
+                                                              nir_imul_imm(&b, nir_channel(&b, p, 1),
+                                                                           PAN_MIPMAP_WG_SIZE)),
+                                                     16);
+                                nir_ssa_def *texel =
+                                        nir_load_shared(&b, 4, 32, offs,
+                                                        .align_mul = 16);
+
+                                sum = sum ? nir_fadd(&b, sum, texel) : texel;
+                        }
+
+                        color = nir_fmul_imm(&b, sum, 0.25);
+                        nir_memory_barrier_shared(&b);
+                        nir_control_barrier(&b);
+
+                        coord = nir_iadd(&b, nir_imul_imm(&b, wg, tile), lid);
+                }
+
+                nir_ssa_def *active =
+                        nir_iand(&b, nir_ball(&b, nir_ult(&b, lid, nir_imm_ivec2(&b, tile, tile))),
+                                 nir_ball(&b, nir_ult(&b, coord, sizes[k])));
+                active = nir_iand(&b, active, nir_ult(&b, nir_imm_int(&b, k), nr_levels));
+
+                nir_push_if(&b, active);
+                {
+                        nir_image_store(&b, nir_imm_int(&b, k),
+                                        nir_pad_vector_imm_int(&b, coord, 0, 4),
+                                        nir_ssa_undef(&b, 1, 32), color,
+                                        nir_imm_int(&b, 0),
+                                        .image_dim = GLSL_SAMPLER_DIM_2D,
+                                        .access = ACCESS_NON_READABLE,
+                                        .src_type = nir_type_float32);
+                }
+                nir_pop_if(&b, NULL);
+        }
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+        };
+
+        ctx->compute_mipmap.shader =
+                ctx->base.create_compute_state(&ctx->base, &cso);
+        ralloc_free(b.shader);
+
+        return ctx->compute_mipmap.shader;
+}
+
+bool
+panfrost_compute_mipmap(struct pipe_context *pipe,
+                        struct pipe_resource *prsrc,
+                        enum pipe_format format,
+                        unsigned base_level, unsigned last_level,
+                        unsigned first_layer, unsigned last_layer)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        struct panfrost_device *dev = pan_device(pipe->screen);
+        enum pipe_shader_type st = PIPE_SHADER_COMPUTE;
+
+        /* The stored texels are filtered as floats, in linear space */
+        if (dev->arch < 6 || prsrc->target != PIPE_TEXTURE_2D ||
+            first_layer || last_layer ||
+            util_format_is_srgb(format) || util_format_is_pure_integer(format) ||
+            !panfrost_can_compute_store(pipe->screen, prsrc, format,
+                                        PIPE_BIND_SAMPLER_VIEW))
+                return false;
+
+        void *shader = panfrost_get_compute_mipmap_shader(ctx);
+        if (!shader)
+                return false;
+
+        if (!ctx->compute_mipmap.sampler) {
+                struct pipe_sampler_state sampler = {
+                        .wrap_s = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .wrap_t = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .wrap_r = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .min_img_filter = PIPE_TEX_FILTER_LINEAR,
+                        .mag_img_filter = PIPE_TEX_FILTER_LINEAR,
+                };
+
+                ctx->compute_mipmap.sampler =
+                        pipe->create_sampler_state(pipe, &sampler);
+        }
+
+        struct panfrost_compute_save save;
+        panfrost_compute_save_state(ctx, &save);
+
+        pipe->bind_sampler_states(pipe, st, 0, 1, &ctx->compute_mipmap.sampler);
+        pipe->bind_compute_state(pipe, shader);
+
+        for (unsigned level = base_level; level < last_level;
+             level += PAN_MIPMAP_LEVELS_PER_PASS) {
+                unsigned nr_levels = MIN2(last_level - level,
+                                          PAN_MIPMAP_LEVELS_PER_PASS);
+                uint32_t params[12] = { 0 };
+                struct pipe_image_view images[PAN_MIPMAP_LEVELS_PER_PASS] = { 0 };
+
+                for (unsigned k = 0; k < nr_levels; ++k) {
+                        params[k * 2 + 0] = u_minify(prsrc->width0, level + k + 1);
+                        params[k * 2 + 1] = u_minify(prsrc->height0, level + k + 1);
+
+                        images[k] = (struct pipe_image_view) {
+                                .resource = prsrc,
+                                .format = format,
+                                .access = PIPE_IMAGE_ACCESS_WRITE,
+                                .shader_access = PIPE_IMAGE_ACCESS_WRITE,
+                                .u.tex.level = level + k + 1,
+                        };
+                }
+
+                params[8] = nr_levels;
+
+                struct pipe_constant_buffer cb = {
+                        .buffer_size = sizeof(params),
+                        .user_buffer = params,
+                };
+                pipe->set_constant_buffer(pipe, st, 0, false, &cb);
+                pipe->set_shader_images(pipe, st, 0, nr_levels,
+                                        PAN_MIPMAP_LEVELS_PER_PASS - nr_levels,
+                                        images);
+
+                struct pipe_sampler_view templ;
+                u_sampler_view_default_template(&templ, prsrc, format);
+                templ.u.tex.first_level = templ.u.tex.last_level = level;
+
+                struct pipe_sampler_view *view =
+                        pipe->create_sampler_view(pipe, prsrc, &templ);
+                pipe->set_sampler_views(pipe, st, 0, 1, 0, true, &view);
+
+                struct pipe_grid_info grid = {
+                        .block = { PAN_MIPMAP_WG_SIZE, PAN_MIPMAP_WG_SIZE, 1 },
+                        .grid = {
+                                DIV_ROUND_UP(params[0], PAN_MIPMAP_WG_SIZE),
+                                DIV_ROUND_UP(params[1], PAN_MIPMAP_WG_SIZE),
+                                1
+                        },
+                };
+                pipe->launch_grid(pipe, &grid);
+        }
+
+        panfrost_compute_restore_state(ctx, &save);
+        return true;
 }
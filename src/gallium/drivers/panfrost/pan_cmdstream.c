@@ -32,6 +32,9 @@
 #include "util/u_draw.h"
 #include "util/u_memory.h"
 #include "util/u_viewport.h"
+#include "util/u_atomic.h"
+#define XXH_INLINE_ALL
+#include "util/xxhash.h"
 #include "pipe/p_defines.h"
 #include "pipe/p_state.h"
 #include "gallium/auxiliary/util/u_blend.h"
@@ -60,6 +63,12 @@ struct panfrost_rasterizer {
         struct mali_multisample_misc_packed multisample;
         struct mali_stencil_mask_misc_packed stencil_misc;
 #endif
+
+#if PAN_ARCH <= 9
+        /* DRAW fields that only depend on the rasterizer, indexed by whether
+         * the primitive is a polygon */
+        struct mali_draw_packed draw[2];
+#endif
 };
 
 struct panfrost_zsa_state {
@@ -108,6 +117,14 @@ struct panfrost_sampler_view {
         struct panfrost_pool *pool;
 };
 
+#if PAN_ARCH < 9
+struct panfrost_vertex_divisor {
+        unsigned hw_divisor;
+        unsigned shift, extra_flags;
+        unsigned magic;
+};
+#endif
+
 struct panfrost_vertex_state {
         unsigned num_elements;
         struct pipe_vertex_element pipe[PIPE_MAX_ATTRIBS];
@@ -125,6 +142,12 @@ struct panfrost_vertex_state {
         unsigned nr_bufs;
 
         unsigned formats[PIPE_MAX_ATTRIBS];
+
+        /* Magic divisor of each buffer for the hardware divisor it was last
+         * computed for. The hardware divisor depends on the padded vertex
+         * count of the draw, which repeated instanced draws of a mesh keep
+         * the same, so the division is only redone when it changes. */
+        struct panfrost_vertex_divisor divisors[PIPE_MAX_ATTRIBS];
 #endif
 };
 
@@ -207,7 +230,7 @@ pan_pipe_to_mipmode(enum pipe_tex_mipfilter f)
 
 
 static void *
-panfrost_create_sampler_state(
+panfrost_pack_sampler_state(
         struct pipe_context *pctx,
         const struct pipe_sampler_state *cso)
 {
@@ -254,6 +277,23 @@ panfrost_create_sampler_state(
         return so;
 }
 
+static void *
+panfrost_create_sampler_state(struct pipe_context *pctx,
+                              const struct pipe_sampler_state *cso)
+{
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+        void *so = panfrost_cso_store_get(screen, PAN_CSO_SAMPLER,
+                                          cso, sizeof(*cso));
+
+        if (!so) {
+                so = panfrost_cso_store_add(screen, PAN_CSO_SAMPLER,
+                                            cso, sizeof(*cso),
+                                            panfrost_pack_sampler_state(pctx, cso));
+        }
+
+        return so;
+}
+
 static bool
 panfrost_fs_required(
                 struct panfrost_compiled_shader *fs,
@@ -279,9 +319,10 @@ panfrost_fs_required(
                         return true;
         }
 
-        /* If depth is written and not implied we need to execute.
-         * TODO: Predicate on Z/S writes being enabled */
-        return (fs->info.fs.writes_depth || fs->info.fs.writes_stencil);
+        /* If depth or stencil is computed by the shader and used by the
+         * depth/stencil state, we need to execute */
+        return (fs->info.fs.writes_depth && zsa->base.depth_enabled) ||
+               (fs->info.fs.writes_stencil && zsa->base.stencil[0].enabled);
 }
 
 /* Get pointers to the blend shaders bound to each active render target. Used
@@ -299,6 +340,9 @@ panfrost_get_blend_shaders(struct panfrost_batch *batch,
                 if (batch->key.cbufs[c]) {
                         blend_shaders[c] = panfrost_get_blend(batch,
                                         c, &shader_bo, &shader_offset);
+
+                        if (blend_shaders[c])
+                                batch->ctx->blend_shaders++;
                 }
         }
 
@@ -374,13 +418,16 @@ panfrost_emit_blend(struct panfrost_batch *batch, void *rts, mali_ptr *blend_sha
 
                 struct pan_blend_info info = so->info[i];
                 enum pipe_format format = batch->key.cbufs[i]->format;
+
+                /* Blending done by the fragment shader leaves a plain store */
+                bool shader_blends = panfrost_fs_blends_rt(ctx, i);
                 float cons = pan_blend_get_constant(info.constant_mask,
                                                     ctx->blend_color.color);
 
                 /* Word 0: Flags and constant */
                 pan_pack(packed, BLEND, cfg) {
                         cfg.srgb = util_format_is_srgb(format);
-                        cfg.load_destination = info.load_dest;
+                        cfg.load_destination = info.load_dest && !shader_blends;
                         cfg.round_to_fb_precision = !dithered;
                         cfg.alpha_to_one = ctx->blend->base.alpha_to_one;
 #if PAN_ARCH >= 6
@@ -399,7 +446,10 @@ panfrost_emit_blend(struct panfrost_batch *batch, void *rts, mali_ptr *blend_sha
                 if (!blend_shaders[i]) {
                         /* Word 1: Blend Equation */
                         STATIC_ASSERT(pan_size(BLEND_EQUATION) == 4);
-                        packed->opaque[PAN_ARCH >= 6 ? 1 : 2] = so->equation[i];
+                        packed->opaque[PAN_ARCH >= 6 ? 1 : 2] = shader_blends ?
+                                pan_pack_blend((struct pan_blend_equation) {
+                                                .color_mask = 0xF }) :
+                                so->equation[i];
                 }
 
 #if PAN_ARCH >= 6
@@ -431,7 +481,9 @@ panfrost_emit_blend(struct panfrost_batch *batch, void *rts, mali_ptr *blend_sha
                         }
                 } else {
                         pan_pack(&packed->opaque[2], INTERNAL_BLEND, cfg) {
-                                cfg.mode = info.opaque ?
+                                bool opaque = info.opaque || shader_blends;
+
+                                cfg.mode = opaque ?
                                         MALI_BLEND_MODE_OPAQUE :
                                         MALI_BLEND_MODE_FIXED_FUNCTION;
 
@@ -444,7 +496,7 @@ panfrost_emit_blend(struct panfrost_batch *batch, void *rts, mali_ptr *blend_sha
                                 cfg.fixed_function.rt = i;
 
 #if PAN_ARCH <= 7
-                                if (!info.opaque) {
+                                if (!opaque) {
                                         cfg.fixed_function.alpha_zero_nop = info.alpha_zero_nop;
                                         cfg.fixed_function.alpha_one_store = info.alpha_one_store;
                                 }
@@ -704,35 +756,122 @@ panfrost_emit_frag_shader(struct panfrost_context *ctx,
         memcpy(fragmeta, &rsd, sizeof(rsd));
 }
 
-static mali_ptr
-panfrost_emit_frag_shader_meta(struct panfrost_batch *batch)
+/* Fills the key of the RSD for the current state, returning false if the
+ * RSD can't be cached */
+static bool
+panfrost_get_rsd_key(struct panfrost_batch *batch, mali_ptr *blend_shaders,
+                     struct panfrost_rsd_key *key)
 {
         struct panfrost_context *ctx = batch->ctx;
-        struct panfrost_compiled_shader *ss = ctx->prog[PIPE_SHADER_FRAGMENT];
+        struct panfrost_compiled_shader *fs = ctx->prog[PIPE_SHADER_FRAGMENT];
 
-        panfrost_batch_add_bo(batch, ss->bin.bo, PIPE_SHADER_FRAGMENT);
+        if (!fs->bin.gpu)
+                return false;
+
+        for (unsigned c = 0; c < batch->key.nr_cbufs; ++c) {
+                if (blend_shaders[c])
+                        return false;
+        }
+
+        memset(key, 0, sizeof(*key));
+
+        key->fs_binary = fs->bin.gpu;
+        key->blend = ctx->blend;
+        key->zsa = ctx->depth_stencil;
+        key->rast = ctx->rasterizer;
+        key->blend_color = ctx->blend_color;
+        key->stencil_ref = ctx->stencil_ref;
+        key->nr_cbufs = ctx->pipe_framebuffer.nr_cbufs;
+        key->sample_mask = ctx->sample_mask;
+        key->min_samples = ctx->min_samples;
+        key->fb_rt_mask = ctx->fb_rt_mask;
+        key->has_oq = ctx->occlusion_query && ctx->active_queries;
+
+        for (unsigned c = 0; c < key->nr_cbufs; ++c) {
+                struct pipe_surface *surf = ctx->pipe_framebuffer.cbufs[c];
+                key->formats[c] = surf ? surf->format : PIPE_FORMAT_NONE;
+        }
 
-        struct panfrost_ptr xfer;
+        return true;
+}
 
+static struct panfrost_ptr
+panfrost_alloc_frag_shader_meta(struct panfrost_context *ctx,
+                                struct pan_pool *pool)
+{
 #if PAN_ARCH == 4
-        xfer = pan_pool_alloc_desc(&batch->pool.base, RENDERER_STATE);
+        return pan_pool_alloc_desc(pool, RENDERER_STATE);
 #else
         unsigned rt_count = MAX2(ctx->pipe_framebuffer.nr_cbufs, 1);
 
-        xfer = pan_pool_alloc_desc_aggregate(&batch->pool.base,
+        return pan_pool_alloc_desc_aggregate(pool,
                                              PAN_DESC(RENDERER_STATE),
                                              PAN_DESC_ARRAY(rt_count, BLEND));
 #endif
+}
+
+static mali_ptr
+panfrost_emit_frag_shader_meta(struct panfrost_batch *batch)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_compiled_shader *ss = ctx->prog[PIPE_SHADER_FRAGMENT];
+
+        panfrost_batch_add_bo(batch, ss->bin.bo, PIPE_SHADER_FRAGMENT);
 
         mali_ptr blend_shaders[PIPE_MAX_COLOR_BUFS] = { 0 };
         panfrost_get_blend_shaders(batch, blend_shaders);
 
+        /* Applications switching between a few materials keep producing the
+         * same RSDs, so look for one uploaded by an earlier draw */
+        struct panfrost_rsd_key key;
+        bool cacheable = panfrost_get_rsd_key(batch, blend_shaders, &key);
+
+        if (cacheable) {
+                uint32_t epoch =
+                        p_atomic_read(&pan_screen(ctx->base.screen)->rsd_cache_epoch);
+
+                /* Shared state an entry may point to was freed */
+                if (unlikely(epoch != ctx->rsd_cache_epoch)) {
+                        panfrost_rsd_cache_clear(ctx);
+                        ctx->rsd_cache_epoch = epoch;
+                }
+
+                struct hash_entry *entry =
+                        _mesa_hash_table_search(ctx->rsd_cache, &key);
+
+                if (entry) {
+                        struct panfrost_rsd_cache_entry *e = entry->data;
+
+                        panfrost_batch_add_bo(batch, e->ref.bo,
+                                              PIPE_SHADER_FRAGMENT);
+                        return e->ref.gpu;
+                }
+
+                if (ctx->rsd_cache->entries >= PAN_RSD_CACHE_SIZE)
+                        panfrost_rsd_cache_clear(ctx);
+        }
+
+        /* Without memory for the entry, upload to the batch as usual */
+        struct panfrost_rsd_cache_entry *e =
+                cacheable ? malloc(sizeof(*e)) : NULL;
+
+        struct pan_pool *pool = e ? &ctx->descs.base : &batch->pool.base;
+        struct panfrost_ptr xfer = panfrost_alloc_frag_shader_meta(ctx, pool);
+
         panfrost_emit_frag_shader(ctx, (struct mali_renderer_state_packed *) xfer.cpu, blend_shaders);
 
 #if PAN_ARCH >= 5
         panfrost_emit_blend(batch, xfer.cpu + pan_size(RENDERER_STATE), blend_shaders);
 #endif
 
+        if (e) {
+                e->key = key;
+                e->ref = panfrost_pool_take_ref(&ctx->descs, xfer.gpu);
+                _mesa_hash_table_insert(ctx->rsd_cache, &e->key, e);
+
+                panfrost_batch_add_bo(batch, e->ref.bo, PIPE_SHADER_FRAGMENT);
+        }
+
         return xfer.gpu;
 }
 #endif
@@ -893,66 +1032,87 @@ panfrost_emit_blend_valhall(struct panfrost_batch *batch)
         return T.gpu;
 }
 
-/**
- * Emit Valhall buffer descriptors for bound vertex buffers at draw-time.
+/*
+ * Emit the attribute and vertex buffer tables, reusing tables uploaded by
+ * earlier draws with the same vertex elements and vertex buffer bindings.
+ * Draw-call bound applications rebind the same few vertex arrays over and
+ * over, so the tables are kept in the descs pool across batches.
  */
-static mali_ptr
-panfrost_emit_vertex_buffers(struct panfrost_batch *batch)
+static void
+panfrost_emit_vertex_tables(struct panfrost_batch *batch)
 {
         struct panfrost_context *ctx = batch->ctx;
-        unsigned buffer_count = util_last_bit(ctx->vb_mask);
-        struct panfrost_ptr T = pan_pool_alloc_desc_array(&batch->pool.base,
-                                                          buffer_count, BUFFER);
-        struct mali_buffer_packed *buffers = T.cpu;
+        struct panfrost_vertex_key key;
+
+        memset(&key, 0, sizeof(key));
+        key.vtx = ctx->vertex;
+        key.vb_mask = ctx->vb_mask;
 
         u_foreach_bit(i, ctx->vb_mask) {
-                struct pipe_vertex_buffer vb = ctx->vertex_buffers[i];
-                struct pipe_resource *prsrc = vb.buffer.resource;
-                struct panfrost_resource *rsrc = pan_resource(prsrc);
-                assert(!vb.is_user_buffer);
+                struct pipe_vertex_buffer *vb = &ctx->vertex_buffers[i];
+                struct panfrost_resource *rsrc = pan_resource(vb->buffer.resource);
+                assert(!vb->is_user_buffer);
 
                 panfrost_batch_read_rsrc(batch, rsrc, PIPE_SHADER_VERTEX);
 
-                pan_pack(buffers + i, BUFFER, cfg) {
-                        cfg.address = rsrc->image.data.bo->ptr.gpu +
-                                      vb.buffer_offset;
-
-                        cfg.size = prsrc->width0 - vb.buffer_offset;
-                }
+                key.buffers[i].address = rsrc->image.data.bo->ptr.gpu +
+                                         vb->buffer_offset;
+                key.buffers[i].size = rsrc->base.width0 - vb->buffer_offset;
+                key.buffers[i].stride = vb->stride;
         }
 
-        return T.gpu;
-}
+        struct hash_entry *entry =
+                _mesa_hash_table_search(ctx->vertex_cache, &key);
+        struct panfrost_vertex_cache_entry *e;
 
-/**
- * Emit Valhall attribute descriptors and associated (vertex) buffer
- * descriptors at draw-time. The attribute descriptors are packed at draw time
- * except for the stride field. The buffer descriptors are packed here, though
- * that could be moved into panfrost_set_vertex_buffers if needed.
- */
-static mali_ptr
-panfrost_emit_vertex_data(struct panfrost_batch *batch)
-{
-        struct panfrost_context *ctx = batch->ctx;
-        struct panfrost_vertex_state *vtx = ctx->vertex;
-        struct panfrost_ptr T = pan_pool_alloc_desc_array(&batch->pool.base,
-                                                          vtx->num_elements,
-                                                          ATTRIBUTE);
-        struct mali_attribute_packed *attributes = T.cpu;
-
-        for (unsigned i = 0; i < vtx->num_elements; ++i) {
-                struct mali_attribute_packed packed;
-                unsigned vbi = vtx->pipe[i].vertex_buffer_index;
-
-                pan_pack(&packed, ATTRIBUTE, cfg) {
-                        cfg.stride = ctx->vertex_buffers[vbi].stride;
+        if (entry) {
+                e = entry->data;
+        } else {
+                if (ctx->vertex_cache->entries >= PAN_VERTEX_CACHE_SIZE)
+                        panfrost_vertex_cache_clear(ctx);
+
+                const struct panfrost_vertex_state *vtx = ctx->vertex;
+                unsigned buffer_count = util_last_bit(ctx->vb_mask);
+
+                struct panfrost_ptr T =
+                        pan_pool_alloc_desc_aggregate(&ctx->descs.base,
+                                                      PAN_DESC_ARRAY(MAX2(vtx->num_elements, 1), ATTRIBUTE),
+                                                      PAN_DESC_ARRAY(MAX2(buffer_count, 1), BUFFER));
+
+                struct mali_attribute_packed *attributes = T.cpu;
+                struct mali_buffer_packed *buffers =
+                        T.cpu + (MAX2(vtx->num_elements, 1) * pan_size(ATTRIBUTE));
+
+                for (unsigned i = 0; i < vtx->num_elements; ++i) {
+                        struct mali_attribute_packed packed;
+                        unsigned vbi = vtx->pipe[i].vertex_buffer_index;
+
+                        pan_pack(&packed, ATTRIBUTE, cfg) {
+                                cfg.stride = key.buffers[vbi].stride;
+                        }
+
+                        pan_merge(packed, vtx->attributes[i], ATTRIBUTE);
+                        attributes[i] = packed;
+                }
+
+                for (unsigned i = 0; i < buffer_count; ++i) {
+                        pan_pack(buffers + i, BUFFER, cfg) {
+                                cfg.address = key.buffers[i].address;
+                                cfg.size = key.buffers[i].size;
+                        }
                 }
 
-                pan_merge(packed, vtx->attributes[i], ATTRIBUTE);
-                attributes[i] = packed;
+                e = malloc(sizeof(*e));
+                e->key = key;
+                e->ref = panfrost_pool_take_ref(&ctx->descs, T.gpu);
+                e->buffers = T.gpu + (MAX2(vtx->num_elements, 1) * pan_size(ATTRIBUTE));
+                _mesa_hash_table_insert(ctx->vertex_cache, &e->key, e);
         }
 
-        return T.gpu;
+        panfrost_batch_add_bo(batch, e->ref.bo, PIPE_SHADER_VERTEX);
+
+        batch->attribs[PIPE_SHADER_VERTEX] = e->ref.gpu;
+        batch->attrib_bufs[PIPE_SHADER_VERTEX] = e->buffers;
 }
 
 /*
@@ -989,7 +1149,7 @@ panfrost_pipe_image_to_sampler_view(struct pipe_image_view *v)
         return out;
 }
 
-static void
+static bool
 panfrost_update_sampler_view(struct panfrost_sampler_view *view,
                              struct pipe_context *pctx);
 
@@ -1197,6 +1357,7 @@ panfrost_upload_ssbo_sysval(struct panfrost_batch *batch,
         struct panfrost_bo *bo = rsrc->image.data.bo;
 
         panfrost_batch_write_rsrc(batch, rsrc, st);
+        batch->storage_writes |= BITFIELD_BIT(st);
 
         util_range_add(&rsrc->base, &rsrc->valid_buffer_range,
                         sb.buffer_offset, sb.buffer_size);
@@ -1374,6 +1535,12 @@ panfrost_upload_sysvals(struct panfrost_batch *batch,
                         uniforms[i].u[0] = batch->ctx->vertex_count;
                         break;
 
+                case PAN_SYSVAL_XFB_INDICES:
+                        uniforms[i].du[0] = batch->ctx->xfb_indices;
+                        uniforms[i].u[2] = batch->ctx->xfb_index_size;
+                        uniforms[i].i[3] = batch->ctx->base_vertex;
+                        break;
+
                 case PAN_SYSVAL_NUM_WORK_GROUPS:
                         for (unsigned j = 0; j < 3; j++) {
                                 batch->num_wg_sysval[j] =
@@ -1429,12 +1596,59 @@ panfrost_upload_sysvals(struct panfrost_batch *batch,
                 case PAN_SYSVAL_DRAWID:
                         uniforms[i].u[0] = batch->ctx->drawid;
                         break;
+                case PAN_SYSVAL_BLEND_CONSTANTS:
+                        memcpy(uniforms[i].f, batch->ctx->blend_color.color,
+                               sizeof(uniforms[i].f));
+                        break;
                 default:
                         assert(0);
                 }
         }
 }
 
+/* Sysvals the GPU patches for indirect draws and dispatches are written
+ * through pointers into a given upload, so that upload can't be shared */
+
+static bool
+panfrost_sysvals_patched(struct panfrost_compiled_shader *ss)
+{
+        for (unsigned i = 0; i < ss->info.sysvals.sysval_count; ++i) {
+                switch (PAN_SYSVAL_TYPE(ss->info.sysvals.sysvals[i])) {
+                case PAN_SYSVAL_VERTEX_INSTANCE_OFFSETS:
+                case PAN_SYSVAL_NUM_WORK_GROUPS:
+                        return true;
+                default:
+                        break;
+                }
+        }
+
+        return false;
+}
+
+/* Upload to the batch pool, reusing the previous upload of the cache if it
+ * belongs to the same batch and has the same contents */
+
+static mali_ptr
+panfrost_upload_cached(struct panfrost_batch *batch,
+                       struct panfrost_upload_cache *cache,
+                       const void *data, size_t size)
+{
+        if (cache->seqnum == batch->seqnum && cache->size == size &&
+            !memcmp(cache->data, data, size))
+                return cache->gpu;
+
+        mali_ptr gpu = pan_pool_upload_aligned(&batch->pool.base, data,
+                                               size, 16);
+
+        assert(size <= sizeof(cache->data));
+        cache->seqnum = batch->seqnum;
+        cache->gpu = gpu;
+        cache->size = size;
+        memcpy(cache->data, data, size);
+
+        return gpu;
+}
+
 static const void *
 panfrost_map_constant_buffer_cpu(struct panfrost_context *ctx,
                                  struct panfrost_constant_buffer *buf,
@@ -1455,6 +1669,74 @@ panfrost_map_constant_buffer_cpu(struct panfrost_context *ctx,
                 unreachable("No constant buffer");
 }
 
+/* Get the mask of UBOs other than sysvals read by pushed words, if their
+ * contents are cached on the CPU. Returns false if any is a user buffer or
+ * may be written without the driver knowing, so the words must be read. */
+
+static bool
+panfrost_push_ubos_cacheable(struct panfrost_constant_buffer *buf,
+                             const struct panfrost_ubo_push *push,
+                             unsigned sysval_ubo, uint32_t *mask)
+{
+        *mask = 0;
+
+        for (unsigned i = 0; i < push->count; ++i) {
+                if (push->words[i].ubo != sysval_ubo)
+                        *mask |= BITFIELD_BIT(push->words[i].ubo);
+        }
+
+        u_foreach_bit(ubo, *mask) {
+                struct panfrost_resource *rsrc = pan_resource(buf->cb[ubo].buffer);
+
+                if (!rsrc || rsrc->persistent_write || !rsrc->contents_seqnum)
+                        return false;
+        }
+
+        return true;
+}
+
+static bool
+panfrost_push_gather_hit(struct panfrost_push_gather_cache *cache,
+                         struct panfrost_constant_buffer *buf,
+                         const struct panfrost_ubo_push *push, uint32_t mask)
+{
+        if (cache->push.count != push->count ||
+            memcmp(cache->push.words, push->words,
+                   push->count * sizeof(push->words[0])))
+                return false;
+
+        u_foreach_bit(ubo, mask) {
+                struct panfrost_resource *rsrc = pan_resource(buf->cb[ubo].buffer);
+
+                if (cache->ubos[ubo].rsrc != rsrc ||
+                    cache->ubos[ubo].offset != buf->cb[ubo].buffer_offset ||
+                    cache->ubos[ubo].seqnum != rsrc->contents_seqnum)
+                        return false;
+        }
+
+        return true;
+}
+
+static void
+panfrost_push_gather_update(struct panfrost_push_gather_cache *cache,
+                            struct panfrost_constant_buffer *buf,
+                            const struct panfrost_ubo_push *push, uint32_t mask,
+                            const uint32_t *words)
+{
+        cache->push.count = push->count;
+        memcpy(cache->push.words, push->words,
+               push->count * sizeof(push->words[0]));
+        memcpy(cache->words, words, push->count * sizeof(words[0]));
+
+        u_foreach_bit(ubo, mask) {
+                struct panfrost_resource *rsrc = pan_resource(buf->cb[ubo].buffer);
+
+                cache->ubos[ubo].rsrc = rsrc;
+                cache->ubos[ubo].offset = buf->cb[ubo].buffer_offset;
+                cache->ubos[ubo].seqnum = rsrc->contents_seqnum;
+        }
+}
+
 /* Emit a single UBO record. On Valhall, UBOs are dumb buffers and are
  * implemented with buffer descriptors in the resource table, sized in terms of
  * bytes. On Bifrost and older, UBOs have special uniform buffer data
@@ -1498,45 +1780,60 @@ panfrost_emit_const_buf(struct panfrost_batch *batch,
         if (!ss)
                 return 0;
 
-        /* Allocate room for the sysval and the uniforms */
         size_t sys_size = sizeof(float) * 4 * ss->info.sysvals.sysval_count;
-        struct panfrost_ptr transfer =
-                pan_pool_alloc_aligned(&batch->pool.base, sys_size, 16);
+        bool shared = !panfrost_sysvals_patched(ss);
         void *sys_cpu = malloc(sys_size);
 
-        /* Write to a shadow buffer to make pushing cheaper */
+        /* Write to a shadow buffer to make pushing cheaper. Patched sysvals
+         * need their final address while they are written. */
+        struct panfrost_ptr transfer = { 0 };
+
+        if (!shared)
+                transfer = pan_pool_alloc_aligned(&batch->pool.base, sys_size, 16);
+
         struct panfrost_ptr sys_shadow = {
                 .cpu = sys_cpu,
                 .gpu = transfer.gpu,
         };
 
-        /* Upload sysvals requested by the shader */
         panfrost_upload_sysvals(batch, &sys_shadow, ss, stage);
-        memcpy(transfer.cpu, sys_cpu, sys_size);
+
+        /* If the shader only reads sysvals through push constants, the sysval
+         * UBO isn't needed at all. Otherwise skip the upload when the previous
+         * draw of the batch used the same values. */
+        if (!shared)
+                memcpy(transfer.cpu, sys_cpu, sys_size);
+        else if (sys_size && !ss->info.sysvals_pushed)
+                transfer.gpu = panfrost_upload_cached(batch, &ctx->sysval_cache[stage],
+                                                      sys_cpu, sys_size);
 
         /* Next up, attach UBOs. UBO count includes gaps but no sysval UBO */
         struct panfrost_compiled_shader *shader = ctx->prog[stage];
         unsigned ubo_count = shader->info.ubo_count - (sys_size ? 1 : 0);
         unsigned sysval_ubo = sys_size ? ubo_count : ~0;
-        struct panfrost_ptr ubos = { 0 };
 
+        /* The descriptors are gathered on the CPU, so that a draw with the
+         * same UBO bindings as the previous one reuses its array, which
+         * then keeps the resource table the same on Valhall */
 #if PAN_ARCH >= 9
-        ubos = pan_pool_alloc_desc_array(&batch->pool.base,
-                                         ubo_count + 1,
-                                         BUFFER);
+        struct mali_buffer_packed ubo_descs[PAN_MAX_CONST_BUFFERS + 1];
 #else
-        ubos = pan_pool_alloc_desc_array(&batch->pool.base,
-                                         ubo_count + 1,
-                                         UNIFORM_BUFFER);
+        struct mali_uniform_buffer_packed ubo_descs[PAN_MAX_CONST_BUFFERS + 1];
 #endif
+        struct panfrost_ptr ubos = { .cpu = ubo_descs };
+
+        assert(ubo_count < ARRAY_SIZE(ubo_descs));
+        memset(ubo_descs, 0, (ubo_count + 1) * sizeof(ubo_descs[0]));
 
         if (buffer_count)
                 *buffer_count = ubo_count + (sys_size ? 1 : 0);
 
         /* Upload sysval as a final UBO */
 
-        if (sys_size)
-                panfrost_emit_ubo(ubos.cpu, ubo_count, transfer.gpu, sys_size);
+        if (sys_size) {
+                panfrost_emit_ubo(ubos.cpu, ubo_count, transfer.gpu,
+                                  transfer.gpu ? sys_size : 0);
+        }
 
         /* The rest are honest-to-goodness UBOs */
 
@@ -1552,6 +1849,10 @@ panfrost_emit_const_buf(struct panfrost_batch *batch,
                 panfrost_emit_ubo(ubos.cpu, ubo, address, usz);
         }
 
+        ubos.gpu = panfrost_upload_cached(batch, &ctx->ubo_cache[stage],
+                                          ubo_descs, (ubo_count + 1) *
+                                                     sizeof(ubo_descs[0]));
+
         if (pushed_words)
                 *pushed_words = ss->info.push.count;
 
@@ -1561,12 +1862,21 @@ panfrost_emit_const_buf(struct panfrost_batch *batch,
         }
 
         /* Copy push constants required by the shader */
-        struct panfrost_ptr push_transfer =
-                pan_pool_alloc_aligned(&batch->pool.base,
-                                       ss->info.push.count * 4, 16);
+        unsigned push_size = ss->info.push.count * 4;
+        struct panfrost_ptr push_transfer = { 0 };
+        uint32_t push_cpu[PAN_MAX_PUSH];
 
-        uint32_t *push_cpu = (uint32_t *) push_transfer.cpu;
-        *push_constants = push_transfer.gpu;
+        if (!shared) {
+                push_transfer = pan_pool_alloc_aligned(&batch->pool.base,
+                                                       push_size, 16);
+        }
+
+        struct panfrost_push_gather_cache *gather = &ctx->push_gather[stage];
+        uint32_t push_ubos = 0;
+        bool cacheable = panfrost_push_ubos_cacheable(buf, &ss->info.push,
+                                                      sysval_ubo, &push_ubos);
+        bool gathered = cacheable &&
+                panfrost_push_gather_hit(gather, buf, &ss->info.push, push_ubos);
 
         for (unsigned i = 0; i < ss->info.push.count; ++i) {
                 struct panfrost_ubo_word src = ss->info.push.words[i];
@@ -1605,6 +1915,12 @@ panfrost_emit_const_buf(struct panfrost_batch *batch,
                                 break;
                         }
                 }
+                /* Words from UBOs unchanged since the last draw are reused */
+                if (gathered && src.ubo != sysval_ubo) {
+                        push_cpu[i] = gather->words[i];
+                        continue;
+                }
+
                 /* Map the UBO, this should be cheap. However this is reading
                  * from write-combine memory which is _very_ slow. It might pay
                  * off to upload sysvals to a staging buffer on the CPU on the
@@ -1617,6 +1933,20 @@ panfrost_emit_const_buf(struct panfrost_batch *batch,
                 memcpy(push_cpu + i, (uint8_t *) mapped_ubo + src.offset, 4);
         }
 
+        if (cacheable && !gathered) {
+                panfrost_push_gather_update(gather, buf, &ss->info.push,
+                                            push_ubos, push_cpu);
+        }
+
+        if (shared) {
+                *push_constants = panfrost_upload_cached(batch,
+                                                         &ctx->push_cache[stage],
+                                                         push_cpu, push_size);
+        } else {
+                memcpy(push_transfer.cpu, push_cpu, push_size);
+                *push_constants = push_transfer.gpu;
+        }
+
         free(sys_cpu);
 
         return ubos.gpu;
@@ -1625,24 +1955,25 @@ panfrost_emit_const_buf(struct panfrost_batch *batch,
 /*
  * Choose the number of WLS instances to allocate. This must be a power-of-two.
  * The number of WLS instances limits the number of concurrent tasks on a given
- * shader core, setting to the (rounded) total number of tasks avoids any
- * throttling. Smaller values save memory at the expense of possible throttling.
+ * shader core. More instances than the core can keep resident, or than there
+ * are workgroups in the grid, only waste memory.
  *
- * With indirect dispatch, we don't know at launch-time how many tasks will be
- * needed, so we use a conservative value that's unlikely to cause slowdown in
- * practice without wasting too much memory.
+ * With indirect dispatch, the grid size isn't known at launch-time, so only
+ * the per-core limit applies.
  */
 static unsigned
-panfrost_choose_wls_instance_count(const struct pipe_grid_info *grid)
+panfrost_choose_wls_instance_count(struct panfrost_device *dev,
+                                   const struct pipe_grid_info *grid)
 {
-        if (grid->indirect) {
-                /* May need tuning in the future, conservative guess */
-                return 128;
-        } else {
-                return util_next_power_of_two(grid->grid[0]) *
-                       util_next_power_of_two(grid->grid[1]) *
-                       util_next_power_of_two(grid->grid[2]);
-        }
+        struct pan_compute_dim local_size = {
+                grid->block[0], grid->block[1], grid->block[2]
+        };
+        struct pan_compute_dim dim = {
+                grid->grid[0], grid->grid[1], grid->grid[2]
+        };
+
+        return pan_wls_instances(dev, &local_size,
+                                 grid->indirect ? NULL : &dim);
 }
 
 static mali_ptr
@@ -1658,7 +1989,7 @@ panfrost_emit_shared_memory(struct panfrost_batch *batch,
         struct pan_tls_info info = {
                 .tls.size = ss->info.tls_size,
                 .wls.size = ss->info.wls_size + grid->variable_shared_mem,
-                .wls.instances = panfrost_choose_wls_instance_count(grid),
+                .wls.instances = panfrost_choose_wls_instance_count(dev, grid),
         };
 
         if (ss->info.tls_size) {
@@ -1675,7 +2006,7 @@ panfrost_emit_shared_memory(struct panfrost_batch *batch,
                                 info.wls.instances * dev->core_id_range;
 
                 struct panfrost_bo *bo =
-                        panfrost_batch_get_shared_memory(batch, size, 1);
+                        panfrost_batch_get_shared_memory(batch, size);
 
                 info.wls.ptr = bo->ptr.gpu;
         }
@@ -1771,6 +2102,31 @@ panfrost_create_sampler_view_bo(struct panfrost_sampler_view *so,
                 .buf.size = buf_size,
         };
 
+        /* Short-lived views have their own pool, don't keep them alive */
+        struct panfrost_view_cache_key key;
+        bool cacheable = !so->pool;
+
+        if (cacheable) {
+                memset(&key, 0, sizeof(key));
+                key.bo = so->texture_bo;
+                key.modifier = so->modifier;
+                key.data_size = prsrc->image.layout.data_size;
+                key.format = format;
+                key.dim = type;
+                key.first_level = first_level;
+                key.last_level = last_level;
+                key.first_layer = first_layer;
+                key.last_layer = last_layer;
+                key.buf_offset = buf_offset;
+                key.buf_size = buf_size;
+                memcpy(key.swizzle, iview.swizzle, sizeof(key.swizzle));
+
+                if (panfrost_view_cache_get(prsrc, &key, &so->state,
+                                            &so->bifrost_descriptor,
+                                            PAN_ARCH >= 6 ? pan_size(TEXTURE) : 0))
+                        return;
+        }
+
         unsigned size =
                 (PAN_ARCH <= 5 ? pan_size(TEXTURE) : 0) +
                 GENX(panfrost_estimate_texture_payload_size)(&iview);
@@ -1787,9 +2143,18 @@ panfrost_create_sampler_view_bo(struct panfrost_sampler_view *so,
         }
 
         GENX(panfrost_new_texture)(device, &iview, tex, &payload);
+
+        if (cacheable) {
+                panfrost_view_cache_put(prsrc, &key, so->state,
+                                        &so->bifrost_descriptor,
+                                        PAN_ARCH >= 6 ? pan_size(TEXTURE) : 0);
+        }
 }
 
-static void
+/* Recreates the descriptor of the view if the backing BO or the layout of the
+ * resource changed, returning true if it did */
+
+static bool
 panfrost_update_sampler_view(struct panfrost_sampler_view *view,
                              struct pipe_context *pctx)
 {
@@ -1798,7 +2163,10 @@ panfrost_update_sampler_view(struct panfrost_sampler_view *view,
             view->modifier != rsrc->image.layout.modifier) {
                 panfrost_bo_unreference(view->state.bo);
                 panfrost_create_sampler_view_bo(view, pctx, &rsrc->base);
+                return true;
         }
+
+        return false;
 }
 
 static mali_ptr
@@ -1810,54 +2178,71 @@ panfrost_emit_texture_descriptors(struct panfrost_batch *batch,
         if (!ctx->sampler_view_count[stage])
                 return 0;
 
-#if PAN_ARCH >= 6
-        struct panfrost_ptr T =
-                pan_pool_alloc_desc_array(&batch->pool.base,
-                                          ctx->sampler_view_count[stage],
-                                          TEXTURE);
-        struct mali_texture_packed *out =
-                (struct mali_texture_packed *) T.cpu;
+        struct panfrost_pool_ref *table = &ctx->texture_table[stage];
+        bool stale = false;
 
+        /* The views still have to be tracked by every batch, and a view whose
+         * resource got reallocated invalidates the previous table */
         for (int i = 0; i < ctx->sampler_view_count[stage]; ++i) {
                 struct panfrost_sampler_view *view = ctx->sampler_views[stage][i];
 
-                if (!view) {
-                        memset(&out[i], 0, sizeof(out[i]));
+                if (!view)
                         continue;
-                }
 
-                struct pipe_sampler_view *pview = &view->base;
-                struct panfrost_resource *rsrc = pan_resource(pview->texture);
+                stale |= panfrost_update_sampler_view(view, &ctx->base);
 
-                panfrost_update_sampler_view(view, &ctx->base);
-                out[i] = view->bifrost_descriptor;
-
-                panfrost_batch_read_rsrc(batch, rsrc, stage);
+#if PAN_ARCH >= 6
+                panfrost_batch_read_rsrc(batch, pan_resource(view->base.texture),
+                                         stage);
                 panfrost_batch_add_bo(batch, view->state.bo, stage);
+#endif
         }
 
-        return T.gpu;
+        if (stale)
+                panfrost_table_invalidate(table);
+
+#if PAN_ARCH >= 6
+        if (!table->bo) {
+                struct panfrost_ptr T =
+                        pan_pool_alloc_desc_array(&ctx->descs.base,
+                                                  ctx->sampler_view_count[stage],
+                                                  TEXTURE);
+                struct mali_texture_packed *out =
+                        (struct mali_texture_packed *) T.cpu;
+
+                for (int i = 0; i < ctx->sampler_view_count[stage]; ++i) {
+                        struct panfrost_sampler_view *view =
+                                ctx->sampler_views[stage][i];
+
+                        if (view)
+                                out[i] = view->bifrost_descriptor;
+                        else
+                                memset(&out[i], 0, sizeof(out[i]));
+                }
+
+                *table = panfrost_pool_take_ref(&ctx->descs, T.gpu);
+        }
 #else
         uint64_t trampolines[PIPE_MAX_SHADER_SAMPLER_VIEWS];
 
         for (int i = 0; i < ctx->sampler_view_count[stage]; ++i) {
                 struct panfrost_sampler_view *view = ctx->sampler_views[stage][i];
 
-                if (!view) {
-                        trampolines[i] = 0;
-                        continue;
-                }
-
-                panfrost_update_sampler_view(view, &ctx->base);
-
                 trampolines[i] = panfrost_get_tex_desc(batch, stage, view);
         }
 
-        return pan_pool_upload_aligned(&batch->pool.base, trampolines,
-                                       sizeof(uint64_t) *
-                                       ctx->sampler_view_count[stage],
-                                       sizeof(uint64_t));
+        if (!table->bo) {
+                mali_ptr T = pan_pool_upload_aligned(&ctx->descs.base, trampolines,
+                                                     sizeof(uint64_t) *
+                                                     ctx->sampler_view_count[stage],
+                                                     sizeof(uint64_t));
+
+                *table = panfrost_pool_take_ref(&ctx->descs, T);
+        }
 #endif
+
+        panfrost_batch_add_bo(batch, table->bo, stage);
+        return table->gpu;
 }
 
 static mali_ptr
@@ -1869,19 +2254,28 @@ panfrost_emit_sampler_descriptors(struct panfrost_batch *batch,
         if (!ctx->sampler_count[stage])
                 return 0;
 
-        struct panfrost_ptr T =
-                pan_pool_alloc_desc_array(&batch->pool.base,
-                                          ctx->sampler_count[stage],
-                                          SAMPLER);
-        struct mali_sampler_packed *out = (struct mali_sampler_packed *) T.cpu;
+        struct panfrost_pool_ref *table = &ctx->sampler_table[stage];
+
+        /* Sampler CSOs are immutable, so the table stays valid until new
+         * samplers are bound */
+        if (!table->bo) {
+                struct panfrost_ptr T =
+                        pan_pool_alloc_desc_array(&ctx->descs.base,
+                                                  ctx->sampler_count[stage],
+                                                  SAMPLER);
+                struct mali_sampler_packed *out = (struct mali_sampler_packed *) T.cpu;
 
-        for (unsigned i = 0; i < ctx->sampler_count[stage]; ++i) {
-                struct panfrost_sampler_state *st = ctx->samplers[stage][i];
+                for (unsigned i = 0; i < ctx->sampler_count[stage]; ++i) {
+                        struct panfrost_sampler_state *st = ctx->samplers[stage][i];
+
+                        out[i] = st ? st->hw : (struct mali_sampler_packed){0};
+                }
 
-                out[i] = st ? st->hw : (struct mali_sampler_packed){0};
+                *table = panfrost_pool_take_ref(&ctx->descs, T.gpu);
         }
 
-        return T.gpu;
+        panfrost_batch_add_bo(batch, table->bo, stage);
+        return table->gpu;
 }
 
 #if PAN_ARCH <= 7
@@ -2171,10 +2565,15 @@ panfrost_emit_vertex_data(struct panfrost_batch *batch,
                         }
 
                 } else {
-                        unsigned shift = 0, extra_flags = 0;
-
-                        unsigned magic_divisor =
-                                panfrost_compute_magic_divisor(hw_divisor, &shift, &extra_flags);
+                        struct panfrost_vertex_divisor *d = &so->divisors[i];
+
+                        if (d->hw_divisor != hw_divisor) {
+                                d->hw_divisor = hw_divisor;
+                                d->extra_flags = 0;
+                                d->magic = panfrost_compute_magic_divisor(hw_divisor,
+                                                                          &d->shift,
+                                                                          &d->extra_flags);
+                        }
 
                         /* Records with continuations must be aligned */
                         k = ALIGN_POT(k, 2);
@@ -2186,12 +2585,12 @@ panfrost_emit_vertex_data(struct panfrost_batch *batch,
                                 cfg.stride = stride;
                                 cfg.size = size;
 
-                                cfg.divisor_r = shift;
-                                cfg.divisor_e = extra_flags;
+                                cfg.divisor_r = d->shift;
+                                cfg.divisor_e = d->extra_flags;
                         }
 
                         pan_pack(bufs + k + 1, ATTRIBUTE_BUFFER_CONTINUATION_NPOT, cfg) {
-                                cfg.divisor_numerator = magic_divisor;
+                                cfg.divisor_numerator = d->magic;
                                 cfg.divisor = divisor;
                         }
 
@@ -2686,15 +3085,12 @@ panfrost_emit_varying_descriptor(struct panfrost_batch *batch,
 static void
 panfrost_emit_vertex_tiler_jobs(struct panfrost_batch *batch,
                                 const struct panfrost_ptr *vertex_job,
-                                const struct panfrost_ptr *tiler_job)
+                                const struct panfrost_ptr *tiler_job,
+                                unsigned vertex_dep)
 {
-        struct panfrost_context *ctx = batch->ctx;
-
         unsigned vertex = panfrost_add_job(&batch->pool.base, &batch->scoreboard,
                                            MALI_JOB_TYPE_VERTEX, false, false,
-                                           ctx->indirect_draw ?
-                                           batch->indirect_draw_job_id : 0,
-                                           0, vertex_job, false);
+                                           vertex_dep, 0, vertex_job, false);
 
         panfrost_add_job(&batch->pool.base, &batch->scoreboard,
                          MALI_JOB_TYPE_TILER, false, false,
@@ -2750,6 +3146,8 @@ emit_fbd(struct panfrost_batch *batch, const struct pan_fb_info *fb)
         batch->framebuffer.gpu |=
                 GENX(pan_emit_fbd)(dev, fb, &tls, &batch->tiler_ctx,
                                    batch->framebuffer.cpu);
+
+        batch->ctx->tile_size = GENX(pan_select_tile_size)(dev, fb);
 }
 
 /* Mark a surface as written */
@@ -2760,7 +3158,15 @@ panfrost_initialize_surface(struct panfrost_batch *batch,
 {
         if (surf) {
                 struct panfrost_resource *rsrc = pan_resource(surf->texture);
-                BITSET_SET(rsrc->valid.data, surf->u.tex.level);
+                struct pipe_scissor_state region = {
+                        .minx = batch->minx,
+                        .miny = batch->miny,
+                        .maxx = batch->maxx,
+                        .maxy = batch->maxy,
+                };
+
+                panfrost_resource_add_valid_region(rsrc, surf->u.tex.level,
+                                                   &region);
         }
 }
 
@@ -2770,16 +3176,8 @@ panfrost_initialize_surface(struct panfrost_batch *batch,
 static mali_ptr
 emit_fragment_job(struct panfrost_batch *batch, const struct pan_fb_info *pfb)
 {
-        /* Mark the affected buffers as initialized, since we're writing to it.
-         * Also, add the surfaces we're writing to to the batch */
-
         struct pipe_framebuffer_state *fb = &batch->key;
 
-        for (unsigned i = 0; i < fb->nr_cbufs; ++i)
-                panfrost_initialize_surface(batch, fb->cbufs[i]);
-
-        panfrost_initialize_surface(batch, fb->zsbuf);
-
         /* The passed tile coords can be out of range in some cases, so we need
          * to clamp them to the framebuffer size to avoid a TILE_RANGE_FAULT.
          * Theoretically we also need to clamp the coordinates positive, but we
@@ -2800,6 +3198,18 @@ emit_fragment_job(struct panfrost_batch *batch, const struct pan_fb_info *pfb)
         assert(batch->maxx > batch->minx);
         assert(batch->maxy > batch->miny);
 
+        /* Mark the affected buffers as initialized, since we're writing to
+         * them, within the rendering region. Invalidated buffers are not
+         * written back, so they stay uninitialized. */
+
+        for (unsigned i = 0; i < fb->nr_cbufs; ++i) {
+                if (batch->resolve & (PIPE_CLEAR_COLOR0 << i))
+                        panfrost_initialize_surface(batch, fb->cbufs[i]);
+        }
+
+        if (batch->resolve & PIPE_CLEAR_DEPTHSTENCIL)
+                panfrost_initialize_surface(batch, fb->zsbuf);
+
         struct panfrost_ptr transfer =
                 pan_pool_alloc_desc(&batch->pool.base, FRAGMENT_JOB);
 
@@ -2809,13 +3219,59 @@ emit_fragment_job(struct panfrost_batch *batch, const struct pan_fb_info *pfb)
         return transfer.gpu;
 }
 
+/* Timestamps are written once the work before them is done. On JM, that is a
+ * chain of WRITE_VALUE jobs submitted after the fragment job, on CSF the
+ * fragment stream waits for all of its jobs before storing them. The
+ * addresses are either the timestamp queries or the trace timestamps. */
+static mali_ptr
+emit_timestamps(struct panfrost_batch *batch, struct util_dynarray *timestamps)
+{
+#if PAN_ARCH >= 10
+        pan_command_stream *c = &batch->cs_fragment;
+        unsigned count = util_dynarray_num_elements(timestamps, mali_ptr);
+
+        assert(c->ptr + 1 + count * 2 <= c->end);
+
+        pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 0xff; }
+
+        util_dynarray_foreach(timestamps, mali_ptr, address) {
+                pan_emit_cs_48(c, 0x48, *address);
+                pan_pack_ins(c, CS_STORE_STATE, cfg) {
+                        cfg.state = MALI_CS_STATE_TIMESTAMP;
+                        cfg.addr = 0x48;
+                }
+        }
+
+        return 0;
+#else
+        struct pan_scoreboard scoreboard = { 0 };
+
+        util_dynarray_foreach(timestamps, mali_ptr, address) {
+                struct panfrost_ptr job =
+                        pan_pool_alloc_desc(&batch->pool.base, WRITE_VALUE_JOB);
+
+                pan_section_pack(job.cpu, WRITE_VALUE_JOB, PAYLOAD, payload) {
+                        payload.address = *address;
+                        payload.type = MALI_WRITE_VALUE_TYPE_SYSTEM_TIMESTAMP;
+                }
+
+                panfrost_add_job(&batch->pool.base, &scoreboard,
+                                 MALI_JOB_TYPE_WRITE_VALUE, false, false,
+                                 0, 0, &job, false);
+        }
+
+        return scoreboard.first_job;
+#endif
+}
+
 #if PAN_ARCH >= 10
 
+/* With DMA_BUF_SYNC_READ, only the writers are waited for */
 static int
-panfrost_export_dmabuf_fence(int dmabuf)
+panfrost_export_dmabuf_fence(int dmabuf, uint32_t flags)
 {
         struct dma_buf_export_sync_file export = {
-                .flags = DMA_BUF_SYNC_RW,
+                .flags = flags,
         };
 
         int err = drmIoctl(dmabuf, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &export);
@@ -2828,11 +3284,12 @@ panfrost_export_dmabuf_fence(int dmabuf)
         return export.fd;
 }
 
+/* With DMA_BUF_SYNC_READ, the fence is only waited for by writers */
 static bool
-panfrost_import_dmabuf_fence(int dmabuf, int fence)
+panfrost_import_dmabuf_fence(int dmabuf, int fence, uint32_t flags)
 {
         struct dma_buf_import_sync_file import = {
-                .flags = DMA_BUF_SYNC_RW,
+                .flags = flags,
                 .fd = fence,
         };
 
@@ -2846,15 +3303,74 @@ panfrost_import_dmabuf_fence(int dmabuf, int fence)
         return true;
 }
 
+/* Batches with more dependencies than this wait for them from a separate
+ * segment rather than in the ring */
+#define PAN_CS_RING_MAX_DEPS 16
+
+static pan_command_stream
+panfrost_batch_create_cs(struct panfrost_batch *batch, unsigned count)
+{
+        struct panfrost_ptr cs = pan_pool_alloc_aligned(&batch->pool.base, count * 8, 64);
+
+        return (pan_command_stream) {
+                .ptr = cs.cpu,
+                .begin = cs.cpu,
+                .end = cs.cpu + count,
+                .gpu = cs.gpu,
+        };
+}
+
+/* Reserves space for count instructions in the ring, waiting for the GPU to
+ * finish with older instructions if needed. Returns the end of the
+ * reservation, or NULL if the GPU didn't free up enough of the ring, in
+ * which case the ring is left untouched. */
 static uint64_t *
-panfrost_cs_ring_allocate_instrs(struct panfrost_cs *cs, unsigned count)
+panfrost_cs_ring_allocate_instrs(struct panfrost_batch *batch,
+                                 struct panfrost_cs *cs, unsigned count)
 {
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
         pan_command_stream c = cs->cs;
 
-        if (c.ptr + count > c.end) {
-                assert(c.ptr <= c.end);
-                assert(c.begin + count <= c.ptr);
+        assert(c.ptr <= c.end);
 
+        /* Wrapping skips fewer than count instructions at the end of the
+         * ring, so this is enough for the reservation to fit once the GPU
+         * has caught up with everything submitted. */
+        assert(count * 8 * 2 <= cs->base.size);
+
+        bool wrap = c.ptr + count > c.end;
+
+        /* Ring offset of the end of the reservation */
+        uint64_t end = (wrap ? cs->offset + cs->base.size : cs->offset) +
+                ((wrap ? c.begin : c.ptr) + count - c.begin) * 8;
+
+        uint64_t extract = dev->mali.cs_extract(&dev->mali, &cs->base);
+
+        if (end - extract > cs->base.size)
+                ++ctx->cs_ring_stalls;
+
+        while (end - extract > cs->base.size) {
+                /* Instructions which have not been submitted yet can't be
+                 * waited for */
+                if (extract == cs->base.last_insert) {
+                        fprintf(stderr, "CS ring too small for batch\n");
+                        return NULL;
+                }
+
+                if (!dev->mali.cs_wait(&dev->mali, &cs->base,
+                                       cs->base.last_insert,
+                                       ctx->syncobj_kbase, 1000000000)) {
+                        fprintf(stderr, "timed out waiting for CS ring space\n");
+                        return NULL;
+                }
+
+                extract = dev->mali.cs_extract(&dev->mali, &cs->base);
+        }
+
+        cs->ring_occupancy = MIN2(end - extract, cs->base.size);
+
+        if (wrap) {
                 /* Instructions are in a ring buffer, simply NOP out the end
                  * and start back from the start. Possibly, doing a TAILCALL
                  * straight to the start could also work. */
@@ -2865,12 +3381,129 @@ panfrost_cs_ring_allocate_instrs(struct panfrost_cs *cs, unsigned count)
                 cs->cs = c;
         }
 
-        /* TODO: Check against the extract offset */
         return c.ptr + count;
 }
 
 // TODO: Rewrite this!
+static bool
+panfrost_dmabuf_in_list(const struct util_dynarray *list,
+                        const struct panfrost_bo *bo)
+{
+        util_dynarray_foreach(list, struct panfrost_bo *, it) {
+                if (*it == bo)
+                        return true;
+        }
+
+        return false;
+}
+
+/* Batches only reading a dma-buf neither wait for the other readers nor
+ * make the later readers wait for them */
+static uint32_t
+panfrost_batch_dmabuf_sync_flags(struct panfrost_batch *batch,
+                                 const struct panfrost_bo *bo)
+{
+        unsigned size = util_dynarray_num_elements(&batch->bos, pan_bo_access);
+        pan_bo_access access = 0;
+
+        if (bo->gem_handle < size) {
+                access = *util_dynarray_element(&batch->bos, pan_bo_access,
+                                                bo->gem_handle);
+        }
+
+        return (access & PAN_BO_ACCESS_WRITE) ? DMA_BUF_SYNC_RW :
+                                                DMA_BUF_SYNC_READ;
+}
+
+/* Make the queue wait for the fences of every dma-buf in dmabufs which is
+ * not also in exclude. If in_sync is set, the sync file accumulated by
+ * fence_server_sync is also consumed. */
+static void
+emit_csf_dmabuf_wait(struct panfrost_batch *batch, struct panfrost_cs *cs,
+                     struct util_dynarray *dmabufs,
+                     const struct util_dynarray *exclude, bool in_sync)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        pan_command_stream *c = &cs->cs;
+
+        struct util_dynarray fences;
+        util_dynarray_init(&fences, NULL);
+
+        if (in_sync && ctx->in_sync_fd != -1) {
+                util_dynarray_append(&fences, int, ctx->in_sync_fd);
+                ctx->in_sync_fd = -1;
+        }
+
+        util_dynarray_foreach(dmabufs, struct panfrost_bo *, bo) {
+                if (exclude && panfrost_dmabuf_in_list(exclude, *bo))
+                        continue;
+
+                int fence = panfrost_export_dmabuf_fence(
+                        (*bo)->dmabuf_fd,
+                        panfrost_batch_dmabuf_sync_flags(batch, *bo));
+
+                if (fence != -1)
+                        util_dynarray_append(&fences, int, fence);
+        }
+
+        unsigned num_fences = util_dynarray_num_elements(&fences, int);
+
+        /* All of the fences are waited for and the CQS object signalled with
+         * a single enqueue, rather than one KCPU command per dma-buf. */
+        bool ret = false;
+        uint64_t kcpu_seqnum = cs->kcpu_seqnum;
+
+        if (num_fences) {
+                uint64_t kcpu_start = panfrost_submit_phase_begin(ctx);
+                kcpu_seqnum = ++cs->kcpu_seqnum;
+
+                ret = dev->mali.kcpu_fence_import_batch(
+                        &dev->mali, cs->base.ctx,
+                        util_dynarray_begin(&fences), num_fences,
+                        cs->kcpu_event_ptr, kcpu_seqnum + 1);
+
+                panfrost_submit_kcpu_end(ctx, kcpu_start);
+        }
+
+        util_dynarray_foreach(&fences, int, fence)
+                close(*fence);
+        util_dynarray_fini(&fences);
+
+        if (ret) {
+                /* If we don't set no_error, kbase might decide to pass on
+                 * errors from waiting for fences. */
+                pan_emit_cs_48(c, 0x42, cs->kcpu_event_ptr);
+                pan_emit_cs_64(c, 0x40, kcpu_seqnum);
+                pan_pack_ins(c, CS_EVWAIT_64, cfg) {
+                        cfg.no_error = true;
+                        cfg.condition = MALI_WAIT_CONDITION_HIGHER;
+                        cfg.value = 0x40;
+                        cfg.addr = 0x42;
+                }
+        }
+}
+
+/* Store one of the trace timestamps of the batch, once the work queued
+ * before it on the queue is done */
 static void
+emit_csf_trace_ts(struct panfrost_batch *batch, pan_command_stream *c,
+                  enum panfrost_trace_ts idx)
+{
+        if (!batch->trace_ts[idx])
+                return;
+
+        pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 0xff; }
+        pan_emit_cs_48(c, 0x48, batch->trace_ts[idx]);
+        pan_pack_ins(c, CS_STORE_STATE, cfg) {
+                cfg.state = MALI_CS_STATE_TIMESTAMP;
+                cfg.addr = 0x48;
+        }
+}
+
+/* Returns false if there was no space in the ring for the job, in which case
+ * nothing was emitted */
+static bool
 emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
                pan_command_stream s, struct util_dynarray *deps,
                bool first, bool last)
@@ -2882,71 +3515,85 @@ emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
         bool fragment = (cs->hw_resources & 2);
         bool vertex = (cs->hw_resources & 12); /* TILER | IDVS */
 
-        uint64_t *limit = panfrost_cs_ring_allocate_instrs(cs,
-                128 + util_dynarray_num_elements(deps, struct panfrost_usage) * 4);
+        unsigned num_deps = util_dynarray_num_elements(deps, struct panfrost_usage);
+
+        /* Waiting for a dependency takes four instructions, as
+         * pan_emit_cs_64 might be split. Long lists of waits go in a segment
+         * allocated from the batch pool, which is called from the ring, so
+         * that the ring space needed per batch is bounded. The segment is
+         * recycled with the rest of the batch memory. */
+        bool deps_segment = first && num_deps > PAN_CS_RING_MAX_DEPS;
+
+        uint64_t *limit = panfrost_cs_ring_allocate_instrs(batch, cs,
+                136 + (deps_segment ? 3 : num_deps * 4));
+        if (!limit)
+                return false;
 
         pan_command_stream *c = &cs->cs;
 
         /* First, do some waiting at the start of the job */
 
         pan_emit_cs_32(c, 0x54, *cs->base.latest_flush);
-        // TODO genxmlify
-        pan_emit_cs_ins(c, 0x24, 0x540000000233ULL);
+        pan_pack_ins(c, CS_FLUSH_CACHES, cfg) {
+                cfg.l2_flush_mode = MALI_CS_FLUSH_MODE_CLEAN_AND_INVALIDATE;
+                cfg.lsc_flush_mode = MALI_CS_FLUSH_MODE_CLEAN_AND_INVALIDATE;
+                cfg.other_invalidate = true;
+                cfg.flush_id = 0x54;
+        }
         // TODO: What does this need to be?
         pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 0xff; }
 
+        bool is_vertex_cs = (cs == &batch->ctx->kbase_cs_vertex);
+
         /* For the first job in the batch, wait on dependencies */
-        // TODO: Usually the vertex job shouldn't have to wait for dmabufs!
         if (first) {
-                mali_ptr seqnum_ptr_base = dev->mali.event_mem.gpu;
+                pan_command_stream seg;
+                pan_command_stream *w = c;
+
+                if (deps_segment) {
+                        seg = panfrost_batch_create_cs(batch, num_deps * 4);
+                        w = &seg;
+                }
+
+                /* Waits for the same queue or seqnum reuse the registers
+                 * loaded by earlier waits */
+                struct pan_cs_builder b;
+                pan_cs_builder_init(&b, w, 0x40, 4);
 
                 util_dynarray_foreach(deps, struct panfrost_usage, u) {
-                        /* Note the multiplication in the call to
-                         * cs_ring_allocate_instrs. pan_emit_cs_64 might be
-                         * split, so the total is four instructions. */
-                        pan_emit_cs_48(c, 0x42, seqnum_ptr_base +
-                                       u->queue * PAN_EVENT_SIZE);
-                        pan_emit_cs_64(c, 0x40, u->seqnum);
-                        pan_pack_ins(c, CS_EVWAIT_64, cfg) {
+                        uint8_t addr = pan_cs_scratch64(&b, kbase_event_va(&dev->mali, u->queue));
+                        uint8_t value = pan_cs_scratch64(&b, u->seqnum);
+
+                        pan_pack_ins(w, CS_EVWAIT_64, cfg) {
                                 cfg.no_error = true;
                                 cfg.condition = MALI_WAIT_CONDITION_HIGHER;
-                                cfg.value = 0x40;
-                                cfg.addr = 0x42;
+                                cfg.value = value;
+                                cfg.addr = addr;
                         }
                 }
 
-                uint64_t kcpu_seqnum = ++cs->kcpu_seqnum;
-
-                util_dynarray_foreach(&batch->dmabufs, int, fd) {
-                        int fence = panfrost_export_dmabuf_fence(*fd);
-
-                        /* TODO: poll on the dma-buf? */
-                        if (fence == -1)
-                                continue;
-
-                        // TODO: What if we reach the limit for number of KCPU
-                        // commands in a queue? It's pretty low (256)
-                        dev->mali.kcpu_fence_import(&dev->mali, cs->base.ctx,
-                                                    fence);
+                if (deps_segment) {
+                        assert(seg.ptr <= seg.end);
 
-                        close(fence);
+                        pan_emit_cs_48(c, 0x48, seg.gpu);
+                        pan_emit_cs_32(c, 0x4a, (seg.ptr - seg.begin) * 8);
+                        pan_pack_ins(c, CS_CALL, cfg) { cfg.address = 0x48; cfg.length = 0x4a; }
                 }
 
-                bool ret = dev->mali.kcpu_cqs_set(&dev->mali, cs->base.ctx,
-                                  cs->kcpu_event_ptr, kcpu_seqnum + 1);
-
-                if (ret) {
-                        /* If we don't set no_error, kbase might decide to
-                         * pass on errors from waiting for fences. */
-                        pan_emit_cs_48(c, 0x42, cs->kcpu_event_ptr);
-                        pan_emit_cs_64(c, 0x40, kcpu_seqnum);
-                        pan_pack_ins(c, CS_EVWAIT_64, cfg) {
-                                cfg.no_error = true;
-                                cfg.condition = MALI_WAIT_CONDITION_HIGHER;
-                                cfg.value = 0x40;
-                                cfg.addr = 0x42;
-                        }
-                }
+                /* The vertex queue only waits for dma-bufs accessed by
+                 * the vertex or tiler stages, the fragment queue needs to
+                 * wait for the rest. */
+                if (is_vertex_cs)
+                        emit_csf_dmabuf_wait(batch, cs, &batch->vert_dmabufs,
+                                             NULL, true);
+                else
+                        emit_csf_dmabuf_wait(batch, cs, &batch->dmabufs,
+                                             NULL, true);
+        } else if (!is_vertex_cs) {
+                /* The vertex job already waited for dma-bufs used in the
+                 * vertex stage, and this job waits for the vertex job */
+                emit_csf_dmabuf_wait(batch, cs, &batch->dmabufs,
+                                     &batch->vert_dmabufs, false);
         }
 
         /* Fragment jobs need to wait for the vertex job */
@@ -2987,6 +3634,9 @@ emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
         }
 #else
 
+        emit_csf_trace_ts(batch, c, vertex ? PAN_TRACE_TS_VERTEX_START :
+                                             PAN_TRACE_TS_FRAGMENT_START);
+
         pan_emit_cs_48(c, 0x48, s.gpu);
         pan_emit_cs_32(c, 0x4a, (s.ptr - s.begin) * 8);
         pan_pack_ins(c, CS_CALL, cfg) { cfg.address = 0x48; cfg.length = 0x4a; }
@@ -2998,13 +3648,23 @@ emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
                 pan_pack_ins(c, CS_HEAPINC, cfg) {
                         cfg.type = MALI_HEAP_STATISTIC_V_T_END;
                 }
+
+                emit_csf_trace_ts(batch, c, PAN_TRACE_TS_VERTEX_END);
         }
 
         if (fragment) {
                 /* Skip the next operation if the batch doesn't use a tiler
                  * heap (i.e. it's just a blit) */
-                pan_emit_cs_ins(c, 22, 0x560030000001); /* b.ne w56, skip 1 */
-                pan_emit_cs_ins(c, 22, 0x570020000007); /* b.eq w57, skip 7 */
+                pan_pack_ins(c, CS_BRANCH, cfg) {
+                        cfg.condition = MALI_CS_BRANCH_CONDITION_NE;
+                        cfg.value = 0x56;
+                        cfg.offset = 1;
+                }
+                pan_pack_ins(c, CS_BRANCH, cfg) {
+                        cfg.condition = MALI_CS_BRANCH_CONDITION_EQ;
+                        cfg.value = 0x57;
+                        cfg.offset = 7;
+                }
 
                 pan_pack_ins(c, CS_LDR, cfg) {
                         cfg.offset = 4 * 10; /* Heap Start */
@@ -3051,8 +3711,17 @@ emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
 
         if (fragment) {
                 pan_emit_cs_32(c, 0x54, 0);
-                pan_emit_cs_ins(c, 0x24, 0x2540000f80211);
+                pan_pack_ins(c, CS_FLUSH_CACHES, cfg) {
+                        cfg.l2_flush_mode = MALI_CS_FLUSH_MODE_CLEAN;
+                        cfg.lsc_flush_mode = MALI_CS_FLUSH_MODE_CLEAN;
+                        cfg.other_invalidate = true;
+                        cfg.scoreboard_mask = 0xf8;
+                        cfg.flush_id = 0x54;
+                        cfg.unk_3 = 2;
+                }
                 pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 1 << 1; }
+
+                emit_csf_trace_ts(batch, c, PAN_TRACE_TS_FRAGMENT_END);
         }
 
         {
@@ -3077,14 +3746,26 @@ emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
                         cfg.addr = 0x42;
                 }
 
+                uint64_t kcpu_start = panfrost_submit_phase_begin(batch->ctx);
+
                 dev->mali.kcpu_cqs_wait(&dev->mali, cs->base.ctx,
                                         cs->kcpu_event_ptr, kcpu_seqnum);
 
                 int fence = dev->mali.kcpu_fence_export(&dev->mali, cs->base.ctx);
 
+                panfrost_submit_kcpu_end(batch->ctx, kcpu_start);
+
                 if (fence != -1) {
-                        util_dynarray_foreach(&batch->dmabufs, int, fd) {
-                                panfrost_import_dmabuf_fence(*fd, fence);
+                        util_dynarray_foreach(&batch->dmabufs,
+                                              struct panfrost_bo *, bo) {
+                                uint32_t flags =
+                                        panfrost_batch_dmabuf_sync_flags(batch, *bo);
+
+                                /* Read fences don't hold back other readers */
+                                panfrost_import_dmabuf_fence(
+                                        (*bo)->dmabuf_fd, fence,
+                                        flags == DMA_BUF_SYNC_RW ?
+                                        DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ);
                         }
                 }
 
@@ -3106,9 +3787,10 @@ emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
                 pan_emit_cs_ins(c, 0, 0);
 
         assert(c->ptr <= limit);
+        return true;
 }
 
-static void
+static bool
 emit_csf_toplevel(struct panfrost_batch *batch)
 {
         pan_command_stream *cv = &batch->ctx->kbase_cs_vertex.cs;
@@ -3128,18 +3810,25 @@ emit_csf_toplevel(struct panfrost_batch *batch)
 
         // TODO: Clean up control-flow?
 
+        struct kbase_context *kctx = batch->ctx->kbase_ctx;
+        mali_ptr heap_va = kctx->tiler_heap_va[batch->tiler_heap];
+
         if (vert) {
-                pan_emit_cs_48(cv, 0x48, batch->ctx->kbase_ctx->tiler_heap_va);
-                pan_pack_ins(cv, CS_HEAPCTX, cfg) { cfg.address = 0x48; }
+                /* Compute-only contexts don't have a tiler heap */
+                if (kctx->num_tiler_heaps) {
+                        pan_emit_cs_48(cv, 0x48, heap_va);
+                        pan_pack_ins(cv, CS_HEAPCTX, cfg) { cfg.address = 0x48; }
+                }
 
-                emit_csf_queue(batch, &batch->ctx->kbase_cs_vertex, v,
-                               &batch->vert_deps, true, !frag);
+                if (!emit_csf_queue(batch, &batch->ctx->kbase_cs_vertex, v,
+                                    &batch->vert_deps, true, !frag))
+                        return false;
         }
 
         if (!frag)
-                return;
+                return true;
 
-        pan_emit_cs_48(cf, 0x48, batch->ctx->kbase_ctx->tiler_heap_va);
+        pan_emit_cs_48(cf, 0x48, heap_va);
         pan_pack_ins(cf, CS_HEAPCTX, cfg) { cfg.address = 0x48; }
 
         uint64_t vertex_seqnum = batch->ctx->kbase_cs_vertex.seqnum;
@@ -3156,8 +3845,8 @@ emit_csf_toplevel(struct panfrost_batch *batch)
         assert(vert || batch->tiler_ctx.bifrost == 0);
         pan_emit_cs_48(cf, 0x56, batch->tiler_ctx.bifrost);
 
-        emit_csf_queue(batch, &batch->ctx->kbase_cs_fragment, f,
-                       &batch->frag_deps, !vert, true);
+        return emit_csf_queue(batch, &batch->ctx->kbase_cs_fragment, f,
+                              &batch->frag_deps, !vert, true);
 }
 
 static void
@@ -3169,6 +3858,7 @@ init_cs(struct panfrost_context *ctx, struct panfrost_cs *cs)
         cs->seqnum = 0;
 
         cs->offset = 0;
+        cs->ring_occupancy = 0;
         c->ptr = cs->bo->ptr.cpu;
         c->begin = cs->bo->ptr.cpu;
         c->end = cs->bo->ptr.cpu + cs->base.size;
@@ -3177,8 +3867,12 @@ init_cs(struct panfrost_context *ctx, struct panfrost_cs *cs)
         // eight instructions == 64 bytes
         pan_pack_ins(c, CS_RESOURCES, cfg) { cfg.mask = cs->hw_resources; }
         pan_pack_ins(c, CS_SLOT, cfg) { cfg.index = 2; }
-        pan_emit_cs_48(c, 0x48, ctx->kbase_ctx->tiler_heap_va);
-        pan_pack_ins(c, CS_HEAPCTX, cfg) { cfg.address = 0x48; }
+        pan_emit_cs_48(c, 0x48, ctx->kbase_ctx->tiler_heap_va[0]);
+        if (ctx->kbase_ctx->num_tiler_heaps) {
+                pan_pack_ins(c, CS_HEAPCTX, cfg) { cfg.address = 0x48; }
+        } else {
+                pan_pack_ins(c, CS_NOP, _);
+        }
         for (unsigned i = 0; i < 4; ++i)
                 pan_pack_ins(c, CS_NOP, _);
 
@@ -3236,11 +3930,34 @@ panfrost_statistics_record(
         ctx->dirty |= PAN_DIRTY_SO;
 }
 
+/* Count the primitives a draw sends to the tiler, or pass count = ~0 if they
+ * are not known on the CPU */
+static void
+panfrost_batch_count_primitives(struct panfrost_batch *batch,
+                                const struct pipe_draw_info *info,
+                                unsigned count)
+{
+        uint64_t prims = UINT32_MAX;
+
+        if (count != ~0)
+                prims = (uint64_t)u_reduced_prims_for_vertices(info->mode, count) *
+                        info->instance_count;
+
+        batch->tiler_primitives = MIN2(batch->tiler_primitives + prims,
+                                       UINT32_MAX);
+}
+
+/* Advance the transform feedback offsets past the vertices written by the
+ * transform feedback shader of the draw. All draws with transform feedback
+ * have their vertex count known on the CPU, as indirect ones are unrolled, so
+ * the offsets are tracked on the CPU without ever waiting for the GPU. */
 static void
-panfrost_update_streamout_offsets(struct panfrost_context *ctx)
+panfrost_update_streamout_offsets(struct panfrost_context *ctx,
+                                  const struct pipe_draw_info *info,
+                                  unsigned count)
 {
-        unsigned count = u_stream_outputs_for_vertices(ctx->active_prim,
-                                                       ctx->vertex_count);
+        u_trim_pipe_prim(info->mode, &count);
+        count *= info->instance_count;
 
         for (unsigned i = 0; i < ctx->streamout.num_targets; ++i) {
                 if (!ctx->streamout.targets[i])
@@ -3437,13 +4154,8 @@ panfrost_update_state_3d(struct panfrost_batch *batch)
         if (dirty & PAN_DIRTY_BLEND)
                 batch->blend = panfrost_emit_blend_valhall(batch);
 
-        if (dirty & PAN_DIRTY_VERTEX) {
-                batch->attribs[PIPE_SHADER_VERTEX] =
-                        panfrost_emit_vertex_data(batch);
-
-                batch->attrib_bufs[PIPE_SHADER_VERTEX] =
-                        panfrost_emit_vertex_buffers(batch);
-        }
+        if (dirty & PAN_DIRTY_VERTEX)
+                panfrost_emit_vertex_tables(batch);
 #endif
 }
 
@@ -3455,20 +4167,27 @@ panfrost_get_tiler_heap_desc(struct panfrost_batch *batch)
 {
         struct panfrost_context *ctx = batch->ctx;
         struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct kbase_context *kctx = ctx->kbase_ctx;
 
-        if (ctx->tiler_heap_desc)
-                return ctx->tiler_heap_desc->ptr.gpu;
+        /* Take the heaps in turn, so consecutive batches bin into different
+         * heaps and don't wait for each other */
+        unsigned idx = ctx->next_tiler_heap;
+        ctx->next_tiler_heap = (idx + 1) % MAX2(kctx->num_tiler_heaps, 1);
+        batch->tiler_heap = idx;
 
-        ctx->tiler_heap_desc = panfrost_bo_create(dev, 4096, 0, "Tiler heap descriptor");
+        if (ctx->tiler_heap_desc[idx])
+                return ctx->tiler_heap_desc[idx]->ptr.gpu;
 
-        pan_pack(ctx->tiler_heap_desc->ptr.cpu, TILER_HEAP, heap) {
-                heap.size = ctx->kbase_ctx->tiler_heap_chunk_size;
-                heap.base = ctx->kbase_ctx->tiler_heap_header;
+        ctx->tiler_heap_desc[idx] = panfrost_bo_create(dev, 4096, 0, "Tiler heap descriptor");
+
+        pan_pack(ctx->tiler_heap_desc[idx]->ptr.cpu, TILER_HEAP, heap) {
+                heap.size = kctx->tiler_heap_config.chunk_size;
+                heap.base = kctx->tiler_heap_header[idx];
                 heap.bottom = heap.base + 64;
                 heap.top = heap.base + heap.size;
         }
 
-        return ctx->tiler_heap_desc->ptr.gpu;
+        return ctx->tiler_heap_desc[idx]->ptr.gpu;
 }
 #else
 static mali_ptr
@@ -3485,11 +4204,30 @@ panfrost_get_tiler_heap_desc(struct panfrost_batch *batch)
 }
 #endif
 
-static mali_ptr
-panfrost_batch_get_bifrost_tiler(struct panfrost_batch *batch, unsigned vertex_count)
+static void
+panfrost_emit_bifrost_tiler_ctx(struct panfrost_batch *batch, mali_ptr heap,
+                                mali_ptr scratch, void *out)
 {
         struct panfrost_device *dev = pan_device(batch->ctx->base.screen);
 
+        /* The tiler context is emitted at the first draw, so the primitive
+         * count of the batch isn't known yet. Use the one of the last render
+         * pass to the same target, which is usually the last frame. */
+        struct panfrost_resource *target = panfrost_batch_tiler_target(batch);
+        unsigned primitive_size = target ?
+                panfrost_tiler_primitive_size(batch->key.width,
+                                              batch->key.height,
+                                              target->tiler_primitives) : 0;
+
+        GENX(pan_emit_tiler_ctx)(dev, batch->key.width, batch->key.height,
+                                 util_framebuffer_get_num_samples(&batch->key),
+                                 pan_tristate_get(batch->first_provoking_vertex),
+                                 primitive_size, heap, scratch, out);
+}
+
+static mali_ptr
+panfrost_batch_get_bifrost_tiler(struct panfrost_batch *batch, unsigned vertex_count)
+{
         if (!vertex_count)
                 return 0;
 
@@ -3501,27 +4239,33 @@ panfrost_batch_get_bifrost_tiler(struct panfrost_batch *batch, unsigned vertex_c
         mali_ptr scratch = 0;
 
 #if PAN_ARCH >= 10
-        // TODO: Dynamically size?
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
         unsigned scratch_bits = 16;
 
-        /* Allocate scratch space for vertex positions / point sizes */
-        // TODO: Should this be shared?
-        struct panfrost_ptr sc =
-                pan_pool_alloc_aligned(&batch->pool.base, 1 << scratch_bits, 4096);
-
-        /* I think the scratch size is passed in the low bits of the
-         * pointer... but trying to go above 16 gives a CS_INHERIT_FAULT.
+        /* Scratch space for vertex positions / point sizes. Batches using a
+         * tiler heap are serialised by the heap dependency, so each heap has
+         * a buffer shared by the batches using it, rather than every batch
+         * allocating its own.
+         *
+         * I think the scratch size is passed in the low bits of the
+         * pointer... but trying to go above 16 gives a CS_INHERIT_FAULT, so
+         * all batches get the largest size.
          */
-        scratch = sc.gpu + scratch_bits;
+        struct panfrost_bo **sc = &ctx->tiler_scratch[batch->tiler_heap];
+
+        if (!*sc) {
+                *sc = panfrost_bo_create(dev, 1 << scratch_bits,
+                                         PAN_BO_INVISIBLE, "Tiler scratch");
+        }
+
+        scratch = (*sc)->ptr.gpu + scratch_bits;
 #endif
 
         struct panfrost_ptr t =
                 pan_pool_alloc_desc(&batch->pool.base, TILER_CONTEXT);
 
-        GENX(pan_emit_tiler_ctx)(dev, batch->key.width, batch->key.height,
-                                 util_framebuffer_get_num_samples(&batch->key),
-                                 pan_tristate_get(batch->first_provoking_vertex),
-                                 heap, scratch, t.cpu);
+        panfrost_emit_bifrost_tiler_ctx(batch, heap, scratch, t.cpu);
 
         batch->tiler_ctx.bifrost = t.gpu;
         return batch->tiler_ctx.bifrost;
@@ -3632,14 +4376,15 @@ panfrost_emit_resources(struct panfrost_batch *batch,
                         mali_ptr ubos, unsigned ubo_count)
 {
         struct panfrost_context *ctx = batch->ctx;
-        struct panfrost_ptr T;
-        unsigned nr_tables = 12;
+        unsigned nr_tables = PAN_RESOURCE_TABLE_COUNT;
 
-        /* Although individual resources need only 16 byte alignment, the
-         * resource table as a whole must be 64-byte aligned.
-         */
-        T = pan_pool_alloc_aligned(&batch->pool.base, nr_tables * pan_size(RESOURCE), 64);
-        memset(T.cpu, 0, nr_tables * pan_size(RESOURCE));
+        /* Build the table in its key, draws switching between a few sets of
+         * bindings then find it uploaded by an earlier draw */
+        struct panfrost_resource_table_key key;
+        STATIC_ASSERT(sizeof(key) == PAN_RESOURCE_TABLE_COUNT * pan_size(RESOURCE));
+
+        memset(&key, 0, sizeof(key));
+        struct panfrost_ptr T = { .cpu = key.words };
 
         panfrost_make_resource_table(T, PAN_TABLE_UBO, ubos, ubo_count);
 
@@ -3673,7 +4418,30 @@ panfrost_emit_resources(struct panfrost_batch *batch,
                                              util_last_bit(ctx->vb_mask));
         }
 
-        return T.gpu | nr_tables;
+        struct hash_entry *entry =
+                _mesa_hash_table_search(ctx->resource_table_cache, &key);
+        struct panfrost_resource_table_cache_entry *e;
+
+        if (entry) {
+                e = entry->data;
+        } else {
+                if (ctx->resource_table_cache->entries >= PAN_RESOURCE_TABLE_CACHE_SIZE)
+                        panfrost_resource_table_cache_clear(ctx);
+
+                /* Although individual resources need only 16 byte alignment,
+                 * the resource table as a whole must be 64-byte aligned.
+                 */
+                mali_ptr gpu = pan_pool_upload_aligned(&ctx->descs.base, &key,
+                                                       sizeof(key), 64);
+
+                e = malloc(sizeof(*e));
+                e->key = key;
+                e->ref = panfrost_pool_take_ref(&ctx->descs, gpu);
+                _mesa_hash_table_insert(ctx->resource_table_cache, &e->key, e);
+        }
+
+        panfrost_batch_add_bo(batch, e->ref.bo, stage);
+        return e->ref.gpu | nr_tables;
 }
 
 static void
@@ -3700,6 +4468,31 @@ panfrost_emit_shader(struct panfrost_batch *batch,
 }
 #endif
 
+/* Set the DRAW fields that only depend on the rasterizer CSO. Packed once at
+ * CSO creation where the descriptor isn't emitted with CS instructions. */
+static void
+panfrost_pack_draw_rasterizer(struct MALI_DRAW *cfg,
+                              const struct pipe_rasterizer_state *rast,
+                              bool polygon)
+{
+        /*
+         * From the Gallium documentation,
+         * pipe_rasterizer_state::cull_face "indicates which faces of
+         * polygons to cull". Points and lines are not considered
+         * polygons and should be drawn even if all faces are culled.
+         * The hardware does not take primitive type into account when
+         * culling, so we need to do that check ourselves.
+         */
+        cfg->cull_front_face = polygon && (rast->cull_face & PIPE_FACE_FRONT);
+        cfg->cull_back_face = polygon && (rast->cull_face & PIPE_FACE_BACK);
+        cfg->front_face_ccw = rast->front_ccw;
+
+#if PAN_ARCH >= 9
+        cfg->multisample_enable = rast->multisample;
+        cfg->single_sampled_lines = !rast->multisample;
+#endif
+}
+
 static void
 panfrost_emit_draw(void *out,
                    struct panfrost_batch *batch,
@@ -3711,18 +4504,12 @@ panfrost_emit_draw(void *out,
         struct pipe_rasterizer_state *rast = &ctx->rasterizer->base;
         bool polygon = (prim == PIPE_PRIM_TRIANGLES);
 
+#if PAN_ARCH <= 9
+        pan_pack_template(out, DRAW, ctx->rasterizer->draw[polygon], cfg) {
+#else
         pan_pack_cs_v10(out, &batch->cs_vertex, DRAW, cfg) {
-                /*
-                 * From the Gallium documentation,
-                 * pipe_rasterizer_state::cull_face "indicates which faces of
-                 * polygons to cull". Points and lines are not considered
-                 * polygons and should be drawn even if all faces are culled.
-                 * The hardware does not take primitive type into account when
-                 * culling, so we need to do that check ourselves.
-                 */
-                cfg.cull_front_face = polygon && (rast->cull_face & PIPE_FACE_FRONT);
-                cfg.cull_back_face = polygon && (rast->cull_face & PIPE_FACE_BACK);
-                cfg.front_face_ccw = rast->front_ccw;
+                panfrost_pack_draw_rasterizer(&cfg, rast, polygon);
+#endif
 
                 if (ctx->occlusion_query && ctx->active_queries) {
                         if (ctx->occlusion_query->type == PIPE_QUERY_OCCLUSION_COUNTER)
@@ -3740,8 +4527,6 @@ panfrost_emit_draw(void *out,
                 struct panfrost_compiled_shader *fs =
                         ctx->prog[PIPE_SHADER_FRAGMENT];
 
-                cfg.multisample_enable = rast->multisample;
-
                 cfg.sample_mask = rast->multisample ? ctx->sample_mask : 0xFFFF;
 
                 /* Use per-sample shading if required by API Also use it when a
@@ -3753,8 +4538,6 @@ panfrost_emit_draw(void *out,
                         (rast->multisample &&
                          ((ctx->min_samples > 1) || ctx->valhall_has_blend_shader));
 
-                cfg.single_sampled_lines = !rast->multisample;
-
                 /* This is filled in by hardware on v10 */
 #if PAN_ARCH < 10
                 cfg.vertex_array.packet = true;
@@ -3865,6 +4648,21 @@ panfrost_emit_draw(void *out,
         }
 }
 
+#if PAN_ARCH >= 10
+/* Vertex packets and polygon lists are allocated from the tiler heap. Culled
+ * primitives take no space, so this overestimates what a draw uses. */
+static void
+panfrost_batch_add_tiler_estimate(struct panfrost_batch *batch,
+                                  const struct pipe_draw_info *info,
+                                  const struct pipe_draw_start_count_bias *draw)
+{
+        uint64_t per_vertex = batch->tiler_vertex_size + PAN_TILER_HEAP_LIST_BYTES;
+
+        batch->tiler_heap_estimate += per_vertex * draw->count *
+                                      info->instance_count;
+}
+#endif
+
 #if PAN_ARCH >= 9
 static void
 panfrost_emit_malloc_vertex(struct panfrost_batch *batch,
@@ -3897,19 +4695,27 @@ panfrost_emit_malloc_vertex(struct panfrost_batch *batch,
                 cfg.count = info->instance_count;
         }
 
+        unsigned vertex_size = 16;
+
         pan_section_pack_cs_v10(job, &batch->cs_vertex, MALLOC_VERTEX_JOB, ALLOCATION, cfg) {
                 if (secondary_shader) {
                         unsigned v = vs->info.varyings.output_count;
                         unsigned f = fs->info.varyings.input_count;
-                        unsigned slots = MAX2(v, f);
-                        slots += util_bitcount(fs->key.fs.fixed_varying_mask);
-                        unsigned size = slots * 16;
+                        unsigned general = MAX2(v, f);
+                        unsigned slots = general +
+                                util_bitcount(fs->key.fs.fixed_varying_mask);
+                        uint32_t fp16 = fs->key.fs.fp16_varying_mask &
+                                        BITFIELD_MASK(general);
+
+                        /* 16 byte slots, except 8 bytes for fp16 varyings */
+                        unsigned size = ALIGN_POT(slots * 16 -
+                                                  util_bitcount(fp16) * 8, 16);
 
-                        /* Assumes 16 byte slots. We could do better. */
 #if PAN_ARCH < 10
                         cfg.vertex_packet_stride = size + 16;
 #endif
                         cfg.vertex_attribute_stride = size;
+                        vertex_size += size;
                 } else {
                         /* Hardware requirement for "no varyings" */
 #if PAN_ARCH < 10
@@ -3923,6 +4729,11 @@ panfrost_emit_malloc_vertex(struct panfrost_batch *batch,
                 cfg.address = panfrost_batch_get_bifrost_tiler(batch, ~0);
         }
 
+#if PAN_ARCH >= 10
+        batch->tiler_vertex_size = vertex_size;
+        panfrost_batch_add_tiler_estimate(batch, info, draw);
+#endif
+
         /* For v10, the scissor is emitted directly by
          * panfrost_emit_viewport */
 #if PAN_ARCH < 10
@@ -4007,11 +4818,17 @@ panfrost_draw_emit_tiler(struct panfrost_batch *batch,
 }
 #endif
 
+/* Runs the transform feedback shader of the draw as a compute job with an
+ * invocation per vertex and instance. Invocations write their outputs at
+ * their position in the draw. On Bifrost and Valhall, invocations of indexed
+ * draws fetch their vertex from the index buffer. Midgard can't load
+ * attributes for an arbitrary vertex, so its indexed draws are captured as if
+ * they weren't indexed. */
 static void
 panfrost_launch_xfb(struct panfrost_batch *batch,
                     const struct pipe_draw_info *info,
                     mali_ptr attribs, mali_ptr attrib_bufs,
-                    unsigned count)
+                    mali_ptr indices, unsigned count)
 {
         struct panfrost_context *ctx = batch->ctx;
 
@@ -4022,8 +4839,6 @@ panfrost_launch_xfb(struct panfrost_batch *batch,
         if (batch->ctx->streamout.num_targets == 0)
                 return;
 
-        /* TODO: XFB with index buffers */
-        //assert(info->index_size == 0);
         u_trim_pipe_prim(info->mode, &count);
 
         if (count == 0)
@@ -4031,6 +4846,9 @@ panfrost_launch_xfb(struct panfrost_batch *batch,
 
         perf_debug_ctx(batch->ctx, "Emulating transform feedback");
 
+        if (PAN_ARCH <= 5 && info->index_size)
+                perf_debug_ctx(batch->ctx, "Transform feedback ignores indices on Midgard");
+
         struct panfrost_uncompiled_shader *vs_uncompiled = ctx->uncompiled[PIPE_SHADER_VERTEX];
         struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
 
@@ -4039,6 +4857,14 @@ panfrost_launch_xfb(struct panfrost_batch *batch,
         mali_ptr saved_rsd = batch->rsd[PIPE_SHADER_VERTEX];
         mali_ptr saved_ubo = batch->uniform_buffers[PIPE_SHADER_VERTEX];
         mali_ptr saved_push = batch->push_uniforms[PIPE_SHADER_VERTEX];
+        unsigned saved_vertex_count = ctx->vertex_count;
+
+        /* The outputs of each instance are packed after the previous one, so
+         * the vertex count read by the shader is the trimmed count of the
+         * draw rather than the number of vertices shaded */
+        ctx->vertex_count = count;
+        ctx->xfb_indices = info->index_size ? indices : 0;
+        ctx->xfb_index_size = info->index_size;
 
         ctx->uncompiled[PIPE_SHADER_VERTEX] = NULL; /* should not be read */
         ctx->prog[PIPE_SHADER_VERTEX] = vs_uncompiled->xfb;
@@ -4059,7 +4885,7 @@ panfrost_launch_xfb(struct panfrost_batch *batch,
                                      batch->tls.gpu);
 
 #if PAN_ARCH < 10
-                /* TODO: Indexing. Also, this is a legacy feature... */
+                /* Also the base of the vertices fetched by indexed draws */
                 cfg.compute.attribute_offset = batch->ctx->offset_start;
 #endif
 
@@ -4088,7 +4914,8 @@ panfrost_launch_xfb(struct panfrost_batch *batch,
                                   attribs, attrib_bufs, t.cpu);
 #endif
 #if PAN_ARCH >= 10
-        // TODO: Use a seperate compute queue?
+        /* The draws following on the vertex/tiler queue read what this
+         * writes, so it stays on that queue rather than a compute one */
         pan_pack_ins(&batch->cs_vertex, COMPUTE_LAUNCH, cfg) {
                 // TODO v10: Set parameters
         }
@@ -4104,25 +4931,13 @@ panfrost_launch_xfb(struct panfrost_batch *batch,
 
         ctx->uncompiled[PIPE_SHADER_VERTEX] = vs_uncompiled;
         ctx->prog[PIPE_SHADER_VERTEX] = vs;
+        ctx->vertex_count = saved_vertex_count;
         batch->rsd[PIPE_SHADER_VERTEX] = saved_rsd;
         batch->uniform_buffers[PIPE_SHADER_VERTEX] = saved_ubo;
         batch->push_uniforms[PIPE_SHADER_VERTEX] = saved_push;
 }
 
 #if PAN_ARCH >= 10
-static pan_command_stream
-panfrost_batch_create_cs(struct panfrost_batch *batch, unsigned count)
-{
-        struct panfrost_ptr cs = pan_pool_alloc_aligned(&batch->pool.base, count * 8, 64);
-
-        return (pan_command_stream) {
-                .ptr = cs.cpu,
-                .begin = cs.cpu,
-                .end = cs.cpu + count,
-                .gpu = cs.gpu,
-        };
-}
-
 static uint64_t *
 panfrost_cs_vertex_allocate_instrs(struct panfrost_batch *batch, unsigned count)
 {
@@ -4155,74 +4970,264 @@ panfrost_cs_vertex_allocate_instrs(struct panfrost_batch *batch, unsigned count)
 
         return batch->cs_vertex.ptr + count;
 }
-#endif
 
 static void
-panfrost_direct_draw(struct panfrost_batch *batch,
-                     const struct pipe_draw_info *info,
-                     unsigned drawid_offset,
-                     const struct pipe_draw_start_count_bias *draw)
+panfrost_csf_patch_branch(pan_command_stream *cs, uint64_t *branch,
+                          enum mali_cs_branch_condition condition,
+                          uint8_t value, uint64_t *target)
 {
-        if (!draw->count || !info->instance_count)
-                return;
+        pan_command_stream patch = *cs;
+        patch.ptr = branch;
 
-        struct panfrost_context *ctx = batch->ctx;
+        /* Offsets are relative to the instruction after the branch */
+        pan_pack_ins(&patch, CS_BRANCH, cfg) {
+                cfg.condition = condition;
+                cfg.value = value;
+                cfg.offset = target - (branch + 1);
+        }
+}
 
-#if PAN_ARCH >= 10
-        /* TODO: We don't need quite so much space */
-        uint64_t *limit = panfrost_cs_vertex_allocate_instrs(batch, 64);
+/* Scratch registers used by the render condition checks */
+#define PAN_CSF_COND_ADDR       0x50
+#define PAN_CSF_COND_VALUE      0x52
 #endif
 
-        /* If we change whether we're drawing points, or whether point sprites
-         * are enabled (specified in the rasterizer), we may need to rebind
-         * shaders accordingly. This implicitly covers the case of rebinding
-         * framebuffers, because all dirty flags are set there.
-         */
-        if ((ctx->dirty & PAN_DIRTY_RASTERIZER) ||
-            ((ctx->active_prim == PIPE_PRIM_POINTS) ^
-             (info->mode       == PIPE_PRIM_POINTS))) {
+#if PAN_ARCH >= 10 || PAN_GPU_INDIRECTS
+/* Number of 64-bit counters written by the render condition query. Only
+ * occlusion counters are accumulated per core. */
+static unsigned
+panfrost_render_condition_counters(struct panfrost_context *ctx)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
 
-                ctx->active_prim = info->mode;
-                panfrost_update_shader_variant(ctx, PIPE_SHADER_FRAGMENT);
-        }
+        return ctx->cond_query->type == PIPE_QUERY_OCCLUSION_COUNTER ?
+               dev->core_id_range : 1;
+}
+#endif
 
-        /* Take into account a negative bias */
-        ctx->indirect_draw = false;
-        ctx->vertex_count = draw->count + (info->index_size ? abs(draw->index_bias) : 0);
-        ctx->instance_count = info->instance_count;
-        ctx->base_vertex = info->index_size ? draw->index_bias : 0;
-        ctx->base_instance = info->start_instance;
-        ctx->active_prim = info->mode;
-        ctx->drawid = drawid_offset;
+#if PAN_ARCH >= 10
+static unsigned
+panfrost_render_condition_instrs_csf(struct panfrost_context *ctx)
+{
+        if (!ctx->render_cond_gpu)
+                return 0;
 
-        struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
+        return 3 + 4 * panfrost_render_condition_counters(ctx);
+}
 
-        bool idvs = vs->info.vs.idvs;
-        bool secondary_shader = vs->info.vs.secondary_enable;
+/* Checks the render condition in the command stream, returning the branch to
+ * patch to skip the draw, or NULL without a render condition on the GPU.
+ * Branches compare 32-bit registers with zero, so each half of the counters
+ * is tested, with any non-zero one branching to the instruction after the
+ * checks. Which way the branches go depends on the condition. */
+static uint64_t *
+panfrost_emit_render_condition_csf(struct panfrost_batch *batch)
+{
+        struct panfrost_context *ctx = batch->ctx;
 
-        UNUSED struct panfrost_ptr tiler, vertex;
+        if (!ctx->render_cond_gpu)
+                return NULL;
 
-#if PAN_ARCH >= 9
-        tiler = pan_pool_alloc_desc_cs_v10(&batch->pool.base, MALLOC_VERTEX_JOB);
-#else /* PAN_ARCH < 9 */
-        if (idvs) {
-#if PAN_ARCH >= 6
-                tiler = pan_pool_alloc_desc(&batch->pool.base, INDEXED_VERTEX_JOB);
-#endif
-                unreachable("IDVS is unsupported on Midgard");
-        } else {
-                vertex = pan_pool_alloc_desc_cs_v10(&batch->pool.base, COMPUTE_JOB);
-                tiler = pan_pool_alloc_desc_cs_v10(&batch->pool.base, TILER_JOB);
+        struct panfrost_resource *rsrc = pan_resource(ctx->cond_query->rsrc);
+        unsigned count = panfrost_render_condition_counters(ctx);
+        pan_command_stream *c = &batch->cs_vertex;
+
+        panfrost_batch_read_rsrc(batch, rsrc, PIPE_SHADER_VERTEX);
+
+        pan_emit_cs_48(c, PAN_CSF_COND_ADDR, rsrc->image.data.bo->ptr.gpu);
+
+        for (unsigned i = 0; i < count; ++i) {
+                pan_pack_ins(c, CS_LDR, cfg) {
+                        cfg.offset = i * sizeof(uint64_t);
+                        cfg.register_mask = 0x3;
+                        cfg.addr = PAN_CSF_COND_ADDR;
+                        cfg.register_base = PAN_CSF_COND_VALUE;
+                }
+                pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 1 << 0; }
+
+                /* Four instructions per counter, plus one for the branch
+                 * after the last counter */
+                for (unsigned j = 0; j < 2; ++j) {
+                        pan_pack_ins(c, CS_BRANCH, cfg) {
+                                cfg.condition = MALI_CS_BRANCH_CONDITION_NE;
+                                cfg.value = PAN_CSF_COND_VALUE + j;
+                                cfg.offset = (count - i) * 4 - 2 - j;
+                        }
+                }
         }
-#endif /* PAN_ARCH */
 
-        unsigned vertex_count = ctx->vertex_count;
+        /* With an inverted condition, the draw only happens if all counters
+         * are zero, so non-zero ones land on the skip branch. Otherwise
+         * they land on the draw, and falling through skips it. */
+        if (ctx->cond_cond) {
+                pan_pack_ins(c, CS_BRANCH, cfg) {
+                        cfg.condition = MALI_CS_BRANCH_CONDITION_ALWAYS;
+                        cfg.offset = 1;
+                }
+        }
 
-        unsigned min_index = 0, max_index = 0;
-        mali_ptr indices = 0;
+        return c->ptr++;
+}
+
+static void
+panfrost_patch_render_condition_csf(struct panfrost_batch *batch,
+                                    uint64_t *skip)
+{
+        if (skip) {
+                panfrost_csf_patch_branch(&batch->cs_vertex, skip,
+                                          MALI_CS_BRANCH_CONDITION_ALWAYS,
+                                          PAN_CSF_COND_VALUE,
+                                          batch->cs_vertex.ptr);
+        }
+}
+#endif
+
+#if PAN_GPU_INDIRECTS
+/* Emits a compute job turning the jobs of a draw into NULL jobs if the render
+ * condition fails, returning the job index they must depend on. */
+static unsigned
+panfrost_emit_render_condition_jm(struct panfrost_batch *batch,
+                                  mali_ptr vertex_job, mali_ptr tiler_job)
+{
+        struct panfrost_context *ctx = batch->ctx;
+
+        if (!ctx->render_cond_gpu)
+                return 0;
+
+        struct panfrost_resource *rsrc = pan_resource(ctx->cond_query->rsrc);
+
+        panfrost_batch_read_rsrc(batch, rsrc, PIPE_SHADER_VERTEX);
+
+        struct pan_render_condition_info info = {
+                .counters = rsrc->image.data.bo->ptr.gpu,
+                .counter_count = panfrost_render_condition_counters(ctx),
+                .inverted = ctx->cond_cond,
+                .vertex_job = vertex_job,
+                .tiler_job = tiler_job,
+        };
+
+        return GENX(panfrost_emit_render_condition)(&batch->pool.base,
+                                                    &batch->scoreboard,
+                                                    &info);
+}
+#endif
+
+/* Makes the storage writes of the jobs already in the batch visible to the
+ * jobs added afterwards, returning false if the batch has to be submitted
+ * instead. On CSF, vertex and compute work runs in order from one stream, so
+ * waiting for it and flushing the caches is enough. Fragment jobs only run
+ * once the whole batch is recorded, so their stores can't be ordered before
+ * later draws of the same batch. */
+static bool
+emit_barrier(struct panfrost_batch *batch)
+{
+#if PAN_ARCH >= 10
+        if (batch->storage_writes & BITFIELD_BIT(PIPE_SHADER_FRAGMENT))
+                return false;
+
+        uint64_t *limit = panfrost_cs_vertex_allocate_instrs(batch, 8);
+        pan_command_stream *c = &batch->cs_vertex;
+
+        pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 0xff; }
+
+        /* A flush ID of zero forces the flush */
+        pan_emit_cs_32(c, 0x4e, 0);
+        pan_pack_ins(c, CS_FLUSH_CACHES, cfg) {
+                cfg.l2_flush_mode = MALI_CS_FLUSH_MODE_CLEAN_AND_INVALIDATE;
+                cfg.lsc_flush_mode = MALI_CS_FLUSH_MODE_CLEAN_AND_INVALIDATE;
+                cfg.other_invalidate = true;
+                cfg.flush_id = 0x4e;
+        }
+        pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 0xff; }
+
+        assert(c->ptr <= limit);
+
+        batch->storage_writes = 0;
+        return true;
+#else
+        return false;
+#endif
+}
+
+static void
+panfrost_direct_draw(struct panfrost_batch *batch,
+                     const struct pipe_draw_info *info,
+                     unsigned drawid_offset,
+                     const struct pipe_draw_start_count_bias *draw)
+{
+        if (!draw->count || !info->instance_count)
+                return;
+
+        struct panfrost_context *ctx = batch->ctx;
+
+#if PAN_ARCH >= 10
+        /* TODO: We don't need quite so much space */
+        uint64_t *limit = panfrost_cs_vertex_allocate_instrs(batch, 64 +
+                panfrost_render_condition_instrs_csf(ctx));
+
+        /* Registers are only known if the previous draw was the last thing
+         * emitted, including any jump to a new buffer */
+        if (batch->cs_vertex.ptr != batch->cs_vertex_draw_end)
+                pan_cs_builder_invalidate(&batch->cs_vertex_regs);
+
+        uint64_t *draw_start = batch->cs_vertex.ptr;
+#endif
+
+        /* If we change whether we're drawing points, or whether point sprites
+         * are enabled (specified in the rasterizer), or the blend state
+         * that may be fused into the fragment shader, we may need to rebind
+         * shaders accordingly. This implicitly covers the case of rebinding
+         * framebuffers, because all dirty flags are set there.
+         */
+        if ((ctx->dirty & (PAN_DIRTY_RASTERIZER | PAN_DIRTY_BLEND)) ||
+            ((ctx->active_prim == PIPE_PRIM_POINTS) ^
+             (info->mode       == PIPE_PRIM_POINTS))) {
+
+                ctx->active_prim = info->mode;
+                panfrost_update_shader_variant(ctx, PIPE_SHADER_FRAGMENT);
+        }
+
+        /* Take into account a negative bias */
+        ctx->indirect_draw = false;
+        ctx->vertex_count = draw->count + (info->index_size ? abs(draw->index_bias) : 0);
+        ctx->instance_count = info->instance_count;
+        ctx->base_vertex = info->index_size ? draw->index_bias : 0;
+        ctx->base_instance = info->start_instance;
+        ctx->active_prim = info->mode;
+        ctx->drawid = drawid_offset;
+
+        struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
+
+        bool idvs = vs->info.vs.idvs;
+        bool secondary_shader = vs->info.vs.secondary_enable;
+
+        UNUSED struct panfrost_ptr tiler, vertex;
+
+#if PAN_ARCH >= 9
+        tiler = pan_pool_alloc_desc_cs_v10(&batch->pool.base, MALLOC_VERTEX_JOB);
+#else /* PAN_ARCH < 9 */
+        if (idvs) {
+#if PAN_ARCH >= 6
+                tiler = pan_pool_alloc_desc(&batch->pool.base, INDEXED_VERTEX_JOB);
+#endif
+                unreachable("IDVS is unsupported on Midgard");
+        } else {
+                vertex = pan_pool_alloc_desc_cs_v10(&batch->pool.base, COMPUTE_JOB);
+                tiler = pan_pool_alloc_desc_cs_v10(&batch->pool.base, TILER_JOB);
+        }
+#endif /* PAN_ARCH */
+
+        unsigned vertex_count = ctx->vertex_count;
+
+        unsigned min_index = 0, max_index = 0;
+        mali_ptr indices = 0;
 
         if (info->index_size && PAN_ARCH >= 9) {
                 indices = panfrost_get_index_buffer(batch, info, draw);
+
+                /* Only read as the first vertex, and as the attribute
+                 * offset of transform feedback */
+                ctx->offset_start = draw->index_bias;
         } else if (info->index_size) {
                 indices = panfrost_get_index_buffer_bounded(batch, info, draw,
                                                             &min_index,
@@ -4293,11 +5298,12 @@ panfrost_direct_draw(struct panfrost_batch *batch,
 #if PAN_ARCH >= 9
                 mali_ptr attribs = 0, attrib_bufs = 0;
 #endif
-                panfrost_launch_xfb(batch, info, attribs, attrib_bufs, draw->count);
+                panfrost_launch_xfb(batch, info, attribs, attrib_bufs,
+                                    indices, draw->count);
         }
 
         /* Increment transform feedback offsets */
-        panfrost_update_streamout_offsets(ctx);
+        panfrost_update_streamout_offsets(ctx, info, draw->count);
 
         /* Any side effects must be handled by the XFB shader, so we only need
          * to run vertex shaders if we need rasterization.
@@ -4305,13 +5311,28 @@ panfrost_direct_draw(struct panfrost_batch *batch,
         if (panfrost_batch_skip_rasterization(batch))
                 return;
 
+        panfrost_batch_count_primitives(batch, info, draw->count);
+
 #if PAN_ARCH >= 9
         assert(idvs && "Memory allocated IDVS required on Valhall");
 
         panfrost_emit_malloc_vertex(batch, info, draw, indices, secondary_shader, tiler.cpu);
 
 #if PAN_ARCH >= 10
+        /* State is emitted in full, drop what the previous draw left in
+         * the registers already */
+        pan_cs_builder_elide_moves(&batch->cs_vertex_regs, draw_start);
+
+        uint64_t *skip = panfrost_emit_render_condition_csf(batch);
         pan_pack_ins(&batch->cs_vertex, IDVS_LAUNCH, _);
+        panfrost_patch_render_condition_csf(batch, skip);
+
+        /* The render condition loads into registers */
+        if (skip)
+                pan_cs_builder_invalidate(&batch->cs_vertex_regs);
+
+        batch->cs_vertex_draw_end = batch->cs_vertex.ptr;
+
         /* TODO: Find a better way to specify that there were jobs */
         batch->scoreboard.first_job = 1;
         batch->scoreboard.first_tiler = NULL + 1;
@@ -4331,6 +5352,14 @@ panfrost_direct_draw(struct panfrost_batch *batch,
         panfrost_draw_emit_tiler(batch, info, draw, &invocation, indices,
                                  fs_vary, varyings, pos, psiz, secondary_shader,
                                  tiler.cpu);
+
+        unsigned cond_dep = 0;
+#if PAN_GPU_INDIRECTS
+        cond_dep = panfrost_emit_render_condition_jm(batch,
+                                                     idvs ? 0 : vertex.gpu,
+                                                     tiler.gpu);
+#endif
+
         if (idvs) {
 #if PAN_ARCH >= 6
                 panfrost_draw_emit_vertex_section(batch,
@@ -4340,34 +5369,358 @@ panfrost_direct_draw(struct panfrost_batch *batch,
 
                 panfrost_add_job(&batch->pool.base, &batch->scoreboard,
                                  MALI_JOB_TYPE_INDEXED_VERTEX, false, false,
-                                 0, 0, &tiler, false);
+                                 cond_dep, 0, &tiler, false);
 #endif /* PAN_ARCH < 6 */
         } else {
                 panfrost_draw_emit_vertex(batch, info, &invocation,
                                           vs_vary, varyings, attribs, attrib_bufs, vertex.cpu);
-                panfrost_emit_vertex_tiler_jobs(batch, &vertex, &tiler);
+                panfrost_emit_vertex_tiler_jobs(batch, &vertex, &tiler, cond_dep);
+        }
+#endif
+}
+
+#if PAN_ARCH >= 10
+static bool
+panfrost_shader_uses_sysval(struct panfrost_compiled_shader *ss, unsigned type)
+{
+        for (unsigned i = 0; i < ss->info.sysvals.sysval_count; ++i) {
+                if (PAN_SYSVAL_TYPE(ss->info.sysvals.sysvals[i]) == type)
+                        return true;
+        }
+
+        return false;
+}
+
+/* Scratch registers used by CSF indirect draws. The toplevel command stream
+ * sets these again before using them after the call returns. */
+#define PAN_CSF_INDIRECT_ADDR   0x40
+#define PAN_CSF_INDIRECT_COUNT  0x42
+#define PAN_CSF_INDIRECT_INST   0x44
+#define PAN_CSF_INDIRECT_LEFT   0x46
+#define PAN_CSF_INDIRECT_STORE  0x4c
+
+/* Indirect draws on CSF are emitted like a direct draw with placeholder
+ * parameters. The command stream then loads the real parameters from the
+ * indirect buffer into the IDVS registers before launching, so the CPU never
+ * has to wait for the buffer. Multi-draws loop over the records, stopping
+ * early at the count from the count buffer. Draw parameters read by the
+ * vertex shader are stored into its push uniforms. */
+static void
+panfrost_indirect_draw_csf(struct panfrost_batch *batch,
+                           const struct pipe_draw_info *info,
+                           unsigned drawid_offset,
+                           const struct pipe_draw_indirect_info *indirect)
+{
+        struct panfrost_context *ctx = batch->ctx;
+
+        if (!indirect->draw_count || !info->instance_count)
+                return;
+
+        uint64_t *limit = panfrost_cs_vertex_allocate_instrs(batch, 96 +
+                panfrost_render_condition_instrs_csf(ctx));
+
+        if ((ctx->dirty & (PAN_DIRTY_RASTERIZER | PAN_DIRTY_BLEND)) ||
+            ((ctx->active_prim == PIPE_PRIM_POINTS) ^
+             (info->mode       == PIPE_PRIM_POINTS))) {
+
+                ctx->active_prim = info->mode;
+                panfrost_update_shader_variant(ctx, PIPE_SHADER_FRAGMENT);
+        }
+
+        /* TODO: update statistics (see panfrost_statistics_record()) */
+        ctx->indirect_draw = true;
+        ctx->vertex_count = ctx->padded_count = 0;
+        ctx->instance_count = info->instance_count;
+        ctx->base_vertex = 0;
+        ctx->base_instance = 0;
+        ctx->offset_start = 0;
+        ctx->active_prim = info->mode;
+        ctx->drawid = drawid_offset;
+
+        /* Set by panfrost_update_shader_state if the vertex shader reads
+         * the draw parameters */
+        ctx->first_vertex_sysval_ptr = 0;
+        ctx->base_vertex_sysval_ptr = 0;
+        ctx->base_instance_sysval_ptr = 0;
+
+        struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
+        bool secondary_shader = vs->info.vs.secondary_enable;
+
+        UNUSED struct panfrost_ptr tiler =
+                pan_pool_alloc_desc_cs_v10(&batch->pool.base, MALLOC_VERTEX_JOB);
+
+        /* The whole index buffer is bound, the index offset of each draw
+         * is loaded into the primitive registers */
+        struct pipe_draw_start_count_bias draw = { 0 };
+        mali_ptr indices = 0;
+
+        if (info->index_size) {
+                draw.count = info->index.resource->width0 / info->index_size;
+                indices = panfrost_get_index_buffer(batch, info, &draw);
+        }
+
+        panfrost_update_state_3d(batch);
+        panfrost_update_shader_state(batch, PIPE_SHADER_VERTEX);
+        panfrost_update_shader_state(batch, PIPE_SHADER_FRAGMENT);
+        panfrost_clean_state_3d(ctx);
+
+        if (panfrost_batch_skip_rasterization(batch))
+                return;
+
+        panfrost_batch_count_primitives(batch, info, ~0);
+
+        panfrost_emit_malloc_vertex(batch, info, &draw, indices,
+                                    secondary_shader, tiler.cpu);
+
+        struct panfrost_resource *rsrc = pan_resource(indirect->buffer);
+        panfrost_batch_read_rsrc(batch, rsrc, PIPE_SHADER_VERTEX);
+
+        pan_command_stream *c = &batch->cs_vertex;
+        bool loop = indirect->draw_count > 1 || indirect->indirect_draw_count;
+
+        pan_emit_cs_48(c, PAN_CSF_INDIRECT_ADDR,
+                       rsrc->image.data.bo->ptr.gpu + indirect->offset);
+
+        if (indirect->indirect_draw_count) {
+                struct panfrost_resource *count =
+                        pan_resource(indirect->indirect_draw_count);
+                panfrost_batch_read_rsrc(batch, count, PIPE_SHADER_VERTEX);
+
+                pan_emit_cs_48(c, PAN_CSF_INDIRECT_COUNT,
+                               count->image.data.bo->ptr.gpu +
+                               indirect->indirect_draw_count_offset);
+                pan_pack_ins(c, CS_LDR, cfg) {
+                        cfg.register_mask = 1;
+                        cfg.addr = PAN_CSF_INDIRECT_COUNT;
+                        cfg.register_base = PAN_CSF_INDIRECT_COUNT;
+                }
+                pan_emit_cs_32(c, PAN_CSF_INDIRECT_COUNT + 1, 0);
+                pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 1 << 0; }
+        }
+
+        if (loop)
+                pan_emit_cs_48(c, PAN_CSF_INDIRECT_LEFT, indirect->draw_count);
+
+        /* The render condition skips all the draws at once */
+        uint64_t *skip = panfrost_emit_render_condition_csf(batch);
+        uint64_t *start = c->ptr, *exit_count = NULL, *exit_left = NULL;
+
+        if (loop) {
+                /* Exit branches, patched once the loop is emitted */
+                if (indirect->indirect_draw_count)
+                        exit_count = c->ptr++;
+                exit_left = c->ptr++;
+        }
+
+        /* Indexed records are { count, instance count, first index, base
+         * vertex, start instance }, and non-indexed ones { count, instance
+         * count, first vertex, start instance }. The first vertex of a
+         * non-indexed draw goes to the base vertex offset register. */
+        pan_pack_ins(c, CS_LDR, cfg) {
+                cfg.register_mask = info->index_size ? 0xf : 0x3;
+                cfg.addr = PAN_CSF_INDIRECT_ADDR;
+                cfg.register_base = 0x21;
+        }
+
+        if (!info->index_size) {
+                pan_pack_ins(c, CS_LDR, cfg) {
+                        cfg.offset = 8;
+                        cfg.register_mask = 1;
+                        cfg.addr = PAN_CSF_INDIRECT_ADDR;
+                        cfg.register_base = 0x24;
+                }
+        }
+
+        mali_ptr vertex_ptr = info->index_size ?
+                ctx->base_vertex_sysval_ptr : ctx->first_vertex_sysval_ptr;
+        mali_ptr instance_ptr = ctx->base_instance_sysval_ptr;
+
+        if (instance_ptr) {
+                pan_pack_ins(c, CS_LDR, cfg) {
+                        cfg.offset = info->index_size ? 16 : 12;
+                        cfg.register_mask = 1;
+                        cfg.addr = PAN_CSF_INDIRECT_ADDR;
+                        cfg.register_base = PAN_CSF_INDIRECT_INST;
+                }
+        }
+
+        pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 1 << 0; }
+
+        if (vertex_ptr || instance_ptr) {
+                /* The push uniforms are shared by all draws of the loop, so
+                 * the previous draw must be done with them */
+                if (loop)
+                        pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 1 << 3; }
+
+                if (vertex_ptr) {
+                        pan_emit_cs_48(c, PAN_CSF_INDIRECT_STORE, vertex_ptr);
+                        pan_pack_ins(c, CS_STR, cfg) {
+                                cfg.register_mask = 1;
+                                cfg.addr = PAN_CSF_INDIRECT_STORE;
+                                cfg.register_base = 0x24;
+                        }
+                }
+
+                if (instance_ptr) {
+                        pan_emit_cs_48(c, PAN_CSF_INDIRECT_STORE, instance_ptr);
+                        pan_pack_ins(c, CS_STR, cfg) {
+                                cfg.register_mask = 1;
+                                cfg.addr = PAN_CSF_INDIRECT_STORE;
+                                cfg.register_base = PAN_CSF_INDIRECT_INST;
+                        }
+                }
+
+                pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = 1 << 0; }
+        }
+
+        pan_pack_ins(c, IDVS_LAUNCH, _);
+
+        if (loop) {
+                pan_pack_ins(c, CS_ADD_IMM, cfg) {
+                        cfg.value = indirect->stride;
+                        cfg.src = PAN_CSF_INDIRECT_ADDR;
+                        cfg.dest = PAN_CSF_INDIRECT_ADDR;
+                }
+                pan_pack_ins(c, CS_ADD_IMM, cfg) {
+                        cfg.value = -1;
+                        cfg.src = PAN_CSF_INDIRECT_LEFT;
+                        cfg.dest = PAN_CSF_INDIRECT_LEFT;
+                }
+
+                if (exit_count) {
+                        pan_pack_ins(c, CS_ADD_IMM, cfg) {
+                                cfg.value = -1;
+                                cfg.src = PAN_CSF_INDIRECT_COUNT;
+                                cfg.dest = PAN_CSF_INDIRECT_COUNT;
+                        }
+                }
+
+                uint64_t *back = c->ptr++;
+                panfrost_csf_patch_branch(c, back,
+                                          MALI_CS_BRANCH_CONDITION_ALWAYS,
+                                          PAN_CSF_INDIRECT_LEFT, start);
+
+                if (exit_count) {
+                        panfrost_csf_patch_branch(c, exit_count,
+                                                  MALI_CS_BRANCH_CONDITION_EQ,
+                                                  PAN_CSF_INDIRECT_COUNT,
+                                                  c->ptr);
+                }
+
+                panfrost_csf_patch_branch(c, exit_left,
+                                          MALI_CS_BRANCH_CONDITION_EQ,
+                                          PAN_CSF_INDIRECT_LEFT, c->ptr);
         }
+
+        panfrost_patch_render_condition_csf(batch, skip);
+
+        batch->scoreboard.first_job = 1;
+        batch->scoreboard.first_tiler = NULL + 1;
+
+        assert(c->ptr <= limit);
+}
 #endif
+
+#if PAN_ARCH >= 10
+/* The draws of a multi-draw share all state, so once the first one has been
+ * emitted, the IDVS registers only need the parameters of the next draw. This
+ * only works if no state was changed by the previous draw, and if the shaders
+ * don't read the draw parameters, which would need new push uniforms. */
+static bool
+panfrost_can_patch_draw_csf(struct panfrost_context *ctx)
+{
+        const unsigned params = PAN_DIRTY_PARAMS | PAN_DIRTY_DRAWID;
+
+        if (ctx->dirty & ~params)
+                return false;
+
+        for (unsigned i = 0; i < PIPE_SHADER_TYPES; ++i) {
+                if (i != PIPE_SHADER_COMPUTE && ctx->dirty_shader[i])
+                        return false;
+        }
+
+        struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
+        struct panfrost_compiled_shader *fs = ctx->prog[PIPE_SHADER_FRAGMENT];
+
+        if (ctx->uncompiled[PIPE_SHADER_VERTEX]->xfb)
+                return false;
+
+        return !((vs->dirty_3d | (fs ? fs->dirty_3d : 0)) & params);
+}
+
+static void
+panfrost_patch_draw_csf(struct panfrost_batch *batch,
+                        const struct pipe_draw_info *info,
+                        unsigned drawid_offset,
+                        const struct pipe_draw_start_count_bias *draw)
+{
+        struct panfrost_context *ctx = batch->ctx;
+
+        if (!draw->count || !info->instance_count)
+                return;
+
+        uint64_t *limit = panfrost_cs_vertex_allocate_instrs(batch, 8 +
+                panfrost_render_condition_instrs_csf(ctx));
+
+        ctx->vertex_count = draw->count + (info->index_size ? abs(draw->index_bias) : 0);
+        ctx->base_vertex = info->index_size ? draw->index_bias : 0;
+        ctx->offset_start = draw->start;
+        ctx->drawid = drawid_offset;
+
+        mali_ptr indices = 0;
+
+        if (info->index_size)
+                indices = panfrost_get_index_buffer(batch, info, draw);
+
+        panfrost_statistics_record(ctx, info, draw);
+        panfrost_update_streamout_offsets(ctx, info, draw->count);
+
+        if (panfrost_batch_skip_rasterization(batch))
+                return;
+
+        panfrost_batch_count_primitives(batch, info, draw->count);
+
+        pan_command_stream *c = &batch->cs_vertex;
+
+        /* Index count and base vertex offset, see panfrost_emit_primitive */
+        pan_emit_cs_32(c, 0x21, draw->count);
+        pan_emit_cs_32(c, 0x24, info->index_size ? draw->index_bias :
+                                                   draw->start);
+
+        if (info->index_size) {
+                pan_pack_cs_v10(NULL, c, INDICES, cfg) {
+                        cfg.address = indices;
+                        cfg.size = draw->count * info->index_size;
+                }
+        }
+
+        uint64_t *skip = panfrost_emit_render_condition_csf(batch);
+        pan_pack_ins(c, IDVS_LAUNCH, _);
+        panfrost_patch_render_condition_csf(batch, skip);
+
+        assert(c->ptr <= limit);
+
+        panfrost_batch_add_tiler_estimate(batch, info, draw);
 }
+#endif
 
 #if PAN_GPU_INDIRECTS
+/* Draws with the parameters at draw_buf, in the layout of an indirect draw
+ * command, patching the jobs on the GPU */
+
 static void
 panfrost_indirect_draw(struct panfrost_batch *batch,
                        const struct pipe_draw_info *info,
                        unsigned drawid_offset,
-                       const struct pipe_draw_indirect_info *indirect,
+                       mali_ptr draw_buf,
                        const struct pipe_draw_start_count_bias *draw)
 {
-        /* Indirect draw count and multi-draw not supported. */
-        assert(indirect->draw_count == 1 && !indirect->indirect_draw_count);
-
         struct panfrost_context *ctx = batch->ctx;
         struct panfrost_device *dev = pan_device(ctx->base.screen);
 
-        perf_debug(dev, "Emulating indirect draw on the GPU");
-
         /* TODO: update statistics (see panfrost_statistics_record()) */
-        /* TODO: Increment transform feedback offsets */
+        /* Transform feedback draws are unrolled on the CPU, see
+         * panfrost_can_draw_indirect_gpu */
         assert(ctx->streamout.num_targets == 0);
 
         ctx->active_prim = info->mode;
@@ -4417,126 +5770,589 @@ panfrost_indirect_draw(struct panfrost_batch *batch,
         ctx->base_vertex_sysval_ptr = 0;
         ctx->base_instance_sysval_ptr = 0;
 
-        panfrost_update_state_3d(batch);
-        panfrost_update_shader_state(batch, PIPE_SHADER_VERTEX);
-        panfrost_update_shader_state(batch, PIPE_SHADER_FRAGMENT);
-        panfrost_clean_state_3d(ctx);
+        panfrost_update_state_3d(batch);
+        panfrost_update_shader_state(batch, PIPE_SHADER_VERTEX);
+        panfrost_update_shader_state(batch, PIPE_SHADER_FRAGMENT);
+        panfrost_clean_state_3d(ctx);
+
+        bool point_coord_replace = (info->mode == PIPE_PRIM_POINTS);
+
+        panfrost_emit_varying_descriptor(batch, 0,
+                                         &vs_vary, &fs_vary, &varyings,
+                                         &varying_buf_count, &pos, &psiz,
+                                         point_coord_replace);
+
+        mali_ptr attribs, attrib_bufs;
+        attribs = panfrost_emit_vertex_data(batch, &attrib_bufs);
+
+        /* Zero-ed invocation, the compute job will update it. */
+        static struct mali_invocation_packed invocation;
+
+        /* Fire off the draw itself */
+        panfrost_draw_emit_tiler(batch, info, draw, &invocation,
+                                 index_buf ? index_buf->ptr.gpu : 0,
+                                 fs_vary, varyings, pos, psiz, secondary_shader,
+                                 tiler.cpu);
+        if (idvs) {
+#if PAN_ARCH >= 6
+                panfrost_draw_emit_vertex_section(batch,
+                                  vs_vary, varyings,
+                                  attribs, attrib_bufs,
+                                  pan_section_ptr(tiler.cpu, INDEXED_VERTEX_JOB, VERTEX_DRAW));
+#endif
+        } else {
+                panfrost_draw_emit_vertex(batch, info, &invocation,
+                                          vs_vary, varyings, attribs, attrib_bufs, vertex.cpu);
+        }
+
+        /* Add the varying heap BO to the batch if we're allocating varyings. */
+        if (varyings) {
+                panfrost_batch_add_bo(batch,
+                                      dev->indirect_draw_shaders.varying_heap,
+                                      PIPE_SHADER_VERTEX);
+        }
+
+        /* Don't count images: those attributes don't need to be patched. */
+        unsigned attrib_count =
+                vs->info.attribute_count -
+                util_bitcount(ctx->image_mask[PIPE_SHADER_VERTEX]);
+
+        struct pan_indirect_draw_info draw_info = {
+                .last_indirect_draw = batch->indirect_draw_job_id,
+                .draw_buf = draw_buf,
+                .index_buf = index_buf ? index_buf->ptr.gpu : 0,
+                .first_vertex_sysval = ctx->first_vertex_sysval_ptr,
+                .base_vertex_sysval = ctx->base_vertex_sysval_ptr,
+                .base_instance_sysval = ctx->base_instance_sysval_ptr,
+                .vertex_job = vertex.gpu,
+                .tiler_job = tiler.gpu,
+                .attrib_bufs = attrib_bufs,
+                .attribs = attribs,
+                .attrib_count = attrib_count,
+                .varying_bufs = varyings,
+                .index_size = info->index_size,
+        };
+
+        if (panfrost_writes_point_size(ctx))
+                draw_info.flags |= PAN_INDIRECT_DRAW_UPDATE_PRIM_SIZE;
+
+        if (vs->info.vs.writes_point_size)
+                draw_info.flags |= PAN_INDIRECT_DRAW_HAS_PSIZ;
+
+        if (idvs)
+                draw_info.flags |= PAN_INDIRECT_DRAW_IDVS;
+
+        if (info->primitive_restart) {
+                draw_info.restart_index = info->restart_index;
+                draw_info.flags |= PAN_INDIRECT_DRAW_PRIMITIVE_RESTART;
+        }
+
+        batch->indirect_draw_job_id =
+                GENX(panfrost_emit_indirect_draw)(&batch->pool.base,
+                                                  &batch->scoreboard,
+                                                  &draw_info,
+                                                  &batch->indirect_draw_ctx);
+
+        if (idvs) {
+                panfrost_add_job(&batch->pool.base, &batch->scoreboard,
+                                 MALI_JOB_TYPE_INDEXED_VERTEX, false, false,
+                                 0, 0, &tiler, false);
+        } else {
+                panfrost_emit_vertex_tiler_jobs(batch, &vertex, &tiler,
+                                                batch->indirect_draw_job_id);
+        }
+}
+
+/* Indexed draws at least this large whose min/max index isn't cached may have
+ * it computed on the GPU */
+#define PAN_GPU_MINMAX_MIN_COUNT 4096
+
+/* The min/max index of a draw is needed to size its vertex job. Computing it
+ * on the CPU requires mapping the index buffer, which waits for the GPU if it
+ * writes the indices. Large draws from such buffers instead go through the
+ * indirect draw path, whose compute job searches the min/max index and
+ * patches the vertex job on the GPU. This relies on the same experimental
+ * support as GPU indirect draws. */
+
+static bool
+panfrost_should_minmax_on_gpu(struct panfrost_context *ctx,
+                              const struct pipe_draw_info *info,
+                              const struct pipe_draw_start_count_bias *draw)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        unsigned min_index, max_index;
+
+        if (!(dev->debug & PAN_DBG_INDIRECT) ||
+            !info->index_size || info->has_user_indices ||
+            info->index_bounds_valid || ctx->streamout.num_targets ||
+            ctx->render_cond_gpu || draw->count < PAN_GPU_MINMAX_MIN_COUNT)
+                return false;
+
+        struct panfrost_resource *rsrc = pan_resource(info->index.resource);
+
+        if (panfrost_minmax_cache_get(rsrc->index_cache, info->index_size,
+                                      draw->start, draw->count,
+                                      &min_index, &max_index))
+                return false;
+
+        return rsrc->track.nr_writers > 0 ||
+               !panfrost_bo_wait(rsrc->image.data.bo, 0, false);
+}
+
+static void
+panfrost_direct_draw_gpu_minmax(struct panfrost_batch *batch,
+                                const struct pipe_draw_info *info,
+                                unsigned drawid_offset,
+                                const struct pipe_draw_start_count_bias *draw)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        perf_debug(dev, "Searching min/max index on the GPU");
+
+        /* Indexed indirect draw command */
+        uint32_t params[] = {
+                draw->count, info->instance_count, draw->start,
+                draw->index_bias, info->start_instance,
+        };
+
+        mali_ptr draw_buf =
+                pan_pool_upload_aligned(&batch->pool.base, params,
+                                        sizeof(params), 16);
+
+        panfrost_statistics_record(ctx, info, draw);
+        panfrost_batch_count_primitives(batch, info, draw->count);
+        panfrost_indirect_draw(batch, info, drawid_offset, draw_buf, draw);
+}
+#endif
+
+static bool
+panfrost_compatible_batch_state(struct panfrost_batch *batch,
+                                bool points)
+{
+        /* Only applies on Valhall */
+        if (PAN_ARCH < 9)
+                return true;
+
+        struct panfrost_context *ctx = batch->ctx;
+        struct pipe_rasterizer_state *rast = &ctx->rasterizer->base;
+
+        bool coord = (rast->sprite_coord_mode == PIPE_SPRITE_COORD_LOWER_LEFT);
+        bool first = rast->flatshade_first;
+
+        /* gl_PointCoord orientation only matters when drawing points, but
+         * provoking vertex doesn't matter for points.
+         */
+        if (points)
+                return pan_tristate_set(&batch->sprite_coord_origin, coord);
+        else
+                return pan_tristate_set(&batch->first_provoking_vertex, first);
+}
+
+#if PAN_ARCH < 10
+static unsigned
+panfrost_batch_job_limit(struct panfrost_context *ctx)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        /* Failed atoms may be batches running into the job timeout, so use
+         * smaller batches from then on */
+        if (dev->kbase) {
+                uint32_t faults = p_atomic_read(&dev->mali.atom_faults);
+
+                if (unlikely(faults != ctx->atom_faults)) {
+                        ctx->atom_faults = faults;
+                        ctx->batch_job_limit = MAX2(ctx->batch_job_limit / 2,
+                                                    PAN_MIN_BATCH_JOBS);
+
+                        perf_debug(dev, "Job failures reported, splitting batches after %u jobs",
+                                   ctx->batch_job_limit);
+                }
+        }
+
+        return ctx->batch_job_limit;
+}
+
+/* Job indices wrap past 16 bits, corrupting the scoreboard dependencies, and
+ * the limit only leaves headroom for the jobs of one draw or dispatch. So it
+ * must be checked before each of them, including every draw of a multi-draw. */
+
+static bool
+panfrost_batch_jobs_full(struct panfrost_context *ctx,
+                         struct panfrost_batch *batch)
+{
+        if (likely(batch->scoreboard.job_index <= panfrost_batch_job_limit(ctx)))
+                return false;
+
+        perf_debug(pan_device(ctx->base.screen), "Splitting batch after %u jobs",
+                   batch->scoreboard.job_index);
+        return true;
+}
+#else
+/* The tiler heap has a fixed number of chunks, and running out of them
+ * faults, as there is no tiler OOM handler to do incremental rendering. So
+ * split batches before their draws might fill most of the heap. As with an
+ * incremental render, the next batch reloads the framebuffer with
+ * pan_preload_fb and carries on. */
+static bool
+panfrost_batch_tiler_heap_full(struct panfrost_batch *batch)
+{
+        struct kbase_context *kctx = batch->ctx->kbase_ctx;
+        const struct kbase_tiler_heap_config *cfg = &kctx->tiler_heap_config;
+        uint64_t size = (uint64_t)cfg->max_chunks * cfg->chunk_size;
+
+        return kctx->num_tiler_heaps &&
+               batch->tiler_heap_estimate > (size / 4) * 3;
+}
+#endif
+
+static bool
+panfrost_can_draw_indirect_gpu(struct panfrost_context *ctx,
+                               const struct pipe_draw_info *info,
+                               const struct pipe_draw_indirect_info *indirect)
+{
+#if PAN_ARCH >= 10
+        struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
+
+        /* Transform feedback is emulated with the vertex count, and the draw
+         * ID sysval can't be patched per draw of the loop */
+        if (ctx->streamout.num_targets ||
+            (info->index_size && info->has_user_indices))
+                return false;
+
+        if ((indirect->draw_count > 1 || indirect->indirect_draw_count) &&
+            panfrost_shader_uses_sysval(vs, PAN_SYSVAL_DRAWID))
+                return false;
+
+        return true;
+#else
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        /* The transform feedback offsets are advanced by the CPU */
+        return PAN_GPU_INDIRECTS && (dev->debug & PAN_DBG_INDIRECT) &&
+               !ctx->streamout.num_targets;
+#endif
+}
+
+#if PAN_ARCH >= 6 && PAN_ARCH < 10
+/* Replaying the draws of earlier batches, see pan_replay.h. The hash covers
+ * everything the jobs and descriptors of a draw are built from. Resources are
+ * identified by the GPU address of their BO, which can't be reused while the
+ * record holds the BO. Draws with side effects, or reading buffers the CPU
+ * may write behind our back, are not replayed. */
+
+static uint64_t
+panfrost_replay_hash_stage(struct panfrost_context *ctx,
+                           enum pipe_shader_type st, uint64_t h)
+{
+        struct panfrost_constant_buffer *buf = &ctx->constant_buffer[st];
+
+        if (ctx->ssbo_mask[st] || ctx->image_mask[st])
+                return 0;
+
+        /* Variants live as long as their shader, whose serial is unique */
+        h = XXH64(&ctx->uncompiled[st]->serial, sizeof(uint32_t), h);
+        h = XXH64(&ctx->prog[st], sizeof(ctx->prog[st]), h);
+
+        for (unsigned i = 0; i < ctx->sampler_view_count[st]; ++i) {
+                struct panfrost_sampler_view *view = ctx->sampler_views[st][i];
+                uint64_t v[4] = { 0 };
+
+                if (view) {
+                        struct panfrost_resource *rsrc =
+                                pan_resource(view->base.texture);
+
+                        v[0] = view->base.format | (view->base.target << 16) |
+                               (view->base.swizzle_r << 21) |
+                               (view->base.swizzle_g << 24) |
+                               (view->base.swizzle_b << 27) |
+                               ((uint64_t) view->base.swizzle_a << 30);
+                        v[1] = rsrc->image.data.bo->ptr.gpu;
+                        v[2] = rsrc->image.layout.modifier;
+
+                        if (rsrc->separate_stencil)
+                                v[3] = rsrc->separate_stencil->image.data.bo->ptr.gpu;
+
+                        h = XXH64(&view->base.u, sizeof(view->base.u), h);
+                }
+
+                h = XXH64(v, sizeof(v), h);
+        }
+
+        for (unsigned i = 0; i < ctx->sampler_count[st]; ++i) {
+                struct panfrost_sampler_state *sampler = ctx->samplers[st][i];
+
+                if (sampler)
+                        h = XXH64(&sampler->base, sizeof(sampler->base), h);
+                else
+                        h = XXH64(&i, sizeof(i), h);
+        }
+
+        u_foreach_bit(i, buf->enabled_mask) {
+                struct pipe_constant_buffer *cb = &buf->cb[i];
+                struct panfrost_resource *rsrc = pan_resource(cb->buffer);
+                uint64_t v[4] = { i, cb->buffer_offset, cb->buffer_size, 0 };
+
+                if (cb->user_buffer) {
+                        h = XXH64(cb->user_buffer, cb->buffer_size, h);
+                } else if (rsrc) {
+                        /* Pushed uniforms are copied from the buffer */
+                        if (rsrc->persistent_write || !rsrc->contents_seqnum)
+                                return 0;
+
+                        v[3] = rsrc->contents_seqnum;
+                        h = XXH64(&rsrc->image.data.bo->ptr.gpu, sizeof(mali_ptr), h);
+                }
+
+                h = XXH64(v, sizeof(v), h);
+        }
+
+        return h;
+}
+
+static uint64_t
+panfrost_replay_hash(struct panfrost_batch *batch,
+                     const struct pipe_draw_info *info, unsigned drawid,
+                     const struct pipe_draw_start_count_bias *draw)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_vertex_state *so = ctx->vertex;
+
+        if (!ctx->uncompiled[PIPE_SHADER_FRAGMENT] ||
+            ctx->uncompiled[PIPE_SHADER_VERTEX]->xfb ||
+            ctx->streamout.num_targets || ctx->occlusion_query ||
+            ctx->prim_queries || ctx->cond_query || info->has_user_indices)
+                return 0;
+
+        uint64_t h = 0;
+
+        h = XXH64(&ctx->rasterizer->base, sizeof(ctx->rasterizer->base), h);
+        h = XXH64(&ctx->blend->base, sizeof(ctx->blend->base), h);
+        h = XXH64(&ctx->depth_stencil->base, sizeof(ctx->depth_stencil->base), h);
+        h = XXH64(&ctx->stencil_ref, sizeof(ctx->stencil_ref), h);
+        h = XXH64(&ctx->blend_color, sizeof(ctx->blend_color), h);
+        h = XXH64(&ctx->sample_mask, sizeof(ctx->sample_mask), h);
+        h = XXH64(&ctx->min_samples, sizeof(ctx->min_samples), h);
+        h = XXH64(&ctx->pipe_viewport, sizeof(ctx->pipe_viewport), h);
+        h = XXH64(&ctx->scissor, sizeof(ctx->scissor), h);
+        h = XXH64(so->pipe, so->num_elements * sizeof(so->pipe[0]), h);
+
+        u_foreach_bit(i, ctx->vb_mask) {
+                struct pipe_vertex_buffer *vb = &ctx->vertex_buffers[i];
+                struct panfrost_resource *rsrc = pan_resource(vb->buffer.resource);
+
+                if (vb->is_user_buffer)
+                        return 0;
+
+                uint64_t v[3] = {
+                        i, rsrc ? rsrc->image.data.bo->ptr.gpu : 0,
+                        vb->buffer_offset | ((uint64_t) vb->stride << 32),
+                };
+
+                h = XXH64(v, sizeof(v), h);
+        }
+
+        h = panfrost_replay_hash_stage(ctx, PIPE_SHADER_VERTEX, h);
+
+        if (h)
+                h = panfrost_replay_hash_stage(ctx, PIPE_SHADER_FRAGMENT, h);
+
+        if (!h)
+                return 0;
+
+        uint64_t params[] = {
+                info->mode | (info->index_size << 8) |
+                (info->primitive_restart << 16),
+                info->restart_index, info->start_instance,
+                info->instance_count, drawid, draw->start, draw->count,
+                draw->index_bias, 0, 0,
+        };
+
+        if (info->index_size) {
+                struct panfrost_resource *rsrc = pan_resource(info->index.resource);
+
+                params[8] = rsrc->image.data.bo->ptr.gpu;
+
+                /* The index bounds are computed from the contents */
+                if (PAN_ARCH < 9) {
+                        if (rsrc->persistent_write || !rsrc->contents_seqnum)
+                                return 0;
+
+                        params[9] = rsrc->contents_seqnum;
+                }
+        }
+
+        h = XXH64(params, sizeof(params), h);
+        return h ? h : 1;
+}
+
+/* Once a draw differs from the record, or the batch is submitted, the jobs of
+ * the draws that matched are linked into the batch. The GPU is done with the
+ * record, see panfrost_replay_start, so they are updated in place. */
+static void
+panfrost_replay_splice(struct panfrost_batch *batch)
+{
+        struct panfrost_replay *rec = batch->replay.record;
+        struct pan_scoreboard *sb = &batch->scoreboard;
+
+        panfrost_replay_truncate(batch);
 
-        bool point_coord_replace = (info->mode == PIPE_PRIM_POINTS);
+        /* None of the state was emitted for the batch */
+        panfrost_dirty_state_all(batch->ctx);
 
-        panfrost_emit_varying_descriptor(batch, 0,
-                                         &vs_vary, &fs_vary, &varyings,
-                                         &varying_buf_count, &pos, &psiz,
-                                         point_coord_replace);
+        if (!sb->first_job)
+                return;
 
-        mali_ptr attribs, attrib_bufs;
-        attribs = panfrost_emit_vertex_data(batch, &attrib_bufs);
+        /* The GPU writes the status of the jobs to their header, which must
+         * be reset for the jobs to run again. Manual update of the header,
+         * as in panfrost_add_job. This is bad, don't copy this pattern. */
+        mali_ptr job = sb->first_job;
 
-        /* Zero-ed invocation, the compute job will update it. */
-        static struct mali_invocation_packed invocation;
+        for (;;) {
+                struct mali_job_header_packed *header =
+                        panfrost_replay_cpu(rec, job);
 
-        /* Fire off the draw itself */
-        panfrost_draw_emit_tiler(batch, info, draw, &invocation,
-                                 index_buf ? index_buf->ptr.gpu : 0,
-                                 fs_vary, varyings, pos, psiz, secondary_shader,
-                                 tiler.cpu);
-        if (idvs) {
-#if PAN_ARCH >= 6
-                panfrost_draw_emit_vertex_section(batch,
-                                  vs_vary, varyings,
-                                  attribs, attrib_bufs,
-                                  pan_section_ptr(tiler.cpu, INDEXED_VERTEX_JOB, VERTEX_DRAW));
-#endif
-        } else {
-                panfrost_draw_emit_vertex(batch, info, &invocation,
-                                          vs_vary, varyings, attribs, attrib_bufs, vertex.cpu);
-        }
+                memset(header->opaque, 0, 4 * sizeof(header->opaque[0]));
 
-        /* Add the varying heap BO to the batch if we're allocating varyings. */
-        if (varyings) {
-                panfrost_batch_add_bo(batch,
-                                      dev->indirect_draw_shaders.varying_heap,
-                                      PIPE_SHADER_VERTEX);
+                if (header == sb->prev_job)
+                        break;
+
+                job = header->opaque[6] | ((uint64_t) header->opaque[7] << 32);
         }
 
-        assert(indirect->buffer);
+        /* Cut the chain after the last job taken */
+        sb->prev_job->opaque[6] = 0;
+        sb->prev_job->opaque[7] = 0;
 
-        struct panfrost_resource *draw_buf = pan_resource(indirect->buffer);
+        batch->tls = rec->tls;
 
-        /* Don't count images: those attributes don't need to be patched. */
-        unsigned attrib_count =
-                vs->info.attribute_count -
-                util_bitcount(ctx->image_mask[PIPE_SHADER_VERTEX]);
+        if (sb->first_tiler) {
+                batch->tiler_ctx.bifrost = rec->tiler_ctx;
+                panfrost_emit_bifrost_tiler_ctx(batch,
+                                                panfrost_get_tiler_heap_desc(batch),
+                                                0, panfrost_replay_cpu(rec, rec->tiler_ctx));
+        }
+}
 
-        panfrost_batch_read_rsrc(batch, draw_buf, PIPE_SHADER_VERTEX);
+/* Draws that can't be replayed end the replay of the batch, and keep it from
+ * being recorded */
+static void
+panfrost_replay_stop(struct panfrost_batch *batch)
+{
+        if (batch->replay.speculating)
+                panfrost_replay_splice(batch);
 
-        struct pan_indirect_draw_info draw_info = {
-                .last_indirect_draw = batch->indirect_draw_job_id,
-                .draw_buf = draw_buf->image.data.bo->ptr.gpu + indirect->offset,
-                .index_buf = index_buf ? index_buf->ptr.gpu : 0,
-                .first_vertex_sysval = ctx->first_vertex_sysval_ptr,
-                .base_vertex_sysval = ctx->base_vertex_sysval_ptr,
-                .base_instance_sysval = ctx->base_instance_sysval_ptr,
-                .vertex_job = vertex.gpu,
-                .tiler_job = tiler.gpu,
-                .attrib_bufs = attrib_bufs,
-                .attribs = attribs,
-                .attrib_count = attrib_count,
-                .varying_bufs = varyings,
-                .index_size = info->index_size,
-        };
+        batch->replay.disabled = true;
+}
 
-        if (panfrost_writes_point_size(ctx))
-                draw_info.flags |= PAN_INDIRECT_DRAW_UPDATE_PRIM_SIZE;
+/* Returns true if the draw was taken from the record instead of emitted */
+static bool
+panfrost_replay_begin_draw(struct panfrost_batch *batch,
+                           const struct pipe_draw_info *info, unsigned drawid,
+                           const struct pipe_draw_start_count_bias *draw)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct panfrost_batch_replay *r = &batch->replay;
 
-        if (vs->info.vs.writes_point_size)
-                draw_info.flags |= PAN_INDIRECT_DRAW_HAS_PSIZ;
+        if (likely(!(dev->debug & PAN_DBG_REPLAY)) || r->disabled)
+                return false;
 
-        if (idvs)
-                draw_info.flags |= PAN_INDIRECT_DRAW_IDVS;
+        /* Skipped by panfrost_direct_draw */
+        if (!draw->count || !info->instance_count)
+                return false;
 
-        if (info->primitive_restart) {
-                draw_info.restart_index = info->restart_index;
-                draw_info.flags |= PAN_INDIRECT_DRAW_PRIMITIVE_RESTART;
+        /* The fragment shader variant is part of the hash, pick it as
+         * panfrost_direct_draw does */
+        if ((ctx->dirty & (PAN_DIRTY_RASTERIZER | PAN_DIRTY_BLEND)) ||
+            ((ctx->active_prim == PIPE_PRIM_POINTS) ^
+             (info->mode       == PIPE_PRIM_POINTS))) {
+
+                ctx->active_prim = info->mode;
+                panfrost_update_shader_variant(ctx, PIPE_SHADER_FRAGMENT);
         }
 
-        batch->indirect_draw_job_id =
-                GENX(panfrost_emit_indirect_draw)(&batch->pool.base,
-                                                  &batch->scoreboard,
-                                                  &draw_info,
-                                                  &batch->indirect_draw_ctx);
+        uint64_t hash = panfrost_replay_hash(batch, info, drawid, draw);
+        unsigned idx = util_dynarray_num_elements(&r->draws,
+                                                  struct panfrost_replay_draw);
 
-        if (idvs) {
-                panfrost_add_job(&batch->pool.base, &batch->scoreboard,
-                                 MALI_JOB_TYPE_INDEXED_VERTEX, false, false,
-                                 0, 0, &tiler, false);
-        } else {
-                panfrost_emit_vertex_tiler_jobs(batch, &vertex, &tiler);
+        if (!r->speculating && !r->record && !idx && hash &&
+            !batch->scoreboard.first_job)
+                panfrost_replay_start(batch, hash);
+
+        if (r->speculating) {
+                struct util_dynarray *recorded = &r->record->draws;
+
+                if (hash && idx < util_dynarray_num_elements(recorded,
+                                                             struct panfrost_replay_draw) &&
+                    util_dynarray_element(recorded, struct panfrost_replay_draw,
+                                          idx)->hash == hash) {
+                        panfrost_replay_skip_draw(batch);
+                        panfrost_statistics_record(ctx, info, draw);
+
+                        /* The viewport was emitted for the batch already,
+                         * see panfrost_draw_vbo */
+                        ctx->dirty &= ~(PAN_DIRTY_VIEWPORT | PAN_DIRTY_SCISSOR);
+                        return true;
+                }
+
+                panfrost_replay_splice(batch);
+        }
+
+        if (!hash) {
+                r->disabled = true;
+                return false;
         }
+
+        r->hash = hash;
+        r->tiler_primitives = batch->tiler_primitives;
+        r->in_draw = true;
+        return false;
+}
+#else
+static void
+panfrost_replay_stop(struct panfrost_batch *batch)
+{
+}
+
+static bool
+panfrost_replay_begin_draw(struct panfrost_batch *batch,
+                           const struct pipe_draw_info *info, unsigned drawid,
+                           const struct pipe_draw_start_count_bias *draw)
+{
+        return false;
 }
 #endif
 
+/* Whether the render condition of a draw can be evaluated by the GPU, rather
+ * than by waiting for the query on the CPU. Only occlusion queries are
+ * written by the GPU, and draws counted on the CPU, by transform feedback or
+ * primitive queries, need the CPU to know whether they happen. On the job
+ * manager, the jobs patched by GPU indirect draws can't be skipped. */
 static bool
-panfrost_compatible_batch_state(struct panfrost_batch *batch,
-                                bool points)
+panfrost_render_condition_gpu(struct panfrost_context *ctx,
+                              const struct pipe_draw_indirect_info *indirect)
 {
-        /* Only applies on Valhall */
-        if (PAN_ARCH < 9)
-                return true;
+        struct panfrost_query *query = ctx->cond_query;
 
-        struct panfrost_context *ctx = batch->ctx;
-        struct pipe_rasterizer_state *rast = &ctx->rasterizer->base;
+        if (!query || !query->rsrc || query == ctx->occlusion_query)
+                return false;
 
-        bool coord = (rast->sprite_coord_mode == PIPE_SPRITE_COORD_LOWER_LEFT);
-        bool first = rast->flatshade_first;
+        if (query->type != PIPE_QUERY_OCCLUSION_COUNTER &&
+            query->type != PIPE_QUERY_OCCLUSION_PREDICATE &&
+            query->type != PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE)
+                return false;
 
-        /* gl_PointCoord orientation only matters when drawing points, but
-         * provoking vertex doesn't matter for points.
-         */
-        if (points)
-                return pan_tristate_set(&batch->sprite_coord_origin, coord);
-        else
-                return pan_tristate_set(&batch->first_provoking_vertex, first);
+        if (ctx->prim_queries || ctx->uncompiled[PIPE_SHADER_VERTEX]->xfb)
+                return false;
+
+#if PAN_ARCH >= 10
+        return true;
+#elif PAN_GPU_INDIRECTS
+        return !(indirect && indirect->buffer);
+#else
+        return false;
+#endif
 }
 
 static void
@@ -4550,13 +6366,22 @@ panfrost_draw_vbo(struct pipe_context *pipe,
         struct panfrost_context *ctx = pan_context(pipe);
         struct panfrost_device *dev = pan_device(pipe->screen);
 
-        if (!panfrost_render_condition_check(ctx))
+        ctx->render_cond_gpu = panfrost_render_condition_gpu(ctx, indirect);
+
+        if (ctx->render_cond_gpu) {
+                /* The query is written by fragment jobs, which only run once
+                 * their batch is complete */
+                panfrost_flush_writer(ctx, pan_resource(ctx->cond_query->rsrc),
+                                      "Conditional rendering");
+        } else if (!panfrost_render_condition_check(ctx)) {
                 return;
+        }
 
         ctx->draw_calls++;
 
         /* Emulate indirect draws unless we're using the experimental path */
-        if ((!(dev->debug & PAN_DBG_INDIRECT) || !PAN_GPU_INDIRECTS) && indirect && indirect->buffer) {
+        if (indirect && indirect->buffer &&
+            !panfrost_can_draw_indirect_gpu(ctx, info, indirect)) {
                 assert(num_draws == 1);
                 util_draw_indirect(pipe, info, indirect);
                 perf_debug(dev, "Emulating indirect draw on the CPU");
@@ -4566,11 +6391,26 @@ panfrost_draw_vbo(struct pipe_context *pipe,
         /* Do some common setup */
         struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
 
-        /* Don't add too many jobs to a single batch. Hardware has a hard limit
-         * of 65536 jobs, but we choose a smaller soft limit (arbitrary) to
-         * avoid the risk of timeouts. This might not be a good idea. */
-        if (unlikely(batch->scoreboard.job_index > 10000))
+        /* Keep graphics work out of batches with compute dispatches, see
+         * panfrost_launch_grid */
+        if (unlikely(batch->has_compute))
+                batch = panfrost_get_fresh_batch_for_fbo(ctx, "Draw after compute");
+
+        batch->has_graphics = true;
+
+#if PAN_ARCH < 10
+        /* Don't add too many jobs to a single batch. Job indices are 16-bit,
+         * but a lower limit may be used to avoid the risk of timeouts. The
+         * command stream has no such limit on CSF. */
+        if (unlikely(panfrost_batch_jobs_full(ctx, batch)))
                 batch = panfrost_get_fresh_batch_for_fbo(ctx, "Too many draws");
+#else
+        if (unlikely(panfrost_batch_tiler_heap_full(batch))) {
+                perf_debug(dev, "Splitting batch using up to %" PRIu64 " bytes of tiler heap",
+                           batch->tiler_heap_estimate);
+                batch = panfrost_get_fresh_batch_for_fbo(ctx, "Tiler heap full");
+        }
+#endif
 
         bool points = (info->mode == PIPE_PRIM_POINTS);
 
@@ -4597,9 +6437,10 @@ panfrost_draw_vbo(struct pipe_context *pipe,
 
         if (indirect) {
                 assert(num_draws == 1);
-                assert(PAN_GPU_INDIRECTS);
+                panfrost_replay_stop(batch);
 
-#if PAN_GPU_INDIRECTS
+                /* The transform feedback offsets are known on the CPU, see
+                 * panfrost_update_streamout_offsets */
                 if (indirect->count_from_stream_output) {
                         struct pipe_draw_start_count_bias tmp_draw = *draws;
                         struct panfrost_streamout_target *so =
@@ -4612,7 +6453,30 @@ panfrost_draw_vbo(struct pipe_context *pipe,
                         return;
                 }
 
-                panfrost_indirect_draw(batch, info, drawid_offset, indirect, &draws[0]);
+#if PAN_ARCH >= 10
+                if (indirect->buffer) {
+                        panfrost_indirect_draw_csf(batch, info, drawid_offset,
+                                                   indirect);
+                        return;
+                }
+#endif
+
+                assert(PAN_GPU_INDIRECTS);
+
+#if PAN_GPU_INDIRECTS
+                /* Indirect draw count and multi-draw not supported. */
+                assert(indirect->draw_count == 1 && !indirect->indirect_draw_count);
+                assert(indirect->buffer);
+
+                perf_debug(dev, "Emulating indirect draw on the GPU");
+
+                struct panfrost_resource *draw_buf = pan_resource(indirect->buffer);
+                panfrost_batch_read_rsrc(batch, draw_buf, PIPE_SHADER_VERTEX);
+                panfrost_batch_count_primitives(batch, info, ~0);
+
+                panfrost_indirect_draw(batch, info, drawid_offset,
+                                       draw_buf->image.data.bo->ptr.gpu +
+                                       indirect->offset, &draws[0]);
                 return;
 #endif
         }
@@ -4621,7 +6485,43 @@ panfrost_draw_vbo(struct pipe_context *pipe,
         unsigned drawid = drawid_offset;
 
         for (unsigned i = 0; i < num_draws; i++) {
-                panfrost_direct_draw(batch, &tmp_info, drawid, &draws[i]);
+#if PAN_ARCH < 10
+                if (i > 0 && unlikely(panfrost_batch_jobs_full(ctx, batch))) {
+                        batch = panfrost_get_fresh_batch_for_fbo(ctx, "Too many draws");
+                        batch->has_graphics = true;
+
+                        ASSERTED bool succ = panfrost_compatible_batch_state(batch, points);
+                        assert(succ && "must be able to set state for a fresh batch");
+
+                        batch->viewport = panfrost_emit_viewport(batch);
+                }
+#endif
+
+#if PAN_ARCH >= 10
+                if (i > 0 && panfrost_can_patch_draw_csf(ctx)) {
+                        panfrost_patch_draw_csf(batch, &tmp_info, drawid,
+                                                &draws[i]);
+                } else
+#endif
+#if PAN_GPU_INDIRECTS
+                if (panfrost_should_minmax_on_gpu(ctx, &tmp_info, &draws[i])) {
+                        panfrost_replay_stop(batch);
+                        panfrost_direct_draw_gpu_minmax(batch, &tmp_info,
+                                                        drawid, &draws[i]);
+                } else
+#endif
+                if (!panfrost_replay_begin_draw(batch, &tmp_info, drawid,
+                                                &draws[i])) {
+                        panfrost_direct_draw(batch, &tmp_info, drawid,
+                                             &draws[i]);
+
+                        if (batch->replay.in_draw)
+                                panfrost_replay_end_draw(batch);
+                }
+
+                /* The sysvals of the next draw must be uploaded again if the
+                 * shaders read them */
+                ctx->dirty |= PAN_DIRTY_PARAMS;
 
                 if (tmp_info.increment_draw_id) {
                         ctx->dirty |= PAN_DIRTY_DRAWID;
@@ -4640,14 +6540,35 @@ panfrost_launch_grid(struct pipe_context *pipe,
                 const struct pipe_grid_info *info)
 {
         struct panfrost_context *ctx = pan_context(pipe);
+        UNUSED struct panfrost_device *dev = pan_device(pipe->screen);
+        struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
 
-        /* XXX - shouldn't be necessary with working memory barriers. Affected
-         * test: KHR-GLES31.core.compute_shader.pipeline-post-xfb */
-        panfrost_flush_all_batches(ctx, "Launch grid pre-barrier");
+        /* Compute jobs would run before the fragment jobs of the batch, and
+         * are not ordered against its vertex jobs on CSF, so graphics work and
+         * compute dispatches go in separate batches. Back-to-back dispatches
+         * share a batch. Affected test:
+         * KHR-GLES31.core.compute_shader.pipeline-post-xfb */
+        if (batch->has_graphics || batch->clear) {
+                /* A pending clear is graphics work too, but neither it nor
+                 * draws not emitted yet leave jobs to split the batch on,
+                 * in which case it must be flushed instead */
+                if (batch->scoreboard.first_job) {
+                        batch = panfrost_get_fresh_batch_for_fbo(ctx, "Launch grid after graphics work");
+                } else {
+                        panfrost_flush_all_batches(ctx, "Launch grid after graphics work");
+                        batch = panfrost_get_batch_for_fbo(ctx);
+                }
+        }
 
-        struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
+#if PAN_ARCH < 10
+        if (unlikely(panfrost_batch_jobs_full(ctx, batch)))
+                batch = panfrost_get_fresh_batch_for_fbo(ctx, "Too many dispatches");
+#endif
 
-        if (info->indirect && !PAN_GPU_INDIRECTS) {
+        batch->has_compute = true;
+
+        /* CSF loads the dimensions of indirect dispatches itself */
+        if (info->indirect && !PAN_GPU_INDIRECTS && PAN_ARCH < 10) {
                 struct pipe_transfer *transfer;
                 uint32_t *params = pipe_buffer_map_range(pipe, info->indirect,
                                 info->indirect_offset,
@@ -4670,6 +6591,12 @@ panfrost_launch_grid(struct pipe_context *pipe,
 
         ctx->compute_grid = info;
 
+        /* The dimensions of indirect dispatches are read on the GPU */
+        if (info->indirect) {
+                panfrost_batch_read_rsrc(batch, pan_resource(info->indirect),
+                                         PIPE_SHADER_COMPUTE);
+        }
+
         UNUSED struct panfrost_ptr t =
                 pan_pool_alloc_desc_cs_v10(&batch->pool.base, COMPUTE_JOB);
 
@@ -4683,6 +6610,15 @@ panfrost_launch_grid(struct pipe_context *pipe,
         /* Conservatively assume workgroup size changes every launch */
         ctx->dirty |= PAN_DIRTY_PARAMS;
 
+        /* Dispatches are only serialized after storage writes, which GL
+         * requires a memory barrier for anyway */
+        UNUSED bool serialize =
+                batch->storage_writes & BITFIELD_BIT(PIPE_SHADER_COMPUTE);
+
+        /* Set again if this shader reads the workgroup count, so indirect
+         * dispatches never patch the uniforms of an earlier one */
+        memset(batch->num_wg_sysval, 0, sizeof(batch->num_wg_sysval));
+
         panfrost_update_shader_state(batch, PIPE_SHADER_COMPUTE);
 
 #if PAN_ARCH <= 7
@@ -4694,9 +6630,11 @@ panfrost_launch_grid(struct pipe_context *pipe,
 
         pan_section_pack(t.cpu, COMPUTE_JOB, PARAMETERS, cfg) {
                 cfg.job_task_split =
-                        util_logbase2_ceil(info->block[0] + 1) +
-                        util_logbase2_ceil(info->block[1] + 1) +
-                        util_logbase2_ceil(info->block[2] + 1);
+                        panfrost_compute_task_split(dev->core_count,
+                                                    num_wg[0], num_wg[1], num_wg[2],
+                                                    info->block[0], info->block[1],
+                                                    info->block[2],
+                                                    info->indirect != NULL);
         }
 
         pan_section_pack(t.cpu, COMPUTE_JOB, DRAW, cfg) {
@@ -4711,6 +6649,10 @@ panfrost_launch_grid(struct pipe_context *pipe,
 #else
         struct panfrost_compiled_shader *cs = ctx->prog[PIPE_SHADER_COMPUTE];
 
+#if PAN_ARCH >= 10
+        uint64_t *limit = panfrost_cs_vertex_allocate_instrs(batch, 48);
+#endif
+
         pan_section_pack_cs_v10(t.cpu, &batch->cs_vertex, COMPUTE_JOB, PAYLOAD, cfg) {
                 cfg.workgroup_size_x = info->block[0];
                 cfg.workgroup_size_y = info->block[1];
@@ -4735,8 +6677,15 @@ panfrost_launch_grid(struct pipe_context *pipe,
                         (info->variable_shared_mem == 0);
 
 #if PAN_ARCH < 10
-                cfg.task_increment = 1;
-                cfg.task_axis = MALI_TASK_AXIS_Z;
+                unsigned axis, increment;
+                panfrost_compute_task_axis(dev->core_count,
+                                           dev->thread_tls_alloc, num_wg,
+                                           info->block[0] * info->block[1] *
+                                           info->block[2],
+                                           &axis, &increment);
+
+                cfg.task_increment = increment;
+                cfg.task_axis = axis;
 #endif
         }
 #endif
@@ -4762,21 +6711,56 @@ panfrost_launch_grid(struct pipe_context *pipe,
 #endif
 
 #if PAN_ARCH >= 10
-        pan_pack_ins(&batch->cs_vertex, COMPUTE_LAUNCH, cfg) {
+        pan_command_stream *c = &batch->cs_vertex;
+
+        /* Indirect dispatches load the workgroup counts over the ones packed
+         * in the payload, and store them to the uniforms of the shader when
+         * it reads them, with no job to patch the parameters */
+        if (info->indirect) {
+                mali_ptr dim = pan_resource(info->indirect)->image.data.bo->ptr.gpu +
+                               info->indirect_offset;
+
+                pan_emit_cs_48(c, 0x48, dim);
+                pan_pack_ins(c, CS_LDR, cfg) {
+                        cfg.register_mask = 0x7;
+                        cfg.addr = 0x48;
+                        cfg.register_base = 0x25;
+                }
+                pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = (1 << 0) | (1 << 3); }
+
+                for (unsigned i = 0; i < 3; ++i) {
+                        if (!batch->num_wg_sysval[i])
+                                continue;
+
+                        pan_emit_cs_48(c, 0x48, batch->num_wg_sysval[i]);
+                        pan_pack_ins(c, CS_STR, cfg) {
+                                cfg.register_mask = 0x1;
+                                cfg.addr = 0x48;
+                                cfg.register_base = 0x25 + i;
+                        }
+                }
+
+                pan_pack_ins(c, CS_WAIT, cfg) { cfg.slots = (1 << 0) | (1 << 3); }
+        }
+
+        pan_pack_ins(c, COMPUTE_LAUNCH, cfg) {
                 /* TODO: Change this as needed */
                 cfg.unk_1 = 512;
         }
         batch->scoreboard.first_job = 1;
+
+        /* Make sure we didn't use more CS instructions than we allocated
+         * space for */
+        assert(c->ptr <= limit);
 #else
         panfrost_add_job(&batch->pool.base, &batch->scoreboard,
-                         MALI_JOB_TYPE_COMPUTE, true, false,
+                         MALI_JOB_TYPE_COMPUTE, serialize, false,
                          indirect_dep, 0, &t, false);
 #endif
-        panfrost_flush_all_batches(ctx, "Launch grid post-barrier");
 }
 
 static void *
-panfrost_create_rasterizer_state(
+panfrost_pack_rasterizer_state(
         struct pipe_context *pctx,
         const struct pipe_rasterizer_state *cso)
 {
@@ -4802,6 +6786,30 @@ panfrost_create_rasterizer_state(
         }
 #endif
 
+#if PAN_ARCH <= 9
+        for (unsigned polygon = 0; polygon < 2; ++polygon) {
+                pan_pack(&so->draw[polygon], DRAW, cfg)
+                        panfrost_pack_draw_rasterizer(&cfg, cso, polygon);
+        }
+#endif
+
+        return so;
+}
+
+static void *
+panfrost_create_rasterizer_state(struct pipe_context *pctx,
+                                 const struct pipe_rasterizer_state *cso)
+{
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+        void *so = panfrost_cso_store_get(screen, PAN_CSO_RASTERIZER,
+                                          cso, sizeof(*cso));
+
+        if (!so) {
+                so = panfrost_cso_store_add(screen, PAN_CSO_RASTERIZER,
+                                            cso, sizeof(*cso),
+                                            panfrost_pack_rasterizer_state(pctx, cso));
+        }
+
         return so;
 }
 
@@ -4934,8 +6942,8 @@ pipe_zs_always_passes(const struct pipe_depth_stencil_alpha_state *zsa)
 }
 
 static void *
-panfrost_create_depth_stencil_state(struct pipe_context *pipe,
-                                    const struct pipe_depth_stencil_alpha_state *zsa)
+panfrost_pack_depth_stencil_state(struct pipe_context *pipe,
+                                  const struct pipe_depth_stencil_alpha_state *zsa)
 {
         struct panfrost_zsa_state *so = CALLOC_STRUCT(panfrost_zsa_state);
         so->base = *zsa;
@@ -5008,6 +7016,23 @@ panfrost_create_depth_stencil_state(struct pipe_context *pipe,
         return so;
 }
 
+static void *
+panfrost_create_depth_stencil_state(struct pipe_context *pipe,
+                                    const struct pipe_depth_stencil_alpha_state *zsa)
+{
+        struct panfrost_screen *screen = pan_screen(pipe->screen);
+        void *so = panfrost_cso_store_get(screen, PAN_CSO_ZSA,
+                                          zsa, sizeof(*zsa));
+
+        if (!so) {
+                so = panfrost_cso_store_add(screen, PAN_CSO_ZSA,
+                                            zsa, sizeof(*zsa),
+                                            panfrost_pack_depth_stencil_state(pipe, zsa));
+        }
+
+        return so;
+}
+
 static struct pipe_sampler_view *
 panfrost_create_sampler_view(
         struct pipe_context *pctx,
@@ -5015,9 +7040,15 @@ panfrost_create_sampler_view(
         const struct pipe_sampler_view *template)
 {
         struct panfrost_context *ctx = pan_context(pctx);
-        struct panfrost_sampler_view *so = rzalloc(pctx, struct panfrost_sampler_view);
 
-        pan_legalize_afbc_format(ctx, pan_resource(texture), template->format);
+        /* Threaded contexts create views on the application thread, so the
+         * view can't be parented to the context, and legalizing the format
+         * and building the descriptor wait until it is bound and used on the
+         * driver thread. */
+        struct panfrost_sampler_view *so = rzalloc(NULL, struct panfrost_sampler_view);
+
+        if (!ctx->tc)
+                pan_legalize_afbc_format(ctx, pan_resource(texture), template->format);
 
         pipe_reference(NULL, &texture->reference);
 
@@ -5026,7 +7057,8 @@ panfrost_create_sampler_view(
         so->base.reference.count = 1;
         so->base.context = pctx;
 
-        panfrost_create_sampler_view_bo(so, pctx, texture);
+        if (!ctx->tc)
+                panfrost_create_sampler_view_bo(so, pctx, texture);
 
         return (struct pipe_sampler_view *) so;
 }
@@ -5084,17 +7116,25 @@ panfrost_init_logicop_blend_state(struct panfrost_blend_state *so)
  * expression and initialize blend shaders */
 
 static void *
-panfrost_create_blend_state(struct pipe_context *pipe,
-                            const struct pipe_blend_state *blend)
+panfrost_pack_blend_state(struct pipe_context *pipe,
+                          const struct pipe_blend_state *blend)
 {
         struct panfrost_blend_state *so = CALLOC_STRUCT(panfrost_blend_state);
         so->base = *blend;
 
-        so->pan.logicop_enable = blend->logicop_enable;
+        /* COPY and NOOP don't combine the source with the destination, so
+         * they are plain (possibly masked-out) stores that fixed-function
+         * blending handles for every format. Only the other logic ops need
+         * blend shaders. */
+        bool store_logicop = blend->logicop_enable &&
+                (blend->logicop_func == PIPE_LOGICOP_COPY ||
+                 blend->logicop_func == PIPE_LOGICOP_NOOP);
+
+        so->pan.logicop_enable = blend->logicop_enable && !store_logicop;
         so->pan.logicop_func = blend->logicop_func;
         so->pan.rt_count = blend->max_rt + 1;
 
-        if (blend->logicop_enable) {
+        if (so->pan.logicop_enable) {
                 panfrost_init_logicop_blend_state(so);
                 return so;
         }
@@ -5105,9 +7145,12 @@ panfrost_create_blend_state(struct pipe_context *pipe,
                 struct pan_blend_equation equation = {0};
 
                 equation.color_mask = pipe.colormask;
-                equation.blend_enable = pipe.blend_enable;
+                equation.blend_enable = pipe.blend_enable && !store_logicop;
 
-                if (pipe.blend_enable) {
+                if (store_logicop && blend->logicop_func == PIPE_LOGICOP_NOOP)
+                        equation.color_mask = 0;
+
+                if (equation.blend_enable) {
                         equation.rgb_func = util_blend_func_to_shader(pipe.rgb_func);
                         equation.rgb_src_factor = util_blend_factor_to_shader(pipe.rgb_src_factor);
                         equation.rgb_invert_src_factor = util_blend_factor_is_inverted(pipe.rgb_src_factor);
@@ -5158,6 +7201,23 @@ panfrost_create_blend_state(struct pipe_context *pipe,
         return so;
 }
 
+static void *
+panfrost_create_blend_state(struct pipe_context *pipe,
+                            const struct pipe_blend_state *blend)
+{
+        struct panfrost_screen *screen = pan_screen(pipe->screen);
+        void *so = panfrost_cso_store_get(screen, PAN_CSO_BLEND,
+                                          blend, sizeof(*blend));
+
+        if (!so) {
+                so = panfrost_cso_store_add(screen, PAN_CSO_BLEND,
+                                            blend, sizeof(*blend),
+                                            panfrost_pack_blend_state(pipe, blend));
+        }
+
+        return so;
+}
+
 #if PAN_ARCH >= 9
 static enum mali_flush_to_zero_mode
 panfrost_ftz_mode(struct pan_shader_info *info)
@@ -5277,6 +7337,7 @@ static void
 screen_destroy(struct pipe_screen *pscreen)
 {
         struct panfrost_device *dev = pan_device(pscreen);
+        util_queue_fence_destroy(&pan_screen(pscreen)->blitter.prefill_fence);
         GENX(pan_blitter_cleanup)(dev);
 
 #if PAN_GPU_INDIRECTS
@@ -5318,6 +7379,9 @@ init_batch(struct panfrost_batch *batch)
 #if PAN_ARCH >= 10
         batch->cs_vertex = panfrost_batch_create_cs(batch, 1 << 13);
         batch->cs_fragment = panfrost_batch_create_cs(batch, 1 << 9);
+
+        pan_cs_builder_init(&batch->cs_vertex_regs, &batch->cs_vertex, 0, 0);
+        batch->cs_vertex_draw_end = NULL;
 #endif
 }
 
@@ -5333,9 +7397,29 @@ panfrost_sampler_view_destroy(
         ralloc_free(view);
 }
 
+static void
+blitter_prefill_execute(void *data, void *gdata, int thread_index)
+{
+        GENX(pan_blitter_prefill)(data);
+}
+
 static void
 context_init(struct pipe_context *pipe)
 {
+        struct panfrost_screen *screen = pan_screen(pipe->screen);
+        struct panfrost_device *dev = &screen->dev;
+
+        /* Blit shaders are compiled on first use. Compile the common ones in
+         * the background once a context exists, so processes that only
+         * create a screen never pay for them. */
+        if (!(dev->debug & PAN_DBG_NO_PRECOMPILE) &&
+            util_queue_is_initialized(&screen->shader_queue) &&
+            !p_atomic_cmpxchg(&screen->blitter.prefill_queued, 0, 1)) {
+                util_queue_add_job(&screen->shader_queue, dev,
+                                   &screen->blitter.prefill_fence,
+                                   blitter_prefill_execute, NULL, 0);
+        }
+
         pipe->draw_vbo           = panfrost_draw_vbo;
         pipe->launch_grid        = panfrost_launch_grid;
 
@@ -5363,10 +7447,18 @@ batch_get_polygon_list(struct panfrost_batch *batch)
 
         if (!batch->tiler_ctx.midgard.polygon_list) {
                 bool has_draws = batch->scoreboard.first_tiler != NULL;
+
+                /* The polygon list is allocated at submit, when the
+                 * primitives of the batch are known */
+                unsigned primitive_size =
+                        panfrost_tiler_primitive_size(batch->key.width,
+                                                      batch->key.height,
+                                                      batch->tiler_primitives);
                 unsigned size =
                         panfrost_tiler_get_polygon_list_size(dev,
                                                              batch->key.width,
                                                              batch->key.height,
+                                                             primitive_size,
                                                              has_draws);
                 size = util_next_power_of_two(size);
 
@@ -5399,6 +7491,7 @@ batch_get_polygon_list(struct panfrost_batch *batch)
                 }
 
                 batch->tiler_ctx.midgard.disable = !has_draws;
+                batch->tiler_ctx.midgard.primitive_size = primitive_size;
         }
 
         return batch->tiler_ctx.midgard.polygon_list->ptr.gpu;
@@ -5425,14 +7518,19 @@ GENX(panfrost_cmdstream_screen_init)(struct panfrost_screen *screen)
         screen->vtbl.emit_tls    = emit_tls;
         screen->vtbl.emit_fbd    = emit_fbd;
         screen->vtbl.emit_fragment_job = emit_fragment_job;
+        screen->vtbl.emit_timestamps = emit_timestamps;
         screen->vtbl.screen_destroy = screen_destroy;
         screen->vtbl.preload     = preload;
         screen->vtbl.context_init = context_init;
         screen->vtbl.init_batch = init_batch;
         screen->vtbl.get_blend_shader = GENX(pan_blend_get_shader_locked);
         screen->vtbl.init_polygon_list = init_polygon_list;
+#if PAN_ARCH >= 6 && PAN_ARCH < 10
+        screen->vtbl.replay_splice = panfrost_replay_splice;
+#endif
         screen->vtbl.get_compiler_options = GENX(pan_shader_get_compiler_options);
         screen->vtbl.compile_shader = GENX(pan_shader_compile);
+        screen->vtbl.emit_barrier = emit_barrier;
 #if PAN_ARCH >= 10
         screen->vtbl.emit_csf_toplevel = emit_csf_toplevel;
         screen->vtbl.init_cs = init_cs;
@@ -5440,6 +7538,7 @@ GENX(panfrost_cmdstream_screen_init)(struct panfrost_screen *screen)
 
         GENX(pan_blitter_init)(dev, &screen->blitter.bin_pool.base,
                                &screen->blitter.desc_pool.base);
+        util_queue_fence_init(&screen->blitter.prefill_fence);
 #if PAN_GPU_INDIRECTS
         GENX(panfrost_init_indirect_draw_shaders)(dev, &screen->indirect_draw.bin_pool.base);
 #endif
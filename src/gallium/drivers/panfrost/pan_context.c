@@ -26,20 +26,25 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <poll.h>
 
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_context.h"
 #include "pan_minmax_cache.h"
+#include "pan_tracepoints.h"
 
 #include "util/macros.h"
 #include "util/format/u_format.h"
 #include "util/libsync.h"
+#include "util/os_time.h"
 #include "util/u_inlines.h"
 #include "util/u_upload_mgr.h"
 #include "util/u_memory.h"
 #include "util/u_surface.h"
 #include "util/u_vbuf.h"
+#include "util/u_trace_gallium.h"
 #include "util/half_float.h"
 #include "util/u_helpers.h"
 #include "util/format/u_format.h"
@@ -48,6 +53,8 @@
 #include "util/u_surface.h"
 #include "util/u_math.h"
 #include "util/u_debug_cb.h"
+#include "util/u_debug.h"
+#include "util/u_atomic.h"
 
 #include "pan_fence.h"
 #include "pan_screen.h"
@@ -112,6 +119,10 @@ panfrost_flush(
         /* Submit all pending jobs */
         panfrost_flush_all_batches(ctx, NULL);
 
+        /* Applications which stop freeing BOs would otherwise never trim
+         * the cache */
+        panfrost_bo_cache_evict_stale(dev);
+
         if (fence) {
                 struct pipe_fence_handle *f = panfrost_fence_create(ctx);
                 pipe->screen->fence_reference(pipe->screen, fence, NULL);
@@ -120,6 +131,11 @@ panfrost_flush(
 
         if (dev->debug & PAN_DBG_TRACE)
                 pandecode_next_frame();
+
+        pan_capture_next_frame(dev);
+
+        u_trace_context_process(&ctx->trace_context,
+                                !!(flags & PIPE_FLUSH_END_OF_FRAME));
 }
 
 static void
@@ -138,12 +154,265 @@ panfrost_set_frontend_noop(struct pipe_context *pipe, bool enable)
 }
 
 
+/* Sampler, rasterizer, depth/stencil/alpha and blend CSOs only depend on
+ * their template, so they are stored once per screen keyed by the template
+ * and shared by all contexts creating them. Each entry is reference counted
+ * by the create calls returning it. A CSO is only freed once every context
+ * that got it has deleted it, and with it cleared its caches keyed by the
+ * CSO pointer, so the pointer can't be reused behind the back of a context.
+ */
+
+struct panfrost_cso_key {
+        enum panfrost_cso_type type;
+        unsigned size;
+        const void *templ;
+};
+
+struct panfrost_cso_store_entry {
+        struct panfrost_cso_key key;
+        void *cso;
+        unsigned users;
+};
+
+static uint32_t
+panfrost_cso_key_hash(const void *key)
+{
+        const struct panfrost_cso_key *k = key;
+
+        return _mesa_hash_data_with_seed(k->templ, k->size, k->type);
+}
+
+static bool
+panfrost_cso_key_equal(const void *a, const void *b)
+{
+        const struct panfrost_cso_key *ka = a, *kb = b;
+
+        return ka->type == kb->type && ka->size == kb->size &&
+               !memcmp(ka->templ, kb->templ, ka->size);
+}
+
+void
+panfrost_cso_store_init(struct panfrost_screen *screen)
+{
+        simple_mtx_init(&screen->cso_store.lock, mtx_plain);
+        screen->cso_store.table =
+                _mesa_hash_table_create(NULL, panfrost_cso_key_hash,
+                                        panfrost_cso_key_equal);
+        screen->cso_store.objects = _mesa_pointer_hash_table_create(NULL);
+}
+
+void
+panfrost_cso_store_cleanup(struct panfrost_screen *screen)
+{
+        if (!screen->cso_store.table)
+                return;
+
+        hash_table_foreach(screen->cso_store.table, entry) {
+                struct panfrost_cso_store_entry *e = entry->data;
+
+                free(e->cso);
+                free(e);
+        }
+
+        _mesa_hash_table_destroy(screen->cso_store.table, NULL);
+        _mesa_hash_table_destroy(screen->cso_store.objects, NULL);
+        simple_mtx_destroy(&screen->cso_store.lock);
+}
+
+/* Returns the stored CSO for the template with a new reference, or NULL if
+ * the caller has to create it and add it with panfrost_cso_store_add */
+
+void *
+panfrost_cso_store_get(struct panfrost_screen *screen,
+                       enum panfrost_cso_type type,
+                       const void *templ, unsigned size)
+{
+        struct panfrost_cso_key key = { type, size, templ };
+        void *cso = NULL;
+
+        simple_mtx_lock(&screen->cso_store.lock);
+
+        struct hash_entry *entry =
+                _mesa_hash_table_search(screen->cso_store.table, &key);
+
+        if (entry) {
+                struct panfrost_cso_store_entry *e = entry->data;
+
+                e->users++;
+                cso = e->cso;
+        }
+
+        simple_mtx_unlock(&screen->cso_store.lock);
+        return cso;
+}
+
+/* Another context may have added the same template since the lookup, in
+ * which case the new CSO is dropped for the stored one */
+
+void *
+panfrost_cso_store_add(struct panfrost_screen *screen,
+                       enum panfrost_cso_type type,
+                       const void *templ, unsigned size, void *cso)
+{
+        struct panfrost_cso_key key = { type, size, templ };
+
+        simple_mtx_lock(&screen->cso_store.lock);
+
+        uint32_t hash = panfrost_cso_key_hash(&key);
+        struct hash_entry *entry =
+                _mesa_hash_table_search_pre_hashed(screen->cso_store.table,
+                                                   hash, &key);
+        struct panfrost_cso_store_entry *e;
+
+        if (entry) {
+                e = entry->data;
+                free(cso);
+        } else {
+                e = malloc(sizeof(*e) + size);
+                memcpy(e + 1, templ, size);
+                e->key = (struct panfrost_cso_key) { type, size, e + 1 };
+                e->cso = cso;
+                e->users = 0;
+
+                _mesa_hash_table_insert_pre_hashed(screen->cso_store.table,
+                                                   hash, &e->key, e);
+                _mesa_hash_table_insert(screen->cso_store.objects, cso, e);
+        }
+
+        e->users++;
+        simple_mtx_unlock(&screen->cso_store.lock);
+
+        return e->cso;
+}
+
+/* Returns whether the CSO was freed */
+
+static bool
+panfrost_cso_store_put(struct panfrost_screen *screen, void *cso)
+{
+        simple_mtx_lock(&screen->cso_store.lock);
+
+        struct hash_entry *entry =
+                _mesa_hash_table_search(screen->cso_store.objects, cso);
+        struct panfrost_cso_store_entry *e = entry->data;
+        bool freed = (--e->users == 0);
+
+        if (freed) {
+                _mesa_hash_table_remove(screen->cso_store.objects, entry);
+                _mesa_hash_table_remove_key(screen->cso_store.table, &e->key);
+                free(e->cso);
+                free(e);
+        }
+
+        simple_mtx_unlock(&screen->cso_store.lock);
+        return freed;
+}
+
+static void
+panfrost_shared_cso_delete(struct pipe_context *pctx, void *hwcso)
+{
+        panfrost_cso_store_put(pan_screen(pctx->screen), hwcso);
+}
+
+/* For CSOs packed into cached RSDs, whose pointers may be reused. They are
+ * shared by all contexts, so the RSDs of every context are invalidated. */
+static void
+panfrost_rsd_cso_delete(struct pipe_context *pctx, void *hwcso)
+{
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+
+        if (panfrost_cso_store_put(screen, hwcso))
+                panfrost_rsd_cache_invalidate(screen);
+}
+
 static void
-panfrost_generic_cso_delete(struct pipe_context *pctx, void *hwcso)
+panfrost_vertex_cso_delete(struct pipe_context *pctx, void *hwcso)
 {
+        panfrost_vertex_cache_clear(pan_context(pctx));
         free(hwcso);
 }
 
+static uint32_t
+panfrost_rsd_key_hash(const void *key)
+{
+        return _mesa_hash_data(key, sizeof(struct panfrost_rsd_key));
+}
+
+static bool
+panfrost_rsd_key_equal(const void *a, const void *b)
+{
+        return !memcmp(a, b, sizeof(struct panfrost_rsd_key));
+}
+
+void
+panfrost_rsd_cache_clear(struct panfrost_context *ctx)
+{
+        hash_table_foreach(ctx->rsd_cache, entry) {
+                struct panfrost_rsd_cache_entry *e = entry->data;
+
+                panfrost_bo_unreference(e->ref.bo);
+                free(e);
+        }
+
+        _mesa_hash_table_clear(ctx->rsd_cache, NULL);
+}
+
+void
+panfrost_rsd_cache_invalidate(struct panfrost_screen *screen)
+{
+        p_atomic_inc(&screen->rsd_cache_epoch);
+}
+
+static uint32_t
+panfrost_vertex_key_hash(const void *key)
+{
+        return _mesa_hash_data(key, sizeof(struct panfrost_vertex_key));
+}
+
+static bool
+panfrost_vertex_key_equal(const void *a, const void *b)
+{
+        return !memcmp(a, b, sizeof(struct panfrost_vertex_key));
+}
+
+void
+panfrost_vertex_cache_clear(struct panfrost_context *ctx)
+{
+        hash_table_foreach(ctx->vertex_cache, entry) {
+                struct panfrost_vertex_cache_entry *e = entry->data;
+
+                panfrost_bo_unreference(e->ref.bo);
+                free(e);
+        }
+
+        _mesa_hash_table_clear(ctx->vertex_cache, NULL);
+}
+
+static uint32_t
+panfrost_resource_table_key_hash(const void *key)
+{
+        return _mesa_hash_data(key, sizeof(struct panfrost_resource_table_key));
+}
+
+static bool
+panfrost_resource_table_key_equal(const void *a, const void *b)
+{
+        return !memcmp(a, b, sizeof(struct panfrost_resource_table_key));
+}
+
+void
+panfrost_resource_table_cache_clear(struct panfrost_context *ctx)
+{
+        hash_table_foreach(ctx->resource_table_cache, entry) {
+                struct panfrost_resource_table_cache_entry *e = entry->data;
+
+                panfrost_bo_unreference(e->ref.bo);
+                free(e);
+        }
+
+        _mesa_hash_table_clear(ctx->resource_table_cache, NULL);
+}
+
 static void
 panfrost_bind_blend_state(struct pipe_context *pipe, void *cso)
 {
@@ -163,6 +432,24 @@ panfrost_set_blend_color(struct pipe_context *pipe,
                 ctx->blend_color = *blend_color;
 }
 
+/* Whether a render target needs a blend shader whatever the blend constant
+ * is. This follows panfrost_get_blend, leaving out the case of fixed-function
+ * equations with more than one unique constant. */
+
+bool
+panfrost_blend_needs_shader(const struct panfrost_context *ctx, unsigned rt,
+                            enum pipe_format format)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct pan_blend_info info = ctx->blend->info[rt];
+
+        if (!info.enabled || (dev->arch >= 6 && info.opaque))
+                return false;
+
+        return !info.fixed_function ||
+               !panfrost_blendable_formats_v7[format].internal;
+}
+
 /* Create a final blend given the context */
 
 mali_ptr
@@ -175,6 +462,10 @@ panfrost_get_blend(struct panfrost_batch *batch, unsigned rti, struct panfrost_b
         struct pipe_surface *surf = batch->key.cbufs[rti];
         enum pipe_format fmt = surf->format;
 
+        /* The fragment shader may blend itself, leaving a plain store */
+        if (panfrost_fs_blends_rt(ctx, rti))
+                return 0;
+
         /* Use fixed-function if the equation permits, the format is blendable,
          * and no more than one unique constant is accessed */
         if (info.fixed_function && panfrost_blendable_formats_v7[fmt].internal &&
@@ -327,6 +618,7 @@ panfrost_bind_sampler_states(
 
         struct panfrost_context *ctx = pan_context(pctx);
         ctx->dirty_shader[shader] |= PAN_DIRTY_STAGE_SAMPLER;
+        panfrost_table_invalidate(&ctx->sampler_table[shader]);
 
         ctx->sampler_count[shader] = sampler ? num_sampler : 0;
         if (sampler)
@@ -394,17 +686,43 @@ panfrost_set_sampler_views(
 {
         struct panfrost_context *ctx = pan_context(pctx);
         ctx->dirty_shader[shader] |= PAN_DIRTY_STAGE_TEXTURE;
+        panfrost_table_invalidate(&ctx->texture_table[shader]);
 
         unsigned new_nr = 0;
         unsigned i;
 
+        /* Converting a texture blits with the currently bound views saved and
+         * restored by u_blitter, so do it before binding the new ones, and
+         * not for the views bound by the blitter itself */
+        if (views && !ctx->blitter->running) {
+                for (i = 0; i < num_views; ++i) {
+                        struct pipe_sampler_view *view = views[i];
+
+                        if (!view || !view->texture ||
+                            view->texture->target == PIPE_BUFFER)
+                                continue;
+
+                        /* Views of a threaded context are created on the
+                         * application thread, so legalize them here */
+                        if (ctx->tc)
+                                pan_legalize_afbc_format(ctx, pan_resource(view->texture),
+                                                         view->format);
+
+                        panfrost_resource_track_sample(ctx, pan_resource(view->texture));
+                }
+        }
+
         for (i = 0; i < num_views; ++i) {
                 struct pipe_sampler_view *view = views ? views[i] : NULL;
                 unsigned p = i + start_slot;
 
-                if (view)
+                if (view) {
                         new_nr = p + 1;
 
+                        if (view->texture && view->texture->target != PIPE_BUFFER)
+                                panfrost_resource_try_pack_afbc(ctx, pan_resource(view->texture));
+                }
+
                 if (take_ownership) {
                         pipe_sampler_view_reference((struct pipe_sampler_view **)&ctx->sampler_views[shader][p],
                                                     NULL);
@@ -460,6 +778,22 @@ panfrost_set_framebuffer_state(struct pipe_context *pctx,
 {
         struct panfrost_context *ctx = pan_context(pctx);
 
+        /* Surfaces of a threaded context are created on the application
+         * thread, and legalized once they are bound */
+        if (ctx->tc && !ctx->blitter->running) {
+                for (unsigned i = 0; i < fb->nr_cbufs; ++i) {
+                        struct pipe_surface *surf = fb->cbufs[i];
+
+                        if (surf)
+                                pan_legalize_afbc_format(ctx, pan_resource(surf->texture),
+                                                         surf->format);
+                }
+
+                if (fb->zsbuf)
+                        pan_legalize_afbc_format(ctx, pan_resource(fb->zsbuf->texture),
+                                                 fb->zsbuf->format);
+        }
+
         util_copy_framebuffer_state(&ctx->pipe_framebuffer, fb);
         ctx->batch = NULL;
 
@@ -565,12 +899,72 @@ panfrost_render_condition(struct pipe_context *pipe,
         ctx->cond_mode = mode;
 }
 
+void
+panfrost_submit_phase_record(struct panfrost_context *ctx,
+                             enum panfrost_submit_phase phase, uint64_t ns)
+{
+        struct panfrost_submit_phase_stats *stats = &ctx->submit_phases[phase];
+        unsigned bucket = ns < 1024 ? 0 : util_logbase2_64(ns) - 9;
+
+        stats->count++;
+        stats->total_ns += ns;
+        stats->max_ns = MAX2(stats->max_ns, ns);
+        stats->histogram[MIN2(bucket, PAN_SUBMIT_HISTOGRAM_BUCKETS - 1)]++;
+}
+
+static void
+panfrost_submit_phases_dump(struct panfrost_context *ctx)
+{
+        static const char *names[PAN_SUBMIT_PHASE_COUNT] = {
+                [PAN_SUBMIT_PHASE_DEPS] = "deps",
+                [PAN_SUBMIT_PHASE_CLEAN_DEPS] = "clean-deps",
+                [PAN_SUBMIT_PHASE_EMIT] = "emit",
+                [PAN_SUBMIT_PHASE_KCPU] = "kcpu",
+                [PAN_SUBMIT_PHASE_SUBMIT] = "submit",
+        };
+
+        fprintf(stderr, "panfrost: CPU time of submission phases, in us\n");
+        fprintf(stderr, "%-12s %10s %10s %10s %10s\n",
+                "phase", "count", "total", "mean", "max");
+
+        for (unsigned i = 0; i < PAN_SUBMIT_PHASE_COUNT; ++i) {
+                const struct panfrost_submit_phase_stats *stats =
+                        &ctx->submit_phases[i];
+
+                if (!stats->count)
+                        continue;
+
+                fprintf(stderr, "%-12s %10" PRIu64 " %10.1f %10.2f %10.1f\n",
+                        names[i], stats->count, stats->total_ns / 1000.0,
+                        stats->total_ns / 1000.0 / stats->count,
+                        stats->max_ns / 1000.0);
+
+                /* Upper bound of each bucket, in us */
+                fprintf(stderr, "%-12s", "");
+                for (unsigned b = 0; b < PAN_SUBMIT_HISTOGRAM_BUCKETS; ++b) {
+                        if (!stats->histogram[b])
+                                continue;
+
+                        if (b == PAN_SUBMIT_HISTOGRAM_BUCKETS - 1)
+                                fprintf(stderr, " >%u:%u", 1u << (b - 1),
+                                        stats->histogram[b]);
+                        else
+                                fprintf(stderr, " <%u:%u", 1u << b,
+                                        stats->histogram[b]);
+                }
+                fprintf(stderr, "\n");
+        }
+}
+
 static void
 panfrost_destroy(struct pipe_context *pipe)
 {
         struct panfrost_context *panfrost = pan_context(pipe);
         struct panfrost_device *dev = pan_device(pipe->screen);
 
+        if (panfrost->submit_profile)
+                panfrost_submit_phases_dump(panfrost);
+
         if (dev->kbase && dev->mali.context_create) {
                 dev->mali.cs_term(&dev->mali, &panfrost->kbase_cs_vertex.base);
                 dev->mali.cs_term(&dev->mali, &panfrost->kbase_cs_fragment.base);
@@ -581,22 +975,82 @@ panfrost_destroy(struct pipe_context *pipe)
                 panfrost_bo_unreference(panfrost->kbase_cs_fragment.bo);
         }
 
-        if (panfrost->tiler_heap_desc)
-                panfrost_bo_unreference(panfrost->tiler_heap_desc);
+        panfrost_release_tiler_heaps(panfrost);
+
+        if (panfrost->wls)
+                panfrost_bo_unreference(panfrost->wls);
+
+        if (panfrost->scratch.bo)
+                panfrost_bo_unreference(panfrost->scratch.bo);
+
+        u_trace_context_fini(&panfrost->trace_context);
 
         _mesa_hash_table_destroy(panfrost->writers, NULL);
 
+        panfrost_rsd_cache_clear(panfrost);
+        _mesa_hash_table_destroy(panfrost->rsd_cache, NULL);
+
+        panfrost_vertex_cache_clear(panfrost);
+        _mesa_hash_table_destroy(panfrost->vertex_cache, NULL);
+
+        panfrost_resource_table_cache_clear(panfrost);
+        _mesa_hash_table_destroy(panfrost->resource_table_cache, NULL);
+
+        for (unsigned i = 0; i < PIPE_SHADER_TYPES; ++i) {
+                panfrost_table_invalidate(&panfrost->texture_table[i]);
+                panfrost_table_invalidate(&panfrost->sampler_table[i]);
+        }
+
+        for (unsigned i = 0; i < ARRAY_SIZE(panfrost->compute_copy.shaders); ++i) {
+                if (panfrost->compute_copy.shaders[i])
+                        pipe->delete_compute_state(pipe, panfrost->compute_copy.shaders[i]);
+        }
+
+        for (unsigned i = 0; i < ARRAY_SIZE(panfrost->compute_clear.shaders); ++i) {
+                if (panfrost->compute_clear.shaders[i])
+                        pipe->delete_compute_state(pipe, panfrost->compute_clear.shaders[i]);
+        }
+
+        if (panfrost->compute_clear.fill)
+                pipe->delete_compute_state(pipe, panfrost->compute_clear.fill);
+
+        if (panfrost->compute_mipmap.shader)
+                pipe->delete_compute_state(pipe, panfrost->compute_mipmap.shader);
+
+        if (panfrost->compute_mipmap.sampler)
+                pipe->delete_sampler_state(pipe, panfrost->compute_mipmap.sampler);
+
+        if (panfrost->compute_copy.sampler)
+                pipe->delete_sampler_state(pipe, panfrost->compute_copy.sampler);
+
+        if (panfrost->compute_copy.buffer)
+                pipe->delete_compute_state(pipe, panfrost->compute_copy.buffer);
+
+        if (panfrost->compute_query.shader)
+                pipe->delete_compute_state(pipe, panfrost->compute_query.shader);
+
+        util_dynarray_foreach(&panfrost->query_bufs, struct pipe_resource *, buf)
+                pipe_resource_reference(buf, NULL);
+
         if (panfrost->blitter)
                 util_blitter_destroy(panfrost->blitter);
 
         util_unreference_framebuffer_state(&panfrost->pipe_framebuffer);
         u_upload_destroy(pipe->stream_uploader);
 
+        panfrost_replay_context_fini(panfrost);
+
         panfrost_pool_cleanup(&panfrost->descs);
-        panfrost_pool_cleanup(&panfrost->shaders);
+        panfrost_pool_recycler_fini(&panfrost->pool_recycler);
+        panfrost_pool_recycler_fini(&panfrost->invisible_pool_recycler);
+
+        slab_destroy_child(&panfrost->transfer_pool);
+        slab_destroy_child(&panfrost->transfer_pool_unsync);
 
         if (dev->kbase) {
                 dev->mali.syncobj_destroy(&dev->mali, panfrost->syncobj_kbase);
+                if (panfrost->in_sync_fd != -1)
+                        close(panfrost->in_sync_fd);
         } else {
                 drmSyncobjDestroy(dev->fd, panfrost->in_sync_obj);
                 if (panfrost->in_sync_fd != -1)
@@ -612,25 +1066,128 @@ panfrost_create_query(struct pipe_context *pipe,
                       unsigned type,
                       unsigned index)
 {
-        struct panfrost_query *q = rzalloc(pipe, struct panfrost_query);
+        /* Not parented to the context, as this may be called from the
+         * application thread when the context is threaded */
+        struct panfrost_query *q = rzalloc(NULL, struct panfrost_query);
 
         q->type = type;
         q->index = index;
 
+        /* Room for the start and end timestamps */
+        if (type == PIPE_QUERY_TIMESTAMP || type == PIPE_QUERY_TIME_ELAPSED) {
+                q->rsrc = pipe_buffer_create(pipe->screen,
+                                             PIPE_BIND_QUERY_BUFFER, 0,
+                                             2 * sizeof(uint64_t));
+        }
+
         return (struct pipe_query *) q;
 }
 
+static bool
+panfrost_is_occlusion_query(const struct panfrost_query *query)
+{
+        return query->type == PIPE_QUERY_OCCLUSION_COUNTER ||
+               query->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
+               query->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE;
+}
+
+/* Keeps enough buffers around for the queries of a few frames */
+#define PAN_MAX_QUERY_BUFS 64
+
 static void
 panfrost_destroy_query(struct pipe_context *pipe, struct pipe_query *q)
 {
+        struct panfrost_context *ctx = pan_context(pipe);
         struct panfrost_query *query = (struct panfrost_query *) q;
 
+        /* The batches still using the buffer hold a reference to it, and
+         * the next query zeroes it in begin_query */
+        if (query->rsrc && panfrost_is_occlusion_query(query) &&
+            util_dynarray_num_elements(&ctx->query_bufs,
+                                       struct pipe_resource *) < PAN_MAX_QUERY_BUFS) {
+                util_dynarray_append(&ctx->query_bufs, struct pipe_resource *,
+                                     query->rsrc);
+                query->rsrc = NULL;
+        }
+
         if (query->rsrc)
                 pipe_resource_reference(&query->rsrc, NULL);
 
         ralloc_free(q);
 }
 
+/* Reads the counter behind an accumulated driver query. Returns false if the
+ * query isn't one of them. */
+
+static bool
+panfrost_driver_query_counter(struct panfrost_context *ctx, unsigned type,
+                              uint64_t *value)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        switch (type) {
+        case PAN_QUERY_DRAW_CALLS:
+                *value = ctx->draw_calls;
+                return true;
+        case PAN_QUERY_CS_RING_STALLS:
+                *value = ctx->cs_ring_stalls;
+                return true;
+        case PAN_QUERY_CRC_TILES:
+                *value = ctx->crc_tiles;
+                return true;
+        case PAN_QUERY_BLEND_SHADERS:
+                *value = ctx->blend_shaders;
+                return true;
+        case PAN_QUERY_BATCHES:
+                *value = 0;
+                for (unsigned i = 0; i < PAN_FLUSH_CLASS_COUNT; ++i)
+                        *value += ctx->batches_submitted[i];
+                return true;
+        case PAN_QUERY_BATCHES_EXPLICIT:
+                *value = ctx->batches_submitted[PAN_FLUSH_EXPLICIT];
+                return true;
+        case PAN_QUERY_BATCHES_FBO:
+                *value = ctx->batches_submitted[PAN_FLUSH_FBO];
+                return true;
+        case PAN_QUERY_BATCHES_RESOURCE:
+                *value = ctx->batches_submitted[PAN_FLUSH_RESOURCE];
+                return true;
+        case PAN_QUERY_BATCHES_DEPENDENCY:
+                *value = ctx->batches_submitted[PAN_FLUSH_DEPENDENCY];
+                return true;
+        case PAN_QUERY_BATCHES_OTHER:
+                *value = ctx->batches_submitted[PAN_FLUSH_OTHER];
+                return true;
+        case PAN_QUERY_BO_CACHE_HITS:
+                *value = p_atomic_read(&dev->bo_cache.fetch_hits);
+                return true;
+        case PAN_QUERY_BO_CACHE_MISSES:
+                *value = p_atomic_read(&dev->bo_cache.fetch_misses);
+                return true;
+        case PAN_QUERY_POOL_UPLOAD_BYTES:
+                *value = ctx->pool_upload_bytes;
+                return true;
+        case PAN_QUERY_CPU_TILING_BYTES:
+                *value = ctx->cpu_tiling_bytes;
+                return true;
+        case PAN_QUERY_KCPU_COMMANDS:
+                *value = dev->kbase ? p_atomic_read(&dev->mali.kcpu_commands) : 0;
+                return true;
+        case PAN_QUERY_RESOURCE_CONVERSIONS:
+                *value = ctx->resource_conversions;
+                return true;
+        case PAN_QUERY_SUBMIT_DEPS_TIME:
+        case PAN_QUERY_SUBMIT_CLEAN_DEPS_TIME:
+        case PAN_QUERY_SUBMIT_EMIT_TIME:
+        case PAN_QUERY_SUBMIT_KCPU_TIME:
+        case PAN_QUERY_SUBMIT_IOCTL_TIME:
+                *value = ctx->submit_phases[type - PAN_QUERY_SUBMIT_DEPS_TIME].total_ns / 1000;
+                return true;
+        default:
+                return false;
+        }
+}
+
 static bool
 panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
 {
@@ -644,8 +1201,12 @@ panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
         case PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE: {
                 unsigned size = sizeof(uint64_t) * dev->core_id_range;
 
-                /* Allocate a resource for the query results to be stored */
-                if (!query->rsrc) {
+                /* Allocate a resource for the query results to be stored,
+                 * or reuse one of a destroyed query */
+                if (!query->rsrc && ctx->query_bufs.size) {
+                        query->rsrc = util_dynarray_pop(&ctx->query_bufs,
+                                                        struct pipe_resource *);
+                } else if (!query->rsrc) {
                         query->rsrc = pipe_buffer_create(ctx->base.screen,
                                         PIPE_BIND_QUERY_BUFFER, 0, size);
                 }
@@ -665,18 +1226,30 @@ panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
          * shaders.. */
 
         case PIPE_QUERY_PRIMITIVES_GENERATED:
+                ctx->prim_queries++;
                 query->start = ctx->prims_generated;
                 break;
         case PIPE_QUERY_PRIMITIVES_EMITTED:
+                ctx->prim_queries++;
                 query->start = ctx->tf_prims_generated;
                 break;
 
-        case PAN_QUERY_DRAW_CALLS:
-                query->start = ctx->draw_calls;
+        case PIPE_QUERY_TIME_ELAPSED:
+                panfrost_write_timestamp(ctx, pan_resource(query->rsrc), 0);
+                break;
+
+        case PAN_QUERY_SUBMIT_DEPS_TIME:
+        case PAN_QUERY_SUBMIT_CLEAN_DEPS_TIME:
+        case PAN_QUERY_SUBMIT_EMIT_TIME:
+        case PAN_QUERY_SUBMIT_KCPU_TIME:
+        case PAN_QUERY_SUBMIT_IOCTL_TIME:
+                /* Submissions are only timed while someone is looking */
+                ctx->submit_time_queries++;
+                panfrost_driver_query_counter(ctx, query->type, &query->start);
                 break;
 
         default:
-                /* TODO: timestamp queries, etc? */
+                panfrost_driver_query_counter(ctx, query->type, &query->start);
                 break;
         }
 
@@ -697,19 +1270,64 @@ panfrost_end_query(struct pipe_context *pipe, struct pipe_query *q)
                 ctx->dirty |= PAN_DIRTY_OQ;
                 break;
         case PIPE_QUERY_PRIMITIVES_GENERATED:
+                assert(ctx->prim_queries);
+                ctx->prim_queries--;
                 query->end = ctx->prims_generated;
                 break;
         case PIPE_QUERY_PRIMITIVES_EMITTED:
+                assert(ctx->prim_queries);
+                ctx->prim_queries--;
                 query->end = ctx->tf_prims_generated;
                 break;
-        case PAN_QUERY_DRAW_CALLS:
-                query->end = ctx->draw_calls;
+        case PAN_QUERY_CRC_TILES:
+                /* Counted when the batches are submitted */
+                panfrost_flush_all_batches(ctx, "Transaction elimination query");
+                query->end = ctx->crc_tiles;
+                break;
+        case PAN_QUERY_CS_RING_OCCUPANCY:
+                /* Sampled rather than accumulated */
+                query->end = MAX2(ctx->kbase_cs_vertex.ring_occupancy,
+                                  ctx->kbase_cs_fragment.ring_occupancy);
+                break;
+        case PAN_QUERY_TILE_SIZE:
+                /* Sampled when the framebuffer descriptor is emitted */
+                panfrost_flush_all_batches(ctx, "Tile size query");
+                query->end = ctx->tile_size;
+                break;
+        case PIPE_QUERY_TIMESTAMP:
+        case PIPE_QUERY_TIME_ELAPSED:
+                panfrost_write_timestamp(ctx, pan_resource(query->rsrc),
+                                         sizeof(uint64_t));
+                break;
+        case PAN_QUERY_SUBMIT_DEPS_TIME:
+        case PAN_QUERY_SUBMIT_CLEAN_DEPS_TIME:
+        case PAN_QUERY_SUBMIT_EMIT_TIME:
+        case PAN_QUERY_SUBMIT_KCPU_TIME:
+        case PAN_QUERY_SUBMIT_IOCTL_TIME:
+                assert(ctx->submit_time_queries);
+                ctx->submit_time_queries--;
+                panfrost_driver_query_counter(ctx, query->type, &query->end);
+                break;
+        default:
+                /* Batches and pool uploads are counted when batches are
+                 * submitted, which is left to the application */
+                panfrost_driver_query_counter(ctx, query->type, &query->end);
                 break;
         }
 
         return true;
 }
 
+/* Splits the division so that the multiplication can't overflow */
+uint64_t
+panfrost_timestamp_to_ns(struct panfrost_device *dev, uint64_t ticks)
+{
+        uint64_t freq = dev->timestamp_frequency;
+
+        return (ticks / freq) * 1000000000ull +
+               (ticks % freq) * 1000000000ull / freq;
+}
+
 static bool
 panfrost_get_query_result(struct pipe_context *pipe,
                           struct pipe_query *q,
@@ -725,7 +1343,11 @@ panfrost_get_query_result(struct pipe_context *pipe,
         case PIPE_QUERY_OCCLUSION_COUNTER:
         case PIPE_QUERY_OCCLUSION_PREDICATE:
         case PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE:
-                panfrost_flush_writer(ctx, rsrc, "Occlusion query");
+                /* Flushed queries may be read from the application thread
+                 * when the context is threaded, without touching it */
+                if (!query->base.flushed)
+                        panfrost_flush_writer(ctx, rsrc, "Occlusion query");
+
                 panfrost_bo_wait(rsrc->image.data.bo, INT64_MAX, false);
 
                 /* Read back the query results */
@@ -748,15 +1370,38 @@ panfrost_get_query_result(struct pipe_context *pipe,
 
         case PIPE_QUERY_PRIMITIVES_GENERATED:
         case PIPE_QUERY_PRIMITIVES_EMITTED:
-                panfrost_flush_all_batches(ctx, "Primitive count query");
+                if (!query->base.flushed)
+                        panfrost_flush_all_batches(ctx, "Primitive count query");
+
                 vresult->u64 = query->end - query->start;
                 break;
 
-        case PAN_QUERY_DRAW_CALLS:
-                vresult->u64 = query->end - query->start;
+        case PAN_QUERY_CS_RING_OCCUPANCY:
+        case PAN_QUERY_TILE_SIZE:
+                vresult->u64 = query->end;
+                break;
+
+        case PIPE_QUERY_TIMESTAMP:
+        case PIPE_QUERY_TIME_ELAPSED: {
+                /* Already submitted when the query ended */
+                if (!panfrost_bo_wait(rsrc->image.data.bo,
+                                      wait ? INT64_MAX : 0, false))
+                        return false;
+
+                uint64_t *ts = (uint64_t *) rsrc->image.data.bo->ptr.cpu;
+                uint64_t ticks = ts[1];
+
+                if (query->type == PIPE_QUERY_TIME_ELAPSED)
+                        ticks -= ts[0];
+
+                vresult->u64 = panfrost_timestamp_to_ns(dev, ticks);
                 break;
+        }
 
         default:
+                if (query->type >= PIPE_QUERY_DRIVER_SPECIFIC)
+                        vresult->u64 = query->end - query->start;
+
                 /* TODO: more queries */
                 break;
         }
@@ -764,6 +1409,96 @@ panfrost_get_query_result(struct pipe_context *pipe,
         return true;
 }
 
+/* Writes the result of a query computed on the CPU to a buffer, with the
+ * semantics of get_query_result_resource */
+static void
+panfrost_write_query_result(struct pipe_context *pipe,
+                            struct panfrost_query *query,
+                            enum pipe_query_flags flags,
+                            enum pipe_query_value_type result_type,
+                            int index,
+                            struct pipe_resource *resource,
+                            unsigned offset)
+{
+        union pipe_query_result res = { 0 };
+        bool ready = panfrost_get_query_result(pipe, (struct pipe_query *) query,
+                                               flags & PIPE_QUERY_WAIT, &res);
+        uint64_t value;
+
+        if (index < 0)
+                value = ready;
+        else if (!ready)
+                return;
+        else if (query->type == PIPE_QUERY_OCCLUSION_PREDICATE ||
+                 query->type == PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE)
+                value = res.b;
+        else
+                value = res.u64;
+
+        switch (result_type) {
+        case PIPE_QUERY_TYPE_I32: {
+                int32_t v = MIN2(value, INT32_MAX);
+                pipe_buffer_write(pipe, resource, offset, sizeof(v), &v);
+                break;
+        }
+        case PIPE_QUERY_TYPE_U32: {
+                uint32_t v = MIN2(value, UINT32_MAX);
+                pipe_buffer_write(pipe, resource, offset, sizeof(v), &v);
+                break;
+        }
+        case PIPE_QUERY_TYPE_I64:
+        case PIPE_QUERY_TYPE_U64:
+                pipe_buffer_write(pipe, resource, offset, sizeof(value), &value);
+                break;
+        }
+}
+
+/* Occlusion query results are written to the buffer by the GPU, ordered after
+ * the batch writing the query. Other queries are counted on the CPU, or are
+ * timestamps whose conversion to nanoseconds is done on the CPU. */
+static void
+panfrost_get_query_result_resource(struct pipe_context *pipe,
+                                   struct pipe_query *q,
+                                   enum pipe_query_flags flags,
+                                   enum pipe_query_value_type result_type,
+                                   int index,
+                                   struct pipe_resource *resource,
+                                   unsigned offset)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct panfrost_query *query = (struct panfrost_query *) q;
+
+        if (panfrost_is_occlusion_query(query) && query->rsrc) {
+                unsigned count = 1, qflags = 0;
+
+                if (index < 0)
+                        qflags |= PAN_QUERY_RESULT_AVAILABILITY;
+
+                if (query->type == PIPE_QUERY_OCCLUSION_COUNTER) {
+                        count = dev->core_id_range;
+
+                        if (dev->arch <= 5 && !query->msaa)
+                                qflags |= PAN_QUERY_RESULT_QUARTER;
+                } else {
+                        qflags |= PAN_QUERY_RESULT_BOOLEAN;
+                }
+
+                if (result_type == PIPE_QUERY_TYPE_I64 ||
+                    result_type == PIPE_QUERY_TYPE_U64)
+                        qflags |= PAN_QUERY_RESULT_64BIT;
+                else if (result_type == PIPE_QUERY_TYPE_I32)
+                        qflags |= PAN_QUERY_RESULT_SIGNED;
+
+                if (panfrost_compute_query_result(pipe, query->rsrc, count,
+                                                  qflags, resource, offset))
+                        return;
+        }
+
+        panfrost_write_query_result(pipe, query, flags, result_type, index,
+                                    resource, offset);
+}
+
 bool
 panfrost_render_condition_check(struct panfrost_context *ctx)
 {
@@ -779,8 +1514,10 @@ panfrost_render_condition_check(struct panfrost_context *ctx)
 
         struct pipe_query *pq = (struct pipe_query *)ctx->cond_query;
 
+        /* The draw happens if the result isn't zero, or if it is with an
+         * inverted condition */
         if (panfrost_get_query_result(&ctx->base, pq, wait, &res))
-                return res.u64 != ctx->cond_cond;
+                return (res.u64 != 0) != ctx->cond_cond;
 
 	return true;
 }
@@ -793,7 +1530,7 @@ panfrost_create_stream_output_target(struct pipe_context *pctx,
 {
         struct pipe_stream_output_target *target;
 
-        target = &rzalloc(pctx, struct panfrost_streamout_target)->base;
+        target = &rzalloc(NULL, struct panfrost_streamout_target)->base;
 
         if (!target)
                 return NULL;
@@ -877,9 +1614,25 @@ panfrost_set_global_binding(struct pipe_context *pctx,
 static void
 panfrost_memory_barrier(struct pipe_context *pctx, unsigned flags)
 {
-        /* TODO: Be smart and only flush the minimum needed, maybe emitting a
-         * cache flush job if that would help */
-        panfrost_flush_all_batches(pan_context(pctx), "Memory barrier");
+        struct panfrost_context *ctx = pan_context(pctx);
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+        struct panfrost_batch *batch = ctx->batch;
+
+        /* Persistently mapped buffers and global memory are accessed without
+         * going through the resource tracking */
+        if (flags & (PIPE_BARRIER_MAPPED_BUFFER | PIPE_BARRIER_GLOBAL_BUFFER)) {
+                panfrost_flush_all_batches(ctx, "Memory barrier");
+                return;
+        }
+
+        /* Writes done by other batches are already ordered against later
+         * accesses to the same resources by the batch dependencies, so only
+         * stores of the batch being recorded need a barrier */
+        if (!batch || !batch->storage_writes)
+                return;
+
+        if (!screen->vtbl.emit_barrier(batch))
+                panfrost_get_fresh_batch_for_fbo(ctx, "Memory barrier");
 }
 
 static void
@@ -898,6 +1651,26 @@ panfrost_fence_server_sync(struct pipe_context *pctx,
         struct panfrost_context *ctx = pan_context(pctx);
         int fd = -1, ret;
 
+        if (dev->kbase) {
+                fd = panfrost_fence_get_fd(pctx->screen, f);
+
+                /* Without a sync file or a CSF queue to wait for it on the
+                 * GPU, fall back to waiting on the CPU */
+                if (fd == -1 || !dev->mali.cs_submit) {
+                        if (fd != -1)
+                                close(fd);
+
+                        panfrost_fence_finish(pctx->screen, pctx, f,
+                                              OS_TIMEOUT_INFINITE);
+                        return;
+                }
+
+                /* Waited for by the first job of the next batch */
+                sync_accumulate("panfrost", &ctx->in_sync_fd, fd);
+                close(fd);
+                return;
+        }
+
         ret = drmSyncobjExportSyncFile(dev->fd, f->syncobj, &fd);
         assert(!ret);
 
@@ -905,6 +1678,90 @@ panfrost_fence_server_sync(struct pipe_context *pctx,
         close(fd);
 }
 
+static enum pipe_reset_status
+panfrost_get_device_reset_status(struct pipe_context *pipe)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        enum pipe_reset_status status = ctx->reset_status;
+
+        /* Contexts are recovered automatically, so each reset is only
+         * reported once */
+        ctx->reset_status = PIPE_NO_RESET;
+        return status;
+}
+
+static void
+panfrost_set_device_reset_callback(struct pipe_context *pipe,
+                                   const struct pipe_device_reset_callback *cb)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+
+        if (cb)
+                ctx->reset_callback = *cb;
+        else
+                memset(&ctx->reset_callback, 0, sizeof(ctx->reset_callback));
+}
+
+/* The timestamps are only written once the batch is submitted, so the
+ * tracepoints record where each of them goes, see panfrost_batch_trace */
+
+static void
+panfrost_trace_record_ts(struct u_trace *ut, void *cs, void *timestamps,
+                         unsigned idx, bool end_of_pipe)
+{
+        struct panfrost_batch *batch =
+                container_of(ut, struct panfrost_batch, trace);
+        struct panfrost_resource *rsrc = pan_resource(timestamps);
+        mali_ptr *address = cs;
+
+        /* Track the buffer on the queue writing the timestamp, so that waiting
+         * on it also waits for batches without fragment work */
+        bool fragment = (address - batch->trace_ts) >= PAN_TRACE_TS_FRAGMENT_START;
+
+        panfrost_batch_write_rsrc(batch, rsrc, fragment ? PIPE_SHADER_FRAGMENT :
+                                                          PIPE_SHADER_VERTEX);
+
+        *address = rsrc->image.data.bo->ptr.gpu + idx * sizeof(uint64_t);
+}
+
+static uint64_t
+panfrost_trace_read_ts(struct u_trace_context *utctx,
+                       void *timestamps, unsigned idx, void *flush_data)
+{
+        struct panfrost_context *ctx =
+                container_of(utctx, struct panfrost_context, trace_context);
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct panfrost_bo *bo = pan_resource(timestamps)->image.data.bo;
+
+        /* Only need to stall on results for the first entry */
+        if (idx == 0 && !panfrost_bo_wait(bo, INT64_MAX, false))
+                return U_TRACE_NO_TIMESTAMP;
+
+        panfrost_bo_mmap(bo);
+        uint64_t *ts = bo->ptr.cpu;
+
+        /* Don't translate the no-timestamp marker */
+        if (ts[idx] == U_TRACE_NO_TIMESTAMP)
+                return U_TRACE_NO_TIMESTAMP;
+
+        return panfrost_timestamp_to_ns(dev, ts[idx]);
+}
+
+static void
+panfrost_trace_delete_flush_data(struct u_trace_context *utctx,
+                                 void *flush_data)
+{
+        /* No flush data */
+}
+
+#ifdef HAVE_PERFETTO
+struct pan_perfetto_state *
+pan_perfetto_state(struct pipe_context *pctx)
+{
+        return &pan_context(pctx)->perfetto;
+}
+#endif
+
 static struct panfrost_cs
 panfrost_cs_create(struct panfrost_context *ctx, unsigned size, unsigned mask)
 {
@@ -916,10 +1773,11 @@ panfrost_cs_create(struct panfrost_context *ctx, unsigned size, unsigned mask)
 
         c.bo = panfrost_bo_create(dev, size, 0, "Command stream");
 
-        c.base = dev->mali.cs_bind(&dev->mali, kctx, c.bo->ptr.gpu, size);
+        /* Priority between contexts is set per queue group, so all queues
+         * of a context share the default queue priority */
+        c.base = dev->mali.cs_bind(&dev->mali, kctx, c.bo->ptr.gpu, size, 1);
 
-        c.event_ptr = dev->mali.event_mem.gpu + c.base.event_mem_offset * PAN_EVENT_SIZE;
-        c.kcpu_event_ptr = dev->mali.kcpu_event_mem.gpu + c.base.event_mem_offset * PAN_EVENT_SIZE;
+        panfrost_cs_update_event_ptrs(dev, &c);
 
         c.hw_resources = mask;
         screen->vtbl.init_cs(ctx, &c);
@@ -943,6 +1801,8 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
 
         gallium->create_fence_fd = panfrost_create_fence_fd;
         gallium->fence_server_sync = panfrost_fence_server_sync;
+        gallium->get_device_reset_status = panfrost_get_device_reset_status;
+        gallium->set_device_reset_callback = panfrost_set_device_reset_callback;
 
         gallium->flush = panfrost_flush;
         gallium->clear = panfrost_clear;
@@ -960,16 +1820,16 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
         gallium->set_sampler_views = panfrost_set_sampler_views;
 
         gallium->bind_rasterizer_state = panfrost_bind_rasterizer_state;
-        gallium->delete_rasterizer_state = panfrost_generic_cso_delete;
+        gallium->delete_rasterizer_state = panfrost_rsd_cso_delete;
 
         gallium->bind_vertex_elements_state = panfrost_bind_vertex_elements_state;
-        gallium->delete_vertex_elements_state = panfrost_generic_cso_delete;
+        gallium->delete_vertex_elements_state = panfrost_vertex_cso_delete;
 
-        gallium->delete_sampler_state = panfrost_generic_cso_delete;
+        gallium->delete_sampler_state = panfrost_shared_cso_delete;
         gallium->bind_sampler_states = panfrost_bind_sampler_states;
 
         gallium->bind_depth_stencil_alpha_state   = panfrost_bind_depth_stencil_state;
-        gallium->delete_depth_stencil_alpha_state = panfrost_generic_cso_delete;
+        gallium->delete_depth_stencil_alpha_state = panfrost_rsd_cso_delete;
 
         gallium->set_sample_mask = panfrost_set_sample_mask;
         gallium->set_min_samples = panfrost_set_min_samples;
@@ -986,13 +1846,14 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
         gallium->begin_query = panfrost_begin_query;
         gallium->end_query = panfrost_end_query;
         gallium->get_query_result = panfrost_get_query_result;
+        gallium->get_query_result_resource = panfrost_get_query_result_resource;
 
         gallium->create_stream_output_target = panfrost_create_stream_output_target;
         gallium->stream_output_target_destroy = panfrost_stream_output_target_destroy;
         gallium->set_stream_output_targets = panfrost_set_stream_output_targets;
 
         gallium->bind_blend_state   = panfrost_bind_blend_state;
-        gallium->delete_blend_state = panfrost_generic_cso_delete;
+        gallium->delete_blend_state = panfrost_rsd_cso_delete;
 
         gallium->set_blend_color = panfrost_set_blend_color;
 
@@ -1007,25 +1868,64 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
         gallium->stream_uploader = u_upload_create_default(gallium);
         gallium->const_uploader = gallium->stream_uploader;
 
+        slab_create_child(&ctx->transfer_pool, &pan_screen(screen)->transfer_pool);
+        slab_create_child(&ctx->transfer_pool_unsync,
+                          &pan_screen(screen)->transfer_pool);
+
         panfrost_pool_init(&ctx->descs, ctx, dev,
-                        0, 4096, "Descriptors", true, false);
+                        0, 4096, "Descriptors", true, false, NULL);
 
-        panfrost_pool_init(&ctx->shaders, ctx, dev,
-                        PAN_BO_EXECUTE, 4096, "Shaders", true, false);
+        panfrost_pool_recycler_init(&ctx->pool_recycler, ctx);
+        panfrost_pool_recycler_init(&ctx->invisible_pool_recycler, ctx);
 
         ctx->blitter = util_blitter_create(gallium);
 
         ctx->writers = _mesa_hash_table_create(gallium, _mesa_hash_pointer,
                                                         _mesa_key_pointer_equal);
 
+        util_dynarray_init(&ctx->query_bufs, gallium);
+
+        ctx->rsd_cache = _mesa_hash_table_create(gallium, panfrost_rsd_key_hash,
+                                                 panfrost_rsd_key_equal);
+        ctx->rsd_cache_epoch = p_atomic_read(&pan_screen(screen)->rsd_cache_epoch);
+
+        ctx->vertex_cache = _mesa_hash_table_create(gallium,
+                                                    panfrost_vertex_key_hash,
+                                                    panfrost_vertex_key_equal);
+
+        ctx->resource_table_cache =
+                _mesa_hash_table_create(gallium,
+                                        panfrost_resource_table_key_hash,
+                                        panfrost_resource_table_key_equal);
+
         assert(ctx->blitter);
 
-        if (dev->kbase && dev->mali.context_create)
-                ctx->kbase_ctx = dev->mali.context_create(&dev->mali);
+        bool compute_only = flags & PIPE_CONTEXT_COMPUTE_ONLY;
+
+        if (dev->kbase && dev->mali.context_create) {
+                unsigned kflags = 0;
+
+                if (compute_only)
+                        kflags |= KBASE_CONTEXT_COMPUTE_ONLY;
+                if (flags & PIPE_CONTEXT_HIGH_PRIORITY)
+                        kflags |= KBASE_CONTEXT_PRIORITY_HIGH;
+                if (flags & PIPE_CONTEXT_LOW_PRIORITY)
+                        kflags |= KBASE_CONTEXT_PRIORITY_LOW;
 
+                ctx->kbase_ctx = dev->mali.context_create(&dev->mali, kflags);
+        }
+
+        /* Compute-only contexts get a queue group without tiler or fragment
+         * resources. The fragment queue is still created to keep the
+         * submission code simple, but never receives any work.
+         *
+         * Each batch needs at most a couple of kilobytes of ring space, as
+         * long dependency lists are called from batch memory. */
         if (dev->arch >= 10) {
-                ctx->kbase_cs_vertex = panfrost_cs_create(ctx, 65536, 13);
-                ctx->kbase_cs_fragment = panfrost_cs_create(ctx, 65536, 2);
+                ctx->kbase_cs_vertex = panfrost_cs_create(ctx, 16384,
+                                                          compute_only ? 1 : 13);
+                ctx->kbase_cs_fragment = panfrost_cs_create(ctx, 16384,
+                                                            compute_only ? 0 : 2);
         }
 
         /* Prepare for render! */
@@ -1033,6 +1933,18 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
         /* By default mask everything on */
         ctx->sample_mask = ~0;
         ctx->active_queries = true;
+        ctx->submit_profile = dev->debug & PAN_DBG_SUBMIT_PROFILE;
+
+        /* The panfrost kernel driver reports no job failures to adapt to,
+         * so keep batches well below its job timeout there */
+        ctx->batch_job_limit =
+                debug_get_num_option("PAN_BATCH_JOB_LIMIT",
+                                     dev->kbase ? PAN_MAX_BATCH_JOBS : 10000);
+        ctx->batch_job_limit = CLAMP(ctx->batch_job_limit, PAN_MIN_BATCH_JOBS,
+                                     PAN_MAX_BATCH_JOBS);
+
+        if (dev->kbase)
+                ctx->atom_faults = p_atomic_read(&dev->mali.atom_faults);
 
         int ASSERTED ret;
 
@@ -1052,5 +1964,28 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
                 assert(!ret);
         }
 
-        return gallium;
+        pan_gpu_tracepoint_config_variable();
+        u_trace_pipe_context_init(&ctx->trace_context, gallium,
+                                  panfrost_trace_record_ts,
+                                  panfrost_trace_read_ts,
+                                  panfrost_trace_delete_flush_data);
+
+        if (!(flags & PIPE_CONTEXT_PREFER_THREADED))
+                return gallium;
+
+        /* Move state validation and command stream building off the
+         * application thread. Returns the context itself when threading is
+         * disabled with GALLIUM_THREAD=0. */
+        struct pipe_context *tc = threaded_context_create(
+                gallium, &pan_screen(screen)->transfer_pool,
+                panfrost_replace_buffer_storage,
+                &(struct threaded_context_options) {
+                        .is_resource_busy = panfrost_resource_busy,
+                },
+                &ctx->tc);
+
+        if (tc && tc != gallium)
+                threaded_context_init_bytes_mapped_limit(ctx->tc, 4);
+
+        return tc;
 }
@@ -34,6 +34,7 @@
 #include "pan_encoder.h"
 #include "pan_texture.h"
 #include "pan_earlyzs.h"
+#include "pan_perfetto.h"
 
 #include "pipe/p_compiler.h"
 #include "util/detect.h"
@@ -44,6 +45,7 @@
 #include "pipe/p_state.h"
 #include "util/u_blitter.h"
 #include "util/hash_table.h"
+#include "util/os_time.h"
 #include "util/simple_mtx.h"
 
 #include "midgard/midgard_compile.h"
@@ -90,6 +92,9 @@ struct panfrost_constant_buffer {
 };
 
 struct panfrost_query {
+        /* Flushed state tracked by u_threaded_context */
+        struct threaded_query base;
+
         /* Passthrough from Gallium */
         unsigned type;
         unsigned index;
@@ -112,6 +117,14 @@ struct panfrost_streamout_target {
         uint32_t offset;
 };
 
+/* Job indices are 16-bit, leave headroom for the jobs of a single draw */
+#define PAN_MAX_BATCH_JOBS (UINT16_MAX - 16)
+#define PAN_MIN_BATCH_JOBS 1000
+
+/* Tiler heap memory assumed to be used by each vertex in the polygon lists,
+ * in addition to its vertex packet */
+#define PAN_TILER_HEAP_LIST_BYTES 16
+
 struct panfrost_streamout {
         struct pipe_stream_output_target *targets[PIPE_MAX_SO_BUFFERS];
         unsigned num_targets;
@@ -126,14 +139,87 @@ struct panfrost_cs {
         uint64_t seqnum;
         mali_ptr kcpu_event_ptr;
         uint64_t kcpu_seqnum;
+        /* Seqnum of the last submission which contained work, or zero */
+        uint64_t submitted_seqnum;
         uint64_t offset;
+        /* Bytes of the ring which the GPU had not yet consumed as of the
+         * last allocation, including that allocation */
+        uint64_t ring_occupancy;
         unsigned hw_resources;
 };
 
+/* Must be called whenever the event slot of the queue changes */
+static inline void
+panfrost_cs_update_event_ptrs(struct panfrost_device *dev, struct panfrost_cs *cs)
+{
+        cs->event_ptr = kbase_event_va(&dev->mali, cs->base.event_mem_offset);
+        cs->kcpu_event_ptr = kbase_kcpu_event_va(&dev->mali, cs->base.event_mem_offset);
+}
+
+struct panfrost_upload_cache {
+        /* Batch the upload belongs to, zero if unused */
+        uint64_t seqnum;
+
+        mali_ptr gpu;
+        unsigned size;
+        uint8_t data[MAX2(MAX_SYSVAL_COUNT * 16, PAN_MAX_PUSH * 4)];
+};
+
+/* Push constants read from UBOs on the CPU for the last draw of a stage.
+ * Reading a UBO resource flushes its writers and reads uncached memory, so
+ * later draws reuse the words while the bindings and contents are unchanged. */
+struct panfrost_push_gather_cache {
+        /* Layout the words were gathered for, zero count if unused */
+        struct panfrost_ubo_push push;
+
+        /* Binding of each UBO read when gathering */
+        struct {
+                struct panfrost_resource *rsrc;
+                unsigned offset;
+                uint64_t seqnum;
+        } ubos[PIPE_MAX_CONSTANT_BUFFERS];
+
+        uint32_t words[PAN_MAX_PUSH];
+};
+
+/* Phases of a CSF submission whose CPU time is profiled */
+enum panfrost_submit_phase {
+        /* Updating the usage of the BOs and the dependency tables */
+        PAN_SUBMIT_PHASE_DEPS,
+        /* Collecting, cleaning and minimising the dependencies */
+        PAN_SUBMIT_PHASE_CLEAN_DEPS,
+        /* Emitting the top-level command streams, without the KCPU work */
+        PAN_SUBMIT_PHASE_EMIT,
+        /* KCPU queue enqueues and waits, made while emitting */
+        PAN_SUBMIT_PHASE_KCPU,
+        /* The queue kicks */
+        PAN_SUBMIT_PHASE_SUBMIT,
+        PAN_SUBMIT_PHASE_COUNT,
+};
+
+/* Bucket 0 counts times under 1024 ns, bucket i times from 512 << i ns, and
+ * the last bucket everything longer. */
+#define PAN_SUBMIT_HISTOGRAM_BUCKETS 16
+
+struct panfrost_submit_phase_stats {
+        uint64_t count;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint32_t histogram[PAN_SUBMIT_HISTOGRAM_BUCKETS];
+};
+
 struct panfrost_context {
         /* Gallium context */
         struct pipe_context base;
 
+        /* Threaded context wrapping this one, if any */
+        struct threaded_context *tc;
+
+        /* Transfers done on the driver thread, and unsynchronized ones done
+         * on the application thread when the context is threaded */
+        struct slab_child_pool transfer_pool;
+        struct slab_child_pool transfer_pool_unsync;
+
         /* Dirty global state */
         enum pan_dirty_3d dirty;
 
@@ -141,7 +227,10 @@ struct panfrost_context {
         enum pan_dirty_shader dirty_shader[PIPE_SHADER_TYPES];
 
         /* Unowned pools, so manage yourself. */
-        struct panfrost_pool descs, shaders;
+        struct panfrost_pool descs;
+
+        /* Recycled BOs for the owned pools of batches */
+        struct panfrost_pool_recycler pool_recycler, invisible_pool_recycler;
 
         /* Sync obj used to keep track of in-flight jobs. */
         uint32_t syncobj;
@@ -161,6 +250,29 @@ struct panfrost_context {
         /* Map from resources to panfrost_batches */
         struct hash_table *writers;
 
+        /* Fragment renderer state descriptors uploaded to the descs pool,
+         * keyed by struct panfrost_rsd_key, valid for the screen's
+         * rsd_cache_epoch recorded here */
+        struct hash_table *rsd_cache;
+        uint32_t rsd_cache_epoch;
+
+        /* Valhall attribute and vertex buffer descriptor tables uploaded to
+         * the descs pool, keyed by struct panfrost_vertex_key */
+        struct hash_table *vertex_cache;
+
+        /* Valhall resource tables uploaded to the descs pool, keyed by
+         * struct panfrost_resource_table_key */
+        struct hash_table *resource_table_cache;
+
+        /* Job chains of submitted batches to replay, see pan_replay.h */
+        struct panfrost_replay *replays[PAN_REPLAY_RECORDS];
+
+        /* Image views of recently submitted framebuffers */
+        struct {
+                uint64_t seqnum;
+                struct panfrost_fb_views entries[PAN_FB_VIEWS];
+        } fb_views;
+
         /* Bound job batch */
         struct panfrost_batch *batch;
 
@@ -171,12 +283,42 @@ struct panfrost_context {
         struct panfrost_streamout streamout;
 
         bool active_queries;
+        /* Primitive queries running, whose counts are taken on the CPU */
+        unsigned prim_queries;
         uint64_t prims_generated;
         uint64_t tf_prims_generated;
         uint64_t draw_calls;
+        /* Jobs after which a batch is split on the job manager, lowered
+         * when kbase reports failed atoms */
+        unsigned batch_job_limit;
+        uint32_t atom_faults;
+        /* Number of times emission waited for space in a CS ring */
+        uint64_t cs_ring_stalls;
+        /* Number of tiles written with transaction elimination enabled */
+        uint64_t crc_tiles;
+        /* Pixels per tile of the last framebuffer emitted */
+        uint64_t tile_size;
+        /* Number of render targets drawn with a blend shader */
+        uint64_t blend_shaders;
+        /* Number of batches submitted for each class of reason */
+        uint64_t batches_submitted[PAN_FLUSH_CLASS_COUNT];
+        /* Bytes allocated from the CPU-visible batch pools */
+        uint64_t pool_upload_bytes;
+        /* Bytes tiled or detiled on the CPU for transfers */
+        uint64_t cpu_tiling_bytes;
+        /* Number of modifier conversions of resources */
+        uint64_t resource_conversions;
+        /* CPU time of the submission phases, collected with
+         * PAN_MESA_DEBUG=submitprof or while a submit time query is active */
+        bool submit_profile;
+        unsigned submit_time_queries;
+        uint64_t submit_kcpu_ns;
+        struct panfrost_submit_phase_stats submit_phases[PAN_SUBMIT_PHASE_COUNT];
         struct panfrost_query *occlusion_query;
 
         bool indirect_draw;
+        /* Whether the render condition of the draw is checked by the GPU */
+        bool render_cond_gpu;
         unsigned drawid;
         unsigned vertex_count;
         unsigned instance_count;
@@ -188,17 +330,37 @@ struct panfrost_context {
         mali_ptr base_instance_sysval_ptr;
         enum pipe_prim_type active_prim;
 
+        /* Index buffer read by the transform feedback shader, with a zero
+         * index size for non-indexed draws */
+        mali_ptr xfb_indices;
+        unsigned xfb_index_size;
+
         /* If instancing is enabled, vertex count padded for instance; if
          * it is disabled, just equal to plain vertex count */
         unsigned padded_count;
 
         struct panfrost_constant_buffer constant_buffer[PIPE_SHADER_TYPES];
+
+        /* Last sysval and push constant uploads per stage, reused by later
+         * draws of the same batch when the contents didn't change */
+        struct panfrost_upload_cache sysval_cache[PIPE_SHADER_TYPES];
+        struct panfrost_upload_cache push_cache[PIPE_SHADER_TYPES];
+        struct panfrost_upload_cache ubo_cache[PIPE_SHADER_TYPES];
+        struct panfrost_push_gather_cache push_gather[PIPE_SHADER_TYPES];
         struct panfrost_rasterizer *rasterizer;
         struct panfrost_vertex_state *vertex;
 
         struct panfrost_uncompiled_shader *uncompiled[PIPE_SHADER_TYPES];
         struct panfrost_compiled_shader *prog[PIPE_SHADER_TYPES];
 
+        /* Last variant selected for each stage, checked before the variant
+         * index. Tagged with the serial of its shader rather than a pointer,
+         * since the shader may be deleted through another context. */
+        struct {
+                uint32_t serial;
+                struct panfrost_compiled_shader *prog;
+        } last_variant[PIPE_SHADER_TYPES];
+
         struct pipe_vertex_buffer vertex_buffers[PIPE_MAX_ATTRIBS];
         uint32_t vb_mask;
 
@@ -214,8 +376,45 @@ struct panfrost_context {
         struct panfrost_sampler_view *sampler_views[PIPE_SHADER_TYPES][PIPE_MAX_SHADER_SAMPLER_VIEWS];
         unsigned sampler_view_count[PIPE_SHADER_TYPES];
 
+        /* Descriptor tables for the bound sampler views and samplers, kept
+         * in the descs pool so that later draws and batches can reuse them
+         * until the bindings change. A NULL BO means no valid table. */
+        struct panfrost_pool_ref texture_table[PIPE_SHADER_TYPES];
+        struct panfrost_pool_ref sampler_table[PIPE_SHADER_TYPES];
+
         struct blitter_context *blitter;
 
+        /* Lazily created state of panfrost_compute_copy. Shaders are indexed
+         * by the base type of the texels copied: float, uint, int. The
+         * buffer shader is used by panfrost_compute_copy_buffer. */
+        struct {
+                void *shaders[3];
+                void *sampler;
+                void *buffer;
+        } compute_copy;
+
+        /* Lazily created shaders of panfrost_compute_clear, indexed like
+         * compute_copy, and of panfrost_compute_fill_buffer */
+        struct {
+                void *shaders[3];
+                void *fill;
+        } compute_clear;
+
+        /* Lazily created state of panfrost_compute_mipmap */
+        struct {
+                void *shader;
+                void *sampler;
+        } compute_mipmap;
+
+        /* Lazily created shader of panfrost_compute_query_result */
+        struct {
+                void *shader;
+        } compute_query;
+
+        /* Result buffers of destroyed occlusion queries, reused by the
+         * next ones instead of creating a resource per query */
+        struct util_dynarray query_bufs;
+
         struct panfrost_blend_state *blend;
 
         /* On Valhall, does the current blend state use a blend shader for any
@@ -242,13 +441,54 @@ struct panfrost_context {
         uint8_t fb_rt_mask;
 
         int in_sync_fd;
+
+        /* Reset since the last get_device_reset_status call */
+        enum pipe_reset_status reset_status;
+        struct pipe_device_reset_callback reset_callback;
         uint32_t in_sync_obj;
 
         struct kbase_context *kbase_ctx;
         struct panfrost_bo *event_bo;
         struct panfrost_cs kbase_cs_vertex;
         struct panfrost_cs kbase_cs_fragment;
-        struct panfrost_bo *tiler_heap_desc;
+
+        /* Descriptors of the tiler heaps of the context, created on first
+         * use. Batches take the heaps in turn. */
+        struct panfrost_bo *tiler_heap_desc[KBASE_MAX_TILER_HEAPS];
+        unsigned next_tiler_heap;
+
+        /* Position and point size scratch space of each tiler heap */
+        struct panfrost_bo *tiler_scratch[KBASE_MAX_TILER_HEAPS];
+
+        /* Workgroup shared memory arena, sized for the largest dispatch so
+         * far and shared by all batches */
+        struct panfrost_bo *wls;
+
+        /* Thread local storage arena, sized for the largest stack so far */
+        struct {
+                struct panfrost_bo *bo;
+
+                /* Batch holding the arena, if any */
+                struct panfrost_batch *batch;
+
+                /* Batches since the arena was last needed at more than a
+                 * quarter of its size */
+                unsigned idle_batches;
+        } scratch;
+
+        /* Batches submitted using each heap, to sample heap usage */
+        unsigned tiler_heap_batches[KBASE_MAX_TILER_HEAPS];
+
+        /* Scratch tables for building the dependencies of CSF batches */
+        struct panfrost_dep_table vert_dep_table;
+        struct panfrost_dep_table frag_dep_table;
+
+        /* GPU timing of the batches, read back by u_trace */
+        struct u_trace_context trace_context;
+
+#ifdef HAVE_PERFETTO
+        struct pan_perfetto_state perfetto;
+#endif
 };
 
 /* Corresponds to the CSO */
@@ -284,6 +524,9 @@ struct panfrost_fs_key {
         /* On Valhall, fixed_varying_mask of the linked vertex shader */
         uint32_t fixed_varying_mask;
 
+        /* On Valhall, fp16_varying_mask of the linked vertex shader */
+        uint32_t fp16_varying_mask;
+
         /* Midgard shaders that read the tilebuffer must be keyed for
          * non-blendable formats
          */
@@ -294,6 +537,17 @@ struct panfrost_fs_key {
 
         /* User clip plane lowering */
         uint8_t clip_plane_enable;
+
+        /* On Bifrost and newer, blend state of the render targets that would
+         * otherwise need a blend shader, to blend in the fragment shader
+         * instead. Render targets with a NONE format are blended as usual.
+         */
+        struct {
+                enum pipe_format formats[8];
+                struct pan_blend_equation equations[8];
+                bool logicop_enable;
+                uint8_t logicop_func;
+        } blend;
 };
 
 struct panfrost_shader_key {
@@ -311,10 +565,29 @@ struct panfrost_shader_key {
         };
 };
 
+/* The binary artefacts of compiling a shader. This differs from
+ * panfrost_compiled_shader, which adds extra metadata beyond compiling but
+ * throws away information not needed after the initial compile.
+ *
+ * This structure is serialized for the shader disk cache.
+ */
+struct panfrost_shader_binary {
+        /* Collected information about the compiled shader */
+        struct pan_shader_info info;
+
+        /* The binary itself */
+        struct util_dynarray binary;
+};
+
+struct panfrost_shader_store_entry;
+
 struct panfrost_compiled_shader {
         /* Respectively, shader binary and Renderer State Descriptor */
         struct panfrost_pool_ref bin, state;
 
+        /* Entry of the screen's shader store owning bin, if any */
+        struct panfrost_shader_store_entry *bin_entry;
+
         /* For fragment shaders, a prepared (but not uploaded RSD) */
         uint32_t partial_rsd[RSD_WORDS];
 
@@ -329,9 +602,20 @@ struct panfrost_compiled_shader {
         uint64_t so_mask;
 
         struct panfrost_shader_key key;
+        uint32_t key_hash;
 
         /* Mask of state that dirties the sysvals */
         unsigned dirty_3d, dirty_shader;
+
+        /* Signalled once the variant is compiled. Compiles run without the
+         * variants lock held, possibly on the screen's shader queue, so users
+         * of a variant found in the array must wait on this first. */
+        struct util_queue_fence ready;
+
+        /* Compiled binary not yet uploaded, consumed by the first context
+         * to use the variant under the variants lock */
+        struct panfrost_shader_binary pending;
+        bool uploaded;
 };
 
 /* Shader CSO */
@@ -348,12 +632,19 @@ struct panfrost_uncompiled_shader {
         /* Stream output information */
         struct pipe_stream_output_info stream_output;
 
-        /** Lock for the variants array */
+        /** Lock for the variants array and for uploading variants */
         simple_mtx_t lock;
 
-        /* Array of panfrost_compiled_shader */
+        /* Array of pointers to panfrost_compiled_shader, which stay put as
+         * the array grows */
         struct util_dynarray variants;
 
+        /* The same variants, keyed by struct panfrost_shader_key */
+        struct hash_table *variant_index;
+
+        /* Screen-unique, nonzero identifier of the shader */
+        uint32_t serial;
+
         /* Compiled transform feedback program, if one is required */
         struct panfrost_compiled_shader *xfb;
 
@@ -362,20 +653,12 @@ struct panfrost_uncompiled_shader {
          * shaders for desktop GL.
          */
         uint32_t fixed_varying_mask;
-};
-
-/* The binary artefacts of compiling a shader. This differs from
- * panfrost_compiled_shader, which adds extra metadata beyond compiling but
- * throws away information not needed after the initial compile.
- *
- * This structure is serialized for the shader disk cache.
- */
-struct panfrost_shader_binary {
-        /* Collected information about the compiled shader */
-        struct pan_shader_info info;
 
-        /* The binary itself */
-        struct util_dynarray binary;
+        /* On vertex shaders, bit mask of general varyings (bit 0 is
+         * VARYING_SLOT_VAR0) written as fp16. Used on Valhall to halve the
+         * varying memory of mediump varyings.
+         */
+        uint32_t fp16_varying_mask;
 };
 
 void
@@ -393,6 +676,52 @@ panfrost_disk_cache_retrieve(struct disk_cache *cache,
 void
 panfrost_disk_cache_init(struct panfrost_screen *screen);
 
+/* A shader variant seen by an earlier process, see pan_disk_cache.c */
+struct panfrost_warmup_variant {
+        unsigned char nir_sha1[20];
+        struct panfrost_shader_key key;
+};
+
+void
+panfrost_warmup_load(struct panfrost_screen *screen);
+
+void
+panfrost_warmup_record(struct panfrost_screen *screen,
+                       const struct panfrost_uncompiled_shader *uncompiled,
+                       const struct panfrost_shader_key *key);
+
+void
+panfrost_warmup_save(struct panfrost_screen *screen);
+
+void
+panfrost_shader_store_init(struct panfrost_screen *screen);
+
+void
+panfrost_shader_store_cleanup(struct panfrost_screen *screen);
+
+enum panfrost_cso_type {
+        PAN_CSO_SAMPLER,
+        PAN_CSO_RASTERIZER,
+        PAN_CSO_ZSA,
+        PAN_CSO_BLEND,
+};
+
+void
+panfrost_cso_store_init(struct panfrost_screen *screen);
+
+void
+panfrost_cso_store_cleanup(struct panfrost_screen *screen);
+
+void *
+panfrost_cso_store_get(struct panfrost_screen *screen,
+                       enum panfrost_cso_type type,
+                       const void *templ, unsigned size);
+
+void *
+panfrost_cso_store_add(struct panfrost_screen *screen,
+                       enum panfrost_cso_type type,
+                       const void *templ, unsigned size, void *cso);
+
 /** (Vertex buffer index, divisor) tuple that will become an Attribute Buffer
  * Descriptor at draw-time on Midgard
  */
@@ -424,6 +753,16 @@ pan_so_target(struct pipe_stream_output_target *target)
         return (struct panfrost_streamout_target *)target;
 }
 
+/* Does the bound fragment shader blend the given render target itself? */
+static inline bool
+panfrost_fs_blends_rt(const struct panfrost_context *ctx, unsigned rt)
+{
+        const struct panfrost_compiled_shader *fs =
+                ctx->prog[PIPE_SHADER_FRAGMENT];
+
+        return fs && fs->key.fs.blend.formats[rt] != PIPE_FORMAT_NONE;
+}
+
 struct pipe_context *
 panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags);
 
@@ -439,6 +778,9 @@ panfrost_flush(
         struct pipe_fence_handle **fence,
         unsigned flags);
 
+uint64_t
+panfrost_timestamp_to_ns(struct panfrost_device *dev, uint64_t ticks);
+
 bool
 panfrost_render_condition_check(struct panfrost_context *ctx);
 
@@ -468,6 +810,98 @@ panfrost_vertex_buffer_address(struct panfrost_context *ctx, unsigned i);
 void
 panfrost_shader_context_init(struct pipe_context *pctx);
 
+/* State packed into a fragment renderer state descriptor and its blend
+ * descriptors. RSDs using blend shaders are not cached, since blend shaders
+ * are uploaded for each batch. The shader is identified by its binary, as
+ * variants can move in memory. Memory must be cleared before filling the key
+ * so that it can be hashed. */
+struct panfrost_rsd_key {
+        mali_ptr fs_binary;
+        const struct panfrost_blend_state *blend;
+        const struct panfrost_zsa_state *zsa;
+        const struct panfrost_rasterizer *rast;
+        struct pipe_blend_color blend_color;
+        struct pipe_stencil_ref stencil_ref;
+        enum pipe_format formats[PIPE_MAX_COLOR_BUFS];
+        unsigned nr_cbufs;
+        unsigned sample_mask;
+        unsigned min_samples;
+        unsigned fb_rt_mask;
+        bool has_oq;
+};
+
+struct panfrost_rsd_cache_entry {
+        struct panfrost_rsd_key key;
+        struct panfrost_pool_ref ref;
+};
+
+/* Maximum number of cached RSDs, the cache is cleared when it is full */
+#define PAN_RSD_CACHE_SIZE 128
+
+void
+panfrost_rsd_cache_clear(struct panfrost_context *ctx);
+
+void
+panfrost_rsd_cache_invalidate(struct panfrost_screen *screen);
+
+/* Key of the attribute and buffer descriptor tables emitted on Valhall, which
+ * only depend on the vertex elements CSO and on the vertex buffer bindings,
+ * resolved to GPU addresses so that reallocated resources get new tables.
+ * Memory must be cleared before filling the key so that it can be hashed. */
+struct panfrost_vertex_key {
+        const struct panfrost_vertex_state *vtx;
+        uint32_t vb_mask;
+
+        struct {
+                mali_ptr address;
+                uint32_t size;
+                uint32_t stride;
+        } buffers[PIPE_MAX_ATTRIBS];
+};
+
+struct panfrost_vertex_cache_entry {
+        struct panfrost_vertex_key key;
+        struct panfrost_pool_ref ref;
+        mali_ptr buffers;
+};
+
+/* Maximum number of cached vertex tables, cleared when full */
+#define PAN_VERTEX_CACHE_SIZE 128
+
+void
+panfrost_vertex_cache_clear(struct panfrost_context *ctx);
+
+/* Number of entries of a Valhall resource table */
+#define PAN_RESOURCE_TABLE_COUNT 12
+
+/* Key of a Valhall resource table, its packed contents. A table only holds
+ * the addresses and sizes of descriptor arrays, so a table with the same
+ * contents can be reused even if the arrays it points to were reallocated
+ * at the same address by a later batch. */
+struct panfrost_resource_table_key {
+        /* RESOURCE descriptors are 16 bytes */
+        uint32_t words[PAN_RESOURCE_TABLE_COUNT * 4];
+};
+
+struct panfrost_resource_table_cache_entry {
+        struct panfrost_resource_table_key key;
+        struct panfrost_pool_ref ref;
+};
+
+/* Maximum number of cached resource tables, cleared when full */
+#define PAN_RESOURCE_TABLE_CACHE_SIZE 256
+
+void
+panfrost_resource_table_cache_clear(struct panfrost_context *ctx);
+
+static inline void
+panfrost_table_invalidate(struct panfrost_pool_ref *table)
+{
+        panfrost_bo_unreference(table->bo);
+        table->bo = NULL;
+        table->gpu = 0;
+}
+
 static inline void
 panfrost_dirty_state_all(struct panfrost_context *ctx)
 {
@@ -488,6 +922,46 @@ panfrost_clean_state_3d(struct panfrost_context *ctx)
         }
 }
 
+void
+panfrost_submit_phase_record(struct panfrost_context *ctx,
+                             enum panfrost_submit_phase phase, uint64_t ns);
+
+static inline bool
+panfrost_submit_profiling(struct panfrost_context *ctx)
+{
+        return ctx->submit_profile || ctx->submit_time_queries;
+}
+
+/* Returns the start time of a profiled phase, or zero when not profiling,
+ * so that the instrumentation costs a branch when disabled */
+static inline uint64_t
+panfrost_submit_phase_begin(struct panfrost_context *ctx)
+{
+        return panfrost_submit_profiling(ctx) ? os_time_get_nano() : 0;
+}
+
+/* Ends the phase started at *start, and starts the next one */
+static inline void
+panfrost_submit_phase_end(struct panfrost_context *ctx,
+                          enum panfrost_submit_phase phase, uint64_t *start)
+{
+        if (!*start)
+                return;
+
+        uint64_t now = os_time_get_nano();
+        panfrost_submit_phase_record(ctx, phase, now - *start);
+        *start = now;
+}
+
+/* KCPU work is done in the middle of emission, so it is accumulated over
+ * the batch and recorded once emission is done */
+static inline void
+panfrost_submit_kcpu_end(struct panfrost_context *ctx, uint64_t start)
+{
+        if (start)
+                ctx->submit_kcpu_ns += os_time_get_nano() - start;
+}
+
 void
 panfrost_set_batch_masks_blend(struct panfrost_batch *batch);
 
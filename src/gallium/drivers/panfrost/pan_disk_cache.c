@@ -175,5 +175,268 @@ panfrost_disk_cache_init(struct panfrost_screen *screen)
         driver_flags |= ((uint64_t) (midgard_debug | bifrost_debug) << 32);
 
         screen->disk_cache = disk_cache_create(renderer, timestamp, driver_flags);
+
+        /* Also cache the internal blend, blit and indirect draw shaders */
+        screen->dev.disk_cache = screen->disk_cache;
 #endif
 }
+
+/*
+ * Warmup records. The shader variant keys and blend shader keys used by a
+ * process are saved to the disk cache when the screen is destroyed, so the
+ * next process can compile them on the shader queue before they are first
+ * needed: blend shaders as soon as the screen is created, variants as soon
+ * as the shader they belong to is created.
+ *
+ * Disk cache entries are never overwritten, so each save goes to the next
+ * free entry of a numbered series and loading takes the last one. Saving
+ * stops once the series is full.
+ */
+
+#define PANFROST_WARMUP_VERSION 1
+#define PANFROST_WARMUP_GENERATIONS 16
+#define PANFROST_WARMUP_MAX_VARIANTS 1024
+#define PANFROST_WARMUP_MAX_BLEND 256
+
+struct panfrost_warmup_blend {
+        struct pan_blend_shader_key key;
+        float constants[4];
+};
+
+#ifdef ENABLE_SHADER_CACHE
+static void
+panfrost_warmup_key(struct disk_cache *cache, unsigned generation,
+                    cache_key cache_key)
+{
+        char name[32];
+        snprintf(name, sizeof(name), "panfrost-warmup-%u", generation);
+        disk_cache_compute_key(cache, name, strlen(name), cache_key);
+}
+
+static void
+panfrost_warmup_blend_execute(void *data, void *gdata, int thread_index)
+{
+        struct panfrost_screen *screen = gdata;
+        struct panfrost_device *dev = &screen->dev;
+        struct util_dynarray *blend = data;
+
+        util_dynarray_foreach(blend, struct panfrost_warmup_blend, b) {
+                struct pan_blend_state state = {
+                        .logicop_enable = b->key.logicop_enable,
+                        .logicop_func = b->key.logicop_func,
+                        .rt_count = b->key.rt + 1,
+                };
+
+                state.rts[b->key.rt] = (struct pan_blend_rt_state) {
+                        .format = b->key.format,
+                        .nr_samples = b->key.nr_samples,
+                        .equation = b->key.equation,
+                };
+
+                memcpy(state.constants, b->constants, sizeof(state.constants));
+
+                pthread_mutex_lock(&dev->blend_shaders.lock);
+                screen->vtbl.get_blend_shader(dev, &state, b->key.src0_type,
+                                              b->key.src1_type, b->key.rt);
+                pthread_mutex_unlock(&dev->blend_shaders.lock);
+        }
+}
+
+static void
+panfrost_warmup_blend_cleanup(void *data, void *gdata, int thread_index)
+{
+        util_dynarray_fini(data);
+        free(data);
+}
+#endif
+
+/**
+ * Load the warmup record of the previous process and start compiling its
+ * blend shaders. Variants are compiled by panfrost_warmup_precompile.
+ */
+void
+panfrost_warmup_load(struct panfrost_screen *screen)
+{
+        simple_mtx_init(&screen->warmup.lock, mtx_plain);
+        util_dynarray_init(&screen->warmup.variants, NULL);
+        util_queue_fence_init(&screen->warmup.blend_fence);
+
+#ifdef ENABLE_SHADER_CACHE
+        struct disk_cache *cache = screen->disk_cache;
+        void *buffer = NULL;
+        size_t size = 0;
+
+        if (!cache || !util_queue_is_initialized(&screen->shader_queue))
+                return;
+
+        for (unsigned i = 0; i < PANFROST_WARMUP_GENERATIONS; ++i) {
+                cache_key cache_key;
+                size_t sz;
+
+                panfrost_warmup_key(cache, i, cache_key);
+                void *buf = disk_cache_get(cache, cache_key, &sz);
+
+                if (!buf)
+                        break;
+
+                free(buffer);
+                buffer = buf;
+                size = sz;
+                screen->warmup.generation = i + 1;
+        }
+
+        if (!buffer)
+                return;
+
+        struct blob_reader blob;
+        blob_reader_init(&blob, buffer, size);
+
+        uint32_t version = blob_read_uint32(&blob);
+        uint32_t nr_variants = blob_read_uint32(&blob);
+        uint32_t nr_blend = blob_read_uint32(&blob);
+
+        if (version != PANFROST_WARMUP_VERSION || blob.overrun ||
+            nr_variants > PANFROST_WARMUP_MAX_VARIANTS ||
+            nr_blend > PANFROST_WARMUP_MAX_BLEND) {
+                free(buffer);
+                return;
+        }
+
+        size_t variants_size = nr_variants * sizeof(struct panfrost_warmup_variant);
+        const void *variants = blob_read_bytes(&blob, variants_size);
+
+        struct util_dynarray *blend = malloc(sizeof(*blend));
+        util_dynarray_init(blend, NULL);
+
+        blob_copy_bytes(&blob,
+                        util_dynarray_grow(blend, struct panfrost_warmup_blend,
+                                           nr_blend),
+                        nr_blend * sizeof(struct panfrost_warmup_blend));
+
+        if (blob.overrun) {
+                panfrost_warmup_blend_cleanup(blend, screen, 0);
+                free(buffer);
+                return;
+        }
+
+        memcpy(util_dynarray_grow_bytes(&screen->warmup.variants, 1, variants_size),
+               variants, variants_size);
+        screen->warmup.nr_blend = nr_blend;
+        free(buffer);
+
+        if (debug) {
+                fprintf(stderr, "[mesa disk cache] warming up %u variants, %u blend shaders\n",
+                        nr_variants, nr_blend);
+        }
+
+        util_queue_add_job(&screen->shader_queue, blend, &screen->warmup.blend_fence,
+                           panfrost_warmup_blend_execute,
+                           panfrost_warmup_blend_cleanup, 0);
+#endif
+}
+
+/**
+ * Remember a newly compiled variant for the next process.
+ */
+void
+panfrost_warmup_record(struct panfrost_screen *screen,
+                       const struct panfrost_uncompiled_shader *uncompiled,
+                       const struct panfrost_shader_key *key)
+{
+        if (!screen->disk_cache)
+                return;
+
+        struct panfrost_warmup_variant v = { 0 };
+        memcpy(v.nir_sha1, uncompiled->nir_sha1, sizeof(v.nir_sha1));
+        v.key = *key;
+
+        simple_mtx_lock(&screen->warmup.lock);
+
+        unsigned count = util_dynarray_num_elements(&screen->warmup.variants,
+                                                    struct panfrost_warmup_variant);
+        bool found = false;
+
+        util_dynarray_foreach(&screen->warmup.variants,
+                              struct panfrost_warmup_variant, it) {
+                if (!memcmp(it, &v, sizeof(v))) {
+                        found = true;
+                        break;
+                }
+        }
+
+        if (!found && count < PANFROST_WARMUP_MAX_VARIANTS) {
+                util_dynarray_append(&screen->warmup.variants,
+                                     struct panfrost_warmup_variant, v);
+                screen->warmup.dirty = true;
+        }
+
+        simple_mtx_unlock(&screen->warmup.lock);
+}
+
+/**
+ * Save the warmup record if anything new was seen, and free it. Must be
+ * called before the shader queue is destroyed and the blend shaders are
+ * cleaned up.
+ */
+void
+panfrost_warmup_save(struct panfrost_screen *screen)
+{
+#ifdef ENABLE_SHADER_CACHE
+        /* Don't hold up exiting to finish warming up */
+        if (util_queue_is_initialized(&screen->shader_queue))
+                util_queue_drop_job(&screen->shader_queue, &screen->warmup.blend_fence);
+
+        struct panfrost_device *dev = &screen->dev;
+        struct disk_cache *cache = screen->disk_cache;
+        struct hash_table *shaders = dev->blend_shaders.shaders;
+        unsigned nr_blend = shaders ? MIN2(shaders->entries, PANFROST_WARMUP_MAX_BLEND) : 0;
+
+        if (cache && screen->warmup.generation < PANFROST_WARMUP_GENERATIONS &&
+            (screen->warmup.dirty || nr_blend > screen->warmup.nr_blend)) {
+                struct blob blob;
+                blob_init(&blob);
+
+                unsigned nr_variants =
+                        util_dynarray_num_elements(&screen->warmup.variants,
+                                                   struct panfrost_warmup_variant);
+
+                blob_write_uint32(&blob, PANFROST_WARMUP_VERSION);
+                blob_write_uint32(&blob, nr_variants);
+                blob_write_uint32(&blob, nr_blend);
+                blob_write_bytes(&blob, screen->warmup.variants.data,
+                                 screen->warmup.variants.size);
+
+                unsigned i = 0;
+
+                pthread_mutex_lock(&dev->blend_shaders.lock);
+                hash_table_foreach(shaders, entry) {
+                        struct pan_blend_shader *shader = entry->data;
+
+                        if (i++ == nr_blend)
+                                break;
+
+                        struct panfrost_warmup_blend b = { .key = shader->key };
+
+                        if (!list_is_empty(&shader->variants)) {
+                                struct pan_blend_shader_variant *v =
+                                        list_first_entry(&shader->variants,
+                                                         struct pan_blend_shader_variant,
+                                                         node);
+                                memcpy(b.constants, v->constants, sizeof(b.constants));
+                        }
+
+                        blob_write_bytes(&blob, &b, sizeof(b));
+                }
+                pthread_mutex_unlock(&dev->blend_shaders.lock);
+
+                cache_key cache_key;
+                panfrost_warmup_key(cache, screen->warmup.generation, cache_key);
+                disk_cache_put(cache, cache_key, blob.data, blob.size, NULL);
+                blob_finish(&blob);
+        }
+#endif
+
+        util_queue_fence_destroy(&screen->warmup.blend_fence);
+        util_dynarray_fini(&screen->warmup.variants);
+        simple_mtx_destroy(&screen->warmup.lock);
+}
@@ -30,6 +30,8 @@
 #include "pan_fence.h"
 #include "pan_screen.h"
 
+#include "util/libsync.h"
+#include "util/os_file.h"
 #include "util/os_time.h"
 #include "util/u_inlines.h"
 
@@ -42,9 +44,12 @@ panfrost_fence_reference(struct pipe_screen *pscreen,
         struct pipe_fence_handle *old = *ptr;
 
         if (pipe_reference(&old->reference, &fence->reference)) {
-                if (dev->kbase)
-                        dev->mali.syncobj_destroy(&dev->mali, old->kbase);
-                else
+                if (dev->kbase) {
+                        if (old->kbase)
+                                dev->mali.syncobj_destroy(&dev->mali, old->kbase);
+                        if (old->sync_fd != -1)
+                                close(old->sync_fd);
+                } else
                         drmSyncobjDestroy(dev->fd, old->syncobj);
                 free(old);
         }
@@ -68,9 +73,20 @@ panfrost_fence_finish(struct pipe_screen *pscreen,
         if (abs_timeout == OS_TIMEOUT_INFINITE)
                 abs_timeout = INT64_MAX;
 
+        if (dev->kbase && fence->sync_fd != -1) {
+                int timeout_ms = (timeout == OS_TIMEOUT_INFINITE) ? -1 :
+                        DIV_ROUND_UP(timeout, 1000000);
+
+                fence->signaled = (sync_wait(fence->sync_fd, timeout_ms) == 0);
+                return fence->signaled;
+        }
+
         if (dev->kbase) {
-                /* TODO: Use the timeout */
-                bool ret = dev->mali.syncobj_wait(&dev->mali, fence->kbase);
+                int64_t timeout_ns = (timeout == OS_TIMEOUT_INFINITE) ?
+                        INT64_MAX : MIN2(timeout, INT64_MAX);
+
+                bool ret = dev->mali.syncobj_wait(&dev->mali, fence->kbase,
+                                                  timeout_ns);
                 fence->signaled = ret;
                 return ret;
         }
@@ -91,9 +107,16 @@ panfrost_fence_get_fd(struct pipe_screen *screen,
         struct panfrost_device *dev = pan_device(screen);
         int fd = -1;
 
-        /* TODO: Export a sync file using KCPU */
-        if (dev->kbase)
-                return fd;
+        if (dev->kbase) {
+                if (f->sync_fd != -1)
+                        return os_dupfd_cloexec(f->sync_fd);
+
+                /* Only CSF can signal a sync file from the GPU side */
+                if (!dev->mali.syncobj_export_sync_file)
+                        return -1;
+
+                return dev->mali.syncobj_export_sync_file(&dev->mali, f->kbase);
+        }
 
         drmSyncobjExportSyncFile(dev->fd, f->syncobj, &fd);
         return fd;
@@ -106,14 +129,30 @@ panfrost_fence_from_fd(struct panfrost_context *ctx, int fd,
         struct panfrost_device *dev = pan_device(ctx->base.screen);
         int ret;
 
-        /* TODO: Implement this for kbase */
-        if (dev->kbase)
-                return NULL;
-
         struct pipe_fence_handle *f = calloc(1, sizeof(*f));
         if (!f)
                 return NULL;
 
+        f->sync_fd = -1;
+
+        /* kbase has no syncobjs which could be shared between processes, so
+         * only sync files can be imported. The file is kept around, either
+         * to be waited on by the CPU or imported into a KCPU queue by
+         * fence_server_sync. */
+        if (dev->kbase) {
+                if (type != PIPE_FD_TYPE_NATIVE_SYNC)
+                        goto err_free_fence;
+
+                f->sync_fd = os_dupfd_cloexec(fd);
+                if (f->sync_fd == -1) {
+                        fprintf(stderr, "dup sync file failed\n");
+                        goto err_free_fence;
+                }
+
+                pipe_reference_init(&f->reference, 1);
+                return f;
+        }
+
         if (type == PIPE_FD_TYPE_NATIVE_SYNC) {
                 ret = drmSyncobjCreate(dev->fd, 0, &f->syncobj);
                 if (ret) {
@@ -146,6 +185,16 @@ err_free_fence:
         return NULL;
 }
 
+static void
+panfrost_fence_add_cs(struct panfrost_device *dev, struct kbase_syncobj *o,
+                      struct panfrost_cs *cs)
+{
+        if (cs->submitted_seqnum && cs->base.user_io)
+                dev->mali.syncobj_add_seqnum(&dev->mali, o,
+                                             cs->base.event_mem_offset,
+                                             cs->submitted_seqnum);
+}
+
 struct pipe_fence_handle *
 panfrost_fence_create(struct panfrost_context *ctx)
 {
@@ -157,7 +206,17 @@ panfrost_fence_create(struct panfrost_context *ctx)
                 if (!f)
                         return NULL;
 
-                f->kbase = dev->mali.syncobj_dup(&dev->mali, ctx->syncobj_kbase);
+                if (dev->mali.cs_submit) {
+                        /* Only wait for the seqnums of the last batch, rather
+                         * than everything the context syncobj tracks */
+                        f->kbase = dev->mali.syncobj_create(&dev->mali);
+                        panfrost_fence_add_cs(dev, f->kbase, &ctx->kbase_cs_vertex);
+                        panfrost_fence_add_cs(dev, f->kbase, &ctx->kbase_cs_fragment);
+                } else {
+                        f->kbase = dev->mali.syncobj_dup(&dev->mali, ctx->syncobj_kbase);
+                }
+
+                f->sync_fd = -1;
                 pipe_reference_init(&f->reference, 1);
                 return f;
         }
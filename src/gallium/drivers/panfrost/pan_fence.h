@@ -33,6 +33,8 @@ struct pipe_fence_handle {
         struct pipe_reference reference;
         uint32_t syncobj;
         struct kbase_syncobj *kbase;
+        /* Imported sync file for kbase fences, or -1 */
+        int sync_fd;
         bool signaled;
 };
 
@@ -22,7 +22,7 @@
  */
 
 #include "pan_context.h"
-#include "util/u_vbuf.h"
+#include "util/u_inlines.h"
 
 void
 panfrost_analyze_sysvals(struct panfrost_compiled_shader *ss)
@@ -69,6 +69,10 @@ panfrost_analyze_sysvals(struct panfrost_compiled_shader *ss)
                         dirty |= PAN_DIRTY_DRAWID;
                         break;
 
+                case PAN_SYSVAL_BLEND_CONSTANTS:
+                        dirty |= PAN_DIRTY_BLEND;
+                        break;
+
                 case PAN_SYSVAL_SAMPLE_POSITIONS:
                 case PAN_SYSVAL_MULTISAMPLED:
                 case PAN_SYSVAL_RT_CONVERSION:
@@ -114,6 +118,41 @@ panfrost_get_index_buffer(struct panfrost_batch *batch,
         }
 }
 
+/* Scan the indices of a draw for their bounds on the CPU. The buffer is
+ * mapped for reading, so this waits on any GPU writer. */
+
+static void
+panfrost_get_minmax_index(struct panfrost_context *ctx,
+                          const struct pipe_draw_info *info,
+                          const struct pipe_draw_start_count_bias *draw,
+                          unsigned *min_index, unsigned *max_index)
+{
+        struct pipe_transfer *transfer = NULL;
+        const void *indices;
+
+        if (!draw->count) {
+                *min_index = *max_index = 0;
+                return;
+        }
+
+        if (info->has_user_indices) {
+                indices = (const uint8_t *) info->index.user +
+                          draw->start * info->index_size;
+        } else {
+                indices = pipe_buffer_map_range(&ctx->base, info->index.resource,
+                                                draw->start * info->index_size,
+                                                draw->count * info->index_size,
+                                                PIPE_MAP_READ, &transfer);
+        }
+
+        panfrost_minmax_search(indices, info->index_size, draw->count,
+                               info->primitive_restart, info->restart_index,
+                               min_index, max_index);
+
+        if (transfer)
+                pipe_buffer_unmap(&ctx->base, transfer);
+}
+
 /* Gets a GPU address for the associated index buffer. Only gauranteed to be
  * good for the duration of the draw (transient), could last longer. Also get
  * the bounds on the index buffer for the range accessed by the draw. We do
@@ -137,6 +176,7 @@ panfrost_get_index_buffer_bounded(struct panfrost_batch *batch,
         } else if (!info->has_user_indices) {
                 /* Check the cache */
                 needs_indices = !panfrost_minmax_cache_get(rsrc->index_cache,
+                                                           info->index_size,
                                                            draw->start,
                                                            draw->count,
                                                            min_index,
@@ -145,10 +185,11 @@ panfrost_get_index_buffer_bounded(struct panfrost_batch *batch,
 
         if (needs_indices) {
                 /* Fallback */
-                u_vbuf_get_minmax_index(&ctx->base, info, draw, min_index, max_index);
+                panfrost_get_minmax_index(ctx, info, draw, min_index, max_index);
 
                 if (!info->has_user_indices)
                         panfrost_minmax_cache_add(rsrc->index_cache,
+                                                  info->index_size,
                                                   draw->start, draw->count,
                                                   *min_index, *max_index);
         }
@@ -215,25 +256,68 @@ panfrost_set_batch_masks_blend(struct panfrost_batch *batch)
         }
 }
 
+static bool
+pan_func_reads(enum pipe_compare_func func)
+{
+        return func != PIPE_FUNC_ALWAYS && func != PIPE_FUNC_NEVER;
+}
+
+/* Does the stencil state depend on the value in the stencil buffer, either
+ * for the test or to compute the value written? */
+static bool
+pan_stencil_reads(const struct pipe_stencil_state *s)
+{
+        if (!s->enabled)
+                return false;
+
+        if (pan_func_reads(s->func))
+                return true;
+
+        if (!util_writes_stencil(s))
+                return false;
+
+        /* Writes with a partial mask preserve the other bits */
+        if ((s->writemask & 0xFF) != 0xFF)
+                return true;
+
+        enum pipe_stencil_op ops[] = { s->fail_op, s->zfail_op, s->zpass_op };
+
+        for (unsigned i = 0; i < ARRAY_SIZE(ops); ++i) {
+                switch (ops[i]) {
+                case PIPE_STENCIL_OP_INCR:
+                case PIPE_STENCIL_OP_DECR:
+                case PIPE_STENCIL_OP_INCR_WRAP:
+                case PIPE_STENCIL_OP_DECR_WRAP:
+                case PIPE_STENCIL_OP_INVERT:
+                        return true;
+                default:
+                        break;
+                }
+        }
+
+        return false;
+}
+
 void
 panfrost_set_batch_masks_zs(struct panfrost_batch *batch)
 {
         struct panfrost_context *ctx = batch->ctx;
         struct pipe_depth_stencil_alpha_state *zsa = (void *) ctx->depth_stencil;
 
-        /* Assume depth is read (TODO: perf) */
-        if (zsa->depth_enabled)
+        if (zsa->depth_enabled && pan_func_reads(zsa->depth_func))
                 batch->read |= PIPE_CLEAR_DEPTH;
 
-        if (zsa->depth_writemask)
+        if (zsa->depth_enabled && zsa->depth_writemask &&
+            zsa->depth_func != PIPE_FUNC_NEVER)
                 panfrost_draw_target(batch, PIPE_CLEAR_DEPTH);
 
-        if (zsa->stencil[0].enabled) {
-                panfrost_draw_target(batch, PIPE_CLEAR_STENCIL);
-
-                /* Assume stencil is read (TODO: perf) */
+        if (pan_stencil_reads(&zsa->stencil[0]) ||
+            pan_stencil_reads(&zsa->stencil[1]))
                 batch->read |= PIPE_CLEAR_STENCIL;
-        }
+
+        if (util_writes_stencil(&zsa->stencil[0]) ||
+            util_writes_stencil(&zsa->stencil[1]))
+                panfrost_draw_target(batch, PIPE_CLEAR_STENCIL);
 }
 
 void
@@ -245,10 +329,15 @@ panfrost_track_image_access(struct panfrost_batch *batch,
 
         if (image->shader_access & PIPE_IMAGE_ACCESS_WRITE) {
                 panfrost_batch_write_rsrc(batch, rsrc, stage);
+                batch->storage_writes |= BITFIELD_BIT(stage);
 
                 bool is_buffer = rsrc->base.target == PIPE_BUFFER;
                 unsigned level = is_buffer ? 0 : image->u.tex.level;
-                BITSET_SET(rsrc->valid.data, level);
+                panfrost_resource_set_valid(rsrc, level);
+
+                /* Storage writes bypass the tile buffer, so the checksums
+                 * no longer match the content */
+                rsrc->valid.crc = false;
 
                 if (is_buffer) {
                         util_range_add(&rsrc->base, &rsrc->valid_buffer_range,
@@ -30,19 +30,26 @@
 #include "drm-uapi/panfrost_drm.h"
 
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_context.h"
+#include "pan_tracepoints.h"
 #include "util/hash_table.h"
 #include "util/ralloc.h"
 #include "util/format/u_format.h"
 #include "util/u_pack_color.h"
 #include "util/rounding.h"
 #include "util/u_framebuffer.h"
+#include "util/u_atomic.h"
 #include "pan_util.h"
 #include "decode.h"
 
 #define foreach_batch(ctx, idx) \
         BITSET_FOREACH_SET(idx, ctx->batches.active, PAN_MAX_BATCHES)
 
+/* Virtual size of a growable varying region. Only what the GPU touches is
+ * committed, in 2 MB steps. */
+#define PAN_GROWABLE_VARYINGS_SIZE (64 * 1024 * 1024)
+
 static unsigned
 panfrost_batch_idx(struct panfrost_batch *batch)
 {
@@ -89,23 +96,47 @@ panfrost_batch_init(struct panfrost_context *ctx,
         util_dynarray_init(&batch->frag_deps, NULL);
 
         util_dynarray_init(&batch->dmabufs, NULL);
+        util_dynarray_init(&batch->vert_dmabufs, NULL);
+        util_dynarray_init(&batch->timestamps, NULL);
+
+        u_trace_init(&batch->trace, &ctx->trace_context);
 
         /* Preallocate the main pool, since every batch has at least one job
          * structure so it will be used */
-        panfrost_pool_init(&batch->pool, NULL, dev, 0, 65536, "Batch pool", true, true);
+        panfrost_pool_init(&batch->pool, NULL, dev, 0, 65536, "Batch pool",
+                           true, true, &ctx->pool_recycler);
 
         /* Don't preallocate the invisible pool, since not every batch will use
          * the pre-allocation, particularly if the varyings are larger than the
-         * preallocation and a reallocation is needed after anyway. */
+         * preallocation and a reallocation is needed after anyway.
+         *
+         * On kbase, varyings can instead come from a large region that is
+         * only committed as the GPU faults on it, so big batches do not
+         * need a chain of BOs. The regions are recycled by the context,
+         * which gives back their pages before reusing them. */
+        unsigned varying_flags = PAN_BO_INVISIBLE;
+        size_t varying_slab_size = 65536;
+
+        if (dev->kbase && (dev->debug & PAN_DBG_GROW_VARYINGS)) {
+                varying_flags |= PAN_BO_GROWABLE;
+                varying_slab_size = PAN_GROWABLE_VARYINGS_SIZE;
+        }
+
         panfrost_pool_init(&batch->invisible_pool, NULL, dev,
-                        PAN_BO_INVISIBLE, 65536, "Varyings", false, true);
+                        varying_flags, varying_slab_size, "Varyings", false,
+                        true, &ctx->invisible_pool_recycler);
+
+        /* Varyings are only written by vertex/tiler jobs */
+        batch->invisible_pool.fragment_access = PAN_BO_ACCESS_READ;
 
         for (unsigned i = 0; i < batch->key.nr_cbufs; ++i)
                 panfrost_batch_add_surface(batch, batch->key.cbufs[i]);
 
         panfrost_batch_add_surface(batch, batch->key.zsbuf);
 
-        if ((dev->debug & PAN_DBG_SYNC) || !(dev->debug & PAN_DBG_GOFASTER))
+        /* Faults are detected asynchronously, so only wait for each batch
+         * when debugging */
+        if (dev->debug & PAN_DBG_SYNC)
                 batch->needs_sync = true;
 
         screen->vtbl.init_batch(batch);
@@ -123,6 +154,19 @@ panfrost_batch_uses_resource(struct panfrost_batch *batch,
         return _mesa_set_search(batch->resources, rsrc) != NULL;
 }
 
+/* Whether implicit sync with other processes or devices accessing the
+ * resource goes through the fences of its dma-buf. Only BOs imported from a
+ * dma-buf have one on kbase, other BOs are private to the process. */
+static bool
+panfrost_rsrc_has_dmabuf_fences(struct panfrost_device *dev,
+                                struct panfrost_resource *rsrc)
+{
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        return dev->has_dmabuf_fence && (bo->flags & PAN_BO_SHARED) &&
+               bo->dmabuf_fd != -1;
+}
+
 static void
 panfrost_batch_add_resource(struct panfrost_batch *batch,
                             struct panfrost_resource *rsrc)
@@ -143,23 +187,24 @@ panfrost_batch_add_resource(struct panfrost_batch *batch,
         /* Reference the resource on the batch */
         pipe_reference(NULL, &rsrc->base.reference);
 
-        if (rsrc->scanout) {
-                if (dev->has_dmabuf_fence) {
-                        int fd = rsrc->image.data.bo->dmabuf_fd;
-                        util_dynarray_append(&batch->dmabufs, int, fd);
-                } else {
-                        perf_debug_ctx(ctx, "Forcing sync on batch");
-                        batch->needs_sync = true;
-                }
+        if (panfrost_rsrc_has_dmabuf_fences(dev, rsrc)) {
+                util_dynarray_append(&batch->dmabufs, struct panfrost_bo *,
+                                     rsrc->image.data.bo);
+        } else if (rsrc->scanout) {
+                perf_debug_ctx(ctx, "Forcing sync on batch");
+                batch->needs_sync = true;
         }
 }
 
 static void
 panfrost_batch_remove_resource_internal(struct panfrost_context *ctx,
+                                        struct panfrost_batch *batch,
                                         struct panfrost_resource *rsrc)
 {
+        /* Readers can outlive the writer when batches are reordered, so only
+         * the writer itself drops the entry */
         struct hash_entry *writer = _mesa_hash_table_search(ctx->writers, rsrc);
-        if (writer) {
+        if (writer && writer->data == batch) {
                 _mesa_hash_table_remove(ctx->writers, writer);
                 rsrc->track.nr_writers--;
         }
@@ -176,7 +221,7 @@ panfrost_batch_remove_resource_if_present(struct panfrost_context *ctx,
         struct set_entry *ent = _mesa_set_search(batch->resources, rsrc);
 
         if (ent != NULL) {
-                panfrost_batch_remove_resource_internal(ctx, rsrc);
+                panfrost_batch_remove_resource_internal(ctx, batch, rsrc);
                 _mesa_set_remove(batch->resources, ent);
         }
 }
@@ -188,12 +233,34 @@ panfrost_batch_destroy_resources(struct panfrost_context *ctx,
         set_foreach(batch->resources, entry) {
                 struct panfrost_resource *rsrc = (void *) entry->key;
 
-                panfrost_batch_remove_resource_internal(ctx, rsrc);
+                panfrost_batch_remove_resource_internal(ctx, batch, rsrc);
         }
 
         _mesa_set_destroy(batch->resources, NULL);
 }
 
+/* Batches after which an unused thread local storage arena is released */
+#define PAN_SCRATCH_IDLE_BATCHES 64
+
+/* Called as batches are freed, releases the arena once it has been unused
+ * for long enough */
+static void
+panfrost_scratch_arena_retire(struct panfrost_context *ctx,
+                              struct panfrost_batch *batch)
+{
+        if (ctx->scratch.batch == batch)
+                ctx->scratch.batch = NULL;
+
+        if (!ctx->scratch.bo || ctx->scratch.batch)
+                return;
+
+        if (++ctx->scratch.idle_batches >= PAN_SCRATCH_IDLE_BATCHES) {
+                panfrost_bo_unreference(ctx->scratch.bo);
+                ctx->scratch.bo = NULL;
+                ctx->scratch.idle_batches = 0;
+        }
+}
+
 static void
 panfrost_batch_cleanup(struct panfrost_context *ctx, struct panfrost_batch *batch)
 {
@@ -222,6 +289,12 @@ panfrost_batch_cleanup(struct panfrost_context *ctx, struct panfrost_batch *batc
         }
 
         util_dynarray_fini(&batch->dmabufs);
+        util_dynarray_fini(&batch->vert_dmabufs);
+        util_dynarray_fini(&batch->timestamps);
+
+        /* Hand the timestamps over to be read back once the GPU is done */
+        u_trace_flush(&batch->trace, NULL, false);
+        u_trace_fini(&batch->trace);
 
         util_dynarray_fini(&batch->vert_deps);
         util_dynarray_fini(&batch->frag_deps);
@@ -230,8 +303,14 @@ panfrost_batch_cleanup(struct panfrost_context *ctx, struct panfrost_batch *batc
                 util_dynarray_fini(&batch->resource_bos[i]);
 
         panfrost_batch_destroy_resources(ctx, batch);
+        panfrost_scratch_arena_retire(ctx, batch);
+
+        /* The invisible pool is only written by the GPU */
+        ctx->pool_upload_bytes += batch->pool.allocated;
+
         panfrost_pool_cleanup(&batch->pool);
         panfrost_pool_cleanup(&batch->invisible_pool);
+        panfrost_replay_batch_fini(batch);
 
         util_unreference_framebuffer_state(&batch->key);
 
@@ -239,6 +318,50 @@ panfrost_batch_cleanup(struct panfrost_context *ctx, struct panfrost_batch *batc
 
         memset(batch, 0, sizeof(*batch));
         BITSET_CLEAR(ctx->batches.active, batch_idx);
+
+        /* The dependencies on this batch are satisfied */
+        for (unsigned i = 0; i < PAN_MAX_BATCHES; i++)
+                BITSET_CLEAR(ctx->batches.slots[i].deps, batch_idx);
+}
+
+/* Whether any open batch must be submitted after this one */
+
+static bool
+panfrost_batch_has_dependents(struct panfrost_context *ctx,
+                              struct panfrost_batch *batch)
+{
+        unsigned batch_idx = panfrost_batch_idx(batch);
+        unsigned i;
+
+        foreach_batch(ctx, i) {
+                if (BITSET_TEST(ctx->batches.slots[i].deps, batch_idx))
+                        return true;
+        }
+
+        return false;
+}
+
+/* Count the tiles of a frame whose writeback was subject to transaction
+ * elimination, i.e. rendered with a valid checksum read back. The hardware
+ * doesn't report how many of them were actually skipped, so this is an upper
+ * bound. The render target checksummed is the one whose checksums stay valid
+ * after the FBD is emitted. */
+
+static unsigned
+panfrost_batch_crc_tiles(const struct pan_fb_info *fb, const bool *crc_valid)
+{
+        for (unsigned i = 0; i < fb->rt_count; ++i) {
+                if (!fb->rts[i].view || !fb->rts[i].view->image->layout.crc)
+                        continue;
+
+                if (!crc_valid[i] || !*(fb->rts[i].crc_valid))
+                        continue;
+
+                return ((fb->extent.maxx / 16) - (fb->extent.minx / 16) + 1) *
+                       ((fb->extent.maxy / 16) - (fb->extent.miny / 16) + 1);
+        }
+
+        return 0;
 }
 
 static void
@@ -254,11 +377,26 @@ panfrost_get_batch(struct panfrost_context *ctx,
         for (unsigned i = 0; i < PAN_MAX_BATCHES; i++) {
                 if (ctx->batches.slots[i].seqnum &&
                     util_framebuffer_state_equal(&ctx->batches.slots[i].key, key)) {
+                        batch = &ctx->batches.slots[i];
+
+                        /* Batches are only ever ordered after the batch being
+                         * recorded, so a batch that later batches depend on
+                         * can't grow any further. Submit it and start a new
+                         * one, that also keeps the dependency graph acyclic.
+                         */
+                        if (panfrost_batch_has_dependents(ctx, batch)) {
+                                perf_debug_ctx(ctx, "Flushing a batch other batches depend on");
+                                batch->reason = "Batch depended on";
+                                batch->flush_class = PAN_FLUSH_DEPENDENCY;
+                                panfrost_batch_submit(ctx, batch);
+                                break;
+                        }
+
                         /* We found a match, increase the seqnum for the LRU
                          * eviction logic.
                          */
-                        ctx->batches.slots[i].seqnum = ++ctx->batches.seqnum;
-                        return &ctx->batches.slots[i];
+                        batch->seqnum = ++ctx->batches.seqnum;
+                        return batch;
                 }
 
                 if (!batch || batch->seqnum > ctx->batches.slots[i].seqnum)
@@ -268,8 +406,11 @@ panfrost_get_batch(struct panfrost_context *ctx,
         assert(batch);
 
         /* The selected slot is used, we need to flush the batch */
-        if (batch->seqnum)
+        if (batch->seqnum) {
+                batch->reason = "Batch slots full";
+                batch->flush_class = PAN_FLUSH_FBO;
                 panfrost_batch_submit(ctx, batch);
+        }
 
         panfrost_batch_init(ctx, key, batch);
 
@@ -317,6 +458,8 @@ panfrost_get_fresh_batch_for_fbo(struct panfrost_context *ctx, const char *reaso
 
         if (batch->scoreboard.first_job) {
                 perf_debug_ctx(ctx, "Flushing the current FBO due to: %s", reason);
+                batch->reason = reason;
+                batch->flush_class = PAN_FLUSH_FBO;
                 panfrost_batch_submit(ctx, batch);
                 batch = panfrost_get_batch(ctx, &ctx->pipe_framebuffer);
         }
@@ -336,20 +479,21 @@ panfrost_batch_update_access(struct panfrost_batch *batch,
 
         panfrost_batch_add_resource(batch, rsrc);
 
-        /* Flush users if required */
-        if (writes || ((writer != NULL) && (writer != batch))) {
+        /* Rather than flushing the other batches involved in a hazard, order
+         * this batch after them. A write has to come after every other user,
+         * a read only after the writer. Nothing depends on the batch being
+         * recorded, so this can't create cycles. */
+        if (writes) {
                 unsigned i;
                 foreach_batch(ctx, i) {
-                        struct panfrost_batch *batch = &ctx->batches.slots[i];
-
-                        /* Skip the entry if this our batch. */
-                        if (i == batch_idx)
-                                continue;
+                        struct panfrost_batch *user = &ctx->batches.slots[i];
 
-                        /* Submit if it's a user */
-                        if (panfrost_batch_uses_resource(batch, rsrc))
-                                panfrost_batch_submit(ctx, batch);
+                        if (i != batch_idx &&
+                            panfrost_batch_uses_resource(user, rsrc))
+                                BITSET_SET(batch->deps, i);
                 }
+        } else if (writer != NULL && writer != batch) {
+                BITSET_SET(batch->deps, panfrost_batch_idx(writer));
         }
 
         if (writes && (writer != batch)) {
@@ -407,10 +551,51 @@ void
 panfrost_batch_add_bo(struct panfrost_batch *batch,
                 struct panfrost_bo *bo, enum pipe_shader_type stage)
 {
+        if (unlikely(batch->replay.in_draw) && bo)
+                panfrost_replay_log_bo(batch, bo, stage);
+
         panfrost_batch_add_bo_old(batch, bo, PAN_BO_ACCESS_READ |
                         panfrost_access_for_stage(stage));
 }
 
+/* Add the BOs of a pool the batch doesn't own, with the access of the owner */
+void
+panfrost_batch_add_pool(struct panfrost_batch *batch,
+                        struct panfrost_pool *pool)
+{
+        util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo) {
+                panfrost_batch_add_bo_old(batch, *bo,
+                                          pool->vertex_access |
+                                          pool->fragment_access |
+                                          PAN_BO_ACCESS_VERTEX_TILER |
+                                          PAN_BO_ACCESS_FRAGMENT);
+        }
+}
+
+/* Track the dma-bufs the vertex queue has to wait for. Resources are only
+ * added to batch->dmabufs on first use, so this has to be checked for every
+ * access. */
+static void
+panfrost_batch_add_dmabuf_stage(struct panfrost_batch *batch,
+                                struct panfrost_resource *rsrc,
+                                enum pipe_shader_type stage)
+{
+        struct panfrost_device *dev = pan_device(batch->ctx->base.screen);
+
+        if (stage == PIPE_SHADER_FRAGMENT ||
+            !panfrost_rsrc_has_dmabuf_fences(dev, rsrc))
+                return;
+
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        util_dynarray_foreach(&batch->vert_dmabufs, struct panfrost_bo *, it) {
+                if (*it == bo)
+                        return;
+        }
+
+        util_dynarray_append(&batch->vert_dmabufs, struct panfrost_bo *, bo);
+}
+
 void
 panfrost_batch_read_rsrc(struct panfrost_batch *batch,
                          struct panfrost_resource *rsrc,
@@ -422,6 +607,9 @@ panfrost_batch_read_rsrc(struct panfrost_batch *batch,
         enum panfrost_usage_type type = (stage == MESA_SHADER_FRAGMENT) ?
                 PAN_USAGE_READ_FRAGMENT : PAN_USAGE_READ_VERTEX;
 
+        if (unlikely(batch->replay.in_draw))
+                panfrost_replay_log_rsrc(batch, rsrc, stage);
+
         util_dynarray_append(&batch->resource_bos[type], struct panfrost_bo *,
                              rsrc->image.data.bo);
 
@@ -431,6 +619,7 @@ panfrost_batch_read_rsrc(struct panfrost_batch *batch,
                 panfrost_batch_add_bo_old(batch, rsrc->separate_stencil->image.data.bo, access);
 
         panfrost_batch_update_access(batch, rsrc, false);
+        panfrost_batch_add_dmabuf_stage(batch, rsrc, stage);
 }
 
 void
@@ -444,6 +633,22 @@ panfrost_batch_write_rsrc(struct panfrost_batch *batch,
         enum panfrost_usage_type type = (stage == MESA_SHADER_FRAGMENT) ?
                 PAN_USAGE_WRITE_FRAGMENT : PAN_USAGE_WRITE_VERTEX;
 
+        /* Draws writing resources are not replayed */
+        if (batch->replay.in_draw)
+                batch->replay.disabled = true;
+
+        /* Packed AFBC has no room for new superblocks */
+        panfrost_resource_cancel_afbc_pack(rsrc);
+
+        if (rsrc->afbc_pack.packed)
+                panfrost_resource_unpack_afbc(batch->ctx, rsrc);
+
+        rsrc->afbc_pack.reads = 0;
+
+        /* The range written by the GPU isn't known */
+        panfrost_minmax_cache_invalidate_range(rsrc->index_cache, 0, ~0);
+        panfrost_resource_contents_changed(rsrc);
+
         util_dynarray_append(&batch->resource_bos[type], struct panfrost_bo *,
                              rsrc->image.data.bo);
 
@@ -453,6 +658,7 @@ panfrost_batch_write_rsrc(struct panfrost_batch *batch,
                 panfrost_batch_add_bo_old(batch, rsrc->separate_stencil->image.data.bo, access);
 
         panfrost_batch_update_access(batch, rsrc, true);
+        panfrost_batch_add_dmabuf_stage(batch, rsrc, stage);
 }
 
 void
@@ -497,46 +703,289 @@ panfrost_batch_create_bo(struct panfrost_batch *batch, size_t size,
         return bo;
 }
 
+/* Thread local storage comes from an arena owned by the context, grown to the
+ * largest stack seen. At most one batch holds the arena at a time, and it is
+ * only taken once the GPU has retired the batches that used it before;
+ * otherwise the batch gets a BO of its own. After enough batches go by
+ * without needing most of it, the arena is dropped so that a single spilling
+ * shader doesn't pin multiple megabytes. */
+
+static bool
+panfrost_scratch_arena_available(struct panfrost_context *ctx, unsigned size)
+{
+        return ctx->scratch.bo && !ctx->scratch.batch &&
+               ctx->scratch.bo->size >= size &&
+               panfrost_bo_wait(ctx->scratch.bo, 0, true);
+}
+
 struct panfrost_bo *
 panfrost_batch_get_scratchpad(struct panfrost_batch *batch,
                 unsigned size_per_thread,
                 unsigned thread_tls_alloc,
                 unsigned core_id_range)
 {
+        struct panfrost_context *ctx = batch->ctx;
         unsigned size = panfrost_get_total_stack_size(size_per_thread,
                         thread_tls_alloc,
                         core_id_range);
 
-        if (batch->scratchpad) {
-                assert(batch->scratchpad->size >= size);
-        } else {
-                batch->scratchpad = panfrost_batch_create_bo(batch, size,
-                                             PAN_BO_INVISIBLE,
-                                             PIPE_SHADER_VERTEX,
-                                             "Thread local storage");
+        if (ctx->scratch.bo && size * 4 > ctx->scratch.bo->size)
+                ctx->scratch.idle_batches = 0;
+
+        if (batch->scratchpad && batch->scratchpad->size >= size)
+                return batch->scratchpad;
 
-                panfrost_batch_add_bo(batch, batch->scratchpad,
-                                PIPE_SHADER_FRAGMENT);
+        struct panfrost_bo *bo;
+
+        if (panfrost_scratch_arena_available(ctx, size)) {
+                bo = ctx->scratch.bo;
+                ctx->scratch.batch = batch;
+        } else if ((!ctx->scratch.bo || ctx->scratch.bo->size < size) &&
+                   (!ctx->scratch.batch || ctx->scratch.batch == batch)) {
+                /* Nobody else holds the arena, so replace it with a larger
+                 * one. Batches still using the old one keep it alive. */
+                panfrost_bo_unreference(ctx->scratch.bo);
+
+                bo = panfrost_bo_create(pan_device(ctx->base.screen), size,
+                                        PAN_BO_INVISIBLE,
+                                        "Thread local storage");
+                ctx->scratch.bo = bo;
+                ctx->scratch.batch = batch;
+                ctx->scratch.idle_batches = 0;
+        } else {
+                bo = panfrost_batch_create_bo(batch, size, PAN_BO_INVISIBLE,
+                                              PIPE_SHADER_VERTEX,
+                                              "Thread local storage");
         }
 
-        return batch->scratchpad;
+        panfrost_batch_add_bo(batch, bo, PIPE_SHADER_VERTEX);
+        panfrost_batch_add_bo(batch, bo, PIPE_SHADER_FRAGMENT);
+        batch->scratchpad = bo;
+
+        return bo;
 }
 
+/* Workgroup shared memory comes from an arena owned by the context, which
+ * grows to the largest size requested and is then reused by every dispatch.
+ * Each dispatch overwrites it, so it is added with write access to order the
+ * batches using it. A replaced arena stays alive until the batches still
+ * referencing it are freed. */
+
 struct panfrost_bo *
 panfrost_batch_get_shared_memory(struct panfrost_batch *batch,
-                unsigned size,
-                unsigned workgroup_count)
+                unsigned size)
 {
-        if (batch->shared_memory) {
-                assert(batch->shared_memory->size >= size);
-        } else {
-                batch->shared_memory = panfrost_batch_create_bo(batch, size,
-                                             PAN_BO_INVISIBLE,
-                                             PIPE_SHADER_VERTEX,
-                                             "Workgroup shared memory");
+        struct panfrost_context *ctx = batch->ctx;
+
+        if (!ctx->wls || ctx->wls->size < size) {
+                if (ctx->wls)
+                        panfrost_bo_unreference(ctx->wls);
+
+                ctx->wls = panfrost_bo_create(pan_device(ctx->base.screen),
+                                              size, PAN_BO_INVISIBLE,
+                                              "Workgroup shared memory");
+        }
+
+        panfrost_batch_add_bo_old(batch, ctx->wls, PAN_BO_ACCESS_RW |
+                                  PAN_BO_ACCESS_VERTEX_TILER);
+        batch->shared_memory = ctx->wls;
+
+        return ctx->wls;
+}
+
+/* Intersects the valid region of a slice with the batch extent, adding it to
+ * region. Returns false if nothing in the extent needs preloading. */
+
+static bool
+panfrost_preload_region(struct panfrost_batch *batch,
+                        struct panfrost_resource *rsrc, unsigned level,
+                        struct pipe_scissor_state *region, bool *partial)
+{
+        if (!BITSET_TEST(rsrc->valid.partial, level)) {
+                *partial = false;
+                return true;
+        }
+
+        const struct pipe_scissor_state *valid = &rsrc->valid.region[level];
+        unsigned minx = MAX2(valid->minx, batch->minx);
+        unsigned miny = MAX2(valid->miny, batch->miny);
+        unsigned maxx = MIN2(valid->maxx, batch->maxx);
+        unsigned maxy = MIN2(valid->maxy, batch->maxy);
+
+        if (minx >= maxx || miny >= maxy)
+                return false;
+
+        region->minx = MIN2(region->minx, minx);
+        region->miny = MIN2(region->miny, miny);
+        region->maxx = MAX2(region->maxx, maxx);
+        region->maxy = MAX2(region->maxy, maxy);
+        return true;
+}
+
+/* Only the parts of the render targets written by earlier render passes hold
+ * valid data. Skip preloading attachments with no valid data in the batch
+ * extent, and when all of the preloaded attachments are only partly valid,
+ * limit the preload to the union of their valid regions. */
+
+static void
+panfrost_batch_restrict_preload(struct panfrost_batch *batch,
+                                struct pan_fb_info *fb,
+                                struct panfrost_resource *z_rsrc,
+                                struct panfrost_resource *s_rsrc)
+{
+        struct pipe_scissor_state region = {
+                .minx = UINT16_MAX, .miny = UINT16_MAX,
+        };
+        bool partial = true, preload = false;
+
+        for (unsigned i = 0; i < fb->rt_count; ++i) {
+                if (!fb->rts[i].preload)
+                        continue;
+
+                struct panfrost_resource *rsrc =
+                        pan_resource(batch->key.cbufs[i]->texture);
+
+                fb->rts[i].preload =
+                        panfrost_preload_region(batch, rsrc,
+                                                fb->rts[i].view->first_level,
+                                                &region, &partial);
+                preload |= fb->rts[i].preload;
+        }
+
+        /* Separate stencil is tracked as a whole */
+        if (fb->zs.preload.s && s_rsrc != z_rsrc) {
+                partial = false;
+                preload = true;
+        }
+
+        if (fb->zs.preload.z || (fb->zs.preload.s && s_rsrc == z_rsrc)) {
+                bool needed =
+                        panfrost_preload_region(batch, z_rsrc,
+                                                fb->zs.view.zs->first_level,
+                                                &region, &partial);
+
+                if (!needed) {
+                        fb->zs.preload.z = false;
+
+                        if (s_rsrc == z_rsrc)
+                                fb->zs.preload.s = false;
+                }
+
+                preload |= needed;
         }
 
-        return batch->shared_memory;
+        if (preload && partial) {
+                fb->preload_region.enable = true;
+                fb->preload_region.minx = region.minx;
+                fb->preload_region.miny = region.miny;
+                fb->preload_region.maxx = region.maxx - 1;
+                fb->preload_region.maxy = region.maxy - 1;
+        }
+}
+
+static void
+panfrost_init_surface_view(struct pan_image_view *view,
+                           struct pipe_surface *surf,
+                           enum pipe_format format,
+                           struct panfrost_resource *rsrc)
+{
+        static const unsigned char id_swz[] = {
+                PIPE_SWIZZLE_X, PIPE_SWIZZLE_Y, PIPE_SWIZZLE_Z, PIPE_SWIZZLE_W,
+        };
+
+        view->format = format;
+        view->dim = MALI_TEXTURE_DIMENSION_2D;
+        view->last_level = view->first_level = surf->u.tex.level;
+        view->first_layer = surf->u.tex.first_layer;
+        view->last_layer = surf->u.tex.last_layer;
+        view->image = &rsrc->image;
+        view->nr_samples = surf->nr_samples ? : MAX2(surf->texture->nr_samples, 1);
+        memcpy(view->swizzle, id_swz, sizeof(view->swizzle));
+}
+
+static void
+panfrost_init_fb_views(struct panfrost_fb_views *views,
+                       const struct pipe_framebuffer_state *key)
+{
+        memset(views, 0, sizeof(*views));
+        views->valid = true;
+        views->key = *key;
+
+        for (unsigned i = 0; i < key->nr_cbufs; i++) {
+                struct pipe_surface *surf = key->cbufs[i];
+
+                if (surf) {
+                        panfrost_init_surface_view(&views->rts[i], surf,
+                                                   surf->format,
+                                                   pan_resource(surf->texture));
+                }
+        }
+
+        if (key->zsbuf) {
+                struct pipe_surface *surf = key->zsbuf;
+                struct panfrost_resource *rsrc = pan_resource(surf->texture);
+                enum pipe_format format =
+                        surf->format == PIPE_FORMAT_Z32_FLOAT_S8X24_UINT ?
+                        PIPE_FORMAT_Z32_FLOAT : surf->format;
+
+                panfrost_init_surface_view(&views->zs, surf, format, rsrc);
+
+                if (rsrc->separate_stencil) {
+                        panfrost_init_surface_view(&views->s, surf,
+                                                   PIPE_FORMAT_S8_UINT,
+                                                   rsrc->separate_stencil);
+                }
+        }
+}
+
+/* Apps rendering to many framebuffers per frame would otherwise build the
+ * same views at every submit */
+
+static const struct panfrost_fb_views *
+panfrost_get_fb_views(struct panfrost_batch *batch)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_fb_views *lru = NULL;
+
+        for (unsigned i = 0; i < PAN_FB_VIEWS; ++i) {
+                struct panfrost_fb_views *entry = &ctx->fb_views.entries[i];
+
+                if (entry->valid &&
+                    util_framebuffer_state_equal(&entry->key, &batch->key)) {
+                        entry->seqnum = ++ctx->fb_views.seqnum;
+                        return entry;
+                }
+
+                /* Invalid entries have a zero seqnum */
+                if (!lru || entry->seqnum < lru->seqnum)
+                        lru = entry;
+        }
+
+        panfrost_init_fb_views(lru, &batch->key);
+        lru->seqnum = ++ctx->fb_views.seqnum;
+        return lru;
+}
+
+void
+panfrost_invalidate_fb_views(struct panfrost_context *ctx,
+                             struct pipe_surface *surf)
+{
+        for (unsigned i = 0; i < PAN_FB_VIEWS; ++i) {
+                struct panfrost_fb_views *entry = &ctx->fb_views.entries[i];
+
+                if (!entry->valid)
+                        continue;
+
+                bool match = entry->key.zsbuf == surf;
+
+                for (unsigned j = 0; j < entry->key.nr_cbufs; ++j)
+                        match |= entry->key.cbufs[j] == surf;
+
+                if (match) {
+                        entry->valid = false;
+                        entry->seqnum = 0;
+                }
+        }
 }
 
 static void
@@ -547,10 +996,12 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
                           struct pan_image_view *s,
                           bool reserve)
 {
+        const struct panfrost_fb_views *views = panfrost_get_fb_views(batch);
+
         memset(fb, 0, sizeof(*fb));
-        memset(rts, 0, sizeof(*rts) * 8);
-        memset(zs, 0, sizeof(*zs));
-        memset(s, 0, sizeof(*s));
+        memcpy(rts, views->rts, sizeof(views->rts));
+        *zs = views->zs;
+        *s = views->s;
 
         fb->width = batch->key.width;
         fb->height = batch->key.height;
@@ -564,10 +1015,6 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
         fb->first_provoking_vertex = pan_tristate_get(batch->first_provoking_vertex);
         fb->cs_fragment = &batch->cs_fragment;
 
-        static const unsigned char id_swz[] = {
-                PIPE_SWIZZLE_X, PIPE_SWIZZLE_Y, PIPE_SWIZZLE_Z, PIPE_SWIZZLE_W,
-        };
-
         for (unsigned i = 0; i < fb->rt_count; i++) {
                 struct pipe_surface *surf = batch->key.cbufs[i];
 
@@ -584,20 +1031,11 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
                 }
 
                 fb->rts[i].discard = !reserve && !(batch->resolve & mask);
-
-                rts[i].format = surf->format;
-                rts[i].dim = MALI_TEXTURE_DIMENSION_2D;
-                rts[i].last_level = rts[i].first_level = surf->u.tex.level;
-                rts[i].first_layer = surf->u.tex.first_layer;
-                rts[i].last_layer = surf->u.tex.last_layer;
-                rts[i].image = &prsrc->image;
-                rts[i].nr_samples = surf->nr_samples ? : MAX2(surf->texture->nr_samples, 1);
-                memcpy(rts[i].swizzle, id_swz, sizeof(rts[i].swizzle));
                 fb->rts[i].crc_valid = &prsrc->valid.crc;
                 fb->rts[i].view = &rts[i];
 
                 /* Preload if the RT is read or updated */
-                if (!(batch->clear & mask) &&
+                if (!((batch->clear | batch->replaced) & mask) &&
                     ((batch->read & mask) ||
                      ((batch->draws & mask) &&
                       BITSET_TEST(prsrc->valid.data, fb->rts[i].view->first_level))))
@@ -609,18 +1047,7 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
         struct panfrost_resource *z_rsrc = NULL, *s_rsrc = NULL;
 
         if (batch->key.zsbuf) {
-                struct pipe_surface *surf = batch->key.zsbuf;
-                z_rsrc = pan_resource(surf->texture);
-
-                zs->format = surf->format == PIPE_FORMAT_Z32_FLOAT_S8X24_UINT ?
-                             PIPE_FORMAT_Z32_FLOAT : surf->format;
-                zs->dim = MALI_TEXTURE_DIMENSION_2D;
-                zs->last_level = zs->first_level = surf->u.tex.level;
-                zs->first_layer = surf->u.tex.first_layer;
-                zs->last_layer = surf->u.tex.last_layer;
-                zs->image = &z_rsrc->image;
-                zs->nr_samples = surf->nr_samples ? : MAX2(surf->texture->nr_samples, 1);
-                memcpy(zs->swizzle, id_swz, sizeof(zs->swizzle));
+                z_rsrc = pan_resource(batch->key.zsbuf->texture);
                 fb->zs.view.zs = zs;
                 z_view = zs;
                 if (util_format_is_depth_and_stencil(zs->format)) {
@@ -630,14 +1057,6 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
 
                 if (z_rsrc->separate_stencil) {
                         s_rsrc = z_rsrc->separate_stencil;
-                        s->format = PIPE_FORMAT_S8_UINT;
-                        s->dim = MALI_TEXTURE_DIMENSION_2D;
-                        s->last_level = s->first_level = surf->u.tex.level;
-                        s->first_layer = surf->u.tex.first_layer;
-                        s->last_layer = surf->u.tex.last_layer;
-                        s->image = &s_rsrc->image;
-                        s->nr_samples = surf->nr_samples ? : MAX2(surf->texture->nr_samples, 1);
-                        memcpy(s->swizzle, id_swz, sizeof(s->swizzle));
                         fb->zs.view.s = s;
                         s_view = s;
                 }
@@ -679,21 +1098,36 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
                 fb->zs.preload.z = !fb->zs.clear.z && valid;
                 fb->zs.preload.s = !fb->zs.clear.s && valid;
         }
+
+        panfrost_batch_restrict_preload(batch, fb, z_rsrc, s_rsrc);
 }
 
 static int
 panfrost_batch_submit_kbase(struct panfrost_device *dev,
                             struct drm_panfrost_submit *submit,
-                            struct kbase_syncobj *syncobj)
+                            const bool *writes,
+                            struct kbase_syncobj *syncobj,
+                            struct kbase_atom_batch *atoms)
 {
         dev->mali.handle_events(&dev->mali);
 
-        int atom = dev->mali.submit(&dev->mali,
-                                    submit->jc,
-                                    submit->requirements,
-                                    syncobj,
-                                    (int32_t *)(uintptr_t) submit->bo_handles,
-                                    submit->bo_handle_count);
+        int atom;
+
+        if (atoms) {
+                atom = dev->mali.submit_queue(&dev->mali, atoms,
+                                              submit->jc,
+                                              submit->requirements,
+                                              syncobj,
+                                              (int32_t *)(uintptr_t) submit->bo_handles,
+                                              writes, submit->bo_handle_count);
+        } else {
+                atom = dev->mali.submit(&dev->mali,
+                                        submit->jc,
+                                        submit->requirements,
+                                        syncobj,
+                                        (int32_t *)(uintptr_t) submit->bo_handles,
+                                        writes, submit->bo_handle_count);
+        }
 
         if (atom == -1) {
                 errno = EINVAL;
@@ -716,6 +1150,7 @@ panfrost_batch_submit_ioctl(struct panfrost_batch *batch,
         struct drm_panfrost_submit submit = {0,};
         uint32_t in_syncs[2];
         uint32_t *bo_handles;
+        bool *bo_writes = NULL;
         int ret;
 
         /* If we trace, we always need a syncobj, so make one of our own if we
@@ -746,12 +1181,23 @@ panfrost_batch_submit_ioctl(struct panfrost_batch *batch,
         if (submit.in_sync_count)
                 submit.in_syncs = (uintptr_t)in_syncs;
 
-        bo_handles = calloc(panfrost_pool_num_bos(&batch->pool) +
-                            panfrost_pool_num_bos(&batch->invisible_pool) +
-                            batch->num_bos + 2,
-                            sizeof(*bo_handles));
+        unsigned max_bos = panfrost_pool_num_bos(&batch->pool) +
+                           panfrost_pool_num_bos(&batch->invisible_pool) +
+                           batch->num_bos + 2;
+
+        bo_handles = calloc(max_bos, sizeof(*bo_handles));
         assert(bo_handles);
 
+        /* kbase emulates implicit sync, and doesn't need to order the batches
+         * only reading a BO */
+        if (dev->kbase) {
+                bo_writes = malloc(max_bos * sizeof(*bo_writes));
+                assert(bo_writes);
+
+                for (unsigned i = 0; i < max_bos; ++i)
+                        bo_writes[i] = true;
+        }
+
         pan_bo_access *flags = util_dynarray_begin(&batch->bos);
         unsigned end_bo = util_dynarray_num_elements(&batch->bos, pan_bo_access);
 
@@ -760,6 +1206,11 @@ panfrost_batch_submit_ioctl(struct panfrost_batch *batch,
                         continue;
 
                 assert(submit.bo_handle_count < batch->num_bos);
+
+                if (bo_writes)
+                        bo_writes[submit.bo_handle_count] =
+                                flags[i] & PAN_BO_ACCESS_WRITE;
+
                 bo_handles[submit.bo_handle_count++] = i;
 
                 /* Update the BO access flags so that panfrost_bo_wait() knows
@@ -787,25 +1238,40 @@ panfrost_batch_submit_ioctl(struct panfrost_batch *batch,
                 bo_handles[submit.bo_handle_count++] = dev->tiler_heap->gem_handle;
 
         /* Always used on Bifrost, occassionally used on Midgard */
+        if (bo_writes)
+                bo_writes[submit.bo_handle_count] = false;
+
         bo_handles[submit.bo_handle_count++] = dev->sample_positions->gem_handle;
 
         submit.bo_handles = (u64) (uintptr_t) bo_handles;
+
+        if (dev->capture) {
+                for (unsigned i = 0; i < submit.bo_handle_count; ++i)
+                        pan_capture_bo(dev, pan_lookup_bo_existing(dev, bo_handles[i]));
+        }
+
         if (ctx->is_noop)
                 ret = 0;
         else if (dev->kbase)
-                ret = panfrost_batch_submit_kbase(dev, &submit, ctx->syncobj_kbase);
+                ret = panfrost_batch_submit_kbase(dev, &submit, bo_writes,
+                                                  ctx->syncobj_kbase,
+                                                  batch->kbase_atoms);
         else
                 ret = drmIoctl(dev->fd, DRM_IOCTL_PANFROST_SUBMIT, &submit);
         free(bo_handles);
+        free(bo_writes);
 
         if (ret)
                 return errno;
 
+        pan_capture_jc(dev, submit.jc, submit.requirements);
+
         /* Trace the job if we're doing that */
         if (dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC)) {
                 /* Wait so we can get errors reported back */
                 if (dev->kbase)
-                        dev->mali.syncobj_wait(&dev->mali, ctx->syncobj_kbase);
+                        dev->mali.syncobj_wait(&dev->mali, ctx->syncobj_kbase,
+                                               1000000000);
                 else
                         drmSyncobjWait(dev->fd, &out_sync, 1,
                                        INT64_MAX, 0, NULL);
@@ -830,6 +1296,29 @@ panfrost_has_fragment_job(struct panfrost_batch *batch)
         return batch->scoreboard.first_tiler || batch->clear;
 }
 
+/* Submit a chain writing one of the trace timestamps of a traced batch. It
+ * signals out_sync, which the next chain of the batch waits for. */
+
+static int
+panfrost_batch_submit_trace_ts(struct panfrost_batch *batch,
+                               enum panfrost_trace_ts idx,
+                               uint32_t in_sync, uint32_t out_sync)
+{
+        struct panfrost_screen *screen = pan_screen(batch->ctx->base.screen);
+
+        if (!batch->trace_ts[idx])
+                return 0;
+
+        struct util_dynarray timestamps;
+        util_dynarray_init(&timestamps, NULL);
+        util_dynarray_append(&timestamps, mali_ptr, batch->trace_ts[idx]);
+
+        mali_ptr jc = screen->vtbl.emit_timestamps(batch, &timestamps);
+        util_dynarray_fini(&timestamps);
+
+        return panfrost_batch_submit_ioctl(batch, jc, 0, in_sync, out_sync);
+}
+
 /* Submit both vertex/tiler and fragment jobs for a batch, possibly with an
  * outsync corresponding to the later of the two (since there will be an
  * implicit dep between them) */
@@ -845,8 +1334,25 @@ panfrost_batch_submit_jobs(struct panfrost_batch *batch,
         bool has_draws = batch->scoreboard.first_job;
         bool has_tiler = batch->scoreboard.first_tiler;
         bool has_frag = panfrost_has_fragment_job(batch);
+        bool has_timestamps = batch->timestamps.size;
         int ret = 0;
 
+        /* When tracing, every chain is ordered after the previous one */
+        bool traced = u_trace_has_points(&batch->trace);
+
+        /* On kbase, the chains are queued and sent to the kernel with a
+         * single ioctl, their order being kept by implicit sync on the batch
+         * BOs. Not when the CPU waits for each chain to complete. */
+        struct kbase_atom_batch atoms;
+        bool queue_atoms = dev->kbase && dev->mali.submit_queue &&
+                           !batch->ctx->is_noop &&
+                           !(dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC));
+
+        if (queue_atoms) {
+                kbase_atom_batch_init(&atoms);
+                batch->kbase_atoms = &atoms;
+        }
+
         /* Take the submit lock to make sure no tiler jobs from other context
          * are inserted between our tiler and fragment jobs, failing to do that
          * might result in tiler heap corruption.
@@ -855,65 +1361,110 @@ panfrost_batch_submit_jobs(struct panfrost_batch *batch,
                 pthread_mutex_lock(&dev->submit_lock);
 
         if (has_draws) {
+                ret = panfrost_batch_submit_trace_ts(batch, PAN_TRACE_TS_VERTEX_START,
+                                                     in_sync, out_sync);
+                if (ret)
+                        goto done;
+
                 ret = panfrost_batch_submit_ioctl(batch, batch->scoreboard.first_job,
-                                                  0, in_sync, has_frag ? 0 : out_sync);
+                                                  0, traced ? out_sync : in_sync,
+                                                  (has_frag && !traced) ? 0 : out_sync);
+
+                if (ret)
+                        goto done;
 
+                ret = panfrost_batch_submit_trace_ts(batch, PAN_TRACE_TS_VERTEX_END,
+                                                     out_sync, out_sync);
                 if (ret)
                         goto done;
         }
 
         if (has_frag) {
+                ret = panfrost_batch_submit_trace_ts(batch, PAN_TRACE_TS_FRAGMENT_START,
+                                                     has_draws ? out_sync : in_sync,
+                                                     out_sync);
+                if (ret)
+                        goto done;
+
                 mali_ptr fragjob = screen->vtbl.emit_fragment_job(batch, fb);
                 ret = panfrost_batch_submit_ioctl(batch, fragjob,
-                                                  PANFROST_JD_REQ_FS, 0,
+                                                  PANFROST_JD_REQ_FS,
+                                                  traced ? out_sync : 0,
+                                                  out_sync);
+                if (ret)
+                        goto done;
+
+                ret = panfrost_batch_submit_trace_ts(batch, PAN_TRACE_TS_FRAGMENT_END,
+                                                     out_sync, out_sync);
+                if (ret)
+                        goto done;
+        }
+
+        /* Timestamps are written by a chain of their own waiting for the
+         * jobs submitted before, which implicit sync on the batch BOs also
+         * ensures on kbase */
+        if (has_timestamps) {
+                mali_ptr jc = screen->vtbl.emit_timestamps(batch,
+                                                           &batch->timestamps);
+                ret = panfrost_batch_submit_ioctl(batch, jc, 0, out_sync,
                                                   out_sync);
                 if (ret)
                         goto done;
         }
 
 done:
+        if (queue_atoms) {
+                if (!dev->mali.submit_batch(&dev->mali, &atoms) && !ret)
+                        ret = EINVAL;
+
+                kbase_atom_batch_fini(&atoms);
+                batch->kbase_atoms = NULL;
+        }
+
         if (has_tiler)
                 pthread_mutex_unlock(&dev->submit_lock);
 
         return ret;
 }
 
-#define BASE_MEM_MMU_DUMP_HANDLE (1 << 12)
+/* The render target whose primitive count is remembered for the tiler
+ * hierarchy, see panfrost_choose_hierarchy_mask */
 
-static void
-mmu_dump(struct panfrost_device *dev)
+struct panfrost_resource *
+panfrost_batch_tiler_target(struct panfrost_batch *batch)
 {
-        unsigned size = 16 * 1024 * 1024;
+        struct pipe_surface *surf = batch->key.zsbuf;
 
-        fprintf(stderr, "dumping MMU tables\n");
-        sleep(3);
+        if (batch->key.nr_cbufs && batch->key.cbufs[0])
+                surf = batch->key.cbufs[0];
 
-        void *mem = mmap(NULL, size, PROT_READ, MAP_SHARED,
-                         dev->mali.fd, BASE_MEM_MMU_DUMP_HANDLE);
-        if (mem == MAP_FAILED) {
-                perror("mmap(BASE_MEM_MMU_DUMP_HANDLE)");
-                return;;
-        }
+        return surf ? pan_resource(surf->texture) : NULL;
+}
 
-        fprintf(stderr, "writing to file\n");
-        sleep(1);
+/* Drop the descriptors and scratch space of the tiler heaps, for when the
+ * heaps are replaced. They are created again on first use. */
 
-        char template[] = {"/tmp/mmu-dump.XXXXXX"};
-        int fd = mkstemp(template);
-        if (fd == -1) {
-                perror("mkstemp(/tmp/mmu-dump.XXXXXX)");
-                goto unmap;
-        }
+void
+panfrost_release_tiler_heaps(struct panfrost_context *ctx)
+{
+        for (unsigned i = 0; i < ARRAY_SIZE(ctx->tiler_heap_desc); ++i) {
+                if (ctx->tiler_heap_desc[i])
+                        panfrost_bo_unreference(ctx->tiler_heap_desc[i]);
 
-        write(fd, mem, size);
-        close(fd);
+                if (ctx->tiler_scratch[i])
+                        panfrost_bo_unreference(ctx->tiler_scratch[i]);
 
-unmap:
-        munmap(mem, size);
+                ctx->tiler_heap_desc[i] = NULL;
+                ctx->tiler_scratch[i] = NULL;
+        }
+
+        ctx->next_tiler_heap = 0;
 }
 
+/* Replaces the queues of a context after a fault or timeout. This does not
+ * wait for the GPU, the old queue group is terminated by kbase. */
 static void
-reset_context(struct panfrost_context *ctx)
+reset_context(struct panfrost_context *ctx, enum pipe_reset_status status)
 {
         struct pipe_screen *pscreen = ctx->base.screen;
         struct panfrost_screen *screen = pan_screen(pscreen);
@@ -928,13 +1479,18 @@ reset_context(struct panfrost_context *ctx)
         dev->mali.cs_term(&dev->mali, &ctx->kbase_cs_vertex.base);
         dev->mali.cs_term(&dev->mali, &ctx->kbase_cs_fragment.base);
 
-        dev->mali.context_recreate(&dev->mali, ctx->kbase_ctx);
-
-        //mmu_dump(dev);
+        if (!dev->mali.context_recreate(&dev->mali, ctx->kbase_ctx)) {
+                mesa_loge("Failed to recreate context, it is now lost");
+                recover = false;
+        }
 
         if (recover) {
                 dev->mali.cs_rebind(&dev->mali, &ctx->kbase_cs_vertex.base);
                 dev->mali.cs_rebind(&dev->mali, &ctx->kbase_cs_fragment.base);
+
+                /* Rebinding might have given us different event slots */
+                panfrost_cs_update_event_ptrs(dev, &ctx->kbase_cs_vertex);
+                panfrost_cs_update_event_ptrs(dev, &ctx->kbase_cs_fragment);
         } else {
                 ctx->kbase_cs_vertex.base.user_io = NULL;
                 ctx->kbase_cs_fragment.base.user_io = NULL;
@@ -943,11 +1499,21 @@ reset_context(struct panfrost_context *ctx)
         ctx->kbase_cs_vertex.base.last_insert = 0;
         ctx->kbase_cs_fragment.base.last_insert = 0;
 
+        /* Old seqnums do not apply to the new event slots */
+        ctx->kbase_cs_vertex.submitted_seqnum = 0;
+        ctx->kbase_cs_fragment.submitted_seqnum = 0;
+
         screen->vtbl.init_cs(ctx, &ctx->kbase_cs_vertex);
         screen->vtbl.init_cs(ctx, &ctx->kbase_cs_fragment);
 
-        /* TODO: this leaks memory */
-        ctx->tiler_heap_desc = 0;
+        /* The descriptors point at the old tiler heaps */
+        panfrost_release_tiler_heaps(ctx);
+
+        if (ctx->reset_status == PIPE_NO_RESET)
+                ctx->reset_status = status;
+
+        if (ctx->reset_callback.reset)
+                ctx->reset_callback.reset(ctx->reset_callback.data, status);
 }
 
 static void
@@ -965,51 +1531,201 @@ pandecode_cs_ring(struct panfrost_device *dev, struct panfrost_cs *cs,
         pandecode_cs(cs->base.va + start, insert - start, dev->gpu_id);
 }
 
-static unsigned
-panfrost_add_dep_after(struct util_dynarray *deps,
-                       struct panfrost_usage u,
-                       unsigned index)
+static void
+pan_capture_cs_ring(struct panfrost_device *dev, struct panfrost_cs *cs,
+                    uint64_t insert)
 {
-        unsigned size = util_dynarray_num_elements(deps, struct panfrost_usage);
-
-        for (unsigned i = index; i < size; ++i) {
-                struct panfrost_usage *d =
-                        util_dynarray_element(deps, struct panfrost_usage, i);
-
-                /* TODO: Remove d if it is an invalid entry? */
-
-                if ((d->queue == u.queue) && (d->write == u.write)) {
-                        d->seqnum = MAX2(d->seqnum, u.seqnum);
-                        return i;
+        insert %= cs->base.size;
+        uint64_t start = cs->base.last_insert % cs->base.size;
 
-                } else if (d->queue > u.queue) {
-                        void *p = util_dynarray_grow(deps, struct panfrost_usage, 1);
-                        assert(p);
-                        memmove(util_dynarray_element(deps, struct panfrost_usage, i + 1),
-                                util_dynarray_element(deps, struct panfrost_usage, i),
-                                (size - i) * sizeof(struct panfrost_usage));
+        pan_capture_bo(dev, cs->bo);
 
-                        *util_dynarray_element(deps, struct panfrost_usage, i) = u;
-                        return i;
-                }
+        if (insert < start) {
+                pan_capture_cs(dev, cs->base.va + start, cs->base.size - start,
+                               cs->base.event_mem_offset);
+                start = 0;
         }
 
-        util_dynarray_append(deps, struct panfrost_usage, u);
-        return size;
+        if (insert != start)
+                pan_capture_cs(dev, cs->base.va + start, insert - start,
+                               cs->base.event_mem_offset);
 }
 
+typedef void (*panfrost_bo_callback)(void *data, struct panfrost_bo *bo);
+
 static void
-panfrost_update_deps(struct util_dynarray *deps, struct panfrost_bo *bo, bool write)
+panfrost_foreach_pool_bo(struct panfrost_pool *pool, panfrost_bo_callback cb,
+                         void *data)
 {
-        /* Both lists should be sorted, so each dependency is at a higher
-         * index than the last */
-        unsigned index = 0;
+        util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo)
+                cb(data, *bo);
+}
+
+/* Calls cb on every BO the command streams of a batch may reference, other
+ * than the rings themselves */
+static void
+panfrost_batch_foreach_csf_bo(struct panfrost_batch *batch,
+                              panfrost_bo_callback cb, void *data)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        for (unsigned i = 0; i < PAN_USAGE_COUNT; ++i) {
+                util_dynarray_foreach(&batch->resource_bos[i], struct panfrost_bo *, bo)
+                        cb(data, *bo);
+        }
+
+        panfrost_foreach_pool_bo(&batch->pool, cb, data);
+        panfrost_foreach_pool_bo(&batch->invisible_pool, cb, data);
+
+        if (batch->tiler_ctx.bifrost && ctx->tiler_heap_desc[batch->tiler_heap])
+                cb(data, ctx->tiler_heap_desc[batch->tiler_heap]);
+
+        cb(data, dev->sample_positions);
+}
+
+static void
+pan_capture_bo_cb(void *data, struct panfrost_bo *bo)
+{
+        pan_capture_bo(data, bo);
+}
+
+/* Records everything the command streams of a batch may reference, then the
+ * new parts of the rings */
+static void
+panfrost_batch_capture_csf(struct panfrost_batch *batch,
+                           uint64_t vs_offset, uint64_t fs_offset)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        /* The tiler heap addresses are needed to replay the BOs */
+        pan_capture_csf_state(dev, ctx->kbase_ctx);
+
+        panfrost_batch_foreach_csf_bo(batch, pan_capture_bo_cb, dev);
+
+        pan_capture_cs_ring(dev, &ctx->kbase_cs_vertex, vs_offset);
+        pan_capture_cs_ring(dev, &ctx->kbase_cs_fragment, fs_offset);
+}
+
+static void
+pan_dump_cs_ring(struct pan_dump *dump, struct panfrost_cs *cs,
+                 uint64_t start, uint64_t insert)
+{
+        insert %= cs->base.size;
+        start %= cs->base.size;
+
+        pan_dump_bo(dump, cs->bo);
+
+        if (insert < start) {
+                pan_dump_cs(dump, cs->base.va + start, cs->base.size - start,
+                            cs->base.event_mem_offset);
+                start = 0;
+        }
+
+        if (insert != start)
+                pan_dump_cs(dump, cs->base.va + start, insert - start,
+                            cs->base.event_mem_offset);
+}
+
+static void
+pan_dump_bo_cb(void *data, struct panfrost_bo *bo)
+{
+        pan_dump_bo(data, bo);
+}
+
+/* Writes the BOs and command streams of a batch which was found to have
+ * faulted, for pancapture or panfrostdump. Other BOs in the GPU address
+ * space are left out, so the dump is far smaller than a full MMU dump.
+ * Without PAN_MESA_DEBUG=sync the fault may have been caused by an earlier
+ * batch, but the batch being submitted is the best guess available. */
+static void
+panfrost_batch_dump_fault(struct panfrost_batch *batch,
+                          uint64_t vs_start, uint64_t vs_offset,
+                          uint64_t fs_start, uint64_t fs_offset)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        char path[] = "/tmp/pan-fault.XXXXXX";
+        int fd = mkstemp(path);
+
+        if (fd == -1) {
+                perror("mkstemp(/tmp/pan-fault.XXXXXX)");
+                return;
+        }
+
+        close(fd);
+
+        struct pan_dump *dump = pan_dump_open(dev, path);
+
+        if (!dump)
+                return;
+
+        panfrost_batch_foreach_csf_bo(batch, pan_dump_bo_cb, dump);
+
+        pan_dump_cs_ring(dump, &ctx->kbase_cs_vertex, vs_start, vs_offset);
+        pan_dump_cs_ring(dump, &ctx->kbase_cs_fragment, fs_start, fs_offset);
+
+        pan_dump_close(dump);
+
+        mesa_loge("Dumped the faulting batch to %s", path);
+}
+
+static void
+panfrost_dep_table_add(struct panfrost_context *ctx,
+                       struct panfrost_dep_table *t,
+                       unsigned queue, uint64_t seqnum)
+{
+        if (queue >= t->size) {
+                unsigned size = MAX2(util_next_power_of_two(queue + 1), 64);
+
+                t->seqnums = reralloc(ctx, t->seqnums, uint64_t, size);
+                memset(t->seqnums + t->size, 0, (size - t->size) * sizeof(uint64_t));
+                t->size = size;
+        }
+
+        t->seqnums[queue] = MAX2(t->seqnums[queue], seqnum + 1);
+        t->used = MAX2(t->used, queue + 1);
+}
+
+/* Moves the entries of the table to deps, sorted by queue, and clears it */
+static void
+panfrost_dep_table_collect(struct panfrost_dep_table *t,
+                           struct util_dynarray *deps)
+{
+        for (unsigned queue = 0; queue < t->used; ++queue) {
+                if (!t->seqnums[queue])
+                        continue;
+
+                struct panfrost_usage u = {
+                        .queue = queue,
+                        .write = true,
+                        .seqnum = t->seqnums[queue] - 1,
+                };
+
+                util_dynarray_append(deps, struct panfrost_usage, u);
+                t->seqnums[queue] = 0;
+        }
+
+        t->used = 0;
+}
+
+static void
+panfrost_update_deps(struct panfrost_context *ctx,
+                     struct panfrost_dep_table *deps,
+                     struct panfrost_bo *bo, bool write)
+{
+        /* Dropping finished usages here keeps the cost of this loop bounded
+         * by the number of queues still using the BO */
+        panfrost_bo_usage_compact(bo);
+
         util_dynarray_foreach(&bo->usage, struct panfrost_usage, u) {
                 /* read->read access does not require a dependency */
                 if (!write && !u->write)
                         continue;
 
-                index = panfrost_add_dep_after(deps, *u, index);
+                panfrost_dep_table_add(ctx, deps, u->queue, u->seqnum);
         }
 }
 
@@ -1025,7 +1741,9 @@ panfrost_usage_fragment(enum panfrost_usage_type usage)
         return (usage == PAN_USAGE_READ_FRAGMENT) || (usage == PAN_USAGE_WRITE_FRAGMENT);
 }
 
-/* Removes invalid dependencies from deps */
+/* Removes invalid dependencies from deps, including those on queues which have
+ * since been destroyed. The event slot fields are read atomically, so this
+ * does not need to take the queue lock. */
 static void
 panfrost_clean_deps(struct panfrost_device *dev, struct util_dynarray *deps)
 {
@@ -1033,21 +1751,26 @@ panfrost_clean_deps(struct panfrost_device *dev, struct util_dynarray *deps)
 
         struct panfrost_usage *rebuild = util_dynarray_begin(deps);
         unsigned index = 0;
+        unsigned slot_count = p_atomic_read(&k->event_slot_usage);
 
         util_dynarray_foreach(deps, struct panfrost_usage, u) {
                 /* Usages are ordered, so we can break here */
-                if (u->queue >= k->event_slot_usage)
+                if (u->queue >= slot_count)
                         break;
 
-                struct kbase_event_slot *slot = &k->event_slots[u->queue];
+                if (!kbase_event_slot_live(k, u->queue))
+                        continue;
+
+                struct kbase_event_slot *slot = kbase_event_slot_get(k, u->queue);
+                uint64_t last_submit = p_atomic_read(&slot->last_submit);
                 uint64_t seqnum = u->seqnum;
 
                 /* There is a race condition, where we can depend on an
                  * unsubmitted batch. In that cade, decrease the seqnum.
                  * Otherwise, skip invalid dependencies. */
-                if (slot->last_submit == seqnum)
+                if (last_submit == seqnum)
                         --seqnum;
-                else if (slot->last_submit < seqnum)
+                else if (last_submit < seqnum)
                         continue;
 
                 /* This usage is valid, add it to the returned list */
@@ -1062,6 +1785,150 @@ panfrost_clean_deps(struct panfrost_device *dev, struct util_dynarray *deps)
         (void)! util_dynarray_resize(deps, struct panfrost_usage, index);
 }
 
+/* Reduces deps, as returned by panfrost_clean_deps, to the waits the queue
+ * actually needs to do. Work on the queue itself is already ordered, only
+ * the highest seqnum for each other queue matters, and waits which event
+ * memory shows have already passed are dropped. */
+static void
+panfrost_minimise_deps(struct panfrost_device *dev, struct util_dynarray *deps,
+                       unsigned own_queue)
+{
+        kbase k = &dev->mali;
+
+        struct panfrost_usage *rebuild = util_dynarray_begin(deps);
+        unsigned index = 0;
+
+        util_dynarray_foreach(deps, struct panfrost_usage, u) {
+                if (u->queue == own_queue)
+                        continue;
+
+                /* The queue waits for the event to be higher than seqnum */
+                if (kbase_event_value(k, u->queue) > u->seqnum)
+                        continue;
+
+                /* Deps are sorted by queue, so merging with the previous
+                 * entry is enough */
+                if (index && rebuild[index - 1].queue == u->queue) {
+                        struct panfrost_usage *prev = &rebuild[index - 1];
+
+                        prev->seqnum = MAX2(prev->seqnum, u->seqnum);
+                        prev->write |= u->write;
+                        continue;
+                }
+
+                rebuild[index++] = *u;
+        }
+
+        (void)! util_dynarray_resize(deps, struct panfrost_usage, index);
+}
+
+static void
+panfrost_batch_track_pool_csf(struct panfrost_batch *batch,
+                              struct panfrost_pool *pool)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        struct panfrost_usage usages[2];
+        unsigned nr_usages = 0;
+
+        if (pool->vertex_access) {
+                usages[nr_usages++] = (struct panfrost_usage) {
+                        .queue = ctx->kbase_cs_vertex.base.event_mem_offset,
+                        .write = pool->vertex_access & PAN_BO_ACCESS_WRITE,
+                        .seqnum = ctx->kbase_cs_vertex.seqnum,
+                };
+        }
+
+        /* Without a fragment job the fragment queue never sees the pool */
+        if (pool->fragment_access && panfrost_has_fragment_job(batch)) {
+                usages[nr_usages++] = (struct panfrost_usage) {
+                        .queue = ctx->kbase_cs_fragment.base.event_mem_offset,
+                        .write = pool->fragment_access & PAN_BO_ACCESS_WRITE,
+                        .seqnum = ctx->kbase_cs_fragment.seqnum,
+                };
+        }
+
+        pan_bo_access access = 0;
+        if (nr_usages)
+                access = pool->vertex_access | pool->fragment_access;
+
+        util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo) {
+                pthread_mutex_t *lock = pan_bo_usage_lock(dev, (*bo)->gem_handle);
+                pthread_mutex_lock(lock);
+
+                for (unsigned i = 0; i < nr_usages; ++i)
+                        panfrost_add_dep_after(&(*bo)->usage, usages[i], 0);
+                (*bo)->gpu_access |= access;
+
+                pthread_mutex_unlock(lock);
+        }
+}
+
+/* Tiler heaps start small, and the kernel grows them on demand up to their
+ * chunk limit, which batches are split to stay under.
+ * Every so often, count the chunks of the heap a batch used, and if the
+ * heap is close to the limit, recreate the heaps with a higher one and with
+ * the observed number of chunks allocated up front. */
+#define PAN_TILER_HEAP_SAMPLE_INTERVAL 128
+#define PAN_TILER_HEAP_MAX_CHUNKS 2000
+
+static void
+panfrost_batch_adapt_tiler_heap(struct panfrost_batch *batch,
+                                uint64_t vs_offset, uint64_t fs_offset)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct kbase_context *kctx = ctx->kbase_ctx;
+        unsigned heap = batch->tiler_heap;
+
+        if (!screen->tiler_heap_adaptive || !batch->tiler_ctx.bifrost)
+                return;
+
+        if (++ctx->tiler_heap_batches[heap] % PAN_TILER_HEAP_SAMPLE_INTERVAL)
+                return;
+
+        struct kbase_tiler_heap_config cfg = kctx->tiler_heap_config;
+
+        if (cfg.max_chunks >= PAN_TILER_HEAP_MAX_CHUNKS)
+                return;
+
+        unsigned chunks = dev->mali.tiler_heap_chunks(&dev->mali, kctx, heap);
+
+        if (!chunks || (chunks * 4) < (cfg.max_chunks * 3))
+                return;
+
+        /* Batches being recorded may already point at a heap */
+        unsigned i;
+        foreach_batch(ctx, i) {
+                struct panfrost_batch *other = &ctx->batches.slots[i];
+
+                if (other != batch && other->tiler_ctx.bifrost)
+                        return;
+        }
+
+        /* The heaps must be idle to be replaced */
+        if (!dev->mali.cs_wait(&dev->mali, &ctx->kbase_cs_vertex.base, vs_offset,
+                               ctx->syncobj_kbase, 1000000000) ||
+            !dev->mali.cs_wait(&dev->mali, &ctx->kbase_cs_fragment.base, fs_offset,
+                               ctx->syncobj_kbase, 1000000000))
+                return;
+
+        cfg.max_chunks = MIN2(cfg.max_chunks * 2, PAN_TILER_HEAP_MAX_CHUNKS);
+        cfg.initial_chunks = MIN2(chunks, cfg.max_chunks);
+
+        perf_debug_ctx(ctx, "Growing tiler heaps to %u chunks", cfg.max_chunks);
+
+        for (unsigned h = 0; h < kctx->num_tiler_heaps; ++h) {
+                if (!dev->mali.tiler_heap_resize(&dev->mali, kctx, h, &cfg))
+                        break;
+        }
+
+        /* The descriptors point at the old heaps */
+        panfrost_release_tiler_heaps(ctx);
+}
+
 static int
 panfrost_batch_submit_csf(struct panfrost_batch *batch,
                           const struct pan_fb_info *fb)
@@ -1071,34 +1938,46 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
         struct panfrost_screen *screen = pan_screen(pscreen);
         struct panfrost_device *dev = pan_device(pscreen);
 
+        bool has_timestamps = batch->timestamps.size;
+
         ++ctx->kbase_cs_vertex.seqnum;
 
-        if (panfrost_has_fragment_job(batch)) {
+        if (panfrost_has_fragment_job(batch))
                 screen->vtbl.emit_fragment_job(batch, fb);
+
+        /* Timestamps are written from the fragment queue, after the fragment
+         * job if there is one */
+        if (has_timestamps)
+                screen->vtbl.emit_timestamps(batch, &batch->timestamps);
+
+        if (panfrost_has_fragment_job(batch) || has_timestamps)
                 ++ctx->kbase_cs_fragment.seqnum;
-        }
 
-        pthread_mutex_lock(&dev->bo_usage_lock);
+        uint64_t phase_start = panfrost_submit_phase_begin(ctx);
+
         for (unsigned i = 0; i < PAN_USAGE_COUNT; ++i) {
 
                 bool write = panfrost_usage_writes(i);
                 pan_bo_access access = write ? PAN_BO_ACCESS_RW : PAN_BO_ACCESS_READ;
-                struct util_dynarray *deps;
+                struct panfrost_dep_table *deps;
                 unsigned queue;
                 uint64_t seqnum;
 
                 if (panfrost_usage_fragment(i)) {
-                        deps = &batch->frag_deps;
+                        deps = &ctx->frag_dep_table;
                         queue = ctx->kbase_cs_fragment.base.event_mem_offset;
                         seqnum = ctx->kbase_cs_fragment.seqnum;
                 } else {
-                        deps = &batch->vert_deps;
+                        deps = &ctx->vert_dep_table;
                         queue = ctx->kbase_cs_vertex.base.event_mem_offset;
                         seqnum = ctx->kbase_cs_vertex.seqnum;
                 }
 
                 util_dynarray_foreach(&batch->resource_bos[i], struct panfrost_bo *, bo) {
-                        panfrost_update_deps(deps, *bo, write);
+                        pthread_mutex_t *lock = pan_bo_usage_lock(dev, (*bo)->gem_handle);
+                        pthread_mutex_lock(lock);
+
+                        panfrost_update_deps(ctx, deps, *bo, write);
                         struct panfrost_usage u = {
                                 .queue = queue,
                                 .write = write,
@@ -1107,31 +1986,87 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
 
                         panfrost_add_dep_after(&(*bo)->usage, u, 0);
                         (*bo)->gpu_access |= access;
+
+                        pthread_mutex_unlock(lock);
                 }
         }
-        pthread_mutex_unlock(&dev->bo_usage_lock);
 
-        /* For now, only a single batch can use each tiler heap at once */
-        if (ctx->tiler_heap_desc) {
-                panfrost_update_deps(&batch->vert_deps, ctx->tiler_heap_desc, true);
+        /* Pool BOs are private to the batch, so they add no dependencies, but
+         * record the queues using them so that recycled BOs are only handed
+         * out again once those queues are done with them. */
+        panfrost_batch_track_pool_csf(batch, &batch->pool);
+        panfrost_batch_track_pool_csf(batch, &batch->invisible_pool);
+
+        /* Only a single batch can use each tiler heap at once, so binning
+         * waits for the fragment pass of the last batch using the same heap.
+         * With heaps taken in turn, that is not the previous batch, so its
+         * fragment pass can overlap with our vertex pass. */
+        struct panfrost_bo *heap_desc = batch->tiler_ctx.bifrost ?
+                ctx->tiler_heap_desc[batch->tiler_heap] : NULL;
+
+        if (heap_desc) {
+                pthread_mutex_t *lock =
+                        pan_bo_usage_lock(dev, heap_desc->gem_handle);
+                pthread_mutex_lock(lock);
+
+                panfrost_update_deps(ctx, &ctx->vert_dep_table,
+                                     heap_desc, true);
 
                 struct panfrost_usage u = {
                         .queue = ctx->kbase_cs_fragment.base.event_mem_offset,
                         .write = true,
                         .seqnum = ctx->kbase_cs_fragment.seqnum,
                 };
-                panfrost_add_dep_after(&ctx->tiler_heap_desc->usage, u, 0);
+                panfrost_add_dep_after(&heap_desc->usage, u, 0);
+
+                pthread_mutex_unlock(lock);
         }
 
-        /* TODO: Use atomics in kbase code to avoid lock? */
-        pthread_mutex_lock(&dev->mali.queue_lock);
+        /* The fragment queue only waits for the vertex work of its own
+         * batch, timestamps also come after the vertex work of earlier
+         * batches without fragment jobs */
+        if (has_timestamps && ctx->kbase_cs_vertex.submitted_seqnum) {
+                panfrost_dep_table_add(ctx, &ctx->frag_dep_table,
+                                       ctx->kbase_cs_vertex.base.event_mem_offset,
+                                       ctx->kbase_cs_vertex.submitted_seqnum);
+        }
+
+        panfrost_submit_phase_end(ctx, PAN_SUBMIT_PHASE_DEPS, &phase_start);
+
+        panfrost_dep_table_collect(&ctx->vert_dep_table, &batch->vert_deps);
+        panfrost_dep_table_collect(&ctx->frag_dep_table, &batch->frag_deps);
 
         panfrost_clean_deps(dev, &batch->vert_deps);
         panfrost_clean_deps(dev, &batch->frag_deps);
 
-        pthread_mutex_unlock(&dev->mali.queue_lock);
+        panfrost_minimise_deps(dev, &batch->vert_deps,
+                               ctx->kbase_cs_vertex.base.event_mem_offset);
+        panfrost_minimise_deps(dev, &batch->frag_deps,
+                               ctx->kbase_cs_fragment.base.event_mem_offset);
 
-        screen->vtbl.emit_csf_toplevel(batch);
+        panfrost_submit_phase_end(ctx, PAN_SUBMIT_PHASE_CLEAN_DEPS, &phase_start);
+
+        ctx->submit_kcpu_ns = 0;
+
+        /* The GPU is stuck if it didn't free up ring space. Nothing of the
+         * batch was submitted, but the seqnums it was given will never be
+         * reached, so recreate the queues. */
+        if (!screen->vtbl.emit_csf_toplevel(batch)) {
+                reset_context(ctx, PIPE_UNKNOWN_CONTEXT_RESET);
+                return -1;
+        }
+
+        if (phase_start) {
+                uint64_t kcpu_ns = ctx->submit_kcpu_ns;
+                uint64_t emit_ns = os_time_get_nano() - phase_start;
+
+                panfrost_submit_phase_record(ctx, PAN_SUBMIT_PHASE_EMIT,
+                                             emit_ns - MIN2(kcpu_ns, emit_ns));
+
+                if (kcpu_ns)
+                        panfrost_submit_phase_record(ctx, PAN_SUBMIT_PHASE_KCPU,
+                                                     kcpu_ns);
+        }
 
         uint64_t vs_offset = ctx->kbase_cs_vertex.offset +
                 (void *)ctx->kbase_cs_vertex.cs.ptr - ctx->kbase_cs_vertex.bo->ptr.cpu;
@@ -1143,37 +2078,58 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
                 pandecode_cs_ring(dev, &ctx->kbase_cs_fragment, fs_offset);
         }
 
-        bool log = (dev->debug & PAN_DBG_LOG);
+        if (dev->capture)
+                panfrost_batch_capture_csf(batch, vs_offset, fs_offset);
 
-        // TODO: We need better synchronisation than a single fake syncobj!
+        bool log = (dev->debug & PAN_DBG_LOG);
 
         if (log)
                 printf("About to submit\n");
 
+        /* cs_submit moves the insert points on */
+        uint64_t vs_start = ctx->kbase_cs_vertex.base.last_insert;
+        uint64_t fs_start = ctx->kbase_cs_fragment.base.last_insert;
+
+        /* Remember which seqnums this batch signals, for fences created
+         * after it. cs_submit does nothing if no work was added. */
+        if (vs_offset != ctx->kbase_cs_vertex.base.last_insert)
+                ctx->kbase_cs_vertex.submitted_seqnum = ctx->kbase_cs_vertex.seqnum;
+        if (fs_offset != ctx->kbase_cs_fragment.base.last_insert)
+                ctx->kbase_cs_fragment.submitted_seqnum = ctx->kbase_cs_fragment.seqnum;
+
+        phase_start = panfrost_submit_phase_begin(ctx);
+
         dev->mali.cs_submit(&dev->mali, &ctx->kbase_cs_vertex.base, vs_offset,
                             ctx->syncobj_kbase, ctx->kbase_cs_vertex.seqnum);
 
         dev->mali.cs_submit(&dev->mali, &ctx->kbase_cs_fragment.base, fs_offset,
                             ctx->syncobj_kbase, ctx->kbase_cs_fragment.seqnum);
 
-        bool reset = false;
+        panfrost_submit_phase_end(ctx, PAN_SUBMIT_PHASE_SUBMIT, &phase_start);
+
+        enum pipe_reset_status reset = PIPE_NO_RESET;
 
-        // TODO: How will we know to reset a CS when waiting is not done?
         if (batch->needs_sync) {
-                if (!dev->mali.cs_wait(&dev->mali, &ctx->kbase_cs_vertex.base, vs_offset, ctx->syncobj_kbase))
-                        reset = true;
+                if (!dev->mali.cs_wait(&dev->mali, &ctx->kbase_cs_vertex.base, vs_offset, ctx->syncobj_kbase, 1000000000))
+                        reset = PIPE_UNKNOWN_CONTEXT_RESET;
 
-                if (!dev->mali.cs_wait(&dev->mali, &ctx->kbase_cs_fragment.base, fs_offset, ctx->syncobj_kbase))
-                        reset = true;
+                if (!dev->mali.cs_wait(&dev->mali, &ctx->kbase_cs_fragment.base, fs_offset, ctx->syncobj_kbase, 1000000000))
+                        reset = PIPE_UNKNOWN_CONTEXT_RESET;
         }
 
+        /* Errors are picked up whenever events are handled, such as when
+         * cleaning up the previous batch. The queues stop after a fault,
+         * so recreate them rather than letting later batches hang. */
+        if (dev->mali.context_faulted(&dev->mali, ctx->kbase_ctx))
+                reset = PIPE_GUILTY_CONTEXT_RESET;
+
         if (dev->debug & PAN_DBG_TILER) {
                 fflush(stdout);
                 FILE *stream = popen("tiler-hex-read", "w");
 
                 /* TODO: Dump more than just the first chunk */
-                unsigned size = batch->ctx->kbase_ctx->tiler_heap_chunk_size;
-                uint64_t va = batch->ctx->kbase_ctx->tiler_heap_header;
+                unsigned size = batch->ctx->kbase_ctx->tiler_heap_config.chunk_size;
+                uint64_t va = batch->ctx->kbase_ctx->tiler_heap_header[batch->tiler_heap];
 
                 fprintf(stream, "width %i\n" "height %i\n" "mask %i\n"
                         "vaheap 0x%"PRIx64"\n" "size %i\n",
@@ -1189,8 +2145,14 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
                 pclose(stream);
         }
 
-        if (reset)
-                reset_context(ctx);
+        if (reset != PIPE_NO_RESET && (dev->debug & PAN_DBG_FAULT_DUMP))
+                panfrost_batch_dump_fault(batch, vs_start, vs_offset,
+                                          fs_start, fs_offset);
+
+        if (reset != PIPE_NO_RESET)
+                reset_context(ctx, reset);
+        else
+                panfrost_batch_adapt_tiler_heap(batch, vs_offset, fs_offset);
 
         return 0;
 }
@@ -1214,6 +2176,48 @@ panfrost_emit_tile_map(struct panfrost_batch *batch, struct pan_fb_info *fb)
         }
 }
 
+/* Record the tracepoints around the work of the batch, if it's traced. The
+ * timestamps are written by the chains or command stream segments submitted
+ * next, and read back when u_trace processes the trace flushed on cleanup. */
+
+static void
+panfrost_batch_trace(struct panfrost_batch *batch)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        const char *reason = batch->reason ? batch->reason : "Unknown";
+
+        /* The timestamps can't be converted to nanoseconds */
+        if (!dev->timestamp_frequency || !u_trace_enabled(&ctx->trace_context))
+                return;
+
+#ifdef HAVE_PERFETTO
+        if (u_trace_perfetto_active(&ctx->trace_context)) {
+                pan_perfetto_submit(panfrost_timestamp_to_ns(dev,
+                                        panfrost_query_timestamp()));
+        }
+#endif
+
+        if (batch->scoreboard.first_job) {
+                trace_start_vertex_tiler(&batch->trace,
+                                         &batch->trace_ts[PAN_TRACE_TS_VERTEX_START],
+                                         batch->seqnum, reason);
+                trace_end_vertex_tiler(&batch->trace,
+                                       &batch->trace_ts[PAN_TRACE_TS_VERTEX_END]);
+        }
+
+        if (panfrost_has_fragment_job(batch)) {
+                trace_start_fragment(&batch->trace,
+                                     &batch->trace_ts[PAN_TRACE_TS_FRAGMENT_START],
+                                     batch->seqnum, reason,
+                                     batch->key.width, batch->key.height,
+                                     batch->key.nr_cbufs,
+                                     util_framebuffer_get_num_samples(&batch->key));
+                trace_end_fragment(&batch->trace,
+                                   &batch->trace_ts[PAN_TRACE_TS_FRAGMENT_END]);
+        }
+}
+
 static void
 panfrost_batch_submit(struct panfrost_context *ctx,
                       struct panfrost_batch *batch)
@@ -1223,10 +2227,32 @@ panfrost_batch_submit(struct panfrost_context *ctx,
         struct panfrost_device *dev = pan_device(pscreen);
         int ret;
 
+        /* Submit the batches this one has to execute after first */
+        unsigned i;
+        BITSET_FOREACH_SET(i, batch->deps, PAN_MAX_BATCHES) {
+                if (BITSET_TEST(ctx->batches.active, i)) {
+                        struct panfrost_batch *dep = &ctx->batches.slots[i];
+
+                        if (!dep->reason) {
+                                dep->reason = "Dependency";
+                                dep->flush_class = PAN_FLUSH_DEPENDENCY;
+                        }
+
+                        panfrost_batch_submit(ctx, dep);
+                }
+        }
+
+        /* Take over the jobs of the draws that matched a record */
+        if (batch->replay.speculating)
+                screen->vtbl.replay_splice(batch);
+
         /* Nothing to do! */
-        if (!batch->scoreboard.first_job && !batch->clear)
+        if (!batch->scoreboard.first_job && !batch->clear &&
+            !batch->timestamps.size)
                 goto out;
 
+        ++ctx->batches_submitted[batch->flush_class];
+
         if (batch->key.zsbuf && panfrost_has_fragment_job(batch)) {
                 struct pipe_surface *surf = batch->key.zsbuf;
                 struct panfrost_resource *z_rsrc = pan_resource(surf->texture);
@@ -1247,11 +2273,38 @@ panfrost_batch_submit(struct panfrost_context *ctx,
                         z_rsrc->constant_stencil = false;
         }
 
+        struct panfrost_resource *tiler_target = panfrost_batch_tiler_target(batch);
+
+        if (tiler_target && batch->scoreboard.first_tiler)
+                tiler_target->tiler_primitives = batch->tiler_primitives;
+
+        /* With EGL_KHR_partial_update, the content outside of the damage
+         * region is preserved from the previous frame. Restricting the
+         * frame to the damage extent means tiles outside of it are neither
+         * preloaded nor written back. */
+        struct pipe_surface *cbuf0 = batch->key.nr_cbufs ?
+                                     batch->key.cbufs[0] : NULL;
+
+        if (cbuf0) {
+                const struct pipe_scissor_state *damage =
+                        &pan_resource(cbuf0->texture)->damage.extent;
+
+                panfrost_batch_intersection_scissor(batch,
+                                                    damage->minx, damage->miny,
+                                                    damage->maxx, damage->maxy);
+        }
+
         struct pan_fb_info fb;
         struct pan_image_view rts[8], zs, s;
 
         panfrost_batch_to_fb_info(batch, &fb, rts, &zs, &s, false);
 
+        bool crc_valid[8] = { false };
+        for (unsigned i = 0; i < fb.rt_count; ++i) {
+                if (fb.rts[i].view)
+                        crc_valid[i] = *(fb.rts[i].crc_valid);
+        }
+
         screen->vtbl.preload(batch, &fb);
         screen->vtbl.init_polygon_list(batch);
 
@@ -1261,8 +2314,12 @@ panfrost_batch_submit(struct panfrost_context *ctx,
         screen->vtbl.emit_tls(batch);
         panfrost_emit_tile_map(batch, &fb);
 
-        if (batch->scoreboard.first_tiler || batch->clear)
+        if (batch->scoreboard.first_tiler || batch->clear) {
                 screen->vtbl.emit_fbd(batch, &fb);
+                ctx->crc_tiles += panfrost_batch_crc_tiles(&fb, crc_valid);
+        }
+
+        panfrost_batch_trace(batch);
 
         /* TODO: Don't hardcode the arch number */
         if (dev->arch < 10)
@@ -1273,6 +2330,9 @@ panfrost_batch_submit(struct panfrost_context *ctx,
         if (ret)
                 fprintf(stderr, "panfrost_batch_submit failed: %d\n", ret);
 
+        if (!ret && (dev->debug & PAN_DBG_REPLAY) && screen->vtbl.replay_splice)
+                panfrost_replay_record(batch);
+
         /* We must reset the damage info of our render targets here even
          * though a damage reset normally happens when the DRI layer swaps
          * buffers. That's because there can be implicit flushes the GL
@@ -1300,7 +2360,13 @@ out:
 void
 panfrost_flush_all_batches(struct panfrost_context *ctx, const char *reason)
 {
+        /* Flushes without a reason are explicit flushes, from the frontend */
+        enum panfrost_flush_class class =
+                reason ? PAN_FLUSH_OTHER : PAN_FLUSH_EXPLICIT;
+
         struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
+        batch->reason = reason ? reason : "Flush";
+        batch->flush_class = class;
         panfrost_batch_submit(ctx, batch);
 
         for (unsigned i = 0; i < PAN_MAX_BATCHES; i++) {
@@ -1308,6 +2374,8 @@ panfrost_flush_all_batches(struct panfrost_context *ctx, const char *reason)
                         if (reason)
                                 perf_debug_ctx(ctx, "Flushing everything due to: %s", reason);
 
+                        ctx->batches.slots[i].reason = reason ? reason : "Flush";
+                        ctx->batches.slots[i].flush_class = class;
                         panfrost_batch_submit(ctx, &ctx->batches.slots[i]);
                 }
         }
@@ -1321,8 +2389,12 @@ panfrost_flush_writer(struct panfrost_context *ctx,
         struct hash_entry *entry = _mesa_hash_table_search(ctx->writers, rsrc);
 
         if (entry) {
+                struct panfrost_batch *batch = entry->data;
+
                 perf_debug_ctx(ctx, "Flushing writer due to: %s", reason);
-                panfrost_batch_submit(ctx, entry->data);
+                batch->reason = reason;
+                batch->flush_class = PAN_FLUSH_RESOURCE;
+                panfrost_batch_submit(ctx, batch);
         }
 }
 
@@ -1339,6 +2411,68 @@ panfrost_flush_batches_accessing_rsrc(struct panfrost_context *ctx,
                         continue;
 
                 perf_debug_ctx(ctx, "Flushing user due to: %s", reason);
+                batch->reason = reason;
+                batch->flush_class = PAN_FLUSH_RESOURCE;
+                panfrost_batch_submit(ctx, batch);
+        }
+}
+
+/* Drops a resource from the attachments written back by every batch drawing
+ * to it, for glInvalidateFramebuffer and friends. Each batch keeps its own
+ * resolve mask, so attachments of framebuffers that are no longer bound are
+ * discarded too. */
+
+void
+panfrost_batch_discard_rsrc(struct panfrost_context *ctx,
+                            struct panfrost_resource *rsrc)
+{
+        unsigned i;
+        foreach_batch(ctx, i) {
+                struct panfrost_batch *batch = &ctx->batches.slots[i];
+                struct pipe_framebuffer_state *key = &batch->key;
+
+                if (key->zsbuf && key->zsbuf->texture == &rsrc->base)
+                        batch->resolve &= ~PIPE_CLEAR_DEPTHSTENCIL;
+
+                for (unsigned c = 0; c < key->nr_cbufs; ++c) {
+                        struct pipe_surface *surf = key->cbufs[c];
+
+                        if (surf && surf->texture == &rsrc->base)
+                                batch->resolve &= ~(PIPE_CLEAR_COLOR0 << c);
+                }
+        }
+}
+
+/* Has the GPU write its system timestamp to a resource once the work queued
+ * so far is done. The timestamp is attached to the end of the current batch,
+ * which is then submitted after the other batches so that later work isn't
+ * counted. */
+
+void
+panfrost_write_timestamp(struct panfrost_context *ctx,
+                         struct panfrost_resource *rsrc,
+                         unsigned offset)
+{
+        struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
+        mali_ptr address = rsrc->image.data.bo->ptr.gpu + offset;
+
+        /* There's no stage for writes after the fragment job, but the
+         * fragment queue writes the timestamps on CSF */
+        panfrost_batch_write_rsrc(batch, rsrc, PIPE_SHADER_FRAGMENT);
+        util_dynarray_append(&batch->timestamps, mali_ptr, address);
+
+        for (unsigned i = 0; i < PAN_MAX_BATCHES; i++) {
+                struct panfrost_batch *other = &ctx->batches.slots[i];
+
+                if (other != batch && other->seqnum) {
+                        other->reason = "Timestamp";
+                        panfrost_batch_submit(ctx, other);
+                }
+        }
+
+        /* Submitted already if one of the others depended on it */
+        if (batch->seqnum) {
+                batch->reason = "Timestamp";
                 panfrost_batch_submit(ctx, batch);
         }
 }
@@ -1413,6 +2547,29 @@ panfrost_batch_union_scissor(struct panfrost_batch *batch,
         batch->maxy = MAX2(batch->maxy, maxy);
 }
 
+/* Restrict the job to the intersection of its bounding rectangle and a new
+ * one. An empty intersection leaves the job untouched, as there must be at
+ * least one pixel to render */
+
+void
+panfrost_batch_intersection_scissor(struct panfrost_batch *batch,
+                                    unsigned minx, unsigned miny,
+                                    unsigned maxx, unsigned maxy)
+{
+        unsigned new_minx = MAX2(batch->minx, minx);
+        unsigned new_miny = MAX2(batch->miny, miny);
+        unsigned new_maxx = MIN2(batch->maxx, maxx);
+        unsigned new_maxy = MIN2(batch->maxy, maxy);
+
+        if (new_minx >= new_maxx || new_miny >= new_maxy)
+                return;
+
+        batch->minx = new_minx;
+        batch->miny = new_miny;
+        batch->maxx = new_maxx;
+        batch->maxy = new_maxy;
+}
+
 /**
  * Checks if rasterization should be skipped. If not, a TILER job must be
  * created for each draw, or the IDVS flow must be used.
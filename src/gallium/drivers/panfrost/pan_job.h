@@ -27,12 +27,45 @@
 #define __PAN_JOB_H__
 
 #include "util/u_dynarray.h"
+#include "util/bitset.h"
+#include "util/perf/u_trace.h"
 #include "pipe/p_state.h"
 #include "pan_cs.h"
 #include "pan_mempool.h"
+#include "pan_replay.h"
 #include "pan_resource.h"
 #include "pan_scoreboard.h"
 
+/* Timestamps written around the work of a traced batch */
+enum panfrost_trace_ts {
+        PAN_TRACE_TS_VERTEX_START,
+        PAN_TRACE_TS_VERTEX_END,
+        PAN_TRACE_TS_FRAGMENT_START,
+        PAN_TRACE_TS_FRAGMENT_END,
+        PAN_TRACE_TS_COUNT
+};
+
+/* Classes of the reasons for submitting batches, counted per class for the
+ * driver queries */
+enum panfrost_flush_class {
+        /* Barriers, queries and other internal flushes */
+        PAN_FLUSH_OTHER,
+
+        /* Flushes requested by the frontend, e.g. at the end of frames */
+        PAN_FLUSH_EXPLICIT,
+
+        /* Framebuffer changes, or running out of batch slots */
+        PAN_FLUSH_FBO,
+
+        /* Resources accessed by the CPU or written by another batch */
+        PAN_FLUSH_RESOURCE,
+
+        /* Batches submitted before a batch depending on them */
+        PAN_FLUSH_DEPENDENCY,
+
+        PAN_FLUSH_CLASS_COUNT
+};
+
 /* Simple tri-state data structure. In the default "don't care" state, the value
  * may be set to true or false. However, once the value is set, it must not be
  * changed. Declared inside of a struct to prevent casting to bool, which is an
@@ -97,6 +130,10 @@ struct panfrost_batch {
         /* Sequence number used to implement LRU eviction when all batch slots are used */
         uint64_t seqnum;
 
+        /* Batches that must be submitted before this one, because this batch
+         * accesses resources they access in a conflicting way */
+        BITSET_DECLARE(deps, PAN_MAX_BATCHES);
+
         /* Buffers cleared (PIPE_CLEAR_* bitmask) */
         unsigned clear;
 
@@ -106,6 +143,19 @@ struct panfrost_batch {
         /* Buffers read */
         unsigned read;
 
+        /* Buffers whose previous contents were entirely overwritten by a
+         * draw, so they don't need to be preloaded */
+        unsigned replaced;
+
+        /* Stages that wrote SSBOs or images since the last barrier, as a
+         * mask of pipe_shader_type */
+        unsigned storage_writes;
+
+        /* Whether draws or compute dispatches were recorded, batches hold
+         * either but not both */
+        bool has_graphics;
+        bool has_compute;
+
         /* Buffers needing resolve to memory */
         unsigned resolve;
 
@@ -166,6 +216,19 @@ struct panfrost_batch {
         /* Tiler context */
         struct pan_tiler_context tiler_ctx;
 
+        /* Index of the context tiler heap binned into (CSF). Only valid if
+         * a tiler context was created. */
+        unsigned tiler_heap;
+
+        /* Upper bound of the tiler heap memory used by the draws so far, and
+         * the size of the vertex packets of the last draw (CSF) */
+        uint64_t tiler_heap_estimate;
+        unsigned tiler_vertex_size;
+
+        /* Primitives sent to the tiler, saturating. UINT32_MAX if unknown
+         * due to indirect draws. */
+        uint32_t tiler_primitives;
+
         /* Indirect draw data */
         struct panfrost_ptr indirect_draw_ctx;
         unsigned indirect_draw_job_id;
@@ -209,20 +272,81 @@ struct panfrost_batch {
         struct util_dynarray vert_deps;
         struct util_dynarray frag_deps;
 
-        /* Referenced dma-bufs FDs, for emitting synchronisation commands. */
+        /* BOs of the referenced resources shared through a dma-buf, for
+         * emitting synchronisation commands. */
         struct util_dynarray dmabufs;
 
+        /* The subset of dmabufs accessed by the vertex or tiler stages. If a
+         * dma-buf is only accessed by fragment shading or as a render target,
+         * only the fragment queue needs to wait for it. */
+        struct util_dynarray vert_dmabufs;
+
         /* Command stream pointers for CSF Valhall. Vertex CS tracking is more
          * complicated as there may be multiple buffers. */
         pan_command_stream cs_vertex;
         uint32_t *cs_vertex_last_size;
         pan_command_stream cs_vertex_first;
 
+        /* Registers of the vertex CS as left by the previous draw, and where
+         * that draw ended. If nothing was emitted since, the moves of the
+         * next draw that don't change a register are dropped. */
+        struct pan_cs_builder cs_vertex_regs;
+        uint64_t *cs_vertex_draw_end;
+
         pan_command_stream cs_fragment;
 
+        /* GPU addresses the system timestamp is written to once all of the
+         * work of the batch is done, for timestamp queries */
+        struct util_dynarray timestamps;
+
+        /* u_trace tracepoints of the batch, flushed on cleanup */
+        struct u_trace trace;
+
+        /* JM kbase atoms of the batch being submitted, sent to the kernel
+         * together once all the chains are queued. NULL when each chain is
+         * submitted on its own. */
+        struct kbase_atom_batch *kbase_atoms;
+
+        /* Why the batch was submitted, for tracing. A static string. */
+        const char *reason;
+        enum panfrost_flush_class flush_class;
+
+        /* GPU addresses of the trace timestamps, recorded when the batch is
+         * submitted. Zero if the timestamp isn't traced. */
+        mali_ptr trace_ts[PAN_TRACE_TS_COUNT];
+
+        /* Draws kept for replaying in later batches, see pan_replay.h */
+        struct panfrost_batch_replay replay;
+
         bool needs_sync;
 };
 
+/* Image views of the surfaces of a framebuffer, which don't change from one
+ * batch to the next. The key doesn't hold references to the surfaces, entries
+ * are dropped when one of them is destroyed instead. */
+
+#define PAN_FB_VIEWS 8
+
+struct panfrost_fb_views {
+        bool valid;
+        struct pipe_framebuffer_state key;
+        struct pan_image_view rts[PIPE_MAX_COLOR_BUFS], zs, s;
+
+        /* For least recently used eviction */
+        uint64_t seqnum;
+};
+
+/* Dense table of the highest seqnum depended upon for each queue, used while
+ * building the dependency lists of a batch. Entries hold seqnum + 1, so that
+ * zero means no dependency. */
+struct panfrost_dep_table {
+        uint64_t *seqnums;
+        unsigned size;
+
+        /* One more than the highest queue with an entry */
+        unsigned used;
+};
+
 /* Functions for managing the above */
 
 struct panfrost_batch *
@@ -236,6 +360,10 @@ panfrost_batch_add_bo(struct panfrost_batch *batch,
                       struct panfrost_bo *bo,
                       enum pipe_shader_type stage);
 
+void
+panfrost_batch_add_pool(struct panfrost_batch *batch,
+                        struct panfrost_pool *pool);
+
 void
 panfrost_batch_read_rsrc(struct panfrost_batch *batch,
                          struct panfrost_resource *rsrc,
@@ -264,6 +392,10 @@ panfrost_flush_batches_accessing_rsrc(struct panfrost_context *ctx,
                                       struct panfrost_resource *rsrc,
                                       const char *reason);
 
+void
+panfrost_batch_discard_rsrc(struct panfrost_context *ctx,
+                            struct panfrost_resource *rsrc);
+
 void
 panfrost_flush_writer(struct panfrost_context *ctx,
                       struct panfrost_resource *rsrc,
@@ -272,11 +404,16 @@ panfrost_flush_writer(struct panfrost_context *ctx,
 void
 panfrost_batch_adjust_stack_size(struct panfrost_batch *batch);
 
+void
+panfrost_write_timestamp(struct panfrost_context *ctx,
+                         struct panfrost_resource *rsrc,
+                         unsigned offset);
+
 struct panfrost_bo *
 panfrost_batch_get_scratchpad(struct panfrost_batch *batch, unsigned size, unsigned thread_tls_alloc, unsigned core_id_range);
 
 struct panfrost_bo *
-panfrost_batch_get_shared_memory(struct panfrost_batch *batch, unsigned size, unsigned workgroup_count);
+panfrost_batch_get_shared_memory(struct panfrost_batch *batch, unsigned size);
 
 void
 panfrost_batch_clear(struct panfrost_batch *batch,
@@ -289,7 +426,22 @@ panfrost_batch_union_scissor(struct panfrost_batch *batch,
                              unsigned minx, unsigned miny,
                              unsigned maxx, unsigned maxy);
 
+void
+panfrost_batch_intersection_scissor(struct panfrost_batch *batch,
+                                    unsigned minx, unsigned miny,
+                                    unsigned maxx, unsigned maxy);
+
 bool
 panfrost_batch_skip_rasterization(struct panfrost_batch *batch);
 
+void
+panfrost_release_tiler_heaps(struct panfrost_context *ctx);
+
+struct panfrost_resource *
+panfrost_batch_tiler_target(struct panfrost_batch *batch);
+
+void
+panfrost_invalidate_fb_views(struct panfrost_context *ctx,
+                             struct pipe_surface *surf);
+
 #endif
@@ -41,19 +41,93 @@
  * or hold references. Instead, the consumer must manage the created BOs. This
  * is more flexible, enabling non-transient CSO state or shader code to be
  * packed with conservative lifetime handling.
+ *
+ * Owned pools can also be given a recycler, which keeps the slab-sized BOs of
+ * finished pools. A new pool takes the oldest of them once it is idle, so
+ * that transient pools such as the batch pools do not allocate and free BOs
+ * for every batch.
  */
 
+/* Maximum number of BOs kept by a recycler */
+#define PAN_POOL_RECYCLER_MAX 64
+
+void
+panfrost_pool_recycler_init(struct panfrost_pool_recycler *recycler,
+                            void *memctx)
+{
+        util_dynarray_init(&recycler->bos, memctx);
+}
+
+void
+panfrost_pool_recycler_fini(struct panfrost_pool_recycler *recycler)
+{
+        util_dynarray_foreach(&recycler->bos, struct panfrost_bo *, bo)
+                panfrost_bo_unreference(*bo);
+
+        util_dynarray_fini(&recycler->bos);
+}
+
+/* BOs are recycled in the order their pools finished, so only the oldest one
+ * needs to be checked */
+
+static struct panfrost_bo *
+panfrost_pool_recycler_get(struct panfrost_pool_recycler *recycler)
+{
+        unsigned count = util_dynarray_num_elements(&recycler->bos,
+                                                    struct panfrost_bo *);
+
+        if (!count)
+                return NULL;
+
+        struct panfrost_bo **bos = util_dynarray_begin(&recycler->bos);
+        struct panfrost_bo *bo = bos[0];
+
+        if (!panfrost_bo_wait(bo, 0, true))
+                return NULL;
+
+        memmove(bos, bos + 1, (count - 1) * sizeof(*bos));
+        (void)! util_dynarray_resize(&recycler->bos, struct panfrost_bo *,
+                                     count - 1);
+
+        /* The contents are dead, so growable BOs start again from no
+         * backing rather than keeping the peak of the batch that last used
+         * them */
+        if (bo->flags & PAN_BO_GROWABLE)
+                panfrost_bo_decommit(bo);
+
+        return bo;
+}
+
+static void
+panfrost_pool_recycler_put(struct panfrost_pool_recycler *recycler,
+                           struct panfrost_bo *bo)
+{
+        if (util_dynarray_num_elements(&recycler->bos, struct panfrost_bo *) >=
+            PAN_POOL_RECYCLER_MAX) {
+                panfrost_bo_unreference(bo);
+                return;
+        }
+
+        util_dynarray_append(&recycler->bos, struct panfrost_bo *, bo);
+}
+
 static struct panfrost_bo *
 panfrost_pool_alloc_backing(struct panfrost_pool *pool, size_t bo_sz)
 {
-        /* We don't know what the BO will be used for, so let's flag it
-         * RW and attach it to both the fragment and vertex/tiler jobs.
-         * TODO: if we want fine grained BO assignment we should pass
-         * flags to this function and keep the read/write,
-         * fragment/vertex+tiler pools separate.
+        /* Allocations don't say what they will be used for, so BOs are
+         * flagged with the access of the whole pool when the batch is
+         * submitted. Consumers with different access patterns should use
+         * separate pools.
          */
-        struct panfrost_bo *bo = panfrost_bo_create(pool->base.dev, bo_sz,
-                        pool->base.create_flags, pool->base.label);
+        struct panfrost_bo *bo = NULL;
+
+        if (pool->recycler && bo_sz == pool->base.slab_size)
+                bo = panfrost_pool_recycler_get(pool->recycler);
+
+        if (!bo)
+                bo = panfrost_bo_create(pool->base.dev, bo_sz,
+                                        pool->base.create_flags,
+                                        pool->base.label);
 
         if (pool->owned)
                 util_dynarray_append(&pool->bos, struct panfrost_bo *, bo);
@@ -70,11 +144,23 @@ void
 panfrost_pool_init(struct panfrost_pool *pool, void *memctx,
                    struct panfrost_device *dev,
                    unsigned create_flags, size_t slab_size, const char *label,
-                   bool prealloc, bool owned)
+                   bool prealloc, bool owned,
+                   struct panfrost_pool_recycler *recycler)
 {
         memset(pool, 0, sizeof(*pool));
         pan_pool_init(&pool->base, dev, create_flags, slab_size, label);
         pool->owned = owned;
+        pool->vertex_access = PAN_BO_ACCESS_RW;
+        pool->fragment_access = PAN_BO_ACCESS_RW;
+
+        if (owned)
+                pool->recycler = recycler;
+
+#ifdef PAN_DBG_OVERFLOW
+        /* Guard pages are set up with mprotect, so the BOs can't be reused */
+        if (dev->debug & PAN_DBG_OVERFLOW)
+                pool->recycler = NULL;
+#endif
 
         if (owned)
                 util_dynarray_init(&pool->bos, memctx);
@@ -91,8 +177,13 @@ panfrost_pool_cleanup(struct panfrost_pool *pool)
                 return;
         }
 
-        util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo)
-                panfrost_bo_unreference(*bo);
+        util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo) {
+                /* Larger BOs for big allocations are not worth keeping */
+                if (pool->recycler && (*bo)->size < 2 * pool->base.slab_size)
+                        panfrost_pool_recycler_put(pool->recycler, *bo);
+                else
+                        panfrost_bo_unreference(*bo);
+        }
 
         util_dynarray_fini(&pool->bos);
 }
@@ -114,7 +205,8 @@ panfrost_pool_get_bo_handles(struct panfrost_pool *pool, uint32_t *handles)
                 * We also preserve existing flags as this batch might not
                 * be the first one to access the BO.
                 */
-                (*bo)->gpu_access |= PAN_BO_ACCESS_RW;
+                (*bo)->gpu_access |= pool->vertex_access |
+                                     pool->fragment_access;
         }
 }
 
@@ -158,6 +250,7 @@ panfrost_pool_alloc_aligned(struct panfrost_pool *pool, size_t sz, unsigned alig
         }
 
         pool->transient_offset = offset + sz;
+        pool->allocated += sz;
 
         struct panfrost_ptr ret = {
                 .cpu = bo->ptr.cpu + offset,
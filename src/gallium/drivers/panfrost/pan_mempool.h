@@ -27,6 +27,13 @@
 
 #include "pan_pool.h"
 
+/* Slab-sized BOs of finished owned pools, kept for reuse by later pools of the
+ * same kind once the GPU is done with them, oldest first. */
+
+struct panfrost_pool_recycler {
+        struct util_dynarray bos;
+};
+
 /* Represents grow-only memory. It may be owned by the batch (OpenGL), or may
    be unowned for persistent uploads. */
 
@@ -43,9 +50,21 @@ struct panfrost_pool {
         /* Within the topmost transient BO, how much has been used? */
         unsigned transient_offset;
 
+        /* Bytes allocated from the pool so far, for the driver queries */
+        uint64_t allocated;
+
         /* Mode of the pool. BO management is in the pool for owned mode, but
          * the consumed for unowned mode. */
         bool owned;
+
+        /* If set, slab-sized BOs of an owned pool are taken from and returned
+         * to the recycler rather than the BO cache */
+        struct panfrost_pool_recycler *recycler;
+
+        /* How vertex/tiler and fragment jobs access the BOs of an owned pool,
+         * as PAN_BO_ACCESS_{READ,WRITE} flags. Both default to RW, the
+         * consumer can restrict them after initialization. */
+        pan_bo_access vertex_access, fragment_access;
 };
 
 static inline struct panfrost_pool *
@@ -83,7 +102,14 @@ void
 panfrost_pool_init(struct panfrost_pool *pool, void *memctx,
                    struct panfrost_device *dev, unsigned create_flags,
                    size_t slab_size, const char *label, bool prealloc, bool
-                   owned);
+                   owned, struct panfrost_pool_recycler *recycler);
+
+void
+panfrost_pool_recycler_init(struct panfrost_pool_recycler *recycler,
+                            void *memctx);
+
+void
+panfrost_pool_recycler_fini(struct panfrost_pool_recycler *recycler);
 
 void
 panfrost_pool_cleanup(struct panfrost_pool *pool);
@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2021 Google, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <perfetto.h>
+
+#include "util/hash_table.h"
+#include "util/macros.h"
+#include "util/perf/u_perfetto.h"
+
+#include "pan_perfetto.h"
+#include "pan_tracepoints.h"
+
+static const struct {
+        const char *name;
+        const char *desc;
+} stages[] = {
+        [VERTEX_TILER_STAGE_ID] = {"Vertex/tiler", "Vertex shading and binning of a batch"},
+        [FRAGMENT_STAGE_ID]     = {"Fragment", "Fragment shading of a batch"},
+};
+
+static const struct {
+        const char *name;
+        const char *desc;
+} queues[] = {
+        [VERTEX_TILER_STAGE_ID] = {"Vertex/tiler queue", "Job slot 1 or CSF vertex queue"},
+        [FRAGMENT_STAGE_ID]     = {"Fragment queue", "Job slot 0 or CSF fragment queue"},
+};
+
+static uint32_t gpu_clock_id;
+static uint64_t next_clock_sync_ns; /* cpu time of next clk sync */
+
+/* GPU time of the first clock sync. Stages which started before it are
+ * dropped, as perfetto can't place them. */
+static uint64_t sync_gpu_ts;
+
+struct PanRenderpassIncrementalState {
+        bool was_cleared = true;
+};
+
+struct PanRenderpassTraits : public perfetto::DefaultDataSourceTraits {
+        using IncrementalStateType = PanRenderpassIncrementalState;
+};
+
+class PanRenderpassDataSource : public perfetto::DataSource<PanRenderpassDataSource, PanRenderpassTraits> {
+public:
+        void OnSetup(const SetupArgs &) override
+        {
+        }
+
+        void OnStart(const StartArgs &) override
+        {
+                u_trace_perfetto_start();
+                PERFETTO_LOG("Tracing started");
+
+                /* Clock ids below 128 are reserved, custom clock sources use
+                 * the hash of a namespaced string. */
+                gpu_clock_id =
+                        _mesa_hash_string("org.freedesktop.mesa.panfrost") | 0x80000000;
+        }
+
+        void OnStop(const StopArgs &) override
+        {
+                PERFETTO_LOG("Tracing stopped");
+
+                u_trace_perfetto_stop();
+
+                Trace([](PanRenderpassDataSource::TraceContext ctx) {
+                        auto packet = ctx.NewTracePacket();
+                        packet->Finalize();
+                        ctx.Flush();
+                });
+        }
+};
+
+PERFETTO_DECLARE_DATA_SOURCE_STATIC_MEMBERS(PanRenderpassDataSource);
+PERFETTO_DEFINE_DATA_SOURCE_STATIC_MEMBERS(PanRenderpassDataSource);
+
+static void
+send_descriptors(PanRenderpassDataSource::TraceContext &ctx)
+{
+        PERFETTO_LOG("Sending renderstage descriptors");
+
+        auto packet = ctx.NewTracePacket();
+
+        packet->set_timestamp(0);
+
+        auto event = packet->set_gpu_render_stage_event();
+        event->set_gpu_id(0);
+
+        auto spec = event->set_specifications();
+
+        for (unsigned i = 0; i < ARRAY_SIZE(queues); i++) {
+                auto desc = spec->add_hw_queue();
+
+                desc->set_name(queues[i].name);
+                desc->set_description(queues[i].desc);
+        }
+
+        for (unsigned i = 0; i < ARRAY_SIZE(stages); i++) {
+                auto desc = spec->add_stage();
+
+                desc->set_name(stages[i].name);
+                desc->set_description(stages[i].desc);
+        }
+}
+
+static void
+add_extra_data(perfetto::protos::pbzero::GpuRenderStageEvent *event,
+               const char *name, const std::string &value)
+{
+        auto data = event->add_extra_data();
+
+        data->set_name(name);
+        data->set_value(value);
+}
+
+static void
+stage_start(struct pipe_context *pctx, uint64_t ts_ns, enum pan_stage_id stage,
+            uint32_t seqnum, const char *reason)
+{
+        struct pan_perfetto_state *p = pan_perfetto_state(pctx);
+
+        p->start_ts[stage] = ts_ns;
+        p->seqnum[stage] = seqnum;
+        p->reason[stage] = reason;
+}
+
+static void
+stage_end(struct pipe_context *pctx, uint64_t ts_ns, enum pan_stage_id stage)
+{
+        struct pan_perfetto_state *p = pan_perfetto_state(pctx);
+
+        /* Skip the stage until the clocks have been synchronised, otherwise
+         * perfetto won't know what to do with it */
+        if (!sync_gpu_ts || p->start_ts[stage] < sync_gpu_ts)
+                return;
+
+        PanRenderpassDataSource::Trace([=](PanRenderpassDataSource::TraceContext tctx) {
+                if (auto state = tctx.GetIncrementalState(); state->was_cleared) {
+                        send_descriptors(tctx);
+                        state->was_cleared = false;
+                }
+
+                auto packet = tctx.NewTracePacket();
+
+                packet->set_timestamp(p->start_ts[stage]);
+                packet->set_timestamp_clock_id(gpu_clock_id);
+
+                auto event = packet->set_gpu_render_stage_event();
+                event->set_event_id(0);
+                event->set_hw_queue_id(stage);
+                event->set_duration(ts_ns - p->start_ts[stage]);
+                event->set_stage_id(stage);
+                event->set_context((uintptr_t)pctx);
+                event->set_submission_id(p->seqnum[stage]);
+
+                if (p->reason[stage])
+                        add_extra_data(event, "reason", p->reason[stage]);
+
+                if (stage == FRAGMENT_STAGE_ID) {
+                        add_extra_data(event, "width", std::to_string(p->width));
+                        add_extra_data(event, "height", std::to_string(p->height));
+                        add_extra_data(event, "MRTs", std::to_string(p->mrts));
+                        add_extra_data(event, "MSAA", std::to_string(p->samples));
+                }
+        });
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+pan_perfetto_init(void)
+{
+        util_perfetto_init();
+
+        perfetto::DataSourceDescriptor dsd;
+        dsd.set_name("gpu.renderstages.panfrost");
+        PanRenderpassDataSource::Register(dsd);
+}
+
+void
+pan_perfetto_submit(uint64_t gpu_ts)
+{
+        uint64_t cpu_ts = perfetto::base::GetBootTimeNs().count();
+
+        if (cpu_ts < next_clock_sync_ns || !gpu_ts)
+                return;
+
+        PanRenderpassDataSource::Trace([=](PanRenderpassDataSource::TraceContext tctx) {
+                auto packet = tctx.NewTracePacket();
+
+                packet->set_timestamp(cpu_ts);
+
+                auto event = packet->set_clock_snapshot();
+
+                {
+                        auto clock = event->add_clocks();
+
+                        clock->set_clock_id(perfetto::protos::pbzero::BUILTIN_CLOCK_BOOTTIME);
+                        clock->set_timestamp(cpu_ts);
+                }
+
+                {
+                        auto clock = event->add_clocks();
+
+                        clock->set_clock_id(gpu_clock_id);
+                        clock->set_timestamp(gpu_ts);
+                }
+
+                if (!sync_gpu_ts)
+                        sync_gpu_ts = gpu_ts;
+
+                next_clock_sync_ns = cpu_ts + 30000000;
+        });
+}
+
+/*
+ * Trace callbacks, called from u_trace once the timestamps from GPU have been
+ * collected.
+ */
+
+void
+pan_start_vertex_tiler(struct pipe_context *pctx, uint64_t ts_ns,
+                       const void *flush_data,
+                       const struct trace_start_vertex_tiler *payload)
+{
+        stage_start(pctx, ts_ns, VERTEX_TILER_STAGE_ID,
+                    payload->seqnum, payload->reason);
+}
+
+void
+pan_end_vertex_tiler(struct pipe_context *pctx, uint64_t ts_ns,
+                     const void *flush_data,
+                     const struct trace_end_vertex_tiler *payload)
+{
+        stage_end(pctx, ts_ns, VERTEX_TILER_STAGE_ID);
+}
+
+void
+pan_start_fragment(struct pipe_context *pctx, uint64_t ts_ns,
+                   const void *flush_data,
+                   const struct trace_start_fragment *payload)
+{
+        struct pan_perfetto_state *p = pan_perfetto_state(pctx);
+
+        stage_start(pctx, ts_ns, FRAGMENT_STAGE_ID,
+                    payload->seqnum, payload->reason);
+
+        p->width = payload->width;
+        p->height = payload->height;
+        p->mrts = payload->mrts;
+        p->samples = payload->samples;
+}
+
+void
+pan_end_fragment(struct pipe_context *pctx, uint64_t ts_ns,
+                 const void *flush_data,
+                 const struct trace_end_fragment *payload)
+{
+        stage_end(pctx, ts_ns, FRAGMENT_STAGE_ID);
+}
+
+#ifdef __cplusplus
+}
+#endif
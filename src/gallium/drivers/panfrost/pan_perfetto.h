@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2021 Google, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PAN_PERFETTO_H
+#define PAN_PERFETTO_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_PERFETTO
+
+/* Render stages of a batch. Stages run on the hardware queue of the same
+ * index, the job slots of the Job Manager or the command stream queues of
+ * CSF. */
+enum pan_stage_id {
+        VERTEX_TILER_STAGE_ID,
+        FRAGMENT_STAGE_ID,
+
+        NUM_STAGES
+};
+
+/* The start tracepoints carry the description of the stage, which is only
+ * emitted along with the end timestamp */
+struct pan_perfetto_state {
+        uint64_t start_ts[NUM_STAGES];
+
+        uint32_t seqnum[NUM_STAGES];
+        const char *reason[NUM_STAGES];
+
+        /* Render target state of the fragment stage */
+        uint16_t width;
+        uint16_t height;
+        uint8_t mrts;
+        uint8_t samples;
+};
+
+void pan_perfetto_init(void);
+
+struct pipe_context;
+
+/* Implemented by the context, as the perfetto code can't include it */
+struct pan_perfetto_state *pan_perfetto_state(struct pipe_context *pctx);
+
+/* Called on submit with the current GPU time for the clock sync */
+void pan_perfetto_submit(uint64_t gpu_ts_ns);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PAN_PERFETTO_H */
@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/u_framebuffer.h"
+#include "pan_bo.h"
+#include "pan_context.h"
+#include "pan_replay.h"
+
+static void
+panfrost_replay_put_use(struct panfrost_replay_use *use)
+{
+        if (use->rsrc) {
+                struct pipe_resource *prsrc = &use->rsrc->base;
+                pipe_resource_reference(&prsrc, NULL);
+        } else {
+                panfrost_bo_unreference(use->bo);
+        }
+}
+
+static void
+panfrost_replay_put_pool(struct panfrost_replay_pool *p)
+{
+        panfrost_pool_cleanup(&p->pool);
+        panfrost_pool_cleanup(&p->invisible_pool);
+        free(p);
+}
+
+static void
+panfrost_replay_free(struct panfrost_replay *rec)
+{
+        util_dynarray_foreach(&rec->uses, struct panfrost_replay_use, use)
+                panfrost_replay_put_use(use);
+
+        util_dynarray_foreach(&rec->pools, struct panfrost_replay_pool *, p)
+                panfrost_replay_put_pool(*p);
+
+        util_dynarray_fini(&rec->draws);
+        util_dynarray_fini(&rec->uses);
+        util_dynarray_fini(&rec->pools);
+        free(rec);
+}
+
+void
+panfrost_replay_batch_fini(struct panfrost_batch *batch)
+{
+        if (batch->replay.record)
+                panfrost_replay_free(batch->replay.record);
+
+        util_dynarray_fini(&batch->replay.draws);
+        util_dynarray_fini(&batch->replay.uses);
+}
+
+static unsigned
+panfrost_replay_draw_count(struct panfrost_batch *batch)
+{
+        return util_dynarray_num_elements(&batch->replay.draws,
+                                          struct panfrost_replay_draw);
+}
+
+/* The batch holds the references until the draws are recorded */
+
+void
+panfrost_replay_log_bo(struct panfrost_batch *batch, struct panfrost_bo *bo,
+                       enum pipe_shader_type stage)
+{
+        struct panfrost_replay_use use = {
+                .draw = panfrost_replay_draw_count(batch),
+                .bo = bo,
+                .stage = stage,
+        };
+
+        util_dynarray_append(&batch->replay.uses, struct panfrost_replay_use, use);
+}
+
+void
+panfrost_replay_log_rsrc(struct panfrost_batch *batch,
+                         struct panfrost_resource *rsrc,
+                         enum pipe_shader_type stage)
+{
+        struct panfrost_replay_use use = {
+                .draw = panfrost_replay_draw_count(batch),
+                .rsrc = rsrc,
+                .stage = stage,
+        };
+
+        util_dynarray_append(&batch->replay.uses, struct panfrost_replay_use, use);
+}
+
+/* Jobs and descriptors are only rewritten once the GPU is done with them. A
+ * busy record is left alone, the batch is then recorded as well, so frames
+ * in flight alternate between records. */
+static bool
+panfrost_replay_idle(struct panfrost_replay *rec)
+{
+        util_dynarray_foreach(&rec->pools, struct panfrost_replay_pool *, p) {
+                util_dynarray_foreach(&(*p)->pool.bos, struct panfrost_bo *, bo) {
+                        if (!panfrost_bo_wait(*bo, 0, true))
+                                return false;
+                }
+        }
+
+        return true;
+}
+
+static bool
+panfrost_replay_matches_fb(const struct panfrost_replay *rec,
+                           const struct pipe_framebuffer_state *fb)
+{
+        if (rec->width != fb->width || rec->height != fb->height ||
+            rec->layers != util_framebuffer_get_num_layers(fb) ||
+            rec->samples != util_framebuffer_get_num_samples(fb) ||
+            rec->nr_cbufs != fb->nr_cbufs)
+                return false;
+
+        for (unsigned i = 0; i < fb->nr_cbufs; ++i) {
+                enum pipe_format format =
+                        fb->cbufs[i] ? fb->cbufs[i]->format : PIPE_FORMAT_NONE;
+
+                if (rec->cbufs[i] != format)
+                        return false;
+        }
+
+        return rec->zsbuf == (fb->zsbuf ? fb->zsbuf->format : PIPE_FORMAT_NONE);
+}
+
+/* At the first draw of a batch, take a record starting with the same draw */
+
+bool
+panfrost_replay_start(struct panfrost_batch *batch, uint64_t hash)
+{
+        struct panfrost_context *ctx = batch->ctx;
+
+        for (unsigned i = 0; i < PAN_REPLAY_RECORDS; ++i) {
+                struct panfrost_replay *rec = ctx->replays[i];
+
+                if (!rec || !panfrost_replay_matches_fb(rec, &batch->key))
+                        continue;
+
+                struct panfrost_replay_draw *first =
+                        util_dynarray_begin(&rec->draws);
+
+                if (first->hash != hash || !panfrost_replay_idle(rec))
+                        continue;
+
+                ctx->replays[i] = NULL;
+                batch->replay.record = rec;
+                batch->replay.speculating = true;
+                batch->replay.use_cursor = 0;
+                return true;
+        }
+
+        return false;
+}
+
+/* Account for the next draw of the record as if it had been emitted */
+
+void
+panfrost_replay_skip_draw(struct panfrost_batch *batch)
+{
+        struct panfrost_replay *rec = batch->replay.record;
+        unsigned idx = panfrost_replay_draw_count(batch);
+        struct panfrost_replay_draw *draw =
+                util_dynarray_element(&rec->draws, struct panfrost_replay_draw, idx);
+
+        unsigned nr_uses = util_dynarray_num_elements(&rec->uses,
+                                                      struct panfrost_replay_use);
+
+        for (; batch->replay.use_cursor < nr_uses; ++batch->replay.use_cursor) {
+                struct panfrost_replay_use *use =
+                        util_dynarray_element(&rec->uses, struct panfrost_replay_use,
+                                              batch->replay.use_cursor);
+
+                if (use->draw != idx)
+                        break;
+
+                if (use->rsrc)
+                        panfrost_batch_read_rsrc(batch, use->rsrc, use->stage);
+                else
+                        panfrost_batch_add_bo(batch, use->bo, use->stage);
+        }
+
+        batch->draws |= draw->draws;
+        batch->resolve |= draw->draws;
+        batch->read |= draw->read;
+        batch->tiler_primitives = MIN2((uint64_t) batch->tiler_primitives +
+                                       draw->tiler_primitives, UINT32_MAX);
+
+        /* The jobs of the draw are only linked in when the batch takes over
+         * the recorded chain, but from now on they count as in the batch */
+        batch->scoreboard = draw->scoreboard;
+
+        util_dynarray_append(&batch->replay.draws, struct panfrost_replay_draw,
+                             *draw);
+}
+
+void
+panfrost_replay_end_draw(struct panfrost_batch *batch)
+{
+        struct panfrost_batch_replay *r = &batch->replay;
+        unsigned draws = batch->draws, read = batch->read;
+
+        r->in_draw = false;
+
+        /* The masks only grow, so what the draw contributes is found by
+         * setting them again from scratch */
+        batch->draws = batch->read = 0;
+        panfrost_set_batch_masks_blend(batch);
+        panfrost_set_batch_masks_zs(batch);
+
+        struct panfrost_replay_draw draw = {
+                .hash = r->hash,
+                .scoreboard = batch->scoreboard,
+                .draws = batch->draws,
+                .read = batch->read,
+                .tiler_primitives = batch->tiler_primitives - r->tiler_primitives,
+        };
+
+        batch->draws |= draws;
+        batch->read |= read;
+
+        util_dynarray_append(&r->draws, struct panfrost_replay_draw, draw);
+}
+
+/* Drop what the record has beyond the draws taken by the batch, and add the
+ * pools left to the batch */
+
+void
+panfrost_replay_truncate(struct panfrost_batch *batch)
+{
+        struct panfrost_replay *rec = batch->replay.record;
+        unsigned count = panfrost_replay_draw_count(batch);
+
+        batch->replay.speculating = false;
+
+        util_dynarray_resize(&rec->draws, struct panfrost_replay_draw, count);
+
+        unsigned nr_uses = util_dynarray_num_elements(&rec->uses,
+                                                      struct panfrost_replay_use);
+
+        for (unsigned i = batch->replay.use_cursor; i < nr_uses; ++i) {
+                panfrost_replay_put_use(util_dynarray_element(&rec->uses,
+                                        struct panfrost_replay_use, i));
+        }
+
+        util_dynarray_resize(&rec->uses, struct panfrost_replay_use,
+                             batch->replay.use_cursor);
+
+        unsigned kept = 0;
+        util_dynarray_foreach(&rec->pools, struct panfrost_replay_pool *, p) {
+                if ((*p)->first_draw >= count) {
+                        panfrost_replay_put_pool(*p);
+                        continue;
+                }
+
+                panfrost_batch_add_pool(batch, &(*p)->pool);
+                panfrost_batch_add_pool(batch, &(*p)->invisible_pool);
+                *util_dynarray_element(&rec->pools, struct panfrost_replay_pool *,
+                                       kept++) = *p;
+        }
+
+        util_dynarray_resize(&rec->pools, struct panfrost_replay_pool *, kept);
+}
+
+void *
+panfrost_replay_cpu(struct panfrost_replay *rec, mali_ptr gpu)
+{
+        util_dynarray_foreach(&rec->pools, struct panfrost_replay_pool *, p) {
+                util_dynarray_foreach(&(*p)->pool.bos, struct panfrost_bo *, bo) {
+                        if (gpu >= (*bo)->ptr.gpu &&
+                            gpu < (*bo)->ptr.gpu + (*bo)->size)
+                                return (*bo)->ptr.cpu + (gpu - (*bo)->ptr.gpu);
+                }
+        }
+
+        unreachable("recorded descriptors are in the record pools");
+}
+
+static void
+panfrost_replay_set_fb(struct panfrost_replay *rec,
+                       const struct pipe_framebuffer_state *fb)
+{
+        rec->width = fb->width;
+        rec->height = fb->height;
+        rec->layers = util_framebuffer_get_num_layers(fb);
+        rec->samples = util_framebuffer_get_num_samples(fb);
+        rec->nr_cbufs = fb->nr_cbufs;
+
+        for (unsigned i = 0; i < fb->nr_cbufs; ++i)
+                rec->cbufs[i] = fb->cbufs[i] ? fb->cbufs[i]->format : PIPE_FORMAT_NONE;
+
+        rec->zsbuf = fb->zsbuf ? fb->zsbuf->format : PIPE_FORMAT_NONE;
+}
+
+/* Called on submission, keeps the draws of the batch along with its pools */
+
+void
+panfrost_replay_record(struct panfrost_batch *batch)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct panfrost_batch_replay *r = &batch->replay;
+        struct panfrost_replay *rec = r->record;
+
+        if (r->disabled || !batch->scoreboard.first_job || batch->has_compute ||
+            batch->stack_size || batch->timestamps.size ||
+            u_trace_has_points(&batch->trace))
+                return;
+
+        if (rec && util_dynarray_num_elements(&rec->pools,
+                                              struct panfrost_replay_pool *) >=
+                   PAN_REPLAY_MAX_POOLS)
+                return;
+
+        if (rec) {
+                r->record = NULL;
+        } else {
+                rec = calloc(1, sizeof(*rec));
+                util_dynarray_init(&rec->draws, NULL);
+                util_dynarray_init(&rec->uses, NULL);
+                util_dynarray_init(&rec->pools, NULL);
+        }
+
+        struct panfrost_replay_pool *p = malloc(sizeof(*p));
+        p->first_draw = util_dynarray_num_elements(&rec->draws,
+                                                   struct panfrost_replay_draw);
+
+        /* The record takes the pools, leave the batch empty ones to clean
+         * up */
+        ctx->pool_upload_bytes += batch->pool.allocated;
+        p->pool = batch->pool;
+        p->invisible_pool = batch->invisible_pool;
+
+        panfrost_pool_init(&batch->pool, NULL, dev, 0, 4096, "Batch pool",
+                           false, true, NULL);
+        panfrost_pool_init(&batch->invisible_pool, NULL, dev, PAN_BO_INVISIBLE,
+                           4096, "Varyings", false, true, NULL);
+
+        util_dynarray_append(&rec->pools, struct panfrost_replay_pool *, p);
+
+        util_dynarray_foreach(&r->uses, struct panfrost_replay_use, use) {
+                if (use->rsrc)
+                        pipe_reference(NULL, &use->rsrc->base.reference);
+                else
+                        panfrost_bo_reference(use->bo);
+
+                util_dynarray_append(&rec->uses, struct panfrost_replay_use, *use);
+        }
+
+        /* The batch has an entry for every draw, including the ones taken
+         * from the record */
+        util_dynarray_fini(&rec->draws);
+        rec->draws = r->draws;
+        util_dynarray_init(&r->draws, NULL);
+
+        panfrost_replay_set_fb(rec, &batch->key);
+        rec->seqnum = batch->seqnum;
+        rec->tls = batch->tls;
+        rec->tiler_ctx = batch->tiler_ctx.bifrost;
+
+        /* Replace the least recently recorded */
+        unsigned slot = 0;
+
+        for (unsigned i = 0; i < PAN_REPLAY_RECORDS; ++i) {
+                if (!ctx->replays[i]) {
+                        slot = i;
+                        break;
+                }
+
+                if (ctx->replays[i]->seqnum < ctx->replays[slot]->seqnum)
+                        slot = i;
+        }
+
+        if (ctx->replays[slot])
+                panfrost_replay_free(ctx->replays[slot]);
+
+        ctx->replays[slot] = rec;
+}
+
+void
+panfrost_replay_context_fini(struct panfrost_context *ctx)
+{
+        for (unsigned i = 0; i < PAN_REPLAY_RECORDS; ++i) {
+                if (ctx->replays[i])
+                        panfrost_replay_free(ctx->replays[i]);
+
+                ctx->replays[i] = NULL;
+        }
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_REPLAY_H__
+#define __PAN_REPLAY_H__
+
+#include "util/u_dynarray.h"
+#include "pipe/p_state.h"
+#include "pan_mempool.h"
+#include "pan_scoreboard.h"
+
+struct panfrost_batch;
+struct panfrost_context;
+struct panfrost_resource;
+
+/* Batch replay (PAN_MESA_DEBUG=replay, job manager Bifrost and Valhall).
+ *
+ * Static scenes draw the same thing with the same state frame after frame.
+ * The job chain of a submitted batch is kept as a record, along with a hash
+ * of the state and parameters of each draw. While the draws of a later batch
+ * to the same kind of framebuffer match the record, nothing is emitted for
+ * them. Once a draw differs, or the batch is submitted, the batch takes over
+ * the matching part of the recorded chain and the remaining draws are added
+ * to it as usual. The framebuffer descriptor and fragment job are always
+ * built for the batch, so only the render targets need not match.
+ */
+
+#define PAN_REPLAY_RECORDS 4
+
+/* Pools grow by one for every batch only partially matching its record */
+#define PAN_REPLAY_MAX_POOLS 8
+
+struct panfrost_replay_draw {
+        /* Hash of the state and parameters of the draw */
+        uint64_t hash;
+
+        /* Scoreboard once the jobs of the draw were added */
+        struct pan_scoreboard scoreboard;
+
+        /* Buffers drawn and read by the draw, and the primitives it sent to
+         * the tiler */
+        unsigned draws, read;
+        uint32_t tiler_primitives;
+};
+
+/* A resource or BO added to the batch by a draw */
+struct panfrost_replay_use {
+        unsigned draw;
+        struct panfrost_resource *rsrc;
+        struct panfrost_bo *bo;
+        enum pipe_shader_type stage;
+};
+
+/* Pools of a batch whose jobs or descriptors are in the record */
+struct panfrost_replay_pool {
+        struct panfrost_pool pool, invisible_pool;
+
+        /* First draw allocating from the pools */
+        unsigned first_draw;
+};
+
+struct panfrost_replay {
+        /* Shape of the framebuffer the draws were recorded for */
+        unsigned width, height, layers, samples, nr_cbufs;
+        enum pipe_format cbufs[PIPE_MAX_COLOR_BUFS], zsbuf;
+
+        /* For least recently used eviction */
+        uint64_t seqnum;
+
+        /* struct panfrost_replay_draw, struct panfrost_replay_use and
+         * struct panfrost_replay_pool * respectively */
+        struct util_dynarray draws, uses, pools;
+
+        /* Local storage and tiler context descriptors the jobs point to */
+        struct panfrost_ptr tls;
+        mali_ptr tiler_ctx;
+};
+
+/* Replay state of a batch */
+struct panfrost_batch_replay {
+        /* A draw couldn't be hashed, so the batch isn't recorded */
+        bool disabled;
+
+        /* Set while a draw is emitted, to log what it adds to the batch */
+        bool in_draw;
+
+        /* Whether the draws so far all matched the record */
+        bool speculating;
+
+        /* Record the batch started from, owned by the batch */
+        struct panfrost_replay *record;
+
+        /* Hash of the draw being emitted, and the primitives sent to the
+         * tiler before it */
+        uint64_t hash;
+        uint32_t tiler_primitives;
+
+        /* struct panfrost_replay_draw for all draws of the batch, and
+         * struct panfrost_replay_use for the emitted ones */
+        struct util_dynarray draws, uses;
+
+        /* Next use of the record to add to the batch */
+        unsigned use_cursor;
+};
+
+void
+panfrost_replay_batch_fini(struct panfrost_batch *batch);
+
+void
+panfrost_replay_log_bo(struct panfrost_batch *batch, struct panfrost_bo *bo,
+                       enum pipe_shader_type stage);
+
+void
+panfrost_replay_log_rsrc(struct panfrost_batch *batch,
+                         struct panfrost_resource *rsrc,
+                         enum pipe_shader_type stage);
+
+bool
+panfrost_replay_start(struct panfrost_batch *batch, uint64_t hash);
+
+void
+panfrost_replay_skip_draw(struct panfrost_batch *batch);
+
+void
+panfrost_replay_end_draw(struct panfrost_batch *batch);
+
+void
+panfrost_replay_truncate(struct panfrost_batch *batch);
+
+void *
+panfrost_replay_cpu(struct panfrost_replay *rec, mali_ptr gpu);
+
+void
+panfrost_replay_record(struct panfrost_batch *batch);
+
+void
+panfrost_replay_context_fini(struct panfrost_context *ctx);
+
+#endif
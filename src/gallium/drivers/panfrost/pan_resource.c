@@ -43,6 +43,9 @@
 #include "util/u_transfer_helper.h"
 #include "util/u_gen_mipmap.h"
 #include "util/u_drm.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_atomic.h"
+#include "util/u_upload_mgr.h"
 
 #include "pan_bo.h"
 #include "pan_context.h"
@@ -156,7 +159,7 @@ panfrost_resource_from_handle(struct pipe_screen *pscreen,
 
         rsc->modifier_constant = true;
 
-        BITSET_SET(rsc->valid.data, 0);
+        panfrost_resource_set_valid(rsc, 0);
         panfrost_resource_set_damage_region(pscreen, &rsc->base, 0, NULL);
 
         if (dev->ro) {
@@ -168,6 +171,9 @@ panfrost_resource_from_handle(struct pipe_screen *pscreen,
         if (rsc->scanout)
                 panfrost_bo_mmap_scanout(bo, dev->ro, rsc->scanout);
 
+        threaded_resource_init(prsc, false);
+        rsc->threaded.is_shared = true;
+
         return prsc;
 }
 
@@ -197,6 +203,7 @@ panfrost_resource_get_handle(struct pipe_screen *pscreen,
 
         handle->modifier = rsrc->image.layout.modifier;
         rsrc->modifier_constant = true;
+        rsrc->threaded.is_shared = true;
 
         if (handle->type == WINSYS_HANDLE_TYPE_KMS && dev->ro) {
                 return renderonly_get_handle(scanout, handle);
@@ -269,7 +276,10 @@ panfrost_create_surface(struct pipe_context *pipe,
         struct panfrost_context *ctx = pan_context(pipe);
         struct pipe_surface *ps = NULL;
 
-        pan_legalize_afbc_format(ctx, pan_resource(pt), surf_tmpl->format);
+        /* Threaded contexts create surfaces on the application thread, where
+         * no blit can be done. Legalize when they are used instead. */
+        if (!ctx->tc)
+                pan_legalize_afbc_format(ctx, pan_resource(pt), surf_tmpl->format);
 
         ps = CALLOC_STRUCT(pipe_surface);
 
@@ -306,6 +316,7 @@ panfrost_surface_destroy(struct pipe_context *pipe,
                          struct pipe_surface *surf)
 {
         assert(surf->texture);
+        panfrost_invalidate_fb_views(pan_context(pipe), surf);
         pipe_resource_reference(&surf->texture, NULL);
         free(surf);
 }
@@ -325,9 +336,9 @@ panfrost_is_2d(const struct panfrost_resource *pres)
  * On platforms where it is supported, AFBC is even better. */
 
 static bool
-panfrost_should_afbc(struct panfrost_device *dev,
-                     const struct panfrost_resource *pres,
-                     enum pipe_format fmt)
+panfrost_can_afbc(struct panfrost_device *dev,
+                  const struct panfrost_resource *pres,
+                  enum pipe_format fmt)
 {
         /* AFBC resources may be rendered to, textured from, or shared across
          * processes, but may not be used as e.g buffers */
@@ -347,10 +358,6 @@ panfrost_should_afbc(struct panfrost_device *dev,
         if (!dev->has_afbc)
                 return false;
 
-        /* AFBC<-->staging is expensive */
-        if (pres->base.usage == PIPE_USAGE_STREAM)
-                return false;
-
         /* Only a small selection of formats are AFBC'able */
         if (!panfrost_format_supports_afbc(dev, fmt))
                 return false;
@@ -389,6 +396,18 @@ panfrost_should_afbc(struct panfrost_device *dev,
         return true;
 }
 
+static bool
+panfrost_should_afbc(struct panfrost_device *dev,
+                     const struct panfrost_resource *pres,
+                     enum pipe_format fmt)
+{
+        /* AFBC<-->staging is expensive */
+        if (pres->base.usage == PIPE_USAGE_STREAM)
+                return false;
+
+        return panfrost_can_afbc(dev, pres, fmt);
+}
+
 /*
  * For a resource we want to use AFBC with, should we use AFBC with tiled
  * headers? On GPUs that support it, this is believed to be beneficial for
@@ -403,6 +422,25 @@ panfrost_should_tile_afbc(const struct panfrost_device *dev,
                pres->base.height0 >= 128;
 }
 
+/*
+ * For a resource we want to use AFBC with, should we use 32x8 wide blocks? A
+ * header then covers twice as many pixels of a row, which helps scanning out
+ * or fetching headers of large render targets. Wide blocks are supported for
+ * rendering and texturing on Bifrost v7+, but force clean tile writes as
+ * superblocks no longer match the tiles, so save them for large colour
+ * buffers where header locality matters most.
+ */
+static bool
+panfrost_should_wide_afbc(const struct panfrost_device *dev,
+                          const struct panfrost_resource *pres)
+{
+        return dev->arch >= 7 &&
+               (pres->base.bind & PIPE_BIND_RENDER_TARGET) &&
+               !util_format_is_depth_or_stencil(pres->base.format) &&
+               pres->base.target != PIPE_TEXTURE_3D &&
+               pres->base.width0 >= 2048;
+}
+
 static bool
 panfrost_should_tile(struct panfrost_device *dev,
                      const struct panfrost_resource *pres,
@@ -431,6 +469,26 @@ panfrost_should_tile(struct panfrost_device *dev,
         return can_tile && (pres->base.usage != PIPE_USAGE_STREAM);
 }
 
+static uint64_t
+panfrost_afbc_modifier(const struct panfrost_device *dev,
+                       const struct panfrost_resource *pres)
+{
+        uint64_t afbc = AFBC_FORMAT_MOD_SPARSE;
+
+        if (panfrost_should_wide_afbc(dev, pres))
+                afbc |= AFBC_FORMAT_MOD_BLOCK_SIZE_32x8;
+        else
+                afbc |= AFBC_FORMAT_MOD_BLOCK_SIZE_16x16;
+
+        if (panfrost_afbc_can_ytr(pres->base.format))
+                afbc |= AFBC_FORMAT_MOD_YTR;
+
+        if (panfrost_should_tile_afbc(dev, pres))
+                afbc |= AFBC_FORMAT_MOD_TILED | AFBC_FORMAT_MOD_SC;
+
+        return DRM_FORMAT_MOD_ARM_AFBC(afbc);
+}
+
 static uint64_t
 panfrost_best_modifier(struct panfrost_device *dev,
                        const struct panfrost_resource *pres,
@@ -440,26 +498,18 @@ panfrost_best_modifier(struct panfrost_device *dev,
         if (unlikely(dev->debug & PAN_DBG_LINEAR))
                 return DRM_FORMAT_MOD_LINEAR;
 
-        if (panfrost_should_afbc(dev, pres, fmt)) {
-                uint64_t afbc =
-                        AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
-                        AFBC_FORMAT_MOD_SPARSE;
-
-                if (panfrost_afbc_can_ytr(pres->base.format))
-                        afbc |= AFBC_FORMAT_MOD_YTR;
-
-                if (panfrost_should_tile_afbc(dev, pres))
-                        afbc |= AFBC_FORMAT_MOD_TILED | AFBC_FORMAT_MOD_SC;
-
-                return DRM_FORMAT_MOD_ARM_AFBC(afbc);
-        } else if (panfrost_should_tile(dev, pres, fmt))
+        if (panfrost_should_afbc(dev, pres, fmt))
+                return panfrost_afbc_modifier(dev, pres);
+        else if (panfrost_should_tile(dev, pres, fmt))
                 return DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED;
         else
                 return DRM_FORMAT_MOD_LINEAR;
 }
 
 static bool
-panfrost_should_checksum(const struct panfrost_device *dev, const struct panfrost_resource *pres)
+panfrost_should_checksum(const struct panfrost_device *dev,
+                         const struct panfrost_resource *pres,
+                         uint64_t modifier)
 {
         /* When checksumming is enabled, the tile data must fit in the
          * size of the writeback buffer, so don't checksum formats
@@ -470,6 +520,11 @@ panfrost_should_checksum(const struct panfrost_device *dev, const struct panfros
         unsigned bytes_per_pixel = MAX2(pres->base.nr_samples, 1) *
                 util_format_get_blocksize(pres->base.format);
 
+        /* Wide AFBC blocks force clean tile writes, so checksums would never
+         * be used to skip a write */
+        if (drm_is_afbc(modifier) && panfrost_afbc_is_wide(modifier))
+                return false;
+
         return pres->base.bind & PIPE_BIND_RENDER_TARGET &&
                 panfrost_is_2d(pres) &&
                 bytes_per_pixel <= bytes_per_pixel_max &&
@@ -509,11 +564,49 @@ panfrost_resource_setup(struct panfrost_device *dev,
                 .array_size = pres->base.array_size,
                 .nr_samples = MAX2(pres->base.nr_samples, 1),
                 .nr_slices = pres->base.last_level + 1,
-                .crc = panfrost_should_checksum(dev, pres)
+                .crc = panfrost_should_checksum(dev, pres, chosen_mod)
         };
 
         ASSERTED bool valid = pan_image_layout_init(&pres->image.layout, NULL);
         assert(valid);
+
+        /* Checksums are for the old layout */
+        pres->valid.crc = false;
+        pres->afbc_pack.packed = false;
+}
+
+/* Renderbuffers only used as attachments are often transient: cleared at the
+ * start of each render pass and invalidated at the end, so their contents
+ * never leave the tile buffer. Back those likely to be so lazily. */
+
+static bool
+panfrost_wants_lazy_backing(struct panfrost_device *dev,
+                            const struct pipe_resource *template)
+{
+        unsigned attachment = PIPE_BIND_RENDER_TARGET | PIPE_BIND_DEPTH_STENCIL;
+
+        if (!dev->kbase || template->target == PIPE_BUFFER ||
+            template->usage == PIPE_USAGE_STAGING ||
+            (template->bind & ~attachment))
+                return false;
+
+        return (template->bind & PIPE_BIND_DEPTH_STENCIL) ||
+               template->nr_samples > 1;
+}
+
+/* Commits the whole BO of a lazily backed resource before the CPU touches
+ * it. The GPU may have faulted in part of it already, which is kept. */
+
+static void
+panfrost_resource_make_resident(struct panfrost_resource *rsrc)
+{
+        if (!rsrc->lazy_backing)
+                return;
+
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        if (panfrost_bo_commit(bo, bo->size))
+                rsrc->lazy_backing = false;
 }
 
 static void
@@ -534,6 +627,11 @@ panfrost_resource_init_afbc_headers(struct panfrost_resource *pres)
                                                 slice->offset +
                                                 (s * slice->afbc.surface_stride);
 
+                                /* Headers are in increasing order, so lazily
+                                 * backed BOs only need memory up to each */
+                                if (pres->lazy_backing)
+                                        panfrost_bo_commit(bo, offset + slice->afbc.header_size);
+
                                 /* Zero-ed AFBC headers seem to encode a plain
                                  * black. Let's use this pattern to keep the
                                  * initialization simple.
@@ -672,6 +770,7 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
                 so->modifier_constant = true;
         }
 
+        so->modifier_auto = (modifier == DRM_FORMAT_MOD_INVALID);
         panfrost_resource_setup(dev, so, modifier, template->format);
 
         /* Guess a label based on the bind */
@@ -758,15 +857,39 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
                 /* We create a BO immediately but don't bother mapping, since we don't
                  * care to map e.g. FBOs which the CPU probably won't touch */
 
-                /* For now, don't cache buffers as syncing can be slow when
-                 * too much memory is mapped. TODO: dynamically switch, or use
-                 * the STREAM_READ etc. hints? */
+                /* Don't cache buffers by default as syncing can be slow when
+                 * too much memory is mapped, but staging buffers are meant
+                 * for CPU readback. Other buffers are moved to cached memory
+                 * when the CPU keeps reading them, see panfrost_ptr_map. */
                 bool buffer = (template->target == PIPE_BUFFER);
-                unsigned cache_flag = buffer ? 0 : PAN_BO_CACHEABLE;
+                bool cached = !buffer || template->usage == PIPE_USAGE_STAGING;
+                unsigned cache_flag = cached ? PAN_BO_CACHEABLE : 0;
+                bool sparse = template->flags & PIPE_RESOURCE_FLAG_SPARSE;
+                so->lazy_backing = panfrost_wants_lazy_backing(dev, template);
+                unsigned sparse_flag = (sparse || so->lazy_backing) ?
+                                       PAN_BO_SPARSE : 0;
 
                 so->image.data.bo =
                         panfrost_bo_create(dev, so->image.layout.data_size,
-                                           PAN_BO_DELAY_MMAP | cache_flag, label);
+                                           PAN_BO_DELAY_MMAP | cache_flag |
+                                           sparse_flag, label);
+
+                /* BOs from the cache may still have pages committed */
+                if (so->lazy_backing)
+                        panfrost_bo_commit(so->image.data.bo, 0);
+
+                if (sparse) {
+                        assert(buffer);
+
+                        /* BOs from the cache may still have pages committed */
+                        panfrost_bo_commit(so->image.data.bo, 0);
+
+                        so->sparse.nr_pages =
+                                DIV_ROUND_UP(template->width0, PAN_SPARSE_PAGE_SIZE);
+                        so->sparse.committed =
+                                calloc(BITSET_WORDS(so->sparse.nr_pages),
+                                       sizeof(BITSET_WORD));
+                }
 
                 so->constant_stencil = true;
         }
@@ -779,6 +902,14 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
         if (template->bind & PIPE_BIND_INDEX_BUFFER)
                 so->index_cache = CALLOC_STRUCT(panfrost_minmax_cache);
 
+        threaded_resource_init(&so->base, false);
+        so->threaded.is_shared = !!(template->bind & PAN_BIND_SHARED_MASK);
+
+        if (template->target == PIPE_BUFFER) {
+                so->threaded.buffer_id_unique =
+                        util_idalloc_mt_alloc(&pan_screen(screen)->buffer_ids);
+        }
+
         return (struct pipe_resource *)so;
 }
 
@@ -805,14 +936,16 @@ panfrost_resource_create_with_modifiers(struct pipe_screen *screen,
         for (unsigned i = 0; i < PAN_MODIFIER_COUNT; ++i) {
                 uint64_t mod = pan_best_modifiers[i];
 
-                if (drm_is_afbc(mod) && !dev->has_afbc)
-                        continue;
-
                 if (mod != DRM_FORMAT_MOD_LINEAR && (dev->debug & PAN_DBG_LINEAR))
                         continue;
 
-                /* TODO: What if mod is an unsupported AFBC variant for this
-                 * format? */
+                /* Apply the same rules as when advertising modifiers, so
+                 * the AFBC variant picked for a scanout buffer is one the
+                 * format supports */
+                if (!screen->is_dmabuf_modifier_supported(screen, mod,
+                                                          template->format,
+                                                          NULL))
+                        continue;
 
                 if (drm_find_modifier(mod, modifiers, count)) {
                         return panfrost_resource_create_with_modifier(screen, template, mod);
@@ -834,12 +967,29 @@ panfrost_resource_destroy(struct pipe_screen *screen,
         if (rsrc->scanout)
                 renderonly_scanout_destroy(rsrc->scanout, dev->ro);
 
+        panfrost_resource_cancel_afbc_pack(rsrc);
+
         if (rsrc->image.data.bo)
                 panfrost_bo_unreference(rsrc->image.data.bo);
 
         free(rsrc->index_cache);
+        free(rsrc->sparse.committed);
         free(rsrc->damage.tile_map.data);
 
+        if (rsrc->view_cache) {
+                for (unsigned i = 0; i < PAN_VIEW_CACHE_SIZE; ++i)
+                        panfrost_bo_unreference(rsrc->view_cache->entries[i].state.bo);
+
+                simple_mtx_destroy(&rsrc->view_cache->lock);
+                free(rsrc->view_cache);
+        }
+
+        if (rsrc->threaded.buffer_id_unique) {
+                util_idalloc_mt_free(&pan_screen(screen)->buffer_ids,
+                                     rsrc->threaded.buffer_id_unique);
+        }
+
+        threaded_resource_deinit(pt);
         util_range_destroy(&rsrc->valid_buffer_range);
         free(rsrc);
 }
@@ -854,7 +1004,25 @@ panfrost_clear_render_target(struct pipe_context *pipe,
 {
         struct panfrost_context *ctx = pan_context(pipe);
 
-        /* TODO: dstx, etc. */
+        if (render_condition_enabled &&
+            !panfrost_render_condition_check(ctx))
+                return;
+
+        if (ctx->tc)
+                pan_legalize_afbc_format(ctx, pan_resource(dst->texture), dst->format);
+
+        /* Clearing part of the target would need a render pass preloading
+         * the rest of it, store the colour from a compute shader instead */
+        if (dstx || dsty || width < dst->width || height < dst->height) {
+                if (panfrost_compute_clear(pipe, dst, color, dstx, dsty,
+                                           width, height))
+                        return;
+
+                panfrost_blitter_save(ctx, render_condition_enabled);
+                util_blitter_clear_render_target(ctx->blitter, dst, color,
+                                                 dstx, dsty, width, height);
+                return;
+        }
 
         struct pipe_framebuffer_state tmp = {0};
         util_copy_framebuffer_state(&tmp, &ctx->pipe_framebuffer);
@@ -887,7 +1055,22 @@ panfrost_clear_depth_stencil(struct pipe_context *pipe,
 {
         struct panfrost_context *ctx = pan_context(pipe);
 
-        /* TODO: dstx, etc. */
+        if (render_condition_enabled &&
+            !panfrost_render_condition_check(ctx))
+                return;
+
+        if (ctx->tc)
+                pan_legalize_afbc_format(ctx, pan_resource(dst->texture), dst->format);
+
+        /* Depth/stencil can't be stored to as images, so partial clears are
+         * drawn */
+        if (dstx || dsty || width < dst->width || height < dst->height) {
+                panfrost_blitter_save(ctx, render_condition_enabled);
+                util_blitter_clear_depth_stencil(ctx->blitter, dst, clear_flags,
+                                                 depth, stencil, dstx, dsty,
+                                                 width, height);
+                return;
+        }
 
         struct pipe_framebuffer_state tmp = {0};
         util_copy_framebuffer_state(&tmp, &ctx->pipe_framebuffer);
@@ -909,6 +1092,87 @@ panfrost_clear_depth_stencil(struct pipe_context *pipe,
         util_unreference_framebuffer_state(&tmp);
 }
 
+static void
+panfrost_clear_buffer(struct pipe_context *pipe,
+                      struct pipe_resource *res,
+                      unsigned offset, unsigned size,
+                      const void *clear_value, int clear_value_size)
+{
+        if (!panfrost_compute_fill_buffer(pipe, res, offset, size,
+                                          clear_value, clear_value_size))
+                u_default_clear_buffer(pipe, res, offset, size,
+                                       clear_value, clear_value_size);
+}
+
+/* Largest write to a busy buffer staged in the upload ring */
+#define PAN_SUBDATA_STAGING_MAX (64 * 1024)
+
+/* Writing part of a buffer the GPU still uses either waits for the GPU or
+ * shadows the whole buffer in a new BO. Small writes are instead copied to
+ * the stream uploader's ring and from there to the buffer by a compute job,
+ * which is ordered after the previous users of the buffer like any other
+ * GPU write. When the buffer is used by a batch with graphics, the copy
+ * would split its render pass, which costs more than shadowing. */
+
+static bool
+panfrost_should_stage_subdata(struct panfrost_context *ctx,
+                              struct panfrost_resource *rsrc,
+                              unsigned usage, unsigned offset, unsigned size)
+{
+        if (rsrc->base.target != PIPE_BUFFER ||
+            (usage & PIPE_MAP_UNSYNCHRONIZED) ||
+            (rsrc->base.flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) ||
+            (rsrc->image.data.bo->flags & PAN_BO_SHARED) ||
+            size > PAN_SUBDATA_STAGING_MAX || ((offset | size) & 3))
+                return false;
+
+        /* Writes covering the buffer discard it instead, and writes to
+         * uninitialized ranges don't need to synchronize */
+        if ((offset == 0 && size == rsrc->base.width0) ||
+            !util_ranges_intersect(&rsrc->valid_buffer_range, offset,
+                                   offset + size))
+                return false;
+
+        if (rsrc->track.nr_users > 0)
+                return !(ctx->batch && ctx->batch->has_graphics);
+
+        return !panfrost_bo_wait(rsrc->image.data.bo, 0, true);
+}
+
+static void
+panfrost_buffer_subdata(struct pipe_context *pipe,
+                        struct pipe_resource *prsrc,
+                        unsigned usage, unsigned offset,
+                        unsigned size, const void *data)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+        struct panfrost_resource *rsrc = pan_resource(prsrc);
+
+        if (panfrost_should_stage_subdata(ctx, rsrc, usage, offset, size)) {
+                struct pipe_resource *staging = NULL;
+                unsigned staging_offset;
+
+                u_upload_data(pipe->stream_uploader, 0, size, 4, data,
+                              &staging_offset, &staging);
+
+                bool copied = staging &&
+                        panfrost_compute_copy_buffer(pipe, prsrc, offset,
+                                                     staging, staging_offset,
+                                                     size);
+
+                pipe_resource_reference(&staging, NULL);
+
+                if (copied) {
+                        panfrost_resource_contents_changed(rsrc);
+                        util_range_add(prsrc, &rsrc->valid_buffer_range,
+                                       offset, offset + size);
+                        return;
+                }
+        }
+
+        u_default_buffer_subdata(pipe, prsrc, usage, offset, size, data);
+}
+
 /* Most of the time we can do CPU-side transfers, but sometimes we need to use
  * the 3D pipe for this. Let's wrap u_blitter to blit to/from staging textures.
  * Code adapted from freedreno */
@@ -977,7 +1241,8 @@ pan_blit_from_staging(struct pipe_context *pctx, struct panfrost_transfer *trans
         blit.mask = util_format_get_mask(blit.src.format);
         blit.filter = PIPE_TEX_FILTER_NEAREST;
 
-        panfrost_blit(pctx, &blit);
+        if (!panfrost_compute_copy(pctx, &blit))
+                panfrost_blit(pctx, &blit);
 }
 
 static void
@@ -997,13 +1262,120 @@ pan_blit_to_staging(struct pipe_context *pctx, struct panfrost_transfer *trans)
         blit.mask = util_format_get_mask(blit.dst.format);
         blit.filter = PIPE_TEX_FILTER_NEAREST;
 
-        panfrost_blit(pctx, &blit);
+        if (!panfrost_compute_copy(pctx, &blit))
+                panfrost_blit(pctx, &blit);
+}
+
+/* Transfers smaller than this are tiled on the calling thread, as the cost of
+ * waking up the workers would dominate */
+
+#define PAN_TILING_THREAD_MIN_SIZE (4 * 1024 * 1024)
+
+struct panfrost_tiling_job {
+        struct util_queue_fence fence;
+
+        void *linear;
+        void *tiled;
+        unsigned x, y, w, h;
+        unsigned linear_stride, tiled_stride;
+        enum pipe_format format;
+        bool store;
+};
+
+static void
+panfrost_tiling_job_execute(void *data, void *gdata, int thread_index)
+{
+        struct panfrost_tiling_job *job = data;
+
+        if (job->store) {
+                panfrost_store_tiled_image(job->tiled, job->linear,
+                                           job->x, job->y, job->w, job->h,
+                                           job->tiled_stride,
+                                           job->linear_stride, job->format);
+        } else {
+                panfrost_load_tiled_image(job->linear, job->tiled,
+                                          job->x, job->y, job->w, job->h,
+                                          job->linear_stride,
+                                          job->tiled_stride, job->format);
+        }
+}
+
+/* Tile one layer of a transfer. Large layers are split in bands of whole tile
+ * rows, which touch disjoint parts of both the linear and tiled images, and
+ * spread across the tiling queue, with the last band done by the caller. */
+
+static void
+panfrost_access_tiled_layer(struct panfrost_screen *screen,
+                            struct panfrost_tiling_job *layer)
+{
+        const struct util_format_description *desc =
+                util_format_description(layer->format);
+        struct util_queue *queue = &screen->tiling_queue;
+        unsigned size = util_format_get_2d_size(layer->format,
+                                                layer->linear_stride,
+                                                layer->h);
+
+        if (!util_queue_is_initialized(queue) ||
+            size < PAN_TILING_THREAD_MIN_SIZE) {
+                panfrost_tiling_job_execute(layer, NULL, 0);
+                return;
+        }
+
+        /* A tile is 16 blocks high for uncompressed formats and 4 blocks high
+         * for compressed ones, so align bands to 16 blocks */
+        unsigned tile_h = 16 * desc->block.height;
+        unsigned band_h = ALIGN_NPOT(DIV_ROUND_UP(layer->h,
+                                                  queue->num_threads + 1),
+                                     tile_h);
+        unsigned start = layer->y, end = layer->y + layer->h;
+        unsigned nr_bands = 0;
+
+        for (unsigned y = start; y < end; y = y - (y % tile_h) + band_h)
+                nr_bands++;
+
+        struct panfrost_tiling_job *jobs = calloc(nr_bands, sizeof(*jobs));
+
+        if (!jobs) {
+                panfrost_tiling_job_execute(layer, NULL, 0);
+                return;
+        }
+
+        for (unsigned i = 0, y = start; i < nr_bands; ++i) {
+                struct panfrost_tiling_job *job = &jobs[i];
+                unsigned next = MIN2(y - (y % tile_h) + band_h, end);
+
+                *job = *layer;
+                job->y = y;
+                job->h = next - y;
+                job->linear = (uint8_t *) layer->linear +
+                              ((y - start) / desc->block.height) *
+                              layer->linear_stride;
+
+                if (i == nr_bands - 1) {
+                        panfrost_tiling_job_execute(job, NULL, 0);
+                } else {
+                        util_queue_fence_init(&job->fence);
+                        util_queue_add_job(queue, job, &job->fence,
+                                           panfrost_tiling_job_execute,
+                                           NULL, 0);
+                }
+
+                y = next;
+        }
+
+        for (unsigned i = 0; i < nr_bands - 1; ++i) {
+                util_queue_fence_wait(&jobs[i].fence);
+                util_queue_fence_destroy(&jobs[i].fence);
+        }
+
+        free(jobs);
 }
 
 static void
 panfrost_load_tiled_images(struct panfrost_transfer *transfer,
                            struct panfrost_resource *rsrc)
 {
+        struct panfrost_screen *screen = pan_screen(rsrc->base.screen);
         struct pipe_transfer *ptrans = &transfer->base;
         unsigned level = ptrans->level;
 
@@ -1025,11 +1397,20 @@ panfrost_load_tiled_images(struct panfrost_transfer *transfer,
                                rsrc->image.layout.slices[level].offset +
                                (z + ptrans->box.z) * stride;
 
-                panfrost_load_tiled_image(dst, map, ptrans->box.x,
-                                          ptrans->box.y, ptrans->box.width,
-                                          ptrans->box.height, ptrans->stride,
-                                          rsrc->image.layout.slices[level].row_stride,
-                                          rsrc->image.layout.format);
+                struct panfrost_tiling_job layer = {
+                        .linear = dst,
+                        .tiled = map,
+                        .x = ptrans->box.x,
+                        .y = ptrans->box.y,
+                        .w = ptrans->box.width,
+                        .h = ptrans->box.height,
+                        .linear_stride = ptrans->stride,
+                        .tiled_stride = rsrc->image.layout.slices[level].row_stride,
+                        .format = rsrc->image.layout.format,
+                        .store = false,
+                };
+
+                panfrost_access_tiled_layer(screen, &layer);
         }
 }
 
@@ -1037,6 +1418,7 @@ static void
 panfrost_store_tiled_images(struct panfrost_transfer *transfer,
                             struct panfrost_resource *rsrc)
 {
+        struct panfrost_screen *screen = pan_screen(rsrc->base.screen);
         struct panfrost_bo *bo = rsrc->image.data.bo;
         struct pipe_transfer *ptrans = &transfer->base;
         unsigned level = ptrans->level;
@@ -1051,11 +1433,20 @@ panfrost_store_tiled_images(struct panfrost_transfer *transfer,
                                rsrc->image.layout.slices[level].offset +
                                (z + ptrans->box.z) * stride;
 
-                panfrost_store_tiled_image(map, src,
-                                ptrans->box.x, ptrans->box.y,
-                                ptrans->box.width, ptrans->box.height,
-                                rsrc->image.layout.slices[level].row_stride,
-                                ptrans->stride, rsrc->image.layout.format);
+                struct panfrost_tiling_job layer = {
+                        .linear = src,
+                        .tiled = map,
+                        .x = ptrans->box.x,
+                        .y = ptrans->box.y,
+                        .w = ptrans->box.width,
+                        .h = ptrans->box.height,
+                        .linear_stride = ptrans->stride,
+                        .tiled_stride = rsrc->image.layout.slices[level].row_stride,
+                        .format = rsrc->image.layout.format,
+                        .store = true,
+                };
+
+                panfrost_access_tiled_layer(screen, &layer);
         }
 }
 
@@ -1069,6 +1460,185 @@ panfrost_box_covers_resource(const struct pipe_resource *resource,
                                                 box->depth);
 }
 
+/* Maximum number of separate ranges to synchronise for a transfer, past
+ * which the span covering all of them is used instead */
+#define PAN_TRANSFER_MAX_SYNC_RANGES 64
+
+/* Performs cache maintenance for only the bytes of the BO accessed by a
+ * transfer. Each row of the box is a range, in tiles for tiled images, and
+ * full rows are merged. AFBC surfaces are not split. */
+
+static void
+panfrost_transfer_mem_op(struct panfrost_resource *rsrc, unsigned level,
+                         const struct pipe_box *box, bool invalidate)
+{
+        const struct pan_image_layout *layout = &rsrc->image.layout;
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+        size_t bytes_per_block = util_format_get_blocksize(layout->format);
+        void (*op)(struct panfrost_bo *, size_t, size_t) = invalidate ?
+                panfrost_bo_mem_invalidate : panfrost_bo_mem_clean;
+
+        if (!bo->cached)
+                return;
+
+        if (rsrc->base.target == PIPE_BUFFER) {
+                op(bo, box->x * bytes_per_block, box->width * bytes_per_block);
+                return;
+        }
+
+        if (drm_is_afbc(layout->modifier)) {
+                op(bo, 0, bo->size);
+                return;
+        }
+
+        struct pipe_box box_blocks;
+        u_box_pixels_to_blocks(&box_blocks, box, layout->format);
+
+        struct pan_block_size block_size =
+                panfrost_block_size(layout->modifier, layout->format);
+        const struct pan_image_slice_layout *slice = &layout->slices[level];
+        size_t row_stride = slice->row_stride;
+        size_t layer_stride = panfrost_get_layer_stride(layout, level);
+
+        /* For tiled images, rows are rows of tiles, which are stored
+         * contiguously */
+        size_t tile_bytes = bytes_per_block * block_size.width *
+                block_size.height;
+        unsigned x0 = box_blocks.x / block_size.width;
+        unsigned x1 = DIV_ROUND_UP(box_blocks.x + box_blocks.width,
+                                   block_size.width);
+        unsigned y0 = box_blocks.y / block_size.height;
+        unsigned y1 = DIV_ROUND_UP(box_blocks.y + box_blocks.height,
+                                   block_size.height);
+
+        size_t row_offset = x0 * tile_bytes;
+        size_t row_size = (x1 - x0) * tile_bytes;
+        unsigned rows = y1 - y0;
+
+        /* Full rows are contiguous within a layer */
+        if (row_size == row_stride) {
+                row_size *= rows;
+                rows = 1;
+        }
+
+        size_t base = slice->offset + box->z * layer_stride +
+                y0 * row_stride + row_offset;
+
+        if (rows * box->depth > PAN_TRANSFER_MAX_SYNC_RANGES) {
+                size_t end = base + (box->depth - 1) * layer_stride +
+                        (rows - 1) * row_stride + row_size;
+
+                op(bo, base, MIN2(end, bo->size) - base);
+                return;
+        }
+
+        for (unsigned z = 0; z < box->depth; ++z) {
+                for (unsigned y = 0; y < rows; ++y) {
+                        size_t offset = base + z * layer_stride +
+                                y * row_stride;
+
+                        op(bo, offset, MIN2(row_size, bo->size - offset));
+                }
+        }
+}
+
+/* Buffers read back by the CPU are slow to access through uncached mappings.
+ * Count synchronized reads, and once a buffer is read often enough move it
+ * to a cached BO. Must be called once the GPU is done writing the buffer. */
+
+static void
+panfrost_buffer_track_cpu_read(struct panfrost_context *ctx,
+                               struct panfrost_resource *rsrc)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        if (bo->cached || (bo->flags & (PAN_BO_SHARED | PAN_BO_SPARSE)) ||
+            (rsrc->base.flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) ||
+            bo->size > PAN_CACHED_BUFFER_MAX_SIZE)
+                return;
+
+        if (++rsrc->cpu_reads < PAN_CACHED_READ_THRESHOLD)
+                return;
+
+        uint32_t flags = (bo->flags & ~PAN_BO_DELAY_MMAP) | PAN_BO_CACHEABLE;
+        struct panfrost_bo *newbo =
+                panfrost_bo_create(dev, bo->size, flags, bo->label);
+
+        /* Keep the uncached BO on failure, and don't try again */
+        if (!newbo || !newbo->cached) {
+                if (newbo)
+                        panfrost_bo_unreference(newbo);
+
+                rsrc->cpu_reads = 0;
+                return;
+        }
+
+        perf_debug(dev, "Moving CPU-read buffer to cached memory");
+
+        memcpy(newbo->ptr.cpu, bo->ptr.cpu, bo->size);
+        panfrost_bo_mem_clean(newbo, 0, newbo->size);
+
+        panfrost_dirty_state_all(ctx);
+        panfrost_resource_swap_bo(ctx, rsrc, newbo);
+}
+
+/* Write-only maps of tiled textures at least this large may be tiled by the
+ * GPU with a blit from a linear staging resource */
+
+#define PAN_GPU_TILING_MIN_SIZE (1024 * 1024)
+
+/* Decide whether a map of a u-interleaved texture should go through a linear
+ * staging resource tiled by the GPU on unmap, rather than a CPU buffer tiled
+ * in software. This pays off when the box is large enough to amortize the
+ * blit and either the GPU still uses the resource, as the blit is queued
+ * after those accesses instead of waiting for them, or the GPU has little
+ * work queued from this context. */
+
+static bool
+panfrost_should_tile_on_gpu(struct panfrost_context *ctx,
+                            struct panfrost_resource *rsrc,
+                            unsigned usage, const struct pipe_box *box)
+{
+        struct pipe_screen *pscreen = ctx->base.screen;
+        enum pipe_format format = rsrc->base.format;
+
+        if (rsrc->image.layout.modifier != DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED)
+                return false;
+
+        /* Reads would need a detiling blit and a wait at map time */
+        if ((usage & (PIPE_MAP_READ | PIPE_MAP_WRITE)) != PIPE_MAP_WRITE)
+                return false;
+
+        if (usage & (PIPE_MAP_UNSYNCHRONIZED | PIPE_MAP_PERSISTENT |
+                     PIPE_MAP_COHERENT))
+                return false;
+
+        if (rsrc->separate_stencil || util_format_is_depth_or_stencil(format) ||
+            util_format_is_compressed(format))
+                return false;
+
+        if (!pscreen->is_format_supported(pscreen, pan_blit_format(format),
+                                          rsrc->base.target,
+                                          rsrc->base.nr_samples,
+                                          rsrc->base.nr_storage_samples,
+                                          PIPE_BIND_RENDER_TARGET))
+                return false;
+
+        size_t size = (size_t) util_format_get_2d_size(format,
+                        util_format_get_stride(format, box->width),
+                        box->height) * box->depth;
+
+        if (size < PAN_GPU_TILING_MIN_SIZE)
+                return false;
+
+        if (rsrc->track.nr_users > 0 ||
+            !panfrost_bo_wait(rsrc->image.data.bo, 0, true))
+                return true;
+
+        return BITSET_COUNT(ctx->batches.active) <= 1;
+}
+
 static void *
 panfrost_ptr_map(struct pipe_context *pctx,
                       struct pipe_resource *resource,
@@ -1088,7 +1658,13 @@ panfrost_ptr_map(struct pipe_context *pctx,
         if ((usage & PIPE_MAP_DIRECTLY) && rsrc->image.layout.modifier != DRM_FORMAT_MOD_LINEAR)
                 return NULL;
 
-        struct panfrost_transfer *transfer = rzalloc(pctx, struct panfrost_transfer);
+        /* Unsynchronized buffer maps are done from the application thread
+         * when the context is threaded, so they get a pool of their own */
+        struct panfrost_transfer *transfer =
+                (usage & TC_TRANSFER_MAP_THREADED_UNSYNC) ?
+                slab_zalloc(&ctx->transfer_pool_unsync) :
+                slab_zalloc(&ctx->transfer_pool);
+
         transfer->base.level = level;
         transfer->base.usage = usage;
         transfer->base.box = *box;
@@ -1096,11 +1672,20 @@ panfrost_ptr_map(struct pipe_context *pctx,
         pipe_resource_reference(&transfer->base.resource, resource);
         *out_transfer = &transfer->base;
 
-        if (usage & PIPE_MAP_WRITE)
+        if (usage & PIPE_MAP_WRITE) {
                 rsrc->constant_stencil = false;
+                rsrc->afbc_promote.uploaded = true;
+                rsrc->afbc_promote.samples = 0;
+                panfrost_resource_contents_changed(rsrc);
 
-        /* We don't have s/w routines for AFBC, so use a staging texture */
-        if (drm_is_afbc(rsrc->image.layout.modifier)) {
+                if (usage & PIPE_MAP_PERSISTENT)
+                        rsrc->persistent_write = true;
+        }
+
+        /* We don't have s/w routines for AFBC, so use a staging texture. Large
+         * tiled writes may also be cheaper to tile on the GPU. */
+        if (drm_is_afbc(rsrc->image.layout.modifier) ||
+            panfrost_should_tile_on_gpu(ctx, rsrc, usage, box)) {
                 struct panfrost_resource *staging = pan_alloc_staging(ctx, rsrc, level, box);
                 assert(staging);
 
@@ -1137,23 +1722,34 @@ panfrost_ptr_map(struct pipe_context *pctx,
         }
 
         /* If we haven't already mmaped, now's the time */
+        panfrost_resource_make_resident(rsrc);
         panfrost_bo_mmap(bo);
 
         if (dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC))
                 pandecode_inject_mmap(bo->ptr.gpu, bo->ptr.cpu, bo->size, NULL);
 
-        /* Upgrade writes to uninitialized ranges to UNSYNCHRONIZED */
+        /* Upgrade writes to uninitialized ranges to UNSYNCHRONIZED. The
+         * threaded context already did this with its own view of the range
+         * when it asks us not to. */
         if ((usage & PIPE_MAP_WRITE) &&
+            !(usage & TC_TRANSFER_MAP_NO_INFER_UNSYNCHRONIZED) &&
             resource->target == PIPE_BUFFER &&
             !util_ranges_intersect(&rsrc->valid_buffer_range, box->x, box->x + box->width)) {
 
                 usage |= PIPE_MAP_UNSYNCHRONIZED;
         }
 
+        /* The threaded context invalidates buffers itself, through
+         * replace_buffer_storage, and doesn't expect the storage to change
+         * behind its back. */
+        if (usage & TC_TRANSFER_MAP_NO_INVALIDATE)
+                usage &= ~PIPE_MAP_DISCARD_WHOLE_RESOURCE;
+
         /* Upgrade DISCARD_RANGE to WHOLE_RESOURCE if the whole resource is
          * being mapped.
          */
         if ((usage & PIPE_MAP_DISCARD_RANGE) &&
+            !(usage & TC_TRANSFER_MAP_NO_INVALIDATE) &&
             !(usage & PIPE_MAP_UNSYNCHRONIZED) &&
             !(resource->flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) &&
             panfrost_box_covers_resource(resource, box) &&
@@ -1167,6 +1763,7 @@ panfrost_ptr_map(struct pipe_context *pctx,
 
         if (!create_new_bo &&
             !(usage & PIPE_MAP_UNSYNCHRONIZED) &&
+            !(usage & TC_TRANSFER_MAP_NO_INVALIDATE) &&
             !(resource->flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) &&
             (usage & PIPE_MAP_WRITE) &&
             rsrc->track.nr_users > 0 &&
@@ -1211,9 +1808,9 @@ panfrost_ptr_map(struct pipe_context *pctx,
                         /* When the BO has been imported/exported, we can't
                          * replace it by another one, otherwise the
                          * importer/exporter wouldn't see the change we're
-                         * doing to it.
+                         * doing to it. Sparse BOs carry their commitment.
                          */
-                        if (!(bo->flags & PAN_BO_SHARED))
+                        if (!(bo->flags & (PAN_BO_SHARED | PAN_BO_SPARSE)))
                                 newbo = panfrost_bo_create(dev, bo->size,
                                                            flags, bo->label);
 
@@ -1225,6 +1822,11 @@ panfrost_ptr_map(struct pipe_context *pctx,
 
                                 panfrost_resource_swap_bo(ctx, rsrc, newbo);
 
+                                /* Copying the BO carries the checksums
+                                 * over, otherwise they are garbage */
+                                if (!copy_resource)
+                                        rsrc->valid.crc = false;
+
                                 if (!copy_resource &&
                                     drm_is_afbc(rsrc->image.layout.modifier))
                                         panfrost_resource_init_afbc_headers(rsrc);
@@ -1246,24 +1848,19 @@ panfrost_ptr_map(struct pipe_context *pctx,
                 } else if (usage & PIPE_MAP_READ) {
                         panfrost_flush_writer(ctx, rsrc, "Synchronized read");
                         panfrost_bo_wait(bo, INT64_MAX, false);
+
+                        if (resource->target == PIPE_BUFFER) {
+                                panfrost_buffer_track_cpu_read(ctx, rsrc);
+                                bo = rsrc->image.data.bo;
+                        }
                 }
         } else {
                 /* No flush for writes to uninitialized */
                 cache_inval = false;
         }
 
-        /* TODO: Only the accessed region for textures */
-        if (cache_inval) {
-                size_t offset = 0;
-                size_t size = bo->size;
-
-                if (resource->target == PIPE_BUFFER) {
-                        offset = box->x * (size_t) bytes_per_block;
-                        size = box->width * (size_t) bytes_per_block;
-                }
-
-                panfrost_bo_mem_invalidate(bo, offset, size);
-        }
+        if (cache_inval)
+                panfrost_transfer_mem_op(rsrc, level, box, true);
 
         /* For access to compressed textures, we want the (x, y, w, h)
          * region-of-interest in blocks, not pixels. Then we compute the stride
@@ -1276,10 +1873,13 @@ panfrost_ptr_map(struct pipe_context *pctx,
         if (rsrc->image.layout.modifier == DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED) {
                 transfer->base.stride = box_blocks.width * bytes_per_block;
                 transfer->base.layer_stride = transfer->base.stride * box_blocks.height;
-                transfer->map = ralloc_size(transfer, transfer->base.layer_stride * box->depth);
+                transfer->map = malloc(transfer->base.layer_stride * box->depth);
 
-                if (usage & PIPE_MAP_READ)
+                if (usage & PIPE_MAP_READ) {
                         panfrost_load_tiled_images(transfer, rsrc);
+                        ctx->cpu_tiling_bytes += transfer->base.layer_stride *
+                                                 box->depth;
+                }
 
                 return transfer->map;
         } else {
@@ -1293,8 +1893,12 @@ panfrost_ptr_map(struct pipe_context *pctx,
 
                 unsigned dpw = PIPE_MAP_DIRECTLY | PIPE_MAP_WRITE | PIPE_MAP_PERSISTENT;
 
-                if ((usage & dpw) == dpw && rsrc->index_cache)
+                if ((usage & dpw) == dpw && rsrc->index_cache) {
+                        pipe_resource_reference(&transfer->base.resource, NULL);
+                        slab_free(&ctx->transfer_pool, transfer);
+                        *out_transfer = NULL;
                         return NULL;
+                }
 
                 transfer->base.stride = rsrc->image.layout.slices[level].row_stride;
                 transfer->base.layer_stride =
@@ -1304,7 +1908,7 @@ panfrost_ptr_map(struct pipe_context *pctx,
                  * initialized (maybe), so be conservative */
 
                 if (usage & PIPE_MAP_WRITE) {
-                        BITSET_SET(rsrc->valid.data, level);
+                        panfrost_resource_set_valid(rsrc, level);
                         panfrost_minmax_cache_invalidate(rsrc->index_cache, &transfer->base);
                 }
 
@@ -1323,7 +1927,8 @@ pan_resource_modifier_convert(struct panfrost_context *ctx,
 {
         assert(!rsrc->modifier_constant);
 
-        perf_debug_ctx(ctx, "Disabling AFBC with a blit. Reason: %s", reason);
+        perf_debug_ctx(ctx, "Converting modifier with a blit. Reason: %s", reason);
+        ++ctx->resource_conversions;
 
         struct pipe_resource *tmp_prsrc =
                 panfrost_resource_create_with_modifier(
@@ -1388,6 +1993,508 @@ pan_legalize_afbc_format(struct panfrost_context *ctx,
                         "Reinterpreting AFBC surface as incompatible format");
 }
 
+/* Sequence numbers are global rather than per resource, so a copy keyed on
+ * one can't match a later resource allocated at the same address. */
+
+static uint64_t panfrost_contents_seqnum;
+
+void
+panfrost_resource_contents_changed(struct panfrost_resource *rsrc)
+{
+        rsrc->contents_seqnum = p_atomic_inc_return(&panfrost_contents_seqnum);
+}
+
+/* Mark the part of a slice written by a render pass as holding valid data.
+ * If nothing was written to the slice before, only that part holds valid
+ * data, so later render passes can skip preloading the rest. Shared
+ * resources may be written behind our back, so they are always whole. */
+
+void
+panfrost_resource_add_valid_region(struct panfrost_resource *rsrc,
+                                   unsigned level,
+                                   const struct pipe_scissor_state *region)
+{
+        struct pipe_scissor_state *valid = &rsrc->valid.region[level];
+
+        if (rsrc->base.bind & PAN_BIND_SHARED_MASK) {
+                panfrost_resource_set_valid(rsrc, level);
+                return;
+        }
+
+        if (!BITSET_TEST(rsrc->valid.data, level)) {
+                BITSET_SET(rsrc->valid.data, level);
+                BITSET_SET(rsrc->valid.partial, level);
+                *valid = *region;
+        } else if (BITSET_TEST(rsrc->valid.partial, level)) {
+                valid->minx = MIN2(valid->minx, region->minx);
+                valid->miny = MIN2(valid->miny, region->miny);
+                valid->maxx = MAX2(valid->maxx, region->maxx);
+                valid->maxy = MAX2(valid->maxy, region->maxy);
+        } else {
+                return;
+        }
+
+        if (!valid->minx && !valid->miny &&
+            valid->maxx >= u_minify(rsrc->base.width0, level) &&
+            valid->maxy >= u_minify(rsrc->base.height0, level))
+                BITSET_CLEAR(rsrc->valid.partial, level);
+}
+
+/* Applications create and destroy views of the same resources constantly, so
+ * the last few sampler view descriptors of a resource are kept for reuse. An
+ * entry holds a reference on the memory of its descriptors. */
+
+static struct panfrost_view_cache *
+panfrost_view_cache(struct panfrost_resource *rsrc)
+{
+        struct panfrost_view_cache *cache = p_atomic_read(&rsrc->view_cache);
+
+        if (cache)
+                return cache;
+
+        cache = CALLOC_STRUCT(panfrost_view_cache);
+        if (!cache)
+                return NULL;
+
+        simple_mtx_init(&cache->lock, mtx_plain);
+
+        /* Another context may have got there first */
+        struct panfrost_view_cache *old =
+                p_atomic_cmpxchg_ptr(&rsrc->view_cache, NULL, cache);
+
+        if (old) {
+                simple_mtx_destroy(&cache->lock);
+                free(cache);
+                return old;
+        }
+
+        return cache;
+}
+
+bool
+panfrost_view_cache_get(struct panfrost_resource *rsrc,
+                        const struct panfrost_view_cache_key *key,
+                        struct panfrost_pool_ref *state,
+                        void *descriptor, size_t descriptor_size)
+{
+        struct panfrost_view_cache *cache = p_atomic_read(&rsrc->view_cache);
+        bool found = false;
+
+        if (!cache)
+                return false;
+
+        assert(descriptor_size <= sizeof(cache->entries[0].descriptor));
+        simple_mtx_lock(&cache->lock);
+
+        for (unsigned i = 0; i < PAN_VIEW_CACHE_SIZE; ++i) {
+                struct panfrost_view_cache_entry *entry = &cache->entries[i];
+
+                if (entry->state.bo && !memcmp(&entry->key, key, sizeof(*key))) {
+                        panfrost_bo_reference(entry->state.bo);
+                        *state = entry->state;
+                        memcpy(descriptor, entry->descriptor, descriptor_size);
+                        found = true;
+                        break;
+                }
+        }
+
+        simple_mtx_unlock(&cache->lock);
+        return found;
+}
+
+void
+panfrost_view_cache_put(struct panfrost_resource *rsrc,
+                        const struct panfrost_view_cache_key *key,
+                        struct panfrost_pool_ref state,
+                        const void *descriptor, size_t descriptor_size)
+{
+        struct panfrost_view_cache *cache = panfrost_view_cache(rsrc);
+
+        if (!cache)
+                return;
+
+        assert(descriptor_size <= sizeof(cache->entries[0].descriptor));
+        simple_mtx_lock(&cache->lock);
+
+        /* Entries are replaced in creation order */
+        struct panfrost_view_cache_entry *entry =
+                &cache->entries[cache->next++ % PAN_VIEW_CACHE_SIZE];
+
+        panfrost_bo_unreference(entry->state.bo);
+        panfrost_bo_reference(state.bo);
+
+        entry->key = *key;
+        entry->state = state;
+        memcpy(entry->descriptor, descriptor, descriptor_size);
+
+        simple_mtx_unlock(&cache->lock);
+}
+
+/* Textures uploaded by the CPU don't get AFBC when created for streaming, and
+ * lose it when they are streamed to, as every upload needs a blit. Once a
+ * texture has been sampled for a while without further uploads, it is likely
+ * static, so convert it to AFBC with a blit queued on the GPU. */
+
+void
+panfrost_resource_track_sample(struct panfrost_context *ctx,
+                               struct panfrost_resource *rsrc)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        if (!rsrc->afbc_promote.uploaded || !rsrc->modifier_auto ||
+            drm_is_afbc(rsrc->image.layout.modifier))
+                return;
+
+        if (++rsrc->afbc_promote.samples < PAN_AFBC_PROMOTE_THRESHOLD)
+                return;
+
+        /* Only consider it again after another upload */
+        rsrc->afbc_promote.uploaded = false;
+
+        if (unlikely(dev->debug & PAN_DBG_LINEAR) ||
+            (rsrc->image.data.bo->flags & PAN_BO_SHARED) ||
+            rsrc->separate_stencil ||
+            !panfrost_can_afbc(dev, rsrc, rsrc->base.format))
+                return;
+
+        rsrc->modifier_constant = false;
+        pan_resource_modifier_convert(ctx, rsrc,
+                        panfrost_afbc_modifier(dev, rsrc),
+                        "Texture no longer uploaded to");
+
+        /* Allow going back to linear if streaming resumes */
+        rsrc->modifier_constant = false;
+        rsrc->modifier_updates = 0;
+}
+
+/* AFBC body space is allocated for the worst case, every superblock being
+ * uncompressed. Render targets that end up only being sampled can have their
+ * superblocks packed back to back to save memory and bandwidth. This is done
+ * on a CPU thread once the GPU is idle, and only for single-surface 2D images
+ * with 16x16 superblocks to keep the layout trivial: headers, then the body. */
+
+/* Each 16-byte header is a 32-bit body offset relative to the headers,
+ * followed by sixteen 6-bit sub-block sizes. A zero offset encodes a solid
+ * colour superblock without a body, and a size of 1 an uncompressed
+ * sub-block. */
+
+static unsigned
+panfrost_afbc_superblock_body_size(const uint32_t *header, unsigned bpp)
+{
+        if (header[0] == 0)
+                return 0;
+
+        unsigned size = 0;
+
+        for (unsigned i = 0; i < 16; ++i) {
+                unsigned bit = 32 + (i * 6);
+                uint64_t word = header[bit / 32];
+
+                if ((bit / 32) < 3)
+                        word |= ((uint64_t) header[(bit / 32) + 1]) << 32;
+
+                unsigned sz = (word >> (bit % 32)) & 0x3f;
+                size += (sz == 1) ? (16 * bpp) : sz;
+        }
+
+        return size;
+}
+
+static bool
+panfrost_afbc_can_pack(struct panfrost_device *dev,
+                       struct panfrost_resource *rsrc)
+{
+        const struct pan_image_layout *layout = &rsrc->image.layout;
+
+        return (dev->debug & PAN_DBG_AFBC_PACK) &&
+               drm_is_afbc(layout->modifier) &&
+               !(layout->modifier & AFBC_FORMAT_MOD_SPLIT) &&
+               panfrost_afbc_superblock_width(layout->modifier) == 16 &&
+               panfrost_afbc_superblock_height(layout->modifier) == 16 &&
+               panfrost_is_2d(rsrc) && layout->nr_slices == 1 &&
+               layout->array_size == 1 && layout->nr_samples == 1 &&
+               !util_format_is_compressed(layout->format) &&
+               !rsrc->separate_stencil && !rsrc->modifier_constant &&
+               !(rsrc->base.bind & PAN_BIND_SHARED_MASK) &&
+               !(rsrc->image.data.bo->flags & PAN_BO_SHARED);
+}
+
+/* Copy the superblock bodies of an AFBC surface, placing them either tightly
+ * (pack) or at their worst-case position (unpack). Returns the size of the
+ * body written, or 0 if a header is out of bounds. */
+
+static unsigned
+panfrost_afbc_copy_bodies(uint8_t *dst, const uint8_t *src, size_t src_size,
+                          unsigned header_size, unsigned nr_superblocks,
+                          unsigned bpp, bool pack)
+{
+        unsigned offset = header_size;
+
+        memcpy(dst, src, header_size);
+
+        for (unsigned i = 0; i < nr_superblocks; ++i) {
+                uint32_t *header = (uint32_t *) (dst + (i * 16));
+                unsigned size = panfrost_afbc_superblock_body_size(header, bpp);
+
+                if (!size)
+                        continue;
+
+                if (header[0] + size > src_size)
+                        return 0;
+
+                unsigned new_offset = pack ? offset :
+                        header_size + (i * 256 * bpp);
+
+                memcpy(dst + new_offset, src + header[0], size);
+                header[0] = new_offset;
+                offset = new_offset + ALIGN_POT(size, 16);
+        }
+
+        return offset - header_size;
+}
+
+/* Packing reads back the whole surface, so it runs on the tiling queue and is
+ * applied on a later bind once done. The job references the BO it reads, and
+ * its result is dropped if the resource got another BO in the meantime. */
+
+struct panfrost_afbc_pack_job {
+        struct util_queue_fence fence;
+
+        struct panfrost_device *dev;
+        struct panfrost_bo *src;
+        unsigned offset, header_size, nr_superblocks, bpp, max_body_size;
+
+        /* Packed BO and its body size, NULL if packing failed or isn't worth
+         * it, in which case worth is cleared for the latter */
+        struct panfrost_bo *dst;
+        unsigned body_size;
+        bool worth;
+};
+
+static void
+panfrost_afbc_pack_job_execute(void *data, void *gdata, int thread_index)
+{
+        struct panfrost_afbc_pack_job *job = data;
+        struct panfrost_bo *bo = job->src;
+
+        panfrost_bo_mem_invalidate(bo, 0, bo->size);
+
+        const uint8_t *src = bo->ptr.cpu + job->offset;
+        size_t src_size = bo->size - job->offset;
+        unsigned body_size = 0;
+
+        for (unsigned i = 0; i < job->nr_superblocks; ++i) {
+                const uint32_t *header = (const uint32_t *) (src + (i * 16));
+                unsigned size = panfrost_afbc_superblock_body_size(header, job->bpp);
+
+                if (size && header[0] + size > src_size) {
+                        body_size = ~0;
+                        break;
+                }
+
+                body_size += ALIGN_POT(size, 16);
+        }
+
+        /* Don't bother unless at least a quarter of the body is saved */
+        if (body_size > (job->max_body_size / 4) * 3) {
+                job->worth = false;
+                return;
+        }
+
+        unsigned size = ALIGN_POT(job->offset + job->header_size + body_size,
+                                  4096);
+        struct panfrost_bo *newbo =
+                panfrost_bo_create(job->dev, size,
+                                   bo->flags & ~(PAN_BO_DELAY_MMAP | PAN_BO_SPARSE),
+                                   bo->label);
+
+        if (!newbo)
+                return;
+
+        panfrost_afbc_copy_bodies(newbo->ptr.cpu + job->offset, src,
+                                  src_size, job->header_size,
+                                  job->nr_superblocks, job->bpp, true);
+        panfrost_bo_mem_clean(newbo, 0, newbo->size);
+
+        job->dst = newbo;
+        job->body_size = body_size;
+}
+
+static void
+panfrost_afbc_pack_job_free(struct panfrost_resource *rsrc)
+{
+        struct panfrost_afbc_pack_job *job = rsrc->afbc_pack.job;
+
+        util_queue_fence_destroy(&job->fence);
+        panfrost_bo_unreference(job->src);
+        free(job);
+
+        rsrc->afbc_pack.job = NULL;
+}
+
+/* Drop a pending pack, before the resource is written or destroyed */
+
+void
+panfrost_resource_cancel_afbc_pack(struct panfrost_resource *rsrc)
+{
+        struct panfrost_afbc_pack_job *job = rsrc->afbc_pack.job;
+
+        if (!job)
+                return;
+
+        util_queue_fence_wait(&job->fence);
+
+        if (job->dst)
+                panfrost_bo_unreference(job->dst);
+
+        panfrost_afbc_pack_job_free(rsrc);
+}
+
+static void
+panfrost_resource_finish_afbc_pack(struct panfrost_context *ctx,
+                                   struct panfrost_resource *rsrc)
+{
+        struct panfrost_afbc_pack_job *job = rsrc->afbc_pack.job;
+        struct pan_image_layout *layout = &rsrc->image.layout;
+        struct pan_image_slice_layout *slice = &layout->slices[0];
+        struct panfrost_bo *newbo = job->dst;
+
+        if (!job->worth)
+                rsrc->afbc_pack.reads = UINT16_MAX;
+
+        /* The resource was converted or reallocated while packing */
+        if (newbo && (rsrc->image.data.bo != job->src ||
+                      !panfrost_afbc_can_pack(pan_device(ctx->base.screen), rsrc))) {
+                panfrost_bo_unreference(newbo);
+                newbo = NULL;
+        }
+
+        unsigned header_size = job->header_size;
+        unsigned body_size = job->body_size;
+        panfrost_afbc_pack_job_free(rsrc);
+
+        if (!newbo)
+                return;
+
+        perf_debug_ctx(ctx, "Packed AFBC body from %u to %u bytes",
+                       slice->afbc.body_size, body_size);
+
+        slice->afbc.body_size = body_size;
+        slice->afbc.surface_stride = header_size + body_size;
+        slice->surface_stride = header_size + body_size;
+        slice->size = header_size + body_size;
+        slice->crc = (struct pan_image_slice_crc) { 0 };
+        layout->crc = false;
+        layout->array_stride = ALIGN_POT(slice->offset + slice->size, 64);
+        layout->data_size = newbo->size;
+
+        rsrc->valid.crc = false;
+        rsrc->afbc_pack.packed = true;
+
+        panfrost_dirty_state_all(ctx);
+        panfrost_resource_swap_bo(ctx, rsrc, newbo);
+}
+
+void
+panfrost_resource_try_pack_afbc(struct panfrost_context *ctx,
+                                struct panfrost_resource *rsrc)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct util_queue *queue = &pan_screen(ctx->base.screen)->tiling_queue;
+        struct pan_image_layout *layout = &rsrc->image.layout;
+        struct pan_image_slice_layout *slice = &layout->slices[0];
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        if (rsrc->afbc_pack.job) {
+                if (util_queue_fence_is_signalled(&rsrc->afbc_pack.job->fence))
+                        panfrost_resource_finish_afbc_pack(ctx, rsrc);
+
+                return;
+        }
+
+        if (rsrc->afbc_pack.packed || !panfrost_afbc_can_pack(dev, rsrc) ||
+            !util_queue_is_initialized(queue))
+                return;
+
+        if (rsrc->afbc_pack.reads == UINT16_MAX ||
+            ++rsrc->afbc_pack.reads < PAN_AFBC_PACK_THRESHOLD)
+                return;
+
+        /* Only pack once the render target is settled, don't wait for it */
+        if (rsrc->track.nr_writers > 0 || !panfrost_bo_wait(bo, 0, true))
+                return;
+
+        struct panfrost_afbc_pack_job *job = calloc(1, sizeof(*job));
+
+        if (!job)
+                return;
+
+        unsigned bpp = util_format_get_blocksize(layout->format);
+
+        panfrost_resource_make_resident(rsrc);
+        panfrost_bo_mmap(bo);
+        panfrost_bo_reference(bo);
+
+        *job = (struct panfrost_afbc_pack_job) {
+                .dev = dev,
+                .src = bo,
+                .offset = slice->offset,
+                .header_size = slice->afbc.header_size,
+                .nr_superblocks = slice->afbc.body_size / (256 * bpp),
+                .bpp = bpp,
+                .max_body_size = slice->afbc.body_size,
+                .worth = true,
+        };
+
+        util_queue_fence_init(&job->fence);
+        rsrc->afbc_pack.job = job;
+
+        util_queue_add_job(queue, job, &job->fence,
+                           panfrost_afbc_pack_job_execute, NULL, 0);
+}
+
+void
+panfrost_resource_unpack_afbc(struct panfrost_context *ctx,
+                              struct panfrost_resource *rsrc)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+        const struct pan_image_slice_layout *packed = &rsrc->image.layout.slices[0];
+        unsigned header_size = packed->afbc.header_size;
+        unsigned offset = packed->offset;
+
+        assert(rsrc->afbc_pack.packed);
+
+        perf_debug_ctx(ctx, "Unpacking AFBC body for writing");
+
+        /* The packed body is only read by the GPU, so it can be copied out
+         * without waiting. Restore the worst-case layout around it. */
+        bool modifier_constant = rsrc->modifier_constant;
+        panfrost_resource_setup(dev, rsrc, rsrc->image.layout.modifier,
+                                rsrc->image.layout.format);
+        rsrc->modifier_constant = modifier_constant;
+
+        const struct pan_image_layout *layout = &rsrc->image.layout;
+        unsigned bpp = util_format_get_blocksize(layout->format);
+        unsigned nr_superblocks = layout->slices[0].afbc.body_size / (256 * bpp);
+
+        struct panfrost_bo *newbo =
+                panfrost_bo_create(dev, layout->data_size,
+                                   bo->flags & ~PAN_BO_DELAY_MMAP, bo->label);
+        assert(newbo);
+
+        panfrost_afbc_copy_bodies(newbo->ptr.cpu + offset, bo->ptr.cpu + offset,
+                                  bo->size - offset, header_size,
+                                  nr_superblocks, bpp, false);
+        panfrost_bo_mem_clean(newbo, 0, newbo->size);
+
+        rsrc->valid.crc = false;
+        rsrc->afbc_pack.packed = false;
+
+        panfrost_dirty_state_all(ctx);
+        panfrost_resource_swap_bo(ctx, rsrc, newbo);
+}
+
 static bool
 panfrost_should_linear_convert(struct panfrost_device *dev,
                                struct panfrost_resource *prsrc,
@@ -1426,6 +2533,44 @@ panfrost_should_linear_convert(struct panfrost_device *dev,
         }
 }
 
+/* A CPU write leaves the checksums of the tiles it touches stale: if the GPU
+ * later rendered the old content of such a tile again, the write would be
+ * eliminated, keeping what the CPU wrote. Rather than dropping all checksums,
+ * overwrite those of the written tiles with a value the hardware is never
+ * expected to produce, so only these tiles are written next time. */
+
+static void
+panfrost_invalidate_crc_box(struct panfrost_resource *rsrc,
+                            const struct pipe_transfer *transfer)
+{
+        const struct pan_image_slice_layout *slice =
+                &rsrc->image.layout.slices[transfer->level];
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        if (!rsrc->valid.crc)
+                return;
+
+        /* The GPU may be using the checksums of unsynchronized maps, and
+         * persistent maps are written after they are unmapped. */
+        if (!bo->ptr.cpu ||
+            (transfer->usage & (PIPE_MAP_UNSYNCHRONIZED | PIPE_MAP_PERSISTENT))) {
+                rsrc->valid.crc = false;
+                return;
+        }
+
+        const struct pipe_box *box = &transfer->box;
+        unsigned minx = box->x / 16, maxx = DIV_ROUND_UP(box->x + box->width, 16);
+        unsigned miny = box->y / 16, maxy = DIV_ROUND_UP(box->y + box->height, 16);
+        uint8_t *crc = bo->ptr.cpu + slice->crc.offset;
+
+        for (unsigned y = miny; y < maxy; ++y)
+                memset(crc + (y * slice->crc.stride) + (minx * 8), 0xff,
+                       (maxx - minx) * 8);
+
+        panfrost_bo_mem_clean(bo, slice->crc.offset + (miny * slice->crc.stride),
+                              (maxy - miny) * slice->crc.stride);
+}
+
 static void
 panfrost_ptr_unmap(struct pipe_context *pctx,
                         struct pipe_transfer *transfer)
@@ -1436,17 +2581,21 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
         struct panfrost_resource *prsrc = (struct panfrost_resource *) transfer->resource;
         struct panfrost_device *dev = pan_device(pctx->screen);
 
-        if (transfer->usage & PIPE_MAP_WRITE)
-                prsrc->valid.crc = false;
+        bool staged = trans->staging.rsrc;
+
+        /* Staged writes are blitted, which keeps the checksums up to date */
+        if (!staged && (transfer->usage & PIPE_MAP_WRITE))
+                panfrost_invalidate_crc_box(prsrc, transfer);
 
-        /* AFBC will use a staging resource. `initialized` will be set when the
-         * fragment job is created; this is deferred to prevent useless surface
-         * reloads that can cascade into DATA_INVALID_FAULTs due to reading
-         * malformed AFBC data if uninitialized */
+        if (transfer->usage & PIPE_MAP_WRITE)
+                panfrost_resource_contents_changed(prsrc);
 
-        bool afbc = trans->staging.rsrc;
+        /* AFBC and GPU-tiled writes use a staging resource. `initialized` will
+         * be set when the fragment job is created; this is deferred to prevent
+         * useless surface reloads that can cascade into DATA_INVALID_FAULTs
+         * due to reading malformed AFBC data if uninitialized */
 
-        if (afbc) {
+        if (staged) {
                 if (transfer->usage & PIPE_MAP_WRITE) {
                         struct panfrost_resource *trans_rsrc = pan_resource(trans->staging.rsrc);
                         struct panfrost_bo *trans_bo = trans_rsrc->image.data.bo;
@@ -1466,7 +2615,7 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
                                 pan_blit_from_staging(pctx, trans);
                                 panfrost_flush_batches_accessing_rsrc(pan_context(pctx),
                                                 pan_resource(trans->staging.rsrc),
-                                                "AFBC write staging blit");
+                                                "Staging write blit");
                         }
                 }
 
@@ -1478,15 +2627,17 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
                 struct panfrost_bo *bo = prsrc->image.data.bo;
 
                 if (transfer->usage & PIPE_MAP_WRITE) {
-                        BITSET_SET(prsrc->valid.data, transfer->level);
+                        panfrost_resource_set_valid(prsrc, transfer->level);
 
                         if (prsrc->image.layout.modifier == DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED) {
                                 if (panfrost_should_linear_convert(dev, prsrc, transfer)) {
                                         panfrost_resource_setup(dev, prsrc, DRM_FORMAT_MOD_LINEAR,
                                                                 prsrc->image.layout.format);
                                         if (prsrc->image.layout.data_size > bo->size) {
-                                                /* We want the BO to be MMAPed. */
-                                                uint32_t flags = bo->flags & ~PAN_BO_DELAY_MMAP;
+                                                /* We want the BO to be MMAPed,
+                                                 * and backed for the CPU. */
+                                                uint32_t flags = bo->flags &
+                                                                 ~(PAN_BO_DELAY_MMAP | PAN_BO_SPARSE);
                                                 const char *label = bo->label;
 
                                                 panfrost_bo_unreference(bo);
@@ -1507,30 +2658,21 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
                                                 0, 0);
                                 } else {
                                         panfrost_store_tiled_images(trans, prsrc);
+                                        pan_context(pctx)->cpu_tiling_bytes +=
+                                                transfer->layer_stride *
+                                                transfer->box.depth;
                                 }
                         }
                 }
+
+                free(trans->map);
         }
 
-        /* TODO: Only the accessed region */
-        /* It is important to not do this for AFBC resources, or else the
+        /* It is important to not do this for staged writes, or else the
          * clean might overwrite the result of the blit. */
-        if (!afbc && (transfer->usage & PIPE_MAP_WRITE)) {
-                size_t offset = 0;
-                size_t size = prsrc->image.data.bo->size;
-
-                /* TODO: Don't recalculate */
-                if (prsrc->base.target == PIPE_BUFFER) {
-                        enum pipe_format format = prsrc->image.layout.format;
-                        int bytes_per_block = util_format_get_blocksize(format);
-
-                        offset = transfer->box.x * (size_t) bytes_per_block;
-                        size = transfer->box.width * (size_t) bytes_per_block;
-                }
-
-                panfrost_bo_mem_clean(prsrc->image.data.bo,
-                                      offset, size);
-        }
+        if (!staged && (transfer->usage & PIPE_MAP_WRITE))
+                panfrost_transfer_mem_op(prsrc, transfer->level,
+                                         &transfer->box, false);
 
         util_range_add(&prsrc->base, &prsrc->valid_buffer_range,
                        transfer->box.x,
@@ -1541,8 +2683,7 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
         /* Derefence the resource */
         pipe_resource_reference(&transfer->resource, NULL);
 
-        /* Transfer itself is RALLOCed at the moment */
-        ralloc_free(transfer);
+        slab_free(&pan_context(pctx)->transfer_pool, transfer);
 }
 
 // TODO: does this need to be changed for cached resources?
@@ -1558,29 +2699,135 @@ panfrost_ptr_flush_region(struct pipe_context *pctx,
                                transfer->box.x + box->x,
                                transfer->box.x + box->x + box->width);
         } else {
-                BITSET_SET(rsc->valid.data, transfer->level);
+                panfrost_resource_set_valid(rsc, transfer->level);
         }
 }
 
+/* Called by the threaded context when it invalidated a buffer by allocating
+ * fresh storage for it, to make the original resource use that storage */
+
+void
+panfrost_replace_buffer_storage(struct pipe_context *pctx,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src,
+                                unsigned num_rebinds,
+                                uint32_t rebind_mask,
+                                uint32_t delete_buffer_id)
+{
+        struct panfrost_context *ctx = pan_context(pctx);
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+        struct panfrost_resource *rdst = pan_resource(dst);
+        struct panfrost_resource *rsrc = pan_resource(src);
+
+        assert(dst->target == PIPE_BUFFER && src->target == PIPE_BUFFER);
+
+        panfrost_bo_reference(rsrc->image.data.bo);
+        panfrost_resource_swap_bo(ctx, rdst, rsrc->image.data.bo);
+
+        /* Make sure we re-emit any descriptors using this resource */
+        panfrost_dirty_state_all(ctx);
+
+        /* The new storage holds nothing yet */
+        util_range_set_empty(&rdst->valid_buffer_range);
+        panfrost_resource_contents_changed(rdst);
+        panfrost_minmax_cache_invalidate_range(rdst->index_cache, 0,
+                                               dst->width0);
+
+        if (delete_buffer_id)
+                util_idalloc_mt_free(&screen->buffer_ids, delete_buffer_id);
+}
+
+/* Called by the threaded context from the application thread, to decide
+ * whether a map can skip the driver thread. The tracking is only read, so a
+ * stale answer just means a needless synchronization or a GPU wait. */
+
+bool
+panfrost_resource_busy(struct pipe_screen *pscreen,
+                       struct pipe_resource *prsrc,
+                       unsigned usage)
+{
+        struct panfrost_resource *rsrc = pan_resource(prsrc);
+        bool write = usage & PIPE_MAP_WRITE;
+
+        if (rsrc->track.nr_writers > 0 || (write && rsrc->track.nr_users > 0))
+                return true;
+
+        return !panfrost_bo_wait(rsrc->image.data.bo, 0, write);
+}
+
 static void
 panfrost_invalidate_resource(struct pipe_context *pctx, struct pipe_resource *prsrc)
 {
         struct panfrost_context *ctx = pan_context(pctx);
-        struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
         struct panfrost_resource *rsrc = pan_resource(prsrc);
 
         rsrc->constant_stencil = true;
 
         /* Handle the glInvalidateFramebuffer case */
-        if (batch->key.zsbuf && batch->key.zsbuf->texture == prsrc)
-                batch->resolve &= ~PIPE_CLEAR_DEPTHSTENCIL;
+        panfrost_batch_discard_rsrc(ctx, rsrc);
+
+        /* The contents are undefined from now on, so the next render pass
+         * drawing to the resource without clearing it needn't preload it.
+         * Deferred renderers invalidating their G-buffer after the lighting
+         * pass then neither write it out nor read it back every frame. */
+        if (prsrc->target != PIPE_BUFFER) {
+                BITSET_ZERO(rsrc->valid.data);
+                BITSET_ZERO(rsrc->valid.partial);
+        }
+}
 
-        for (unsigned i = 0; i < batch->key.nr_cbufs; ++i) {
-                struct pipe_surface *surf = batch->key.cbufs[i];
+/* Sparse buffers are backed by kbase regions committed on demand. As kbase
+ * only resizes the backing from the start of a region, everything up to the
+ * last committed page is resident, and decommitted pages are only given back
+ * once no later page is committed. */
 
-                if (surf && surf->texture == prsrc)
-                        batch->resolve &= ~(PIPE_CLEAR_COLOR0 << i);
+static bool
+panfrost_resource_commit(struct pipe_context *pctx, struct pipe_resource *prsrc,
+                         unsigned level, struct pipe_box *box, bool commit)
+{
+        struct panfrost_context *ctx = pan_context(pctx);
+        struct panfrost_resource *rsrc = pan_resource(prsrc);
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        assert(prsrc->target == PIPE_BUFFER && level == 0);
+        assert(bo->flags & PAN_BO_SPARSE);
+
+        if (!box->width)
+                return true;
+
+        unsigned first = box->x / PAN_SPARSE_PAGE_SIZE;
+        unsigned last = (box->x + box->width - 1) / PAN_SPARSE_PAGE_SIZE;
+
+        assert(last < rsrc->sparse.nr_pages);
+
+        if (commit)
+                BITSET_SET_RANGE(rsrc->sparse.committed, first, last);
+        else
+                BITSET_CLEAR_RANGE(rsrc->sparse.committed, first, last);
+
+        unsigned resident = rsrc->sparse.nr_pages;
+
+        while (resident && !BITSET_TEST(rsrc->sparse.committed, resident - 1))
+                --resident;
+
+        if (resident == rsrc->sparse.resident)
+                return true;
+
+        /* Don't give pages back under the GPU, they would just fault back
+         * in */
+        if (resident < rsrc->sparse.resident) {
+                panfrost_flush_batches_accessing_rsrc(ctx, rsrc,
+                                                      "Sparse decommit");
+                panfrost_bo_wait(bo, INT64_MAX, true);
         }
+
+        size_t size = MIN2((size_t) resident * PAN_SPARSE_PAGE_SIZE, bo->size);
+
+        if (!panfrost_bo_commit(bo, size))
+                return false;
+
+        rsrc->sparse.resident = resident;
+        return true;
 }
 
 static enum pipe_format
@@ -1602,8 +2849,6 @@ panfrost_generate_mipmap(
 {
         struct panfrost_resource *rsrc = pan_resource(prsrc);
 
-        perf_debug_ctx(pan_context(pctx), "Unoptimized mipmap generation");
-
         /* Generating a mipmap invalidates the written levels, so make that
          * explicit so we don't try to wallpaper them back and end up with
          * u_blitter recursion */
@@ -1612,6 +2857,12 @@ panfrost_generate_mipmap(
         for (unsigned l = base_level + 1; l <= last_level; ++l)
                 BITSET_CLEAR(rsrc->valid.data, l);
 
+        if (panfrost_compute_mipmap(pctx, prsrc, format, base_level,
+                                    last_level, first_layer, last_layer))
+                return true;
+
+        perf_debug_ctx(pan_context(pctx), "Unoptimized mipmap generation");
+
         /* Beyond that, we just delegate the hard stuff. */
 
         bool blit_res = util_gen_mipmap(
@@ -1663,11 +2914,32 @@ panfrost_resource_screen_init(struct pipe_screen *pscreen)
         pscreen->transfer_helper = u_transfer_helper_create(&transfer_vtbl,
                                         U_TRANSFER_HELPER_SEPARATE_Z32S8 |
                                         U_TRANSFER_HELPER_MSAA_MAP);
+
+        /* Leave a core to the application thread doing the transfer, which
+         * handles a band of its own */
+        unsigned nr_threads = MIN2(util_get_cpu_caps()->nr_cpus, 8) - 1;
+
+        if (nr_threads) {
+                util_queue_init(&pan_screen(pscreen)->tiling_queue, "pantile",
+                                64, nr_threads, 0, NULL);
+        }
+
+        slab_create_parent(&pan_screen(pscreen)->transfer_pool,
+                           sizeof(struct panfrost_transfer), 16);
+        util_idalloc_mt_init_tc(&pan_screen(pscreen)->buffer_ids);
 }
+
 void
 panfrost_resource_screen_destroy(struct pipe_screen *pscreen)
 {
+        struct util_queue *queue = &pan_screen(pscreen)->tiling_queue;
+
+        if (util_queue_is_initialized(queue))
+                util_queue_destroy(queue);
+
         u_transfer_helper_destroy(pscreen->transfer_helper);
+        slab_destroy_parent(&pan_screen(pscreen)->transfer_pool);
+        util_idalloc_mt_fini(&pan_screen(pscreen)->buffer_ids);
 }
 
 void
@@ -1686,8 +2958,9 @@ panfrost_resource_context_init(struct pipe_context *pctx)
         pctx->generate_mipmap = panfrost_generate_mipmap;
         pctx->flush_resource = panfrost_flush_resource;
         pctx->invalidate_resource = panfrost_invalidate_resource;
+        pctx->resource_commit = panfrost_resource_commit;
         pctx->transfer_flush_region = u_transfer_helper_transfer_flush_region;
-        pctx->buffer_subdata = u_default_buffer_subdata;
+        pctx->buffer_subdata = panfrost_buffer_subdata;
         pctx->texture_subdata = u_default_texture_subdata;
-        pctx->clear_buffer = u_default_clear_buffer;
+        pctx->clear_buffer = panfrost_clear_buffer;
 }
@@ -31,15 +31,68 @@
 #include "pan_texture.h"
 #include "drm-uapi/drm.h"
 #include "util/u_range.h"
+#include "util/u_threaded_context.h"
 
 #define LAYOUT_CONVERT_THRESHOLD 8
+
+/* Number of synchronized CPU reads of an uncached buffer after which it is
+ * moved to cached memory, and the largest buffer moved */
+#define PAN_CACHED_READ_THRESHOLD 4
+#define PAN_CACHED_BUFFER_MAX_SIZE (16 * 1024 * 1024)
+
+/* Number of times an AFBC resource is bound for sampling without being
+ * written before its body is compacted */
+#define PAN_AFBC_PACK_THRESHOLD 8
+
+/* Number of times a CPU-uploaded texture is bound for sampling without being
+ * uploaded to again before it is converted to AFBC */
+#define PAN_AFBC_PROMOTE_THRESHOLD 64
 #define PAN_MAX_BATCHES 32
 
+/* Number of sampler view descriptors cached per resource */
+#define PAN_VIEW_CACHE_SIZE 4
+
+/* Commit granularity of sparse buffers */
+#define PAN_SPARSE_PAGE_SIZE (64 * 1024)
+
+/* Everything the descriptors of a sampler view depend on, besides the
+ * resource. Compared with memcmp, so it must be zeroed before filling. */
+struct panfrost_view_cache_key {
+        mali_ptr bo;
+        uint64_t modifier;
+        uint64_t data_size;
+        enum pipe_format format;
+        unsigned dim;
+        unsigned first_level, last_level;
+        unsigned first_layer, last_layer;
+        unsigned buf_offset, buf_size;
+        unsigned char swizzle[4];
+};
+
+struct panfrost_view_cache_entry {
+        struct panfrost_view_cache_key key;
+        struct panfrost_pool_ref state;
+
+        /* Texture descriptor on v6+, where it isn't part of the state */
+        uint32_t descriptor[8];
+};
+
+struct panfrost_view_cache {
+        simple_mtx_t lock;
+        unsigned next;
+        struct panfrost_view_cache_entry entries[PAN_VIEW_CACHE_SIZE];
+};
+
 #define PAN_BIND_SHARED_MASK (PIPE_BIND_DISPLAY_TARGET | PIPE_BIND_SCANOUT | \
                               PIPE_BIND_SHARED)
 
 struct panfrost_resource {
-        struct pipe_resource base;
+        /* The threaded context state extends the resource, its first member
+         * being the pipe_resource */
+        union {
+                struct pipe_resource base;
+                struct threaded_resource threaded;
+        };
         struct {
                 struct pipe_scissor_state extent;
                 struct {
@@ -77,14 +130,49 @@ struct panfrost_resource {
 
                 /* Has anything been written to this slice? */
                 BITSET_DECLARE(data, MAX_MIP_LEVELS);
+
+                /* Slices only written by render passes covering part of
+                 * them, so that only region holds valid data */
+                BITSET_DECLARE(partial, MAX_MIP_LEVELS);
+                struct pipe_scissor_state region[MAX_MIP_LEVELS];
         } valid;
 
         /* Whether the modifier can be changed */
         bool modifier_constant;
 
+        /* Whether the driver picked the modifier, rather than the user */
+        bool modifier_auto;
+
+        struct {
+                /* Has the CPU written the texture since it was last
+                 * considered for AFBC? */
+                bool uploaded;
+
+                /* Texture binds since the last CPU write */
+                uint16_t samples;
+        } afbc_promote;
+
         /* Used to decide when to convert to another modifier */
         uint16_t modifier_updates;
 
+        /* Synchronized CPU reads of an uncached buffer, used to decide when
+         * to move it to a cached mapping */
+        uint16_t cpu_reads;
+
+        struct {
+                /* Texture binds since the last GPU write, saturating. Set to
+                 * UINT16_MAX when packing isn't worth it. */
+                uint16_t reads;
+
+                /* Is the AFBC body tightly packed? A packed resource has no
+                 * room for the GPU to write superblocks, so it must be
+                 * unpacked before being written again. */
+                bool packed;
+
+                /* Packing in flight on the tiling queue */
+                struct panfrost_afbc_pack_job *job;
+        } afbc_pack;
+
         /* Do all pixels have the same stencil value? */
         bool constant_stencil;
 
@@ -93,6 +181,35 @@ struct panfrost_resource {
 
         /* Cached min/max values for index buffers */
         struct panfrost_minmax_cache *index_cache;
+
+        /* Sparse buffers: committed pages of PAN_SPARSE_PAGE_SIZE, and the
+         * number of pages resident from the start of the BO */
+        struct {
+                BITSET_WORD *committed;
+                unsigned nr_pages, resident;
+        } sparse;
+
+        /* Depth/stencil and multisampled renderbuffers on kbase start with
+         * no memory, which the GPU faults in when writing back or reading
+         * them. Attachments that are always cleared and invalidated never
+         * get any. Cleared once the whole BO is committed for the CPU. */
+        bool lazy_backing;
+
+        /* Taken from a global counter whenever the contents may change, so
+         * CPU copies of the contents can be checked for staleness */
+        uint64_t contents_seqnum;
+
+        /* Mapped persistently for writing, so the contents may change at any
+         * time and CPU copies of them can't be reused */
+        bool persistent_write;
+
+        /* Primitives drawn by the last render pass to this render target,
+         * used to pick the tiler hierarchy levels of the next one */
+        uint32_t tiler_primitives;
+
+        /* Descriptors of recently created sampler views, shared by all
+         * contexts. Allocated on first use. */
+        struct panfrost_view_cache *view_cache;
 };
 
 static inline struct panfrost_resource *
@@ -102,7 +219,10 @@ pan_resource(struct pipe_resource *p)
 }
 
 struct panfrost_transfer {
-        struct pipe_transfer base;
+        union {
+                struct pipe_transfer base;
+                struct threaded_transfer threaded;
+        };
         void *map;
         struct {
                 struct pipe_resource *rsrc;
@@ -122,6 +242,21 @@ void panfrost_resource_screen_destroy(struct pipe_screen *screen);
 
 void panfrost_resource_context_init(struct pipe_context *pctx);
 
+/* u_threaded_context callbacks */
+
+void
+panfrost_replace_buffer_storage(struct pipe_context *pctx,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src,
+                                unsigned num_rebinds,
+                                uint32_t rebind_mask,
+                                uint32_t delete_buffer_id);
+
+bool
+panfrost_resource_busy(struct pipe_screen *pscreen,
+                       struct pipe_resource *prsrc,
+                       unsigned usage);
+
 /* Blitting */
 
 void
@@ -131,6 +266,49 @@ void
 panfrost_blit(struct pipe_context *pipe,
               const struct pipe_blit_info *info);
 
+bool
+panfrost_compute_copy(struct pipe_context *pipe,
+                      const struct pipe_blit_info *info);
+
+bool
+panfrost_compute_clear(struct pipe_context *pipe,
+                       struct pipe_surface *dst,
+                       const union pipe_color_union *color,
+                       unsigned dstx, unsigned dsty,
+                       unsigned width, unsigned height);
+
+bool
+panfrost_compute_mipmap(struct pipe_context *pipe,
+                        struct pipe_resource *prsrc,
+                        enum pipe_format format,
+                        unsigned base_level, unsigned last_level,
+                        unsigned first_layer, unsigned last_layer);
+
+bool
+panfrost_compute_fill_buffer(struct pipe_context *pipe,
+                             struct pipe_resource *res,
+                             unsigned offset, unsigned size,
+                             const void *value, int value_size);
+
+bool
+panfrost_compute_copy_buffer(struct pipe_context *pipe,
+                             struct pipe_resource *dst, unsigned dst_offset,
+                             struct pipe_resource *src, unsigned src_offset,
+                             unsigned size);
+
+/* Flags of panfrost_compute_query_result */
+#define PAN_QUERY_RESULT_AVAILABILITY   BITFIELD_BIT(0)
+#define PAN_QUERY_RESULT_BOOLEAN        BITFIELD_BIT(1)
+#define PAN_QUERY_RESULT_QUARTER        BITFIELD_BIT(2)
+#define PAN_QUERY_RESULT_64BIT          BITFIELD_BIT(3)
+#define PAN_QUERY_RESULT_SIGNED         BITFIELD_BIT(4)
+
+bool
+panfrost_compute_query_result(struct pipe_context *pipe,
+                              struct pipe_resource *counters,
+                              unsigned count, unsigned flags,
+                              struct pipe_resource *dst, unsigned offset);
+
 void
 panfrost_resource_set_damage_region(struct pipe_screen *screen,
                                     struct pipe_resource *res,
@@ -168,6 +346,49 @@ pan_resource_modifier_convert(struct panfrost_context *ctx,
                               struct panfrost_resource *rsrc,
                               uint64_t modifier, const char *reason);
 
+void
+panfrost_resource_contents_changed(struct panfrost_resource *rsrc);
+
+/* Mark a whole slice as holding valid data */
+static inline void
+panfrost_resource_set_valid(struct panfrost_resource *rsrc, unsigned level)
+{
+        BITSET_SET(rsrc->valid.data, level);
+        BITSET_CLEAR(rsrc->valid.partial, level);
+}
+
+void
+panfrost_resource_add_valid_region(struct panfrost_resource *rsrc,
+                                   unsigned level,
+                                   const struct pipe_scissor_state *region);
+
+bool
+panfrost_view_cache_get(struct panfrost_resource *rsrc,
+                        const struct panfrost_view_cache_key *key,
+                        struct panfrost_pool_ref *state,
+                        void *descriptor, size_t descriptor_size);
+
+void
+panfrost_view_cache_put(struct panfrost_resource *rsrc,
+                        const struct panfrost_view_cache_key *key,
+                        struct panfrost_pool_ref state,
+                        const void *descriptor, size_t descriptor_size);
+
+void
+panfrost_resource_track_sample(struct panfrost_context *ctx,
+                               struct panfrost_resource *rsrc);
+
+void
+panfrost_resource_try_pack_afbc(struct panfrost_context *ctx,
+                                struct panfrost_resource *rsrc);
+
+void
+panfrost_resource_cancel_afbc_pack(struct panfrost_resource *rsrc);
+
+void
+panfrost_resource_unpack_afbc(struct panfrost_context *ctx,
+                              struct panfrost_resource *rsrc);
+
 void
 pan_legalize_afbc_format(struct panfrost_context *ctx,
                          struct panfrost_resource *rsrc,
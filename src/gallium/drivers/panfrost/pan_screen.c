@@ -34,6 +34,8 @@
 #include "util/u_screen.h"
 #include "util/os_time.h"
 #include "util/u_process.h"
+#include "util/u_cpu_detect.h"
+#include "util/xmlconfig.h"
 #include "pipe/p_defines.h"
 #include "pipe/p_screen.h"
 #include "draw/draw_context.h"
@@ -47,6 +49,7 @@
 #include "pan_fence.h"
 #include "pan_shader.h"
 #include "pan_screen.h"
+#include "pan_thread.h"
 #include "pan_resource.h"
 #include "pan_public.h"
 #include "pan_util.h"
@@ -79,6 +82,13 @@ static const struct debug_named_value panfrost_debug_options[] = {
         {"nocpuc",    PAN_DBG_UNCACHED_CPU, "Use uncached CPU mappings for textures"},
         {"log",       PAN_DBG_LOG,      "Log job submission etc."},
         {"gofaster",  PAN_DBG_GOFASTER, "Experimental performance improvements"},
+        {"growvary",  PAN_DBG_GROW_VARYINGS, "Allocate varyings from GPU-fault-grown memory (kbase only)"},
+        {"afbcpack",  PAN_DBG_AFBC_PACK, "Compact AFBC render targets once they are only sampled"},
+        {"capture",   PAN_DBG_CAPTURE, "Write a binary capture of the submissions to PAN_CAPTURE_FILE"},
+        {"faultdump", PAN_DBG_FAULT_DUMP, "Dump the BOs and command streams of faulting batches to /tmp (kbase CSF only)"},
+        {"submitprof", PAN_DBG_SUBMIT_PROFILE, "Print histograms of the CPU time of CSF submission phases on context destruction"},
+        {"noprecompile", PAN_DBG_NO_PRECOMPILE, "Compile blit shaders on first use rather than in the background"},
+        {"replay",    PAN_DBG_REPLAY,   "Reuse the job chains of batches repeating the draws of a previous batch (Bifrost and Valhall job manager)"},
         DEBUG_NAMED_VALUE_END
 };
 
@@ -216,8 +226,22 @@ panfrost_get_param(struct pipe_screen *screen, enum pipe_cap param)
         case PIPE_CAP_TEXTURE_BUFFER_OFFSET_ALIGNMENT:
                 return 64;
 
+        /* Sparse buffers need kbase to commit memory on demand */
+        case PIPE_CAP_SPARSE_BUFFER_PAGE_SIZE:
+                return dev->kbase ? PAN_SPARSE_PAGE_SIZE : 0;
+
+        /* Queries convert the GPU timestamp to nanoseconds */
         case PIPE_CAP_QUERY_TIMESTAMP:
-                return is_gl3;
+        case PIPE_CAP_QUERY_TIME_ELAPSED:
+                return dev->timestamp_frequency != 0;
+
+        case PIPE_CAP_QUERY_TIMESTAMP_BITS:
+                return 64;
+
+        /* Occlusion queries are copied by a compute shader, other queries
+         * are written from the CPU */
+        case PIPE_CAP_QUERY_BUFFER_OBJECT:
+                return true;
 
         /* The hardware requires element alignment for data conversion to work
          * as expected. If data conversion is not required, this restriction is
@@ -261,8 +285,20 @@ panfrost_get_param(struct pipe_screen *screen, enum pipe_cap param)
         case PIPE_CAP_MAX_VERTEX_ELEMENT_SRC_OFFSET:
                 return 0xffff;
 
+        /* Lets the frontend read back into and upload from pixel buffer
+         * objects with a shader, queued like any other draw. Otherwise
+         * every PBO transfer maps the resource on the CPU, flushing and
+         * waiting for the writer.
+         *
+         * The frontend has no PBO-only mode, so this also makes it blit
+         * through a staging texture for ReadPixels, GetTexImage and the
+         * TexSubImage calls needing a format conversion without a PBO.
+         * Uploads not needing a conversion still use texture_subdata.
+         * Mapping a tiled or AFBC resource already goes through a GPU blit
+         * or a CPU detile, so the blit moves detiling and conversion to the
+         * GPU rather than adding a copy. */
         case PIPE_CAP_TEXTURE_TRANSFER_MODES:
-                return 0;
+                return PIPE_TEXTURE_TRANSFER_BLIT;
 
         case PIPE_CAP_ENDIANNESS:
                 return PIPE_ENDIAN_NATIVE;
@@ -328,6 +364,11 @@ panfrost_get_param(struct pipe_screen *screen, enum pipe_cap param)
         case PIPE_CAP_DRAW_INDIRECT:
                 return has_heap;
 
+        /* The command stream loops over the draws itself on CSF */
+        case PIPE_CAP_MULTI_DRAW_INDIRECT:
+        case PIPE_CAP_MULTI_DRAW_INDIRECT_PARAMS:
+                return has_heap && dev->arch >= 10;
+
         case PIPE_CAP_START_INSTANCE:
         case PIPE_CAP_DRAW_PARAMETERS:
                 return pan_is_bifrost(dev);
@@ -357,9 +398,22 @@ panfrost_get_param(struct pipe_screen *screen, enum pipe_cap param)
         case PIPE_CAP_IMAGE_STORE_FORMATTED:
                 return 1;
 
-        case PIPE_CAP_NATIVE_FENCE_FD:
+        /* Queue group priorities are only available with CSF */
+        case PIPE_CAP_CONTEXT_PRIORITY_MASK:
+                if (dev->kbase && dev->mali.context_create)
+                        return PIPE_CONTEXT_PRIORITY_LOW |
+                               PIPE_CONTEXT_PRIORITY_MEDIUM |
+                               PIPE_CONTEXT_PRIORITY_HIGH;
                 return 0;
 
+        /* Faults are only tracked per context with CSF */
+        case PIPE_CAP_DEVICE_RESET_STATUS_QUERY:
+                return dev->kbase && dev->mali.context_faulted;
+
+        /* On kbase, sync files can only be signalled by the GPU with CSF */
+        case PIPE_CAP_NATIVE_FENCE_FD:
+                return dev->kbase && dev->mali.syncobj_export_sync_file;
+
         default:
                 return u_pipe_screen_get_param_defaults(screen, param);
         }
@@ -372,7 +426,7 @@ panfrost_get_shader_param(struct pipe_screen *screen,
 {
         struct panfrost_device *dev = pan_device(screen);
         bool is_nofp16 = dev->debug & PAN_DBG_NOFP16;
-        bool is_deqp = dev->debug & PAN_DBG_DEQP;
+        bool mediump_int16 = pan_screen(screen)->mediump_int16;
 
         switch (shader) {
         case PIPE_SHADER_VERTEX:
@@ -450,9 +504,9 @@ panfrost_get_shader_param(struct pipe_screen *screen,
         case PIPE_SHADER_CAP_FP16_CONST_BUFFERS:
                 return dev->arch >= 6 && !is_nofp16;
         case PIPE_SHADER_CAP_INT16:
-                /* XXX: Advertise this CAP when a proper fix to lower_precision
-                 * lands. GLSL IR validation failure in glmark2 -bterrain */
-                return dev->arch >= 6 && !is_nofp16 && is_deqp;
+                /* Lowering mediump integers trips GLSL IR validation in some
+                 * applications (glmark2 -bterrain), which driconf opts out */
+                return dev->arch >= 6 && !is_nofp16 && mediump_int16;
 
         case PIPE_SHADER_CAP_INT64_ATOMICS:
         case PIPE_SHADER_CAP_DROUND_SUPPORTED:
@@ -613,6 +667,7 @@ panfrost_walk_dmabuf_modifiers(struct pipe_screen *screen,
         struct panfrost_device *dev = pan_device(screen);
         bool afbc = dev->has_afbc && panfrost_format_supports_afbc(dev, format);
         bool ytr = panfrost_afbc_can_ytr(format);
+        bool split = panfrost_afbc_can_split(dev->arch, format);
         bool tiled_afbc = panfrost_afbc_can_tile(dev);
         bool native = panfrost_afbc_only_native(dev->arch, format);
 
@@ -625,6 +680,9 @@ panfrost_walk_dmabuf_modifiers(struct pipe_screen *screen,
                 if ((pan_best_modifiers[i] & AFBC_FORMAT_MOD_YTR) && !ytr)
                         continue;
 
+                if ((pan_best_modifiers[i] & AFBC_FORMAT_MOD_SPLIT) && !split)
+                        continue;
+
                 if ((pan_best_modifiers[i] & AFBC_FORMAT_MOD_TILED) && !tiled_afbc)
                         continue;
 
@@ -635,14 +693,17 @@ panfrost_walk_dmabuf_modifiers(struct pipe_screen *screen,
                     test_modifier != pan_best_modifiers[i])
                         continue;
 
-                count++;
-
                 if (max > (int) count) {
                         modifiers[count] = pan_best_modifiers[i];
 
+                        /* YUV images are sampled as separate planes with
+                         * the conversion lowered into the shader, which only
+                         * external textures can do */
                         if (external_only)
-                                external_only[count] = false;
+                                external_only[count] = util_format_is_yuv(format);
                 }
+
+                count++;
         }
 
         *out_count = count;
@@ -741,7 +802,9 @@ panfrost_get_compute_param(struct pipe_screen *pscreen, enum pipe_shader_ir ir_t
 		RET((uint64_t []) { 1024*1024*512 /* Maybe get memory */ });
 
 	case PIPE_COMPUTE_CAP_MAX_CLOCK_FREQUENCY:
-		RET((uint32_t []) { 800 /* MHz -- TODO */ });
+		RET((uint32_t []) { dev->max_freq_khz ?
+		                    dev->max_freq_khz / 1000 :
+		                    800 /* MHz, unknown without kbase */ });
 
 	case PIPE_COMPUTE_CAP_MAX_COMPUTE_UNITS:
 		RET((uint32_t []) { dev->core_count });
@@ -765,7 +828,18 @@ panfrost_destroy_screen(struct pipe_screen *pscreen)
         struct panfrost_device *dev = pan_device(pscreen);
         struct panfrost_screen *screen = pan_screen(pscreen);
 
+        panfrost_warmup_save(screen);
+
+        if (util_queue_is_initialized(&screen->shader_queue)) {
+                /* Don't hold up exiting to finish precompiling */
+                util_queue_drop_job(&screen->shader_queue,
+                                    &screen->blitter.prefill_fence);
+                util_queue_destroy(&screen->shader_queue);
+        }
+
         panfrost_resource_screen_destroy(pscreen);
+        panfrost_shader_store_cleanup(screen);
+        panfrost_cso_store_cleanup(screen);
         panfrost_pool_cleanup(&screen->indirect_draw.bin_pool);
         panfrost_pool_cleanup(&screen->blitter.bin_pool);
         panfrost_pool_cleanup(&screen->blitter.desc_pool);
@@ -814,8 +888,57 @@ panfrost_get_driver_query_info(struct pipe_screen *pscreen, unsigned index,
 }
 
 
+/* Tiler heap parameters, used by CSF GPUs only. Options are checked before
+ * being queried, as the kmsro loader may pass the options of another
+ * driver. */
+
+static unsigned
+panfrost_query_driconf_int(const struct pipe_screen_config *config,
+                           const char *name, unsigned def)
+{
+        if (!driCheckOption(config->options, name, DRI_INT))
+                return def;
+
+        return driQueryOptioni(config->options, name);
+}
+
+static void
+panfrost_parse_driconf(struct panfrost_screen *screen,
+                       const struct pipe_screen_config *config)
+{
+        struct panfrost_device *dev = &screen->dev;
+        struct kbase_tiler_heap_config *heap = &dev->mali.tiler_heap_config;
+
+        driParseConfigFiles(config->options, config->options_info, 0,
+                            "panfrost", NULL, NULL, NULL, 0, NULL, 0);
+
+        heap->chunk_size =
+                panfrost_query_driconf_int(config, "pan_tiler_heap_chunk_size",
+                                           heap->chunk_size >> 10) << 10;
+        heap->initial_chunks =
+                panfrost_query_driconf_int(config, "pan_tiler_heap_initial_chunks",
+                                           heap->initial_chunks);
+        heap->max_chunks =
+                panfrost_query_driconf_int(config, "pan_tiler_heap_max_chunks",
+                                           heap->max_chunks);
+        heap->initial_chunks = MIN2(heap->initial_chunks, heap->max_chunks);
+
+        screen->tiler_heap_adaptive =
+                !driCheckOption(config->options, "pan_tiler_heap_adaptive", DRI_BOOL) ||
+                driQueryOptionb(config->options, "pan_tiler_heap_adaptive");
+
+        screen->mediump_int16 =
+                !driCheckOption(config->options, "pan_mediump_int16", DRI_BOOL) ||
+                driQueryOptionb(config->options, "pan_mediump_int16");
+
+        screen->thread_affinity =
+                !driCheckOption(config->options, "pan_thread_affinity", DRI_BOOL) ||
+                driQueryOptionb(config->options, "pan_thread_affinity");
+}
+
 struct pipe_screen *
-panfrost_create_screen(int fd, struct renderonly *ro)
+panfrost_create_screen(int fd, const struct pipe_screen_config *config,
+                       struct renderonly *ro)
 {
         /* Create the screen */
         struct panfrost_screen *screen = rzalloc(NULL, struct panfrost_screen);
@@ -841,6 +964,17 @@ panfrost_create_screen(int fd, struct renderonly *ro)
 
         dev->ro = ro;
 
+#ifdef HAVE_PERFETTO
+        pan_perfetto_init();
+#endif
+
+        screen->tiler_heap_adaptive = true;
+        screen->mediump_int16 = true;
+        screen->thread_affinity = true;
+
+        if (config)
+                panfrost_parse_driconf(screen, config);
+
         /* The functionality is only useful with kbase */
         if (dev->kbase)
                 dev->has_dmabuf_fence = panfrost_check_dmabuf_fence(dev);
@@ -872,14 +1006,34 @@ panfrost_create_screen(int fd, struct renderonly *ro)
         pan_blend_shaders_init(dev);
 
         panfrost_disk_cache_init(screen);
+        panfrost_shader_store_init(screen);
+        panfrost_cso_store_init(screen);
+
+        /* Precompiles only need to keep ahead of the application thread, so
+         * a few low priority threads are enough */
+        unsigned nr_compile_threads = MIN2(util_get_cpu_caps()->nr_cpus, 4) - 1;
+
+        if (nr_compile_threads) {
+                util_queue_init(&screen->shader_queue, "panshader", 64,
+                                nr_compile_threads,
+                                UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                                UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY,
+                                screen);
+        }
+
+        if (screen->thread_affinity) {
+                panfrost_place_device_threads(dev);
+                pan_queue_set_class(&screen->shader_queue, PAN_THREAD_COMPUTE);
+                pan_queue_set_class(&screen->tiling_queue, PAN_THREAD_COMPUTE);
+        }
 
         panfrost_pool_init(&screen->indirect_draw.bin_pool, NULL, dev,
                            PAN_BO_EXECUTE, 65536, "Indirect draw shaders",
-                           false, true);
+                           false, true, NULL);
         panfrost_pool_init(&screen->blitter.bin_pool, NULL, dev, PAN_BO_EXECUTE,
-                           4096, "Blitter shaders", false, true);
+                           4096, "Blitter shaders", false, true, NULL);
         panfrost_pool_init(&screen->blitter.desc_pool, NULL, dev, 0, 65536,
-                           "Blitter RSDs", false, true);
+                           "Blitter RSDs", false, true, NULL);
         if (dev->arch == 4)
                 panfrost_cmdstream_screen_init_v4(screen);
         else if (dev->arch == 5)
@@ -895,5 +1049,8 @@ panfrost_create_screen(int fd, struct renderonly *ro)
         else
                 unreachable("Unhandled architecture major");
 
+        /* Needs the blend shader hook set up above */
+        panfrost_warmup_load(screen);
+
         return &screen->base;
 }
@@ -38,14 +38,73 @@
 #include "util/set.h"
 #include "util/log.h"
 #include "util/disk_cache.h"
+#include "util/simple_mtx.h"
+#include "util/u_idalloc.h"
+#include "util/u_queue.h"
+#include "util/slab.h"
 
 #include "pan_device.h"
 #include "pan_mempool.h"
 
 #define PAN_QUERY_DRAW_CALLS (PIPE_QUERY_DRIVER_SPECIFIC + 0)
+#define PAN_QUERY_CS_RING_STALLS (PIPE_QUERY_DRIVER_SPECIFIC + 1)
+#define PAN_QUERY_CS_RING_OCCUPANCY (PIPE_QUERY_DRIVER_SPECIFIC + 2)
+#define PAN_QUERY_CRC_TILES (PIPE_QUERY_DRIVER_SPECIFIC + 3)
+#define PAN_QUERY_BLEND_SHADERS (PIPE_QUERY_DRIVER_SPECIFIC + 4)
+#define PAN_QUERY_BATCHES (PIPE_QUERY_DRIVER_SPECIFIC + 5)
+#define PAN_QUERY_BATCHES_EXPLICIT (PIPE_QUERY_DRIVER_SPECIFIC + 6)
+#define PAN_QUERY_BATCHES_FBO (PIPE_QUERY_DRIVER_SPECIFIC + 7)
+#define PAN_QUERY_BATCHES_RESOURCE (PIPE_QUERY_DRIVER_SPECIFIC + 8)
+#define PAN_QUERY_BATCHES_DEPENDENCY (PIPE_QUERY_DRIVER_SPECIFIC + 9)
+#define PAN_QUERY_BATCHES_OTHER (PIPE_QUERY_DRIVER_SPECIFIC + 10)
+#define PAN_QUERY_BO_CACHE_HITS (PIPE_QUERY_DRIVER_SPECIFIC + 11)
+#define PAN_QUERY_BO_CACHE_MISSES (PIPE_QUERY_DRIVER_SPECIFIC + 12)
+#define PAN_QUERY_POOL_UPLOAD_BYTES (PIPE_QUERY_DRIVER_SPECIFIC + 13)
+#define PAN_QUERY_CPU_TILING_BYTES (PIPE_QUERY_DRIVER_SPECIFIC + 14)
+#define PAN_QUERY_KCPU_COMMANDS (PIPE_QUERY_DRIVER_SPECIFIC + 15)
+#define PAN_QUERY_RESOURCE_CONVERSIONS (PIPE_QUERY_DRIVER_SPECIFIC + 16)
+/* In the order of enum panfrost_submit_phase */
+#define PAN_QUERY_SUBMIT_DEPS_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 17)
+#define PAN_QUERY_SUBMIT_CLEAN_DEPS_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 18)
+#define PAN_QUERY_SUBMIT_EMIT_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 19)
+#define PAN_QUERY_SUBMIT_KCPU_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 20)
+#define PAN_QUERY_SUBMIT_IOCTL_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 21)
+#define PAN_QUERY_TILE_SIZE (PIPE_QUERY_DRIVER_SPECIFIC + 22)
 
+/* The BO cache and KCPU counts are shared by all contexts of the device */
 static const struct pipe_driver_query_info panfrost_driver_query_list[] = {
         {"draw-calls", PAN_QUERY_DRAW_CALLS, { 0 }},
+        {"cs-ring-stalls", PAN_QUERY_CS_RING_STALLS, { 0 }},
+        {"cs-ring-occupancy", PAN_QUERY_CS_RING_OCCUPANCY, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_BYTES, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE},
+        {"crc-tiles", PAN_QUERY_CRC_TILES, { 0 }},
+        {"blend-shaders", PAN_QUERY_BLEND_SHADERS, { 0 }},
+        {"batches", PAN_QUERY_BATCHES, { 0 }},
+        {"batches-explicit", PAN_QUERY_BATCHES_EXPLICIT, { 0 }},
+        {"batches-fbo", PAN_QUERY_BATCHES_FBO, { 0 }},
+        {"batches-resource", PAN_QUERY_BATCHES_RESOURCE, { 0 }},
+        {"batches-dependency", PAN_QUERY_BATCHES_DEPENDENCY, { 0 }},
+        {"batches-other", PAN_QUERY_BATCHES_OTHER, { 0 }},
+        {"bo-cache-hits", PAN_QUERY_BO_CACHE_HITS, { 0 }},
+        {"bo-cache-misses", PAN_QUERY_BO_CACHE_MISSES, { 0 }},
+        {"pool-upload-bytes", PAN_QUERY_POOL_UPLOAD_BYTES, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_BYTES},
+        {"cpu-tiling-bytes", PAN_QUERY_CPU_TILING_BYTES, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_BYTES},
+        {"kcpu-commands", PAN_QUERY_KCPU_COMMANDS, { 0 }},
+        {"resource-conversions", PAN_QUERY_RESOURCE_CONVERSIONS, { 0 }},
+        {"submit-deps-time", PAN_QUERY_SUBMIT_DEPS_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS},
+        {"submit-clean-deps-time", PAN_QUERY_SUBMIT_CLEAN_DEPS_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS},
+        {"submit-emit-time", PAN_QUERY_SUBMIT_EMIT_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS},
+        {"submit-kcpu-time", PAN_QUERY_SUBMIT_KCPU_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS},
+        {"submit-ioctl-time", PAN_QUERY_SUBMIT_IOCTL_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS},
+        {"tile-size", PAN_QUERY_TILE_SIZE, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_UINT64, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE},
 };
 
 struct panfrost_batch;
@@ -74,6 +133,11 @@ struct panfrost_vtable {
         /* Emits a fragment job */
         mali_ptr (*emit_fragment_job)(struct panfrost_batch *, const struct pan_fb_info *);
 
+        /* Emits the timestamp writes of a batch, returning the job chain
+         * writing them on JM. On CSF they are added to the fragment stream. */
+        mali_ptr (*emit_timestamps)(struct panfrost_batch *,
+                                    struct util_dynarray *);
+
         /* General destructor */
         void (*screen_destroy)(struct pipe_screen *);
 
@@ -103,9 +167,18 @@ struct panfrost_vtable {
                                struct util_dynarray *binary,
                                struct pan_shader_info *info);
 
-        void (*emit_csf_toplevel)(struct panfrost_batch *);
+        /* Returns false if the batch didn't fit in the CSF rings */
+        bool (*emit_csf_toplevel)(struct panfrost_batch *);
+
+        /* Orders the storage writes of the jobs in a batch before the jobs
+         * added later, returns false if the batch must be submitted instead */
+        bool (*emit_barrier)(struct panfrost_batch *);
 
         void (*init_cs)(struct panfrost_context *ctx, struct panfrost_cs *cs);
+
+        /* Link the jobs of the draws taken from a replay record into the
+         * batch. NULL if replay is not supported. */
+        void (*replay_splice)(struct panfrost_batch *batch);
 };
 
 struct panfrost_screen {
@@ -114,6 +187,11 @@ struct panfrost_screen {
         struct {
                 struct panfrost_pool bin_pool;
                 struct panfrost_pool desc_pool;
+
+                /* Set once the first context has queued the precompilation
+                 * of the common blit shaders, and the fence of that job */
+                uint32_t prefill_queued;
+                struct util_queue_fence prefill_fence;
         } blitter;
         struct {
                 struct panfrost_pool bin_pool;
@@ -121,6 +199,74 @@ struct panfrost_screen {
 
         struct panfrost_vtable vtbl;
         struct disk_cache *disk_cache;
+
+        /* Whether to raise the chunk limit of tiler heaps that contexts
+         * mostly use up, set from driconf (CSF) */
+        bool tiler_heap_adaptive;
+
+        /* Whether mediump integers are lowered to 16-bit, set from driconf */
+        bool mediump_int16;
+
+        /* Whether driver threads are placed on big or little cores, set from
+         * driconf */
+        bool thread_affinity;
+
+        /* Worker threads splitting large tiled transfers in bands of tile
+         * rows. Not initialized on single core systems. */
+        struct util_queue tiling_queue;
+
+        /* Worker threads for shader precompiles. Not initialized on single
+         * core systems. */
+        struct util_queue shader_queue;
+
+        /* Shader binaries of all contexts, deduplicated by content. See
+         * pan_shader.c */
+        struct {
+                simple_mtx_t lock;
+                struct panfrost_pool pool;
+                struct hash_table *table;
+        } shader_store;
+
+        /* Sampler, rasterizer, depth/stencil/alpha and blend CSOs of all
+         * contexts, deduplicated by template. See pan_context.c */
+        struct {
+                simple_mtx_t lock;
+
+                /* Template to struct panfrost_cso_store_entry, and CSO to
+                 * the same entry */
+                struct hash_table *table, *objects;
+        } cso_store;
+
+        /* Keys to precompile, loaded from the disk cache and saved back
+         * with the keys seen by this process. See pan_disk_cache.c */
+        struct {
+                simple_mtx_t lock;
+
+                /* Array of struct panfrost_warmup_variant */
+                struct util_dynarray variants;
+                bool dirty;
+
+                /* Number of blend shaders loaded, and the fence of the job
+                 * compiling them */
+                unsigned nr_blend;
+                struct util_queue_fence blend_fence;
+
+                /* Next free entry of the series in the disk cache */
+                unsigned generation;
+        } warmup;
+
+        /* Serial of the last shader CSO created */
+        uint32_t shader_serial;
+
+        /* Incremented when a CSO or fragment shader binary that cached RSDs
+         * may point to is freed. Those are shared by all contexts, which
+         * clear their RSD cache when they see it change. */
+        uint32_t rsd_cache_epoch;
+
+        /* Transfers of all contexts, and the IDs of buffers used by
+         * u_threaded_context to track their bindings */
+        struct slab_parent_pool transfer_pool;
+        struct util_idalloc_mt buffer_ids;
 };
 
 static inline struct panfrost_screen *
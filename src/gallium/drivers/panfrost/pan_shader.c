@@ -32,18 +32,38 @@
 #include "pan_context.h"
 #include "pan_bo.h"
 #include "pan_shader.h"
+#include "util/u_atomic.h"
 #include "util/u_memory.h"
 #include "nir/tgsi_to_nir.h"
 #include "nir_serialize.h"
 
+static uint32_t
+panfrost_shader_key_hash(const void *key)
+{
+        return _mesa_hash_data(key, sizeof(struct panfrost_shader_key));
+}
+
+static bool
+panfrost_shader_key_equal(const void *a, const void *b)
+{
+        return !memcmp(a, b, sizeof(struct panfrost_shader_key));
+}
+
 static struct panfrost_uncompiled_shader *
-panfrost_alloc_shader(const nir_shader *nir)
+panfrost_alloc_shader(struct pipe_screen *pscreen, const nir_shader *nir)
 {
         struct panfrost_uncompiled_shader *so =
                 rzalloc(NULL, struct panfrost_uncompiled_shader);
 
         simple_mtx_init(&so->lock, mtx_plain);
         util_dynarray_init(&so->variants, so);
+        so->variant_index = _mesa_hash_table_create(so, panfrost_shader_key_hash,
+                                                    panfrost_shader_key_equal);
+
+        /* Skip 0 on wraparound, it tags empty last_variant entries */
+        do {
+                so->serial = p_atomic_inc_return(&pan_screen(pscreen)->shader_serial);
+        } while (so->serial == 0);
 
         so->nir = nir;
 
@@ -61,12 +81,6 @@ panfrost_alloc_shader(const nir_shader *nir)
         return so;
 }
 
-static struct panfrost_compiled_shader *
-panfrost_alloc_variant(struct panfrost_uncompiled_shader *so)
-{
-        return util_dynarray_grow(&so->variants, struct panfrost_compiled_shader, 1);
-}
-
 static void
 panfrost_shader_compile(struct panfrost_screen *screen,
                         const nir_shader *ir,
@@ -74,6 +88,7 @@ panfrost_shader_compile(struct panfrost_screen *screen,
                         struct panfrost_shader_key *key,
                         unsigned req_local_mem,
                         unsigned fixed_varying_mask,
+                        unsigned fp16_varying_mask,
                         struct panfrost_shader_binary *out)
 {
         struct panfrost_device *dev = pan_device(&screen->base);
@@ -89,6 +104,7 @@ panfrost_shader_compile(struct panfrost_screen *screen,
         /* Lower this early so the backends don't have to worry about it */
         if (s->info.stage == MESA_SHADER_FRAGMENT) {
                 inputs.fixed_varying_mask = key->fs.fixed_varying_mask;
+                inputs.fp16_varying_mask = key->fs.fp16_varying_mask;
 
                 if (s->info.outputs_written & BITFIELD_BIT(FRAG_RESULT_COLOR)) {
                         NIR_PASS_V(s, nir_lower_fragcolor,
@@ -108,12 +124,39 @@ panfrost_shader_compile(struct panfrost_screen *screen,
                                    false);
                 }
 
+                nir_lower_blend_options blend = {
+                        .logicop_enable = key->fs.blend.logicop_enable,
+                        .logicop_func = key->fs.blend.logicop_func,
+                };
+                bool lower_blend = false;
+
+                for (unsigned i = 0; i < ARRAY_SIZE(key->fs.blend.formats); ++i) {
+                        if (key->fs.blend.formats[i] == PIPE_FORMAT_NONE)
+                                continue;
+
+                        blend.format[i] = key->fs.blend.formats[i];
+                        pan_blend_to_nir_lower_blend_rt(key->fs.blend.equations[i],
+                                                        &blend.rt[i]);
+                        lower_blend = true;
+                }
+
+                /* Needs per-render target outputs, so after gl_FragColor
+                 * lowering. The constant comes from a sysval. */
+                if (lower_blend)
+                        NIR_PASS_V(s, nir_lower_blend, &blend);
+
                 memcpy(inputs.rt_formats, key->fs.rt_formats, sizeof(inputs.rt_formats));
         } else if (s->info.stage == MESA_SHADER_VERTEX) {
                 inputs.fixed_varying_mask = fixed_varying_mask;
 
+                if (key->vs_is_xfb)
+                        s->info.name = ralloc_asprintf(s, "%s@xfb", s->info.name);
+
                 /* No IDVS for internal XFB shaders */
                 inputs.no_idvs = s->info.has_transform_feedback_varyings;
+
+                if (!inputs.no_idvs)
+                        inputs.fp16_varying_mask = fp16_varying_mask;
         }
 
         util_dynarray_init(&out->binary, NULL);
@@ -128,51 +171,213 @@ panfrost_shader_compile(struct panfrost_screen *screen,
         ralloc_free(s);
 }
 
+/* Compile a variant into its pending binary, or retrieve it from the disk
+ * cache. This does not touch any context state, so it may run on any thread
+ * holding the only reference to the variant. */
+
 static void
-panfrost_shader_get(struct pipe_screen *pscreen,
-                    struct panfrost_pool *shader_pool,
-                    struct panfrost_pool *desc_pool,
-                    struct panfrost_uncompiled_shader *uncompiled,
-                    struct util_debug_callback *dbg,
-                    struct panfrost_compiled_shader *state,
-                    unsigned req_local_mem)
+panfrost_shader_compile_variant(struct panfrost_screen *screen,
+                                struct panfrost_uncompiled_shader *uncompiled,
+                                struct util_debug_callback *dbg,
+                                struct panfrost_compiled_shader *state,
+                                unsigned req_local_mem)
 {
-        struct panfrost_screen *screen = pan_screen(pscreen);
-        struct panfrost_device *dev = pan_device(pscreen);
-
-        struct panfrost_shader_binary res = { 0 };
+        struct panfrost_shader_binary *res = &state->pending;
 
         /* Try to retrieve the variant from the disk cache. If that fails,
          * compile a new variant and store in the disk cache for later reuse.
+         * The cache key is the NIR hash and the shader key, so a hit never
+         * clones or lowers the NIR.
          */
-        if (!panfrost_disk_cache_retrieve(screen->disk_cache, uncompiled, &state->key, &res)) {
+        if (!panfrost_disk_cache_retrieve(screen->disk_cache, uncompiled, &state->key, res)) {
                 panfrost_shader_compile(screen, uncompiled->nir, dbg, &state->key,
                                         req_local_mem,
-                                        uncompiled->fixed_varying_mask, &res);
+                                        uncompiled->fixed_varying_mask,
+                                        uncompiled->fp16_varying_mask, res);
+
+                panfrost_disk_cache_store(screen->disk_cache, uncompiled, &state->key, res);
+        }
+}
+
+/* Shader binaries are stored once per screen, keyed by a SHA1 of the binary
+ * and its info. Identical variants, whether of one shader or across
+ * contexts, share a GPU copy, and binaries are packed in large executable
+ * BOs since executable allocations are expensive with kbase. Each entry is
+ * reference counted by the variants using it.
+ */
+
+struct panfrost_shader_store_entry {
+        unsigned char sha1[20];
+        struct panfrost_pool_ref ref;
+        unsigned users;
+};
 
-                panfrost_disk_cache_store(screen->disk_cache, uncompiled, &state->key, &res);
+static uint32_t
+panfrost_shader_sha1_hash(const void *key)
+{
+        return _mesa_hash_data(key, 20);
+}
+
+static bool
+panfrost_shader_sha1_equal(const void *a, const void *b)
+{
+        return !memcmp(a, b, 20);
+}
+
+void
+panfrost_shader_store_init(struct panfrost_screen *screen)
+{
+        simple_mtx_init(&screen->shader_store.lock, mtx_plain);
+        screen->shader_store.table =
+                _mesa_hash_table_create(NULL, panfrost_shader_sha1_hash,
+                                        panfrost_shader_sha1_equal);
+
+        panfrost_pool_init(&screen->shader_store.pool, NULL, &screen->dev,
+                           PAN_BO_EXECUTE, 65536, "Shaders", false, false, NULL);
+}
+
+void
+panfrost_shader_store_cleanup(struct panfrost_screen *screen)
+{
+        if (!screen->shader_store.table)
+                return;
+
+        hash_table_foreach(screen->shader_store.table, entry) {
+                struct panfrost_shader_store_entry *e = entry->data;
+
+                panfrost_bo_unreference(e->ref.bo);
+                free(e);
         }
 
-        state->info = res.info;
+        _mesa_hash_table_destroy(screen->shader_store.table, NULL);
+        panfrost_pool_cleanup(&screen->shader_store.pool);
+        simple_mtx_destroy(&screen->shader_store.lock);
+}
+
+static struct panfrost_shader_store_entry *
+panfrost_shader_store_get(struct panfrost_screen *screen,
+                          const struct panfrost_shader_binary *res)
+{
+        struct mesa_sha1 ctx;
+        unsigned char sha1[20];
+
+        _mesa_sha1_init(&ctx);
+        _mesa_sha1_update(&ctx, res->binary.data, res->binary.size);
+        _mesa_sha1_update(&ctx, &res->info, sizeof(res->info));
+        _mesa_sha1_final(&ctx, sha1);
+
+        uint32_t hash = panfrost_shader_sha1_hash(sha1);
 
-        if (res.binary.size) {
-                state->bin = panfrost_pool_take_ref(shader_pool,
-                        pan_pool_upload_aligned(&shader_pool->base,
-                                res.binary.data, res.binary.size, 128));
+        simple_mtx_lock(&screen->shader_store.lock);
+
+        struct hash_entry *entry =
+                _mesa_hash_table_search_pre_hashed(screen->shader_store.table,
+                                                   hash, sha1);
+        struct panfrost_shader_store_entry *e;
+
+        if (entry) {
+                e = entry->data;
+        } else {
+                struct panfrost_pool *pool = &screen->shader_store.pool;
+
+                e = calloc(1, sizeof(*e));
+                memcpy(e->sha1, sha1, sizeof(sha1));
+                e->ref = panfrost_pool_take_ref(pool,
+                        pan_pool_upload_aligned(&pool->base, res->binary.data,
+                                                res->binary.size, 128));
+
+                _mesa_hash_table_insert_pre_hashed(screen->shader_store.table,
+                                                   hash, e->sha1, e);
         }
 
-        util_dynarray_fini(&res.binary);
+        e->users++;
+        simple_mtx_unlock(&screen->shader_store.lock);
+
+        return e;
+}
+
+static void
+panfrost_shader_store_put(struct panfrost_screen *screen,
+                          struct panfrost_shader_store_entry *e)
+{
+        if (!e)
+                return;
+
+        simple_mtx_lock(&screen->shader_store.lock);
+
+        if (--e->users == 0) {
+                _mesa_hash_table_remove_key(screen->shader_store.table, e->sha1);
+                panfrost_bo_unreference(e->ref.bo);
+                free(e);
+        }
+
+        simple_mtx_unlock(&screen->shader_store.lock);
+}
+
+/* Release the GPU memory of a variant, but not the variant itself */
+
+static void
+panfrost_shader_release(struct panfrost_screen *screen,
+                        struct panfrost_compiled_shader *so)
+{
+        panfrost_shader_store_put(screen, so->bin_entry);
+        panfrost_bo_unreference(so->state.bo);
+        panfrost_bo_unreference(so->linkage.bo);
+}
+
+/* Upload the pending binary of a compiled variant and prepare its
+ * descriptors */
+
+static void
+panfrost_shader_upload(struct pipe_screen *pscreen,
+                       struct panfrost_pool *desc_pool,
+                       struct panfrost_compiled_shader *state)
+{
+        struct panfrost_screen *screen = pan_screen(pscreen);
+        struct panfrost_device *dev = pan_device(pscreen);
+        struct panfrost_shader_binary *res = &state->pending;
+
+        state->info = res->info;
+
+        if (res->binary.size) {
+                state->bin_entry = panfrost_shader_store_get(screen, res);
+                state->bin = state->bin_entry->ref;
+        }
+
+        util_dynarray_fini(&res->binary);
 
         /* Don't upload RSD for fragment shaders since they need draw-time
          * merging for e.g. depth/stencil/alpha. RSDs are replaced by simpler
          * shader program descriptors on Valhall, which can be preuploaded even
          * for fragment shaders. */
-        bool upload = !(uncompiled->nir->info.stage == MESA_SHADER_FRAGMENT && dev->arch <= 7);
+        bool upload = !(state->info.stage == MESA_SHADER_FRAGMENT && dev->arch <= 7);
         screen->vtbl.prepare_shader(state, desc_pool, upload);
 
         panfrost_analyze_sysvals(state);
 }
 
+/* Variants compiled when creating the CSO, which happens on the application
+ * thread of a threaded context, are uploaded by the first context binding
+ * them */
+
+static void
+panfrost_upload_precompiled(struct panfrost_context *ctx,
+                            struct panfrost_uncompiled_shader *uncompiled,
+                            struct panfrost_compiled_shader *prog)
+{
+        if (p_atomic_read(&prog->uploaded))
+                return;
+
+        simple_mtx_lock(&uncompiled->lock);
+
+        if (!prog->uploaded) {
+                panfrost_shader_upload(ctx->base.screen, &ctx->descs, prog);
+                p_atomic_set(&prog->uploaded, true);
+        }
+
+        simple_mtx_unlock(&uncompiled->lock);
+}
+
 static void
 panfrost_build_key(struct panfrost_context *ctx,
                    struct panfrost_shader_key *key,
@@ -216,10 +421,43 @@ panfrost_build_key(struct panfrost_context *ctx,
                 }
         }
 
+        /* On Bifrost and newer, blend in the shader rather than calling a
+         * blend shader, unless the need for one depends on the blend
+         * constant. Blending in the shader reads a single sample of the
+         * destination, so this is limited to single-sampled targets.
+         */
+        if (dev->arch >= 6 && ctx->blend && !nir->info.fs.color_is_dual_source) {
+                struct panfrost_blend_state *blend = ctx->blend;
+                unsigned written = nir->info.outputs_written >> FRAG_RESULT_DATA0;
+
+                if (nir->info.outputs_written & BITFIELD_BIT(FRAG_RESULT_COLOR))
+                        written |= BITFIELD_MASK(fb->nr_cbufs);
+
+                for (unsigned i = 0; i < fb->nr_cbufs; ++i) {
+                        struct pipe_surface *surf = fb->cbufs[i];
+
+                        if (!surf || !(written & BITFIELD_BIT(i)))
+                                continue;
+
+                        unsigned nr_samples = surf->nr_samples ? :
+                                              surf->texture->nr_samples;
+
+                        if (nr_samples > 1 ||
+                            !panfrost_blend_needs_shader(ctx, i, surf->format))
+                                continue;
+
+                        key->fs.blend.formats[i] = surf->format;
+                        key->fs.blend.equations[i] = blend->pan.rts[i].equation;
+                        key->fs.blend.logicop_enable = blend->pan.logicop_enable;
+                        key->fs.blend.logicop_func = blend->pan.logicop_func;
+                }
+        }
+
         /* Funny desktop GL varying lowering on Valhall */
         if (dev->arch >= 9) {
                 assert(vs != NULL && "too early");
                 key->fs.fixed_varying_mask = vs->fixed_varying_mask;
+                key->fs.fp16_varying_mask = vs->fp16_varying_mask;
         }
 }
 
@@ -262,21 +500,39 @@ update_so_info(struct pipe_stream_output_info *so_info,
 	return so_outputs;
 }
 
+/* Add a variant to be compiled for the given key. Its ready fence starts out
+ * signalled, the caller must reset it before dropping the lock. */
+
 static struct panfrost_compiled_shader *
 panfrost_new_variant_locked(
-        struct panfrost_context *ctx,
         struct panfrost_uncompiled_shader *uncompiled,
-        struct panfrost_shader_key *key)
+        struct panfrost_shader_key *key, uint32_t key_hash)
 {
-        struct panfrost_compiled_shader *prog = panfrost_alloc_variant(uncompiled);
+        struct panfrost_compiled_shader *prog =
+                calloc(1, sizeof(struct panfrost_compiled_shader));
 
-        *prog = (struct panfrost_compiled_shader) {
-                .key = *key,
-                .stream_output = uncompiled->stream_output,
-        };
+        prog->key = *key;
+        prog->key_hash = key_hash;
+        prog->stream_output = uncompiled->stream_output;
+        util_queue_fence_init(&prog->ready);
+
+        util_dynarray_append(&uncompiled->variants,
+                             struct panfrost_compiled_shader *, prog);
+        _mesa_hash_table_insert_pre_hashed(uncompiled->variant_index, key_hash,
+                                           &prog->key, prog);
 
-        panfrost_shader_get(ctx->base.screen, &ctx->shaders, &ctx->descs,
-                            uncompiled, &ctx->base.debug, prog, 0);
+        return prog;
+}
+
+/* Upload a compiled variant to the pools of the first context using it */
+
+static void
+panfrost_finish_variant_locked(
+        struct panfrost_context *ctx,
+        struct panfrost_uncompiled_shader *uncompiled,
+        struct panfrost_compiled_shader *prog)
+{
+        panfrost_shader_upload(ctx->base.screen, &ctx->descs, prog);
 
         /* Fixup the stream out information */
         prog->so_mask =
@@ -285,7 +541,74 @@ panfrost_new_variant_locked(
 
         prog->earlyzs = pan_earlyzs_analyze(&prog->info);
 
-        return prog;
+        p_atomic_set(&prog->uploaded, true);
+}
+
+struct panfrost_compile_job {
+        struct panfrost_uncompiled_shader *uncompiled;
+        struct panfrost_compiled_shader *prog;
+};
+
+static void
+panfrost_compile_job_execute(void *data, void *gdata, int thread_index)
+{
+        struct panfrost_compile_job *job = data;
+
+        /* There is no context to report to from the queue */
+        panfrost_shader_compile_variant(gdata, job->uncompiled, NULL,
+                                        job->prog, 0);
+}
+
+static void
+panfrost_compile_job_cleanup(void *data, void *gdata, int thread_index)
+{
+        free(data);
+}
+
+static void
+panfrost_queue_compile(struct panfrost_screen *screen,
+                       struct panfrost_uncompiled_shader *uncompiled,
+                       struct panfrost_compiled_shader *prog)
+{
+        struct panfrost_compile_job *job =
+                malloc(sizeof(struct panfrost_compile_job));
+
+        *job = (struct panfrost_compile_job) {
+                .uncompiled = uncompiled,
+                .prog = prog,
+        };
+
+        util_queue_add_job(&screen->shader_queue, job, &prog->ready,
+                           panfrost_compile_job_execute,
+                           panfrost_compile_job_cleanup, 0);
+}
+
+/* Queue compiles of the variants of a new shader that earlier processes
+ * used, as recorded in the disk cache */
+
+static void
+panfrost_warmup_precompile(struct panfrost_screen *screen,
+                           struct panfrost_uncompiled_shader *so)
+{
+        simple_mtx_lock(&screen->warmup.lock);
+
+        util_dynarray_foreach(&screen->warmup.variants,
+                              struct panfrost_warmup_variant, v) {
+                if (memcmp(v->nir_sha1, so->nir_sha1, sizeof(so->nir_sha1)))
+                        continue;
+
+                uint32_t key_hash = panfrost_shader_key_hash(&v->key);
+
+                if (_mesa_hash_table_search_pre_hashed(so->variant_index,
+                                                       key_hash, &v->key))
+                        continue;
+
+                panfrost_queue_compile(screen, so,
+                                       panfrost_new_variant_locked(so, &v->key,
+                                                                   key_hash));
+        }
+
+        simple_mtx_unlock(&screen->warmup.lock);
 }
 
 static void
@@ -300,52 +623,143 @@ panfrost_bind_shader_state(
 
         ctx->dirty |= PAN_DIRTY_TLS_SIZE;
         ctx->dirty_shader[type] |= PAN_DIRTY_STAGE_SHADER;
+}
 
-        if (hwcso)
-                panfrost_update_shader_variant(ctx, type);
+/* Wait for a variant to be compiled, upload it and bind it */
+
+static void
+panfrost_end_shader_variant(struct panfrost_context *ctx,
+                            enum pipe_shader_type type,
+                            struct panfrost_compiled_shader *compiled)
+{
+        struct panfrost_uncompiled_shader *uncompiled = ctx->uncompiled[type];
+
+        util_queue_fence_wait(&compiled->ready);
+
+        if (!p_atomic_read(&compiled->uploaded)) {
+                simple_mtx_lock(&uncompiled->lock);
+
+                if (!compiled->uploaded)
+                        panfrost_finish_variant_locked(ctx, uncompiled, compiled);
+
+                simple_mtx_unlock(&uncompiled->lock);
+        }
+
+        /* Variants change at draw time with the rasterizer and blend state */
+        if (ctx->prog[type] != compiled)
+                ctx->dirty_shader[type] |= PAN_DIRTY_STAGE_SHADER;
+
+        ctx->prog[type] = compiled;
+        ctx->last_variant[type].serial = uncompiled->serial;
+        ctx->last_variant[type].prog = compiled;
 }
 
-void
-panfrost_update_shader_variant(struct panfrost_context *ctx,
-                               enum pipe_shader_type type)
+/*
+ * Select the variant of a stage for the current state, compiling it if it
+ * doesn't exist yet. If defer is set and the variant is still being compiled
+ * on the shader queue, as the precompile queued at CSO creation may be, it is
+ * returned without waiting, and the caller must finish it with
+ * panfrost_end_shader_variant once it has done other work. Otherwise the
+ * variant is finished here and NULL is returned.
+ */
+static struct panfrost_compiled_shader *
+panfrost_begin_shader_variant(struct panfrost_context *ctx,
+                              enum pipe_shader_type type, bool defer)
 {
         /* No shader variants for compute */
         if (type == PIPE_SHADER_COMPUTE)
-                return;
+                return NULL;
 
         /* We need linking information, defer this */
         if (type == PIPE_SHADER_FRAGMENT && !ctx->uncompiled[PIPE_SHADER_VERTEX])
-                return;
+                return NULL;
 
         /* Also defer, happens with GALLIUM_HUD */
         if (!ctx->uncompiled[type])
-                return;
+                return NULL;
 
         /* Match the appropriate variant */
         struct panfrost_uncompiled_shader *uncompiled = ctx->uncompiled[type];
+        struct panfrost_screen *screen = pan_screen(ctx->base.screen);
         struct panfrost_compiled_shader *compiled = NULL;
 
-        simple_mtx_lock(&uncompiled->lock);
-
         struct panfrost_shader_key key = { 0 };
         panfrost_build_key(ctx, &key, uncompiled->nir);
 
-        util_dynarray_foreach(&uncompiled->variants, struct panfrost_compiled_shader, so) {
-                if (memcmp(&key, &so->key, sizeof(key)) == 0) {
-                        compiled = so;
-                        break;
-                }
+        /* Rebinding the last variant is the common case, and that variant is
+         * known to be ready */
+        if (ctx->last_variant[type].serial == uncompiled->serial &&
+            memcmp(&key, &ctx->last_variant[type].prog->key, sizeof(key)) == 0) {
+                if (ctx->prog[type] != ctx->last_variant[type].prog)
+                        ctx->dirty_shader[type] |= PAN_DIRTY_STAGE_SHADER;
+
+                ctx->prog[type] = ctx->last_variant[type].prog;
+                return NULL;
         }
 
-        if (compiled == NULL)
-                compiled = panfrost_new_variant_locked(ctx, uncompiled, &key);
+        uint32_t key_hash = panfrost_shader_key_hash(&key);
 
-        ctx->prog[type] = compiled;
+        simple_mtx_lock(&uncompiled->lock);
+
+        struct hash_entry *entry =
+                _mesa_hash_table_search_pre_hashed(uncompiled->variant_index,
+                                                   key_hash, &key);
+
+        if (entry)
+                compiled = entry->data;
+
+        /* Compile new variants without the lock held, so that other threads
+         * can look up other keys in the meantime. Threads wanting the same
+         * key find the variant and wait on its fence. */
+        bool compile = (compiled == NULL);
+
+        if (compile) {
+                compiled = panfrost_new_variant_locked(uncompiled, &key, key_hash);
+                util_queue_fence_reset(&compiled->ready);
+        }
 
-        /* TODO: it would be more efficient to release the lock before
-         * compiling instead of after, but that can race if thread A compiles a
-         * variant while thread B searches for that same variant */
         simple_mtx_unlock(&uncompiled->lock);
+
+        if (compile) {
+                panfrost_shader_compile_variant(screen, uncompiled,
+                                                &ctx->base.debug, compiled, 0);
+                util_queue_fence_signal(&compiled->ready);
+
+                panfrost_warmup_record(screen, uncompiled, &key);
+        } else if (defer && !util_queue_fence_is_signalled(&compiled->ready)) {
+                return compiled;
+        }
+
+        panfrost_end_shader_variant(ctx, type, compiled);
+        return NULL;
+}
+
+void
+panfrost_update_shader_variant(struct panfrost_context *ctx,
+                               enum pipe_shader_type type)
+{
+        panfrost_begin_shader_variant(ctx, type, false);
+}
+
+/*
+ * Select the vertex and fragment variants together. Vertex shaders have a
+ * single variant, precompiled on the shader queue when the CSO is created. A
+ * program is usually bound right after its shaders are created, so rather
+ * than waiting for that precompile before compiling the fragment variant,
+ * compile the fragment variant here while the precompile runs. Linking a new
+ * program then costs about the longer of the two compiles rather than their
+ * sum.
+ */
+static void
+panfrost_update_vs_fs_variants(struct panfrost_context *ctx)
+{
+        struct panfrost_compiled_shader *vs =
+                panfrost_begin_shader_variant(ctx, PIPE_SHADER_VERTEX, true);
+
+        panfrost_begin_shader_variant(ctx, PIPE_SHADER_FRAGMENT, false);
+
+        if (vs)
+                panfrost_end_shader_variant(ctx, PIPE_SHADER_VERTEX, vs);
 }
 
 static void
@@ -355,13 +769,60 @@ panfrost_bind_vs_state(struct pipe_context *pctx, void *hwcso)
 
         /* Fragment shaders are linked with vertex shaders */
         struct panfrost_context *ctx = pan_context(pctx);
-        panfrost_update_shader_variant(ctx, PIPE_SHADER_FRAGMENT);
+        struct panfrost_uncompiled_shader *vs = hwcso;
+
+        if (vs && vs->xfb)
+                panfrost_upload_precompiled(ctx, vs, vs->xfb);
+
+        if (hwcso)
+                panfrost_update_vs_fs_variants(ctx);
+        else
+                panfrost_update_shader_variant(ctx, PIPE_SHADER_FRAGMENT);
 }
 
 static void
 panfrost_bind_fs_state(struct pipe_context *pctx, void *hwcso)
 {
         panfrost_bind_shader_state(pctx, hwcso, PIPE_SHADER_FRAGMENT);
+
+        if (hwcso)
+                panfrost_update_shader_variant(pan_context(pctx),
+                                               PIPE_SHADER_FRAGMENT);
+}
+
+/*
+ * Mediump float varyings only need fp16 in the varying buffer, halving their
+ * memory traffic on Valhall. Arrays are excluded so indirect indexing can keep
+ * assuming 16-byte slots, as are flat varyings, which are loaded as 32-bit, and
+ * locations shared with a varying that can't be packed.
+ */
+static uint32_t
+panfrost_fp16_varying_mask(nir_shader *nir)
+{
+        uint32_t fp16 = 0, fp32 = 0;
+
+        nir_foreach_shader_out_variable(var, nir) {
+                if (var->data.location < VARYING_SLOT_VAR0)
+                        continue;
+
+                unsigned index = var->data.location - VARYING_SLOT_VAR0;
+                unsigned slots = glsl_count_attribute_slots(var->type, false);
+
+                if (index + slots > 32)
+                        continue;
+
+                bool mediump = var->data.precision == GLSL_PRECISION_MEDIUM ||
+                               var->data.precision == GLSL_PRECISION_LOW;
+
+                if (mediump && glsl_type_is_vector_or_scalar(var->type) &&
+                    glsl_get_base_type(var->type) == GLSL_TYPE_FLOAT &&
+                    var->data.interpolation != INTERP_MODE_FLAT)
+                        fp16 |= BITFIELD_BIT(index);
+                else
+                        fp32 |= BITFIELD_RANGE(index, slots);
+        }
+
+        return fp16 & ~fp32;
 }
 
 static void *
@@ -373,7 +834,7 @@ panfrost_create_shader_state(
                           tgsi_to_nir(cso->tokens, pctx->screen, false) :
                           cso->ir.nir;
 
-        struct panfrost_uncompiled_shader *so = panfrost_alloc_shader(nir);
+        struct panfrost_uncompiled_shader *so = panfrost_alloc_shader(pctx->screen, nir);
 
         /* The driver gets ownership of the nir_shader for graphics. The NIR is
          * ralloc'd. Free the NIR when we free the uncompiled shader.
@@ -388,6 +849,8 @@ panfrost_create_shader_state(
                 so->fixed_varying_mask =
                         (so->nir->info.outputs_written & BITFIELD_MASK(VARYING_SLOT_VAR0)) &
                         ~VARYING_BIT_POS & ~VARYING_BIT_PSIZ;
+
+                so->fp16_varying_mask = panfrost_fp16_varying_mask(so->nir);
         }
 
         /* If this shader uses transform feedback, compile the transform
@@ -396,15 +859,11 @@ panfrost_create_shader_state(
         struct panfrost_context *ctx = pan_context(pctx);
 
         if (so->nir->xfb_info) {
-                nir_shader *xfb = nir_shader_clone(NULL, so->nir);
-                xfb->info.name = ralloc_asprintf(xfb, "%s@xfb", xfb->info.name);
-                xfb->info.internal = true;
-
                 so->xfb = calloc(1, sizeof(struct panfrost_compiled_shader));
                 so->xfb->key.vs_is_xfb = true;
 
-                panfrost_shader_get(ctx->base.screen, &ctx->shaders, &ctx->descs,
-                                    so, &ctx->base.debug, so->xfb, 0);
+                panfrost_shader_compile_variant(pan_screen(pctx->screen), so,
+                                                &ctx->base.debug, so->xfb, 0);
 
                 /* Since transform feedback is handled via the transform
                  * feedback program, the original program no longer uses XFB
@@ -434,9 +893,23 @@ panfrost_create_shader_state(
 
         /* Creating a CSO is single-threaded, so it's ok to use the
          * locked function without explicitly taking the lock. Creating a
-         * default variant acts as a precompile.
+         * default variant acts as a precompile. It runs on the shader queue
+         * unless a debug callback wants the compile to be reported here, and
+         * it is uploaded by the first context binding the shader.
          */
-        panfrost_new_variant_locked(ctx, so, &key);
+        struct panfrost_compiled_shader *prog =
+                panfrost_new_variant_locked(so, &key,
+                                            panfrost_shader_key_hash(&key));
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+
+        if (util_queue_is_initialized(&screen->shader_queue) &&
+            !ctx->base.debug.debug_message) {
+                panfrost_queue_compile(screen, so, prog);
+                panfrost_warmup_precompile(screen, so);
+        } else {
+                panfrost_shader_compile_variant(screen, so, &ctx->base.debug,
+                                                prog, 0);
+        }
 
         return so;
 }
@@ -445,17 +918,32 @@ static void
 panfrost_delete_shader_state(struct pipe_context *pctx, void *so)
 {
         struct panfrost_uncompiled_shader *cso = (struct panfrost_uncompiled_shader *) so;
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+
+        /* Cached RSDs are keyed by the address of fragment shader binaries,
+         * which may be reused, in any context */
+        if (cso->nir && cso->nir->info.stage == MESA_SHADER_FRAGMENT)
+                panfrost_rsd_cache_invalidate(screen);
+
+        util_dynarray_foreach(&cso->variants, struct panfrost_compiled_shader *, it) {
+                struct panfrost_compiled_shader *so = *it;
 
-        util_dynarray_foreach(&cso->variants, struct panfrost_compiled_shader, so) {
-                panfrost_bo_unreference(so->bin.bo);
-                panfrost_bo_unreference(so->state.bo);
-                panfrost_bo_unreference(so->linkage.bo);
+                /* The precompile may still be running on the queue */
+                util_queue_fence_wait(&so->ready);
+                util_queue_fence_destroy(&so->ready);
+
+                if (!so->uploaded)
+                        util_dynarray_fini(&so->pending.binary);
+
+                panfrost_shader_release(screen, so);
+                free(so);
         }
 
         if (cso->xfb) {
-                panfrost_bo_unreference(cso->xfb->bin.bo);
-                panfrost_bo_unreference(cso->xfb->state.bo);
-                panfrost_bo_unreference(cso->xfb->linkage.bo);
+                if (!cso->xfb->uploaded)
+                        util_dynarray_fini(&cso->xfb->pending.binary);
+
+                panfrost_shader_release(screen, cso->xfb);
                 free(cso->xfb);
         }
 
@@ -474,14 +962,17 @@ panfrost_create_compute_state(
         const struct pipe_compute_state *cso)
 {
         struct panfrost_context *ctx = pan_context(pctx);
-        struct panfrost_uncompiled_shader *so = panfrost_alloc_shader(cso->prog);
-        struct panfrost_compiled_shader *v = panfrost_alloc_variant(so);
-        memset(v, 0, sizeof *v);
+        struct panfrost_uncompiled_shader *so = panfrost_alloc_shader(pctx->screen, cso->prog);
+        struct panfrost_shader_key key = { 0 };
+        struct panfrost_compiled_shader *v =
+                panfrost_new_variant_locked(so, &key,
+                                            panfrost_shader_key_hash(&key));
 
         assert(cso->ir_type == PIPE_SHADER_IR_NIR && "TGSI kernels unsupported");
 
-        panfrost_shader_get(pctx->screen, &ctx->shaders, &ctx->descs,
-                            so, &ctx->base.debug, v, cso->static_shared_mem);
+        panfrost_shader_compile_variant(pan_screen(pctx->screen), so,
+                                        &ctx->base.debug, v,
+                                        cso->static_shared_mem);
 
         /* The NIR becomes invalid after this. For compute kernels, we never
          * need to access it again. Don't keep a dangling pointer around.
@@ -498,9 +989,16 @@ panfrost_bind_compute_state(struct pipe_context *pipe, void *cso)
         struct panfrost_uncompiled_shader *uncompiled = cso;
 
         ctx->uncompiled[PIPE_SHADER_COMPUTE] = uncompiled;
+        ctx->prog[PIPE_SHADER_COMPUTE] = NULL;
+
+        if (uncompiled) {
+                struct panfrost_compiled_shader *prog =
+                        *util_dynarray_element(&uncompiled->variants,
+                                               struct panfrost_compiled_shader *, 0);
 
-        ctx->prog[PIPE_SHADER_COMPUTE] =
-                uncompiled ? util_dynarray_begin(&uncompiled->variants) : NULL;
+                panfrost_upload_precompiled(ctx, uncompiled, prog);
+                ctx->prog[PIPE_SHADER_COMPUTE] = prog;
+        }
 }
 
 void
@@ -0,0 +1,89 @@
+#
+# Copyright (C) 2020 Google, Inc.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+
+import argparse
+import sys
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-p', '--import-path', required=True)
+parser.add_argument('-C', '--src', required=True)
+parser.add_argument('-H', '--hdr', required=True)
+args = parser.parse_args()
+sys.path.insert(0, args.import_path)
+
+
+from u_trace import Tracepoint
+from u_trace import TracepointArg
+from u_trace import utrace_generate
+
+# List of the default tracepoints enabled. By default tracepoints are enabled,
+# set tp_default_enabled=False to disable them by default.
+pan_default_tps = []
+
+#
+# Tracepoint definitions:
+#
+
+
+def begin_end_tp(name, args=[], tp_struct=None, tp_print=None,
+                 tp_default_enabled=True):
+    global pan_default_tps
+    if tp_default_enabled:
+        pan_default_tps.append(name)
+    Tracepoint('start_{0}'.format(name),
+               toggle_name=name,
+               args=args,
+               tp_struct=tp_struct,
+               tp_perfetto='pan_start_{0}'.format(name),
+               tp_print=tp_print)
+    Tracepoint('end_{0}'.format(name),
+               toggle_name=name,
+               tp_perfetto='pan_end_{0}'.format(name))
+
+
+# The timestamps are written around the job chains (Job Manager) or the
+# command stream segments (CSF) of each batch. The reason is the
+# static string passed by the code which submitted the batch.
+begin_end_tp('vertex_tiler',
+    args=[TracepointArg(type='uint32_t',     var='seqnum', c_format='%u'),
+          TracepointArg(type='const char *', var='reason', c_format='%s')],
+    tp_print=['seqnum=%u, reason=%s', '__entry->seqnum', '__entry->reason'],
+)
+
+begin_end_tp('fragment',
+    args=[TracepointArg(type='uint32_t',     var='seqnum', c_format='%u'),
+          TracepointArg(type='const char *', var='reason', c_format='%s'),
+          TracepointArg(type='uint16_t',     var='width',  c_format='%u'),
+          TracepointArg(type='uint16_t',     var='height', c_format='%u'),
+          TracepointArg(type='uint8_t',      var='mrts',   c_format='%u'),
+          TracepointArg(type='uint8_t',      var='samples', c_format='%u')],
+    tp_print=['seqnum=%u, reason=%s, %ux%u, mrts=%u, samples=%u',
+        '__entry->seqnum', '__entry->reason', '__entry->width',
+        '__entry->height', '__entry->mrts', '__entry->samples'],
+)
+
+utrace_generate(cpath=args.src,
+                hpath=args.hdr,
+                ctx_param='struct pipe_context *pctx',
+                trace_toggle_name='pan_gpu_tracepoint',
+                trace_toggle_defaults=pan_default_tps)
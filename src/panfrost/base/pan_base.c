@@ -30,13 +30,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 #include <poll.h>
 #include <pthread.h>
 
+#include "util/futex.h"
+#include "util/hash_table.h"
 #include "util/macros.h"
+#include "util/u_atomic.h"
+#include "util/u_debug.h"
+#include "util/disk_cache.h"
+#include "util/disk_cache_os.h"
+#include "util/ralloc.h"
 #include "pan_base.h"
 
 #include "mali_kbase_ioctl.h"
@@ -50,21 +60,181 @@ kbase_open(kbase k, int fd, unsigned cs_queue_count, bool verbose)
         k->page_size = sysconf(_SC_PAGE_SIZE);
         k->verbose = verbose;
 
+        k->tiler_heap_config = (struct kbase_tiler_heap_config) {
+                .chunk_size = 1 << 21, /* 2 MB */
+                .initial_chunks = 2,
+                .max_chunks = 200,
+                .target_in_flight = 65535,
+        };
+
+        /* Drive a fake Mali-G610 instead of the real device, for measuring
+         * the CPU overhead of the driver. Ownership of the fd was passed in. */
+        if (k->fd != -1 && debug_get_bool_option("PAN_KBASE_NOOP", false)) {
+                close(k->fd);
+                k->fd = -1;
+        }
+
         if (k->fd == -1)
            return kbase_open_csf_noop(k);
 
         struct kbase_ioctl_version_check ver = { 0 };
+        bool ret = false;
 
         if (ioctl(k->fd, KBASE_IOCTL_VERSION_CHECK_RESERVED, &ver) == 0) {
-                return kbase_open_csf(k);
+                ret = kbase_open_csf(k);
         } else if (ioctl(k->fd, KBASE_IOCTL_VERSION_CHECK, &ver) == 0) {
                 if (ver.major == 3)
-                        return kbase_open_old(k);
+                        ret = kbase_open_old(k);
                 else
-                        return kbase_open_new(k);
+                        ret = kbase_open_new(k);
+        }
+
+        if (ret && debug_get_bool_option("PAN_KBASE_EVENT_THREAD", false))
+                kbase_start_event_thread(k);
+
+        if (ret)
+                k->share_groups = debug_get_bool_option("PAN_KBASE_SHARED_GROUPS", false);
+
+        return ret;
+}
+
+/* GPU properties can only change with a reboot or another kernel, so they are
+ * kept in a small file in the Mesa cache directory, saving short-lived
+ * processes the GET_GPUPROPS ioctls. The GPU ID can't be checked without
+ * those ioctls, so the entry is tied to the device node instead. */
+
+#define KBASE_PROPS_CACHE_MAGIC 0x70626b50 /* "Pkbp" */
+#define KBASE_PROPS_CACHE_MAX_SIZE 65536
+
+struct kbase_props_cache_header {
+        uint32_t magic;
+        uint32_t api;
+        uint64_t rdev;
+        char boot_id[40];
+        /* Sized so that the header has no padding */
+        char release[68];
+        uint32_t size;
+};
+
+static bool
+kbase_props_cache_header(kbase k, struct kbase_props_cache_header *h)
+{
+        struct stat st;
+        struct utsname uts;
+
+        if (fstat(k->fd, &st) || uname(&uts))
+                return false;
+
+        memset(h, 0, sizeof(*h));
+        h->magic = KBASE_PROPS_CACHE_MAGIC;
+        h->api = k->api;
+        h->rdev = st.st_rdev;
+
+        strncpy(h->release, uts.release, sizeof(h->release) - 1);
+
+        FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+        if (!f)
+                return false;
+
+        bool ok = fgets(h->boot_id, sizeof(h->boot_id), f) != NULL;
+        fclose(f);
+
+        return ok;
+}
+
+static char *
+kbase_props_cache_path(void *mem_ctx, uint64_t rdev)
+{
+#ifdef ENABLE_SHADER_CACHE
+        if (!disk_cache_enabled())
+                return NULL;
+
+        char *dir = disk_cache_generate_cache_dir(mem_ctx, "kbase", "panfrost");
+        if (!dir)
+                return NULL;
+
+        return ralloc_asprintf(mem_ctx, "%s/panfrost_kbase_props_%"PRIx64,
+                               dir, rdev);
+#else
+        return NULL;
+#endif
+}
+
+bool
+kbase_props_cache_load(kbase k)
+{
+        struct kbase_props_cache_header h, file_h;
+
+        if (k->fd == -1 || !kbase_props_cache_header(k, &h))
+                return false;
+
+        void *mem_ctx = ralloc_context(NULL);
+        char *path = kbase_props_cache_path(mem_ctx, h.rdev);
+        FILE *f = path ? fopen(path, "rb") : NULL;
+        ralloc_free(mem_ctx);
+
+        if (!f)
+                return false;
+
+        bool ok = fread(&file_h, sizeof(file_h), 1, f) == 1 &&
+                file_h.size && file_h.size <= KBASE_PROPS_CACHE_MAX_SIZE;
+
+        h.size = file_h.size;
+        ok = ok && !memcmp(&h, &file_h, sizeof(h));
+
+        if (ok) {
+                k->gpuprops = malloc(file_h.size);
+                ok = k->gpuprops &&
+                        fread(k->gpuprops, file_h.size, 1, f) == 1;
+
+                if (ok) {
+                        k->gpuprops_size = file_h.size;
+                } else {
+                        free(k->gpuprops);
+                        k->gpuprops = NULL;
+                }
         }
 
-        return false;
+        fclose(f);
+        return ok;
+}
+
+void
+kbase_props_cache_store(kbase k)
+{
+        struct kbase_props_cache_header h;
+
+        if (k->fd == -1 || !k->gpuprops_size ||
+            k->gpuprops_size > KBASE_PROPS_CACHE_MAX_SIZE ||
+            !kbase_props_cache_header(k, &h))
+                return;
+
+        h.size = k->gpuprops_size;
+
+        void *mem_ctx = ralloc_context(NULL);
+        char *path = kbase_props_cache_path(mem_ctx, h.rdev);
+
+        if (!path) {
+                ralloc_free(mem_ctx);
+                return;
+        }
+
+        /* Write to a temporary file and rename it, so that concurrent
+         * processes never see a partial entry */
+        char *tmp = ralloc_asprintf(mem_ctx, "%s.%i", path, getpid());
+        FILE *f = fopen(tmp, "wb");
+
+        if (f) {
+                bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+                        fwrite(k->gpuprops, h.size, 1, f) == 1;
+
+                ok &= fclose(f) == 0;
+
+                if (!ok || rename(tmp, path))
+                        unlink(tmp);
+        }
+
+        ralloc_free(mem_ctx);
 }
 
 /* If fd != -1, ownership is passed in */
@@ -76,18 +246,42 @@ kbase_alloc_gem_handle_locked(kbase k, base_va va, int fd)
                 .fd = fd
         };
 
-        unsigned size = util_dynarray_num_elements(&k->gem_handles, kbase_handle);
+        if (k->free_gem_handle >= 0) {
+                int handle = k->free_gem_handle;
+                kbase_handle *ptr = kbase_gem_handle_ptr(k, handle);
+
+                assert(ptr->fd == -2);
+                k->free_gem_handle = ptr->next_free;
+                *ptr = h;
+                return handle;
+        }
 
-        kbase_handle *handles = util_dynarray_begin(&k->gem_handles);
+        unsigned size = k->num_gem_handles;
+        unsigned chunk = size >> KBASE_HANDLE_CHUNK_SHIFT;
 
-        for (unsigned i = 0; i < size; ++i) {
-                if (handles[i].fd == -2) {
-                        handles[i] = h;
-                        return i;
+        if (chunk >= KBASE_HANDLE_MAX_CHUNKS) {
+                if (fd != -1)
+                        close(fd);
+                return -1;
+        }
+
+        if (!k->gem_handles[chunk]) {
+                kbase_handle *handles =
+                        calloc(KBASE_HANDLE_CHUNK_SIZE, sizeof(kbase_handle));
+
+                if (!handles) {
+                        if (fd != -1)
+                                close(fd);
+                        return -1;
                 }
+
+                p_atomic_set(&k->gem_handles[chunk], handles);
         }
 
-        util_dynarray_append(&k->gem_handles, kbase_handle, h);
+        k->gem_handles[chunk][size & (KBASE_HANDLE_CHUNK_SIZE - 1)] = h;
+
+        /* Publish the handle once its entry is written */
+        p_atomic_xchg(&k->num_gem_handles, size + 1);
 
         return size;
 }
@@ -107,79 +301,49 @@ kbase_alloc_gem_handle(kbase k, base_va va, int fd)
 void
 kbase_free_gem_handle(kbase k, int handle)
 {
-        pthread_mutex_lock(&k->handle_lock);
-
-        unsigned size = util_dynarray_num_elements(&k->gem_handles, kbase_handle);
+        kbase_handle *ptr = kbase_gem_handle_ptr(k, handle);
 
-        int fd;
-
-        if (handle >= size) {
-                pthread_mutex_unlock(&k->handle_lock);
+        if (!ptr)
                 return;
-        }
 
-        if (handle + 1 < size) {
-                kbase_handle *ptr = util_dynarray_element(&k->gem_handles, kbase_handle, handle);
-                fd = ptr->fd;
-                ptr->fd = -2;
-        } else {
-                fd = (util_dynarray_pop(&k->gem_handles, kbase_handle)).fd;
+        pthread_mutex_lock(&k->handle_lock);
+
+        if (ptr->dmabuf_ino) {
+                _mesa_hash_table_u64_remove(k->dmabuf_handles, ptr->dmabuf_ino);
+                ptr->dmabuf_ino = 0;
+        } else if (ptr->fd >= 0) {
+                k->dmabuf_unindexed--;
         }
 
-        if (fd != -1)
-                close(fd);
+        int fd = ptr->fd;
+        ptr->fd = -2;
+        ptr->next_free = k->free_gem_handle;
+        k->free_gem_handle = handle;
 
         pthread_mutex_unlock(&k->handle_lock);
+
+        if (fd >= 0)
+                close(fd);
 }
 
 kbase_handle
 kbase_gem_handle_get(kbase k, int handle)
 {
-        kbase_handle h = { .fd = -1 };
+        kbase_handle *ptr = kbase_gem_handle_ptr(k, handle);
 
-        pthread_mutex_lock(&k->handle_lock);
-
-        unsigned size = util_dynarray_num_elements(&k->gem_handles, kbase_handle);
-
-        if (handle < size)
-                h = *util_dynarray_element(&k->gem_handles, kbase_handle, handle);
-
-        pthread_mutex_unlock(&k->handle_lock);
+        if (!ptr)
+                return (kbase_handle) { .fd = -1 };
 
-        return h;
-}
-
-int
-kbase_wait_bo(kbase k, int handle, int64_t timeout_ns, bool wait_readers)
-{
-        struct kbase_wait_ctx wait = kbase_wait_init(k, timeout_ns);
-
-        while (kbase_wait_for_event(&wait)) {
-                pthread_mutex_lock(&k->handle_lock);
-                if (handle >= util_dynarray_num_elements(&k->gem_handles, kbase_handle)) {
-                        pthread_mutex_unlock(&k->handle_lock);
-                        kbase_wait_fini(wait);
-                        errno = EINVAL;
-                        return -1;
-                }
-                kbase_handle *ptr = util_dynarray_element(&k->gem_handles, kbase_handle, handle);
-                if (!ptr->use_count) {
-                        pthread_mutex_unlock(&k->handle_lock);
-                        kbase_wait_fini(wait);
-                        return 0;
-                }
-                pthread_mutex_unlock(&k->handle_lock);
-        }
-
-        kbase_wait_fini(wait);
-        errno = ETIMEDOUT;
-        return -1;
+        return *ptr;
 }
 
 static void
 adjust_time(struct timespec *tp, int64_t ns)
 {
-        ns += tp->tv_nsec;
+        /* Split before adding, so that INT64_MAX does not overflow */
+        tp->tv_sec += ns / 1000000000;
+        ns = ns % 1000000000 + tp->tv_nsec;
+
         tp->tv_nsec = ns % 1000000000;
         tp->tv_sec += ns / 1000000000;
 }
@@ -190,9 +354,14 @@ ns_until(struct timespec tp)
         struct timespec now;
         clock_gettime(CLOCK_MONOTONIC, &now);
 
-        int64_t sec = (tp.tv_sec - now.tv_sec) * 1000000000;
+        int64_t sec = tp.tv_sec - now.tv_sec;
         int64_t ns = tp.tv_nsec - now.tv_nsec;
 
+        if (sec >= INT64_MAX / 1000000000 - 1)
+                return INT64_MAX;
+
+        sec *= 1000000000;
+
         /* Clamp the value to zero to avoid errors from ppoll */
         return MAX2(sec + ns, 0);
 }
@@ -208,6 +377,77 @@ kbase_wait_signal(kbase k)
         pthread_mutex_unlock(&k->event_cnd_lock);
 }
 
+static void *
+kbase_event_thread(void *data)
+{
+        kbase k = data;
+
+        struct pollfd pfd[2] = {
+                { .fd = k->fd, .events = POLLIN },
+                { .fd = k->event_thread_fd, .events = POLLIN },
+        };
+
+        for (;;) {
+                int ret = poll(pfd, ARRAY_SIZE(pfd), -1);
+
+                if (ret == -1) {
+                        if (errno == EINTR)
+                                continue;
+
+                        perror("poll(mali fd)");
+                        break;
+                }
+
+                if (pfd[1].revents)
+                        break;
+
+                pthread_mutex_lock(&k->event_read_lock);
+                k->handle_events(k);
+                pthread_mutex_unlock(&k->event_read_lock);
+
+                p_atomic_inc(&k->event_seq);
+                futex_wake(&k->event_seq, INT32_MAX);
+        }
+
+        return NULL;
+}
+
+void
+kbase_start_event_thread(kbase k)
+{
+#if UTIL_FUTEX_SUPPORTED
+        k->event_thread_fd = eventfd(0, EFD_CLOEXEC);
+        if (k->event_thread_fd == -1) {
+                perror("eventfd");
+                return;
+        }
+
+        if (pthread_create(&k->event_thread, NULL, kbase_event_thread, k)) {
+                perror("pthread_create");
+                close(k->event_thread_fd);
+                return;
+        }
+
+        k->event_thread_enabled = true;
+#endif
+}
+
+void
+kbase_stop_event_thread(kbase k)
+{
+        if (!k->event_thread_enabled)
+                return;
+
+        uint64_t val = 1;
+        if (write(k->event_thread_fd, &val, sizeof(val)) != sizeof(val))
+                perror("write(eventfd)");
+
+        pthread_join(k->event_thread, NULL);
+        close(k->event_thread_fd);
+
+        k->event_thread_enabled = false;
+}
+
 struct kbase_wait_ctx
 kbase_wait_init(kbase k, int64_t timeout_ns)
 {
@@ -227,6 +467,29 @@ kbase_wait_for_event(struct kbase_wait_ctx *ctx)
 {
         kbase k = ctx->k;
 
+        if (k->event_thread_enabled) {
+                /* Again return instantly the first time, but remember the
+                 * sequence number so that events handled before the caller
+                 * checks its condition are not missed */
+                if (!ctx->has_seq) {
+                        ctx->seq = p_atomic_read(&k->event_seq);
+                        ctx->has_seq = true;
+                        return true;
+                }
+
+                do {
+                        futex_wait(&k->event_seq, ctx->seq, &ctx->until);
+
+                        uint32_t seq = p_atomic_read(&k->event_seq);
+                        if (seq != ctx->seq) {
+                                ctx->seq = seq;
+                                return true;
+                        }
+                } while (ns_until(ctx->until));
+
+                return false;
+        }
+
         /* Return instantly the first time so that a check outside the
          * wait_for_Event loop is not required */
         if (!ctx->has_cnd_lock) {
@@ -265,9 +528,66 @@ kbase_wait_fini(struct kbase_wait_ctx ctx)
         }
 }
 
+int
+kbase_wait_bo(kbase k, int handle, int64_t timeout_ns, bool wait_readers)
+{
+        kbase_handle *ptr = kbase_gem_handle_ptr(k, handle);
+
+        if (!ptr) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        if (!p_atomic_read(&ptr->use_count))
+                return 0;
+
+#if UTIL_FUTEX_SUPPORTED
+        /* The event thread wakes the waiters of a BO once it is idle, rather
+         * than every waiter for every event */
+        if (k->event_thread_enabled) {
+                struct kbase_wait_ctx wait = kbase_wait_init(k, timeout_ns);
+
+                for (;;) {
+                        /* Ordered against the decrement of use_count by the
+                         * exchange, so that either the wake or the idle BO
+                         * is seen */
+                        p_atomic_xchg(&ptr->has_waiters, 1);
+
+                        uint32_t count = p_atomic_read(&ptr->use_count);
+                        if (!count)
+                                return 0;
+
+                        if (!ns_until(wait.until)) {
+                                errno = ETIMEDOUT;
+                                return -1;
+                        }
+
+                        futex_wait(&ptr->use_count, count, &wait.until);
+                }
+        }
+#endif
+
+        struct kbase_wait_ctx wait = kbase_wait_init(k, timeout_ns);
+
+        while (kbase_wait_for_event(&wait)) {
+                if (!p_atomic_read(&ptr->use_count)) {
+                        kbase_wait_fini(wait);
+                        return 0;
+                }
+        }
+
+        kbase_wait_fini(wait);
+        errno = ETIMEDOUT;
+        return -1;
+}
+
 void
 kbase_ensure_handle_events(kbase k)
 {
+        /* The event thread handles events as soon as they arrive */
+        if (k->event_thread_enabled)
+                return;
+
         /* If we don't manage to take the lock, then events have recently/will
          * soon be handled, there is no need to do anything. */
         if (pthread_mutex_trylock(&k->event_read_lock) == 0) {
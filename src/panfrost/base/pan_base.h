@@ -25,7 +25,9 @@
 #ifndef PAN_BASE_H
 #define PAN_BASE_H
 
+#include "util/u_atomic.h"
 #include "util/u_dynarray.h"
+#include "util/bitset.h"
 #include "util/list.h"
 
 #define PAN_EVENT_SIZE 16
@@ -37,6 +39,7 @@ struct base_ptr {
 };
 
 struct kbase_syncobj;
+struct hash_table_u64;
 
 /* The job is done when the queue seqnum > seqnum */
 struct kbase_sync_link {
@@ -47,22 +50,103 @@ struct kbase_sync_link {
 };
 
 struct kbase_event_slot {
+        /* Protected by queue_lock */
         struct kbase_sync_link *syncobjs;
         struct kbase_sync_link **back;
+
+        /* Only accessed with p_atomic_read/p_atomic_set, so that submission
+         * and dependency tracking do not need to take queue_lock */
         uint64_t last_submit;
         uint64_t last;
 };
 
+/* Event slots are allocated in chunks, each with its own event memory. Chunks
+ * are only freed when the device is closed, so pointers to slots stay valid
+ * and lookups do not need any locking. */
+#define KBASE_EVENT_CHUNK_SLOTS 256
+#define KBASE_MAX_EVENT_CHUNKS 64
+#define KBASE_MAX_EVENT_SLOTS (KBASE_EVENT_CHUNK_SLOTS * KBASE_MAX_EVENT_CHUNKS)
+
+struct kbase_event_chunk {
+        /* Only allocated for CSF */
+        struct base_ptr event_mem;
+        struct base_ptr kcpu_event_mem;
+        unsigned mem_size;
+
+        struct kbase_event_slot slots[KBASE_EVENT_CHUNK_SLOTS];
+};
+
+/* Flags for context_create */
+#define KBASE_CONTEXT_COMPUTE_ONLY  (1 << 0)
+/* Queue group priority, the default is medium */
+#define KBASE_CONTEXT_PRIORITY_HIGH (1 << 1)
+#define KBASE_CONTEXT_PRIORITY_LOW  (1 << 2)
+
+/* With PAN_KBASE_SHARED_GROUPS=1, contexts with the same flags are packed
+ * into queue groups with this many CSIs, each context getting a fixed range
+ * of KBASE_SHARED_CONTEXT_CSI of them. */
+#define KBASE_SHARED_GROUP_CSI   8
+#define KBASE_SHARED_CONTEXT_CSI 2
+
+/* Tiler heaps per graphics context. While a batch's fragment pass reads a
+ * heap, the next batch's vertex pass can bin into another one. */
+#define KBASE_MAX_TILER_HEAPS 2
+
+/* Parameters of the tiler heaps of a context. The kernel allocates
+ * initial_chunks chunks up front and grows the heap on demand, until the
+ * heap has max_chunks chunks or target_in_flight render passes are in
+ * flight, after which the tiler runs out of memory. */
+struct kbase_tiler_heap_config {
+        unsigned chunk_size;
+        unsigned initial_chunks;
+        unsigned max_chunks;
+        unsigned target_in_flight;
+};
+
+/* A queue group shared between contexts, protected by csg_lock */
+struct kbase_csg {
+        struct list_head link;
+        unsigned flags;
+        uint8_t handle;
+        uint32_t uid;
+        /* Value of csg_faults for the handle when the group was created */
+        uint32_t faults_base;
+        /* Bitmask of the context CSI ranges in use */
+        uint32_t used;
+        unsigned refcnt;
+};
+
 struct kbase_context {
+        unsigned flags;
+        /* NULL if the context has a group of its own */
+        struct kbase_csg *csg;
+        /* First CSI of the context in its group */
+        unsigned csi_base;
         uint8_t csg_handle;
         uint8_t kcpu_queue;
         bool kcpu_init; // TODO: Always create a queue?
         uint32_t csg_uid;
         unsigned num_csi;
 
-        unsigned tiler_heap_chunk_size;
-        base_va tiler_heap_va;
-        base_va tiler_heap_header;
+        /* Value of csg_faults for the group when last checked */
+        uint32_t faults_seen;
+
+        /* Zero heaps for compute-only contexts */
+        unsigned num_tiler_heaps;
+        struct kbase_tiler_heap_config tiler_heap_config;
+        base_va tiler_heap_va[KBASE_MAX_TILER_HEAPS];
+        base_va tiler_heap_header[KBASE_MAX_TILER_HEAPS];
+};
+
+/* Exports wait on a queue without unsignalled exports where possible, so
+ * that they don't wait behind each other for unrelated work */
+#define KBASE_SYNC_FILE_QUEUES 16
+
+struct kbase_sync_file_queue {
+        /* Only used for its KCPU queue */
+        struct kbase_context kcpu;
+        /* The last sync file exported from the queue, or -1 */
+        int fd;
 };
 
 struct kbase_cs {
@@ -71,7 +155,10 @@ struct kbase_cs {
         base_va va;
         unsigned size;
         unsigned event_mem_offset;
+        /* Index relative to the csi_base of the context */
         unsigned csi;
+        /* Priority of the queue within its group, 0 to 15 */
+        unsigned priority;
 
         uint64_t last_insert;
 
@@ -84,11 +171,56 @@ struct kbase_cs {
 typedef struct {
         base_va va;
         int fd;
-        uint8_t use_count;
-        /* For emulating implicit sync. TODO make this work on v10 */
-        uint8_t last_access[KBASE_SLOT_COUNT];
+        /* Atomic, so that kbase_wait_bo doesn't need handle_lock. With the
+         * event thread, kbase_wait_bo sleeps on it as a futex, and sets
+         * has_waiters so that it is woken once the count drops to zero. */
+        uint32_t use_count;
+        uint8_t has_waiters;
+        /* For emulating implicit sync, the latest atom of each slot writing
+         * the BO, and reading it since the last write. The masks tell which
+         * slots have such an atom in flight. JM only: on v10, drivers sync
+         * with other users of dma-bufs through their fences, and order their
+         * own queues. */
+        uint8_t last_write[KBASE_SLOT_COUNT];
+        uint8_t last_read[KBASE_SLOT_COUNT];
+        uint8_t write_slots;
+        uint8_t read_slots;
+        /* For imported dma-bufs, the device and inode of the file, the
+         * inode being the key of dmabuf_handles. Zero if not in the table. */
+        uint64_t dmabuf_dev;
+        uint64_t dmabuf_ino;
+        /* For freed handles, the next freed handle, or -1 */
+        int next_free;
 } kbase_handle;
 
+/* JM atoms queued with submit_queue, then sent to the kernel with a single
+ * ioctl by submit_batch */
+struct kbase_atom_batch {
+        struct util_dynarray atoms;
+        /* External resource lists of the atoms */
+        struct util_dynarray extres;
+};
+
+static inline void
+kbase_atom_batch_init(struct kbase_atom_batch *b)
+{
+        util_dynarray_init(&b->atoms, NULL);
+        util_dynarray_init(&b->extres, NULL);
+}
+
+static inline void
+kbase_atom_batch_fini(struct kbase_atom_batch *b)
+{
+        assert(!b->atoms.size);
+        util_dynarray_fini(&b->atoms);
+        util_dynarray_fini(&b->extres);
+}
+
+/* The handle table is made of chunks which are never moved once allocated */
+#define KBASE_HANDLE_CHUNK_SHIFT 10
+#define KBASE_HANDLE_CHUNK_SIZE (1 << KBASE_HANDLE_CHUNK_SHIFT)
+#define KBASE_HANDLE_MAX_CHUNKS 256
+
 struct kbase_;
 typedef struct kbase_ *kbase;
 
@@ -99,35 +231,89 @@ struct kbase_ {
         int fd;
         unsigned api;
         unsigned page_size;
-        // TODO: Actually we may want to try to pack multiple contexts / queue
-        // "sets" into a single group...
         unsigned cs_queue_count;
 
+        /* Whether to pack contexts into shared queue groups */
+        bool share_groups;
+        pthread_mutex_t csg_lock;
+        struct list_head shared_groups;
+
         /* Must not hold handle_lock while acquiring event_read_lock */
         pthread_mutex_t handle_lock;
+        /* Taken around JM submissions, and held while atoms are queued in
+         * a kbase_atom_batch */
+        pthread_mutex_t submit_lock;
         pthread_mutex_t event_read_lock;
         pthread_mutex_t event_cnd_lock;
         pthread_cond_t event_cnd;
-        /* TODO: Per-context/queue locks? */
+
+        /* With PAN_KBASE_EVENT_THREAD=1, a single thread reads all events,
+         * and waiters sleep on a futex on event_seq instead of taking turns
+         * reading events. event_seq is incremented after events are
+         * handled. The eventfd is used to stop the thread. */
+        bool event_thread_enabled;
+        pthread_t event_thread;
+        int event_thread_fd;
+        uint32_t event_seq;
+        /* Protects the syncobj list and the callback lists of event slots.
+         * Fence lists are protected by a per-syncobj lock, which may be
+         * taken while holding queue_lock, but not the other way around. */
         pthread_mutex_t queue_lock;
 
         struct list_head syncobjs;
 
+        /* KCPU queues used for exporting syncobjs as sync files, protected
+         * by sync_file_lock */
+        struct kbase_sync_file_queue sync_file_queues[KBASE_SYNC_FILE_QUEUES];
+        unsigned sync_file_next;
+        pthread_mutex_t sync_file_lock;
+
         unsigned gpuprops_size;
         void *gpuprops;
 
+        /* Tiler heap parameters for contexts created from now on */
+        struct kbase_tiler_heap_config tiler_heap_config;
+
         void *tracking_region;
         void *csf_user_reg;
-        struct base_ptr event_mem;
-        struct base_ptr kcpu_event_mem;
-        // TODO: dynamically size
-        struct kbase_event_slot event_slots[256];
-        // TODO: USe a bitset?
+
+        /* On JM GPUs, every slot of the first chunk is used, indexed by atom
+         * number. On CSF, slots are allocated for each queue. Allocation is
+         * protected by queue_lock. */
+        struct kbase_event_chunk *event_chunks[KBASE_MAX_EVENT_CHUNKS];
+        unsigned event_chunk_count;
+        BITSET_DECLARE(event_slots_free, KBASE_MAX_EVENT_SLOTS);
+        /* One more than the highest allocated slot, read atomically */
         unsigned event_slot_usage;
 
         uint8_t atom_number;
 
-        struct util_dynarray gem_handles;
+        /* Number of errors reported for each CSG handle, incremented
+         * atomically when events are read */
+        uint32_t csg_faults[256];
+
+        /* Number of JM atoms that did not complete successfully, incremented
+         * atomically when events are read */
+        uint32_t atom_faults;
+
+        /* Number of commands enqueued on KCPU queues, incremented
+         * atomically */
+        uint64_t kcpu_commands;
+
+        /* Handles are looked up without taking handle_lock: entries below
+         * num_gem_handles are in chunks which are never moved or freed
+         * before kbase_close, and num_gem_handles never decreases. Freed
+         * handles are kept in a list, from the most recently freed one, and
+         * reused by later allocations. Allocating and freeing handles, and
+         * the implicit sync state of handles, are protected by handle_lock. */
+        kbase_handle *gem_handles[KBASE_HANDLE_MAX_CHUNKS];
+        unsigned num_gem_handles;
+        int free_gem_handle;
+        /* Imported dma-bufs by inode, mapping to handle + 1. Protected by
+         * handle_lock. */
+        struct hash_table_u64 *dmabuf_handles;
+        /* Imported dma-bufs which are not in dmabuf_handles */
+        unsigned dmabuf_unindexed;
         struct util_dynarray atom_bos[256];
         uint64_t job_seq;
 
@@ -141,6 +327,24 @@ struct kbase_ {
                                  unsigned mali_flags);
         void (*free)(kbase k, base_va va);
 
+        /* Allocates memory at a given GPU address, for replaying captured
+         * work. Executable memory needs a kernel that supports fixed
+         * address allocations. Returns a NULL pointer on failure, including
+         * when the address is already in use. */
+        struct base_ptr (*alloc_at)(kbase k, base_va va, size_t size,
+                                    unsigned pan_flags);
+
+        /* Marks memory as purgeable, allowing the kernel to reclaim it under
+         * memory pressure, or makes it required again. Returns false if the
+         * flag could not be changed, which when making the memory required
+         * means that the backing was lost and the memory should be freed. */
+        bool (*mem_purgeable)(kbase k, base_va va, bool purgeable);
+
+        /* Sets the number of physical pages backing memory that grows on GPU
+         * faults, which can be used to give back the pages of idle memory.
+         * The contents of released pages are lost. */
+        bool (*mem_commit)(kbase k, base_va va, size_t pages);
+
         int (*import_dmabuf)(kbase k, int fd);
         void *(*mmap_import)(kbase k, base_va va, size_t size);
 
@@ -152,28 +356,74 @@ struct kbase_ {
         bool (*handle_events)(kbase k);
 
         /* <= v9 GPUs */
+        /* writes tells which of the handles the atom may write, so that
+         * atoms only reading a BO don't wait for each other. When NULL, all
+         * of them are considered written. */
         int (*submit)(kbase k, uint64_t va, unsigned req,
                       struct kbase_syncobj *o,
-                      int32_t *handles, unsigned num_handles);
+                      int32_t *handles, const bool *writes,
+                      unsigned num_handles);
+        /* Like submit, but the atom is only added to the batch. Atoms are
+         * ordered like separate submissions would be. Other submissions are
+         * blocked from the first queued atom until submit_batch, which must
+         * be called by the same thread. */
+        int (*submit_queue)(kbase k, struct kbase_atom_batch *b,
+                            uint64_t va, unsigned req,
+                            struct kbase_syncobj *o,
+                            int32_t *handles, const bool *writes,
+                            unsigned num_handles);
+        /* Submits the queued atoms and empties the batch. Returns false if
+         * the ioctl failed. */
+        bool (*submit_batch)(kbase k, struct kbase_atom_batch *b);
 
         /* >= v10 GPUs */
-        struct kbase_context *(*context_create)(kbase k);
+        struct kbase_context *(*context_create)(kbase k, unsigned flags);
         void (*context_destroy)(kbase k, struct kbase_context *ctx);
+        /* Replaces the queue group and tiler heap of the context. On failure
+         * the context can't be used, but must still be destroyed. */
         bool (*context_recreate)(kbase k, struct kbase_context *ctx);
-
-        // TODO: Pass in a priority?
+        /* Returns true if the group has reported an error since the last
+         * call, in which case the context needs to be recreated */
+        bool (*context_faulted)(kbase k, struct kbase_context *ctx);
+        /* Returns the number of chunks the kernel has allocated for a tiler
+         * heap of the context, or zero if the chunk list can't be read */
+        unsigned (*tiler_heap_chunks)(kbase k, struct kbase_context *ctx,
+                                      unsigned heap);
+        /* Replaces a tiler heap of the context with one using new
+         * parameters, which then apply to the whole context. The heap must
+         * be idle. On failure the old heap is recreated if possible,
+         * otherwise the context keeps one heap fewer, with the remaining
+         * heaps renumbered. */
+        bool (*tiler_heap_resize)(kbase k, struct kbase_context *ctx,
+                                  unsigned heap,
+                                  const struct kbase_tiler_heap_config *cfg);
+
+        /* The queue priority only orders queues within a context, use the
+         * context_create flags to prioritise between contexts */
         struct kbase_cs (*cs_bind)(kbase k, struct kbase_context *ctx,
-                                   base_va va, unsigned size);
+                                   base_va va, unsigned size,
+                                   unsigned priority);
         void (*cs_term)(kbase k, struct kbase_cs *cs);
         void (*cs_rebind)(kbase k, struct kbase_cs *cs);
 
         bool (*cs_submit)(kbase k, struct kbase_cs *cs, uint64_t insert_offset,
                           struct kbase_syncobj *o, uint64_t seqnum);
+        /* Returns false if the queue had not finished after timeout_ns */
         bool (*cs_wait)(kbase k, struct kbase_cs *cs, uint64_t extract_offset,
-                        struct kbase_syncobj *o);
+                        struct kbase_syncobj *o, int64_t timeout_ns);
+        /* Returns the ring offset up to which the queue has finished
+         * reading instructions, which is at most last_insert */
+        uint64_t (*cs_extract)(kbase k, struct kbase_cs *cs);
 
         int (*kcpu_fence_export)(kbase k, struct kbase_context *ctx);
         bool (*kcpu_fence_import)(kbase k, struct kbase_context *ctx, int fd);
+        /* Waits for each of the sync files that has not already signalled,
+         * then sets the CQS object at addr to value. Fences and the CQS set
+         * are sent in as few enqueues as possible. Does not take ownership
+         * of the file descriptors. */
+        bool (*kcpu_fence_import_batch)(kbase k, struct kbase_context *ctx,
+                                        const int *fds, unsigned count,
+                                        base_va addr, uint64_t value);
 
         bool (*kcpu_cqs_set)(kbase k, struct kbase_context *ctx,
                              base_va addr, uint64_t value);
@@ -184,8 +434,16 @@ struct kbase_ {
         struct kbase_syncobj *(*syncobj_create)(kbase k);
         void (*syncobj_destroy)(kbase k, struct kbase_syncobj *o);
         struct kbase_syncobj *(*syncobj_dup)(kbase k, struct kbase_syncobj *o);
-        /* TODO: timeout? (and for cs_wait) */
-        bool (*syncobj_wait)(kbase k, struct kbase_syncobj *o);
+        /* Make the syncobj also wait for seqnum to complete on an event
+         * slot, as if it had been passed to the submission */
+        void (*syncobj_add_seqnum)(kbase k, struct kbase_syncobj *o,
+                                   unsigned slot, uint64_t seqnum);
+        /* A zero timeout only polls, INT64_MAX never times out */
+        bool (*syncobj_wait)(kbase k, struct kbase_syncobj *o,
+                             int64_t timeout_ns);
+        /* Returns a sync file that signals when the syncobj does, or -1 on
+         * failure. Only implemented for CSF. */
+        int (*syncobj_export_sync_file)(kbase k, struct kbase_syncobj *o);
 
         /* Returns false if there are no active queues */
         bool (*callback_all_queues)(kbase k, int32_t *count,
@@ -193,21 +451,98 @@ struct kbase_ {
 
         void (*mem_sync)(kbase k, base_va gpu, void *cpu, size_t size,
                          bool invalidate);
+
+        /* Sets up a hardware counter reader with every counter enabled,
+         * returning its fd, or -1 on failure. Not implemented on the
+         * oldest kernels. */
+        int (*hwcnt_reader_setup)(kbase k, unsigned buffer_count);
 };
 
 bool kbase_open(kbase k, int fd, unsigned cs_queue_count, bool verbose);
 
+static inline struct kbase_event_slot *
+kbase_event_slot_get(kbase k, unsigned slot)
+{
+        struct kbase_event_chunk *chunk =
+                k->event_chunks[slot / KBASE_EVENT_CHUNK_SLOTS];
+
+        return &chunk->slots[slot % KBASE_EVENT_CHUNK_SLOTS];
+}
+
+/* Whether the slot is currently allocated to a queue */
+static inline bool
+kbase_event_slot_live(kbase k, unsigned slot)
+{
+        return slot < k->event_chunk_count * KBASE_EVENT_CHUNK_SLOTS &&
+                !BITSET_TEST(k->event_slots_free, slot);
+}
+
+/* Address of the sequence number written by the GPU for a slot */
+static inline base_va
+kbase_event_va(kbase k, unsigned slot)
+{
+        struct kbase_event_chunk *chunk =
+                k->event_chunks[slot / KBASE_EVENT_CHUNK_SLOTS];
+
+        return chunk->event_mem.gpu +
+                (slot % KBASE_EVENT_CHUNK_SLOTS) * PAN_EVENT_SIZE;
+}
+
+/* The sequence number last written by the GPU for a slot, read directly from
+ * event memory so that it does not depend on events having been handled */
+static inline uint64_t
+kbase_event_value(kbase k, unsigned slot)
+{
+        struct kbase_event_chunk *chunk =
+                k->event_chunks[slot / KBASE_EVENT_CHUNK_SLOTS];
+
+        if (!chunk->event_mem.cpu)
+                return 0;
+
+        volatile uint64_t *mem = chunk->event_mem.cpu +
+                (slot % KBASE_EVENT_CHUNK_SLOTS) * PAN_EVENT_SIZE;
+
+        return *mem;
+}
+
+static inline base_va
+kbase_kcpu_event_va(kbase k, unsigned slot)
+{
+        struct kbase_event_chunk *chunk =
+                k->event_chunks[slot / KBASE_EVENT_CHUNK_SLOTS];
+
+        return chunk->kcpu_event_mem.gpu +
+                (slot % KBASE_EVENT_CHUNK_SLOTS) * PAN_EVENT_SIZE;
+}
+
 /* Called from kbase_open */
 bool kbase_open_old(kbase k);
 bool kbase_open_new(kbase k);
 bool kbase_open_csf(kbase k);
 bool kbase_open_csf_noop(kbase k);
 
+/* Per-boot cache of the GPU properties, see pan_base.c */
+bool kbase_props_cache_load(kbase k);
+void kbase_props_cache_store(kbase k);
+
 /* BO management */
 int kbase_alloc_gem_handle(kbase k, base_va va, int fd);
 int kbase_alloc_gem_handle_locked(kbase k, base_va va, int fd);
 void kbase_free_gem_handle(kbase k, int handle);
 kbase_handle kbase_gem_handle_get(kbase k, int handle);
+
+/* Returns NULL if the handle was never allocated */
+static inline kbase_handle *
+kbase_gem_handle_ptr(kbase k, int handle)
+{
+        if (handle < 0 ||
+            (unsigned) handle >= p_atomic_read(&k->num_gem_handles))
+                return NULL;
+
+        return &k->gem_handles[handle >> KBASE_HANDLE_CHUNK_SHIFT]
+                              [handle & (KBASE_HANDLE_CHUNK_SIZE - 1)];
+}
+
 int kbase_wait_bo(kbase k, int handle, int64_t timeout_ns, bool wait_readers);
 
 /* Event waiting */
@@ -216,6 +551,9 @@ struct kbase_wait_ctx {
         struct timespec until;
         bool has_lock;
         bool has_cnd_lock;
+        /* Value of event_seq last seen, when using the event thread */
+        bool has_seq;
+        uint32_t seq;
 };
 
 struct kbase_wait_ctx kbase_wait_init(kbase k, int64_t timeout_ns);
@@ -225,10 +563,17 @@ void kbase_wait_fini(struct kbase_wait_ctx ctx);
 
 void kbase_ensure_handle_events(kbase k);
 
+void kbase_start_event_thread(kbase k);
+void kbase_stop_event_thread(kbase k);
+
 bool kbase_poll_fd_until(int fd, bool wait_shared, struct timespec tp);
 
 /* Must not conflict with PANFROST_BO_* flags */
 #define MALI_BO_CACHED_CPU   (1 << 16)
 #define MALI_BO_UNCACHED_GPU (1 << 17)
+/* CSF event memory, only for alloc_at */
+#define MALI_BO_EVENT        (1 << 18)
+/* Allocate whole 2 MB chunks, which kbase can back with large pages */
+#define MALI_BO_LARGE_PAGES  (1 << 19)
 
 #endif
@@ -26,13 +26,13 @@
 
 #ifdef __aarch64__
 
-static void
+static inline void
 cache_clean(volatile void *addr)
 {
         __asm__ volatile ("dc cvac, %0" :: "r" (addr) : "memory");
 }
 
-static void
+static inline void
 cache_invalidate(volatile void *addr)
 {
         __asm__ volatile ("dc civac, %0" :: "r" (addr) : "memory");
@@ -40,15 +40,49 @@ cache_invalidate(volatile void *addr)
 
 typedef void (*cacheline_op)(volatile void *addr);
 
-#define CACHELINE_SIZE 64
+/* Above this size, kbase_mem_sync asks the kernel to do the maintenance
+ * instead. Large ranges are likely to include pages which have never been
+ * touched through the CPU mapping, and DC instructions would fault in each of
+ * them, while the kernel can use its own mapping. */
+#define CACHE_SYNC_IOCTL_THRESHOLD (8 * 1024 * 1024)
 
-static void
+/* Returns the smallest data cache line size of all caches, from CTR_EL0 */
+static unsigned
+cacheline_size(void)
+{
+        static unsigned size;
+
+        if (!size) {
+                uint64_t ctr;
+                __asm__ ("mrs %0, ctr_el0" : "=r" (ctr));
+
+                /* DminLine is the log2 of the number of words */
+                size = 4 << ((ctr >> 16) & 0xf);
+        }
+
+        return size;
+}
+
+static inline void
 cacheline_op_range(volatile void *start, size_t length, cacheline_op op)
 {
-        volatile void *ptr = (volatile void *)((uintptr_t) start & ~((uintptr_t) CACHELINE_SIZE - 1));
-        volatile void *end = (volatile void *) ALIGN_POT((uintptr_t) start + length, CACHELINE_SIZE);
-        for (; ptr < end; ptr += CACHELINE_SIZE)
-                op(ptr);
+        uintptr_t line = cacheline_size();
+        uintptr_t ptr = (uintptr_t) start & ~(line - 1);
+        uintptr_t end = ALIGN_POT((uintptr_t) start + length, line);
+
+        /* Unroll by four lines, the tail is handled separately */
+        for (; ptr + 4 * line <= end; ptr += 4 * line) {
+                op((volatile void *) ptr);
+                op((volatile void *) (ptr + line));
+                op((volatile void *) (ptr + 2 * line));
+                op((volatile void *) (ptr + 3 * line));
+        }
+
+        for (; ptr < end; ptr += line)
+                op((volatile void *) ptr);
+
+        /* Wait for all of the maintenance operations to complete */
+        __asm__ volatile ("dsb sy" ::: "memory");
 }
 
 static void
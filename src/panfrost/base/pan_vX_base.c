@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <poll.h>
 #include <pthread.h>
@@ -44,9 +45,11 @@
 #endif
 
 #include "util/macros.h"
+#include "util/hash_table.h"
 #include "util/list.h"
 #include "util/u_atomic.h"
 #include "util/os_file.h"
+#include "util/futex.h"
 
 #include "pan_base.h"
 #include "pan_cache.h"
@@ -188,14 +191,20 @@ kbase_get_mali_gpuprop(kbase k, unsigned name, uint64_t *value)
 static bool
 alloc_handles(kbase k)
 {
-        util_dynarray_init(&k->gem_handles, NULL);
-        return true;
+        memset(k->gem_handles, 0, sizeof(k->gem_handles));
+        k->num_gem_handles = 0;
+        k->free_gem_handle = -1;
+        k->dmabuf_unindexed = 0;
+        k->dmabuf_handles = _mesa_hash_table_u64_create(NULL);
+        return k->dmabuf_handles != NULL;
 }
 
 static bool
 free_handles(kbase k)
 {
-        util_dynarray_fini(&k->gem_handles);
+        for (unsigned i = 0; i < KBASE_HANDLE_MAX_CHUNKS; ++i)
+                free(k->gem_handles[i]);
+        _mesa_hash_table_u64_destroy(k->dmabuf_handles);
         return true;
 }
 
@@ -242,6 +251,9 @@ munmap_tracking(kbase k)
 static bool
 get_gpuprops(kbase k)
 {
+        if (kbase_props_cache_load(k))
+                return true;
+
         struct kbase_ioctl_get_gpuprops props = { 0 };
 
         int ret = kbase_ioctl(k->fd, KBASE_IOCTL_GET_GPUPROPS, &props);
@@ -265,6 +277,7 @@ get_gpuprops(kbase k)
                 return false;
         }
 
+        kbase_props_cache_store(k);
         return true;
 }
 #else
@@ -354,48 +367,111 @@ init_mem_jit(kbase k)
 #if PAN_BASE_API >= 2
 static struct base_ptr
 kbase_alloc(kbase k, size_t size, unsigned pan_flags, unsigned mali_flags);
+#endif
 
+/* Must be called with queue_lock held, or during initialisation */
 static bool
-alloc_event_mem(kbase k)
-{
-        k->event_mem = kbase_alloc(k, k->page_size * 2,
-                                   PANFROST_BO_NOEXEC,
-                                   BASE_MEM_PROT_CPU_RD | BASE_MEM_PROT_CPU_WR |
-                                   BASE_MEM_PROT_GPU_RD | BASE_MEM_PROT_GPU_WR |
-                                   BASE_MEM_SAME_VA | BASE_MEM_CSF_EVENT);
-        k->kcpu_event_mem = (struct base_ptr) {
-                .cpu = k->event_mem.cpu + k->page_size,
-                .gpu = k->event_mem.gpu + k->page_size,
+kbase_event_chunk_add(kbase k)
+{
+        if (k->event_chunk_count == KBASE_MAX_EVENT_CHUNKS)
+                return false;
+
+        struct kbase_event_chunk *chunk = calloc(1, sizeof(*chunk));
+        if (!chunk)
+                return false;
+
+#if PAN_BASE_API >= 2
+        /* The event memory is followed by the KCPU event memory */
+        unsigned size = ALIGN_POT(KBASE_EVENT_CHUNK_SLOTS * PAN_EVENT_SIZE,
+                                  k->page_size);
+
+        chunk->mem_size = size * 2;
+        chunk->event_mem = kbase_alloc(k, chunk->mem_size,
+                                       PANFROST_BO_NOEXEC,
+                                       BASE_MEM_PROT_CPU_RD | BASE_MEM_PROT_CPU_WR |
+                                       BASE_MEM_PROT_GPU_RD | BASE_MEM_PROT_GPU_WR |
+                                       BASE_MEM_SAME_VA | BASE_MEM_CSF_EVENT);
+
+        if (!chunk->event_mem.cpu) {
+                free(chunk);
+                return false;
+        }
+
+        chunk->kcpu_event_mem = (struct base_ptr) {
+                .cpu = chunk->event_mem.cpu + size,
+                .gpu = chunk->event_mem.gpu + size,
         };
-        return k->event_mem.cpu;
+#endif
+
+        unsigned first = k->event_chunk_count * KBASE_EVENT_CHUNK_SLOTS;
+        BITSET_SET_RANGE(k->event_slots_free, first,
+                         first + KBASE_EVENT_CHUNK_SLOTS - 1);
+
+        /* Make sure the chunk is visible before the count is updated, so
+         * that lock-free readers never see a NULL chunk */
+        p_atomic_set(&k->event_chunks[k->event_chunk_count], chunk);
+        p_atomic_inc(&k->event_chunk_count);
+
+        return true;
 }
 
 static bool
-free_event_mem(kbase k)
+alloc_event_slots(kbase k)
 {
-        if (k->event_mem.cpu)
-                return munmap(k->event_mem.cpu, k->page_size * 2) == 0;
-        return true;
+        return kbase_event_chunk_add(k);
+}
+
+static bool
+free_event_slots(kbase k)
+{
+        bool ret = true;
+
+        for (unsigned i = 0; i < k->event_chunk_count; ++i) {
+                struct kbase_event_chunk *chunk = k->event_chunks[i];
+
+                if (chunk->event_mem.cpu)
+                        ret &= munmap(chunk->event_mem.cpu, chunk->mem_size) == 0;
+
+                free(chunk);
+                k->event_chunks[i] = NULL;
+        }
+
+        k->event_chunk_count = 0;
+        return ret;
 }
-#endif
 
 #if PAN_BASE_API >= 2
+static uint8_t
+kbase_group_priority(unsigned flags)
+{
+        if (flags & KBASE_CONTEXT_PRIORITY_HIGH)
+                return BASE_QUEUE_GROUP_PRIORITY_HIGH;
+        else if (flags & KBASE_CONTEXT_PRIORITY_LOW)
+                return BASE_QUEUE_GROUP_PRIORITY_LOW;
+        else
+                return BASE_QUEUE_GROUP_PRIORITY_MEDIUM;
+}
+
 static bool
-cs_group_create(kbase k, struct kbase_context *c)
+cs_group_create_ioctl(kbase k, unsigned flags, unsigned cs_min,
+                      uint8_t *handle, uint32_t *uid)
 {
-        /* TODO: What about compute-only contexts? */
+        /* Compute-only groups do not claim the tiler or fragment units, so
+         * they can be scheduled alongside graphics groups */
+        bool compute_only = flags & KBASE_CONTEXT_COMPUTE_ONLY;
+
         union kbase_ioctl_cs_queue_group_create_1_6 create = {
                 .in = {
                         /* Mali *still* only supports a single tiler unit */
-                        .tiler_mask = 1,
-                        .fragment_mask = ~0ULL,
+                        .tiler_mask = compute_only ? 0 : 1,
+                        .fragment_mask = compute_only ? 0 : ~0ULL,
                         .compute_mask = ~0ULL,
 
-                        .cs_min = k->cs_queue_count,
+                        .cs_min = cs_min,
 
-                        .priority = 1,
-                        .tiler_max = 1,
-                        .fragment_max = 64,
+                        .priority = kbase_group_priority(flags),
+                        .tiler_max = compute_only ? 0 : 1,
+                        .fragment_max = compute_only ? 0 : 64,
                         .compute_max = 64,
                 }
         };
@@ -407,23 +483,20 @@ cs_group_create(kbase k, struct kbase_context *c)
                 return false;
         }
 
-        c->csg_handle = create.out.group_handle;
-        c->csg_uid = create.out.group_uid;
+        *handle = create.out.group_handle;
+        *uid = create.out.group_uid;
 
         /* Should be at least 1 */
-        assert(c->csg_uid);
+        assert(*uid);
 
         return true;
 }
 
 static bool
-cs_group_term(kbase k, struct kbase_context *c)
+cs_group_term_ioctl(kbase k, uint8_t handle)
 {
-        if (!c->csg_uid)
-                return true;
-
         struct kbase_ioctl_cs_queue_group_term term = {
-                .group_handle = c->csg_handle
+                .group_handle = handle
         };
 
         int ret = kbase_ioctl(k->fd, KBASE_IOCTL_CS_QUEUE_GROUP_TERMINATE, &term);
@@ -434,20 +507,123 @@ cs_group_term(kbase k, struct kbase_context *c)
         }
         return true;
 }
+
+/* Finds a range of CSIs for the context in a shared group with matching
+ * flags, creating a new group if none has space. Groups which have faulted
+ * are skipped, they are destroyed once every context has moved off them. */
+static bool
+cs_group_join_shared(kbase k, struct kbase_context *c)
+{
+        const unsigned ranges = KBASE_SHARED_GROUP_CSI / KBASE_SHARED_CONTEXT_CSI;
+        struct kbase_csg *csg = NULL;
+
+        pthread_mutex_lock(&k->csg_lock);
+
+        list_for_each_entry(struct kbase_csg, it, &k->shared_groups, link) {
+                bool faulted = p_atomic_read(&k->csg_faults[it->handle]) !=
+                        it->faults_base;
+
+                if (it->flags == c->flags && !faulted &&
+                    it->used != BITFIELD_MASK(ranges)) {
+                        csg = it;
+                        break;
+                }
+        }
+
+        if (!csg) {
+                csg = calloc(1, sizeof(*csg));
+                csg->flags = c->flags;
+
+                if (!cs_group_create_ioctl(k, c->flags, KBASE_SHARED_GROUP_CSI,
+                                           &csg->handle, &csg->uid)) {
+                        free(csg);
+                        pthread_mutex_unlock(&k->csg_lock);
+                        return false;
+                }
+
+                csg->faults_base = p_atomic_read(&k->csg_faults[csg->handle]);
+                list_addtail(&csg->link, &k->shared_groups);
+        }
+
+        unsigned range = ffs(~csg->used) - 1;
+        csg->used |= BITFIELD_BIT(range);
+        ++csg->refcnt;
+
+        c->csg = csg;
+        c->csi_base = range * KBASE_SHARED_CONTEXT_CSI;
+        c->csg_handle = csg->handle;
+        c->csg_uid = csg->uid;
+        c->faults_seen = csg->faults_base;
+
+        pthread_mutex_unlock(&k->csg_lock);
+
+        return true;
+}
+
+static bool
+cs_group_create(kbase k, struct kbase_context *c)
+{
+        if (k->share_groups && cs_group_join_shared(k, c))
+                return true;
+
+        c->csg = NULL;
+        c->csi_base = 0;
+
+        if (!cs_group_create_ioctl(k, c->flags, k->cs_queue_count,
+                                   &c->csg_handle, &c->csg_uid))
+                return false;
+
+        /* Errors for a previous group with the same handle do not count */
+        c->faults_seen = p_atomic_read(&k->csg_faults[c->csg_handle]);
+
+        return true;
+}
+
+static bool
+cs_group_term(kbase k, struct kbase_context *c)
+{
+        if (!c->csg_uid)
+                return true;
+
+        if (!c->csg) {
+                c->csg_uid = 0;
+                return cs_group_term_ioctl(k, c->csg_handle);
+        }
+
+        struct kbase_csg *csg = c->csg;
+        bool ret = true;
+
+        pthread_mutex_lock(&k->csg_lock);
+
+        csg->used &= ~BITFIELD_BIT(c->csi_base / KBASE_SHARED_CONTEXT_CSI);
+
+        if (--csg->refcnt == 0) {
+                list_del(&csg->link);
+                ret = cs_group_term_ioctl(k, csg->handle);
+                free(csg);
+        }
+
+        pthread_mutex_unlock(&k->csg_lock);
+
+        c->csg = NULL;
+        c->csg_uid = 0;
+
+        return ret;
+}
 #endif
 
 #if PAN_BASE_API >= 2
 static bool
-tiler_heap_create(kbase k, struct kbase_context *c)
+tiler_heap_init(kbase k, struct kbase_context *c, unsigned heap)
 {
-        c->tiler_heap_chunk_size = 1 << 21; /* 2 MB */
+        const struct kbase_tiler_heap_config *cfg = &c->tiler_heap_config;
 
         union kbase_ioctl_cs_tiler_heap_init init = {
                 .in = {
-                        .chunk_size = c->tiler_heap_chunk_size,
-                        .initial_chunks = 5,
-                        .max_chunks = 200,
-                        .target_in_flight = 65535,
+                        .chunk_size = cfg->chunk_size,
+                        .initial_chunks = cfg->initial_chunks,
+                        .max_chunks = cfg->max_chunks,
+                        .target_in_flight = cfg->target_in_flight,
                 }
         };
 
@@ -458,23 +634,21 @@ tiler_heap_create(kbase k, struct kbase_context *c)
                 return false;
         }
 
-        c->tiler_heap_va = init.out.gpu_heap_va;
-        c->tiler_heap_header = init.out.first_chunk_va;
+        c->tiler_heap_va[heap] = init.out.gpu_heap_va;
+        c->tiler_heap_header[heap] = init.out.first_chunk_va;
 
         return true;
 }
 
 static bool
-tiler_heap_term(kbase k, struct kbase_context *c)
+tiler_heap_term_one(kbase k, struct kbase_context *c, unsigned heap)
 {
-        if (!c->tiler_heap_va)
-                return true;
-
         struct kbase_ioctl_cs_tiler_heap_term term = {
-                .gpu_heap_va = c->tiler_heap_va
+                .gpu_heap_va = c->tiler_heap_va[heap]
         };
 
         int ret = kbase_ioctl(k->fd, KBASE_IOCTL_CS_TILER_HEAP_TERM, &term);
+        c->tiler_heap_va[heap] = 0;
 
         if (ret == -1) {
                 perror("ioctl(KBASE_IOCTL_CS_TILER_HEAP_TERM)");
@@ -482,6 +656,100 @@ tiler_heap_term(kbase k, struct kbase_context *c)
         }
         return true;
 }
+
+static bool
+tiler_heap_create(kbase k, struct kbase_context *c)
+{
+        c->num_tiler_heaps = 0;
+
+        if (c->flags & KBASE_CONTEXT_COMPUTE_ONLY)
+                return true;
+
+        /* Keep the parameters of a context being recreated */
+        if (!c->tiler_heap_config.chunk_size)
+                c->tiler_heap_config = k->tiler_heap_config;
+
+        for (unsigned i = 0; i < KBASE_MAX_TILER_HEAPS; ++i) {
+                /* Later heaps only allow more overlap, so make do without */
+                if (!tiler_heap_init(k, c, i))
+                        return c->num_tiler_heaps > 0;
+
+                c->num_tiler_heaps++;
+        }
+
+        return true;
+}
+
+static bool
+tiler_heap_term(kbase k, struct kbase_context *c)
+{
+        bool ok = true;
+
+        for (unsigned i = 0; i < c->num_tiler_heaps; ++i)
+                ok &= tiler_heap_term_one(k, c, i);
+
+        c->num_tiler_heaps = 0;
+        return ok;
+}
+
+/* Chunks start with a header holding the address of the next chunk in the
+ * upper bits, and its size in pages in the lower 12 bits. */
+#define TILER_HEAP_CHUNK_ADDR_MASK (~(uint64_t) 0xfff)
+
+static unsigned
+kbase_tiler_heap_chunks(kbase k, struct kbase_context *c, unsigned heap)
+{
+        base_va chunk = c->tiler_heap_header[heap];
+        unsigned count = 0;
+
+        /* The kernel never allocates more than max_chunks, so bound the walk
+         * in case of a corrupted list */
+        while (chunk && count <= c->tiler_heap_config.max_chunks) {
+                void *ptr = kbase_mmap(NULL, k->page_size, PROT_READ,
+                                       MAP_SHARED, k->fd, chunk);
+
+                if (ptr == MAP_FAILED)
+                        return 0;
+
+                uint64_t hdr = *(volatile uint64_t *) ptr;
+                munmap(ptr, k->page_size);
+
+                chunk = hdr & TILER_HEAP_CHUNK_ADDR_MASK;
+                ++count;
+        }
+
+        return count;
+}
+
+static bool
+kbase_tiler_heap_resize(kbase k, struct kbase_context *c, unsigned heap,
+                        const struct kbase_tiler_heap_config *cfg)
+{
+        assert(heap < c->num_tiler_heaps);
+
+        struct kbase_tiler_heap_config old = c->tiler_heap_config;
+
+        tiler_heap_term_one(k, c, heap);
+        c->tiler_heap_config = *cfg;
+
+        if (tiler_heap_init(k, c, heap))
+                return true;
+
+        /* A larger heap may not fit, so try to get the old one back */
+        c->tiler_heap_config = old;
+
+        if (tiler_heap_init(k, c, heap))
+                return false;
+
+        /* Shift the remaining heaps down */
+        for (unsigned i = heap; i + 1 < c->num_tiler_heaps; ++i) {
+                c->tiler_heap_va[i] = c->tiler_heap_va[i + 1];
+                c->tiler_heap_header[i] = c->tiler_heap_header[i + 1];
+        }
+
+        c->num_tiler_heaps--;
+        return false;
+}
 #endif
 
 typedef bool (* kbase_func)(kbase k);
@@ -509,14 +777,28 @@ static struct kbase_op kbase_main[] = {
         { init_mem_exec, NULL, "Initialise EXEC_VA zone" },
         { init_mem_jit, NULL, "Initialise JIT allocator" },
 #endif
+        { alloc_event_slots, free_event_slots, "Allocate event slots" },
+};
+
 #if PAN_BASE_API >= 2
-        { alloc_event_mem, free_event_mem, "Allocate event memory" },
+static void
+kbase_kcpu_queue_destroy(kbase k, struct kbase_context *ctx);
 #endif
-};
 
 static void
 kbase_close(kbase k)
 {
+        /* The thread uses the fd and the event slots */
+        kbase_stop_event_thread(k);
+
+#if PAN_BASE_API >= 2
+        for (unsigned i = 0; i < KBASE_SYNC_FILE_QUEUES; ++i) {
+                kbase_kcpu_queue_destroy(k, &k->sync_file_queues[i].kcpu);
+                if (k->sync_file_queues[i].fd != -1)
+                        close(k->sync_file_queues[i].fd);
+        }
+#endif
+
         while (k->setup_state) {
                 unsigned i = k->setup_state - 1;
                 if (kbase_main[i].cleanup)
@@ -525,9 +807,12 @@ kbase_close(kbase k)
         }
 
         pthread_mutex_destroy(&k->handle_lock);
+        pthread_mutex_destroy(&k->submit_lock);
         pthread_mutex_destroy(&k->event_read_lock);
         pthread_mutex_destroy(&k->event_cnd_lock);
         pthread_mutex_destroy(&k->queue_lock);
+        pthread_mutex_destroy(&k->sync_file_lock);
+        pthread_mutex_destroy(&k->csg_lock);
         pthread_cond_destroy(&k->event_cnd);
 
         close(k->fd);
@@ -575,6 +860,50 @@ kbase_free(kbase k, base_va va)
                 perror("ioctl(KBASE_IOCTL_MEM_FREE)");
 }
 
+static bool
+kbase_mem_purgeable(kbase k, base_va va, bool purgeable)
+{
+#if PAN_BASE_API >= 1
+        struct kbase_ioctl_mem_flags_change change = {
+                .gpu_va = va,
+                .flags = purgeable ? BASE_MEM_DONT_NEED : 0,
+                .mask = BASE_MEM_DONT_NEED,
+        };
+
+        int ret = kbase_ioctl(k->fd, KBASE_IOCTL_MEM_FLAGS_CHANGE, &change);
+
+        /* ENOMEM is expected if the memory was reclaimed and could not be
+         * allocated again */
+        if (ret == -1 && errno != ENOMEM)
+                perror("ioctl(KBASE_IOCTL_MEM_FLAGS_CHANGE)");
+
+        return ret != -1;
+#else
+        /* The ioctl layout is unconfirmed for the old ABI, so never mark
+         * memory as purgeable there */
+        return !purgeable;
+#endif
+}
+
+static bool
+kbase_mem_commit(kbase k, base_va va, size_t pages)
+{
+#if PAN_BASE_API >= 1
+        struct kbase_ioctl_mem_commit commit = {
+                .gpu_addr = va,
+                .pages = pages,
+        };
+
+        int ret = kbase_ioctl(k->fd, KBASE_IOCTL_MEM_COMMIT, &commit);
+        if (ret == -1)
+                perror("ioctl(KBASE_IOCTL_MEM_COMMIT)");
+
+        return ret != -1;
+#else
+        return false;
+#endif
+}
+
 static struct base_ptr
 kbase_alloc(kbase k, size_t size, unsigned pan_flags, unsigned mali_flags)
 {
@@ -613,6 +942,16 @@ kbase_alloc(kbase k, size_t size, unsigned pan_flags, unsigned mali_flags)
                 flags |= BASE_MEM_GROW_ON_GPF;
         }
 
+        if (pan_flags & MALI_BO_LARGE_PAGES) {
+                /* kbase only uses 2 MB pages, and aligns the VA for them,
+                 * for regions made of whole 2 MB chunks */
+                size_t align_size = 2 * 1024 * 1024 / k->page_size;
+
+                a.in.va_pages = ALIGN_POT(a.in.va_pages, align_size);
+                a.in.commit_pages = a.in.va_pages;
+                size = alloc_size = a.in.va_pages * k->page_size;
+        }
+
 #if PAN_BASE_API >= 1
         if (pan_flags & MALI_BO_CACHED_CPU)
                 flags |= BASE_MEM_CACHED_CPU;
@@ -694,30 +1033,159 @@ kbase_alloc(kbase k, size_t size, unsigned pan_flags, unsigned mali_flags)
         return r;
 }
 
-static int
-kbase_import_dmabuf(kbase k, int fd)
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+static struct base_ptr
+kbase_alloc_at(kbase k, base_va va, size_t size, unsigned pan_flags)
 {
-        int ret;
+        struct base_ptr r = {0};
 
-        pthread_mutex_lock(&k->handle_lock);
+        if (va % k->page_size) {
+                errno = EINVAL;
+                return r;
+        }
 
-        unsigned size = util_dynarray_num_elements(&k->gem_handles, kbase_handle);
+        unsigned pages = DIV_ROUND_UP(size, k->page_size);
+        size = pages * k->page_size;
 
-        kbase_handle *handles = util_dynarray_begin(&k->gem_handles);
+        unsigned flags = BASE_MEM_PROT_CPU_RD | BASE_MEM_PROT_CPU_WR |
+                BASE_MEM_PROT_GPU_RD | BASE_MEM_PROT_GPU_WR;
+
+        if (PAN_BASE_API >= 1)
+                flags |= BASE_MEM_COHERENT_LOCAL;
+
+#if PAN_BASE_API >= 2
+        if (pan_flags & MALI_BO_EVENT)
+                flags |= BASE_MEM_CSF_EVENT;
+#endif
+
+        if (!(pan_flags & PANFROST_BO_NOEXEC)) {
+#if PAN_BASE_API >= 2
+                /* Executable memory can't be SAME_VA, so the address has to
+                 * be given to the kernel */
+                union kbase_ioctl_mem_alloc_ex a = {
+                        .in = {
+                                .va_pages = pages,
+                                .commit_pages = pages,
+                                .flags = (flags & ~BASE_MEM_PROT_GPU_WR) |
+                                        BASE_MEM_PROT_GPU_EX | BASE_MEM_FIXED,
+                                .fixed_address = va,
+                        }
+                };
+
+                if (kbase_ioctl(k->fd, KBASE_IOCTL_MEM_ALLOC_EX, &a) == -1) {
+                        perror("ioctl(KBASE_IOCTL_MEM_ALLOC_EX)");
+                        return r;
+                }
+
+                void *ptr = kbase_mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED, k->fd, a.out.gpu_va);
+
+                if (ptr == MAP_FAILED) {
+                        perror("mmap(GPU BO)");
+                        kbase_free(k, a.out.gpu_va);
+                        return r;
+                }
+
+                r.cpu = ptr;
+                r.gpu = a.out.gpu_va;
+                return r;
+#else
+                errno = ENOTSUP;
+                return r;
+#endif
+        }
+
+        /* For SAME_VA memory the GPU address is the address of the CPU
+         * mapping, so ask for the mapping to be placed there */
+        union kbase_ioctl_mem_alloc a = {
+                .in = {
+                        .va_pages = pages,
+                        .commit_pages = pages,
+                        .flags = flags | BASE_MEM_SAME_VA,
+                }
+        };
+
+        if (kbase_ioctl(k->fd, KBASE_IOCTL_MEM_ALLOC, &a) == -1) {
+                perror("ioctl(KBASE_IOCTL_MEM_ALLOC)");
+                return r;
+        }
+
+        void *ptr = kbase_mmap((void *)(uintptr_t) va, size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_FIXED_NOREPLACE,
+                               k->fd, a.out.gpu_va);
+
+        if (ptr == MAP_FAILED || (uintptr_t) ptr != va) {
+                if (ptr != MAP_FAILED)
+                        munmap(ptr, size);
+
+                kbase_free(k, a.out.gpu_va);
+                errno = EEXIST;
+                return r;
+        }
+
+        r.cpu = ptr;
+        r.gpu = va;
+        return r;
+}
+
+/* Compares file descriptions with every imported handle, for when the inode
+ * of the dma-buf can't identify it */
+static int
+kbase_find_dmabuf_locked(kbase k, int fd)
+{
+        unsigned size = k->num_gem_handles;
 
         for (unsigned i = 0; i < size; ++i) {
-                kbase_handle h = handles[i];
+                kbase_handle h = *kbase_gem_handle_ptr(k, i);
 
                 if (h.fd < 0)
                         continue;
 
-                ret = os_same_file_description(h.fd, fd);
+                int ret = os_same_file_description(h.fd, fd);
 
-                if (ret == 0) {
-                        pthread_mutex_unlock(&k->handle_lock);
+                if (ret == 0)
                         return i;
-                } else if (ret < 0) {
+                else if (ret < 0)
                         printf("error in os_same_file_description(%i, %i)\n", h.fd, fd);
+        }
+
+        return -1;
+}
+
+static int
+kbase_import_dmabuf(kbase k, int fd)
+{
+        int ret;
+
+        /* Every fd of a dma-buf refers to the same file, so its inode
+         * identifies it while the import keeps it alive. The file
+         * descriptions are only compared one by one if fstat fails, the inode
+         * number matches a file on another device, or an earlier import
+         * couldn't be put in the table. */
+        struct stat st;
+        bool have_stat = fstat(fd, &st) == 0 && st.st_ino;
+
+        pthread_mutex_lock(&k->handle_lock);
+
+        uintptr_t entry = have_stat ? (uintptr_t)
+                _mesa_hash_table_u64_search(k->dmabuf_handles, st.st_ino) : 0;
+
+        if (entry &&
+            kbase_gem_handle_ptr(k, entry - 1)->dmabuf_dev == st.st_dev) {
+                pthread_mutex_unlock(&k->handle_lock);
+                return entry - 1;
+        }
+
+        if (!have_stat || entry || k->dmabuf_unindexed) {
+                int found = kbase_find_dmabuf_locked(k, fd);
+
+                if (found >= 0) {
+                        pthread_mutex_unlock(&k->handle_lock);
+                        return found;
                 }
         }
 
@@ -746,12 +1214,37 @@ kbase_import_dmabuf(kbase k, int fd)
 
                 if (va == (uintptr_t) MAP_FAILED) {
                         perror("mmap(IMPORTED BO)");
+                        close(dup);
+                        kbase_free(k, import.out.gpu_va);
                         handle = -1;
                 } else {
                         handle = kbase_alloc_gem_handle_locked(k, va, dup);
+
+                        /* Out of handles, dup was closed */
+                        if (handle == -1) {
+                                munmap((void *)(uintptr_t) va,
+                                       import.out.va_pages * k->page_size);
+                                kbase_free(k, va);
+                        }
                 }
         } else {
                 handle = kbase_alloc_gem_handle_locked(k, import.out.gpu_va, dup);
+
+                if (handle == -1)
+                        kbase_free(k, import.out.gpu_va);
+        }
+
+        /* On an inode collision the handle stays out of the table, and is
+         * found by comparing file descriptions */
+        if (handle >= 0 && have_stat && !entry) {
+                kbase_handle *h = kbase_gem_handle_ptr(k, handle);
+
+                h->dmabuf_dev = st.st_dev;
+                h->dmabuf_ino = st.st_ino;
+                _mesa_hash_table_u64_insert(k->dmabuf_handles, st.st_ino,
+                                            (void *)(uintptr_t)(handle + 1));
+        } else if (handle >= 0) {
+                k->dmabuf_unindexed++;
         }
 
         pthread_mutex_unlock(&k->handle_lock);
@@ -775,6 +1268,8 @@ struct kbase_fence {
 struct kbase_syncobj {
         struct list_head link;
 
+        /* Protects the fence list */
+        pthread_mutex_t lock;
         struct list_head fences;
 };
 
@@ -783,6 +1278,7 @@ kbase_syncobj_create(kbase k)
 {
         struct kbase_syncobj *o = calloc(1, sizeof(*o));
         list_inithead(&o->fences);
+        pthread_mutex_init(&o->lock, NULL);
         pthread_mutex_lock(&k->queue_lock);
         list_add(&o->link, &k->syncobjs);
         pthread_mutex_unlock(&k->queue_lock);
@@ -801,6 +1297,7 @@ kbase_syncobj_destroy(kbase k, struct kbase_syncobj *o)
                 free(fence);
         }
 
+        pthread_mutex_destroy(&o->lock);
         free(o);
 }
 
@@ -818,16 +1315,28 @@ kbase_syncobj_add_fence(struct kbase_syncobj *o, unsigned slot, uint64_t value)
 static void
 kbase_syncobj_update_fence(struct kbase_syncobj *o, unsigned slot, uint64_t value)
 {
+        pthread_mutex_lock(&o->lock);
+
         list_for_each_entry(struct kbase_fence, fence, &o->fences, link) {
                 if (fence->slot == slot) {
                         if (value > fence->value)
                                 fence->value = value;
 
+                        pthread_mutex_unlock(&o->lock);
                         return;
                 }
         }
 
         kbase_syncobj_add_fence(o, slot, value);
+
+        pthread_mutex_unlock(&o->lock);
+}
+
+static void
+kbase_syncobj_add_seqnum(kbase k, struct kbase_syncobj *o,
+                         unsigned slot, uint64_t seqnum)
+{
+        kbase_syncobj_update_fence(o, slot, seqnum);
 }
 
 static struct kbase_syncobj *
@@ -835,21 +1344,28 @@ kbase_syncobj_dup(kbase k, struct kbase_syncobj *o)
 {
         struct kbase_syncobj *dup = kbase_syncobj_create(k);
 
-        pthread_mutex_lock(&k->queue_lock);
+        /* Only a single syncobj lock is ever held by other threads, so
+         * nesting the locks here cannot deadlock */
+        pthread_mutex_lock(&o->lock);
+        pthread_mutex_lock(&dup->lock);
 
         list_for_each_entry(struct kbase_fence, fence, &o->fences, link)
                 kbase_syncobj_add_fence(dup, fence->slot, fence->value);
 
-        pthread_mutex_unlock(&k->queue_lock);
+        pthread_mutex_unlock(&dup->lock);
+        pthread_mutex_unlock(&o->lock);
 
         return dup;
 }
 
-static void
+/* Returns true if all fences have been signalled */
+static bool
 kbase_syncobj_update(kbase k, struct kbase_syncobj *o)
 {
+        pthread_mutex_lock(&o->lock);
+
         list_for_each_entry_safe(struct kbase_fence, fence, &o->fences, link) {
-                uint64_t value = k->event_slots[fence->slot].last;
+                uint64_t value = p_atomic_read(&kbase_event_slot_get(k, fence->slot)->last);
 
                 if (value > fence->value) {
                         LOG("syncobj %p slot %u value %"PRIu64" vs %"PRIu64"\n",
@@ -859,22 +1375,26 @@ kbase_syncobj_update(kbase k, struct kbase_syncobj *o)
                         free(fence);
                 }
         }
+
+        bool done = list_is_empty(&o->fences);
+
+        pthread_mutex_unlock(&o->lock);
+
+        return done;
 }
 
 static bool
-kbase_syncobj_wait(kbase k, struct kbase_syncobj *o)
+kbase_syncobj_wait(kbase k, struct kbase_syncobj *o, int64_t timeout_ns)
 {
-        if (list_is_empty(&o->fences)) {
+        if (kbase_syncobj_update(k, o)) {
                 LOG("syncobj has no fences\n");
                 return true;
         }
 
-        struct kbase_wait_ctx wait = kbase_wait_init(k, 1 * 1000000000LL);
+        struct kbase_wait_ctx wait = kbase_wait_init(k, timeout_ns);
 
         while (kbase_wait_for_event(&wait)) {
-                kbase_syncobj_update(k, o);
-
-                if (list_is_empty(&o->fences)) {
+                if (kbase_syncobj_update(k, o)) {
                         kbase_wait_fini(wait);
                         return true;
                 }
@@ -882,13 +1402,19 @@ kbase_syncobj_wait(kbase k, struct kbase_syncobj *o)
 
         kbase_wait_fini(wait);
 
-        fprintf(stderr, "syncobj %p wait timeout\n", o);
+        LOG("syncobj %p wait timeout\n", o);
         return false;
 }
 
 static bool
 kbase_poll_event(kbase k, int64_t timeout_ns)
 {
+#ifdef PAN_BASE_NOOP
+        /* Submissions complete immediately, so there is never anything to
+         * wait for, and polling fd -1 would sleep for the whole timeout */
+        return true;
+#endif
+
         struct pollfd pfd = {
                 .fd = k->fd,
                 .events = POLLIN,
@@ -931,24 +1457,33 @@ kbase_handle_events(kbase k)
                 if (event.event_code != BASE_JD_EVENT_DONE) {
                         fprintf(stderr, "Atom %i reported event 0x%x!\n",
                                 event.atom_number, event.event_code);
+                        p_atomic_inc(&k->atom_faults);
                         ret = false;
                 }
 
                 pthread_mutex_lock(&k->handle_lock);
 
-                k->event_slots[event.atom_number].last = event.udata.blob[0];
-
-                unsigned size = util_dynarray_num_elements(&k->gem_handles,
-                                                           kbase_handle);
-                kbase_handle *handle_data = util_dynarray_begin(&k->gem_handles);
+                p_atomic_set(&kbase_event_slot_get(k, event.atom_number)->last,
+                             event.udata.blob[0]);
 
                 struct util_dynarray *handles = k->atom_bos + event.atom_number;
 
                 util_dynarray_foreach(handles, int32_t, h) {
-                        if (*h >= size)
+                        kbase_handle *hd = kbase_gem_handle_ptr(k, *h);
+
+                        if (!hd)
                                 continue;
-                        assert(handle_data[*h].use_count);
-                        --handle_data[*h].use_count;
+                        assert(hd->use_count);
+                        if (!p_atomic_dec_return(&hd->use_count)) {
+                                /* Nothing left to wait for */
+                                hd->write_slots = 0;
+                                hd->read_slots = 0;
+
+#if UTIL_FUTEX_SUPPORTED
+                                if (p_atomic_xchg(&hd->has_waiters, 0))
+                                        futex_wake(&hd->use_count, INT32_MAX);
+#endif
+                        }
                 }
                 util_dynarray_fini(handles);
 
@@ -1000,6 +1535,9 @@ kbase_read_event(kbase k)
 
         struct base_gpu_queue_group_error e = event.payload.csg_error.error;
 
+        /* The context will be recreated when it next submits */
+        p_atomic_inc(&k->csg_faults[event.payload.csg_error.handle]);
+
         switch (e.error_type) {
         case BASE_GPU_QUEUE_GROUP_ERROR_FATAL: {
                 // See CS_FATAL_EXCEPTION_* in mali_gpu_csf_registers.h
@@ -1066,21 +1604,24 @@ kbase_update_queue_callbacks(kbase k,
 static bool
 kbase_handle_events(kbase k)
 {
-#ifdef PAN_BASE_NOOP
-        return true;
-#endif
-
         /* This will clear the event count, so there's no need to do it in a
-         * loop. */
-        bool ret = kbase_read_event(k);
-
-        uint64_t *event_mem = k->event_mem.cpu;
+         * loop. The noop backend has no fd, kbase_cs_submit writes event
+         * memory directly. */
+        bool ret = k->fd == -1 || kbase_read_event(k);
 
         pthread_mutex_lock(&k->queue_lock);
 
         for (unsigned i = 0; i < k->event_slot_usage; ++i) {
-                uint64_t seqnum = event_mem[i * 2];
-                uint64_t cmp = k->event_slots[i].last;
+                if (!kbase_event_slot_live(k, i))
+                        continue;
+
+                struct kbase_event_chunk *chunk =
+                        k->event_chunks[i / KBASE_EVENT_CHUNK_SLOTS];
+                uint64_t *event_mem = chunk->event_mem.cpu;
+                struct kbase_event_slot *slot = kbase_event_slot_get(k, i);
+
+                uint64_t seqnum = event_mem[(i % KBASE_EVENT_CHUNK_SLOTS) * 2];
+                uint64_t cmp = p_atomic_read(&slot->last);
 
                 LOG("MAIN SEQ %"PRIu64" > %"PRIu64"?\n", seqnum, cmp);
 
@@ -1090,12 +1631,10 @@ kbase_handle_events(kbase k)
                                         "from %"PRIu64" to %"PRIu64"!\n",
                                         i, cmp, seqnum);
                 } else /*if (seqnum > cmp)*/ {
-                        kbase_update_queue_callbacks(k, &k->event_slots[i],
-                                                     seqnum);
+                        kbase_update_queue_callbacks(k, slot, seqnum);
                 }
 
-                /* TODO: Atomic operations? */
-                k->event_slots[i].last = seqnum;
+                p_atomic_set(&slot->last, seqnum);
         }
 
         pthread_mutex_unlock(&k->queue_lock);
@@ -1117,10 +1656,13 @@ kbase_latest_slot(uint8_t a, uint8_t b, uint8_t newest)
         return a;
 }
 
+/* Must be called with submit_lock held */
 static int
-kbase_submit(kbase k, uint64_t va, unsigned req,
-             struct kbase_syncobj *o,
-             int32_t *handles, unsigned num_handles)
+kbase_queue_atom(kbase k, struct kbase_atom_batch *b,
+                 uint64_t va, unsigned req,
+                 struct kbase_syncobj *o,
+                 int32_t *handles, const bool *writes,
+                 unsigned num_handles)
 {
         struct util_dynarray buf;
         util_dynarray_init(&buf, NULL);
@@ -1148,88 +1690,180 @@ kbase_submit(kbase k, uint64_t va, unsigned req,
         assert(!k->atom_bos[nr].data);
         k->atom_bos[atom.atom_number] = buf;
 
-        unsigned handle_buf_size = util_dynarray_num_elements(&k->gem_handles, kbase_handle);
-        kbase_handle *handle_buf = util_dynarray_begin(&k->gem_handles);
-
         struct util_dynarray extres;
         util_dynarray_init(&extres, NULL);
 
         /* Mark the BOs as in use */
         for (unsigned i = 0; i < num_handles; ++i) {
-                int32_t h = handles[i];
-                assert(h < handle_buf_size);
-                assert(handle_buf[h].use_count < 255);
+                kbase_handle *hd = kbase_gem_handle_ptr(k, handles[i]);
+                assert(hd);
+
+                bool write = !writes || writes[i];
+
+                /* Implicit sync: reads wait for the latest writes, and
+                 * writes for every access in flight. This also orders the
+                 * atoms of a batch sharing BOs, which can depend on each
+                 * other as the kernel processes the atoms of a submission in
+                 * order. */
+                if (hd->use_count) {
+                        for (unsigned s = 0; s < KBASE_SLOT_COUNT; ++s) {
+                                if (hd->write_slots & BITFIELD_BIT(s))
+                                        dep_slots[s] =
+                                                kbase_latest_slot(dep_slots[s],
+                                                                  hd->last_write[s],
+                                                                  nr);
+                                if (write && (hd->read_slots & BITFIELD_BIT(s)))
+                                        dep_slots[s] =
+                                                kbase_latest_slot(dep_slots[s],
+                                                                  hd->last_read[s],
+                                                                  nr);
+                        }
+                }
 
-                /* Implicit sync */
-                if (handle_buf[h].use_count)
-                        for (unsigned s = 0; s < KBASE_SLOT_COUNT; ++s)
-                                dep_slots[s] =
-                                        kbase_latest_slot(dep_slots[s],
-                                                          handle_buf[h].last_access[s],
-                                                          nr);
+                /* Accesses waiting for a write also wait for what the write
+                 * waited for */
+                if (write) {
+                        hd->last_write[slot] = nr;
+                        hd->write_slots = BITFIELD_BIT(slot);
+                        hd->read_slots = 0;
+                } else {
+                        hd->last_read[slot] = nr;
+                        hd->read_slots |= BITFIELD_BIT(slot);
+                }
 
-                handle_buf[h].last_access[slot] = nr;
-                ++handle_buf[h].use_count;
+                p_atomic_inc(&hd->use_count);
 
-                if (handle_buf[h].fd != -1)
-                        util_dynarray_append(&extres, base_va, handle_buf[h].va);
+                if (hd->fd != -1)
+                        util_dynarray_append(&extres, base_va, hd->va);
         }
 
         pthread_mutex_unlock(&k->handle_lock);
 
-        /* TODO: Better work out the difference between handle_lock and
-         * queue_lock. */
-        if (o) {
-                pthread_mutex_lock(&k->queue_lock);
+        if (o)
                 kbase_syncobj_update_fence(o, nr, atom.udata.blob[0]);
-                pthread_mutex_unlock(&k->queue_lock);
-        }
 
         assert(KBASE_SLOT_COUNT == 2);
+        /* These are only emitted for real hazards, so an atom consuming
+         * the results of a failed one fails too */
         if (dep_slots[0] != nr) {
                 atom.pre_dep[0].atom_id = dep_slots[0];
-                /* TODO: Use data dependencies?  */
-                atom.pre_dep[0].dependency_type = BASE_JD_DEP_TYPE_ORDER;
+                atom.pre_dep[0].dependency_type = BASE_JD_DEP_TYPE_DATA;
         }
         if (dep_slots[1] != nr) {
                 atom.pre_dep[1].atom_id = dep_slots[1];
-                atom.pre_dep[1].dependency_type = BASE_JD_DEP_TYPE_ORDER;
+                atom.pre_dep[1].dependency_type = BASE_JD_DEP_TYPE_DATA;
         }
 
+        /* The list is kept until the batch is submitted, its data doesn't
+         * move when more lists are appended */
         if (extres.size) {
                 atom.core_req |= BASE_JD_REQ_EXTERNAL_RESOURCES;
                 atom.nr_extres = util_dynarray_num_elements(&extres, base_va);
                 atom.extres_list = (uintptr_t) util_dynarray_begin(&extres);
         }
 
+        util_dynarray_append(&b->extres, struct util_dynarray, extres);
+
         if (req & PANFROST_JD_REQ_FS)
                 atom.core_req |= BASE_JD_REQ_FS;
         else
                 atom.core_req |= BASE_JD_REQ_CS | BASE_JD_REQ_T;
 
-        struct kbase_ioctl_job_submit submit = {
-                .nr_atoms = 1,
-                .stride = sizeof(atom),
-                .addr = (uintptr_t) &atom,
-        };
+        util_dynarray_append(&b->atoms, struct base_jd_atom_v2, atom);
+
+        return atom.atom_number;
+}
 
-        int ret = kbase_ioctl(k->fd, KBASE_IOCTL_JOB_SUBMIT, &submit);
+/* Must be called with submit_lock held */
+static bool
+kbase_flush_atoms(kbase k, struct kbase_atom_batch *b)
+{
+        unsigned count =
+                util_dynarray_num_elements(&b->atoms, struct base_jd_atom_v2);
+        int ret = 0;
+
+        if (count) {
+                struct kbase_ioctl_job_submit submit = {
+                        .nr_atoms = count,
+                        .stride = sizeof(struct base_jd_atom_v2),
+                        .addr = (uintptr_t) util_dynarray_begin(&b->atoms),
+                };
+
+                ret = kbase_ioctl(k->fd, KBASE_IOCTL_JOB_SUBMIT, &submit);
+        }
+
+        util_dynarray_foreach(&b->extres, struct util_dynarray, extres)
+                util_dynarray_fini(extres);
 
-        util_dynarray_fini(&extres);
+        util_dynarray_clear(&b->atoms);
+        util_dynarray_clear(&b->extres);
 
         if (ret == -1) {
                 perror("ioctl(KBASE_IOCTL_JOB_SUBMIT)");
-                return -1;
+                return false;
         }
 
-        return atom.atom_number;
+        return true;
+}
+
+static int
+kbase_submit(kbase k, uint64_t va, unsigned req,
+             struct kbase_syncobj *o,
+             int32_t *handles, const bool *writes,
+             unsigned num_handles)
+{
+        struct kbase_atom_batch b;
+        kbase_atom_batch_init(&b);
+
+        pthread_mutex_lock(&k->submit_lock);
+
+        int nr = kbase_queue_atom(k, &b, va, req, o, handles, writes,
+                                  num_handles);
+        bool ok = kbase_flush_atoms(k, &b);
+
+        pthread_mutex_unlock(&k->submit_lock);
+
+        kbase_atom_batch_fini(&b);
+
+        return ok ? nr : -1;
+}
+
+static int
+kbase_submit_queue(kbase k, struct kbase_atom_batch *b,
+                   uint64_t va, unsigned req,
+                   struct kbase_syncobj *o,
+                   int32_t *handles, const bool *writes,
+                   unsigned num_handles)
+{
+        /* Atoms of other threads must not depend on atoms the kernel
+         * doesn't know about yet, so keep them out until the batch is
+         * submitted */
+        if (!b->atoms.size)
+                pthread_mutex_lock(&k->submit_lock);
+
+        return kbase_queue_atom(k, b, va, req, o, handles, writes,
+                                num_handles);
+}
+
+static bool
+kbase_submit_batch(kbase k, struct kbase_atom_batch *b)
+{
+        if (!b->atoms.size)
+                return true;
+
+        bool ok = kbase_flush_atoms(k, b);
+
+        pthread_mutex_unlock(&k->submit_lock);
+
+        return ok;
 }
 
 #else
 static struct kbase_context *
-kbase_context_create(kbase k)
+kbase_context_create(kbase k, unsigned flags)
 {
         struct kbase_context *c = calloc(1, sizeof(*c));
+        c->flags = flags;
 
         if (!cs_group_create(k, c)) {
                 free(c);
@@ -1245,6 +1879,18 @@ kbase_context_create(kbase k)
         return c;
 }
 
+static bool
+kbase_context_faulted(kbase k, struct kbase_context *ctx)
+{
+        uint32_t faults = p_atomic_read(&k->csg_faults[ctx->csg_handle]);
+
+        if (faults == ctx->faults_seen)
+                return false;
+
+        ctx->faults_seen = faults;
+        return true;
+}
+
 static void
 kbase_kcpu_queue_destroy(kbase k, struct kbase_context *ctx);
 
@@ -1264,35 +1910,41 @@ kbase_context_recreate(kbase k, struct kbase_context *ctx)
         tiler_heap_term(k, ctx);
         cs_group_term(k, ctx);
 
-        if (!cs_group_create(k, ctx)) {
-                free(ctx);
+        /* On failure the context is left without a group, but can still be
+         * destroyed by the caller */
+        if (!cs_group_create(k, ctx))
                 return false;
-        }
 
-        if (!tiler_heap_create(k, ctx)) {
-                free(ctx);
+        if (!tiler_heap_create(k, ctx))
                 return false;
-        }
 
         return true;
 }
 
 static struct kbase_cs
 kbase_cs_bind_noevent(kbase k, struct kbase_context *ctx,
-                      base_va va, unsigned size, unsigned csi)
+                      base_va va, unsigned size, unsigned csi,
+                      unsigned priority)
 {
         struct kbase_cs cs = {
                 .ctx = ctx,
                 .va = va,
                 .size = size,
                 .csi = csi,
+                .priority = MIN2(priority, BASE_QUEUE_MAX_PRIORITY),
                 .latest_flush = (uint32_t *)k->csf_user_reg,
         };
 
+        /* Contexts in shared groups only get a few queues each */
+        if (ctx->csg && csi >= KBASE_SHARED_CONTEXT_CSI) {
+                fprintf(stderr, "no more CSIs in shared queue group\n");
+                return cs;
+        }
+
         struct kbase_ioctl_cs_queue_register reg = {
                 .buffer_gpu_addr = va,
                 .buffer_size = size,
-                .priority = 1,
+                .priority = cs.priority,
         };
 
         int ret = kbase_ioctl(k->fd, KBASE_IOCTL_CS_QUEUE_REGISTER, &reg);
@@ -1306,7 +1958,7 @@ kbase_cs_bind_noevent(kbase k, struct kbase_context *ctx,
                 .in = {
                         .buffer_gpu_addr = va,
                         .group_handle = ctx->csg_handle,
-                        .csi_index = csi,
+                        .csi_index = ctx->csi_base + csi,
                 }
         };
 
@@ -1333,26 +1985,83 @@ kbase_cs_bind_noevent(kbase k, struct kbase_context *ctx,
         return cs;
 }
 
-static struct kbase_cs
-kbase_cs_bind(kbase k, struct kbase_context *ctx,
-              base_va va, unsigned size)
+static void
+kbase_cs_term_noevent(kbase k, struct kbase_cs *cs)
 {
-        struct kbase_cs cs = kbase_cs_bind_noevent(k, ctx, va, size, ctx->num_csi++);
+        if (cs->user_io) {
+                LOG("unmapping %p user_io %p\n", cs, cs->user_io);
+                munmap(cs->user_io,
+                       k->page_size * BASEP_QUEUE_NR_MMAP_USER_PAGES);
+        }
 
-        // TODO: Fix this problem properly
-        if (k->event_slot_usage >= 256) {
-                fprintf(stderr, "error: Too many contexts created!\n");
+        struct kbase_ioctl_cs_queue_terminate term = {
+                .buffer_gpu_addr = cs->va,
+        };
+
+        kbase_ioctl(k->fd, KBASE_IOCTL_CS_QUEUE_TERMINATE, &term);
+}
+
+/* Returns -1 if all slots are in use. Must be called with queue_lock held. */
+static int
+kbase_event_slot_alloc(kbase k)
+{
+        int slot = BITSET_FFS(k->event_slots_free) - 1;
+
+        if (slot < 0) {
+                if (!kbase_event_chunk_add(k))
+                        return -1;
+
+                slot = BITSET_FFS(k->event_slots_free) - 1;
+                assert(slot >= 0);
+        }
+
+        BITSET_CLEAR(k->event_slots_free, slot);
+
+        if (slot >= k->event_slot_usage)
+                p_atomic_set(&k->event_slot_usage, slot + 1);
+
+        return slot;
+}
+
+/* Must be called with queue_lock held */
+static void
+kbase_event_slot_free(kbase k, unsigned slot)
+{
+        BITSET_SET(k->event_slots_free, slot);
+
+        /* Shrink the range of slots that need to be walked */
+        unsigned usage = k->event_slot_usage;
+        while (usage && BITSET_TEST(k->event_slots_free, usage - 1))
+                --usage;
+
+        p_atomic_set(&k->event_slot_usage, usage);
+}
+
+static bool
+kbase_cs_init_event_slot(kbase k, struct kbase_cs *cs)
+{
+        pthread_mutex_lock(&k->queue_lock);
+
+        int slot_idx = kbase_event_slot_alloc(k);
 
-                /* *very* dangerous, but might just work */
-                --k->event_slot_usage;
+        if (slot_idx < 0) {
+                pthread_mutex_unlock(&k->queue_lock);
+                fprintf(stderr, "error: Too many contexts created!\n");
+                return false;
         }
 
+        struct kbase_event_chunk *chunk =
+                k->event_chunks[slot_idx / KBASE_EVENT_CHUNK_SLOTS];
+        unsigned offset = (slot_idx % KBASE_EVENT_CHUNK_SLOTS) * PAN_EVENT_SIZE;
+        struct kbase_event_slot *slot = &chunk->slots[slot_idx % KBASE_EVENT_CHUNK_SLOTS];
+
         // TODO: This is a misnomer... it isn't a byte offset
-        cs.event_mem_offset = k->event_slot_usage++;
-        k->event_slots[cs.event_mem_offset].back =
-                &k->event_slots[cs.event_mem_offset].syncobjs;
+        cs->event_mem_offset = slot_idx;
 
-        uint64_t *event_data = k->event_mem.cpu + cs.event_mem_offset * PAN_EVENT_SIZE;
+        assert(!slot->syncobjs);
+        slot->back = &slot->syncobjs;
+
+        uint64_t *event_data = chunk->event_mem.cpu + offset;
 
         /* We use the "Higher" wait condition, so initialise to 1 to allow
          * waiting before writing... */
@@ -1361,13 +2070,31 @@ kbase_cs_bind(kbase k, struct kbase_context *ctx,
         event_data[1] = 0;
 
         /* Just a zero-init is fine... reads and writes are always paired */
-        uint64_t *kcpu_data = k->kcpu_event_mem.cpu + cs.event_mem_offset * PAN_EVENT_SIZE;
+        uint64_t *kcpu_data = chunk->kcpu_event_mem.cpu + offset;
         kcpu_data[0] = 0;
         kcpu_data[1] = 0;
 
         /* To match the event data */
-        k->event_slots[cs.event_mem_offset].last = 1;
-        k->event_slots[cs.event_mem_offset].last_submit = 1;
+        p_atomic_set(&slot->last, 1);
+        p_atomic_set(&slot->last_submit, 1);
+
+        pthread_mutex_unlock(&k->queue_lock);
+
+        return true;
+}
+
+static struct kbase_cs
+kbase_cs_bind(kbase k, struct kbase_context *ctx,
+              base_va va, unsigned size, unsigned priority)
+{
+        struct kbase_cs cs = kbase_cs_bind_noevent(k, ctx, va, size,
+                                                   ctx->num_csi++, priority);
+
+        /* An event slot is allocated iff user_io is set */
+        if (cs.user_io && !kbase_cs_init_event_slot(k, &cs)) {
+                kbase_cs_term_noevent(k, &cs);
+                cs.user_io = NULL;
+        }
 
         return cs;
 }
@@ -1375,42 +2102,51 @@ kbase_cs_bind(kbase k, struct kbase_context *ctx,
 static void
 kbase_cs_term(kbase k, struct kbase_cs *cs)
 {
-        if (cs->user_io) {
-                LOG("unmapping %p user_io %p\n", cs, cs->user_io);
-                munmap(cs->user_io,
-                       k->page_size * BASEP_QUEUE_NR_MMAP_USER_PAGES);
-        }
+        kbase_cs_term_noevent(k, cs);
 
-        struct kbase_ioctl_cs_queue_terminate term = {
-                .buffer_gpu_addr = cs->va,
-        };
-
-        kbase_ioctl(k->fd, KBASE_IOCTL_CS_QUEUE_TERMINATE, &term);
+        /* The event slot was never allocated */
+        if (!cs->user_io)
+                return;
 
         pthread_mutex_lock(&k->queue_lock);
-        kbase_update_queue_callbacks(k, &k->event_slots[cs->event_mem_offset],
-                                     ~0ULL);
 
-        k->event_slots[cs->event_mem_offset].last = ~0ULL;
+        struct kbase_event_slot *slot =
+                kbase_event_slot_get(k, cs->event_mem_offset);
+
+        kbase_update_queue_callbacks(k, slot, ~0ULL);
+
+        p_atomic_set(&slot->last, ~0ULL);
 
         /* Make sure that no syncobjs are referencing this CS */
         list_for_each_entry(struct kbase_syncobj, o, &k->syncobjs, link)
                 kbase_syncobj_update(k, o);
 
+        p_atomic_set(&slot->last, 0);
+        p_atomic_set(&slot->last_submit, 0);
+
+        /* The slot can now be reused by another queue */
+        kbase_event_slot_free(k, cs->event_mem_offset);
 
-        k->event_slots[cs->event_mem_offset].last = 0;
         pthread_mutex_unlock(&k->queue_lock);
 }
 
+/* The event slot might change, so callers must refresh any cached copies of
+ * the event addresses. */
 static void
 kbase_cs_rebind(kbase k, struct kbase_cs *cs)
 {
         struct kbase_cs new;
-        new = kbase_cs_bind_noevent(k, cs->ctx, cs->va, cs->size, cs->csi);
+        new = kbase_cs_bind_noevent(k, cs->ctx, cs->va, cs->size, cs->csi,
+                                    cs->priority);
 
         cs->user_io = new.user_io;
         LOG("remapping %p user_io %p\n", cs, cs->user_io);
 
+        if (cs->user_io && !kbase_cs_init_event_slot(k, cs)) {
+                kbase_cs_term_noevent(k, cs);
+                cs->user_io = NULL;
+        }
+
         fprintf(stderr, "bound csi %i again\n", cs->csi);
 }
 
@@ -1453,16 +2189,29 @@ kbase_cs_submit(kbase k, struct kbase_cs *cs, uint64_t insert_offset,
         if (insert_offset == cs->last_insert)
                 return true;
 
-#ifndef PAN_BASE_NOOP
         struct kbase_event_slot *slot =
-                &k->event_slots[cs->event_mem_offset];
+                kbase_event_slot_get(k, cs->event_mem_offset);
 
-        pthread_mutex_lock(&k->queue_lock);
-        slot->last_submit = seqnum + 1;
+        /* No need for queue_lock here, this is all that is needed for other
+         * threads to start depending on the submission */
+        p_atomic_set(&slot->last_submit, seqnum + 1);
 
         if (o)
                 kbase_syncobj_update_fence(o, cs->event_mem_offset, seqnum);
-        pthread_mutex_unlock(&k->queue_lock);
+
+#ifdef PAN_BASE_NOOP
+        /* With no GPU behind the queue, complete the submission straight
+         * away by writing its sequence number to event memory like the
+         * command stream would, so that only CPU time is measured */
+        struct kbase_event_chunk *chunk =
+                k->event_chunks[cs->event_mem_offset / KBASE_EVENT_CHUNK_SLOTS];
+        uint64_t *event_mem = chunk->event_mem.cpu;
+        p_atomic_set(&event_mem[(cs->event_mem_offset %
+                                 KBASE_EVENT_CHUNK_SLOTS) * 2], seqnum + 1);
+
+        cs->last_insert = insert_offset;
+        k->handle_events(k);
+        return true;
 #endif
 
         memory_barrier();
@@ -1489,14 +2238,20 @@ kbase_cs_submit(kbase k, struct kbase_cs *cs, uint64_t insert_offset,
 
 static bool
 kbase_cs_wait(kbase k, struct kbase_cs *cs, uint64_t extract_offset,
-              struct kbase_syncobj *o)
+              struct kbase_syncobj *o, int64_t timeout_ns)
 {
         if (!cs->user_io)
                 return false;
 
-        if (kbase_syncobj_wait(k, o))
+        if (kbase_syncobj_wait(k, o, timeout_ns))
                 return true;
 
+        /* Polling is not an error */
+        if (!timeout_ns)
+                return false;
+
+        fprintf(stderr, "syncobj %p wait timeout\n", o);
+
         uint64_t e = CS_READ_REGISTER(cs, CS_EXTRACT);
         unsigned a = CS_READ_REGISTER(cs, CS_ACTIVE);
 
@@ -1505,14 +2260,38 @@ kbase_cs_wait(kbase k, struct kbase_cs *cs, uint64_t extract_offset,
                 cs->csi, e, extract_offset, a);
 
         fprintf(stderr, "fences:\n");
+        pthread_mutex_lock(&o->lock);
         list_for_each_entry(struct kbase_fence, fence, &o->fences, link) {
                 fprintf(stderr, " slot %i: seqnum %"PRIu64"\n",
                         fence->slot, fence->value);
         }
+        pthread_mutex_unlock(&o->lock);
 
         return false;
 }
 
+static uint64_t
+kbase_cs_extract(kbase k, struct kbase_cs *cs)
+{
+#ifdef PAN_BASE_NOOP
+        return cs->last_insert;
+#endif
+
+        if (!cs->user_io)
+                return cs->last_insert;
+
+        struct kbase_event_slot *slot =
+                kbase_event_slot_get(k, cs->event_mem_offset);
+
+        /* The firmware does not update CS_EXTRACT after every instruction,
+         * but once the last submission has signalled its event the whole
+         * ring has been consumed */
+        if (p_atomic_read(&slot->last) >= p_atomic_read(&slot->last_submit))
+                return cs->last_insert;
+
+        return MIN2(CS_READ_REGISTER(cs, CS_EXTRACT), cs->last_insert);
+}
+
 static bool
 kbase_kcpu_queue_create(kbase k, struct kbase_context *ctx)
 {
@@ -1558,21 +2337,30 @@ kbase_kcpu_queue_destroy(kbase k, struct kbase_context *ctx)
         ctx->kcpu_init = false;
 }
 
+/* The kernel KCPU queue can only hold 256 commands, so the commands for a
+ * single enqueue must be limited to fit in a partially filled queue. */
+#define KBASE_KCPU_MAX_ENQUEUE 64
+
 static bool
-kbase_kcpu_command(kbase k, struct kbase_context *ctx, struct base_kcpu_command *cmd)
+kbase_kcpu_commands(kbase k, struct kbase_context *ctx,
+                    struct base_kcpu_command *cmds, unsigned count)
 {
         int err;
         bool ret = true;
 
+        assert(count <= KBASE_KCPU_MAX_ENQUEUE);
+
         if (!kbase_kcpu_queue_create(k, ctx))
                 return false;
 
         struct kbase_ioctl_kcpu_queue_enqueue enqueue = {
-                .addr = (uintptr_t) cmd,
-                .nr_commands = 1,
+                .addr = (uintptr_t) cmds,
+                .nr_commands = count,
                 .id = ctx->kcpu_queue,
         };
 
+        p_atomic_add(&k->kcpu_commands, count);
+
         err = kbase_ioctl(k->fd, KBASE_IOCTL_KCPU_QUEUE_ENQUEUE, &enqueue);
         if (err != -1)
                 return ret;
@@ -1598,6 +2386,12 @@ kbase_kcpu_command(kbase k, struct kbase_context *ctx, struct base_kcpu_command
         return ret;
 }
 
+static bool
+kbase_kcpu_command(kbase k, struct kbase_context *ctx, struct base_kcpu_command *cmd)
+{
+        return kbase_kcpu_commands(k, ctx, cmd, 1);
+}
+
 static int
 kbase_kcpu_fence_export(kbase k, struct kbase_context *ctx)
 {
@@ -1666,7 +2460,221 @@ kbase_kcpu_cqs_wait(kbase k, struct kbase_context *ctx,
 
         return kbase_kcpu_command(k, ctx, &wait_cmd);
 }
+
+static bool
+kbase_sync_file_signalled(int fd)
+{
+        struct pollfd pfd = {
+                .fd = fd,
+                .events = POLLIN,
+        };
+
+        return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+/* Picks the queue for a sync file export, called with sync_file_lock held */
+static struct kbase_sync_file_queue *
+kbase_sync_file_queue_get(kbase k)
+{
+        for (unsigned i = 0; i < KBASE_SYNC_FILE_QUEUES; ++i) {
+                struct kbase_sync_file_queue *q = &k->sync_file_queues[i];
+
+                if (q->fd == -1 || kbase_sync_file_signalled(q->fd))
+                        return q;
+        }
+
+        /* Every queue is busy, so share them out in turn */
+        unsigned i = k->sync_file_next++ % KBASE_SYNC_FILE_QUEUES;
+        return &k->sync_file_queues[i];
+}
+
+/* Counts the fences which have not yet signalled, called with the syncobj
+ * lock held */
+static unsigned
+kbase_syncobj_count_pending(kbase k, struct kbase_syncobj *o)
+{
+        unsigned count = 0;
+
+        list_for_each_entry(struct kbase_fence, f, &o->fences, link) {
+                struct kbase_event_slot *slot = kbase_event_slot_get(k, f->slot);
+
+                if (p_atomic_read(&slot->last) <= f->value)
+                        ++count;
+        }
+
+        return count;
+}
+
+/* Returns a sync file which signals once every fence in the syncobj has
+ * completed. A KCPU queue waits on the event memory of each queue, so the
+ * CPU never has to block. */
+static int
+kbase_syncobj_export_sync_file(kbase k, struct kbase_syncobj *o)
+{
+        /* A wait command can only take BASEP_KCPU_CQS_MAX_NUM_OBJS objects.
+         * The waits and the fence signal are enqueued by a single ioctl, so
+         * that a failure can't leave some of the waits in the queue. */
+        const unsigned max_objs =
+                (KBASE_KCPU_MAX_ENQUEUE - 1) * BASEP_KCPU_CQS_MAX_NUM_OBJS;
+
+        struct base_kcpu_command cmds[KBASE_KCPU_MAX_ENQUEUE];
+        unsigned num_objs, num_cmds = 0;
+
+        struct base_fence fence = {
+                .basep.fd = -1,
+        };
+
+        pthread_mutex_lock(&o->lock);
+
+        /* There isn't space for the waits, wait on the CPU instead */
+        while ((num_objs = kbase_syncobj_count_pending(k, o)) > max_objs) {
+                pthread_mutex_unlock(&o->lock);
+
+                if (!kbase_syncobj_wait(k, o, INT64_MAX))
+                        return -1;
+
+                pthread_mutex_lock(&o->lock);
+        }
+
+        struct base_cqs_wait_operation_info *objs =
+                malloc(MAX2(num_objs, 1) * sizeof(*objs));
+
+        if (!objs) {
+                pthread_mutex_unlock(&o->lock);
+                return -1;
+        }
+
+        unsigned i = 0;
+
+        list_for_each_entry(struct kbase_fence, f, &o->fences, link) {
+                struct kbase_event_slot *slot = kbase_event_slot_get(k, f->slot);
+
+                /* Slots only move forwards, so this can only skip fences
+                 * which were counted */
+                if (p_atomic_read(&slot->last) > f->value)
+                        continue;
+
+                objs[i++] = (struct base_cqs_wait_operation_info) {
+                        .addr = kbase_event_va(k, f->slot),
+                        .val = f->value,
+                        .operation = BASEP_CQS_WAIT_OPERATION_GT,
+                        .data_type = BASEP_CQS_DATA_TYPE_U64,
+                };
+        }
+
+        pthread_mutex_unlock(&o->lock);
+
+        for (unsigned first = 0; first < i;
+             first += BASEP_KCPU_CQS_MAX_NUM_OBJS) {
+                cmds[num_cmds++] = (struct base_kcpu_command) {
+                        .type = BASE_KCPU_COMMAND_TYPE_CQS_WAIT_OPERATION,
+                        .info.cqs_wait_operation = {
+                                .objs = (uintptr_t) (objs + first),
+                                .nr_objs = MIN2(i - first,
+                                                BASEP_KCPU_CQS_MAX_NUM_OBJS),
+                        },
+                };
+        }
+
+        cmds[num_cmds++] = (struct base_kcpu_command) {
+                .type = BASE_KCPU_COMMAND_TYPE_FENCE_SIGNAL,
+                .info.fence.fence = (uintptr_t) &fence,
+        };
+
+        pthread_mutex_lock(&k->sync_file_lock);
+
+        struct kbase_sync_file_queue *q = kbase_sync_file_queue_get(k);
+        bool ok = kbase_kcpu_commands(k, &q->kcpu, cmds, num_cmds);
+
+        if (ok && fence.basep.fd != -1) {
+                if (q->fd != -1)
+                        close(q->fd);
+
+                q->fd = os_dupfd_cloexec(fence.basep.fd);
+        }
+
+        pthread_mutex_unlock(&k->sync_file_lock);
+
+        free(objs);
+
+        return ok ? fence.basep.fd : -1;
+}
+
+static bool
+kbase_kcpu_fence_import_batch(kbase k, struct kbase_context *ctx,
+                              const int *fds, unsigned count,
+                              base_va addr, uint64_t value)
+{
+        struct base_kcpu_command cmds[KBASE_KCPU_MAX_ENQUEUE];
+        struct base_fence fences[KBASE_KCPU_MAX_ENQUEUE];
+        unsigned num_cmds = 0;
+
+        struct base_cqs_set_operation_info set = {
+                .addr = addr,
+                .val = value,
+                .operation = BASEP_CQS_SET_OPERATION_SET,
+                .data_type = BASEP_CQS_DATA_TYPE_U64,
+        };
+
+        for (unsigned i = 0; i < count; ++i) {
+                /* There is no need for the KCPU queue to wait for fences
+                 * that have already signalled */
+                if (kbase_sync_file_signalled(fds[i]))
+                        continue;
+
+                /* Leave space for the CQS set at the end */
+                if (num_cmds == ARRAY_SIZE(cmds) - 1) {
+                        if (!kbase_kcpu_commands(k, ctx, cmds, num_cmds))
+                                return false;
+                        num_cmds = 0;
+                }
+
+                fences[num_cmds] = (struct base_fence) {
+                        .basep.fd = fds[i],
+                };
+
+                cmds[num_cmds] = (struct base_kcpu_command) {
+                        .type = BASE_KCPU_COMMAND_TYPE_FENCE_WAIT,
+                        .info.fence.fence = (uintptr_t) &fences[num_cmds],
+                };
+                ++num_cmds;
+        }
+
+        cmds[num_cmds++] = (struct base_kcpu_command) {
+                .type = BASE_KCPU_COMMAND_TYPE_CQS_SET_OPERATION,
+                .info.cqs_set_operation = {
+                        .objs = (uintptr_t) &set,
+                        .nr_objs = 1,
+                },
+        };
+
+        return kbase_kcpu_commands(k, ctx, cmds, num_cmds);
+}
+#endif
+
+static int
+kbase_hwcnt_reader_setup(kbase k, unsigned buffer_count)
+{
+#if PAN_BASE_API >= 1 && !defined(PAN_BASE_NOOP)
+        /* The first block is the job manager on JM GPUs and the command
+         * stream front-end on CSF, the layout is otherwise the same */
+        struct kbase_ioctl_hwcnt_reader_setup setup = {
+                .buffer_count = buffer_count,
+                .fe_bm = ~0,
+                .shader_bm = ~0,
+                .tiler_bm = ~0,
+                .mmu_l2_bm = ~0,
+        };
+
+        int fd = kbase_ioctl(k->fd, KBASE_IOCTL_HWCNT_READER_SETUP, &setup);
+        if (fd < 0)
+                perror("ioctl(KBASE_IOCTL_HWCNT_READER_SETUP)");
+
+        return fd;
+#else
+        return -1;
 #endif
+}
 
 // TODO: Only define for CSF kbases?
 static bool
@@ -1678,16 +2686,20 @@ kbase_callback_all_queues(kbase k, int32_t *count,
         int32_t queue_count = 0;
 
         for (unsigned i = 0; i < k->event_slot_usage; ++i) {
-                struct kbase_event_slot *slot = &k->event_slots[i];
+                if (!kbase_event_slot_live(k, i))
+                        continue;
+
+                struct kbase_event_slot *slot = kbase_event_slot_get(k, i);
+                uint64_t last_submit = p_atomic_read(&slot->last_submit);
 
                 /* There is no need to do anything for idle slots */
-                if (slot->last == slot->last_submit)
+                if (p_atomic_read(&slot->last) == last_submit)
                         continue;
 
                 struct kbase_sync_link *link = malloc(sizeof(*link));
                 *link = (struct kbase_sync_link) {
                         .next = NULL,
-                        .seqnum = slot->last_submit,
+                        .seqnum = last_submit,
                         .callback = callback,
                         .data = data,
                 };
@@ -1714,8 +2726,9 @@ kbase_mem_sync(kbase k, base_va gpu, void *cpu, size_t size,
 {
 #ifdef __aarch64__
         /* Valgrind replaces the operations with DC CVAU, which is not enough
-         * for CPU<->GPU coherency. The ioctl can be used instead. */
-        if (!RUNNING_ON_VALGRIND) {
+         * for CPU<->GPU coherency. The ioctl can be used instead, and is
+         * also used for large ranges. */
+        if (!RUNNING_ON_VALGRIND && size < CACHE_SYNC_IOCTL_THRESHOLD) {
                 /* I don't that memory barriers are needed here... having the
                  * DMB SY before submit should be enough. TODO what about
                  * dma-bufs? */
@@ -1755,9 +2768,15 @@ kbase_open_csf
         k->api = PAN_BASE_API;
 
         pthread_mutex_init(&k->handle_lock, NULL);
+        pthread_mutex_init(&k->submit_lock, NULL);
         pthread_mutex_init(&k->event_read_lock, NULL);
         pthread_mutex_init(&k->event_cnd_lock, NULL);
         pthread_mutex_init(&k->queue_lock, NULL);
+        pthread_mutex_init(&k->sync_file_lock, NULL);
+        pthread_mutex_init(&k->csg_lock, NULL);
+
+        for (unsigned i = 0; i < KBASE_SYNC_FILE_QUEUES; ++i)
+                k->sync_file_queues[i].fd = -1;
 
         pthread_condattr_t attr;
         pthread_condattr_init(&attr);
@@ -1766,6 +2785,7 @@ kbase_open_csf
         pthread_condattr_destroy(&attr);
 
         list_inithead(&k->syncobjs);
+        list_inithead(&k->shared_groups);
 
         /* For later APIs, we've already checked the version in pan_base.c */
 #if PAN_BASE_API == 0
@@ -1780,6 +2800,9 @@ kbase_open_csf
 
         k->alloc = kbase_alloc;
         k->free = kbase_free;
+        k->alloc_at = kbase_alloc_at;
+        k->mem_purgeable = kbase_mem_purgeable;
+        k->mem_commit = kbase_mem_commit;
         k->import_dmabuf = kbase_import_dmabuf;
         k->mmap_import = kbase_mmap_import;
 
@@ -1788,32 +2811,44 @@ kbase_open_csf
 
 #if PAN_BASE_API < 2
         k->submit = kbase_submit;
+        k->submit_queue = kbase_submit_queue;
+        k->submit_batch = kbase_submit_batch;
 #else
         k->context_create = kbase_context_create;
         k->context_destroy = kbase_context_destroy;
         k->context_recreate = kbase_context_recreate;
+        k->context_faulted = kbase_context_faulted;
+        k->tiler_heap_chunks = kbase_tiler_heap_chunks;
+        k->tiler_heap_resize = kbase_tiler_heap_resize;
 
         k->cs_bind = kbase_cs_bind;
         k->cs_term = kbase_cs_term;
         k->cs_rebind = kbase_cs_rebind;
         k->cs_submit = kbase_cs_submit;
         k->cs_wait = kbase_cs_wait;
+        k->cs_extract = kbase_cs_extract;
 
         k->kcpu_fence_export = kbase_kcpu_fence_export;
         k->kcpu_fence_import = kbase_kcpu_fence_import;
+        k->kcpu_fence_import_batch = kbase_kcpu_fence_import_batch;
         k->kcpu_cqs_set = kbase_kcpu_cqs_set;
         k->kcpu_cqs_wait = kbase_kcpu_cqs_wait;
+
+        k->syncobj_export_sync_file = kbase_syncobj_export_sync_file;
 #endif
 
         k->syncobj_create = kbase_syncobj_create;
         k->syncobj_destroy = kbase_syncobj_destroy;
         k->syncobj_dup = kbase_syncobj_dup;
+        k->syncobj_add_seqnum = kbase_syncobj_add_seqnum;
         k->syncobj_wait = kbase_syncobj_wait;
 
         k->callback_all_queues = kbase_callback_all_queues;
 
         k->mem_sync = kbase_mem_sync;
 
+        k->hwcnt_reader_setup = kbase_hwcnt_reader_setup;
+
         for (unsigned i = 0; i < ARRAY_SIZE(kbase_main); ++i) {
                 ++k->setup_state;
                 if (!kbase_main[i].part(k)) {
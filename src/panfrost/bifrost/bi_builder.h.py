@@ -98,7 +98,7 @@ bi_instr * bi_${opcode.replace('.', '_').lower()}${to_suffix(ops[opcode])}(${sig
     nr_srcs = "nr_srcs" if op["variable_srcs"] else src_count(op)
 %>
     size_t size = sizeof(bi_instr) + sizeof(bi_index) * (${nr_dests} + ${nr_srcs});
-    bi_instr *I = (bi_instr *) rzalloc_size(b->shader, size);
+    bi_instr *I = (bi_instr *) linear_zalloc_child(b->shader->linear_ctx, size);
 
     I->op = BI_OPCODE_${opcode.replace('.', '_').upper()};
     I->nr_dests = ${nr_dests};
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2020 Collabora Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors (Collabora):
+ *      Alyssa Rosenzweig <alyssa.rosenzweig@collabora.com>
+ */
+
+#ifndef __BI_LCRA_H
+#define __BI_LCRA_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "util/bitscan.h"
+#include "util/macros.h"
+#include "util/u_math.h"
+#include "nodearray.h"
+
+struct lcra_state {
+        unsigned node_count;
+        uint64_t *affinity;
+
+        /* Linear constraints imposed. For each node there there is a
+         * 'nodearray' structure, which changes between a sparse and dense
+         * array depending on the number of elements.
+         *
+         * Each element is itself a bit field denoting whether (c_j - c_i) bias
+         * is present or not, including negative biases.
+         *
+         * We support up to 8 components so the bias is in range
+         * [-7, 7] encoded by a 16-bit field
+         */
+        nodearray *linear;
+
+        /* Before solving, forced registers; after solving, solutions. */
+        unsigned *solutions;
+
+        /** Node which caused register allocation to fail */
+        unsigned spill_node;
+};
+
+/* This module is an implementation of "Linearly Constrained
+ * Register Allocation". The paper is available in PDF form
+ * (https://people.collabora.com/~alyssa/LCRA.pdf) as well as Markdown+LaTeX
+ * (https://gitlab.freedesktop.org/alyssa/lcra/blob/master/LCRA.md)
+ */
+
+static inline struct lcra_state *
+lcra_alloc_equations(unsigned node_count)
+{
+        struct lcra_state *l = (struct lcra_state *)calloc(1, sizeof(*l));
+
+        l->node_count = node_count;
+
+        l->linear = (nodearray *)calloc(sizeof(l->linear[0]), node_count);
+        l->solutions = (unsigned *)calloc(sizeof(l->solutions[0]), node_count);
+        l->affinity = (uint64_t *)calloc(sizeof(l->affinity[0]), node_count);
+
+        memset(l->solutions, ~0, sizeof(l->solutions[0]) * node_count);
+
+        return l;
+}
+
+static inline void
+lcra_free(struct lcra_state *l)
+{
+        for (unsigned i = 0; i < l->node_count; ++i)
+                nodearray_reset(&l->linear[i]);
+
+        free(l->linear);
+        free(l->affinity);
+        free(l->solutions);
+        free(l);
+}
+
+static inline void
+lcra_add_node_interference(struct lcra_state *l, unsigned i, unsigned cmask_i, unsigned j, unsigned cmask_j)
+{
+        if (i == j)
+                return;
+
+        nodearray_value constraint_fw = 0;
+        nodearray_value constraint_bw = 0;
+
+        /* The constraint bits are reversed from lcra.c so that register
+         * allocation can be done in parallel for every possible solution,
+         * with lower-order bits representing smaller registers. */
+
+        for (unsigned D = 0; D < 8; ++D) {
+                if (cmask_i & (cmask_j << D)) {
+                        constraint_fw |= (1 << (7 + D));
+                        constraint_bw |= (1 << (7 - D));
+                }
+
+                if (cmask_i & (cmask_j >> D)) {
+                        constraint_bw |= (1 << (7 + D));
+                        constraint_fw |= (1 << (7 - D));
+                }
+        }
+
+        /* Use dense arrays after adding 256 elements */
+        nodearray_orr(&l->linear[j], i, constraint_fw, 256, l->node_count);
+        nodearray_orr(&l->linear[i], j, constraint_bw, 256, l->node_count);
+}
+
+/* Constraint bit b between nodes i and j forbids the solution
+ * solutions[j] + b - 7 for node i, so the whole constraint can be moved into
+ * place with a single shift. */
+static inline uint64_t
+lcra_constraint_mask(nodearray_value constraint, unsigned solution)
+{
+        signed shift = (signed) solution - 7;
+
+        if (shift >= 0)
+                return (uint64_t) constraint << shift;
+        else
+                return (uint64_t) constraint >> -shift;
+}
+
+/* Bit mask of the registers node i can't use given the solutions so far */
+static inline uint64_t
+lcra_forbidden(struct lcra_state *l, unsigned *solutions, unsigned i)
+{
+        uint64_t forbidden = 0;
+
+        if (nodearray_is_sparse(&l->linear[i])) {
+                nodearray_sparse_foreach(&l->linear[i], elem) {
+                        unsigned j = nodearray_sparse_key(elem);
+
+                        if (solutions[j] == ~0) continue;
+
+                        forbidden |= lcra_constraint_mask(nodearray_sparse_value(elem),
+                                                          solutions[j]);
+                }
+
+                return forbidden;
+        }
+
+        nodearray_value *row = l->linear[i].dense;
+
+        for (unsigned j = 0; j < l->node_count; ++j) {
+                if (solutions[j] == ~0 || !row[j]) continue;
+
+                forbidden |= lcra_constraint_mask(row[j], solutions[j]);
+        }
+
+        return forbidden;
+}
+
+static inline bool
+lcra_test_linear(struct lcra_state *l, unsigned *solutions, unsigned i)
+{
+        return !(lcra_forbidden(l, solutions, i) & BITFIELD64_BIT(solutions[i]));
+}
+
+static inline bool
+lcra_solve(struct lcra_state *l)
+{
+        for (unsigned step = 0; step < l->node_count; ++step) {
+                if (l->solutions[step] != ~0) continue;
+                if (l->affinity[step] == 0) continue;
+
+                /* Test every register at once, picking the lowest free */
+                uint64_t options = l->affinity[step] &
+                                   ~lcra_forbidden(l, l->solutions, step);
+
+                /* Out of registers - prepare to spill */
+                if (!options) {
+                        l->spill_node = step;
+                        return false;
+                }
+
+                l->solutions[step] = ffsll(options) - 1;
+        }
+
+        return true;
+}
+
+/* Register spilling is implemented with a cost-benefit system. Costs are set
+ * by the user. Benefits are calculated from the constraints. */
+
+static inline unsigned
+lcra_count_constraints(struct lcra_state *l, unsigned i)
+{
+        unsigned count = 0;
+        nodearray *constraints = &l->linear[i];
+
+        if (nodearray_is_sparse(constraints)) {
+                nodearray_sparse_foreach(constraints, elem)
+                        count += util_bitcount(nodearray_sparse_value(elem));
+        } else {
+                nodearray_dense_foreach_64(constraints, elem)
+                        count += util_bitcount64(*elem);
+        }
+
+        return count;
+}
+
+#endif
@@ -32,6 +32,12 @@
  * (computed LOD in fragment shaders, else zero LOD) and immediate
  * texture/sampler indices 0...3.
  *
+ * The dual texture descriptor has room for neither an array index nor a LOD
+ * source and both textures are sampled at one coordinate pair, so fetches at
+ * different coordinates, from arrays or with other LOD modes go through TEXC.
+ * Quads exist outside of fragment shaders, so computed LOD is not the same as
+ * zero LOD there either.
+ *
  * Fusing across basic block boundaries is not expected to be useful, as it
  * increases register pressure and causes redundant memory traffic. As such, we
  * use a local optimization pass.
@@ -100,6 +106,7 @@ bi_fuse_dual(bi_context *ctx, bi_instr *I1, bi_instr *I2)
                         bi_count_write_registers(I2, 0));
 
         I->skip = I1->skip && I2->skip;
+        ctx->dual_tex++;
 
         bi_remove_instruction(I1);
         bi_remove_instruction(I2);
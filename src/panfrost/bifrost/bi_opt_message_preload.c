@@ -27,9 +27,11 @@
 /* Bifrost v7 can preload up to two messages of the form:
  *
  * 1. +LD_VAR_IMM, register_format f32/f16, sample mode
- * 2. +VAR_TEX, register format f32/f16, sample mode (TODO)
+ * 2. +VAR_TEX, register format f32/f16, sample mode
  *
- * Analyze the shader for these instructions and push accordingly.
+ * Analyze the shader for these instructions and push accordingly. Message
+ * preloading is a fragment-only feature of v7: vertex shaders and Valhall have
+ * nothing similar, so there is nothing to do for them.
  */
 
 static bool
@@ -86,43 +88,177 @@ bi_is_var_tex(enum bi_opcode op)
         return (op == BI_OPCODE_VAR_TEX_F32) || (op == BI_OPCODE_VAR_TEX_F16);
 }
 
-void
-bi_opt_message_preload(bi_context *ctx)
+/*
+ * Preloaded registers are live from the start of the shader, rather than from
+ * the replaced message, so preloading a message far from the start lengthens
+ * its live range. Estimate the register pressure in words before each
+ * instruction of the first block, to reject preloads that would push the
+ * pressure past what full occupancy allows.
+ */
+#define BI_PRELOAD_MAX_PRESSURE 32
+
+static unsigned *
+bi_block_pressure(bi_context *ctx, bi_block *block, unsigned nr_instrs,
+                  unsigned *peak)
+{
+        unsigned *words = calloc(ctx->ssa_alloc, sizeof(unsigned));
+        unsigned *pressure = calloc(nr_instrs, sizeof(unsigned));
+        BITSET_WORD *live = calloc(BITSET_WORDS(ctx->ssa_alloc),
+                                   sizeof(BITSET_WORD));
+
+        bi_foreach_instr_global(ctx, I) {
+                bi_foreach_dest(I, d) {
+                        if (bi_is_ssa(I->dest[d]))
+                                words[I->dest[d].value] = bi_count_write_registers(I, d);
+                }
+        }
+
+        bi_compute_liveness_ssa(ctx);
+        memcpy(live, block->ssa_live_out,
+               BITSET_WORDS(ctx->ssa_alloc) * sizeof(BITSET_WORD));
+
+        unsigned current = 0, i;
+        BITSET_FOREACH_SET(i, live, ctx->ssa_alloc)
+                current += words[i];
+
+        unsigned ip = nr_instrs;
+        *peak = current;
+
+        bi_foreach_instr_in_block_rev(block, I) {
+                bi_foreach_dest(I, d) {
+                        if (bi_is_ssa(I->dest[d]) &&
+                            BITSET_TEST(live, I->dest[d].value)) {
+                                BITSET_CLEAR(live, I->dest[d].value);
+                                current -= words[I->dest[d].value];
+                        }
+                }
+
+                bi_foreach_ssa_src(I, s) {
+                        if (!BITSET_TEST(live, I->src[s].value)) {
+                                BITSET_SET(live, I->src[s].value);
+                                current += words[I->src[s].value];
+                        }
+                }
+
+                pressure[--ip] = current;
+                *peak = MAX2(*peak, current);
+        }
+
+        free(live);
+        free(words);
+        return pressure;
+}
+
+static bool
+bi_can_preload(bi_instr *I)
+{
+        return (I->nr_dests == 1) &&
+                (bi_can_preload_ld_var(I) || bi_is_var_tex(I->op));
+}
+
+static struct bifrost_message_preload
+bi_message_for_preload(bi_instr *I)
 {
+        if (bi_is_var_tex(I->op)) {
+                return (struct bifrost_message_preload) {
+                        .enabled = true,
+                        .texture = true,
+                        .varying_index = I->varying_index,
+                        .texture_index = I->texture_index,
+                        .fp16 = (I->op == BI_OPCODE_VAR_TEX_F16),
+                        .skip = I->skip,
+                        .zero_lod = I->lod_mode
+                };
+        } else {
+                return (struct bifrost_message_preload) {
+                        .enabled = true,
+                        .varying_index = I->varying_index,
+                        .fp16 = (I->register_format == BI_REGISTER_FORMAT_F16),
+                        .num_components = I->vecsize + 1
+                };
+        }
+}
+
+/*
+ * Pick up to two messages to preload. Texturing has the longest latency, so
+ * VAR_TEX is picked before LD_VAR_IMM, each kind in program order. A message
+ * is skipped if the registers it holds from the start of the shader would
+ * raise the pressure of the first block above both the occupancy limit and
+ * the block's existing peak.
+ */
+static unsigned
+bi_choose_preloads(bi_context *ctx, bi_block *block, bi_instr **chosen)
+{
+        unsigned nr_instrs = 0;
+        bi_foreach_instr_in_block(block, I)
+                nr_instrs++;
+
+        if (!nr_instrs)
+                return 0;
+
+        unsigned peak;
+        unsigned *pressure = bi_block_pressure(ctx, block, nr_instrs, &peak);
+        unsigned limit = MAX2(peak, BI_PRELOAD_MAX_PRESSURE);
         unsigned nr_preload = 0;
 
+        for (unsigned pass = 0; pass < 2 && nr_preload < 2; ++pass) {
+                unsigned ip = 0;
+
+                bi_foreach_instr_in_block(block, I) {
+                        unsigned here = ip++;
+
+                        if (!bi_can_preload(I) || (bi_is_var_tex(I->op) != (pass == 0)))
+                                continue;
+
+                        unsigned nr = bi_count_write_registers(I, 0);
+                        bool fits = true;
+
+                        for (unsigned j = 0; j <= here; ++j)
+                                fits &= (pressure[j] + nr) <= limit;
+
+                        if (!fits)
+                                continue;
+
+                        for (unsigned j = 0; j <= here; ++j)
+                                pressure[j] += nr;
+
+                        chosen[nr_preload++] = I;
+
+                        /* Maximum number of preloaded messages */
+                        if (nr_preload == 2)
+                                break;
+                }
+        }
+
+        free(pressure);
+        return nr_preload;
+}
+
+void
+bi_opt_message_preload(bi_context *ctx)
+{
         /* We only preload from the first block */
         bi_block *block = bi_start_block(&ctx->blocks);
         bi_builder b = bi_init_builder(ctx, bi_before_nonempty_block(block));
 
+        bi_instr *chosen[2];
+        unsigned nr_preload = bi_choose_preloads(ctx, block, chosen);
+
+        /* Rewrite in program order, with messages numbered in order of
+         * choice */
         bi_foreach_instr_in_block_safe(block, I) {
-                if (I->nr_dests != 1) continue;
-
-                struct bifrost_message_preload msg;
-
-                if (bi_can_preload_ld_var(I)) {
-                        msg = (struct bifrost_message_preload) {
-                                .enabled = true,
-                                .varying_index = I->varying_index,
-                                .fp16 = (I->register_format == BI_REGISTER_FORMAT_F16),
-                                .num_components = I->vecsize + 1
-                        };
-                } else if (bi_is_var_tex(I->op)) {
-                        msg = (struct bifrost_message_preload) {
-                                .enabled = true,
-                                .texture = true,
-                                .varying_index = I->varying_index,
-                                .texture_index = I->texture_index,
-                                .fp16 = (I->op == BI_OPCODE_VAR_TEX_F16),
-                                .skip = I->skip,
-                                .zero_lod = I->lod_mode
-                        };
-                } else {
-                        continue;
+                unsigned m;
+
+                for (m = 0; m < nr_preload; ++m) {
+                        if (chosen[m] == I)
+                                break;
                 }
 
+                if (m == nr_preload)
+                        continue;
+
                 /* Report the preloading */
-                ctx->info.bifrost->messages[nr_preload] = msg;
+                ctx->info.bifrost->messages[m] = bi_message_for_preload(I);
 
                 /* Replace with a collect of preloaded registers. The collect
                  * kills the moves, so the collect is free (it is coalesced).
@@ -138,15 +274,11 @@ bi_opt_message_preload(bi_context *ctx)
                  */
                 b.cursor = bi_before_block(block);
                 bi_foreach_src(collect, i) {
-                        unsigned reg = (nr_preload * 4) + i;
+                        unsigned reg = (m * 4) + i;
 
                         collect->src[i] = bi_mov_i32(&b, bi_register(reg));
                 }
 
                 bi_remove_instruction(I);
-
-                /* Maximum number of preloaded messages */
-                if ((++nr_preload) == 2)
-                        break;
         }
 }
@@ -23,6 +23,7 @@
 
 #include "compiler.h"
 #include "bi_builder.h"
+#include "util/u_dynarray.h"
 
 /* This optimization pass, intended to run once after code emission but before
  * copy propagation, analyzes direct word-aligned UBO reads and promotes a
@@ -52,6 +53,10 @@ bi_is_direct_aligned_ubo(bi_instr *ins)
 struct bi_ubo_block {
         BITSET_DECLARE(pushed, MAX_UBO_WORDS);
         uint8_t range[MAX_UBO_WORDS];
+
+        /* Estimated number of executions of loads from each word, weighting
+         * loads in loops by their nesting depth */
+        uint32_t uses[MAX_UBO_WORDS];
 };
 
 struct bi_ubo_analysis {
@@ -68,61 +73,132 @@ bi_analyze_ranges(bi_context *ctx)
         };
 
         res.blocks = calloc(res.nr_blocks, sizeof(struct bi_ubo_block));
+        unsigned *loop_depth = bi_compute_loop_depth(ctx);
 
-        bi_foreach_instr_global(ctx, ins) {
-                if (!bi_is_direct_aligned_ubo(ins)) continue;
+        bi_foreach_block(ctx, block) {
+                /* Assume 8 iterations per loop, as register allocation does */
+                unsigned weight = 1 << (3 * MIN2(loop_depth[block->index], 4));
 
-                unsigned ubo = ins->src[1].value;
-                unsigned word = ins->src[0].value / 4;
-                unsigned channels = bi_opcode_props[ins->op].sr_count;
+                bi_foreach_instr_in_block(block, ins) {
+                        if (!bi_is_direct_aligned_ubo(ins)) continue;
 
-                assert(ubo < res.nr_blocks);
-                assert(channels > 0 && channels <= 4);
+                        unsigned ubo = ins->src[1].value;
+                        unsigned word = ins->src[0].value / 4;
+                        unsigned channels = bi_opcode_props[ins->op].sr_count;
 
-                if (word >= MAX_UBO_WORDS) continue;
+                        assert(ubo < res.nr_blocks);
+                        assert(channels > 0 && channels <= 4);
 
-                /* Must use max if the same base is read with different channel
-                 * counts, which is possible with nir_opt_shrink_vectors */
-                uint8_t *range = res.blocks[ubo].range;
-                range[word] = MAX2(range[word], channels);
+                        if (word >= MAX_UBO_WORDS) continue;
+
+                        /* Must use max if the same base is read with different
+                         * channel counts, which is possible with
+                         * nir_opt_shrink_vectors */
+                        struct bi_ubo_block *ubo_block = &res.blocks[ubo];
+                        ubo_block->range[word] = MAX2(ubo_block->range[word], channels);
+                        ubo_block->uses[word] += weight;
+                }
         }
 
+        free(loop_depth);
         return res;
 }
 
-/* Select UBO words to push. A sophisticated implementation would consider the
- * number of uses and perhaps the control flow to estimate benefit. This is not
- * sophisticated. Select from the last UBO first to prioritize sysvals. */
+struct bi_ubo_candidate {
+        unsigned ubo, word, range, uses;
+};
+
+/* Sort by uses per pushed word, highest first. Ties are broken by position
+ * for a deterministic order, as qsort is not stable. */
+
+static int
+bi_compare_candidates(const void *a_, const void *b_)
+{
+        const struct bi_ubo_candidate *a = a_, *b = b_;
+        uint64_t score_a = (uint64_t) a->uses * b->range;
+        uint64_t score_b = (uint64_t) b->uses * a->range;
+
+        if (score_a != score_b)
+                return (score_a > score_b) ? -1 : 1;
+        else if (a->ubo != b->ubo)
+                return (a->ubo > b->ubo) ? -1 : 1;
+        else
+                return (a->word > b->word) ? 1 : -1;
+}
+
+static void
+bi_push_range(struct panfrost_ubo_push *push, struct bi_ubo_block *block,
+              unsigned ubo, unsigned r)
+{
+        for (unsigned offs = 0; offs < block->range[r]; ++offs) {
+                struct panfrost_ubo_word word = {
+                        .ubo = ubo,
+                        .offset = (r + offs) * 4
+                };
+
+                push->words[push->count++] = word;
+        }
+
+        /* Mark it as pushed so we can rewrite */
+        BITSET_SET(block->pushed, r);
+}
+
+/* Select UBO words to push. Sysvals, in the last UBO, are pushed first, as
+ * pushing all of them lets the driver skip uploading the sysval UBO. The
+ * remaining budget goes to the ranges with the most estimated executed loads
+ * per pushed word, so a value read in a loop beats one read once. */
 
 static void
 bi_pick_ubo(struct panfrost_ubo_push *push, struct bi_ubo_analysis *analysis)
 {
-        for (signed ubo = analysis->nr_blocks - 1; ubo >= 0; --ubo) {
+        unsigned sysval_ubo = analysis->nr_blocks - 1;
+        struct bi_ubo_block *sysvals = &analysis->blocks[sysval_ubo];
+        struct util_dynarray candidates;
+
+        util_dynarray_init(&candidates, NULL);
+
+        for (unsigned r = 0; r < MAX_UBO_WORDS; ++r) {
+                /* Don't push something we don't access */
+                if (sysvals->range[r] == 0) continue;
+
+                /* Don't push more than possible */
+                if (push->count > PAN_MAX_PUSH - sysvals->range[r])
+                        break;
+
+                bi_push_range(push, sysvals, sysval_ubo, r);
+        }
+
+        for (unsigned ubo = 0; ubo < sysval_ubo; ++ubo) {
                 struct bi_ubo_block *block = &analysis->blocks[ubo];
 
                 for (unsigned r = 0; r < MAX_UBO_WORDS; ++r) {
-                        unsigned range = block->range[r];
+                        if (block->range[r] == 0) continue;
 
-                        /* Don't push something we don't access */
-                        if (range == 0) continue;
+                        struct bi_ubo_candidate c = {
+                                .ubo = ubo,
+                                .word = r,
+                                .range = block->range[r],
+                                .uses = block->uses[r],
+                        };
 
-                        /* Don't push more than possible */
-                        if (push->count > PAN_MAX_PUSH - range)
-                                return;
+                        util_dynarray_append(&candidates,
+                                             struct bi_ubo_candidate, c);
+                }
+        }
 
-                        for (unsigned offs = 0; offs < range; ++offs) {
-                                struct panfrost_ubo_word word = {
-                                        .ubo = ubo,
-                                        .offset = (r + offs) * 4
-                                };
+        qsort(candidates.data, util_dynarray_num_elements(&candidates,
+                                                          struct bi_ubo_candidate),
+              sizeof(struct bi_ubo_candidate), bi_compare_candidates);
 
-                                push->words[push->count++] = word;
-                        }
+        /* A range that doesn't fit may be followed by a smaller one that does */
+        util_dynarray_foreach(&candidates, struct bi_ubo_candidate, c) {
+                if (push->count > PAN_MAX_PUSH - c->range)
+                        continue;
 
-                        /* Mark it as pushed so we can rewrite */
-                        BITSET_SET(block->pushed, r);
-                }
+                bi_push_range(push, &analysis->blocks[c->ubo], c->ubo, c->word);
         }
+
+        util_dynarray_fini(&candidates);
 }
 
 void
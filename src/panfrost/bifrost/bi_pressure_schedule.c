@@ -24,9 +24,10 @@
  *      Alyssa Rosenzweig <alyssa.rosenzweig@collabora.com>
  */
 
-/* Bottom-up local scheduler to reduce register pressure */
+/* Bottom-up local schedulers to reduce register pressure and to hide latency */
 
 #include "compiler.h"
+#include "valhall/va_compiler.h"
 #include "util/dag.h"
 
 struct sched_ctx {
@@ -42,6 +43,15 @@ struct sched_node {
 
         /* Instruction this node represents */
         bi_instr *instr;
+
+        /* Latency scheduling only: the earliest time, counted in cycles from
+         * the end of the block, at which this instruction can be scheduled
+         * without stalling a consumer already scheduled */
+        unsigned ready;
+
+        /* Latency scheduling only: length of the longest latency-weighted
+         * chain of producers ending in this instruction */
+        unsigned depth;
 };
 
 static void
@@ -51,8 +61,23 @@ add_dep(struct sched_node *a, struct sched_node *b)
                 dag_add_edge(&a->dag, &b->dag, 0);
 }
 
+/* Data dependencies are tagged so the latency scheduler can tell them apart
+ * from ordering constraints */
+static void
+add_data_dep(struct sched_node *a, struct sched_node *b)
+{
+        if (a && b)
+                dag_add_edge_max_data(&a->dag, &b->dag, 1);
+}
+
+/*
+ * Build the dependency graph of a block. If nodes is non-NULL, it is filled
+ * with the nodes in program order, and the number of nodes is returned in
+ * nr_nodes.
+ */
 static struct dag *
-create_dag(bi_context *ctx, bi_block *block, void *memctx)
+create_dag(bi_context *ctx, bi_block *block, void *memctx,
+           struct sched_node **nodes, unsigned *nr_nodes)
 {
         struct dag *dag = dag_create(ctx);
 
@@ -67,6 +92,8 @@ create_dag(bi_context *ctx, bi_block *block, void *memctx)
         /* Last memory store, to serialize loads and stores against */
         struct sched_node *memory_store = NULL;
 
+        unsigned count = 0;
+
         bi_foreach_instr_in_block(block, I) {
                 /* Leave branches at the end */
                 if (I->op == BI_OPCODE_JUMP || bi_opcode_props[I->op].branch)
@@ -78,9 +105,14 @@ create_dag(bi_context *ctx, bi_block *block, void *memctx)
                 node->instr = I;
                 dag_init_node(dag, &node->dag);
 
+                if (nodes)
+                        nodes[count] = node;
+
+                count++;
+
                 /* Reads depend on writes, no other hazards in SSA */
                 bi_foreach_ssa_src(I, s)
-                        add_dep(node, last_write[I->src[s].value]);
+                        add_data_dep(node, last_write[I->src[s].value]);
 
                 bi_foreach_dest(I, d)
                         last_write[I->dest[d].value] = node;
@@ -168,6 +200,9 @@ create_dag(bi_context *ctx, bi_block *block, void *memctx)
 
         free(last_write);
 
+        if (nr_nodes)
+                *nr_nodes = count;
+
         return dag;
 }
 
@@ -291,7 +326,7 @@ bi_pressure_schedule(bi_context *ctx)
 
         bi_foreach_block(ctx, block) {
                 struct sched_ctx sctx = {
-                        .dag = create_dag(ctx, block, memctx),
+                        .dag = create_dag(ctx, block, memctx, NULL, NULL),
                         .live = live
                 };
 
@@ -300,3 +335,204 @@ bi_pressure_schedule(bi_context *ctx)
 
         ralloc_free(memctx);
 }
+
+/*
+ * Latency scheduling for Valhall. Valhall has no clauses to hide the latency
+ * of message-passing instructions, so a consumer scheduled right after a
+ * texture or memory load stalls the warp at the wait until the message
+ * returns. Scheduling bottom-up, we track for each instruction the time at
+ * which its results are needed and prefer instructions that have had time to
+ * finish, pushing independent arithmetic in between messages and their uses.
+ * Waits end up as late as possible, where va_merge_flow can fold them into
+ * existing instructions.
+ *
+ * Hiding latency extends live ranges, which reduces occupancy if it pushes
+ * the shader above 32 registers. The pressure of the original order is an
+ * acceptable limit, and so is 32 registers, below which occupancy does not
+ * change.
+ */
+#define LATENCY_SCHED_MIN_REGS 32
+
+struct latency_ctx {
+        struct dag *dag;
+        BITSET_WORD *live;
+
+        /* Current time, counted in cycles from the end of the block */
+        unsigned time;
+
+        /* Register pressure of the live set, and the limit we can't exceed */
+        signed pressure, max_pressure, limit;
+};
+
+static void
+latency_calculate_depth(struct dag_node *dag_node, void *data)
+{
+        struct sched_node *node = (struct sched_node *) dag_node;
+        unsigned depth = 0;
+
+        util_dynarray_foreach(&node->dag.edges, struct dag_edge, edge) {
+                struct sched_node *child = (struct sched_node *) edge->child;
+                depth = MAX2(depth, child->depth);
+        }
+
+        node->depth = depth + va_instr_latency(node->instr);
+}
+
+/* Advance the clock past a node scheduled now, and update the ready times of
+ * the instructions producing its sources */
+static void
+latency_issue(struct sched_node *node, unsigned *time)
+{
+        *time = MAX2(*time, node->ready);
+
+        util_dynarray_foreach(&node->dag.edges, struct dag_edge, edge) {
+                struct sched_node *child = (struct sched_node *) edge->child;
+                unsigned ready = *time;
+
+                if (edge->data)
+                        ready += va_instr_latency(child->instr);
+
+                child->ready = MAX2(child->ready, ready);
+        }
+
+        (*time)++;
+}
+
+/*
+ * Choose the next instruction, bottom-up. Among the instructions that fit in
+ * the register limit, prefer those that can issue without a stall, then
+ * those on the longest path to the start of the block. If nothing fits,
+ * minimize pressure instead.
+ */
+static struct sched_node *
+latency_choose_instr(struct latency_ctx *s)
+{
+        struct sched_node *best = NULL, *min_pressure = NULL;
+        bool best_ready = false;
+        signed min_delta = INT32_MAX;
+
+        list_for_each_entry(struct sched_node, n, &s->dag->heads, dag.link) {
+                signed delta = calculate_pressure_delta(n->instr, s->live);
+
+                if (delta < min_delta) {
+                        min_pressure = n;
+                        min_delta = delta;
+                }
+
+                if (s->pressure + delta > s->limit)
+                        continue;
+
+                bool ready = n->ready <= s->time;
+
+                if (!best || (ready && !best_ready) ||
+                    (ready == best_ready &&
+                     (ready ? n->depth > best->depth :
+                              n->ready < best->ready))) {
+                        best = n;
+                        best_ready = ready;
+                }
+        }
+
+        return best ?: min_pressure;
+}
+
+static void
+latency_schedule_block(bi_context *ctx, bi_block *block, BITSET_WORD *live,
+                       const unsigned *sizes, void *memctx)
+{
+        unsigned nr_ins = 0;
+
+        bi_foreach_instr_in_block(block, I)
+                nr_ins++;
+
+        struct sched_node **nodes = calloc(nr_ins, sizeof(struct sched_node *));
+        unsigned nr_nodes = 0;
+        struct dag *dag = create_dag(ctx, block, memctx, nodes, &nr_nodes);
+
+        /* Register pressure at the end of the block */
+        signed live_out = 0;
+        unsigned i;
+
+        BITSET_FOREACH_SET(i, block->ssa_live_out, ctx->ssa_alloc)
+                live_out += sizes[i];
+
+        /* Cost of the original order, simulated bottom-up */
+        memcpy(live, block->ssa_live_out, BITSET_WORDS(ctx->ssa_alloc) * sizeof(BITSET_WORD));
+
+        signed pressure = live_out, orig_max_pressure = live_out;
+        unsigned orig_time = 0;
+
+        bi_foreach_instr_in_block_rev(block, I) {
+                pressure += calculate_pressure_delta(I, live);
+                orig_max_pressure = MAX2(pressure, orig_max_pressure);
+                bi_liveness_ins_update_ssa(live, I);
+        }
+
+        for (signed n = nr_nodes - 1; n >= 0; --n)
+                latency_issue(nodes[n], &orig_time);
+
+        for (unsigned n = 0; n < nr_nodes; ++n)
+                nodes[n]->ready = 0;
+
+        dag_traverse_bottom_up(dag, latency_calculate_depth, NULL);
+
+        /* Schedule */
+        memcpy(live, block->ssa_live_out, BITSET_WORDS(ctx->ssa_alloc) * sizeof(BITSET_WORD));
+
+        struct latency_ctx s = {
+                .dag = dag,
+                .live = live,
+                .pressure = live_out,
+                .max_pressure = live_out,
+                .limit = MAX2(orig_max_pressure, LATENCY_SCHED_MIN_REGS),
+        };
+
+        struct sched_node **schedule = calloc(nr_nodes, sizeof(struct sched_node *));
+        unsigned nr_scheduled = 0;
+
+        while (!list_is_empty(&dag->heads)) {
+                struct sched_node *node = latency_choose_instr(&s);
+                s.pressure += calculate_pressure_delta(node->instr, live);
+                s.max_pressure = MAX2(s.pressure, s.max_pressure);
+                latency_issue(node, &s.time);
+                dag_prune_head(dag, &node->dag);
+
+                schedule[nr_scheduled++] = node;
+                bi_liveness_ins_update_ssa(live, node->instr);
+        }
+
+        /* Bail if we'd lose occupancy or it doesn't look faster */
+        if (s.max_pressure > s.limit || s.time >= orig_time) {
+                free(schedule);
+                free(nodes);
+                return;
+        }
+
+        /* Apply the schedule */
+        for (unsigned n = 0; n < nr_scheduled; ++n) {
+                bi_remove_instruction(schedule[n]->instr);
+                list_add(&schedule[n]->instr->link, &block->instructions);
+        }
+
+        free(schedule);
+        free(nodes);
+}
+
+void
+bi_latency_schedule(bi_context *ctx)
+{
+        bi_compute_liveness_ssa(ctx);
+        void *memctx = ralloc_context(ctx);
+        BITSET_WORD *live = ralloc_array(memctx, BITSET_WORD, BITSET_WORDS(ctx->ssa_alloc));
+        unsigned *sizes = rzalloc_array(memctx, unsigned, ctx->ssa_alloc);
+
+        bi_foreach_instr_global(ctx, I) {
+                bi_foreach_dest(I, d)
+                        sizes[I->dest[d].value] = bi_count_write_registers(I, d);
+        }
+
+        bi_foreach_block(ctx, block)
+                latency_schedule_block(ctx, block, live, sizes, memctx);
+
+        ralloc_free(memctx);
+}
@@ -25,186 +25,10 @@
  */
 
 #include "compiler.h"
-#include "nodearray.h"
+#include "bi_lcra.h"
 #include "bi_builder.h"
 #include "util/u_memory.h"
 
-struct lcra_state {
-        unsigned node_count;
-        uint64_t *affinity;
-
-        /* Linear constraints imposed. For each node there there is a
-         * 'nodearray' structure, which changes between a sparse and dense
-         * array depending on the number of elements.
-         *
-         * Each element is itself a bit field denoting whether (c_j - c_i) bias
-         * is present or not, including negative biases.
-         *
-         * We support up to 8 components so the bias is in range
-         * [-7, 7] encoded by a 16-bit field
-         */
-        nodearray *linear;
-
-        /* Before solving, forced registers; after solving, solutions. */
-        unsigned *solutions;
-
-        /** Node which caused register allocation to fail */
-        unsigned spill_node;
-};
-
-/* This module is an implementation of "Linearly Constrained
- * Register Allocation". The paper is available in PDF form
- * (https://people.collabora.com/~alyssa/LCRA.pdf) as well as Markdown+LaTeX
- * (https://gitlab.freedesktop.org/alyssa/lcra/blob/master/LCRA.md)
- */
-
-static struct lcra_state *
-lcra_alloc_equations(unsigned node_count)
-{
-        struct lcra_state *l = calloc(1, sizeof(*l));
-
-        l->node_count = node_count;
-
-        l->linear = calloc(sizeof(l->linear[0]), node_count);
-        l->solutions = calloc(sizeof(l->solutions[0]), node_count);
-        l->affinity = calloc(sizeof(l->affinity[0]), node_count);
-
-        memset(l->solutions, ~0, sizeof(l->solutions[0]) * node_count);
-
-        return l;
-}
-
-static void
-lcra_free(struct lcra_state *l)
-{
-        for (unsigned i = 0; i < l->node_count; ++i)
-                nodearray_reset(&l->linear[i]);
-
-        free(l->linear);
-        free(l->affinity);
-        free(l->solutions);
-        free(l);
-}
-
-static void
-lcra_add_node_interference(struct lcra_state *l, unsigned i, unsigned cmask_i, unsigned j, unsigned cmask_j)
-{
-        if (i == j)
-                return;
-
-        nodearray_value constraint_fw = 0;
-        nodearray_value constraint_bw = 0;
-
-        /* The constraint bits are reversed from lcra.c so that register
-         * allocation can be done in parallel for every possible solution,
-         * with lower-order bits representing smaller registers. */
-
-        for (unsigned D = 0; D < 8; ++D) {
-                if (cmask_i & (cmask_j << D)) {
-                        constraint_fw |= (1 << (7 + D));
-                        constraint_bw |= (1 << (7 - D));
-                }
-
-                if (cmask_i & (cmask_j >> D)) {
-                        constraint_bw |= (1 << (7 + D));
-                        constraint_fw |= (1 << (7 - D));
-                }
-        }
-
-        /* Use dense arrays after adding 256 elements */
-        nodearray_orr(&l->linear[j], i, constraint_fw, 256, l->node_count);
-        nodearray_orr(&l->linear[i], j, constraint_bw, 256, l->node_count);
-}
-
-static bool
-lcra_test_linear(struct lcra_state *l, unsigned *solutions, unsigned i)
-{
-        signed constant = solutions[i];
-
-        if (nodearray_is_sparse(&l->linear[i])) {
-                nodearray_sparse_foreach(&l->linear[i], elem) {
-                        unsigned j = nodearray_sparse_key(elem);
-                        nodearray_value constraint = nodearray_sparse_value(elem);
-
-                        if (solutions[j] == ~0) continue;
-
-                        signed lhs = constant - solutions[j];
-
-                        if (lhs < -7 || lhs > 7)
-                                continue;
-
-                        if (constraint & (1 << (lhs + 7)))
-                                return false;
-                }
-
-                return true;
-        }
-
-        nodearray_value *row = l->linear[i].dense;
-
-        for (unsigned j = 0; j < l->node_count; ++j) {
-                if (solutions[j] == ~0) continue;
-
-                signed lhs = constant - solutions[j];
-
-                if (lhs < -7 || lhs > 7)
-                        continue;
-
-                if (row[j] & (1 << (lhs + 7)))
-                        return false;
-        }
-
-        return true;
-}
-
-static bool
-lcra_solve(struct lcra_state *l)
-{
-        for (unsigned step = 0; step < l->node_count; ++step) {
-                if (l->solutions[step] != ~0) continue;
-                if (l->affinity[step] == 0) continue;
-
-                bool succ = false;
-
-                u_foreach_bit64(r, l->affinity[step]) {
-                        l->solutions[step] = r;
-
-                        if (lcra_test_linear(l, l->solutions, step)) {
-                                succ = true;
-                                break;
-                        }
-                }
-
-                /* Out of registers - prepare to spill */
-                if (!succ) {
-                        l->spill_node = step;
-                        return false;
-                }
-        }
-
-        return true;
-}
-
-/* Register spilling is implemented with a cost-benefit system. Costs are set
- * by the user. Benefits are calculated from the constraints. */
-
-static unsigned
-lcra_count_constraints(struct lcra_state *l, unsigned i)
-{
-        unsigned count = 0;
-        nodearray *constraints = &l->linear[i];
-
-        if (nodearray_is_sparse(constraints)) {
-                nodearray_sparse_foreach(constraints, elem)
-                        count += util_bitcount(nodearray_sparse_value(elem));
-        } else {
-                nodearray_dense_foreach_64(constraints, elem)
-                        count += util_bitcount64(*elem);
-        }
-
-        return count;
-}
-
 /* Liveness analysis is a backwards-may dataflow analysis pass. Within a block,
  * we compute live_out from live_in. The intrablock pass is linear-time. It
  * returns whether progress was made. */
@@ -600,33 +424,189 @@ bi_rewrite_index_src_single(bi_instr *ins, bi_index old, bi_index new)
         }
 }
 
-/* If register allocation fails, find the best spill node */
+/*
+ * Spilling inside loops is much more expensive than spilling outside, since
+ * the fills and stores execute on every iteration. Weight each access by its
+ * loop nesting depth, estimating 8 iterations per loop. Blocks are in source
+ * order, so a back edge from block e to block h encloses blocks h to e.
+ */
+unsigned *
+bi_compute_loop_depth(bi_context *ctx)
+{
+        unsigned *depth = calloc(ctx->num_blocks, sizeof(unsigned));
+
+        bi_foreach_block(ctx, block) {
+                bi_foreach_successor(block, succ) {
+                        if (succ->index > block->index)
+                                continue;
+
+                        for (unsigned i = succ->index; i <= block->index; ++i)
+                                depth[i]++;
+                }
+        }
+
+        return depth;
+}
+
+static unsigned
+bi_spill_weight(unsigned loop_depth)
+{
+        return 1 << (3 * MIN2(loop_depth, 4));
+}
+
+/*
+ * Values that are trivially recomputable are rematerialized rather than
+ * spilled: instead of storing the value to thread-local storage and loading
+ * it back, the defining instruction is duplicated before each use. That
+ * applies to moves of constants and FAU (uniforms, special values) and to
+ * arithmetic on them, like address computations on push constants.
+ */
+static bool
+bi_is_remat_source(bi_index src)
+{
+        switch (src.type) {
+        case BI_INDEX_NULL:
+        case BI_INDEX_CONSTANT:
+                return true;
+        case BI_INDEX_FAU:
+                return src.value != BIR_FAU_PROGRAM_COUNTER;
+        default:
+                return false;
+        }
+}
+
+bool
+bi_can_remat(const bi_instr *I)
+{
+        if (I->nr_dests != 1 || I->dest[0].offset != 0)
+                return false;
+
+        if (bi_opcode_props[I->op].message || bi_opcode_props[I->op].branch)
+                return false;
+
+        bi_foreach_src(I, s) {
+                if (!bi_is_remat_source(I->src[s]))
+                        return false;
+        }
+
+        return true;
+}
+
+/* Marks a node written more than once, which we can't rematerialize */
+#define BI_REMAT_MULTIPLE ((bi_instr *) 1)
+
+/*
+ * For each node, the instruction to duplicate to rematerialize it, or NULL if
+ * the node isn't written exactly once by an instruction we can duplicate.
+ */
+bi_instr **
+bi_find_remat_defs(bi_context *ctx, unsigned node_count)
+{
+        bi_instr **defs = calloc(node_count, sizeof(bi_instr *));
+
+        bi_foreach_instr_global(ctx, ins) {
+                bi_foreach_dest(ins, d) {
+                        unsigned node = ins->dest[d].value;
+
+                        if (node >= node_count)
+                                continue;
+
+                        defs[node] = (defs[node] || !bi_can_remat(ins)) ?
+                                     BI_REMAT_MULTIPLE : ins;
+                }
+        }
+
+        for (unsigned i = 0; i < node_count; ++i) {
+                if (defs[i] == BI_REMAT_MULTIPLE)
+                        defs[i] = NULL;
+        }
+
+        return defs;
+}
+
+struct bi_spill_choice {
+        signed node;
+        unsigned benefit, cost;
+        bool remat;
+};
+
+/*
+ * Consider spilling a node interfering with the node that failed register
+ * allocation. Rematerialization is preferred to spilling, and otherwise we
+ * pick the best ratio of constraints removed to loop-weighted accesses.
+ */
+static void
+bi_consider_spill_node(struct bi_spill_choice *best, struct lcra_state *l,
+                       unsigned i, unsigned cost, bool remat)
+{
+        unsigned benefit = lcra_count_constraints(l, i);
+
+        if (!benefit || (best->remat && !remat))
+                return;
+
+        cost = MAX2(cost, 1);
+
+        if (best->node >= 0 && remat == best->remat &&
+            ((uint64_t) benefit * best->cost) <=
+            ((uint64_t) best->benefit * cost))
+                return;
+
+        *best = (struct bi_spill_choice) {
+                .node = i,
+                .benefit = benefit,
+                .cost = cost,
+                .remat = remat,
+        };
+}
+
+/* If register allocation fails, find the best spill node. If it can be
+ * rematerialized, its definition is returned in remat. Its loop-weighted
+ * number of accesses is returned in cost. */
 
 static signed
-bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
+bi_choose_spill_node(bi_context *ctx, struct lcra_state *l, bi_instr **remat,
+                     unsigned *cost_out)
 {
         /* Pick a node satisfying bi_spill_register's preconditions */
         BITSET_WORD *no_spill = calloc(sizeof(BITSET_WORD), BITSET_WORDS(l->node_count));
+        unsigned *cost = calloc(l->node_count, sizeof(unsigned));
+        bi_instr **defs = bi_find_remat_defs(ctx, l->node_count);
+        unsigned *loop_depth = bi_compute_loop_depth(ctx);
 
-        bi_foreach_instr_global(ctx, ins) {
-                bi_foreach_dest(ins, d) {
-                        /* Don't allow spilling coverage mask writes because the
-                         * register preload logic assumes it will stay in R60.
-                         * This could be optimized.
-                         */
-                        if (ins->no_spill ||
-                            ins->op == BI_OPCODE_ATEST ||
-                            ins->op == BI_OPCODE_ZS_EMIT ||
-                            (ins->op == BI_OPCODE_MOV_I32 &&
-                             ins->src[0].type == BI_INDEX_REGISTER &&
-                             ins->src[0].value == 60)) {
-                                BITSET_SET(no_spill, ins->dest[d].value);
+        bi_foreach_block(ctx, block) {
+                unsigned weight = bi_spill_weight(loop_depth[block->index]);
+
+                bi_foreach_instr_in_block(block, ins) {
+                        bi_foreach_dest(ins, d) {
+                                unsigned node = ins->dest[d].value;
+
+                                /* Don't allow spilling coverage mask writes because the
+                                 * register preload logic assumes it will stay in R60.
+                                 * This could be optimized.
+                                 */
+                                if (ins->no_spill ||
+                                    ins->op == BI_OPCODE_ATEST ||
+                                    ins->op == BI_OPCODE_ZS_EMIT ||
+                                    (ins->op == BI_OPCODE_MOV_I32 &&
+                                     ins->src[0].type == BI_INDEX_REGISTER &&
+                                     ins->src[0].value == 60)) {
+                                        BITSET_SET(no_spill, node);
+                                }
+
+                                if (node >= l->node_count)
+                                        continue;
+
+                                cost[node] += weight;
+                        }
+
+                        bi_foreach_ssa_src(ins, s) {
+                                if (ins->src[s].value < l->node_count)
+                                        cost[ins->src[s].value] += weight;
                         }
                 }
         }
 
-        unsigned best_benefit = 0.0;
-        signed best_node = -1;
+        struct bi_spill_choice best = { .node = -1 };
 
         if (nodearray_is_sparse(&l->linear[l->spill_node])) {
                 nodearray_sparse_foreach(&l->linear[l->spill_node], elem) {
@@ -639,12 +619,8 @@ bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
 
                         if (BITSET_TEST(no_spill, i)) continue;
 
-                        unsigned benefit = lcra_count_constraints(l, i);
-
-                        if (benefit > best_benefit) {
-                                best_benefit = benefit;
-                                best_node = i;
-                        }
+                        bi_consider_spill_node(&best, l, i, cost[i],
+                                               defs[i] != NULL);
                 }
         } else {
                 nodearray_value *row = l->linear[l->spill_node].dense;
@@ -656,17 +632,19 @@ bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
 
                         if (BITSET_TEST(no_spill, i)) continue;
 
-                        unsigned benefit = lcra_count_constraints(l, i);
-
-                        if (benefit > best_benefit) {
-                                best_benefit = benefit;
-                                best_node = i;
-                        }
+                        bi_consider_spill_node(&best, l, i, cost[i],
+                                               defs[i] != NULL);
                 }
         }
 
+        *remat = (best.node >= 0 && best.remat) ? defs[best.node] : NULL;
+        *cost_out = best.cost;
+
         free(no_spill);
-        return best_node;
+        free(cost);
+        free(defs);
+        free(loop_depth);
+        return best.node;
 }
 
 static unsigned
@@ -762,6 +740,48 @@ bi_spill_register(bi_context *ctx, bi_index index, uint32_t offset)
         return (channels * 4);
 }
 
+static bi_instr *
+bi_clone_instr(bi_context *ctx, const bi_instr *I)
+{
+        size_t size = sizeof(bi_instr) +
+                      sizeof(bi_index) * (I->nr_dests + I->nr_srcs);
+        bi_instr *clone = (bi_instr *) linear_alloc_child(ctx->linear_ctx, size);
+
+        memcpy(clone, I, sizeof(bi_instr));
+        clone->dest = (bi_index *) &clone[1];
+        clone->src = clone->dest + I->nr_dests;
+        memcpy(clone->dest, I->dest, sizeof(bi_index) * I->nr_dests);
+        memcpy(clone->src, I->src, sizeof(bi_index) * I->nr_srcs);
+
+        return clone;
+}
+
+/* Rematerialize a node by recomputing it before every use. The copies are
+ * not themselves candidates, so this makes progress. */
+
+static void
+bi_remat_register(bi_context *ctx, bi_index index, bi_instr *def)
+{
+        bi_builder b = { .shader = ctx };
+
+        bi_foreach_instr_global_safe(ctx, I) {
+                if (I == def || !bi_has_arg(I, index)) continue;
+
+                b.cursor = bi_before_instr(I);
+                bi_index tmp = bi_temp(ctx);
+
+                bi_instr *remat = bi_clone_instr(ctx, def);
+                remat->dest[0] = bi_replace_index(def->dest[0], tmp);
+                remat->no_spill = true;
+                bi_builder_insert(&b.cursor, remat);
+
+                bi_rewrite_index_src_single(I, index, tmp);
+                ctx->remats++;
+        }
+
+        bi_remove_instruction(def);
+}
+
 /*
  * For transition, lower collects and splits before RA, rather than after RA.
  * LCRA knows how to deal with offsets (broken SSA), but not how to coalesce
@@ -1054,6 +1074,133 @@ bi_out_of_ssa(bi_context *ctx)
         return first_reg;
 }
 
+/*
+ * Shaders using at most 32 registers run with twice as many threads, which
+ * hides the latency of message-passing instructions. It is worth a little
+ * spilling to stay under that limit if the shader has enough messages for
+ * occupancy to matter, since the spill traffic is itself latency that the
+ * extra threads hide. As a rough model, allow one loop-weighted spill or fill
+ * for every four messages.
+ */
+static unsigned
+bi_occupancy_spill_budget(bi_context *ctx)
+{
+        unsigned *loop_depth = bi_compute_loop_depth(ctx);
+        unsigned messages = 0;
+
+        bi_foreach_block(ctx, block) {
+                unsigned weight = bi_spill_weight(loop_depth[block->index]);
+
+                bi_foreach_instr_in_block(block, I) {
+                        if (bi_opcode_props[I->op].message)
+                                messages += weight;
+                }
+        }
+
+        free(loop_depth);
+        return messages / 4;
+}
+
+/* Saved instructions, to undo spilling if we give up on 32 registers */
+
+struct bi_ra_snapshot {
+        struct list_head *instructions;
+        unsigned spills, fills, remats;
+};
+
+static void
+bi_save_shader(bi_context *ctx, struct bi_ra_snapshot *snap, void *memctx)
+{
+        snap->instructions = ralloc_array(memctx, struct list_head,
+                                          ctx->num_blocks);
+        snap->spills = ctx->spills;
+        snap->fills = ctx->fills;
+        snap->remats = ctx->remats;
+
+        bi_foreach_block(ctx, block) {
+                struct list_head *list = &snap->instructions[block->index];
+                list_inithead(list);
+
+                bi_foreach_instr_in_block(block, I)
+                        list_addtail(&bi_clone_instr(ctx, I)->link, list);
+        }
+}
+
+static void
+bi_restore_shader(bi_context *ctx, struct bi_ra_snapshot *snap)
+{
+        bi_foreach_block(ctx, block) {
+                list_replace(&snap->instructions[block->index],
+                             &block->instructions);
+        }
+
+        ctx->spills = snap->spills;
+        ctx->fills = snap->fills;
+        ctx->remats = snap->remats;
+}
+
+/*
+ * Try to allocate within 32 registers, rematerializing freely and spilling
+ * within the budget. On failure, the shader is left unchanged.
+ */
+struct lcra_state *
+bi_allocate_for_occupancy(bi_context *ctx, unsigned *spill_count)
+{
+        struct bi_ra_snapshot snap = { NULL };
+        void *memctx = ralloc_context(NULL);
+        unsigned budget = bi_occupancy_spill_budget(ctx);
+        unsigned spent = 0, count = *spill_count;
+        struct lcra_state *l = NULL;
+
+        for (unsigned iter = 0; iter < 32; ++iter) {
+                bool success = false;
+                l = bi_allocate_registers(ctx, &success, false);
+
+                if (success) {
+                        *spill_count = count;
+                        ralloc_free(memctx);
+                        return l;
+                }
+
+                bi_instr *remat = NULL;
+                unsigned cost = 0;
+                signed spill_node = bi_choose_spill_node(ctx, l, &remat, &cost);
+                lcra_free(l);
+                l = NULL;
+
+                if (spill_node == -1)
+                        break;
+
+                if (!remat) {
+                        spent += cost;
+
+                        if (ctx->inputs->is_blend || spent > budget)
+                                break;
+                }
+
+                if (!snap.instructions)
+                        bi_save_shader(ctx, &snap, memctx);
+
+                if (remat) {
+                        bi_remat_register(ctx, bi_get_index(spill_node), remat);
+                } else {
+                        if (ctx->arch >= 9)
+                                count = ALIGN_POT(count, 16);
+
+                        count += bi_spill_register(ctx, bi_get_index(spill_node),
+                                                   count);
+                }
+
+                bi_coalesce_tied(ctx);
+        }
+
+        if (snap.instructions)
+                bi_restore_shader(ctx, &snap);
+
+        ralloc_free(memctx);
+        return NULL;
+}
+
 void
 bi_register_allocate(bi_context *ctx)
 {
@@ -1076,14 +1223,11 @@ bi_register_allocate(bi_context *ctx)
 
         /* Try with reduced register pressure to improve thread count */
         if (ctx->arch >= 7) {
-                l = bi_allocate_registers(ctx, &success, false);
+                l = bi_allocate_for_occupancy(ctx, &spill_count);
+                success = (l != NULL);
 
-                if (success) {
+                if (success)
                         ctx->info.work_reg_count = 32;
-                } else {
-                        lcra_free(l);
-                        l = NULL;
-                }
         }
 
         /* Otherwise, use the register file and spill until we succeed */
@@ -1093,26 +1237,33 @@ bi_register_allocate(bi_context *ctx)
                 if (success) {
                         ctx->info.work_reg_count = 64;
                 } else {
-                        signed spill_node = bi_choose_spill_node(ctx, l);
+                        bi_instr *remat = NULL;
+                        unsigned cost = 0;
+                        signed spill_node = bi_choose_spill_node(ctx, l, &remat, &cost);
                         lcra_free(l);
                         l = NULL;
 
                         if (spill_node == -1)
                                 unreachable("Failed to choose spill node\n");
 
-                        if (ctx->inputs->is_blend)
-                                unreachable("Blend shaders may not spill");
-
-                        /* By default, we use packed TLS addressing on Valhall.
-                         * We cannot cross 16 byte boundaries with packed TLS
-                         * addressing. Align to ensure this doesn't happen. This
-                         * could be optimized a bit.
-                         */
-                        if (ctx->arch >= 9)
-                                spill_count = ALIGN_POT(spill_count, 16);
+                        if (remat) {
+                                bi_remat_register(ctx, bi_get_index(spill_node),
+                                                  remat);
+                        } else {
+                                if (ctx->inputs->is_blend)
+                                        unreachable("Blend shaders may not spill");
+
+                                /* By default, we use packed TLS addressing on Valhall.
+                                 * We cannot cross 16 byte boundaries with packed TLS
+                                 * addressing. Align to ensure this doesn't happen. This
+                                 * could be optimized a bit.
+                                 */
+                                if (ctx->arch >= 9)
+                                        spill_count = ALIGN_POT(spill_count, 16);
 
-                        spill_count += bi_spill_register(ctx,
-                                        bi_get_index(spill_node), spill_count);
+                                spill_count += bi_spill_register(ctx,
+                                                bi_get_index(spill_node), spill_count);
+                        }
 
                         /* In case the spill affected an instruction with tied
                          * operands, we need to fix up.
@@ -45,6 +45,11 @@ struct bi_worklist {
          * scheduled before (after) this instruction. */
         unsigned *dep_counts;
         BITSET_WORD **dependents;
+
+        /* Estimated cycles from the start of the block until each
+         * instruction completes, along its longest dependency chain. Only
+         * allocated when scheduling along the critical path */
+        unsigned *depth;
 };
 
 /* State of a single tuple and clause under construction */
@@ -160,6 +165,31 @@ bi_message_type_for_instr(bi_instr *ins)
         return msg;
 }
 
+/* Rough latency estimates for the critical path model. Arithmetic completes
+ * within the tuple, while messages go out to the shared units. Texturing and
+ * memory accesses are the slowest, especially on a cache miss. */
+
+static unsigned
+bi_latency_for_instr(bi_instr *ins)
+{
+        switch (bi_message_type_for_instr(ins)) {
+        case BIFROST_MESSAGE_NONE:
+                return 1;
+        case BIFROST_MESSAGE_TEX:
+        case BIFROST_MESSAGE_VARTEX:
+        case BIFROST_MESSAGE_LOAD:
+        case BIFROST_MESSAGE_ATOMIC:
+                return 16;
+        case BIFROST_MESSAGE_VARYING:
+        case BIFROST_MESSAGE_ATTRIBUTE:
+        case BIFROST_MESSAGE_TILE:
+        case BIFROST_MESSAGE_Z_STENCIL:
+                return 8;
+        default:
+                return 4;
+        }
+}
+
 /* Attribute, texture, and UBO load (attribute message) instructions support
  * bindless, so just check the message type */
 
@@ -188,20 +218,50 @@ bi_push_dependency(unsigned parent, unsigned child,
         }
 }
 
+/* Instructions that read or wrote each register, as lists threaded through a
+ * single packed array rather than one allocation per register */
+
+struct bi_access {
+        unsigned ins;
+        unsigned next;
+};
+
+struct bi_access_table {
+        unsigned head[64];
+        struct util_dynarray accesses;
+};
+
+static void
+bi_init_access_table(struct bi_access_table *table)
+{
+        memset(table->head, ~0, sizeof(table->head));
+        util_dynarray_init(&table->accesses, NULL);
+}
+
 static void
-add_dependency(struct util_dynarray *table, unsigned index, unsigned child,
+add_dependency(struct bi_access_table *table, unsigned index, unsigned child,
                 BITSET_WORD **dependents, unsigned *dep_counts)
 {
         assert(index < 64);
-        util_dynarray_foreach(table + index, unsigned, parent)
-                bi_push_dependency(*parent, child, dependents, dep_counts);
+        struct bi_access *accesses = table->accesses.data;
+
+        for (unsigned a = table->head[index]; a != ~0; a = accesses[a].next)
+                bi_push_dependency(accesses[a].ins, child, dependents, dep_counts);
 }
 
 static void
-mark_access(struct util_dynarray *table, unsigned index, unsigned parent)
+mark_access(struct bi_access_table *table, unsigned index, unsigned parent)
 {
         assert(index < 64);
-        util_dynarray_append(&table[index], unsigned, parent);
+        unsigned a = util_dynarray_num_elements(&table->accesses, struct bi_access);
+
+        util_dynarray_append(&table->accesses, struct bi_access,
+                             ((struct bi_access) {
+                                     .ins = parent,
+                                     .next = table->head[index],
+                             }));
+
+        table->head[index] = a;
 }
 
 static bool
@@ -219,18 +279,20 @@ bi_is_sched_barrier(bi_instr *I)
 static void
 bi_create_dependency_graph(struct bi_worklist st, bool inorder, bool is_blend)
 {
-        struct util_dynarray last_read[64], last_write[64];
+        struct bi_access_table read_table, write_table;
+        struct bi_access_table *last_read = &read_table;
+        struct bi_access_table *last_write = &write_table;
 
-        for (unsigned i = 0; i < 64; ++i) {
-                util_dynarray_init(&last_read[i], NULL);
-                util_dynarray_init(&last_write[i], NULL);
-        }
+        bi_init_access_table(last_read);
+        bi_init_access_table(last_write);
 
-        /* Initialize dependency graph */
-        for (unsigned i = 0; i < st.count; ++i) {
-                st.dependents[i] =
-                        calloc(BITSET_WORDS(st.count), sizeof(BITSET_WORD));
+        /* Initialize dependency graph. The bitsets are rows of one matrix,
+         * owned by dependents[0]. */
+        unsigned words = BITSET_WORDS(st.count);
+        BITSET_WORD *matrix = calloc(st.count * words, sizeof(BITSET_WORD));
 
+        for (unsigned i = 0; i < st.count; ++i) {
+                st.dependents[i] = matrix + (i * words);
                 st.dep_counts[i] = 0;
         }
 
@@ -313,10 +375,8 @@ bi_create_dependency_graph(struct bi_worklist st, bool inorder, bool is_blend)
         }
 
         /* Free the intermediate structures */
-        for (unsigned i = 0; i < 64; ++i) {
-                util_dynarray_fini(&last_read[i]);
-                util_dynarray_fini(&last_write[i]);
-        }
+        util_dynarray_fini(&last_read->accesses);
+        util_dynarray_fini(&last_write->accesses);
 }
 
 /* Scheduler pseudoinstruction lowerings to enable instruction pairings.
@@ -449,8 +509,25 @@ bi_flatten_block(bi_block *block, unsigned *len)
  * debug, force in-order scheduling (no dependency graph is constructed).
  */
 
+/* Compute the depth of each instruction. Dependencies always point to
+ * earlier instructions, so a single forward pass suffices. */
+
+static void
+bi_calculate_depths(struct bi_worklist st)
+{
+        for (unsigned i = 0; i < st.count; ++i) {
+                unsigned j, max_pred = 0;
+
+                BITSET_FOREACH_SET(j, st.dependents[i], i)
+                        max_pred = MAX2(max_pred, st.depth[j]);
+
+                st.depth[i] = max_pred + bi_latency_for_instr(st.instructions[i]);
+        }
+}
+
 static struct bi_worklist
-bi_initialize_worklist(bi_block *block, bool inorder, bool is_blend)
+bi_initialize_worklist(bi_block *block, bool inorder, bool is_blend,
+                       bool critical_path)
 {
         struct bi_worklist st = { };
         st.instructions = bi_flatten_block(block, &st.count);
@@ -464,6 +541,11 @@ bi_initialize_worklist(bi_block *block, bool inorder, bool is_blend)
         bi_create_dependency_graph(st, inorder, is_blend);
         st.worklist = calloc(BITSET_WORDS(st.count), sizeof(BITSET_WORD));
 
+        if (critical_path) {
+                st.depth = calloc(st.count, sizeof(st.depth[0]));
+                bi_calculate_depths(st);
+        }
+
         for (unsigned i = 0; i < st.count; ++i) {
                 if (st.dep_counts[i] == 0)
                         BITSET_SET(st.worklist, i);
@@ -476,7 +558,12 @@ static void
 bi_free_worklist(struct bi_worklist st)
 {
         free(st.dep_counts);
+
+        if (st.dependents)
+                free(st.dependents[0]);
+
         free(st.dependents);
+        free(st.depth);
         free(st.instructions);
         free(st.worklist);
 }
@@ -500,8 +587,6 @@ bi_update_worklist(struct bi_worklist st, unsigned idx)
                 if (new_deps == 0)
                         BITSET_SET(st.worklist, i);
         }
-
-        free(st.dependents[idx]);
 }
 
 /* Scheduler predicates */
@@ -1205,15 +1290,24 @@ bi_choose_index(struct bi_worklist st,
 
                 signed cost = bi_instr_cost(instr, tuple);
 
-                /* Tie break in favour of later instructions, under the
-                 * assumption this promotes temporary usage (reducing pressure
-                 * on the register file). This is a side effect of a prepass
-                 * scheduling for pressure. */
+                if (cost > best_cost)
+                        continue;
 
-                if (cost <= best_cost) {
-                        best_idx = i;
-                        best_cost = cost;
-                }
+                /* When scheduling along the critical path, break ties in
+                 * favour of the instruction ending the longest dependency
+                 * chain. We schedule backwards, so this leaves that chain the
+                 * most room before it. */
+                if (st.depth && cost == best_cost &&
+                    st.depth[i] < st.depth[best_idx])
+                        continue;
+
+                /* Otherwise tie break in favour of later instructions, under
+                 * the assumption this promotes temporary usage (reducing
+                 * pressure on the register file). This is a side effect of a
+                 * prepass scheduling for pressure. */
+
+                best_idx = i;
+                best_cost = cost;
         }
 
         return best_idx;
@@ -1928,7 +2022,8 @@ bi_schedule_block(bi_context *ctx, bi_block *block)
         /* Copy list to dynamic array */
         struct bi_worklist st = bi_initialize_worklist(block,
                         bifrost_debug & BIFROST_DBG_INORDER,
-                        ctx->inputs->is_blend);
+                        ctx->inputs->is_blend,
+                        bifrost_debug & BIFROST_DBG_CRITPATH);
 
         if (!st.count) {
                 bi_free_worklist(st);
@@ -50,6 +50,7 @@ static inline bi_builder *
 bit_builder(void *memctx)
 {
         bi_context *ctx = rzalloc(memctx, bi_context);
+        ctx->linear_ctx = linear_alloc_parent(ctx, 0);
         list_inithead(&ctx->blocks);
         ctx->inputs = rzalloc(memctx, struct panfrost_compile_inputs);
 
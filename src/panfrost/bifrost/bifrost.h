@@ -49,6 +49,10 @@ extern "C" {
 #define BIFROST_DBG_NOPRELOAD   0x0800
 #define BIFROST_DBG_SPILL       0x1000
 #define BIFROST_DBG_NOPSCHED    0x2000
+#define BIFROST_DBG_CRITPATH    0x4000
+#define BIFROST_DBG_PERF        0x8000
+#define BIFROST_DBG_NOLSCHED    0x10000
+#define BIFROST_DBG_TIME        0x20000
 
 extern int bifrost_debug;
 
@@ -30,6 +30,7 @@
 #include "compiler/nir/nir_builder.h"
 #include "compiler/nir/nir_schedule.h"
 #include "util/u_debug.h"
+#include "util/os_time.h"
 
 #include "disassemble.h"
 #include "valhall/va_compiler.h"
@@ -49,6 +50,7 @@ static const struct debug_named_value bifrost_debug_options[] = {
         {"internal",  BIFROST_DBG_INTERNAL,	"Dump even internal shaders"},
         {"nosched",   BIFROST_DBG_NOSCHED, 	"Force trivial bundling"},
         {"nopsched",  BIFROST_DBG_NOPSCHED,     "Disable scheduling for pressure"},
+        {"nolsched",  BIFROST_DBG_NOLSCHED,     "Disable scheduling for latency on Valhall"},
         {"inorder",   BIFROST_DBG_INORDER, 	"Force in-order bundling"},
         {"novalidate",BIFROST_DBG_NOVALIDATE,   "Skip IR validation"},
         {"noopt",     BIFROST_DBG_NOOPT,        "Skip optimization passes"},
@@ -56,6 +58,9 @@ static const struct debug_named_value bifrost_debug_options[] = {
         {"nosb",      BIFROST_DBG_NOSB,         "Disable scoreboarding"},
         {"nopreload", BIFROST_DBG_NOPRELOAD,    "Disable message preloading"},
         {"spill",     BIFROST_DBG_SPILL,        "Test register spilling"},
+        {"critpath",  BIFROST_DBG_CRITPATH,     "Bundle along the critical path"},
+        {"perf",      BIFROST_DBG_PERF,         "Print the Valhall performance model of each block"},
+        {"time",      BIFROST_DBG_TIME,         "Print the wall time of each compile phase"},
         DEBUG_NAMED_VALUE_END
 };
 
@@ -442,21 +447,38 @@ bi_emit_load_attr(bi_builder *b, nir_intrinsic_instr *instr)
         bool needs_offset = b->shader->arch >= 10 &&
                 b->shader->nir->info.has_transform_feedback_varyings;
 
-        bi_index vertex_id = bi_vertex_id_offset(b, needs_offset);
+        bi_index vertex_id, instance_id;
+
+        /* Explicit vertices are relative to the first vertex, like the
+         * preloaded vertex ID */
+        if (instr->intrinsic == nir_intrinsic_load_attribute_pan) {
+                vertex_id = bi_src_index(&instr->src[0]);
+                instance_id = bi_src_index(&instr->src[1]);
+
+                if (needs_offset) {
+                        bi_index first = bi_load_sysval(b,
+                                PAN_SYSVAL_VERTEX_INSTANCE_OFFSETS, 1, 0);
+
+                        vertex_id = bi_iadd_u32(b, vertex_id, first, false);
+                }
+        } else {
+                vertex_id = bi_vertex_id_offset(b, needs_offset);
+                instance_id = bi_instance_id(b);
+        }
 
         if (immediate) {
                 I = bi_ld_attr_imm_to(b, dest, vertex_id,
-                                      bi_instance_id(b), regfmt, vecsize,
+                                      instance_id, regfmt, vecsize,
                                       imm_index);
         } else {
-                bi_index idx = bi_src_index(&instr->src[0]);
+                bi_index idx = bi_src_index(offset);
 
                 if (constant)
                         idx = bi_imm_u32(imm_index);
                 else if (base != 0)
                         idx = bi_iadd_u32(b, idx, bi_imm_u32(base), false);
 
-                I = bi_ld_attr_to(b, dest, vertex_id, bi_instance_id(b),
+                I = bi_ld_attr_to(b, dest, vertex_id, instance_id,
                                   idx, regfmt, vecsize);
         }
 
@@ -470,7 +492,8 @@ bi_emit_load_attr(bi_builder *b, nir_intrinsic_instr *instr)
  * ABI: Special (desktop GL) slots come first, tightly packed. General varyings
  * come later, sparsely packed. This handles both linked and separable shaders
  * with a common code path, with minimal keying only for desktop GL. Each slot
- * consumes 16 bytes (TODO: fp16, partial vectors).
+ * consumes 16 bytes, except general varyings in fp16_varying_mask which
+ * consume 8 (TODO: partial vectors).
  */
 static unsigned
 bi_varying_base_bytes(bi_context *ctx, nir_intrinsic_instr *intr)
@@ -481,8 +504,11 @@ bi_varying_base_bytes(bi_context *ctx, nir_intrinsic_instr *intr)
         if (sem.location >= VARYING_SLOT_VAR0) {
                 unsigned nr_special = util_bitcount(mask);
                 unsigned general_index = (sem.location - VARYING_SLOT_VAR0);
+                uint32_t fp16 = ctx->inputs->fp16_varying_mask &
+                                BITFIELD_MASK(general_index);
 
-                return 16 * (nr_special + general_index);
+                return 16 * (nr_special + general_index) -
+                       8 * util_bitcount(fp16);
         } else {
                 return 16 * (util_bitcount(mask & BITFIELD_MASK(sem.location)));
         }
@@ -501,6 +527,21 @@ bi_varying_offset(bi_context *ctx, nir_intrinsic_instr *intr)
         return bi_varying_base_bytes(ctx, intr) + (nir_src_as_uint(*src) * 16);
 }
 
+/* Is the varying stored as fp16 by the vertex shader? Such varyings are never
+ * arrays, so the offset source is always zero. */
+static bool
+bi_is_fp16_varying(bi_context *ctx, nir_intrinsic_instr *intr)
+{
+        nir_io_semantics sem = nir_intrinsic_io_semantics(intr);
+
+        if (sem.location < VARYING_SLOT_VAR0 ||
+            sem.location >= VARYING_SLOT_VAR0 + 32)
+                return false;
+
+        unsigned general_index = sem.location - VARYING_SLOT_VAR0;
+        return ctx->inputs->fp16_varying_mask & BITFIELD_BIT(general_index);
+}
+
 static void
 bi_emit_load_vary(bi_builder *b, nir_intrinsic_instr *instr)
 {
@@ -543,6 +584,9 @@ bi_emit_load_vary(bi_builder *b, nir_intrinsic_instr *instr)
         enum bi_source_format source_format =
                 smooth ? BI_SOURCE_FORMAT_F32 : BI_SOURCE_FORMAT_FLAT32;
 
+        if (smooth && b->shader->malloc_idvs && bi_is_fp16_varying(b->shader, instr))
+                source_format = BI_SOURCE_FORMAT_F16;
+
         nir_src *offset = nir_get_io_offset_src(instr);
         unsigned imm_index = 0;
         bool immediate = bi_is_intr_immediate(instr, &imm_index, 20);
@@ -974,9 +1018,10 @@ bi_emit_fragment_out(bi_builder *b, nir_intrinsic_instr *instr)
 }
 
 /**
- * In a vertex shader, is the specified variable a position output? These kinds
- * of outputs are written from position shaders when IDVS is enabled. All other
- * outputs are written from the varying shader.
+ * Should a vertex shader output store be removed from an IDVS variant?
+ * Position outputs are written from position shaders, gl_PointSize only from
+ * the one used to draw points. All other outputs are written from the varying
+ * shader.
  */
 static bool
 bi_should_remove_store(nir_intrinsic_instr *intr, enum bi_idvs_mode idvs)
@@ -985,10 +1030,11 @@ bi_should_remove_store(nir_intrinsic_instr *intr, enum bi_idvs_mode idvs)
 
         switch (sem.location) {
         case VARYING_SLOT_POS:
-        case VARYING_SLOT_PSIZ:
                 return idvs == BI_IDVS_VARYING;
+        case VARYING_SLOT_PSIZ:
+                return idvs != BI_IDVS_POSITION;
         default:
-                return idvs == BI_IDVS_POSITION;
+                return idvs != BI_IDVS_VARYING;
         }
 }
 
@@ -1013,6 +1059,44 @@ bifrost_nir_specialize_idvs(nir_builder *b, nir_instr *instr, void *data)
         return false;
 }
 
+/* Backend scheduler is purely local, so do some global optimizations to
+ * reduce register pressure. */
+static void
+bi_move_instructions(nir_shader *nir)
+{
+        nir_move_options move_all =
+                nir_move_const_undef | nir_move_load_ubo | nir_move_load_input |
+                nir_move_comparisons | nir_move_copies | nir_move_load_ssbo;
+
+        NIR_PASS_V(nir, nir_opt_sink, move_all);
+        NIR_PASS_V(nir, nir_opt_move, move_all);
+}
+
+/* With the stores of the other variant removed, whatever only fed them is
+ * dead. Slice the variant down to the dataflow of its own outputs, which for
+ * position shaders keeps culled primitives from paying for varying maths.
+ * Removed uses also free up loads and moves to sit next to their remaining
+ * uses, so place those again.
+ */
+static void
+bi_slice_idvs_variant(nir_shader *nir)
+{
+        bool progress;
+
+        do {
+                progress = false;
+
+                NIR_PASS(progress, nir, nir_opt_dce);
+                NIR_PASS(progress, nir, nir_opt_dead_cf);
+                NIR_PASS(progress, nir, nir_copy_prop);
+                NIR_PASS(progress, nir, nir_opt_remove_phis);
+                NIR_PASS(progress, nir, nir_opt_cse);
+                NIR_PASS(progress, nir, nir_opt_constant_folding);
+        } while (progress);
+
+        bi_move_instructions(nir);
+}
+
 static void
 bi_emit_store_vary(bi_builder *b, nir_intrinsic_instr *instr)
 {
@@ -1612,6 +1696,171 @@ bi_emit_ld_tile(bi_builder *b, nir_intrinsic_instr *instr)
         bi_emit_cached_split(b, dest, size * nr);
 }
 
+static enum bi_subgroup
+bi_subgroup_mode(bi_context *ctx)
+{
+        switch (pan_subgroup_size(ctx->arch)) {
+        case 16: return BI_SUBGROUP_SUBGROUP16;
+        case 8: return BI_SUBGROUP_SUBGROUP8;
+        default: return BI_SUBGROUP_SUBGROUP4;
+        }
+}
+
+/* Lanes reading an inactive lane with CLPER get a constant chosen from a
+ * small set, which covers the identity of every reduction op. The identity
+ * is also needed as an immediate for lanes that read out of the subgroup. */
+
+static void
+bi_reduction_identity(nir_op op, enum bi_inactive_result *inactive,
+                      uint32_t *value)
+{
+        switch (op) {
+        case nir_op_iadd:
+        case nir_op_ior:
+        case nir_op_ixor:
+        case nir_op_umax:
+        case nir_op_fadd:
+                *inactive = BI_INACTIVE_RESULT_ZERO;
+                *value = 0;
+                break;
+        case nir_op_iand:
+        case nir_op_umin:
+                *inactive = BI_INACTIVE_RESULT_UMAX;
+                *value = UINT32_MAX;
+                break;
+        case nir_op_imul:
+                *inactive = BI_INACTIVE_RESULT_I1;
+                *value = 1;
+                break;
+        case nir_op_fmul:
+                *inactive = BI_INACTIVE_RESULT_F1;
+                *value = 0x3F800000;
+                break;
+        case nir_op_imin:
+                *inactive = BI_INACTIVE_RESULT_SMAX;
+                *value = INT32_MAX;
+                break;
+        case nir_op_imax:
+                *inactive = BI_INACTIVE_RESULT_SMIN;
+                *value = INT32_MIN;
+                break;
+        case nir_op_fmin:
+                *inactive = BI_INACTIVE_RESULT_INF;
+                *value = 0x7F800000;
+                break;
+        case nir_op_fmax:
+                *inactive = BI_INACTIVE_RESULT_INFN;
+                *value = 0xFF800000;
+                break;
+        default:
+                unreachable("Invalid reduction op");
+        }
+}
+
+static bi_index
+bi_reduction_alu(bi_builder *b, nir_op op, bi_index s0, bi_index s1)
+{
+        switch (op) {
+        case nir_op_iadd:
+                return bi_iadd_u32(b, s0, s1, false);
+        case nir_op_imul:
+                return bi_imul_i32(b, s0, s1);
+        case nir_op_iand:
+                return bi_lshift_and_i32(b, s0, s1, bi_imm_u8(0));
+        case nir_op_ior:
+                return bi_lshift_or_i32(b, s0, s1, bi_imm_u8(0));
+        case nir_op_ixor:
+                return bi_lshift_xor_i32(b, s0, s1, bi_imm_u8(0));
+        case nir_op_imin:
+                return bi_csel_s32(b, s0, s1, s0, s1, BI_CMPF_LT);
+        case nir_op_imax:
+                return bi_csel_s32(b, s0, s1, s0, s1, BI_CMPF_GT);
+        case nir_op_umin:
+                return bi_csel_u32(b, s0, s1, s0, s1, BI_CMPF_LT);
+        case nir_op_umax:
+                return bi_csel_u32(b, s0, s1, s0, s1, BI_CMPF_GT);
+        case nir_op_fadd:
+                return bi_fadd_f32(b, s0, s1);
+        case nir_op_fmul:
+                return bi_fma_f32(b, s0, s1, bi_negzero());
+        case nir_op_fmin:
+                return bi_fmin_f32(b, s0, s1);
+        case nir_op_fmax:
+                return bi_fmax_f32(b, s0, s1);
+        default:
+                unreachable("Invalid reduction op");
+        }
+}
+
+/*
+ * Reductions and scans are built from CLPER reads of the other lanes. The
+ * accumulate and shift lane ops could shorten these, but their semantics
+ * aren't known well enough, so every lane is read explicitly. A lane reading
+ * an inactive lane gets the identity, so results only cover active lanes as
+ * required. Clustered reductions XOR the lane ID with every offset within the
+ * cluster, which stays inside the cluster since clusters are power-of-two
+ * sized and aligned.
+ */
+void
+bi_subgroup_reduce(bi_builder *b, bi_index dst, bi_index x, nir_op op,
+                   unsigned cluster)
+{
+        assert(!(b->shader->quirks & BIFROST_LIMITED_CLPER));
+
+        enum bi_subgroup mode = bi_subgroup_mode(b->shader);
+        unsigned size = pan_subgroup_size(b->shader->arch);
+
+        enum bi_inactive_result inactive;
+        uint32_t identity;
+        bi_reduction_identity(op, &inactive, &identity);
+
+        if (cluster == 0 || cluster > size)
+                cluster = size;
+
+        bi_index acc = x;
+
+        for (unsigned i = 1; i < cluster; ++i) {
+                bi_index other = bi_clper_i32(b, x, bi_imm_u32(i), inactive,
+                                              BI_LANE_OP_XOR, mode);
+
+                acc = bi_reduction_alu(b, op, acc, other);
+        }
+
+        bi_mov_i32_to(b, dst, acc);
+}
+
+void
+bi_subgroup_scan(bi_builder *b, bi_index dst, bi_index x, nir_op op,
+                 bool inclusive)
+{
+        assert(!(b->shader->quirks & BIFROST_LIMITED_CLPER));
+
+        enum bi_subgroup mode = bi_subgroup_mode(b->shader);
+        unsigned size = pan_subgroup_size(b->shader->arch);
+
+        enum bi_inactive_result inactive;
+        uint32_t identity;
+        bi_reduction_identity(op, &inactive, &identity);
+
+        /* Scans read the lanes below, which lanes at the bottom of the
+         * subgroup don't have */
+        bi_index lane_id = bi_fau(BIR_FAU_LANE_ID, false);
+        bi_index acc = inclusive ? x : bi_imm_u32(identity);
+
+        for (unsigned i = 1; i < size; ++i) {
+                bi_index lane = bi_iadd_u32(b, lane_id, bi_imm_u32(-i), false);
+                bi_index other = bi_clper_i32(b, x, lane, inactive,
+                                              BI_LANE_OP_NONE, mode);
+
+                other = bi_csel_u32(b, lane_id, bi_imm_u32(i), other,
+                                    bi_imm_u32(identity), BI_CMPF_GE);
+
+                acc = bi_reduction_alu(b, op, acc, other);
+        }
+
+        bi_mov_i32_to(b, dst, acc);
+}
+
 static void
 bi_emit_intrinsic(bi_builder *b, nir_intrinsic_instr *instr)
 {
@@ -1639,6 +1888,11 @@ bi_emit_intrinsic(bi_builder *b, nir_intrinsic_instr *instr)
                         unreachable("Unsupported shader stage");
                 break;
 
+        case nir_intrinsic_load_attribute_pan:
+                assert(stage == MESA_SHADER_VERTEX);
+                bi_emit_load_attr(b, instr);
+                break;
+
         case nir_intrinsic_store_output:
                 if (stage == MESA_SHADER_FRAGMENT)
                         bi_emit_fragment_out(b, instr);
@@ -1846,6 +2100,10 @@ bi_emit_intrinsic(bi_builder *b, nir_intrinsic_instr *instr)
                 bi_load_sysval_nir(b, instr, 1, 4);
                 break;
 
+        case nir_intrinsic_load_xfb_indices_pan:
+                bi_load_sysval_nir(b, instr, 4, 0);
+                break;
+
         case nir_intrinsic_load_base_instance:
         case nir_intrinsic_get_ssbo_size:
                 bi_load_sysval_nir(b, instr, 1, 8);
@@ -1943,6 +2201,37 @@ bi_emit_intrinsic(bi_builder *b, nir_intrinsic_instr *instr)
                 bi_split_dest(b, instr->dest);
                 break;
 
+        case nir_intrinsic_ballot:
+                assert(!(b->shader->quirks & BIFROST_LIMITED_CLPER));
+                bi_wmask_to(b, dst, bi_src_index(&instr->src[0]),
+                            bi_subgroup_mode(b->shader), 0);
+                break;
+
+        case nir_intrinsic_read_invocation:
+        case nir_intrinsic_shuffle:
+                assert(!(b->shader->quirks & BIFROST_LIMITED_CLPER));
+                assert(nir_dest_bit_size(instr->dest) == 32);
+                bi_clper_i32_to(b, dst, bi_src_index(&instr->src[0]),
+                                bi_src_index(&instr->src[1]),
+                                BI_INACTIVE_RESULT_ZERO, BI_LANE_OP_NONE,
+                                bi_subgroup_mode(b->shader));
+                break;
+
+        case nir_intrinsic_reduce:
+                assert(nir_dest_bit_size(instr->dest) == 32);
+                bi_subgroup_reduce(b, dst, bi_src_index(&instr->src[0]),
+                                   nir_intrinsic_reduction_op(instr),
+                                   nir_intrinsic_cluster_size(instr));
+                break;
+
+        case nir_intrinsic_inclusive_scan:
+        case nir_intrinsic_exclusive_scan:
+                assert(nir_dest_bit_size(instr->dest) == 32);
+                bi_subgroup_scan(b, dst, bi_src_index(&instr->src[0]),
+                                 nir_intrinsic_reduction_op(instr),
+                                 instr->intrinsic == nir_intrinsic_inclusive_scan);
+                break;
+
         default:
                 fprintf(stderr, "Unhandled intrinsic %s\n", nir_intrinsic_infos[instr->intrinsic].name);
                 assert(0);
@@ -4171,7 +4460,7 @@ emit_cf_list(bi_context *ctx, struct exec_list *list)
 /* shader-db stuff */
 
 struct bi_stats {
-        unsigned nr_clauses, nr_tuples, nr_ins;
+        unsigned nr_clauses, nr_tuples, nr_ins, nr_nops;
         unsigned nr_arith, nr_texture, nr_varying, nr_ldst;
 };
 
@@ -4181,6 +4470,9 @@ bi_count_tuple_stats(bi_clause *clause, bi_tuple *tuple, struct bi_stats *stats)
         /* Count instructions */
         stats->nr_ins += (tuple->fma ? 1 : 0) + (tuple->add ? 1 : 0);
 
+        /* Empty slots are encoded as NOPs */
+        stats->nr_nops += (tuple->fma ? 0 : 1) + (tuple->add ? 0 : 1);
+
         /* Non-message passing tuples are always arithmetic */
         if (tuple->add != clause->message) {
                 stats->nr_arith++;
@@ -4262,6 +4554,8 @@ bi_shader_stage_name(bi_context *ctx)
                 return "MESA_SHADER_VARYING";
         else if (ctx->idvs == BI_IDVS_POSITION)
                 return "MESA_SHADER_POSITION";
+        else if (ctx->idvs == BI_IDVS_POSITION_NO_PSIZ)
+                return "MESA_SHADER_POSITION_NO_PSIZ";
         else if (ctx->inputs->is_blend)
                 return "MESA_SHADER_BLEND";
         else
@@ -4307,13 +4601,30 @@ bi_print_stats(bi_context *ctx, unsigned size)
         bool full_threads = (ctx->arch == 7 && ctx->info.work_reg_count <= 32);
         unsigned nr_threads = full_threads ? 2 : 1;
 
+        ctx->stats = (struct pan_shader_stats) {
+                .instrs = stats.nr_ins,
+                .bundles = stats.nr_clauses,
+                .code_size = size,
+                .cycles = cycles_bound,
+                .cycles_arith = cycles_arith,
+                .cycles_texture = cycles_texture,
+                .cycles_varying = cycles_varying,
+                .cycles_ldst = cycles_ldst,
+                .work_regs = ctx->info.work_reg_count,
+                .threads = nr_threads,
+                .loops = ctx->loop_count,
+                .spills = ctx->spills,
+                .fills = ctx->fills,
+        };
+
         /* Dump stats */
         char *str = ralloc_asprintf(NULL, "%s shader: "
-                        "%u inst, %u tuples, %u clauses, "
+                        "%u inst, %u tuples, %u clauses, %u nops, "
                         "%f cycles, %f arith, %f texture, %f vary, %f ldst, "
                         "%u quadwords, %u threads",
                         bi_shader_stage_name(ctx),
                         stats.nr_ins, stats.nr_tuples, stats.nr_clauses,
+                        stats.nr_nops,
                         cycles_bound, cycles_arith, cycles_texture,
                         cycles_varying, cycles_ldst,
                         size / 16, nr_threads);
@@ -4322,8 +4633,10 @@ bi_print_stats(bi_context *ctx, unsigned size)
                 ralloc_asprintf_append(&str, ", %u preloads", bi_count_preload_cost(ctx));
         }
 
-        ralloc_asprintf_append(&str, ", %u loops, %u:%u spills:fills",
-                        ctx->loop_count, ctx->spills, ctx->fills);
+        ralloc_asprintf_append(&str, ", %u loops, %u:%u spills:fills, "
+                        "%u remats, %u dual tex",
+                        ctx->loop_count, ctx->spills, ctx->fills, ctx->remats,
+                        ctx->dual_tex);
 
         return str;
 }
@@ -4358,23 +4671,36 @@ va_print_stats(bi_context *ctx, unsigned size)
         float cycles_ls = ((float) stats.ls) / 1.0;
 
         /* Calculate the bound */
-        float cycles = MAX2(
-                        MAX3(cycles_fma, cycles_cvt, cycles_sfu),
-                        MAX3(cycles_v,   cycles_t,   cycles_ls));
+        float cycles = va_stats_cycles(&stats);
 
 
         /* Thread count and register pressure are traded off */
         unsigned nr_threads = (ctx->info.work_reg_count <= 32) ? 2 : 1;
 
+        ctx->stats = (struct pan_shader_stats) {
+                .instrs = nr_ins,
+                .code_size = size,
+                .cycles = cycles,
+                .cycles_arith = MAX3(cycles_fma, cycles_cvt, cycles_sfu),
+                .cycles_texture = cycles_t,
+                .cycles_varying = cycles_v,
+                .cycles_ldst = cycles_ls,
+                .work_regs = ctx->info.work_reg_count,
+                .threads = nr_threads,
+                .loops = ctx->loop_count,
+                .spills = ctx->spills,
+                .fills = ctx->fills,
+        };
+
         /* Dump stats */
         return ralloc_asprintf(NULL, "%s shader: "
                         "%u inst, %f cycles, %f fma, %f cvt, %f sfu, %f v, "
                         "%f t, %f ls, %u quadwords, %u threads, %u loops, "
-                        "%u:%u spills:fills",
+                        "%u:%u spills:fills, %u remats",
                         bi_shader_stage_name(ctx),
                         nr_ins, cycles, cycles_fma, cycles_cvt, cycles_sfu,
                         cycles_v, cycles_t, cycles_ls, size / 16, nr_threads,
-                        ctx->loop_count, ctx->spills, ctx->fills);
+                        ctx->loop_count, ctx->spills, ctx->fills, ctx->remats);
 }
 
 static int
@@ -4411,6 +4737,24 @@ should_split_wrmask(const nir_instr *instr, UNUSED const void *data)
 static unsigned
 bi_lower_bit_size(const nir_instr *instr, UNUSED void *data)
 {
+        /* Cross-lane ops are only implemented on 32-bit values */
+        if (instr->type == nir_instr_type_intrinsic) {
+                nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+
+                switch (intr->intrinsic) {
+                case nir_intrinsic_read_invocation:
+                case nir_intrinsic_shuffle:
+                case nir_intrinsic_reduce:
+                case nir_intrinsic_inclusive_scan:
+                case nir_intrinsic_exclusive_scan: {
+                        unsigned bit_size = nir_dest_bit_size(intr->dest);
+                        return (bit_size == 8 || bit_size == 16) ? 32 : 0;
+                }
+                default:
+                        return 0;
+                }
+        }
+
         if (instr->type != nir_instr_type_alu)
                 return 0;
 
@@ -4430,6 +4774,81 @@ bi_lower_bit_size(const nir_instr *instr, UNUSED void *data)
         }
 }
 
+/* Votes and first invocation queries are built on ballots, and the subgroup ID
+ * on the local invocation index, assuming warps are filled with consecutive
+ * invocations. That isn't confirmed on hardware, so panvk only exposes
+ * subgroups with PANVK_DEBUG=subgroups. */
+
+static bool
+bi_lower_subgroup_intrinsic(nir_builder *b, nir_instr *instr, void *data)
+{
+        if (instr->type != nir_instr_type_intrinsic)
+                return false;
+
+        nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+        unsigned subgroup_size = *((unsigned *) data);
+        nir_ssa_def *res;
+
+        b->cursor = nir_before_instr(instr);
+
+        switch (intr->intrinsic) {
+        case nir_intrinsic_vote_any:
+                res = nir_ine_imm(b, nir_ballot(b, 1, 32, intr->src[0].ssa), 0);
+                break;
+
+        case nir_intrinsic_vote_all: {
+                nir_ssa_def *not = nir_inot(b, intr->src[0].ssa);
+                res = nir_ieq_imm(b, nir_ballot(b, 1, 32, not), 0);
+                break;
+        }
+
+        case nir_intrinsic_first_invocation:
+                res = nir_find_lsb(b, nir_ballot(b, 1, 32, nir_imm_true(b)));
+                break;
+
+        case nir_intrinsic_read_first_invocation: {
+                nir_ssa_def *first =
+                        nir_find_lsb(b, nir_ballot(b, 1, 32, nir_imm_true(b)));
+                res = nir_read_invocation(b, intr->src[0].ssa, first);
+                break;
+        }
+
+        case nir_intrinsic_load_subgroup_id: {
+                /* The local invocation index was lowered already */
+                nir_ssa_def *id = nir_load_local_invocation_id(b);
+                nir_ssa_def *size = nir_load_workgroup_size(b);
+                nir_ssa_def *index =
+                        nir_iadd(b, nir_channel(b, id, 0),
+                                 nir_imul(b, nir_channel(b, size, 0),
+                                          nir_iadd(b, nir_channel(b, id, 1),
+                                                   nir_imul(b, nir_channel(b, size, 1),
+                                                            nir_channel(b, id, 2)))));
+
+                res = nir_udiv_imm(b, index, subgroup_size);
+                break;
+        }
+
+        case nir_intrinsic_load_num_subgroups: {
+                nir_ssa_def *size = nir_load_workgroup_size(b);
+                nir_ssa_def *count =
+                        nir_imul(b, nir_channel(b, size, 0),
+                                 nir_imul(b, nir_channel(b, size, 1),
+                                          nir_channel(b, size, 2)));
+
+                res = nir_udiv_imm(b, nir_iadd_imm(b, count, subgroup_size - 1),
+                                   subgroup_size);
+                break;
+        }
+
+        default:
+                return false;
+        }
+
+        nir_ssa_def_rewrite_uses(&intr->dest.ssa, res);
+        nir_instr_remove(instr);
+        return true;
+}
+
 /* Although Bifrost generally supports packed 16-bit vec2 and 8-bit vec4,
  * transcendentals are an exception. Also shifts because of lane size mismatch
  * (8-bit in Bifrost, 32-bit in NIR TODO - workaround!). Some conversions need
@@ -4571,6 +4990,15 @@ bi_optimize_nir(nir_shader *nir, unsigned gpu_id, bool is_blend)
         NIR_PASS(progress, nir, nir_lower_idiv, &idiv_options);
 
         NIR_PASS(progress, nir, nir_lower_tex, &lower_tex_options);
+
+        /* Return mediump texture results at 16-bit directly, so the math
+         * consuming them can stay 16-bit without conversions */
+        struct nir_fold_16bit_tex_image_options fold_16bit_options = {
+                .rounding_mode = nir_rounding_mode_rtne,
+                .fold_tex_dest = true,
+        };
+        NIR_PASS(progress, nir, nir_fold_16bit_tex_image, &fold_16bit_options);
+
         NIR_PASS(progress, nir, nir_lower_alu_to_scalar, bi_scalarize_filter, NULL);
         NIR_PASS(progress, nir, nir_lower_load_const_to_scalar);
         NIR_PASS(progress, nir, nir_lower_phis_to_scalar, true);
@@ -4667,14 +5095,7 @@ bi_optimize_nir(nir_shader *nir, unsigned gpu_id, bool is_blend)
                            NULL);
         }
 
-        /* Backend scheduler is purely local, so do some global optimizations
-         * to reduce register pressure. */
-        nir_move_options move_all =
-                nir_move_const_undef | nir_move_load_ubo | nir_move_load_input |
-                nir_move_comparisons | nir_move_copies | nir_move_load_ssbo;
-
-        NIR_PASS_V(nir, nir_opt_sink, move_all);
-        NIR_PASS_V(nir, nir_opt_move, move_all);
+        bi_move_instructions(nir);
 
         /* We might lower attribute, varying, and image indirects. Use the
          * gathered info to skip the extra analysis in the happy path. */
@@ -4828,8 +5249,50 @@ bi_fp32_varying_mask(nir_shader *nir)
         return mask;
 }
 
+/*
+ * On Valhall, convert vertex shader stores to the varyings in
+ * fp16_varying_mask to fp16, matching their 8-byte slots. The mask only
+ * contains mediump float varyings, so this is the same conversion
+ * nir_lower_mediump_io would do, but it must not depend on the IO semantics
+ * or a 32-bit store would overflow into the next slot.
+ */
+static bool
+bi_lower_fp16_varying_store(nir_builder *b, nir_instr *instr, void *data)
+{
+        uint32_t *mask = data;
+
+        if (instr->type != nir_instr_type_intrinsic)
+                return false;
+
+        nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+
+        if (intr->intrinsic != nir_intrinsic_store_output)
+                return false;
+
+        nir_io_semantics sem = nir_intrinsic_io_semantics(intr);
+
+        if (sem.location < VARYING_SLOT_VAR0 ||
+            sem.location >= VARYING_SLOT_VAR0 + 32 ||
+            !(*mask & BITFIELD_BIT(sem.location - VARYING_SLOT_VAR0)))
+                return false;
+
+        if (nir_src_bit_size(intr->src[0]) == 16)
+                return false;
+
+        assert(nir_src_bit_size(intr->src[0]) == 32);
+        assert(nir_src_is_const(*nir_get_io_offset_src(intr)));
+
+        b->cursor = nir_before_instr(instr);
+        nir_ssa_def *value = nir_f2f16(b, intr->src[0].ssa);
+
+        nir_instr_rewrite_src_ssa(instr, &intr->src[0], value);
+        nir_intrinsic_set_src_type(intr, nir_type_float16);
+        return true;
+}
+
 static void
-bi_finalize_nir(nir_shader *nir, unsigned gpu_id, bool is_blend)
+bi_finalize_nir(nir_shader *nir, unsigned gpu_id, bool is_blend,
+                uint32_t fp16_varying_mask)
 {
         /* Lower gl_Position pre-optimisation, but after lowering vars to ssa
          * (so we don't accidentally duplicate the epilogue since mesa/st has
@@ -4886,6 +5349,14 @@ bi_finalize_nir(nir_shader *nir, unsigned gpu_id, bool is_blend)
                 if (gpu_id >= 0x9000) {
                         NIR_PASS_V(nir, nir_lower_mediump_io, nir_var_shader_out,
                                         BITFIELD64_BIT(VARYING_SLOT_PSIZ), false);
+
+                        if (fp16_varying_mask) {
+                                NIR_PASS_V(nir, nir_shader_instructions_pass,
+                                           bi_lower_fp16_varying_store,
+                                           nir_metadata_block_index |
+                                           nir_metadata_dominance,
+                                           &fp16_varying_mask);
+                        }
                 }
 
                 NIR_PASS_V(nir, pan_nir_lower_store_component);
@@ -4894,6 +5365,26 @@ bi_finalize_nir(nir_shader *nir, unsigned gpu_id, bool is_blend)
         NIR_PASS_V(nir, nir_lower_ssbo);
         NIR_PASS_V(nir, pan_nir_lower_zs_store);
         NIR_PASS_V(nir, pan_lower_sample_pos);
+
+        unsigned subgroup_size = pan_subgroup_size(gpu_id >> 12);
+        nir_lower_subgroups_options subgroups_options = {
+                .subgroup_size = subgroup_size,
+                .ballot_bit_size = 32,
+                .ballot_components = 1,
+                .lower_to_scalar = true,
+                .lower_vote_eq = true,
+                .lower_subgroup_masks = true,
+                .lower_relative_shuffle = true,
+                .lower_shuffle_to_32bit = true,
+                .lower_quad = true,
+                .lower_elect = true,
+        };
+
+        NIR_PASS_V(nir, nir_lower_subgroups, &subgroups_options);
+        NIR_PASS_V(nir, nir_shader_instructions_pass,
+                   bi_lower_subgroup_intrinsic,
+                   nir_metadata_block_index | nir_metadata_dominance,
+                   &subgroup_size);
         NIR_PASS_V(nir, nir_lower_bit_size, bi_lower_bit_size, NULL);
         NIR_PASS_V(nir, nir_lower_64bit_phis);
 
@@ -4901,12 +5392,28 @@ bi_finalize_nir(nir_shader *nir, unsigned gpu_id, bool is_blend)
                 NIR_PASS_V(nir, nir_io_add_const_offset_to_base,
                            nir_var_shader_in | nir_var_shader_out);
                 NIR_PASS_V(nir, nir_io_add_intrinsic_xfb_info);
-                NIR_PASS_V(nir, pan_lower_xfb);
+                NIR_PASS_V(nir, pan_lower_xfb, true);
         }
 
         bi_optimize_nir(nir, gpu_id, is_blend);
 }
 
+/* Print the wall time spent since the previous checkpoint */
+static void
+bi_checkpoint(bi_context *ctx, const char *phase)
+{
+        if (likely(!(bifrost_debug & BIFROST_DBG_TIME)))
+                return;
+
+        int64_t now = os_time_get_nano();
+
+        fprintf(stderr, "%s %s: %.3f ms\n",
+                _mesa_shader_stage_to_abbrev(ctx->stage), phase,
+                (now - ctx->checkpoint_ns) / 1000000.0);
+
+        ctx->checkpoint_ns = now;
+}
+
 static bi_context *
 bi_compile_variant_nir(nir_shader *nir,
                        const struct panfrost_compile_inputs *inputs,
@@ -4916,6 +5423,10 @@ bi_compile_variant_nir(nir_shader *nir,
                        enum bi_idvs_mode idvs)
 {
         bi_context *ctx = rzalloc(NULL, bi_context);
+        ctx->linear_ctx = linear_alloc_parent(ctx, 0);
+
+        if (bifrost_debug & BIFROST_DBG_TIME)
+                ctx->checkpoint_ns = os_time_get_nano();
 
         /* There may be another program in the dynarray, start at the end */
         unsigned offset = binary->size;
@@ -4932,10 +5443,11 @@ bi_compile_variant_nir(nir_shader *nir,
 
         if (idvs != BI_IDVS_NONE) {
                 /* Specializing shaders for IDVS is destructive, so we need to
-                 * clone. However, the last (second) IDVS shader does not need
-                 * to be preserved so we can skip cloning that one.
+                 * clone. However, the varying shader is compiled last and
+                 * does not need to be preserved so we can skip cloning that
+                 * one.
                  */
-                if (offset == 0)
+                if (idvs != BI_IDVS_VARYING)
                         ctx->nir = nir = nir_shader_clone(ctx, nir);
 
                 NIR_PASS_V(nir, nir_shader_instructions_pass,
@@ -4943,15 +5455,7 @@ bi_compile_variant_nir(nir_shader *nir,
                            nir_metadata_block_index | nir_metadata_dominance,
                            &idvs);
 
-                /* After specializing, clean up the mess */
-                bool progress = true;
-
-                while (progress) {
-                        progress = false;
-
-                        NIR_PASS(progress, nir, nir_opt_dce);
-                        NIR_PASS(progress, nir, nir_opt_dead_cf);
-                }
+                bi_slice_idvs_variant(nir);
         }
 
         /* If nothing is pushed, all UBOs need to be uploaded */
@@ -4991,6 +5495,7 @@ bi_compile_variant_nir(nir_shader *nir,
         }
 
         bi_validate(ctx, "NIR -> BIR");
+        bi_checkpoint(ctx, "NIR -> BIR");
 
         _mesa_hash_table_u64_destroy(ctx->allocated_vec);
 
@@ -5042,6 +5547,7 @@ bi_compile_variant_nir(nir_shader *nir,
                 if (!ctx->inputs->no_ubo_to_push)
                         bi_opt_reorder_push(ctx);
                 bi_validate(ctx, "Optimization passes");
+                bi_checkpoint(ctx, "Optimization passes");
         }
 
         bi_lower_opt_instructions(ctx);
@@ -5068,6 +5574,7 @@ bi_compile_variant_nir(nir_shader *nir,
                 }
 
                 bi_validate(ctx, "Valhall passes");
+                bi_checkpoint(ctx, "Valhall passes");
         }
 
         bi_foreach_block(ctx, block) {
@@ -5105,10 +5612,19 @@ bi_compile_variant_nir(nir_shader *nir,
         }
 
         bi_validate(ctx, "Late lowering");
+        bi_checkpoint(ctx, "Late lowering");
 
         if (likely(!(bifrost_debug & BIFROST_DBG_NOPSCHED))) {
                 bi_pressure_schedule(ctx);
                 bi_validate(ctx, "Pre-RA scheduling");
+                bi_checkpoint(ctx, "Pre-RA scheduling");
+        }
+
+        if (ctx->arch >= 9 && likely(optimize) &&
+            likely(!(bifrost_debug & BIFROST_DBG_NOLSCHED))) {
+                bi_latency_schedule(ctx);
+                bi_validate(ctx, "Latency scheduling");
+                bi_checkpoint(ctx, "Latency scheduling");
         }
 
         bi_register_allocate(ctx);
@@ -5116,6 +5632,8 @@ bi_compile_variant_nir(nir_shader *nir,
         if (likely(optimize))
                 bi_opt_post_ra(ctx);
 
+        bi_checkpoint(ctx, "Register allocation");
+
         if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal)
                 bi_print_shader(ctx, stdout);
 
@@ -5139,12 +5657,16 @@ bi_compile_variant_nir(nir_shader *nir,
         if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal)
                 bi_print_shader(ctx, stdout);
 
+        bi_checkpoint(ctx, "Scheduling");
+
         if (ctx->arch <= 8) {
                 bi_pack_clauses(ctx, binary, offset);
         } else {
                 bi_pack_valhall(ctx, binary);
         }
 
+        bi_checkpoint(ctx, "Packing");
+
         if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal) {
                 if (ctx->arch <= 8) {
                         disassemble_bifrost(stdout, binary->data + offset,
@@ -5159,28 +5681,71 @@ bi_compile_variant_nir(nir_shader *nir,
                 fflush(stdout);
         }
 
-        if (!skip_internal &&
-            ((bifrost_debug & BIFROST_DBG_SHADERDB) || inputs->debug)) {
-                char *shaderdb;
+        /* Statistics are always gathered for the shader info */
+        char *shaderdb;
 
-                if (ctx->arch >= 9) {
-                        shaderdb = va_print_stats(ctx, binary->size - offset);
-                } else {
-                        shaderdb = bi_print_stats(ctx, binary->size - offset);
-                }
+        if (ctx->arch >= 9) {
+                shaderdb = va_print_stats(ctx, binary->size - offset);
+        } else {
+                shaderdb = bi_print_stats(ctx, binary->size - offset);
+        }
+
+        if (!skip_internal && (bifrost_debug & BIFROST_DBG_SHADERDB))
+                fprintf(stderr, "SHADER-DB: %s\n", shaderdb);
 
-                if (bifrost_debug & BIFROST_DBG_SHADERDB)
-                        fprintf(stderr, "SHADER-DB: %s\n", shaderdb);
+        if (!skip_internal && inputs->debug)
+                util_debug_message(inputs->debug, SHADER_INFO, "%s", shaderdb);
 
-                if (inputs->debug)
-                        util_debug_message(inputs->debug, SHADER_INFO, "%s", shaderdb);
+        ralloc_free(shaderdb);
 
-                ralloc_free(shaderdb);
+        if ((bifrost_debug & BIFROST_DBG_PERF) && ctx->arch >= 9 &&
+            !skip_internal) {
+                fprintf(stderr, "PERF: %s shader\n", bi_shader_stage_name(ctx));
+                va_print_perf(stderr, ctx);
         }
 
         return ctx;
 }
 
+/* Points are drawn with the position shader writing gl_PointSize, everything
+ * else with a second entry point that doesn't write it. That one is compiled
+ * from the NIR without the store, so the point size computation goes away
+ * along with it. Both entry points share the fields of the program
+ * descriptor, so those have to fit either.
+ */
+static void
+bi_compile_position_no_psiz(nir_shader *nir,
+                            const struct panfrost_compile_inputs *inputs,
+                            struct util_dynarray *binary,
+                            struct hash_table_u64 *sysval_to_id,
+                            struct pan_shader_info *info)
+{
+        struct bi_shader_info local_info = {
+                .push = &info->push,
+                .bifrost = &info->bifrost,
+                .tls_size = info->tls_size,
+                .sysvals = &info->sysvals,
+                .push_offset = info->push.count
+        };
+
+        unsigned offset = binary->size;
+
+        bi_context *ctx = bi_compile_variant_nir(nir, inputs, binary,
+                                                 sysval_to_id, local_info,
+                                                 BI_IDVS_POSITION_NO_PSIZ);
+
+        bi_block *first_block = list_first_entry(&ctx->blocks, bi_block, link);
+
+        info->preload |= first_block->reg_live_in;
+        info->work_reg_count = MAX2(info->work_reg_count,
+                                    ctx->info.work_reg_count);
+        info->ubo_mask |= ctx->ubo_mask;
+        info->tls_size = MAX2(info->tls_size, ctx->info.tls_size);
+        info->vs.no_psiz_offset = offset;
+
+        ralloc_free(ctx);
+}
+
 static void
 bi_compile_variant(nir_shader *nir,
                    const struct panfrost_compile_inputs *inputs,
@@ -5234,6 +5799,13 @@ bi_compile_variant(nir_shader *nir,
         info->ubo_mask |= ctx->ubo_mask;
         info->tls_size = MAX2(info->tls_size, ctx->info.tls_size);
 
+        if (idvs == BI_IDVS_POSITION)
+                ctx->stats.position_instrs = ctx->stats.instrs;
+        else if (idvs == BI_IDVS_VARYING)
+                ctx->stats.varying_instrs = ctx->stats.instrs;
+
+        pan_shader_stats_merge(&info->stats, &ctx->stats);
+
         if (idvs == BI_IDVS_VARYING) {
                 info->vs.secondary_enable = (binary->size > offset);
                 info->vs.secondary_offset = offset;
@@ -5247,29 +5819,8 @@ bi_compile_variant(nir_shader *nir,
         if (idvs == BI_IDVS_POSITION &&
             !nir->info.internal &&
             nir->info.outputs_written & BITFIELD_BIT(VARYING_SLOT_PSIZ)) {
-                /* Find the psiz write */
-                bi_instr *write = NULL;
-
-                bi_foreach_instr_global(ctx, I) {
-                        if (I->op == BI_OPCODE_STORE_I16 && I->seg == BI_SEG_POS) {
-                                write = I;
-                                break;
-                        }
-                }
-
-                assert(write != NULL);
-
-                /* NOP it out, preserving its flow control. TODO: maybe DCE */
-                if (write->flow) {
-                        bi_builder b = bi_init_builder(ctx, bi_before_instr(write));
-                        bi_instr *nop = bi_nop(&b);
-                        nop->flow = write->flow;
-                }
-
-                bi_remove_instruction(write);
-
-                info->vs.no_psiz_offset = binary->size;
-                bi_pack_valhall(ctx, binary);
+                bi_compile_position_no_psiz(nir, inputs, binary, sysval_to_id,
+                                            info);
         }
 
         ralloc_free(ctx);
@@ -5304,7 +5855,8 @@ bifrost_compile_shader_nir(nir_shader *nir,
 {
         bifrost_debug = debug_get_option_bifrost_debug();
 
-        bi_finalize_nir(nir, inputs->gpu_id, inputs->is_blend);
+        bi_finalize_nir(nir, inputs->gpu_id, inputs->is_blend,
+                        inputs->fp16_varying_mask);
         struct hash_table_u64 *sysval_to_id =
                 panfrost_init_sysvals(&info->sysvals,
                                       inputs->fixed_sysval_layout,
@@ -5334,6 +5886,10 @@ bifrost_compile_shader_nir(nir_shader *nir,
                         !nir->info.uses_memory_barrier;
         }
 
+        unsigned sysval_ubo = inputs->fixed_sysval_ubo >= 0 ?
+                              inputs->fixed_sysval_ubo : nir->info.num_ubos;
+
+        info->sysvals_pushed = !(info->ubo_mask & BITFIELD_BIT(sysval_ubo));
         info->ubo_mask &= (1 << nir->info.num_ubos) - 1;
 
         _mesa_hash_table_u64_destroy(sysval_to_id);
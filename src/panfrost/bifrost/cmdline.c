@@ -333,10 +333,14 @@ main(int argc, char **argv)
 
         if (strcmp(argv[optind], "compile") == 0)
                 compile_shader(argc - optind - 1, &argv[optind + 1]);
-        else if (strcmp(argv[optind], "disasm") == 0)
+        else if (strcmp(argv[optind], "perf") == 0) {
+                /* Compile, printing the static performance model */
+                setenv("BIFROST_MESA_DEBUG", "perf,shaderdb", 1);
+                compile_shader(argc - optind - 1, &argv[optind + 1]);
+        } else if (strcmp(argv[optind], "disasm") == 0)
                 disassemble(argv[optind + 1]);
         else {
-                fprintf(stderr, "Unknown command. Valid: compile/disasm\n");
+                fprintf(stderr, "Unknown command. Valid: compile/perf/disasm\n");
                 return 1;
         }
 
@@ -811,6 +811,10 @@ enum bi_idvs_mode {
 
         /* IDVS in use. Compiling a varying shader */
         BI_IDVS_VARYING = 2,
+
+        /* IDVS in use. Compiling the position shader used when not drawing
+         * points, without the gl_PointSize write (Valhall) */
+        BI_IDVS_POSITION_NO_PSIZ = 3,
 };
 
 typedef struct {
@@ -850,6 +854,11 @@ typedef struct {
         */
        bi_index preloaded[64];
 
+       /* Linear allocator parent for instructions, which are never freed
+        * individually, so they are released in one go with the context.
+        */
+       void *linear_ctx;
+
        /* For creating temporaries */
        unsigned ssa_alloc;
        unsigned reg_alloc;
@@ -866,6 +875,14 @@ typedef struct {
        unsigned loop_count;
        unsigned spills;
        unsigned fills;
+       unsigned remats;
+       unsigned dual_tex;
+
+       /* Statistics to report in the shader info */
+       struct pan_shader_stats stats;
+
+       /* With BIFROST_DBG_TIME, time of the last compile phase checkpoint */
+       int64_t checkpoint_ns;
 } bi_context;
 
 static inline void
@@ -1137,12 +1154,21 @@ void bi_lower_swizzle(bi_context *ctx);
 void bi_lower_fau(bi_context *ctx);
 void bi_assign_scoreboard(bi_context *ctx);
 void bi_register_allocate(bi_context *ctx);
+unsigned *bi_compute_loop_depth(bi_context *ctx);
+bool bi_can_remat(const bi_instr *I);
+bi_instr **bi_find_remat_defs(bi_context *ctx, unsigned node_count);
+
+struct lcra_state;
+struct lcra_state *bi_allocate_for_occupancy(bi_context *ctx,
+                                            unsigned *spill_count);
+
 void va_optimize(bi_context *ctx);
 void va_lower_split_64bit(bi_context *ctx);
 
 void bi_lower_opt_instructions(bi_context *ctx);
 
 void bi_pressure_schedule(bi_context *ctx);
+void bi_latency_schedule(bi_context *ctx);
 void bi_schedule(bi_context *ctx);
 bool bi_can_fma(bi_instr *ins);
 bool bi_can_add(bi_instr *ins);
@@ -1425,6 +1451,11 @@ bi_builder_insert(bi_cursor *cursor, bi_instr *I)
 
 bi_instr *bi_csel_from_mux(bi_builder *b, const bi_instr *I, bool must_sign);
 
+void bi_subgroup_reduce(bi_builder *b, bi_index dst, bi_index x, nir_op op,
+                        unsigned cluster);
+void bi_subgroup_scan(bi_builder *b, bi_index dst, bi_index x, nir_op op,
+                      bool inclusive);
+
 /* Read back power-efficent garbage, TODO maybe merge with null? */
 static inline bi_index
 bi_dontcare(bi_builder *b)
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bi_lcra.h"
+
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+
+/* The solver used to test one candidate register at a time, walking all of
+ * the constraints of the node for each. Check that testing every register at
+ * once with a mask gives the same results. */
+
+static bool
+ref_test_linear(struct lcra_state *l, const unsigned *solutions, unsigned i)
+{
+   signed constant = solutions[i];
+
+   if (nodearray_is_sparse(&l->linear[i])) {
+      nodearray_sparse_foreach(&l->linear[i], elem) {
+         unsigned j = nodearray_sparse_key(elem);
+         nodearray_value constraint = nodearray_sparse_value(elem);
+
+         if (solutions[j] == ~0u) continue;
+
+         signed lhs = constant - (signed) solutions[j];
+
+         if (lhs < -7 || lhs > 7)
+            continue;
+
+         if (constraint & (1 << (lhs + 7)))
+            return false;
+      }
+
+      return true;
+   }
+
+   nodearray_value *row = l->linear[i].dense;
+
+   for (unsigned j = 0; j < l->node_count; ++j) {
+      if (solutions[j] == ~0u) continue;
+
+      signed lhs = constant - (signed) solutions[j];
+
+      if (lhs < -7 || lhs > 7)
+         continue;
+
+      if (row[j] & (1 << (lhs + 7)))
+         return false;
+   }
+
+   return true;
+}
+
+/* Returns the node that failed, or -1 */
+static signed
+ref_solve(struct lcra_state *l, std::vector<unsigned> &solutions)
+{
+   for (unsigned step = 0; step < l->node_count; ++step) {
+      if (solutions[step] != ~0u) continue;
+      if (l->affinity[step] == 0) continue;
+
+      bool succ = false;
+
+      for (unsigned r = 0; r < 64; ++r) {
+         if (!(l->affinity[step] & BITFIELD64_BIT(r)))
+            continue;
+
+         solutions[step] = r;
+
+         if (ref_test_linear(l, solutions.data(), step)) {
+            succ = true;
+            break;
+         }
+      }
+
+      if (!succ) {
+         solutions[step] = ~0u;
+         return step;
+      }
+   }
+
+   return -1;
+}
+
+static uint64_t
+random_affinity(std::mt19937_64 &rng)
+{
+   switch (rng() % 4) {
+   case 0: return ~0ull;
+   case 1: return BITFIELD64_MASK(32);
+   case 2: return rng() & rng();
+   default: return (rng() & 7) ? (rng() | rng()) : 0;
+   }
+}
+
+/* Random constraints between node_count nodes, averaging density per node.
+ * Some nodes are forced to a register, as preloads are. */
+static struct lcra_state *
+random_equations(std::mt19937_64 &rng, unsigned node_count, unsigned density)
+{
+   struct lcra_state *l = lcra_alloc_equations(node_count);
+
+   for (unsigned i = 0; i < node_count; ++i) {
+      l->affinity[i] = random_affinity(rng);
+
+      if (rng() % 10 == 0)
+         l->solutions[i] = rng() % 64;
+   }
+
+   for (unsigned n = 0; n < node_count * density; ++n) {
+      unsigned i = rng() % node_count;
+      unsigned j = rng() % node_count;
+
+      lcra_add_node_interference(l, i, (rng() & 0xff) | 1,
+                                 j, (rng() & 0xff) | 1);
+   }
+
+   return l;
+}
+
+static void
+check_solve(std::mt19937_64 &rng, unsigned node_count, unsigned density)
+{
+   struct lcra_state *l = random_equations(rng, node_count, density);
+   std::vector<unsigned> ref(l->solutions, l->solutions + node_count);
+
+   signed ref_spill = ref_solve(l, ref);
+   bool success = lcra_solve(l);
+
+   ASSERT_EQ(success, ref_spill < 0);
+
+   if (!success)
+      ASSERT_EQ(l->spill_node, (unsigned) ref_spill);
+
+   for (unsigned i = 0; i < node_count; ++i)
+      ASSERT_EQ(l->solutions[i], ref[i]) << "node " << i;
+
+   lcra_free(l);
+}
+
+TEST(LCRA, SolveMatchesPerCandidateTest)
+{
+   std::mt19937_64 rng(1);
+   unsigned successes = 0;
+
+   for (unsigned iter = 0; iter < 1000; ++iter) {
+      unsigned node_count = 1 + rng() % 128;
+      unsigned density = rng() % 8;
+
+      struct lcra_state *l = random_equations(rng, node_count, density);
+      std::vector<unsigned> ref(l->solutions, l->solutions + node_count);
+      successes += (ref_solve(l, ref) < 0);
+      lcra_free(l);
+   }
+
+   /* Make sure both outcomes are covered */
+   EXPECT_GT(successes, 100);
+   EXPECT_LT(successes, 900);
+
+   rng.seed(1);
+
+   for (unsigned iter = 0; iter < 1000; ++iter) {
+      unsigned node_count = 1 + rng() % 128;
+      unsigned density = rng() % 8;
+
+      check_solve(rng, node_count, density);
+   }
+}
+
+/* Nodes with more than 256 constraints switch to dense storage */
+TEST(LCRA, SolveMatchesPerCandidateTestDense)
+{
+   std::mt19937_64 rng(2);
+
+   for (unsigned iter = 0; iter < 20; ++iter)
+      check_solve(rng, 300 + rng() % 100, 200 + rng() % 200);
+}
+
+/* Coalescing tests a single candidate with lcra_test_linear */
+TEST(LCRA, TestLinearMatchesPerCandidateTest)
+{
+   std::mt19937_64 rng(3);
+
+   for (unsigned iter = 0; iter < 100; ++iter) {
+      unsigned node_count = 1 + rng() % 400;
+      struct lcra_state *l =
+         random_equations(rng, node_count, rng() % 300);
+
+      for (unsigned i = 0; i < node_count; ++i)
+         l->solutions[i] = (rng() % 4) ? rng() % 64 : ~0u;
+
+      for (unsigned i = 0; i < node_count; ++i) {
+         if (l->solutions[i] == ~0u)
+            continue;
+
+         ASSERT_EQ(lcra_test_linear(l, l->solutions, i),
+                   ref_test_linear(l, l->solutions, i)) << "node " << i;
+      }
+
+      lcra_free(l);
+   }
+}
@@ -181,3 +181,41 @@ TEST_F(MessagePreload, PreloadVartexLodModes)
          preload_moves(b, v, 4, 1);
    });
 }
+
+TEST_F(MessagePreload, PreferVartex)
+{
+   CASE({
+         bi_ld_var_imm_to(b, u, bi_register(61), BI_REGISTER_FORMAT_F32,
+                          BI_SAMPLE_SAMPLE, BI_UPDATE_STORE, BI_VECSIZE_V4, 2);
+         bi_ld_var_imm_to(b, v, bi_register(61), BI_REGISTER_FORMAT_F32,
+                          BI_SAMPLE_SAMPLE, BI_UPDATE_STORE, BI_VECSIZE_V4, 1);
+         bi_var_tex_f32_to(b, w, false, BI_SAMPLE_CENTER, BI_UPDATE_STORE, 0, 0);
+   }, {
+         preload_moves(b, u, 4, 1);
+         bi_ld_var_imm_to(b, v, bi_register(61), BI_REGISTER_FORMAT_F32,
+                          BI_SAMPLE_SAMPLE, BI_UPDATE_STORE, BI_VECSIZE_V4, 1);
+         preload_moves(b, w, 4, 0);
+   });
+}
+
+TEST_F(MessagePreload, AvoidOccupancyLoss)
+{
+   /* Preloading the late varying would keep its registers live across the
+    * 32 words of the earlier loads */
+   NEGCASE({
+         bi_index vals[8];
+
+         for (unsigned i = 0; i < 8; ++i) {
+            vals[i] = bi_ld_var_imm(b, bi_register(61), BI_REGISTER_FORMAT_U32,
+                                    BI_SAMPLE_SAMPLE, BI_UPDATE_STORE,
+                                    BI_VECSIZE_V4, i);
+         }
+
+         for (unsigned i = 0; i < 8; ++i)
+            bi_fadd_f32(b, vals[i], vals[i]);
+
+         bi_ld_var_imm_to(b, u, bi_register(61), BI_REGISTER_FORMAT_F32,
+                          BI_SAMPLE_SAMPLE, BI_UPDATE_STORE, BI_VECSIZE_V4, 0);
+         bi_fadd_f32(b, u, u);
+   });
+}
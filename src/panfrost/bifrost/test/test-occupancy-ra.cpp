@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compiler.h"
+#include "bi_test.h"
+#include "bi_builder.h"
+#include "bi_lcra.h"
+
+#include <vector>
+#include <gtest/gtest.h>
+
+/* Register allocation first tries to fit in 32 registers for occupancy,
+ * spilling only within a budget derived from the shader's message count */
+
+class OccupancyRA : public testing::Test {
+protected:
+   OccupancyRA() {
+      mem_ctx = ralloc_context(NULL);
+   }
+
+   ~OccupancyRA() {
+      ralloc_free(mem_ctx);
+   }
+
+   /* Constants, rematerialized before anything is spilled, and values
+    * computed from a register, which can only be spilled. All are live until
+    * they are summed at the end of the shader. */
+   bi_builder *build(unsigned nr_consts, unsigned nr_values) {
+      bi_builder *b = bit_builder(mem_ctx);
+      b->shader->arch = 9;
+
+      bi_index x = bi_temp(b->shader);
+      bi_mov_i32_to(b, x, bi_register(0));
+
+      std::vector<bi_index> live;
+
+      for (unsigned i = 0; i < nr_consts; ++i) {
+         live.push_back(bi_temp(b->shader));
+         bi_mov_i32_to(b, live.back(), bi_imm_u32(0x1000 + i));
+      }
+
+      for (unsigned i = 0; i < nr_values; ++i) {
+         live.push_back(bi_temp(b->shader));
+         bi_iadd_u32_to(b, live.back(), x, bi_imm_u32(i), false);
+      }
+
+      bi_index sum = live[0];
+
+      for (unsigned i = 1; i < live.size(); ++i) {
+         bi_index tmp = bi_temp(b->shader);
+         bi_iadd_u32_to(b, tmp, sum, live[i], false);
+         sum = tmp;
+      }
+
+      return b;
+   }
+
+   void *mem_ctx;
+};
+
+TEST_F(OccupancyRA, Fits)
+{
+   bi_builder *b = build(4, 8);
+   unsigned spill_count = 0;
+
+   struct lcra_state *l = bi_allocate_for_occupancy(b->shader, &spill_count);
+
+   ASSERT_NE(l, nullptr);
+   EXPECT_EQ(spill_count, 0u);
+   lcra_free(l);
+}
+
+TEST_F(OccupancyRA, RestoresShaderOverBudget)
+{
+   /* Without messages the budget is zero, so the first spill gives up after
+    * the constants have been rematerialized */
+   bi_builder *b = build(4, 40);
+   bi_builder *expected = build(4, 40);
+   unsigned spill_count = 16;
+
+   b->shader->spills = 1;
+   b->shader->fills = 2;
+   b->shader->remats = 3;
+
+   EXPECT_EQ(bi_allocate_for_occupancy(b->shader, &spill_count), nullptr);
+
+   ASSERT_SHADER_EQUAL(b->shader, expected->shader);
+   EXPECT_EQ(spill_count, 16u);
+   EXPECT_EQ(b->shader->spills, 1u);
+   EXPECT_EQ(b->shader->fills, 2u);
+   EXPECT_EQ(b->shader->remats, 3u);
+}
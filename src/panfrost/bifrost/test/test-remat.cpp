@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compiler.h"
+#include "bi_test.h"
+#include "bi_builder.h"
+
+#include <gtest/gtest.h>
+
+/* Values written once by an arithmetic instruction whose sources are all
+ * constants or FAU can be recomputed instead of spilled */
+
+class Remat : public testing::Test {
+protected:
+   Remat() {
+      mem_ctx = ralloc_context(NULL);
+      b = bit_builder(mem_ctx);
+      uniform = bi_fau((enum bir_fau) (BIR_FAU_UNIFORM | 2), false);
+   }
+
+   ~Remat() {
+      ralloc_free(mem_ctx);
+   }
+
+   bi_index TMP() { return bi_temp(b->shader); }
+
+   bi_instr *remat_def(bi_index node) {
+      bi_instr **defs = bi_find_remat_defs(b->shader, b->shader->ssa_alloc);
+      bi_instr *def = defs[node.value];
+      free(defs);
+      return def;
+   }
+
+   void *mem_ctx;
+   bi_builder *b;
+   bi_index uniform;
+};
+
+TEST_F(Remat, Constants)
+{
+   EXPECT_TRUE(bi_can_remat(bi_mov_i32_to(b, TMP(), bi_imm_u32(0xCAFE))));
+   EXPECT_TRUE(bi_can_remat(bi_fadd_f32_to(b, TMP(), bi_imm_f32(1.0),
+                                           bi_zero())));
+}
+
+TEST_F(Remat, FAU)
+{
+   EXPECT_TRUE(bi_can_remat(bi_mov_i32_to(b, TMP(), uniform)));
+   EXPECT_TRUE(bi_can_remat(bi_iadd_u32_to(b, TMP(), uniform,
+                                           bi_imm_u32(16), false)));
+}
+
+TEST_F(Remat, RejectsProgramCounter)
+{
+   /* The program counter differs at the point of use */
+   bi_index pc = bi_fau(BIR_FAU_PROGRAM_COUNTER, false);
+
+   EXPECT_FALSE(bi_can_remat(bi_mov_i32_to(b, TMP(), pc)));
+}
+
+TEST_F(Remat, RejectsTemporarySources)
+{
+   bi_index x = TMP();
+
+   EXPECT_FALSE(bi_can_remat(bi_mov_i32_to(b, TMP(), x)));
+   EXPECT_FALSE(bi_can_remat(bi_iadd_u32_to(b, TMP(), x, uniform, false)));
+}
+
+TEST_F(Remat, RejectsRegisterSources)
+{
+   EXPECT_FALSE(bi_can_remat(bi_mov_i32_to(b, TMP(), bi_register(0))));
+}
+
+TEST_F(Remat, RejectsMessages)
+{
+   EXPECT_FALSE(bi_can_remat(bi_load_i32_to(b, TMP(), bi_imm_u32(0),
+                                            bi_zero(), BI_SEG_UBO, 0)));
+}
+
+TEST_F(Remat, RejectsBranches)
+{
+   EXPECT_FALSE(bi_can_remat(bi_jump(b, bi_imm_u32(0))));
+}
+
+TEST_F(Remat, SingleDefinition)
+{
+   bi_index x = TMP();
+   bi_instr *mov = bi_mov_i32_to(b, x, uniform);
+   bi_fadd_f32_to(b, TMP(), x, x);
+
+   EXPECT_EQ(remat_def(x), mov);
+}
+
+TEST_F(Remat, RejectsMultipleDefinitions)
+{
+   /* Out of SSA, a node can be written more than once */
+   bi_index x = TMP();
+   bi_mov_i32_to(b, x, bi_imm_u32(1));
+   bi_mov_i32_to(b, x, bi_imm_u32(2));
+   bi_fadd_f32_to(b, TMP(), x, x);
+
+   EXPECT_EQ(remat_def(x), nullptr);
+}
+
+TEST_F(Remat, RejectsIneligibleDefinition)
+{
+   bi_index x = TMP();
+   bi_load_i32_to(b, x, bi_imm_u32(0), bi_zero(), BI_SEG_UBO, 0);
+   bi_fadd_f32_to(b, TMP(), x, x);
+
+   EXPECT_EQ(remat_def(x), nullptr);
+}
+
+TEST_F(Remat, RejectsUndefined)
+{
+   bi_index x = TMP();
+   bi_fadd_f32_to(b, TMP(), x, x);
+
+   EXPECT_EQ(remat_def(x), nullptr);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compiler.h"
+#include "bi_test.h"
+#include "bi_builder.h"
+
+#include <gtest/gtest.h>
+
+/* Subgroup reductions and scans are lowered to CLPER reads of other lanes,
+ * in the subgroup size of the architecture */
+
+#define CASE(arch_, instr, expected) do { \
+   bi_builder *A = bit_builder(mem_ctx); \
+   bi_builder *B = bit_builder(mem_ctx); \
+   A->shader->arch = B->shader->arch = arch_; \
+   { \
+      bi_builder *b = A; \
+      instr; \
+   } \
+   { \
+      bi_builder *b = B; \
+      expected; \
+   } \
+   ASSERT_SHADER_EQUAL(A->shader, B->shader); \
+} while(0)
+
+class Subgroup : public testing::Test {
+protected:
+   Subgroup() {
+      mem_ctx = ralloc_context(NULL);
+      dst = bi_register(0);
+      x = bi_register(1);
+      lane_id = bi_fau(BIR_FAU_LANE_ID, false);
+   }
+
+   ~Subgroup() {
+      ralloc_free(mem_ctx);
+   }
+
+   void *mem_ctx;
+   bi_index dst, x, lane_id;
+};
+
+TEST_F(Subgroup, ClusteredReduce) {
+   CASE(9, bi_subgroup_reduce(b, dst, x, nir_op_iadd, 4), {
+      bi_index acc = x;
+
+      for (unsigned i = 1; i < 4; ++i) {
+         bi_index other = bi_clper_i32(b, x, bi_imm_u32(i),
+                                       BI_INACTIVE_RESULT_ZERO, BI_LANE_OP_XOR,
+                                       BI_SUBGROUP_SUBGROUP16);
+         acc = bi_iadd_u32(b, acc, other, false);
+      }
+
+      bi_mov_i32_to(b, dst, acc);
+   });
+}
+
+TEST_F(Subgroup, ReduceWholeSubgroup) {
+   /* Clusters of size 0 or larger than the subgroup cover all of it */
+   for (unsigned cluster : { 0, 4, 32 }) {
+      CASE(7, bi_subgroup_reduce(b, dst, x, nir_op_umin, cluster), {
+         bi_index acc = x;
+
+         for (unsigned i = 1; i < 8; ++i) {
+            bi_index other = bi_clper_i32(b, x, bi_imm_u32(i),
+                                          BI_INACTIVE_RESULT_UMAX,
+                                          BI_LANE_OP_XOR, BI_SUBGROUP_SUBGROUP8);
+            acc = bi_csel_u32(b, acc, other, acc, other, BI_CMPF_LT);
+         }
+
+         bi_mov_i32_to(b, dst, acc);
+      });
+   }
+}
+
+TEST_F(Subgroup, ReduceIdentity) {
+   /* Inactive lanes read the identity of the op */
+   CASE(9, bi_subgroup_reduce(b, dst, x, nir_op_fmin, 2), {
+      bi_index other = bi_clper_i32(b, x, bi_imm_u32(1),
+                                    BI_INACTIVE_RESULT_INF, BI_LANE_OP_XOR,
+                                    BI_SUBGROUP_SUBGROUP16);
+      bi_mov_i32_to(b, dst, bi_fmin_f32(b, x, other));
+   });
+
+   CASE(9, bi_subgroup_reduce(b, dst, x, nir_op_fmul, 2), {
+      bi_index other = bi_clper_i32(b, x, bi_imm_u32(1),
+                                    BI_INACTIVE_RESULT_F1, BI_LANE_OP_XOR,
+                                    BI_SUBGROUP_SUBGROUP16);
+      bi_mov_i32_to(b, dst, bi_fma_f32(b, x, other, bi_negzero()));
+   });
+
+   CASE(9, bi_subgroup_reduce(b, dst, x, nir_op_imax, 2), {
+      bi_index other = bi_clper_i32(b, x, bi_imm_u32(1),
+                                    BI_INACTIVE_RESULT_SMIN, BI_LANE_OP_XOR,
+                                    BI_SUBGROUP_SUBGROUP16);
+      bi_mov_i32_to(b, dst, bi_csel_s32(b, x, other, x, other, BI_CMPF_GT));
+   });
+}
+
+TEST_F(Subgroup, InclusiveScan) {
+   CASE(6, bi_subgroup_scan(b, dst, x, nir_op_iadd, true), {
+      bi_index acc = x;
+
+      for (unsigned i = 1; i < 4; ++i) {
+         bi_index lane = bi_iadd_u32(b, lane_id, bi_imm_u32(-i), false);
+         bi_index other = bi_clper_i32(b, x, lane, BI_INACTIVE_RESULT_ZERO,
+                                       BI_LANE_OP_NONE, BI_SUBGROUP_SUBGROUP4);
+         other = bi_csel_u32(b, lane_id, bi_imm_u32(i), other,
+                             bi_imm_u32(0), BI_CMPF_GE);
+         acc = bi_iadd_u32(b, acc, other, false);
+      }
+
+      bi_mov_i32_to(b, dst, acc);
+   });
+}
+
+TEST_F(Subgroup, ExclusiveScan) {
+   /* The first lane gets the identity */
+   CASE(6, bi_subgroup_scan(b, dst, x, nir_op_imin, false), {
+      bi_index acc = bi_imm_u32(INT32_MAX);
+
+      for (unsigned i = 1; i < 4; ++i) {
+         bi_index lane = bi_iadd_u32(b, lane_id, bi_imm_u32(-i), false);
+         bi_index other = bi_clper_i32(b, x, lane, BI_INACTIVE_RESULT_SMAX,
+                                       BI_LANE_OP_NONE, BI_SUBGROUP_SUBGROUP4);
+         other = bi_csel_u32(b, lane_id, bi_imm_u32(i), other,
+                             bi_imm_u32(INT32_MAX), BI_CMPF_GE);
+         acc = bi_csel_s32(b, acc, other, acc, other, BI_CMPF_LT);
+      }
+
+      bi_mov_i32_to(b, dst, acc);
+   });
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bi_test.h"
+#include "bi_builder.h"
+#include "va_compiler.h"
+
+#include <set>
+#include <gtest/gtest.h>
+
+class LatencySchedule : public testing::Test {
+protected:
+   LatencySchedule() {
+      mem_ctx = ralloc_context(NULL);
+   }
+
+   ~LatencySchedule() {
+      ralloc_free(mem_ctx);
+   }
+
+   /* Allocate the same SSA indices in every shader of a case */
+   bi_index *temps(bi_builder *b, unsigned count) {
+      bi_index *t = ralloc_array(mem_ctx, bi_index, count);
+
+      for (unsigned i = 0; i < count; ++i)
+         t[i] = bi_temp(b->shader);
+
+      return t;
+   }
+
+   void *mem_ctx;
+};
+
+/* Maximum number of SSA values live at once in a straight-line shader */
+static unsigned
+max_pressure(bi_context *ctx)
+{
+   std::set<unsigned> live;
+   unsigned max = 0;
+
+   bi_foreach_instr_in_block_rev(bi_start_block(&ctx->blocks), I) {
+      bi_foreach_dest(I, d)
+         live.erase(I->dest[d].value);
+
+      bi_foreach_ssa_src(I, s)
+         live.insert(I->src[s].value);
+
+      max = MAX2(max, (unsigned) live.size());
+   }
+
+   return max;
+}
+
+static void
+ubo_load(bi_builder *b, bi_index dest, unsigned offset)
+{
+   bi_load_i32_to(b, dest, bi_imm_u32(offset), bi_zero(), BI_SEG_UBO, 0);
+}
+
+TEST_F(LatencySchedule, HoistsMessageAboveArithmetic)
+{
+   bi_builder *A = bit_builder(mem_ctx);
+   bi_builder *B = bit_builder(mem_ctx);
+
+   {
+      bi_builder *b = A;
+      bi_index *t = temps(b, 6);
+
+      bi_fadd_f32_to(b, t[0], bi_imm_f32(1.0), bi_imm_f32(2.0));
+      bi_fadd_f32_to(b, t[1], t[0], bi_imm_f32(3.0));
+      bi_fadd_f32_to(b, t[2], t[1], bi_imm_f32(4.0));
+      bi_fadd_f32_to(b, t[3], t[2], bi_imm_f32(5.0));
+      ubo_load(b, t[4], 0);
+      bi_fadd_f32_to(b, t[5], t[4], t[3]);
+   }
+
+   {
+      bi_builder *b = B;
+      bi_index *t = temps(b, 6);
+
+      ubo_load(b, t[4], 0);
+      bi_fadd_f32_to(b, t[0], bi_imm_f32(1.0), bi_imm_f32(2.0));
+      bi_fadd_f32_to(b, t[1], t[0], bi_imm_f32(3.0));
+      bi_fadd_f32_to(b, t[2], t[1], bi_imm_f32(4.0));
+      bi_fadd_f32_to(b, t[3], t[2], bi_imm_f32(5.0));
+      bi_fadd_f32_to(b, t[5], t[4], t[3]);
+   }
+
+   bi_latency_schedule(A->shader);
+   ASSERT_SHADER_EQUAL(A->shader, B->shader);
+}
+
+TEST_F(LatencySchedule, RespectsPressureLimit)
+{
+   /* Each load is consumed right away, so few values are live. Hoisting
+    * every load to the top would keep all 40 results live at once. */
+   bi_builder *b = bit_builder(mem_ctx);
+   bi_index *t = temps(b, 80);
+
+   for (unsigned i = 0; i < 40; ++i) {
+      ubo_load(b, t[2 * i], i * 4);
+
+      bi_fadd_f32_to(b, t[2 * i + 1], t[2 * i],
+                     i ? t[2 * i - 1] : bi_imm_f32(0.0));
+   }
+
+   unsigned orig_pressure = max_pressure(b->shader);
+   ASSERT_LT(orig_pressure, 32u);
+
+   bi_latency_schedule(b->shader);
+
+   /* Loads were hoisted, but only up to the 32 registers we can use without
+    * losing occupancy */
+   EXPECT_GT(max_pressure(b->shader), orig_pressure);
+   EXPECT_LE(max_pressure(b->shader), 32u);
+}
+
+TEST_F(LatencySchedule, KeepsOrderWithoutGain)
+{
+   bi_builder *A = bit_builder(mem_ctx);
+   bi_builder *B = bit_builder(mem_ctx);
+
+   /* The message already issues first, and the arithmetic is independent,
+    * so no order is faster */
+   for (bi_builder *b : { A, B }) {
+      bi_index *t = temps(b, 4);
+
+      ubo_load(b, t[0], 0);
+      bi_fadd_f32_to(b, t[1], bi_imm_f32(1.0), bi_imm_f32(2.0));
+      bi_fadd_f32_to(b, t[2], bi_imm_f32(3.0), bi_imm_f32(4.0));
+      bi_fadd_f32_to(b, t[3], t[0], bi_imm_f32(5.0));
+   }
+
+   bi_latency_schedule(A->shader);
+   ASSERT_SHADER_EQUAL(A->shader, B->shader);
+}
@@ -110,6 +110,14 @@ TEST_F(ValhallPacking, Clper) {
          0x00a0c030128fc900);
 }
 
+TEST_F(ValhallPacking, Wmask) {
+   CASE(bi_wmask_to(b, bi_register(0), bi_register(1), BI_SUBGROUP_SUBGROUP16, 0),
+         0x0095c03000000001);
+
+   CASE(bi_wmask_to(b, bi_register(0), bi_register(1), BI_SUBGROUP_SUBGROUP4, 0),
+         0x0095c01000000001);
+}
+
 TEST_F(ValhallPacking, Clamps) {
    bi_instr *I = bi_fadd_f32_to(b, bi_register(0), bi_register(1),
                                 bi_neg(bi_abs(bi_register(2))));
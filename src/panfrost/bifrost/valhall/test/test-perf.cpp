@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "bi_test.h"
+#include "bi_builder.h"
+#include "va_compiler.h"
+#include "valhall_enums.h"
+
+#include <gtest/gtest.h>
+
+#define R(x) bi_register(x)
+
+class ValhallPerf : public testing::Test {
+protected:
+   ValhallPerf() {
+      mem_ctx = ralloc_context(NULL);
+      b = bit_builder(mem_ctx);
+   }
+
+   ~ValhallPerf() {
+      ralloc_free(mem_ctx);
+   }
+
+   struct va_block_perf analyze() {
+      struct va_block_perf perf;
+      va_analyze_block(b->shader, bi_start_block(&b->shader->blocks), &perf);
+      return perf;
+   }
+
+   void *mem_ctx;
+   bi_builder *b;
+};
+
+TEST_F(ValhallPerf, IndependentArithmetic) {
+   bi_fadd_f32_to(b, R(0), R(4), R(5));
+   bi_fadd_f32_to(b, R(1), R(6), R(7));
+
+   struct va_block_perf perf = analyze();
+   EXPECT_EQ(perf.nr_ins, 2);
+   EXPECT_EQ(perf.stats.fma, 2);
+   EXPECT_EQ(perf.latency, 1);
+   EXPECT_EQ(perf.reg_reads, 4);
+}
+
+TEST_F(ValhallPerf, DependentArithmetic) {
+   bi_fadd_f32_to(b, R(0), R(4), R(5));
+   bi_fadd_f32_to(b, R(1), R(0), R(5));
+   bi_fadd_f32_to(b, R(2), R(1), R(0));
+
+   EXPECT_EQ(analyze().latency, 3);
+}
+
+TEST_F(ValhallPerf, MessageLatency) {
+   bi_instr *load = bi_load_i32_to(b, R(0), R(8), R(9), BI_SEG_NONE, 0);
+   bi_fadd_f32_to(b, R(1), R(0), R(5));
+
+   struct va_block_perf perf = analyze();
+   EXPECT_EQ(perf.stats.ls, 1);
+   EXPECT_EQ(perf.latency, va_instr_latency(load) + 1);
+   EXPECT_GT(va_instr_latency(load), 1);
+}
+
+TEST_F(ValhallPerf, SSA) {
+   bi_index x = bi_fadd_f32(b, bi_temp(b->shader), bi_temp(b->shader));
+   bi_index y = bi_fadd_f32(b, x, x);
+   bi_fadd_f32(b, y, x);
+
+   EXPECT_EQ(analyze().latency, 3);
+}
@@ -94,6 +94,33 @@ struct va_stats {
 void
 va_count_instr_stats(bi_instr *I, struct va_stats *stats);
 
+float
+va_stats_cycles(const struct va_stats *stats);
+
+unsigned
+va_instr_latency(const bi_instr *I);
+
+/** Static performance model of a block */
+struct va_block_perf {
+   struct va_stats stats;
+   unsigned nr_ins;
+
+   /** Throughput bound, in normalized cycles */
+   float cycles;
+
+   /** Longest dependency chain, in estimated cycles */
+   unsigned latency;
+
+   /** Words read from the register file, a proxy for bank pressure */
+   unsigned reg_reads;
+};
+
+void
+va_analyze_block(bi_context *ctx, bi_block *block, struct va_block_perf *perf);
+
+void
+va_print_perf(FILE *fp, bi_context *ctx);
+
 #ifdef __cplusplus
 } /* extern C */
 #endif
@@ -75,3 +75,144 @@ va_count_instr_stats(bi_instr *I, struct va_stats *stats)
 
    unreachable("Invalid unit");
 }
+
+/*
+ * Normalize the counts to cycles using the peak rates of Mali-G78:
+ *
+ * 64 FMA instructions per cycle
+ * 64 CVT instructions per cycle
+ * 16 SFU instructions per cycle
+ * 8 x 32-bit varying channels interpolated per cycle
+ * 4 texture instructions per cycle
+ * 1 load/store operation per cycle
+ *
+ * The units run in parallel, so the busiest unit bounds the throughput.
+ */
+float
+va_stats_cycles(const struct va_stats *stats)
+{
+   float cycles_fma = ((float) stats->fma) / 64.0;
+   float cycles_cvt = ((float) stats->cvt) / 64.0;
+   float cycles_sfu = ((float) stats->sfu) / 16.0;
+   float cycles_v = ((float) stats->v) / 16.0;
+   float cycles_t = ((float) stats->t) / 4.0;
+   float cycles_ls = ((float) stats->ls) / 1.0;
+
+   return MAX2(MAX3(cycles_fma, cycles_cvt, cycles_sfu),
+               MAX3(cycles_v, cycles_t, cycles_ls));
+}
+
+/*
+ * Estimated cycles until the result of an instruction may be used. These are
+ * rough: arithmetic is pipelined across warps, while message latencies vary
+ * with the memory system and are assumed to hit in cache.
+ */
+unsigned
+va_instr_latency(const bi_instr *I)
+{
+   switch (valhall_opcodes[I->op].unit) {
+   case VA_UNIT_FMA:
+   case VA_UNIT_CVT:
+      return 1 + (bi_count_write_registers(I, 0) > 1);
+   case VA_UNIT_SFU:
+      return 4;
+   case VA_UNIT_V:
+      return 8;
+   case VA_UNIT_LS:
+      return 32;
+   case VA_UNIT_T:
+   case VA_UNIT_VT:
+      return 48;
+   case VA_UNIT_NONE:
+      return 0;
+   }
+
+   unreachable("Invalid unit");
+}
+
+static unsigned *
+va_ready_slot(unsigned *ready, unsigned ssa_alloc, bi_index idx, unsigned c)
+{
+   if (idx.type == BI_INDEX_NORMAL)
+      return &ready[idx.value];
+   else if (idx.type == BI_INDEX_REGISTER && (idx.value + c) < 64)
+      return &ready[ssa_alloc + idx.value + c];
+   else
+      return NULL;
+}
+
+/*
+ * Model a block both as a throughput bound (per unit issue rates) and as a
+ * latency bound (the longest dependency chain, weighted by the latency of
+ * each instruction). Works before and after register allocation. The
+ * optimizer can compare candidate lowerings with this or with
+ * va_count_instr_stats directly.
+ */
+void
+va_analyze_block(bi_context *ctx, bi_block *block, struct va_block_perf *perf)
+{
+   /* Ready times of SSA values followed by the 64 registers */
+   unsigned *ready = calloc(ctx->ssa_alloc + 64, sizeof(unsigned));
+
+   memset(perf, 0, sizeof(*perf));
+
+   bi_foreach_instr_in_block(block, I) {
+      unsigned start = 0;
+
+      perf->nr_ins++;
+      va_count_instr_stats(I, &perf->stats);
+
+      bi_foreach_src(I, s) {
+         bi_index src = I->src[s];
+
+         if (src.type == BI_INDEX_NORMAL || src.type == BI_INDEX_REGISTER)
+            perf->reg_reads += bi_count_read_registers(I, s);
+
+         for (unsigned c = 0; c < bi_count_read_registers(I, s); ++c) {
+            unsigned *slot = va_ready_slot(ready, ctx->ssa_alloc, src, c);
+
+            if (slot)
+               start = MAX2(start, *slot);
+
+            /* SSA values are tracked whole */
+            if (src.type != BI_INDEX_REGISTER)
+               break;
+         }
+      }
+
+      unsigned end = start + va_instr_latency(I);
+
+      bi_foreach_dest(I, d) {
+         for (unsigned c = 0; c < bi_count_write_registers(I, d); ++c) {
+            unsigned *slot = va_ready_slot(ready, ctx->ssa_alloc, I->dest[d], c);
+
+            if (slot)
+               *slot = end;
+
+            if (I->dest[d].type != BI_INDEX_REGISTER)
+               break;
+         }
+      }
+
+      perf->latency = MAX2(perf->latency, end);
+   }
+
+   perf->cycles = va_stats_cycles(&perf->stats);
+   free(ready);
+}
+
+/* Print the model for each block of a shader, for the "perf" debug option */
+void
+va_print_perf(FILE *fp, bi_context *ctx)
+{
+   bi_foreach_block(ctx, block) {
+      struct va_block_perf perf;
+      va_analyze_block(ctx, block, &perf);
+
+      fprintf(fp, "block%u: %u inst, %f cycles, %u latency, %u reg reads, "
+              "%u fma, %u cvt, %u sfu, %u v, %u t, %u ls\n",
+              block->index, perf.nr_ins, perf.cycles, perf.latency,
+              perf.reg_reads, perf.stats.fma, perf.stats.cvt,
+              perf.stats.sfu, perf.stats.v, perf.stats.t, perf.stats.ls);
+   }
+}
@@ -10,6 +10,7 @@
 #include "pan_pps_driver.h"
 
 #include <cstring>
+#include <ctime>
 #include <perfetto.h>
 #include <xf86drm.h>
 
@@ -116,7 +117,7 @@ void PanfrostDriver::enable_all_counters()
    }
 }
 
-void PanfrostDriver::enable_perfcnt(const uint64_t /* sampling_period_ns */)
+void PanfrostDriver::enable_perfcnt(const uint64_t sampling_period_ns)
 {
    auto res = perf->enable();
    if (!check(res, "Failed to enable performance counters")) {
@@ -125,10 +126,18 @@ void PanfrostDriver::enable_perfcnt(const uint64_t /* sampling_period_ns */)
       }
       PERFETTO_FATAL("Please verify graphics card");
    }
+
+   // Let the kernel sample at the requested period when it can, rather than
+   // dumping synchronously on every trace iteration
+   periodic = perf->start_sampling(sampling_period_ns) == 0;
 }
 
 bool PanfrostDriver::dump_perfcnt()
 {
+   // Samples are collected by the kernel, and read one at a time by next()
+   if (periodic)
+      return true;
+
    last_dump_ts = perfetto::base::GetBootTimeNs().count();
 
    // Dump performance counters to buffer
@@ -142,6 +151,14 @@ bool PanfrostDriver::dump_perfcnt()
 
 uint64_t PanfrostDriver::next()
 {
+   if (periodic) {
+      uint64_t timestamp = 0;
+      if (perf->read_sample(&timestamp) < 0)
+         return 0;
+
+      return timestamp;
+   }
+
    auto ret = last_dump_ts;
    last_dump_ts = 0;
    return ret;
@@ -150,6 +167,7 @@ uint64_t PanfrostDriver::next()
 void PanfrostDriver::disable_perfcnt()
 {
    perf->disable();
+   periodic = false;
    perf.reset();
    dev.reset();
    groups.clear();
@@ -159,11 +177,20 @@ void PanfrostDriver::disable_perfcnt()
 
 uint32_t PanfrostDriver::gpu_clock_id() const
 {
+   if (periodic)
+      return perfetto::protos::pbzero::BUILTIN_CLOCK_MONOTONIC_RAW;
+
    return perfetto::protos::pbzero::BUILTIN_CLOCK_BOOTTIME;
 }
 
 uint64_t PanfrostDriver::gpu_timestamp() const
 {
+   if (periodic) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+      return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+   }
+
    return perfetto::base::GetBootTimeNs().count();
 }
 
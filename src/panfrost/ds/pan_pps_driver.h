@@ -19,6 +19,8 @@ namespace pps
 /// This driver queries the GPU through `drm/panfrost_drm.h`, using performance counters ioctls,
 /// which can be enabled by setting a kernel parameter: `modprobe panfrost unstable_ioctls=1`.
 /// The ioctl needs a buffer to copy data from kernel to user space.
+/// On kbase, the kernel samples the counters periodically into a ring buffer
+/// instead, timestamping samples with the raw monotonic clock.
 class PanfrostDriver : public Driver
 {
    public:
@@ -46,6 +48,9 @@ class PanfrostDriver : public Driver
 
    uint64_t last_dump_ts = 0;
 
+   /// Whether the kernel samples the counters periodically
+   bool periodic = false;
+
    std::unique_ptr<PanfrostDevice> dev = nullptr;
    std::unique_ptr<PanfrostPerf> perf = nullptr;
 };
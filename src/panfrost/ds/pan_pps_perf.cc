@@ -2,6 +2,7 @@
 
 #include <lib/pan_device.h>
 #include <perf/pan_perf.h>
+#include <util/os_file.h>
 #include <util/ralloc.h>
 #include <pps/pps.h>
 
@@ -12,7 +13,9 @@ PanfrostDevice::PanfrostDevice(int fd)
    , dev {reinterpret_cast<struct panfrost_device*>(new struct panfrost_device())}
 {
    assert(fd >= 0);
-   panfrost_open_device(ctx, fd, dev);
+
+   // The device takes ownership of its fd, which the DRM device also closes
+   panfrost_open_device(ctx, os_dupfd_cloexec(fd), dev);
 }
 
 PanfrostDevice::~PanfrostDevice()
@@ -86,4 +89,16 @@ int PanfrostPerf::dump() const
    return panfrost_perf_dump(perf);
 }
 
+int PanfrostPerf::start_sampling(uint64_t period_ns) const
+{
+   assert(perf);
+   return panfrost_perf_start_sampling(perf, period_ns);
+}
+
+int PanfrostPerf::read_sample(uint64_t *timestamp_ns) const
+{
+   assert(perf);
+   return panfrost_perf_read_sample(perf, timestamp_ns);
+}
+
 } // namespace pps
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 struct panfrost_device;
 struct panfrost_perf;
 
@@ -43,6 +45,8 @@ class PanfrostPerf
    int enable() const;
    void disable() const;
    int dump() const;
+   int start_sampling(uint64_t period_ns) const;
+   int read_sample(uint64_t *timestamp_ns) const;
 
    struct panfrost_perf *perf = nullptr;
 };
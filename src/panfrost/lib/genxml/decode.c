@@ -1654,6 +1654,23 @@ pandecode_cs_command(uint64_t command, mali_ptr va,
                 break;
         }
 
+        case 36: {
+                const char *modes[] = { "none", "clean", "unk2", "clean_inv" };
+
+                if (addr || l & 0xfd00 || (l & 0xc) || (l & 0xc0)) {
+                        pandecode_log("flush_caches (unk %02x), w%02x, "
+                                      "(unk %x)\n", addr, arg2, l);
+                } else {
+                        pandecode_log("flush_caches l2 %s, lsc %s%s, w%02x",
+                                      modes[l & 3], modes[(l >> 4) & 3],
+                                      l & 0x200 ? ", other_inv" : "", arg2);
+                        if (l >> 16)
+                                pandecode_log_cont(", wait 0x%x", l >> 16);
+                        pandecode_log_cont("\n");
+                }
+                break;
+        }
+
         case 37: case 38: case 51: case 52: {
                 /*
                  * 0b 00100101 / 00100110 -- opcode
@@ -42,6 +42,10 @@ FILE *pandecode_dump_stream;
 
 static struct rb_tree mmap_tree;
 
+/* Decoding mostly walks descriptors within a single buffer, so remember the
+ * last mapping found to skip the tree search */
+static struct pandecode_mapped_memory *last_hit;
+
 static struct util_dynarray ro_mappings;
 
 static simple_mtx_t pandecode_lock = SIMPLE_MTX_INITIALIZER;
@@ -60,16 +64,20 @@ pandecode_cmp_key(const struct rb_node *lhs, const void *key)
         struct pandecode_mapped_memory *mem = to_mapped_memory(lhs);
         uint64_t *gpu_va = (uint64_t *) key;
 
+        /* The difference of two addresses doesn't fit in the int result */
         if (mem->gpu_va <= *gpu_va && *gpu_va < (mem->gpu_va + mem->length))
                 return 0;
         else
-                return mem->gpu_va - *gpu_va;
+                return mem->gpu_va > *gpu_va ? 1 : -1;
 }
 
 static int
 pandecode_cmp(const struct rb_node *lhs, const struct rb_node *rhs)
 {
-        return to_mapped_memory(lhs)->gpu_va - to_mapped_memory(rhs)->gpu_va;
+        uint64_t a = to_mapped_memory(lhs)->gpu_va;
+        uint64_t b = to_mapped_memory(rhs)->gpu_va;
+
+        return (a > b) - (a < b);
 }
 
 static struct pandecode_mapped_memory *
@@ -77,8 +85,15 @@ pandecode_find_mapped_gpu_mem_containing_rw(uint64_t addr)
 {
         simple_mtx_assert_locked(&pandecode_lock);
 
+        if (last_hit && last_hit->gpu_va <= addr &&
+            addr < (last_hit->gpu_va + last_hit->length))
+                return last_hit;
+
         struct rb_node *node = rb_tree_search(&mmap_tree, &addr, pandecode_cmp_key);
 
+        if (node)
+                last_hit = to_mapped_memory(node);
+
         return to_mapped_memory(node);
 }
 
@@ -169,6 +184,9 @@ pandecode_inject_free(uint64_t gpu_va, unsigned sz)
                 assert(mem->gpu_va == gpu_va);
                 assert(mem->length == sz);
 
+                if (last_hit == mem)
+                        last_hit = NULL;
+
                 rb_tree_remove(&mmap_tree, &mem->node);
                 free(mem);
         }
@@ -272,6 +290,8 @@ pandecode_close(void)
                 free(it);
         }
 
+        last_hit = NULL;
+
         util_dynarray_fini(&ro_mappings);
         pandecode_dump_file_close();
 
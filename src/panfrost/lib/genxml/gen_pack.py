@@ -176,6 +176,31 @@ static inline void pan_merge_helper(uint32_t *dst, const uint32_t *src, size_t b
 #define pan_merge(packed1, packed2, type) \
         pan_merge_helper((packed1).opaque, (packed2).opaque, pan_size(type))
 
+static inline void
+pan_pack_template_helper(uint32_t *dst, const uint32_t *packed,
+                         const uint32_t *template, size_t bytes)
+{
+        assert((bytes & 3) == 0);
+
+        for (unsigned i = 0; i < (bytes / 4); ++i)
+                dst[i] = packed[i] | template[i];
+}
+
+/* Like pan_pack, but ORs in a template packed ahead of time, usually at CSO
+ * creation, so only the fields that change between uses are set in the body.
+ * Fields set in the body must be left at their defaults in the template and
+ * vice versa. The descriptor is staged on the stack and written to dst once,
+ * so dst may be write-combined memory. */
+#define pan_pack_template(dst, T, template, name)                         \
+   for (struct PREFIX1(T) name = { PREFIX2(T, header) },                \
+        *_loop_terminate = (void *) (dst);                              \
+        __builtin_expect(_loop_terminate != NULL, 1);                   \
+        ({ uint32_t _staged[pan_size(T) / 4];                           \
+           PREFIX2(T, pack)(_staged, &name);                            \
+           pan_pack_template_helper((uint32_t *) (dst), _staged,        \
+                                    (template).opaque, pan_size(T));    \
+           _loop_terminate = NULL; }))
+
 /* From presentations, 16x16 tiles externally. Use shift for fast computation
  * of tile numbers. */
 
@@ -176,6 +176,18 @@ panfrost_afbc_can_ytr(enum pipe_format format)
         return desc->colorspace == UTIL_FORMAT_COLORSPACE_RGB;
 }
 
+/*
+ * Split blocks (AFBC_FORMAT_MOD_SPLIT) store the two halves of each 16x16
+ * superblock separately, which some display engines require for scanout.
+ * The descriptors can only express them on Bifrost and newer, and they are
+ * only defined for the same formats as YTR.
+ */
+bool
+panfrost_afbc_can_split(unsigned arch, enum pipe_format format)
+{
+        return arch >= 6 && panfrost_afbc_can_ytr(format);
+}
+
 /*
  * Check if the device supports AFBC with tiled headers (and hence also solid
  * colour blocks).
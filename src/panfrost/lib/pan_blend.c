@@ -102,23 +102,33 @@ can_fixed_function_equation(enum blend_func blend_func,
 }
 
 static unsigned
-blend_factor_constant_mask(enum blend_factor factor)
+blend_factor_constant_mask(enum blend_factor factor, unsigned channels)
 {
         if (factor == BLEND_FACTOR_CONSTANT_COLOR)
-                return 0b0111; /* RGB */
+                return channels; /* Per-channel */
         else if (factor == BLEND_FACTOR_CONSTANT_ALPHA)
-                return 0b1000; /* A */
+                return channels ? 0b1000 : 0b0000; /* A */
         else
                 return 0b0000; /* - */
 }
 
+/* Constants are only read for channels that are written, so a constant colour
+ * factor only reads the components of the colour mask. Tracking this
+ * precisely lets more states pass the homogenous constant check */
+
 unsigned
 pan_blend_constant_mask(const struct pan_blend_equation eq)
 {
-        return blend_factor_constant_mask(eq.rgb_src_factor) |
-               blend_factor_constant_mask(eq.rgb_dst_factor) |
-               blend_factor_constant_mask(eq.alpha_src_factor) |
-               blend_factor_constant_mask(eq.alpha_dst_factor);
+        if (!eq.blend_enable)
+                return 0;
+
+        unsigned rgb = eq.color_mask & 0b0111;
+        unsigned alpha = eq.color_mask & 0b1000;
+
+        return blend_factor_constant_mask(eq.rgb_src_factor, rgb) |
+               blend_factor_constant_mask(eq.rgb_dst_factor, rgb) |
+               blend_factor_constant_mask(eq.alpha_src_factor, alpha) |
+               blend_factor_constant_mask(eq.alpha_dst_factor, alpha);
 }
 
 /* Only "homogenous" (scalar or vector with all components equal) constants are
@@ -465,6 +475,42 @@ pan_pack_blend(const struct pan_blend_equation equation)
         return out;
 }
 
+/* Translate an equation to the nir_lower_blend state of a render target.
+ * Disabled blending is expressed as a replace, so the colour mask still
+ * applies. */
+
+void
+pan_blend_to_nir_lower_blend_rt(const struct pan_blend_equation equation,
+                                nir_lower_blend_rt *rt)
+{
+        rt->colormask = equation.color_mask;
+
+        if (!equation.blend_enable) {
+                static const nir_lower_blend_channel replace = {
+                        .func = BLEND_FUNC_ADD,
+                        .src_factor = BLEND_FACTOR_ZERO,
+                        .invert_src_factor = true,
+                        .dst_factor = BLEND_FACTOR_ZERO,
+                        .invert_dst_factor = false,
+                };
+
+                rt->rgb = replace;
+                rt->alpha = replace;
+                return;
+        }
+
+        rt->rgb.func = equation.rgb_func;
+        rt->rgb.src_factor = equation.rgb_src_factor;
+        rt->rgb.invert_src_factor = equation.rgb_invert_src_factor;
+        rt->rgb.dst_factor = equation.rgb_dst_factor;
+        rt->rgb.invert_dst_factor = equation.rgb_invert_dst_factor;
+        rt->alpha.func = equation.alpha_func;
+        rt->alpha.src_factor = equation.alpha_src_factor;
+        rt->alpha.invert_src_factor = equation.alpha_invert_src_factor;
+        rt->alpha.dst_factor = equation.alpha_dst_factor;
+        rt->alpha.invert_dst_factor = equation.alpha_invert_dst_factor;
+}
+
 static uint32_t pan_blend_shader_key_hash(const void *key)
 {
         return _mesa_hash_data(key, sizeof(struct pan_blend_shader_key));
@@ -640,33 +686,10 @@ GENX(pan_blend_create_shader)(const struct panfrost_device *dev,
         nir_lower_blend_options options = {
                 .logicop_enable = state->logicop_enable,
                 .logicop_func = state->logicop_func,
-                .rt[0].colormask = rt_state->equation.color_mask,
                 .format[0] = rt_state->format
         };
 
-        if (!rt_state->equation.blend_enable) {
-                static const nir_lower_blend_channel replace = {
-                        .func = BLEND_FUNC_ADD,
-                        .src_factor = BLEND_FACTOR_ZERO,
-                        .invert_src_factor = true,
-                        .dst_factor = BLEND_FACTOR_ZERO,
-                        .invert_dst_factor = false,
-                };
-
-                options.rt[0].rgb = replace;
-                options.rt[0].alpha = replace;
-        } else {
-                options.rt[0].rgb.func = rt_state->equation.rgb_func;
-                options.rt[0].rgb.src_factor = rt_state->equation.rgb_src_factor;
-                options.rt[0].rgb.invert_src_factor = rt_state->equation.rgb_invert_src_factor;
-                options.rt[0].rgb.dst_factor = rt_state->equation.rgb_dst_factor;
-                options.rt[0].rgb.invert_dst_factor = rt_state->equation.rgb_invert_dst_factor;
-                options.rt[0].alpha.func = rt_state->equation.alpha_func;
-                options.rt[0].alpha.src_factor = rt_state->equation.alpha_src_factor;
-                options.rt[0].alpha.invert_src_factor = rt_state->equation.alpha_invert_src_factor;
-                options.rt[0].alpha.dst_factor = rt_state->equation.alpha_dst_factor;
-                options.rt[0].alpha.invert_dst_factor = rt_state->equation.alpha_invert_dst_factor;
-        }
+        pan_blend_to_nir_lower_blend_rt(rt_state->equation, &options.rt[0]);
 
         nir_alu_type src_types[] = { src0_type ?: nir_type_float32, src1_type ?: nir_type_float32 };
 
@@ -857,7 +880,7 @@ GENX(pan_blend_get_shader_locked)(const struct panfrost_device *dev,
 
         struct pan_shader_info info;
 
-        GENX(pan_shader_compile)(nir, &inputs, &variant->binary, &info);
+        GENX(pan_shader_compile_cached)(dev, nir, &inputs, &variant->binary, &info);
 
         /* Blend shaders can't have sysvals */
         assert(info.sysvals.sysval_count == 0);
@@ -31,6 +31,7 @@
 #include "util/format/u_format.h"
 #include "compiler/shader_enums.h"
 #include "compiler/nir/nir.h"
+#include "compiler/nir/nir_lower_blend.h"
 
 #include "panfrost/util/pan_ir.h"
 
@@ -117,6 +118,10 @@ pan_blend_alpha_one_store(const struct pan_blend_equation eq);
 unsigned
 pan_blend_constant_mask(const struct pan_blend_equation eq);
 
+void
+pan_blend_to_nir_lower_blend_rt(const struct pan_blend_equation equation,
+                                nir_lower_blend_rt *rt);
+
 /* Fixed-function blending only supports a single constant, so if multiple bits
  * are set in constant_mask, the constants must match. Therefore we may pick
  * just the first constant. */
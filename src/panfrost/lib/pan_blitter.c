@@ -603,7 +603,7 @@ pan_blitter_get_blit_shader(struct panfrost_device *dev,
         for (unsigned i = 0; i < active_count; ++i)
                 BITSET_SET(b.shader->info.textures_used, i);
 
-        GENX(pan_shader_compile)(b.shader, &inputs, &binary, &shader->info);
+        GENX(pan_shader_compile_cached)(dev, b.shader, &inputs, &binary, &shader->info);
 
         /* Blit shaders shouldn't have sysvals */
         assert(shader->info.sysvals.sysval_count == 0);
@@ -1087,11 +1087,21 @@ pan_preload_emit_dcd(struct pan_pool *pool,
                         maxx = fb->width - 1;
                         maxy = fb->height - 1;
                 } else {
+                        unsigned x0 = fb->extent.minx, y0 = fb->extent.miny;
+                        unsigned x1 = fb->extent.maxx, y1 = fb->extent.maxy;
+
+                        if (fb->preload_region.enable) {
+                                x0 = MAX2(x0, fb->preload_region.minx);
+                                y0 = MAX2(y0, fb->preload_region.miny);
+                                x1 = MIN2(x1, fb->preload_region.maxx);
+                                y1 = MIN2(y1, fb->preload_region.maxy);
+                        }
+
                         /* Align on 32x32 tiles */
-                        minx = fb->extent.minx & ~31;
-                        miny = fb->extent.miny & ~31;
-                        maxx = MIN2(ALIGN_POT(fb->extent.maxx + 1, 32), fb->width) - 1;
-                        maxy = MIN2(ALIGN_POT(fb->extent.maxy + 1, 32), fb->height) - 1;
+                        minx = x0 & ~31;
+                        miny = y0 & ~31;
+                        maxx = MIN2(ALIGN_POT(x1 + 1, 32), fb->width) - 1;
+                        maxy = MIN2(ALIGN_POT(y1 + 1, 32), fb->height) - 1;
                 }
 
                 cfg.thread_storage = tsd;
@@ -1601,8 +1611,8 @@ static bool pan_blit_rsd_key_equal(const void *a, const void *b)
         return !memcmp(a, b, sizeof(struct pan_blit_rsd_key));
 }
 
-static void
-pan_blitter_prefill_blit_shader_cache(struct panfrost_device *dev)
+void
+GENX(pan_blitter_prefill)(struct panfrost_device *dev)
 {
         static const struct pan_blit_shader_key prefill[] = {
                 {
@@ -1651,7 +1661,6 @@ GENX(pan_blitter_init)(struct panfrost_device *dev,
                                         pan_blit_blend_shader_key_equal);
         dev->blitter.shaders.pool = bin_pool;
         pthread_mutex_init(&dev->blitter.shaders.lock, NULL);
-        pan_blitter_prefill_blit_shader_cache(dev);
 
         dev->blitter.rsds.pool = desc_pool;
         dev->blitter.rsds.rsds =
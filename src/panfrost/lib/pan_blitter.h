@@ -89,6 +89,11 @@ GENX(pan_blitter_init)(struct panfrost_device *dev,
 void
 GENX(pan_blitter_cleanup)(struct panfrost_device *dev);
 
+/* Compile the most common blit shaders ahead of their first use. Shaders are
+ * otherwise compiled on demand. */
+void
+GENX(pan_blitter_prefill)(struct panfrost_device *dev);
+
 unsigned
 GENX(pan_preload_fb)(struct pan_pool *desc_pool,
                      struct pan_scoreboard *scoreboard,
@@ -28,15 +28,20 @@
 #include <fcntl.h>
 #include <xf86drm.h>
 #include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include "drm-uapi/panfrost_drm.h"
 
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_device.h"
 #include "pan_util.h"
 #include "wrap.h"
 
 #include "util/os_mman.h"
 
+#include "util/bitset.h"
 #include "util/u_inlines.h"
 #include "util/u_math.h"
 #include "util/os_file.h"
@@ -47,15 +52,39 @@
  * solves both of these problems and does not require kernel updates.
  *
  * Cached BOs are sorted into a bucket based on rounding their size down to the
- * nearest power-of-two. Each bucket contains a linked list of free panfrost_bo
- * objects. Putting a BO into the cache is accomplished by adding it to the
+ * nearest quarter of a power-of-two. Each bucket contains a linked list of free
+ * panfrost_bo objects. Putting a BO into the cache is accomplished by adding it to the
  * corresponding bucket. Getting a BO from the cache consists of finding the
  * appropriate bucket and sorting. A cache eviction is a kernel-level free of a
  * BO and removing it from the bucket. We special case evicting all BOs from
  * the cache, since that's what helpful in practice and avoids extra logic
  * around the linked list.
+ *
+ * With kbase, BOs smaller than 64 KB are additionally sub-allocated from
+ * "slabs", 2 MB parent BOs split into entries of a single power-of-two size
+ * class. This avoids a kernel roundtrip and a separate GPU VA region for every
+ * small allocation. Sub-BOs still get their own handle, as everything from the
+ * BO map to batch access tracking is keyed by handle, but the handle is only a
+ * userspace table entry. The parent BO is freed once all of its entries have
+ * been released, unless it is the last slab of its size class.
  */
 
+/* Flags which affect the kbase allocation, other flags can share a slab */
+#define PAN_BO_SLAB_FLAGS (PAN_BO_EXECUTE | PAN_BO_CACHEABLE)
+
+struct panfrost_bo_slab {
+        struct list_head link;
+
+        /* BO which owns the memory, never returned by panfrost_bo_create */
+        struct panfrost_bo *parent;
+
+        uint32_t flags;
+        unsigned order;
+
+        unsigned num_free;
+        BITSET_DECLARE(free, PAN_BO_SLAB_SIZE >> MIN_BO_SLAB_ORDER);
+};
+
 static struct panfrost_bo *
 panfrost_bo_alloc(struct panfrost_device *dev, size_t size,
                   uint32_t flags, const char *label)
@@ -66,7 +95,7 @@ panfrost_bo_alloc(struct panfrost_device *dev, size_t size,
 
         if (dev->kernel_version->version_major > 1 ||
             dev->kernel_version->version_minor >= 1) {
-                if (flags & PAN_BO_GROWABLE)
+                if (flags & (PAN_BO_GROWABLE | PAN_BO_SPARSE))
                         create_bo.flags |= PANFROST_BO_HEAP;
                 if (!(flags & PAN_BO_EXECUTE))
                         create_bo.flags |= PANFROST_BO_NOEXEC;
@@ -87,6 +116,9 @@ panfrost_bo_alloc(struct panfrost_device *dev, size_t size,
                                 create_bo.flags |= MALI_BO_UNCACHED_GPU;
                 }
 
+                if (flags & PAN_BO_LARGE_PAGES)
+                        create_bo.flags |= MALI_BO_LARGE_PAGES;
+
                 unsigned mali_flags = (flags & PAN_BO_EVENT) ? 0x8200f : 0;
 
                 struct base_ptr p = dev->mali.alloc(&dev->mali, size, create_bo.flags, mali_flags);
@@ -98,6 +130,15 @@ panfrost_bo_alloc(struct panfrost_device *dev, size_t size,
                         if (!cpu)
                                 abort();
                         ret = 0;
+
+                        /* Out of handles, release the memory */
+                        if (create_bo.handle == -1) {
+                                os_munmap(cpu, size);
+                                if ((uintptr_t) cpu != p.gpu)
+                                        dev->mali.free(&dev->mali, p.gpu);
+                                errno = ENOMEM;
+                                ret = -1;
+                        }
                 } else {
                         ret = -1;
                 }
@@ -126,6 +167,167 @@ panfrost_bo_alloc(struct panfrost_device *dev, size_t size,
         return bo;
 }
 
+static void
+panfrost_bo_free(struct panfrost_bo *bo);
+
+static bool
+panfrost_bo_slab_eligible(struct panfrost_device *dev, size_t size,
+                          uint32_t flags)
+{
+        /* Sub-allocation would hide use-after-free bugs, so disable it along
+         * with the BO cache */
+        if (!dev->kbase || (dev->debug & PAN_DBG_NO_CACHE))
+                return false;
+
+        if (flags & (PAN_BO_SHARED | PAN_BO_GROWABLE | PAN_BO_SPARSE |
+                     PAN_BO_EVENT))
+                return false;
+
+        return size < (1 << MAX_BO_SLAB_ORDER);
+}
+
+static bool
+panfrost_bo_large_pages_eligible(struct panfrost_device *dev, size_t size,
+                                 uint32_t flags)
+{
+        if (!dev->kbase || size < PAN_LARGE_PAGE_MIN_SIZE)
+                return false;
+
+        return !(flags & (PAN_BO_EXECUTE | PAN_BO_GROWABLE | PAN_BO_SPARSE |
+                          PAN_BO_SHARED | PAN_BO_EVENT));
+}
+
+static void
+panfrost_bo_slab_destroy(struct panfrost_bo_slab *slab)
+{
+        list_del(&slab->link);
+        panfrost_bo_free(slab->parent);
+        free(slab);
+}
+
+static void
+panfrost_bo_slab_put(struct panfrost_device *dev,
+                     struct panfrost_bo_slab *slab, unsigned index)
+{
+        pthread_mutex_lock(&dev->bo_slab.lock);
+
+        assert(!BITSET_TEST(slab->free, index));
+        BITSET_SET(slab->free, index);
+
+        struct list_head *slabs =
+                &dev->bo_slab.slabs[slab->order - MIN_BO_SLAB_ORDER];
+
+        /* Move the slab away from the full slabs at the end */
+        if (!slab->num_free++) {
+                list_del(&slab->link);
+                list_add(&slab->link, slabs);
+        }
+
+        if (slab->num_free == (PAN_BO_SLAB_SIZE >> slab->order)) {
+                /* Keep one slab around to avoid allocating a new one for the
+                 * next small BO */
+                list_for_each_entry(struct panfrost_bo_slab, entry, slabs, link) {
+                        if (entry != slab && entry->flags == slab->flags) {
+                                panfrost_bo_slab_destroy(slab);
+                                break;
+                        }
+                }
+        }
+
+        pthread_mutex_unlock(&dev->bo_slab.lock);
+}
+
+static struct panfrost_bo *
+panfrost_bo_slab_alloc(struct panfrost_device *dev, size_t size,
+                       uint32_t flags, const char *label)
+{
+        unsigned order = MAX2(util_logbase2_ceil(size), MIN_BO_SLAB_ORDER);
+        unsigned count = PAN_BO_SLAB_SIZE >> order;
+        uint32_t slab_flags = flags & PAN_BO_SLAB_FLAGS;
+        struct list_head *slabs = &dev->bo_slab.slabs[order - MIN_BO_SLAB_ORDER];
+        struct panfrost_bo_slab *slab = NULL;
+
+        pthread_mutex_lock(&dev->bo_slab.lock);
+
+        /* Full slabs are kept at the end of the list */
+        list_for_each_entry(struct panfrost_bo_slab, entry, slabs, link) {
+                if (entry->flags == slab_flags && entry->num_free) {
+                        slab = entry;
+                        break;
+                }
+        }
+
+        if (!slab) {
+                struct panfrost_bo *parent =
+                        panfrost_bo_alloc(dev, PAN_BO_SLAB_SIZE, slab_flags,
+                                          "Slab");
+                if (!parent) {
+                        pthread_mutex_unlock(&dev->bo_slab.lock);
+                        return NULL;
+                }
+
+                slab = calloc(1, sizeof(*slab));
+                if (!slab) {
+                        panfrost_bo_free(parent);
+                        pthread_mutex_unlock(&dev->bo_slab.lock);
+                        return NULL;
+                }
+
+                slab->parent = parent;
+                slab->flags = slab_flags;
+                slab->order = order;
+                slab->num_free = count;
+                BITSET_SET_RANGE(slab->free, 0, count - 1);
+                list_add(&slab->link, slabs);
+        }
+
+        unsigned index = BITSET_FFS(slab->free) - 1;
+        BITSET_CLEAR(slab->free, index);
+
+        if (!--slab->num_free) {
+                list_del(&slab->link);
+                list_addtail(&slab->link, slabs);
+        }
+
+        pthread_mutex_unlock(&dev->bo_slab.lock);
+
+        size_t offset = (size_t) index << order;
+        mali_ptr gpu = slab->parent->ptr.gpu + offset;
+        int handle = kbase_alloc_gem_handle(&dev->mali, gpu, -1);
+
+        if (handle == -1) {
+                panfrost_bo_slab_put(dev, slab, index);
+                return NULL;
+        }
+
+        struct panfrost_bo *bo = pan_lookup_bo(dev, handle);
+        assert(!memcmp(bo, &((struct panfrost_bo){}), sizeof(*bo)));
+
+        bo->size = 1 << order;
+        bo->ptr.gpu = gpu;
+        bo->ptr.cpu = slab->parent->ptr.cpu + offset;
+        bo->gem_handle = handle;
+        bo->flags = flags;
+        bo->dev = dev;
+        bo->label = label;
+        bo->cached = slab->parent->cached;
+        bo->dmabuf_fd = -1;
+        bo->slab = slab;
+        return bo;
+}
+
+/* Returns the memory of a sub-allocated BO to its slab, called by
+ * panfrost_bo_free after the GPU has finished with the BO */
+
+static void
+panfrost_bo_slab_release(struct panfrost_bo *bo)
+{
+        struct panfrost_bo_slab *slab = bo->slab;
+
+        panfrost_bo_slab_put(bo->dev, slab,
+                             (bo->ptr.gpu - slab->parent->ptr.gpu) >> slab->order);
+}
+
 static void
 panfrost_bo_free(struct panfrost_bo *bo)
 {
@@ -144,7 +346,12 @@ panfrost_bo_free(struct panfrost_bo *bo)
                 fflush(NULL);
         }
 
-        if (dev->kbase) {
+        if (bo->slab) {
+                /* The memory is owned by the parent BO */
+                kbase_free_gem_handle(&dev->mali, bo->gem_handle);
+                panfrost_bo_slab_release(bo);
+                ret = 0;
+        } else if (dev->kbase) {
                 os_munmap(bo->ptr.cpu, bo->size);
                 if (bo->munmap_ptr)
                         os_munmap(bo->munmap_ptr, bo->size);
@@ -164,6 +371,46 @@ panfrost_bo_free(struct panfrost_bo *bo)
         memset(bo, 0, sizeof(*bo));
 }
 
+/* Removes usages which have finished, or which refer to queues that no longer
+ * exist, so that BOs used by every batch don't accumulate entries. Must be
+ * called with the usage lock of the BO held. */
+void
+panfrost_bo_usage_compact(struct panfrost_bo *bo)
+{
+        kbase k = &bo->dev->mali;
+
+        struct panfrost_usage *rebuild = util_dynarray_begin(&bo->usage);
+        unsigned index = 0;
+        unsigned slot_count = p_atomic_read(&k->event_slot_usage);
+
+        util_dynarray_foreach(&bo->usage, struct panfrost_usage, u) {
+                /* Usages are ordered, so everything else is also invalid */
+                if (u->queue >= slot_count)
+                        break;
+
+                if (!kbase_event_slot_live(k, u->queue))
+                        continue;
+
+                struct kbase_event_slot *slot = kbase_event_slot_get(k, u->queue);
+                uint64_t last_submit = p_atomic_read(&slot->last_submit);
+
+                /* The seqnum is from a previous user of the slot */
+                if (last_submit < u->seqnum)
+                        continue;
+
+                /* Usages by a batch which is still being submitted are kept
+                 * even if the previous batch has finished */
+                if (last_submit != u->seqnum &&
+                    p_atomic_read(&slot->last) > u->seqnum)
+                        continue;
+
+                rebuild[index++] = *u;
+        }
+
+        /* No need to check the return value, it can only shrink */
+        (void)! util_dynarray_resize(&bo->usage, struct panfrost_usage, index);
+}
+
 static bool
 panfrost_bo_usage_finished(struct panfrost_bo *bo, bool readers)
 {
@@ -172,8 +419,14 @@ panfrost_bo_usage_finished(struct panfrost_bo *bo, bool readers)
 
         bool ret = true;
 
-        pthread_mutex_lock(&dev->bo_usage_lock);
-        pthread_mutex_lock(&dev->mali.queue_lock);
+        /* The event slot fields are accessed atomically, so there is no need
+         * to take the queue lock */
+        pthread_mutex_t *lock = pan_bo_usage_lock(dev, bo->gem_handle);
+        pthread_mutex_lock(lock);
+
+        panfrost_bo_usage_compact(bo);
+
+        unsigned slot_count = p_atomic_read(&k->event_slot_usage);
 
         util_dynarray_foreach(&bo->usage, struct panfrost_usage, u) {
                 /* Skip if we are only waiting for writers */
@@ -181,28 +434,32 @@ panfrost_bo_usage_finished(struct panfrost_bo *bo, bool readers)
                         continue;
 
                 /* Usages are ordered, so everything else is also invalid */
-                if (u->queue >= k->event_slot_usage)
+                if (u->queue >= slot_count)
                         break;
 
-                struct kbase_event_slot *slot = &k->event_slots[u->queue];
+                /* The queue has been destroyed, so the usage is finished */
+                if (!kbase_event_slot_live(k, u->queue))
+                        continue;
+
+                struct kbase_event_slot *slot = kbase_event_slot_get(k, u->queue);
+                uint64_t last_submit = p_atomic_read(&slot->last_submit);
                 uint64_t seqnum = u->seqnum;
 
                 /* There is a race condition, where we can depend on an
                  * unsubmitted batch. In that cade, decrease the seqnum.
-                 * Otherwise, skip invalid dependencies. TODO: do GC? */
-                if (slot->last_submit == seqnum)
+                 * Otherwise, skip invalid dependencies. */
+                if (last_submit == seqnum)
                         --seqnum;
-                else if (slot->last_submit < seqnum)
+                else if (last_submit < seqnum)
                         continue;
 
-                if (slot->last <= seqnum) {
+                if (p_atomic_read(&slot->last) <= seqnum) {
                         ret = false;
                         break;
                 }
         }
 
-        pthread_mutex_unlock(&dev->mali.queue_lock);
-        pthread_mutex_unlock(&dev->bo_usage_lock);
+        pthread_mutex_unlock(lock);
 
         return ret;
 }
@@ -305,29 +562,61 @@ panfrost_bo_mem_clean(struct panfrost_bo *bo, size_t offset, size_t length)
         panfrost_bo_mem_op(bo, offset, length, false);
 }
 
+/* Gives back the physical pages of an idle growable BO, which the kernel
+ * commits again as the GPU faults on it. The contents are lost. */
+void
+panfrost_bo_decommit(struct panfrost_bo *bo)
+{
+        struct panfrost_device *dev = bo->dev;
+
+        assert(bo->flags & PAN_BO_GROWABLE);
+
+        if (dev->kbase && dev->mali.mem_commit)
+                dev->mali.mem_commit(&dev->mali, bo->ptr.gpu, 0);
+}
+
+/* Makes the first size bytes of a sparse BO resident, and gives back the pages
+ * after them. kbase only resizes the backing of a region from its start, so
+ * callers commit up to the last page they need. */
+bool
+panfrost_bo_commit(struct panfrost_bo *bo, size_t size)
+{
+        struct panfrost_device *dev = bo->dev;
+
+        assert(bo->flags & PAN_BO_SPARSE);
+        assert(size <= bo->size);
+
+        if (!dev->mali.mem_commit)
+                return false;
+
+        return dev->mali.mem_commit(&dev->mali, bo->ptr.gpu,
+                                    DIV_ROUND_UP(size, dev->mali.page_size));
+}
+
 /* Helper to calculate the bucket index of a BO */
 
 static unsigned
 pan_bucket_index(unsigned size)
 {
-        /* Round down to POT to compute a bucket index */
+        /* Round down to POT to compute the level */
 
-        unsigned bucket_index = util_logbase2(size);
+        unsigned level = util_logbase2(size);
 
-        /* Clamp the bucket index; all huge allocations will be
-         * sorted into the largest bucket */
+        /* All huge allocations will be sorted into the largest bucket */
 
-        bucket_index = CLAMP(bucket_index, MIN_BO_CACHE_BUCKET,
-                             MAX_BO_CACHE_BUCKET);
+        if (level >= MAX_BO_CACHE_BUCKET)
+                return NR_BO_CACHE_BUCKETS - 1;
 
-        /* Reindex from 0 */
-        return (bucket_index - MIN_BO_CACHE_BUCKET);
-}
+        level = MAX2(level, MIN_BO_CACHE_BUCKET);
 
-static struct list_head *
-pan_bucket(struct panfrost_device *dev, unsigned size)
-{
-        return &dev->bo_cache.buckets[pan_bucket_index(size)];
+        /* The bits below the leading one select the bucket within the
+         * level */
+        unsigned sub = (size >> (level - BO_CACHE_BUCKET_SPLIT_BITS)) &
+                BITFIELD_MASK(BO_CACHE_BUCKET_SPLIT_BITS);
+
+        /* Reindex from 0 */
+        return ((level - MIN_BO_CACHE_BUCKET) << BO_CACHE_BUCKET_SPLIT_BITS) +
+                sub;
 }
 
 /* Tries to fetch a BO of sufficient size with the appropriate flags from the
@@ -341,8 +630,26 @@ panfrost_bo_cache_fetch(struct panfrost_device *dev,
                         bool dontwait)
 {
         pthread_mutex_lock(&dev->bo_cache.lock);
-        struct list_head *bucket = pan_bucket(dev, size);
+        unsigned index = pan_bucket_index(size);
+        struct list_head *bucket = &dev->bo_cache.buckets[index];
         struct panfrost_bo *bo = NULL;
+        struct panfrost_bo *best = NULL;
+
+        /* The largest bucket has no upper bound on the size, so look for the
+         * best fit rather than taking the first BO which is large enough */
+        if (index == NR_BO_CACHE_BUCKETS - 1) {
+                list_for_each_entry(struct panfrost_bo, entry, bucket,
+                                    bucket_link) {
+                        if (entry->size < size || entry->flags != flags)
+                                continue;
+
+                        if (!best || entry->size < best->size)
+                                best = entry;
+
+                        if (entry->size == size)
+                                break;
+                }
+        }
 
         /* Iterate the bucket looking for something suitable */
         list_for_each_entry_safe(struct panfrost_bo, entry, bucket,
@@ -350,6 +657,9 @@ panfrost_bo_cache_fetch(struct panfrost_device *dev,
                 if (entry->size < size || entry->flags != flags)
                         continue;
 
+                if (best && entry != best)
+                        continue;
+
                 /* If the oldest BO in the cache is busy, likely so is
                  * everything newer, so bail. */
 
@@ -370,10 +680,14 @@ panfrost_bo_cache_fetch(struct panfrost_device *dev,
                 /* This one works, splice it out of the cache */
                 list_del(&entry->bucket_link);
                 list_del(&entry->lru_link);
+                dev->bo_cache.size -= entry->size;
 
                 if (dev->kbase) {
-                        /* With kbase, BOs are never freed from the cache */
-                        madv.retained = true;
+                        /* The kernel might have reclaimed purgeable BOs */
+                        madv.retained = !entry->purgeable ||
+                                dev->mali.mem_purgeable(&dev->mali,
+                                                        entry->ptr.gpu, false);
+                        entry->purgeable = false;
                 } else {
                         ret = drmIoctl(dev->fd, DRM_IOCTL_PANFROST_MADVISE, &madv);
                 }
@@ -386,36 +700,91 @@ panfrost_bo_cache_fetch(struct panfrost_device *dev,
                 bo->label = label;
                 break;
         }
+
+        /* Retries after a failed allocation are not counted as misses */
+        if (bo)
+                ++dev->bo_cache.hits[index];
+        else if (dontwait)
+                ++dev->bo_cache.misses[index];
+
         pthread_mutex_unlock(&dev->bo_cache.lock);
 
         return bo;
 }
 
-static void
-panfrost_bo_cache_evict_stale_bos(struct panfrost_device *dev)
+static uint64_t
+pan_bo_cache_time_ms(void)
 {
         struct timespec time;
 
         clock_gettime(CLOCK_MONOTONIC, &time);
+        return (uint64_t) time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+/* Drops all entries which have not been used for longer than the retention
+ * period. Must be called with the cache lock held. */
+
+static void
+panfrost_bo_cache_evict_stale_bos(struct panfrost_device *dev, uint64_t now)
+{
         list_for_each_entry_safe(struct panfrost_bo, entry,
                                  &dev->bo_cache.lru, lru_link) {
-                /* We want all entries that have been used more than 1 sec
-                 * ago to be dropped, others can be kept.
-                 * Note the <= 2 check and not <= 1. It's here to account for
-                 * the fact that we're only testing ->tv_sec, not ->tv_nsec.
-                 * That means we might keep entries that are between 1 and 2
-                 * seconds old, but we don't really care, as long as unused BOs
-                 * are dropped at some point.
-                 */
-                if (time.tv_sec - entry->last_used <= 2)
+                if (now - entry->last_used <= dev->bo_cache.retention_ms)
                         break;
 
                 list_del(&entry->bucket_link);
                 list_del(&entry->lru_link);
+                dev->bo_cache.size -= entry->size;
                 panfrost_bo_free(entry);
         }
 }
 
+/* Evicts the least recently used BOs until at most target bytes are cached.
+ * Must be called with the cache lock held. */
+
+static void
+panfrost_bo_cache_trim(struct panfrost_device *dev, size_t target)
+{
+        list_for_each_entry_safe(struct panfrost_bo, entry,
+                                 &dev->bo_cache.lru, lru_link) {
+                if (dev->bo_cache.size <= target)
+                        break;
+
+                list_del(&entry->bucket_link);
+                list_del(&entry->lru_link);
+                dev->bo_cache.size -= entry->size;
+                panfrost_bo_free(entry);
+        }
+}
+
+static bool
+panfrost_bo_cache_under_pressure(struct panfrost_device *dev, uint64_t now)
+{
+        if (dev->bo_cache.psi_fd == -1 ||
+            now - dev->bo_cache.last_pressure_check < 1000)
+                return false;
+
+        dev->bo_cache.last_pressure_check = now;
+
+        struct pollfd pfd = {
+                .fd = dev->bo_cache.psi_fd,
+                .events = POLLPRI,
+        };
+
+        return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLPRI);
+}
+
+/* Only plain kbase allocations can be made purgeable; sub-allocated BOs share
+ * their region, and executable BOs may not start at the region base */
+
+static bool
+panfrost_bo_can_purge(struct panfrost_bo *bo)
+{
+        return bo->dev->kbase && !bo->slab &&
+               !(bo->flags & (PAN_BO_EXECUTE | PAN_BO_GROWABLE |
+                              PAN_BO_SPARSE | PAN_BO_EVENT));
+}
+
 /* Tries to add a BO to the cache. Returns if it was
  * successful */
 
@@ -427,29 +796,41 @@ panfrost_bo_cache_put(struct panfrost_bo *bo)
         if (bo->flags & PAN_BO_SHARED || dev->debug & PAN_DBG_NO_CACHE)
                 return false;
 
+        if (bo->size > dev->bo_cache.max_size)
+                return false;
+
         /* Must be first */
         pthread_mutex_lock(&dev->bo_cache.lock);
 
-        struct list_head *bucket = pan_bucket(dev, MAX2(bo->size, 4096));
+        struct list_head *bucket =
+                &dev->bo_cache.buckets[pan_bucket_index(MAX2(bo->size, 4096))];
         struct drm_panfrost_madvise madv;
-        struct timespec time;
 
         madv.handle = bo->gem_handle;
         madv.madv = PANFROST_MADV_DONTNEED;
 	madv.retained = 0;
 
-        // TODO: Allow freeing madvise'd BOs with kbase... not that it really
-        // matters for boards with 16 GB RAM
         if (!dev->kbase)
                 drmIoctl(dev->fd, DRM_IOCTL_PANFROST_MADVISE, &madv);
+        else if (panfrost_bo_can_purge(bo))
+                bo->purgeable = dev->mali.mem_purgeable(&dev->mali,
+                                                        bo->ptr.gpu, true);
+
+        uint64_t now = pan_bo_cache_time_ms();
+
+        /* Make space for the BO, and give memory back to the system if it
+         * is running low */
+        if (panfrost_bo_cache_under_pressure(dev, now))
+                panfrost_bo_cache_trim(dev, dev->bo_cache.size / 2);
+        panfrost_bo_cache_trim(dev, dev->bo_cache.max_size - bo->size);
 
         /* Add us to the bucket */
         list_addtail(&bo->bucket_link, bucket);
 
         /* Add us to the LRU list and update the last_used field. */
         list_addtail(&bo->lru_link, &dev->bo_cache.lru);
-        clock_gettime(CLOCK_MONOTONIC, &time);
-        bo->last_used = time.tv_sec;
+        bo->last_used = now;
+        dev->bo_cache.size += bo->size;
 
         /* For kbase, the GPU can't be accessing this BO any more */
         if (dev->kbase)
@@ -458,7 +839,7 @@ panfrost_bo_cache_put(struct panfrost_bo *bo)
         /* Let's do some cleanup in the BO cache while we hold the
          * lock.
          */
-        panfrost_bo_cache_evict_stale_bos(dev);
+        panfrost_bo_cache_evict_stale_bos(dev, now);
 
         /* Update the label to help debug BO cache memory usage issues */
         bo->label = "Unused (BO cache)";
@@ -468,6 +849,368 @@ panfrost_bo_cache_put(struct panfrost_bo *bo)
         return true;
 }
 
+/* With kbase, small BOs are first put in a per-thread magazine in front of
+ * the shared buckets, so that threads allocating transient BOs do not contend
+ * on the cache lock. Each magazine has its own lock, which is only taken by
+ * other threads when trimming or evicting. When a magazine bucket is full,
+ * the older half of it is moved to the shared cache. Magazines are not
+ * counted in the cache size, but each holds at most
+ * PAN_BO_MAGAZINE_BUCKETS * PAN_BO_MAGAZINE_SIZE BOs smaller than 64 KB.
+ *
+ * This is only done for kbase, where BOs are idle when put in the cache. */
+
+struct panfrost_bo_magazine {
+        struct list_head link;
+        struct panfrost_device *dev;
+
+        pthread_mutex_t lock;
+
+        /* Ordered from oldest to newest */
+        unsigned count[PAN_BO_MAGAZINE_BUCKETS];
+        struct panfrost_bo *bos[PAN_BO_MAGAZINE_BUCKETS][PAN_BO_MAGAZINE_SIZE];
+};
+
+static struct panfrost_bo_magazine *
+panfrost_bo_magazine_get(struct panfrost_device *dev, bool create)
+{
+        struct panfrost_bo_magazine *mag =
+                pthread_getspecific(dev->bo_cache.magazine_key);
+
+        if (mag || !create)
+                return mag;
+
+        mag = calloc(1, sizeof(*mag));
+        if (!mag)
+                return NULL;
+
+        mag->dev = dev;
+        pthread_mutex_init(&mag->lock, NULL);
+
+        pthread_mutex_lock(&dev->bo_cache.magazine_lock);
+        list_addtail(&mag->link, &dev->bo_cache.magazines);
+        pthread_mutex_unlock(&dev->bo_cache.magazine_lock);
+
+        pthread_setspecific(dev->bo_cache.magazine_key, mag);
+        return mag;
+}
+
+static struct panfrost_bo *
+panfrost_bo_magazine_fetch(struct panfrost_device *dev, size_t size,
+                           uint32_t flags, const char *label)
+{
+        unsigned index = pan_bucket_index(size);
+
+        if (!dev->bo_cache.magazines_enabled ||
+            index >= PAN_BO_MAGAZINE_BUCKETS)
+                return NULL;
+
+        struct panfrost_bo_magazine *mag = panfrost_bo_magazine_get(dev, false);
+        struct panfrost_bo *bo = NULL;
+
+        if (!mag)
+                return NULL;
+
+        pthread_mutex_lock(&mag->lock);
+
+        struct panfrost_bo **bos = mag->bos[index];
+        unsigned count = mag->count[index];
+
+        /* Take the most recently used BO, it is the most likely to be hot in
+         * the CPU cache */
+        for (int i = count - 1; i >= 0; --i) {
+                if (bos[i]->size < size || bos[i]->flags != flags)
+                        continue;
+
+                bo = bos[i];
+                memmove(&bos[i], &bos[i + 1], (count - i - 1) * sizeof(*bos));
+                --mag->count[index];
+                break;
+        }
+
+        pthread_mutex_unlock(&mag->lock);
+
+        if (bo)
+                bo->label = label;
+
+        return bo;
+}
+
+/* Tries to add a BO to the magazine of the current thread. Returns if it was
+ * successful */
+
+static bool
+panfrost_bo_magazine_put(struct panfrost_bo *bo)
+{
+        struct panfrost_device *dev = bo->dev;
+        unsigned index = pan_bucket_index(MAX2(bo->size, 4096));
+
+        if (!dev->bo_cache.magazines_enabled ||
+            index >= PAN_BO_MAGAZINE_BUCKETS)
+                return false;
+
+        if (bo->flags & PAN_BO_SHARED || dev->debug & PAN_DBG_NO_CACHE)
+                return false;
+
+        struct panfrost_bo_magazine *mag = panfrost_bo_magazine_get(dev, true);
+        if (!mag)
+                return false;
+
+        struct panfrost_bo *spill[PAN_BO_MAGAZINE_SIZE / 2];
+        unsigned spill_count = 0;
+
+        pthread_mutex_lock(&mag->lock);
+
+        struct panfrost_bo **bos = mag->bos[index];
+
+        if (mag->count[index] == PAN_BO_MAGAZINE_SIZE) {
+                spill_count = ARRAY_SIZE(spill);
+                memcpy(spill, bos, sizeof(spill));
+                memmove(bos, &bos[spill_count],
+                        (PAN_BO_MAGAZINE_SIZE - spill_count) * sizeof(*bos));
+                mag->count[index] -= spill_count;
+        }
+
+        bo->last_used = pan_bo_cache_time_ms();
+        bo->gpu_access = 0;
+        bo->label = "Unused (BO cache)";
+        bos[mag->count[index]++] = bo;
+
+        pthread_mutex_unlock(&mag->lock);
+
+        for (unsigned i = 0; i < spill_count; ++i) {
+                if (!panfrost_bo_cache_put(spill[i]))
+                        panfrost_bo_free(spill[i]);
+        }
+
+        return true;
+}
+
+/* Frees the BOs of a magazine which were put at least min_age milliseconds
+ * before now. Must be called with the magazine lock held. */
+
+static void
+panfrost_bo_magazine_evict(struct panfrost_bo_magazine *mag, uint64_t now,
+                           uint64_t min_age)
+{
+        for (unsigned i = 0; i < PAN_BO_MAGAZINE_BUCKETS; ++i) {
+                struct panfrost_bo **bos = mag->bos[i];
+                unsigned keep = 0;
+
+                for (unsigned j = 0; j < mag->count[i]; ++j) {
+                        if (bos[j]->last_used + min_age > now)
+                                bos[keep++] = bos[j];
+                        else
+                                panfrost_bo_free(bos[j]);
+                }
+
+                mag->count[i] = keep;
+        }
+}
+
+static void
+panfrost_bo_magazines_evict(struct panfrost_device *dev, uint64_t now,
+                            uint64_t min_age)
+{
+        if (!dev->bo_cache.magazines_enabled)
+                return;
+
+        pthread_mutex_lock(&dev->bo_cache.magazine_lock);
+
+        list_for_each_entry(struct panfrost_bo_magazine, mag,
+                            &dev->bo_cache.magazines, link) {
+                pthread_mutex_lock(&mag->lock);
+                panfrost_bo_magazine_evict(mag, now, min_age);
+                pthread_mutex_unlock(&mag->lock);
+        }
+
+        pthread_mutex_unlock(&dev->bo_cache.magazine_lock);
+}
+
+/* Called on thread exit, the BOs are returned to the shared cache */
+
+static void
+panfrost_bo_magazine_destroy(void *data)
+{
+        struct panfrost_bo_magazine *mag = data;
+        struct panfrost_device *dev = mag->dev;
+
+        pthread_mutex_lock(&dev->bo_cache.magazine_lock);
+        list_del(&mag->link);
+        pthread_mutex_unlock(&dev->bo_cache.magazine_lock);
+
+        for (unsigned i = 0; i < PAN_BO_MAGAZINE_BUCKETS; ++i) {
+                for (unsigned j = 0; j < mag->count[i]; ++j) {
+                        if (!panfrost_bo_cache_put(mag->bos[i][j]))
+                                panfrost_bo_free(mag->bos[i][j]);
+                }
+        }
+
+        pthread_mutex_destroy(&mag->lock);
+        free(mag);
+}
+
+void
+panfrost_bo_magazines_init(struct panfrost_device *dev)
+{
+        if (!dev->kbase)
+                return;
+
+        pthread_mutex_init(&dev->bo_cache.magazine_lock, NULL);
+        list_inithead(&dev->bo_cache.magazines);
+
+        if (pthread_key_create(&dev->bo_cache.magazine_key,
+                               panfrost_bo_magazine_destroy)) {
+                pthread_mutex_destroy(&dev->bo_cache.magazine_lock);
+                return;
+        }
+
+        dev->bo_cache.magazines_enabled = true;
+}
+
+/* Must be called after all other threads have stopped using the device */
+
+void
+panfrost_bo_magazines_fini(struct panfrost_device *dev)
+{
+        if (!dev->bo_cache.magazines_enabled)
+                return;
+
+        /* BOs freed from now on go straight to the shared cache */
+        dev->bo_cache.magazines_enabled = false;
+        pthread_key_delete(dev->bo_cache.magazine_key);
+
+        list_for_each_entry_safe(struct panfrost_bo_magazine, mag,
+                                 &dev->bo_cache.magazines, link) {
+                panfrost_bo_magazine_evict(mag, UINT64_MAX, 0);
+                list_del(&mag->link);
+                pthread_mutex_destroy(&mag->lock);
+                free(mag);
+        }
+
+        pthread_mutex_destroy(&dev->bo_cache.magazine_lock);
+}
+
+/* Trims the cache when no BOs are being freed, so that idle applications
+ * still give memory back. Called on flush and from the trimming thread. */
+
+void
+panfrost_bo_cache_evict_stale(struct panfrost_device *dev)
+{
+        uint64_t now = pan_bo_cache_time_ms();
+
+        pthread_mutex_lock(&dev->bo_cache.lock);
+
+        if (panfrost_bo_cache_under_pressure(dev, now))
+                panfrost_bo_cache_trim(dev, dev->bo_cache.size / 2);
+
+        panfrost_bo_cache_evict_stale_bos(dev, now);
+
+        pthread_mutex_unlock(&dev->bo_cache.lock);
+
+        panfrost_bo_magazines_evict(dev, now, dev->bo_cache.retention_ms + 1);
+}
+
+static void *
+panfrost_bo_cache_trim_thread(void *data)
+{
+        struct panfrost_device *dev = data;
+
+        /* Trimming is never urgent, so avoid competing with the application */
+        setpriority(PRIO_PROCESS, gettid(), 19);
+
+        pthread_mutex_lock(&dev->bo_cache.trim_lock);
+
+        while (!dev->bo_cache.trim_thread_stop) {
+                struct timespec until;
+                clock_gettime(CLOCK_MONOTONIC, &until);
+
+                /* Wake up twice per retention period, so BOs are kept for at
+                 * most 1.5 times the requested time */
+                uint64_t ns = until.tv_nsec +
+                        (uint64_t) MAX2(dev->bo_cache.retention_ms / 2, 1) * 1000000;
+                until.tv_sec += ns / 1000000000;
+                until.tv_nsec = ns % 1000000000;
+
+                pthread_cond_timedwait(&dev->bo_cache.trim_cond,
+                                       &dev->bo_cache.trim_lock, &until);
+
+                if (!dev->bo_cache.trim_thread_stop)
+                        panfrost_bo_cache_evict_stale(dev);
+        }
+
+        pthread_mutex_unlock(&dev->bo_cache.trim_lock);
+
+        return NULL;
+}
+
+void
+panfrost_bo_cache_start_trim_thread(struct panfrost_device *dev)
+{
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&dev->bo_cache.trim_cond, &attr);
+        pthread_condattr_destroy(&attr);
+
+        pthread_mutex_init(&dev->bo_cache.trim_lock, NULL);
+        dev->bo_cache.trim_thread_stop = false;
+
+        if (pthread_create(&dev->bo_cache.trim_thread, NULL,
+                           panfrost_bo_cache_trim_thread, dev)) {
+                perror("pthread_create");
+                pthread_cond_destroy(&dev->bo_cache.trim_cond);
+                pthread_mutex_destroy(&dev->bo_cache.trim_lock);
+                return;
+        }
+
+        dev->bo_cache.trim_thread_enabled = true;
+}
+
+void
+panfrost_bo_cache_stop_trim_thread(struct panfrost_device *dev)
+{
+        if (!dev->bo_cache.trim_thread_enabled)
+                return;
+
+        pthread_mutex_lock(&dev->bo_cache.trim_lock);
+        dev->bo_cache.trim_thread_stop = true;
+        pthread_cond_signal(&dev->bo_cache.trim_cond);
+        pthread_mutex_unlock(&dev->bo_cache.trim_lock);
+
+        pthread_join(dev->bo_cache.trim_thread, NULL);
+        pthread_cond_destroy(&dev->bo_cache.trim_cond);
+        pthread_mutex_destroy(&dev->bo_cache.trim_lock);
+
+        dev->bo_cache.trim_thread_enabled = false;
+}
+
+/* Writes the hit and miss counts of each bucket to the BO log. Must be called
+ * with the cache lock held. */
+
+static void
+panfrost_bo_cache_log_stats(struct panfrost_device *dev)
+{
+        struct timespec tp;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &tp);
+
+        for (unsigned i = 0; i < NR_BO_CACHE_BUCKETS; ++i) {
+                if (!dev->bo_cache.hits[i] && !dev->bo_cache.misses[i])
+                        continue;
+
+                unsigned level = MIN_BO_CACHE_BUCKET +
+                        (i >> BO_CACHE_BUCKET_SPLIT_BITS);
+                unsigned sub = i & BITFIELD_MASK(BO_CACHE_BUCKET_SPLIT_BITS);
+                size_t splits = BITFIELD_BIT(BO_CACHE_BUCKET_SPLIT_BITS);
+                size_t min_size = (splits + sub) <<
+                        (level - BO_CACHE_BUCKET_SPLIT_BITS);
+
+                fprintf(dev->bo_log, "%"PRIu64".%09li cachestats bucket %u size %zu hits %"PRIu64" misses %"PRIu64"\n",
+                        (uint64_t) tp.tv_sec, tp.tv_nsec, i, min_size,
+                        dev->bo_cache.hits[i], dev->bo_cache.misses[i]);
+        }
+        fflush(NULL);
+}
+
 /* Evicts all BOs from the cache. Called during context
  * destroy or during low-memory situations (to free up
  * memory that may be unused by us just sitting in our
@@ -489,7 +1232,25 @@ panfrost_bo_cache_evict_all(
                         panfrost_bo_free(entry);
                 }
         }
+        dev->bo_cache.size = 0;
+
+        if (dev->bo_log)
+                panfrost_bo_cache_log_stats(dev);
+
         pthread_mutex_unlock(&dev->bo_cache.lock);
+
+        panfrost_bo_magazines_evict(dev, UINT64_MAX, 0);
+
+        /* Slabs kept around without any allocations can also be freed */
+        pthread_mutex_lock(&dev->bo_slab.lock);
+        for (unsigned i = 0; i < ARRAY_SIZE(dev->bo_slab.slabs); ++i) {
+                list_for_each_entry_safe(struct panfrost_bo_slab, slab,
+                                         &dev->bo_slab.slabs[i], link) {
+                        if (slab->num_free == (PAN_BO_SLAB_SIZE >> slab->order))
+                                panfrost_bo_slab_destroy(slab);
+                }
+        }
+        pthread_mutex_unlock(&dev->bo_slab.lock);
 }
 
 void
@@ -549,16 +1310,33 @@ panfrost_bo_create(struct panfrost_device *dev, size_t size,
         /* To maximize BO cache usage, don't allocate tiny BOs */
         size = ALIGN_POT(size, 4096);
 
+        if (panfrost_bo_large_pages_eligible(dev, size, flags)) {
+                flags |= PAN_BO_LARGE_PAGES;
+                size = ALIGN_POT(size, PAN_LARGE_PAGE_SIZE);
+        }
+
         /* GROWABLE BOs cannot be mmapped */
         if (flags & PAN_BO_GROWABLE)
                 assert(flags & PAN_BO_INVISIBLE);
 
+        /* Sparse BOs rely on kbase committing memory on demand */
+        if (flags & PAN_BO_SPARSE)
+                assert(dev->kbase);
+
         /* Ideally, we get a BO that's ready in the cache, or allocate a fresh
          * BO. If allocation fails, we can try waiting for something in the
          * cache. But if there's no nothing suitable, we should flush the cache
          * to make space for the new allocation.
          */
-        bo = panfrost_bo_cache_fetch(dev, size, flags, label, true);
+        bo = panfrost_bo_magazine_fetch(dev, size, flags, label);
+        if (!bo)
+                bo = panfrost_bo_cache_fetch(dev, size, flags, label, true);
+
+        p_atomic_inc(bo ? &dev->bo_cache.fetch_hits :
+                          &dev->bo_cache.fetch_misses);
+
+        if (!bo && panfrost_bo_slab_eligible(dev, size, flags))
+                bo = panfrost_bo_slab_alloc(dev, size, flags, label);
         if (!bo)
                 bo = panfrost_bo_alloc(dev, size, flags, label);
         if (!bo)
@@ -634,10 +1412,12 @@ panfrost_bo_fini(struct panfrost_bo *bo)
         if (dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC))
                 pandecode_inject_free(bo->ptr.gpu, bo->size);
 
+        pan_capture_free_bo(dev, bo);
+
         /* Rather than freeing the BO now, we'll cache the BO for later
          * allocations if we're allowed to.
          */
-        if (!panfrost_bo_cache_put(bo))
+        if (!panfrost_bo_magazine_put(bo) && !panfrost_bo_cache_put(bo))
                 panfrost_bo_free(bo);
 }
 
@@ -868,3 +1648,36 @@ panfrost_bo_export(struct panfrost_bo *bo)
         return args.fd;
 }
 
+/* Merges u into a usage list sorted by queue, looking from index onwards.
+ * Returns the index of the entry holding u. */
+
+unsigned
+panfrost_add_dep_after(struct util_dynarray *deps,
+                       struct panfrost_usage u,
+                       unsigned index)
+{
+        unsigned size = util_dynarray_num_elements(deps, struct panfrost_usage);
+
+        for (unsigned i = index; i < size; ++i) {
+                struct panfrost_usage *d =
+                        util_dynarray_element(deps, struct panfrost_usage, i);
+
+                if ((d->queue == u.queue) && (d->write == u.write)) {
+                        d->seqnum = MAX2(d->seqnum, u.seqnum);
+                        return i;
+
+                } else if (d->queue > u.queue) {
+                        void *p = util_dynarray_grow(deps, struct panfrost_usage, 1);
+                        assert(p);
+                        memmove(util_dynarray_element(deps, struct panfrost_usage, i + 1),
+                                util_dynarray_element(deps, struct panfrost_usage, i),
+                                (size - i) * sizeof(struct panfrost_usage));
+
+                        *util_dynarray_element(deps, struct panfrost_usage, i) = u;
+                        return i;
+                }
+        }
+
+        util_dynarray_append(deps, struct panfrost_usage, u);
+        return size;
+}
@@ -57,6 +57,15 @@
 /* Use the caching policy for resource BOs */
 #define PAN_BO_CACHEABLE          (1 << 6)
 
+/* Backing memory is only present where committed with panfrost_bo_commit or
+ * faulted in by the GPU, for sparse resources (kbase only). Unlike GROWABLE,
+ * the BO is mapped, but the CPU must only access committed memory. */
+#define PAN_BO_SPARSE             (1 << 7)
+
+/* Backed by large pages, set by panfrost_bo_create for large BOs on kbase.
+ * Also keeps them apart from other BOs in the cache. */
+#define PAN_BO_LARGE_PAGES        (1 << 8)
+
 /* GPU access flags */
 
 /* BO is either shared (can be accessed by more than one GPU batch) or private
@@ -78,6 +87,7 @@
 typedef uint8_t pan_bo_access;
 
 struct panfrost_device;
+struct panfrost_bo_slab;
 
 struct panfrost_ptr {
         /* CPU address */
@@ -100,10 +110,10 @@ struct panfrost_bo {
         /* Used to link the BO to the BO cache LRU list. */
         struct list_head lru_link;
 
-        /* Store the time this BO was use last, so the BO cache logic can evict
-         * stale BOs.
+        /* Store the time this BO was use last in milliseconds, so the BO
+         * cache logic can evict stale BOs.
          */
-        time_t last_used;
+        uint64_t last_used;
 
         /* Atomic reference count */
         int32_t refcnt;
@@ -147,17 +157,35 @@ struct panfrost_bo {
         /* Is the BO cached CPU-side? */
         bool cached;
 
+        /* Has the BO been marked as purgeable while in the BO cache? */
+        bool purgeable;
+
         /* File descriptor for the dma-buf */
         int dmabuf_fd;
+
+        /* If the BO is sub-allocated, the slab which owns the memory */
+        struct panfrost_bo_slab *slab;
+
+        /* Hash of the contents last written to the capture, if captured
+         * since the BO was allocated. */
+        uint64_t capture_hash;
+        bool captured;
 };
 
 bool
 panfrost_bo_wait(struct panfrost_bo *bo, int64_t timeout_ns, bool wait_readers);
 void
+panfrost_bo_usage_compact(struct panfrost_bo *bo);
+void
 panfrost_bo_mem_invalidate(struct panfrost_bo *bo, size_t offset, size_t length);
 void
 panfrost_bo_mem_clean(struct panfrost_bo *bo, size_t offset, size_t length);
 void
+panfrost_bo_decommit(struct panfrost_bo *bo);
+
+bool
+panfrost_bo_commit(struct panfrost_bo *bo, size_t size);
+void
 panfrost_bo_reference(struct panfrost_bo *bo);
 void
 panfrost_bo_unreference(struct panfrost_bo *bo);
@@ -172,5 +200,18 @@ int
 panfrost_bo_export(struct panfrost_bo *bo);
 void
 panfrost_bo_cache_evict_all(struct panfrost_device *dev);
+void
+panfrost_bo_cache_evict_stale(struct panfrost_device *dev);
+void
+panfrost_bo_cache_start_trim_thread(struct panfrost_device *dev);
+void
+panfrost_bo_cache_stop_trim_thread(struct panfrost_device *dev);
+void
+panfrost_bo_magazines_init(struct panfrost_device *dev);
+void
+panfrost_bo_magazines_fini(struct panfrost_device *dev);
+unsigned
+panfrost_add_dep_after(struct util_dynarray *deps, struct panfrost_usage u,
+                       unsigned index);
 
 #endif /* __PAN_BO_H__ */
@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "util/simple_mtx.h"
+#include "util/u_atomic.h"
+#include "util/u_debug.h"
+#include "util/u_dynarray.h"
+#include "util/u_queue.h"
+#define XXH_INLINE_ALL
+#include "util/xxhash.h"
+
+#include "pan_bo.h"
+#include "pan_capture.h"
+#include "pan_device.h"
+#include "pan_util.h"
+
+/* Copying the contents of the BOs is done on the submitting thread, since
+ * they may be reused as soon as the submission is made, but writing them out
+ * is left to a thread of its own. Records are batched up until the end of
+ * each submission, and then handed over as a single job. */
+
+struct pan_capture_job {
+        struct util_queue_fence fence;
+        struct util_dynarray data;
+};
+
+struct pan_capture {
+        FILE *fp;
+
+        struct util_queue queue;
+
+        /* Protects job and the capture state of the BOs */
+        simple_mtx_t lock;
+
+        /* Records of the submission in progress */
+        struct pan_capture_job *job;
+
+        /* Number of kbase event chunks recorded so far, and the hashes of
+         * their KCPU event memory when last recorded */
+        unsigned event_chunks;
+        uint64_t kcpu_hash[KBASE_MAX_EVENT_CHUNKS];
+};
+
+static void
+pan_capture_write(void *data, void *gdata, int thread_index)
+{
+        struct pan_capture_job *job = data;
+        struct pan_capture *cap = gdata;
+
+        if (fwrite(job->data.data, 1, job->data.size, cap->fp) != job->data.size)
+                fprintf(stderr, "panfrost: failed to write capture\n");
+}
+
+static void
+pan_capture_job_free(void *data, void *gdata, int thread_index)
+{
+        struct pan_capture_job *job = data;
+
+        util_dynarray_fini(&job->data);
+        free(job);
+}
+
+static void
+pan_capture_record(struct pan_capture *cap, enum pan_capture_record_type type,
+                   uint64_t va, uint64_t size, uint32_t flags,
+                   const void *data, uint64_t data_size)
+{
+        if (!cap->job) {
+                cap->job = calloc(1, sizeof(*cap->job));
+                util_queue_fence_init(&cap->job->fence);
+                util_dynarray_init(&cap->job->data, NULL);
+        }
+
+        struct pan_capture_record record = {
+                .magic = PAN_CAPTURE_MAGIC,
+                .type = type,
+                .va = va,
+                .size = size,
+                .data_size = data_size,
+                .flags = flags,
+        };
+
+        util_dynarray_append(&cap->job->data, struct pan_capture_record, record);
+
+        if (data_size) {
+                void *dst = util_dynarray_grow_bytes(&cap->job->data, 1, data_size);
+                memcpy(dst, data, data_size);
+        }
+}
+
+static void
+pan_capture_submit(struct pan_capture *cap)
+{
+        struct pan_capture_job *job = cap->job;
+
+        if (!job)
+                return;
+
+        cap->job = NULL;
+        util_queue_add_job(&cap->queue, job, &job->fence, pan_capture_write,
+                           pan_capture_job_free, job->data.size);
+}
+
+void
+pan_capture_init(struct panfrost_device *dev)
+{
+        if (!(dev->debug & PAN_DBG_CAPTURE))
+                return;
+
+        char default_path[64];
+        snprintf(default_path, sizeof(default_path), "/tmp/pancapture.%d",
+                 (int) getpid());
+
+        const char *path = debug_get_option("PAN_CAPTURE_FILE", default_path);
+        FILE *fp = fopen(path, "wb");
+
+        if (!fp) {
+                fprintf(stderr, "panfrost: failed to open capture file %s\n",
+                        path);
+                return;
+        }
+
+        struct pan_capture *cap = calloc(1, sizeof(*cap));
+        cap->fp = fp;
+        simple_mtx_init(&cap->lock, mtx_plain);
+
+        if (!util_queue_init(&cap->queue, "pancapture", 32, 1, 0, cap)) {
+                simple_mtx_destroy(&cap->lock);
+                fclose(fp);
+                free(cap);
+                return;
+        }
+
+        struct pan_capture_record header = {
+                .magic = PAN_CAPTURE_MAGIC,
+                .type = PAN_CAPTURE_RECORD_HEADER,
+                .va = dev->gpu_id,
+                .size = PAN_CAPTURE_VERSION,
+        };
+
+        fwrite(&header, sizeof(header), 1, fp);
+
+        dev->capture = cap;
+}
+
+void
+pan_capture_fini(struct panfrost_device *dev)
+{
+        struct pan_capture *cap = dev->capture;
+
+        if (!cap)
+                return;
+
+        pan_capture_submit(cap);
+        util_queue_finish(&cap->queue);
+        util_queue_destroy(&cap->queue);
+        simple_mtx_destroy(&cap->lock);
+        fclose(cap->fp);
+        free(cap);
+
+        dev->capture = NULL;
+}
+
+void
+pan_capture_bo(struct panfrost_device *dev, struct panfrost_bo *bo)
+{
+        struct pan_capture *cap = dev->capture;
+
+        if (!cap)
+                return;
+
+        const void *data = (bo->flags & PAN_BO_INVISIBLE) ? NULL : bo->ptr.cpu;
+        uint64_t hash = data ? XXH64(data, bo->size, 0) : 0;
+
+        simple_mtx_lock(&cap->lock);
+
+        if (!bo->captured || bo->capture_hash != hash) {
+                uint32_t flags = 0;
+
+                if (bo->flags & PAN_BO_EXECUTE)
+                        flags |= PAN_CAPTURE_BO_EXECUTE;
+                if (bo->flags & PAN_BO_INVISIBLE)
+                        flags |= PAN_CAPTURE_BO_INVISIBLE;
+
+                pan_capture_record(cap, PAN_CAPTURE_RECORD_BO, bo->ptr.gpu,
+                                   bo->size, flags, data, data ? bo->size : 0);
+
+                bo->captured = true;
+                bo->capture_hash = hash;
+        }
+
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_free_bo(struct panfrost_device *dev, struct panfrost_bo *bo)
+{
+        struct pan_capture *cap = dev->capture;
+
+        if (!cap || !bo->captured)
+                return;
+
+        simple_mtx_lock(&cap->lock);
+        pan_capture_record(cap, PAN_CAPTURE_RECORD_FREE, bo->ptr.gpu,
+                           bo->size, 0, NULL, 0);
+        bo->captured = false;
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_jc(struct panfrost_device *dev, uint64_t jc, uint32_t reqs)
+{
+        struct pan_capture *cap = dev->capture;
+
+        if (!cap)
+                return;
+
+        simple_mtx_lock(&cap->lock);
+        pan_capture_record(cap, PAN_CAPTURE_RECORD_JC, jc, reqs, 0, NULL, 0);
+        pan_capture_submit(cap);
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_cs(struct panfrost_device *dev, uint64_t va, uint64_t size,
+               unsigned queue)
+{
+        struct pan_capture *cap = dev->capture;
+
+        if (!cap)
+                return;
+
+        simple_mtx_lock(&cap->lock);
+        pan_capture_record(cap, PAN_CAPTURE_RECORD_CS, va, size, queue,
+                           NULL, 0);
+        pan_capture_submit(cap);
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_csf_state(struct panfrost_device *dev,
+                      const struct kbase_context *kctx)
+{
+        struct pan_capture *cap = dev->capture;
+        kbase k = &dev->mali;
+
+        if (!cap)
+                return;
+
+        simple_mtx_lock(&cap->lock);
+
+        /* Event memory written by the GPU is only recorded once, replaying
+         * the command streams brings it up to date. The KCPU half is written
+         * by the kernel, so changes to it have to be recorded. */
+        unsigned chunks = p_atomic_read(&k->event_chunk_count);
+
+        for (unsigned i = 0; i < chunks; ++i) {
+                const struct kbase_event_chunk *chunk = k->event_chunks[i];
+                unsigned size = chunk->mem_size / 2;
+
+                if (!chunk->event_mem.cpu)
+                        continue;
+
+                uint64_t hash = XXH64(chunk->kcpu_event_mem.cpu, size, 0);
+
+                if (i >= cap->event_chunks) {
+                        pan_capture_record(cap, PAN_CAPTURE_RECORD_EVENT_MEM,
+                                           chunk->event_mem.gpu, chunk->mem_size,
+                                           0, chunk->event_mem.cpu,
+                                           chunk->mem_size);
+                } else if (hash != cap->kcpu_hash[i]) {
+                        pan_capture_record(cap, PAN_CAPTURE_RECORD_EVENT_MEM,
+                                           chunk->kcpu_event_mem.gpu, size,
+                                           PAN_CAPTURE_EVENT_KCPU,
+                                           chunk->kcpu_event_mem.cpu, size);
+                }
+
+                cap->kcpu_hash[i] = hash;
+        }
+
+        cap->event_chunks = MAX2(cap->event_chunks, chunks);
+
+        for (unsigned i = 0; i < kctx->num_tiler_heaps; ++i) {
+                struct pan_capture_tiler_heap heap = {
+                        .context_va = kctx->tiler_heap_va[i],
+                        .chunk_va = kctx->tiler_heap_header[i],
+                        .chunk_size = kctx->tiler_heap_config.chunk_size,
+                        .index = i,
+                };
+
+                pan_capture_record(cap, PAN_CAPTURE_RECORD_TILER_HEAP,
+                                   heap.context_va, 0, 0, &heap, sizeof(heap));
+        }
+
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_next_frame(struct panfrost_device *dev)
+{
+        struct pan_capture *cap = dev->capture;
+
+        if (!cap)
+                return;
+
+        simple_mtx_lock(&cap->lock);
+        pan_capture_record(cap, PAN_CAPTURE_RECORD_FRAME, 0, 0, 0, NULL, 0);
+        pan_capture_submit(cap);
+        simple_mtx_unlock(&cap->lock);
+}
+
+/* Dumps are written straight out on the calling thread, which has usually
+ * just noticed a fault and has nothing better to do. Only what is dumped is
+ * held in memory, a BO at a time. */
+
+struct pan_dump {
+        FILE *fp;
+
+#ifdef HAVE_ZSTD
+        ZSTD_CStream *zs;
+        void *out;
+        size_t out_size;
+#endif
+};
+
+static void
+pan_dump_flush(struct pan_dump *dump, const void *data, size_t size,
+               bool end)
+{
+#ifdef HAVE_ZSTD
+        if (dump->zs) {
+                ZSTD_inBuffer in = { data, size, 0 };
+                ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+                size_t remaining;
+
+                do {
+                        ZSTD_outBuffer out = { dump->out, dump->out_size, 0 };
+
+                        remaining = ZSTD_compressStream2(dump->zs, &out, &in,
+                                                         mode);
+
+                        if (ZSTD_isError(remaining)) {
+                                fprintf(stderr, "panfrost: dump compression failed: %s\n",
+                                        ZSTD_getErrorName(remaining));
+                                return;
+                        }
+
+                        fwrite(dump->out, 1, out.pos, dump->fp);
+                } while (end ? remaining : in.pos < in.size);
+
+                return;
+        }
+#endif
+
+        if (size)
+                fwrite(data, 1, size, dump->fp);
+}
+
+static void
+pan_dump_record(struct pan_dump *dump, enum pan_capture_record_type type,
+                uint64_t va, uint64_t size, uint32_t flags,
+                const void *data, uint64_t data_size)
+{
+        struct pan_capture_record record = {
+                .magic = PAN_CAPTURE_MAGIC,
+                .type = type,
+                .va = va,
+                .size = size,
+                .data_size = data_size,
+                .flags = flags,
+        };
+
+        pan_dump_flush(dump, &record, sizeof(record), false);
+        pan_dump_flush(dump, data, data_size, false);
+}
+
+struct pan_dump *
+pan_dump_open(struct panfrost_device *dev, const char *path)
+{
+        FILE *fp = fopen(path, "wb");
+
+        if (!fp) {
+                fprintf(stderr, "panfrost: failed to open dump file %s\n",
+                        path);
+                return NULL;
+        }
+
+        struct pan_dump *dump = calloc(1, sizeof(*dump));
+        dump->fp = fp;
+
+#ifdef HAVE_ZSTD
+        dump->zs = ZSTD_createCStream();
+
+        if (dump->zs) {
+                /* Dumps are taken after faults, favour speed over size */
+                ZSTD_CCtx_setParameter(dump->zs, ZSTD_c_compressionLevel, 1);
+                dump->out_size = ZSTD_CStreamOutSize();
+                dump->out = malloc(dump->out_size);
+        }
+#endif
+
+        pan_dump_record(dump, PAN_CAPTURE_RECORD_HEADER, dev->gpu_id,
+                        PAN_CAPTURE_VERSION, 0, NULL, 0);
+
+        return dump;
+}
+
+void
+pan_dump_bo(struct pan_dump *dump, struct panfrost_bo *bo)
+{
+        const void *data = (bo->flags & PAN_BO_INVISIBLE) ? NULL : bo->ptr.cpu;
+        uint32_t flags = 0;
+
+        if (bo->flags & PAN_BO_EXECUTE)
+                flags |= PAN_CAPTURE_BO_EXECUTE;
+        if (bo->flags & PAN_BO_INVISIBLE)
+                flags |= PAN_CAPTURE_BO_INVISIBLE;
+
+        pan_dump_record(dump, PAN_CAPTURE_RECORD_BO, bo->ptr.gpu, bo->size,
+                        flags, data, data ? bo->size : 0);
+}
+
+void
+pan_dump_cs(struct pan_dump *dump, uint64_t va, uint64_t size,
+            unsigned queue)
+{
+        pan_dump_record(dump, PAN_CAPTURE_RECORD_CS, va, size, queue, NULL, 0);
+}
+
+void
+pan_dump_close(struct pan_dump *dump)
+{
+        pan_dump_flush(dump, NULL, 0, true);
+
+#ifdef HAVE_ZSTD
+        ZSTD_freeCStream(dump->zs);
+        free(dump->out);
+#endif
+
+        fclose(dump->fp);
+        free(dump);
+}
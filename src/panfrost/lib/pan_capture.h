@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_CAPTURE_H__
+#define __PAN_CAPTURE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary captures of the work submitted to the GPU, written with
+ * PAN_MESA_DEBUG=capture to the file named by PAN_CAPTURE_FILE. They are
+ * decoded offline by pancapture, rather than by pandecode on the submitting
+ * thread.
+ *
+ * A capture is a sequence of records, each followed by data_size bytes of
+ * data. The contents of the BOs referenced by a submission are recorded
+ * before it, unless they are unchanged since they were last recorded. BOs
+ * which can't be read by the CPU are recorded without contents. All values
+ * are little-endian. */
+
+#define PAN_CAPTURE_MAGIC   0x50414e43
+#define PAN_CAPTURE_VERSION 2
+
+enum pan_capture_record_type {
+        /* First record of the file: va is the GPU ID, size the version */
+        PAN_CAPTURE_RECORD_HEADER = 1,
+
+        /* Contents of the BO at va, or none if data_size is zero. flags
+         * are PAN_CAPTURE_BO_* flags. */
+        PAN_CAPTURE_RECORD_BO = 2,
+
+        /* The BO at va was freed */
+        PAN_CAPTURE_RECORD_FREE = 3,
+
+        /* Job chain starting at va, submitted on the job manager. size is
+         * the requirements of the chain. */
+        PAN_CAPTURE_RECORD_JC = 4,
+
+        /* Command stream of size bytes at va, submitted on a CSF queue.
+         * flags identifies the queue. */
+        PAN_CAPTURE_RECORD_CS = 5,
+
+        /* End of the frame */
+        PAN_CAPTURE_RECORD_FRAME = 6,
+
+        /* Tiler heap of the context which the following command streams
+         * were submitted from, with a pan_capture_tiler_heap as data.
+         * Created by the kernel, so the addresses aren't kept on replay. */
+        PAN_CAPTURE_RECORD_TILER_HEAP = 7,
+
+        /* Contents of kbase CSF event memory. Recorded when first used, and
+         * for memory written by KCPU queues, whenever it changed. flags are
+         * PAN_CAPTURE_EVENT_* flags. */
+        PAN_CAPTURE_RECORD_EVENT_MEM = 8,
+};
+
+#define PAN_CAPTURE_BO_EXECUTE   (1 << 0)
+#define PAN_CAPTURE_BO_INVISIBLE (1 << 1)
+
+#define PAN_CAPTURE_EVENT_KCPU   (1 << 0)
+
+struct pan_capture_record {
+        uint32_t magic;
+        uint32_t type;
+        uint64_t va;
+        uint64_t size;
+        uint64_t data_size;
+        uint32_t flags;
+        uint32_t pad;
+};
+
+struct pan_capture_tiler_heap {
+        uint64_t context_va;
+        uint64_t chunk_va;
+        uint32_t chunk_size;
+        uint32_t index;
+};
+
+struct panfrost_device;
+struct panfrost_bo;
+struct kbase_context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Starts capturing, if enabled. Called once on device creation. */
+void pan_capture_init(struct panfrost_device *dev);
+
+/* Waits for the pending records to be written and closes the file */
+void pan_capture_fini(struct panfrost_device *dev);
+
+/* Records the contents of a BO used by the next submission */
+void pan_capture_bo(struct panfrost_device *dev, struct panfrost_bo *bo);
+
+/* Records that a BO was freed. Called with the last reference dropped. */
+void pan_capture_free_bo(struct panfrost_device *dev, struct panfrost_bo *bo);
+
+/* Record submissions. The BO records of a submission must come first. */
+void pan_capture_jc(struct panfrost_device *dev, uint64_t jc, uint32_t reqs);
+void pan_capture_cs(struct panfrost_device *dev, uint64_t va, uint64_t size,
+                    unsigned queue);
+
+/* Records what CSF command streams depend on outside of BOs: the event
+ * memory and the tiler heaps of the context */
+void pan_capture_csf_state(struct panfrost_device *dev,
+                           const struct kbase_context *kctx);
+
+void pan_capture_next_frame(struct panfrost_device *dev);
+
+/* Dumps are written like captures, but synchronously and for a single
+ * submission, such as one which faulted. They are zstd-compressed when
+ * available. */
+struct pan_dump;
+
+struct pan_dump *pan_dump_open(struct panfrost_device *dev, const char *path);
+void pan_dump_bo(struct pan_dump *dump, struct panfrost_bo *bo);
+void pan_dump_cs(struct pan_dump *dump, uint64_t va, uint64_t size,
+                 unsigned queue);
+void pan_dump_close(struct pan_dump *dump);
+
+/* Reading captures and dumps, compressed or not */
+struct pan_capture_reader;
+
+/* Returns NULL if the file is not a capture of the current version */
+struct pan_capture_reader *pan_capture_reader_open(const char *path,
+                                                   uint32_t *gpu_id);
+bool pan_capture_reader_next(struct pan_capture_reader *r,
+                             struct pan_capture_record *rec);
+/* Reads or skips the data of the record returned by the last call to
+ * pan_capture_reader_next */
+bool pan_capture_reader_data(struct pan_capture_reader *r, void *data,
+                             size_t size);
+bool pan_capture_reader_skip(struct pan_capture_reader *r, size_t size);
+void pan_capture_reader_close(struct pan_capture_reader *r);
+
+/* Whether the file looks like a capture or a dump */
+bool pan_capture_probe(const char *path);
+
+/* Decodes a capture or dump with pandecode, or only prints the number of
+ * records with stats set. Returns false if the file is corrupted. */
+bool pan_capture_decode(const char *path, bool stats);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "util/hash_table.h"
+#include "util/macros.h"
+
+#include "pan_capture.h"
+#include "wrap.h"
+
+/* Captures are written uncompressed, dumps are zstd-compressed if it was
+ * available. Both are read through the same interface, which tells them
+ * apart by the magic number at the start of the file. */
+
+#define ZSTD_FRAME_MAGIC 0xFD2FB528
+
+struct pan_capture_reader {
+        FILE *fp;
+
+#ifdef HAVE_ZSTD
+        ZSTD_DStream *zs;
+        ZSTD_inBuffer in;
+        void *in_data;
+        size_t in_size;
+        bool eof;
+#endif
+
+        /* Set when reading stopped before the end of the file */
+        bool corrupt;
+};
+
+static bool
+pan_capture_read(struct pan_capture_reader *r, void *data, size_t size)
+{
+#ifdef HAVE_ZSTD
+        if (r->zs) {
+                ZSTD_outBuffer out = { data, size, 0 };
+
+                while (out.pos < out.size) {
+                        if (r->in.pos == r->in.size && !r->eof) {
+                                r->in.size = fread(r->in_data, 1, r->in_size,
+                                                   r->fp);
+                                r->in.pos = 0;
+                                r->eof = r->in.size < r->in_size;
+                        }
+
+                        size_t pos = out.pos;
+                        size_t ret = ZSTD_decompressStream(r->zs, &out, &r->in);
+
+                        if (ZSTD_isError(ret)) {
+                                fprintf(stderr, "Decompression failed: %s\n",
+                                        ZSTD_getErrorName(ret));
+                                r->corrupt = true;
+                                return false;
+                        }
+
+                        /* End of file, possibly truncated */
+                        if (out.pos == pos && r->in.pos == r->in.size &&
+                            r->eof)
+                                return false;
+                }
+
+                return true;
+        }
+#endif
+
+        return fread(data, 1, size, r->fp) == size;
+}
+
+struct pan_capture_reader *
+pan_capture_reader_open(const char *path, uint32_t *gpu_id)
+{
+        FILE *fp = fopen(path, "rb");
+        uint32_t magic;
+
+        if (!fp)
+                return NULL;
+
+        if (fread(&magic, sizeof(magic), 1, fp) != 1) {
+                fclose(fp);
+                return NULL;
+        }
+
+        rewind(fp);
+
+        struct pan_capture_reader *r = calloc(1, sizeof(*r));
+        r->fp = fp;
+
+        if (magic == ZSTD_FRAME_MAGIC) {
+#ifdef HAVE_ZSTD
+                r->zs = ZSTD_createDStream();
+                r->in_size = ZSTD_DStreamInSize();
+                r->in_data = malloc(r->in_size);
+                r->in.src = r->in_data;
+#else
+                fprintf(stderr, "Compressed dumps need zstd support\n");
+                pan_capture_reader_close(r);
+                return NULL;
+#endif
+        }
+
+        struct pan_capture_record rec;
+
+        if (!pan_capture_read(r, &rec, sizeof(rec)) ||
+            rec.magic != PAN_CAPTURE_MAGIC ||
+            rec.type != PAN_CAPTURE_RECORD_HEADER) {
+                pan_capture_reader_close(r);
+                return NULL;
+        }
+
+        if (rec.size != PAN_CAPTURE_VERSION) {
+                fprintf(stderr, "Unsupported capture version %" PRIu64 "\n",
+                        rec.size);
+                pan_capture_reader_close(r);
+                return NULL;
+        }
+
+        if (gpu_id)
+                *gpu_id = rec.va;
+
+        return r;
+}
+
+bool
+pan_capture_reader_next(struct pan_capture_reader *r,
+                        struct pan_capture_record *rec)
+{
+        if (!pan_capture_read(r, rec, sizeof(*rec)))
+                return false;
+
+        if (rec->magic != PAN_CAPTURE_MAGIC) {
+                fprintf(stderr, "Corrupted record\n");
+                r->corrupt = true;
+                return false;
+        }
+
+        return true;
+}
+
+bool
+pan_capture_reader_data(struct pan_capture_reader *r, void *data, size_t size)
+{
+        return pan_capture_read(r, data, size);
+}
+
+bool
+pan_capture_reader_skip(struct pan_capture_reader *r, size_t size)
+{
+#ifdef HAVE_ZSTD
+        if (r->zs) {
+                char buf[4096];
+
+                while (size) {
+                        size_t n = MIN2(size, sizeof(buf));
+
+                        if (!pan_capture_read(r, buf, n))
+                                return false;
+
+                        size -= n;
+                }
+
+                return true;
+        }
+#endif
+
+        return !fseek(r->fp, size, SEEK_CUR);
+}
+
+void
+pan_capture_reader_close(struct pan_capture_reader *r)
+{
+#ifdef HAVE_ZSTD
+        ZSTD_freeDStream(r->zs);
+        free(r->in_data);
+#endif
+
+        fclose(r->fp);
+        free(r);
+}
+
+bool
+pan_capture_probe(const char *path)
+{
+        struct pan_capture_reader *r = pan_capture_reader_open(path, NULL);
+
+        if (!r)
+                return false;
+
+        pan_capture_reader_close(r);
+        return true;
+}
+
+/* The BOs are replayed into pandecode as they were at the time of each
+ * submission, which is then decoded as PAN_MESA_DEBUG=trace would have done,
+ * to the files named by PANDECODE_DUMP_FILE. */
+
+struct capture_bo {
+        uint64_t size;
+        void *data;
+};
+
+static void
+capture_free_bo(struct hash_table_u64 *bos, uint64_t va)
+{
+        struct capture_bo *bo = _mesa_hash_table_u64_search(bos, va);
+
+        if (!bo)
+                return;
+
+        pandecode_inject_free(va, bo->size);
+        _mesa_hash_table_u64_remove(bos, va);
+        free(bo->data);
+        free(bo);
+}
+
+static bool
+capture_read_bo(struct pan_capture_reader *r, struct hash_table_u64 *bos,
+                const struct pan_capture_record *rec)
+{
+        struct capture_bo *bo = _mesa_hash_table_u64_search(bos, rec->va);
+
+        if (bo && bo->size != rec->size) {
+                capture_free_bo(bos, rec->va);
+                bo = NULL;
+        }
+
+        if (!bo) {
+                bo = calloc(1, sizeof(*bo));
+                bo->size = rec->size;
+                _mesa_hash_table_u64_insert(bos, rec->va, bo);
+        }
+
+        /* BOs without contents stay mapped without a CPU copy, the decoder
+         * reports accesses to them */
+        if (rec->data_size) {
+                if (rec->data_size != rec->size) {
+                        fprintf(stderr, "BO at %" PRIx64 " has a bad size\n",
+                                rec->va);
+                        return false;
+                }
+
+                if (!bo->data)
+                        bo->data = malloc(rec->size);
+
+                if (!pan_capture_read(r, bo->data, rec->size)) {
+                        fprintf(stderr, "Truncated BO at %" PRIx64 "\n",
+                                rec->va);
+                        return false;
+                }
+        } else {
+                free(bo->data);
+                bo->data = NULL;
+        }
+
+        pandecode_inject_mmap(rec->va, bo->data, rec->size, NULL);
+        return true;
+}
+
+bool
+pan_capture_decode(const char *path, bool stats)
+{
+        unsigned frames = 0, submits = 0, bo_records = 0;
+        uint64_t bo_bytes = 0;
+        uint32_t gpu_id = 0;
+
+        struct pan_capture_reader *r = pan_capture_reader_open(path, &gpu_id);
+
+        if (!r) {
+                fprintf(stderr, "Not a Panfrost capture\n");
+                return false;
+        }
+
+        struct hash_table_u64 *bos = _mesa_hash_table_u64_create(NULL);
+        struct pan_capture_record rec;
+        bool ok = true;
+
+        if (!stats)
+                pandecode_initialize(false);
+
+        while (ok && pan_capture_reader_next(r, &rec)) {
+                switch (rec.type) {
+                case PAN_CAPTURE_RECORD_BO:
+                        bo_records++;
+                        bo_bytes += rec.data_size;
+
+                        if (stats)
+                                ok = pan_capture_reader_skip(r, rec.data_size);
+                        else
+                                ok = capture_read_bo(r, bos, &rec);
+                        break;
+                case PAN_CAPTURE_RECORD_FREE:
+                        if (!stats)
+                                capture_free_bo(bos, rec.va);
+                        break;
+                case PAN_CAPTURE_RECORD_JC:
+                        submits++;
+                        if (!stats)
+                                pandecode_jc(rec.va, gpu_id);
+                        break;
+                case PAN_CAPTURE_RECORD_CS:
+                        submits++;
+                        if (!stats)
+                                pandecode_cs(rec.va, rec.size, gpu_id);
+                        break;
+                case PAN_CAPTURE_RECORD_FRAME:
+                        frames++;
+                        if (!stats)
+                                pandecode_next_frame();
+                        break;
+                default:
+                        /* Only needed for replay, or from newer versions */
+                        ok = pan_capture_reader_skip(r, rec.data_size);
+                        break;
+                }
+        }
+
+        if (stats) {
+                printf("GPU ID: %" PRIX32 "\n", gpu_id);
+                printf("Frames: %u\n", frames);
+                printf("Submissions: %u\n", submits);
+                printf("BO records: %u (%" PRIu64 " bytes)\n", bo_records,
+                       bo_bytes);
+        } else {
+                pandecode_close();
+        }
+
+        ok = ok && !r->corrupt;
+
+        _mesa_hash_table_u64_destroy(bos);
+        pan_capture_reader_close(r);
+
+        return ok;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/u_math.h"
+#include "pan_encoder.h"
+
+/* Compute jobs are split into tasks, which the job manager hands out to the
+ * shader cores. Tasks always hold whole workgroups. Large tasks amortize the
+ * cost of dispatching them, but a grid must be split into at least a couple
+ * of tasks per core for every core to get work, which matters for grids with
+ * few workgroups or narrow in one dimension. */
+
+#define PAN_TASKS_PER_CORE 2
+
+/* Most workgroups merged into a task on Midgard and Bifrost, matching the
+ * split used for large grids before it depended on the core count */
+#define PAN_MAX_TASK_WORKGROUPS_LOG2 3
+
+static unsigned
+panfrost_target_task_count(unsigned core_count)
+{
+        return MAX2(core_count, 1) * PAN_TASKS_PER_CORE;
+}
+
+/* Midgard and Bifrost give the log2 of the size of a task in the packed
+ * invocation space, where the workgroup size takes the low bits. Indirect
+ * dispatches don't know their grid size, so they are assumed large. */
+
+unsigned
+panfrost_compute_task_split(unsigned core_count,
+                            unsigned num_x, unsigned num_y, unsigned num_z,
+                            unsigned size_x, unsigned size_y, unsigned size_z,
+                            bool indirect)
+{
+        unsigned wg_bits = util_logbase2_ceil(size_x) +
+                           util_logbase2_ceil(size_y) +
+                           util_logbase2_ceil(size_z);
+
+        unsigned extra = PAN_MAX_TASK_WORKGROUPS_LOG2;
+
+        if (!indirect) {
+                uint64_t count = (uint64_t) num_x * num_y * num_z;
+                uint64_t per_task = count / panfrost_target_task_count(core_count);
+
+                extra = per_task ? MIN2(util_logbase2_64(per_task), extra) : 0;
+        }
+
+        /* The field is 4 bits */
+        return MIN2(wg_bits + extra, 15);
+}
+
+/* Valhall splits a grid along one axis, a task covering `increment` steps
+ * along that axis and the whole grid in the axes below it. Pick the highest
+ * axis that still gives enough tasks, with the largest increment keeping
+ * both the task count and the threads per task in bounds. */
+
+void
+panfrost_compute_task_axis(unsigned core_count, unsigned max_threads,
+                           const unsigned grid[3], unsigned wg_threads,
+                           unsigned *axis, unsigned *increment)
+{
+        unsigned target = panfrost_target_task_count(core_count);
+
+        for (int i = 2; i >= 0; --i) {
+                uint64_t lower = wg_threads, outer = 1;
+
+                for (int j = 0; j < i; ++j)
+                        lower *= MAX2(grid[j], 1);
+
+                for (int j = i + 1; j < 3; ++j)
+                        outer *= MAX2(grid[j], 1);
+
+                /* Steps along the axis needed for enough tasks */
+                uint64_t steps = DIV_ROUND_UP(target, outer);
+                uint64_t n = MIN2(grid[i] / steps, max_threads / lower);
+
+                if (n == 0 && i > 0)
+                        continue;
+
+                *axis = i;
+                *increment = CLAMP(n, 1, MIN2(MAX2(grid[i], 1), (1 << 14) - 1));
+                return;
+        }
+
+        unreachable("the X axis always fits");
+}
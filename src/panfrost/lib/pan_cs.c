@@ -112,28 +112,41 @@ GENX(pan_select_crc_rt)(const struct pan_fb_info *fb, unsigned tile_size)
 
         return -1;
 #else
+        /* Checksums live in the ZS/CRC extension, which only describes one
+         * render target. Writeback can only be skipped for a target whose
+         * checksums are still valid, and only the checksummed target keeps
+         * them valid, so a valid target is kept as long as possible. When
+         * there is none, start checksumming the target with the most bytes
+         * written back per pixel, which has the most to save. */
         bool best_rt_valid = false;
+        unsigned best_rt_bytes = 0;
         int best_rt = -1;
 
+        bool full = !fb->extent.minx && !fb->extent.miny &&
+                    fb->extent.maxx == (fb->width - 1) &&
+                    fb->extent.maxy == (fb->height - 1);
+
         for (unsigned i = 0; i < fb->rt_count; i++) {
-		if (!fb->rts[i].view || fb->rts[0].discard ||
-                    !fb->rts[i].view->image->layout.crc)
+                const struct pan_image_view *rt = fb->rts[i].view;
+
+                if (!rt || fb->rts[i].discard || !rt->image->layout.crc)
                         continue;
 
                 bool valid = *(fb->rts[i].crc_valid);
-                bool full = !fb->extent.minx && !fb->extent.miny &&
-                            fb->extent.maxx == (fb->width - 1) &&
-                            fb->extent.maxy == (fb->height - 1);
                 if (!full && !valid)
                         continue;
 
-                if (best_rt < 0 || (valid && !best_rt_valid)) {
-                        best_rt = i;
-                        best_rt_valid = valid;
-                }
+                unsigned bytes = util_format_get_blocksize(rt->format) *
+                                 rt->image->layout.nr_samples;
+
+                bool better = best_rt < 0 || (valid && !best_rt_valid) ||
+                              (valid == best_rt_valid && bytes > best_rt_bytes);
+                if (!better)
+                        continue;
 
-                if (valid)
-                        break;
+                best_rt = i;
+                best_rt_valid = valid;
+                best_rt_bytes = bytes;
         }
 
         return best_rt;
@@ -324,6 +337,16 @@ pan_bytes_per_pixel_tib(enum pipe_format format)
         }
 }
 
+/* Every sample of the view takes space in the tile buffer, including when
+ * multisampled rendering to a single-sampled image is resolved on writeback.
+ * The size of the image samples doesn't matter. */
+
+static unsigned
+pan_rt_bytes_per_pixel_tib(const struct pan_image_view *rt)
+{
+        return pan_bytes_per_pixel_tib(rt->format) * rt->nr_samples;
+}
+
 static unsigned
 pan_cbuf_bytes_per_pixel(const struct pan_fb_info *fb)
 {
@@ -335,7 +358,7 @@ pan_cbuf_bytes_per_pixel(const struct pan_fb_info *fb)
                 if (!rt)
                         continue;
 
-                sum += pan_bytes_per_pixel_tib(rt->format) * rt->nr_samples;
+                sum += pan_rt_bytes_per_pixel_tib(rt);
         }
 
         return sum;
@@ -358,6 +381,25 @@ pan_select_max_tile_size(unsigned tile_buffer_bytes, unsigned bytes_per_pixel)
         return tile_buffer_bytes >> util_logbase2_ceil(bytes_per_pixel);
 }
 
+/* Tile size, in pixels, used to render a framebuffer. The colour buffer
+ * budget is the part of the tile buffer of this GPU model that still lets
+ * tiles be pipelined, see panfrost_query_optimal_tib_size. */
+
+unsigned
+GENX(pan_select_tile_size)(const struct panfrost_device *dev,
+                           const struct pan_fb_info *fb)
+{
+        unsigned bytes_per_pixel = pan_cbuf_bytes_per_pixel(fb);
+        unsigned tile_size = pan_select_max_tile_size(dev->optimal_tib_size,
+                                                      bytes_per_pixel);
+
+        /* Clamp tile size to hardware limits */
+        tile_size = MIN2(tile_size, 16 * 16);
+        assert(tile_size >= 4 * 4);
+
+        return tile_size;
+}
+
 static enum mali_color_format
 pan_mfbd_raw_format(unsigned bits)
 {
@@ -519,6 +561,7 @@ pan_prepare_rt(const struct pan_fb_info *fb, unsigned idx,
                         cfg->afbc.yuv_transform = true;
 
                 cfg->afbc.wide_block = panfrost_afbc_is_wide(rt->image->layout.modifier);
+                cfg->afbc.split_block = (rt->image->layout.modifier & AFBC_FORMAT_MOD_SPLIT);
                 cfg->afbc.header = surf.afbc.header;
                 cfg->afbc.body_offset = surf.afbc.body - surf.afbc.header;
                 assert(surf.afbc.body >= surf.afbc.header);
@@ -532,6 +575,8 @@ pan_prepare_rt(const struct pan_fb_info *fb, unsigned idx,
                 cfg->afbc.row_stride = pan_afbc_stride_blocks(rt->image->layout.modifier, slice->row_stride);
                 cfg->afbc.afbc_wide_block_enable =
                         panfrost_afbc_is_wide(rt->image->layout.modifier);
+                cfg->afbc.afbc_split_block_enable =
+                        (rt->image->layout.modifier & AFBC_FORMAT_MOD_SPLIT);
 #else
                 cfg->afbc.chunk_size = 9;
                 cfg->afbc.sparse = true;
@@ -620,7 +665,9 @@ pan_emit_midgard_tiler(const struct panfrost_device *dev,
                         cfg.hierarchy_mask =
                                 panfrost_choose_hierarchy_mask(fb->width,
                                                                fb->height,
-                                                               1, hierarchy);
+                                                               1,
+                                                               tiler_ctx->midgard.primitive_size,
+                                                               hierarchy);
                         header_size = panfrost_tiler_header_size(fb->width,
                                                                  fb->height,
                                                                  cfg.hierarchy_mask,
@@ -728,12 +775,7 @@ GENX(pan_emit_fbd)(const struct panfrost_device *dev,
 #endif
 
         unsigned bytes_per_pixel = pan_cbuf_bytes_per_pixel(fb);
-        unsigned tile_size = pan_select_max_tile_size(dev->optimal_tib_size,
-                                                      bytes_per_pixel);
-
-        /* Clamp tile size to hardware limits */
-        tile_size = MIN2(tile_size, 16 * 16);
-        assert(tile_size >= 4 * 4);
+        unsigned tile_size = GENX(pan_select_tile_size)(dev, fb);
 
         /* Colour buffer allocations must be 1K aligned. */
         unsigned cbuf_allocation = ALIGN_POT(bytes_per_pixel * tile_size, 1024);
@@ -828,8 +870,8 @@ GENX(pan_emit_fbd)(const struct panfrost_device *dev,
                 if (!fb->rts[i].view)
                         continue;
 
-                cbuf_offset += pan_bytes_per_pixel_tib(fb->rts[i].view->format) *
-                               tile_size * fb->rts[i].view->image->layout.nr_samples;
+                cbuf_offset += pan_rt_bytes_per_pixel_tib(fb->rts[i].view) *
+                               tile_size;
 
                 if (i != crc_rt)
                         *(fb->rts[i].crc_valid) = false;
@@ -968,6 +1010,7 @@ GENX(pan_emit_tiler_ctx)(const struct panfrost_device *dev,
                          unsigned fb_width, unsigned fb_height,
                          unsigned nr_samples,
                          bool first_provoking_vertex,
+                         unsigned primitive_size,
                          mali_ptr heap,
                          mali_ptr scratch,
                          void *out)
@@ -976,8 +1019,6 @@ GENX(pan_emit_tiler_ctx)(const struct panfrost_device *dev,
         assert(max_levels >= 2);
 
         pan_pack(out, TILER_CONTEXT, tiler) {
-                /* TODO: Select hierarchy mask more effectively. */
-
                 /* Disable the smallest hierarchy level. This is required to
                  * use 32x32 tiles on v10, and helps reduce tiler heap memory
                  * usage for other GPUs. The rasteriser can efficiently skip
@@ -990,6 +1031,13 @@ GENX(pan_emit_tiler_ctx)(const struct panfrost_device *dev,
                  */
                 tiler.hierarchy_mask = (max_levels >= 8) ? 0xFE : 0x28;
 
+                /* With large primitives, drop more of the small levels. GPUs
+                 * with few levels already only enable large ones. */
+                if (max_levels >= 8) {
+                        tiler.hierarchy_mask &=
+                                panfrost_hierarchy_levels_for_size(primitive_size);
+                }
+
                 tiler.fb_width = fb_width;
                 tiler.fb_height = fb_height;
                 tiler.heap = heap;
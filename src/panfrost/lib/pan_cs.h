@@ -29,9 +29,13 @@
 #define __PAN_CS_H
 
 #include "genxml/gen_macros.h"
+#include "util/bitset.h"
 
 #include "pan_texture.h"
 
+/* Number of 32-bit registers tracked by pan_cs_builder */
+#define PAN_CS_BUILDER_REGS 96
+
 struct pan_compute_dim {
         uint32_t x, y, z;
 };
@@ -74,6 +78,10 @@ struct pan_tiler_context {
                 struct {
                         bool disable;
                         struct panfrost_bo *polygon_list;
+
+                        /* Estimated primitive size used to size the polygon
+                         * list, see panfrost_tiler_primitive_size */
+                        unsigned primitive_size;
                 } midgard;
         };
 };
@@ -104,6 +112,14 @@ struct pan_fb_info {
                 /* Max values are inclusive */
                 unsigned minx, miny, maxx, maxy;
         } extent;
+
+        /* If enabled, only this part of the extent holds valid data to
+         * preload. Max values are inclusive. */
+        struct {
+                bool enable;
+                unsigned minx, miny, maxx, maxy;
+        } preload_region;
+
         unsigned nr_samples;
         unsigned rt_count;
         struct pan_fb_color_attachment rts[8];
@@ -125,12 +141,26 @@ struct pan_fb_info {
         pan_command_stream *cs_fragment;
 };
 
+/* Number of WLS instances to allocate per core, which must be a power of two.
+ * A core never has more workgroups resident than fit in its thread slots, so
+ * that bounds the count, as does the size of the grid when it is known. Pass
+ * a NULL grid for indirect dispatches. */
 static inline unsigned
-pan_wls_instances(const struct pan_compute_dim *dim)
+pan_wls_instances(const struct panfrost_device *dev,
+                  const struct pan_compute_dim *local_size,
+                  const struct pan_compute_dim *dim)
 {
-        return util_next_power_of_two(dim->x) *
-               util_next_power_of_two(dim->y) *
-               util_next_power_of_two(dim->z);
+        unsigned threads = MAX2(local_size->x * local_size->y * local_size->z, 1);
+        unsigned per_core = DIV_ROUND_UP(dev->thread_tls_alloc, threads);
+        unsigned instances = util_next_power_of_two(MAX2(per_core, 1));
+
+        if (!dim)
+                return instances;
+
+        return MIN2(instances,
+                    util_next_power_of_two(MAX2(dim->x, 1)) *
+                    util_next_power_of_two(MAX2(dim->y, 1)) *
+                    util_next_power_of_two(MAX2(dim->z, 1)));
 }
 
 static inline unsigned
@@ -141,14 +171,36 @@ pan_wls_adjust_size(unsigned wls_size)
 
 static inline unsigned
 pan_wls_mem_size(const struct panfrost_device *dev,
+                 const struct pan_compute_dim *local_size,
                  const struct pan_compute_dim *dim,
                  unsigned wls_size)
 {
-        unsigned instances = pan_wls_instances(dim);
+        unsigned instances = pan_wls_instances(dev, local_size, dim);
 
         return pan_wls_adjust_size(wls_size) * instances * dev->core_id_range;
 }
 
+/* Wraps a command stream, remembering the values moved into registers so
+ * that moves of a value the register already holds can be dropped. Scratch
+ * register pairs can also be handed out by value, so that a value used by
+ * several instructions is only moved once.
+ *
+ * Only moves done through the builder are tracked. Anything else that can
+ * write registers, such as CS_LDR, CS_CALL or moves emitted directly, must
+ * be followed by pan_cs_builder_invalidate. */
+struct pan_cs_builder {
+        pan_command_stream *s;
+
+        uint32_t values[PAN_CS_BUILDER_REGS];
+        BITSET_DECLARE(known, PAN_CS_BUILDER_REGS);
+
+        /* Scratch registers, as pairs from scratch_base */
+        uint8_t scratch_base;
+        unsigned scratch_pairs;
+        unsigned next_scratch;
+        uint8_t last_scratch;
+};
+
 #ifdef PAN_ARCH
 void
 GENX(pan_emit_tls)(const struct pan_tls_info *info,
@@ -157,6 +209,10 @@ GENX(pan_emit_tls)(const struct pan_tls_info *info,
 int
 GENX(pan_select_crc_rt)(const struct pan_fb_info *fb, unsigned tile_size);
 
+unsigned
+GENX(pan_select_tile_size)(const struct panfrost_device *dev,
+                           const struct pan_fb_info *fb);
+
 unsigned
 GENX(pan_emit_fbd)(const struct panfrost_device *dev,
                    const struct pan_fb_info *fb,
@@ -173,6 +229,7 @@ void
 GENX(pan_emit_tiler_ctx)(const struct panfrost_device *dev,
                          unsigned fb_width, unsigned fb_height,
                          unsigned nr_samples, bool first_provoking_vertex,
+                         unsigned primitive_size,
                          mali_ptr heap, mali_ptr scratch,
                          void *out);
 #endif
@@ -181,6 +238,170 @@ void
 GENX(pan_emit_fragment_job)(const struct pan_fb_info *fb,
                             mali_ptr fbd,
                             void *out);
+
+#if PAN_ARCH >= 10
+static inline void
+pan_cs_builder_invalidate(struct pan_cs_builder *b)
+{
+        BITSET_ZERO(b->known);
+}
+
+static inline void
+pan_cs_builder_init(struct pan_cs_builder *b, pan_command_stream *s,
+                    uint8_t scratch_base, unsigned scratch_pairs)
+{
+        assert(scratch_base + scratch_pairs * 2 <= PAN_CS_BUILDER_REGS);
+
+        *b = (struct pan_cs_builder) {
+                .s = s,
+                .scratch_base = scratch_base,
+                .scratch_pairs = scratch_pairs,
+                .last_scratch = 0xff,
+        };
+}
+
+static inline bool
+pan_cs_reg_holds(const struct pan_cs_builder *b, uint8_t reg, uint32_t value)
+{
+        return BITSET_TEST(b->known, reg) && b->values[reg] == value;
+}
+
+static inline void
+pan_cs_reg_set(struct pan_cs_builder *b, uint8_t reg, uint32_t value)
+{
+        BITSET_SET(b->known, reg);
+        b->values[reg] = value;
+}
+
+static inline void
+pan_cs_move32(struct pan_cs_builder *b, uint8_t reg, uint32_t value)
+{
+        if (pan_cs_reg_holds(b, reg, value))
+                return;
+
+        pan_emit_cs_32(b->s, reg, value);
+        pan_cs_reg_set(b, reg, value);
+}
+
+static inline void
+pan_cs_move64(struct pan_cs_builder *b, uint8_t reg, uint64_t value)
+{
+        uint32_t lo = value, hi = value >> 32;
+        bool need_lo = !pan_cs_reg_holds(b, reg, lo);
+        bool need_hi = !pan_cs_reg_holds(b, reg + 1, hi);
+
+        /* A 48-bit move writes both halves in a single instruction */
+        if (need_lo && need_hi && value < (1ULL << 48)) {
+                pan_emit_cs_48(b->s, reg, value);
+                pan_cs_reg_set(b, reg, lo);
+                pan_cs_reg_set(b, reg + 1, hi);
+                return;
+        }
+
+        if (need_lo)
+                pan_cs_move32(b, reg, lo);
+        if (need_hi)
+                pan_cs_move32(b, reg + 1, hi);
+}
+
+/* Returns a scratch register pair holding value. The pair returned by the
+ * previous call is never reused, so two values can be used together. */
+static inline uint8_t
+pan_cs_scratch64(struct pan_cs_builder *b, uint64_t value)
+{
+        for (unsigned i = 0; i < b->scratch_pairs; ++i) {
+                uint8_t reg = b->scratch_base + i * 2;
+
+                if (pan_cs_reg_holds(b, reg, value) &&
+                    pan_cs_reg_holds(b, reg + 1, value >> 32)) {
+                        b->last_scratch = reg;
+                        return reg;
+                }
+        }
+
+        assert(b->scratch_pairs >= 2);
+
+        uint8_t reg = b->scratch_base + b->next_scratch * 2;
+        b->next_scratch = (b->next_scratch + 1) % b->scratch_pairs;
+
+        if (reg == b->last_scratch) {
+                reg = b->scratch_base + b->next_scratch * 2;
+                b->next_scratch = (b->next_scratch + 1) % b->scratch_pairs;
+        }
+
+        pan_cs_move64(b, reg, value);
+        b->last_scratch = reg;
+        return reg;
+}
+
+/* Drops the moves emitted since start of values the registers are known to
+ * hold, compacting the stream in place. This lets state be emitted in full
+ * with the usual pack functions while only the registers that changed reach
+ * the command stream. Instructions other than moves are kept; unless they
+ * are known to leave the registers alone, the known values are forgotten.
+ * Branch offsets would be broken by the compaction, so branches must come
+ * after the compacted range. */
+static inline void
+pan_cs_builder_elide_moves(struct pan_cs_builder *b, uint64_t *start)
+{
+        uint64_t *out = start;
+
+        for (uint64_t *in = start; in < b->s->ptr; ++in) {
+                uint64_t ins = *in;
+                uint8_t op = ins >> 56;
+                uint8_t reg = (ins >> 48) & 0xff;
+                bool keep = true;
+
+                switch (op) {
+                case 1: {
+                        /* MOVE48, writing both halves of a pair */
+                        uint64_t value = ins & BITFIELD64_MASK(48);
+
+                        if (reg + 1 >= PAN_CS_BUILDER_REGS) {
+                                pan_cs_builder_invalidate(b);
+                                break;
+                        }
+
+                        keep = !pan_cs_reg_holds(b, reg, value) ||
+                               !pan_cs_reg_holds(b, reg + 1, value >> 32);
+                        pan_cs_reg_set(b, reg, value);
+                        pan_cs_reg_set(b, reg + 1, value >> 32);
+                        break;
+                }
+                case 2: {
+                        /* MOVE32 */
+                        uint32_t value = ins;
+
+                        if (reg >= PAN_CS_BUILDER_REGS) {
+                                pan_cs_builder_invalidate(b);
+                                break;
+                        }
+
+                        keep = !pan_cs_reg_holds(b, reg, value);
+                        pan_cs_reg_set(b, reg, value);
+                        break;
+                }
+                case 0: /* NOP */
+                case 3: /* WAIT */
+                case 4: /* COMPUTE_LAUNCH */
+                case 5: /* TILER_LAUNCH */
+                case 6: /* IDVS_LAUNCH */
+                case 21: /* STR */
+                        break;
+                default:
+                        assert(op != 22 && "branches can't be compacted");
+                        pan_cs_builder_invalidate(b);
+                        break;
+                }
+
+                if (keep)
+                        *(out++) = ins;
+        }
+
+        b->s->ptr = out;
+}
+#endif
+
 #endif /* ifdef PAN_ARCH */
 
 #endif
@@ -58,8 +58,36 @@ extern "C" {
 #define MIN_BO_CACHE_BUCKET (12) /* 2^12 = 4KB */
 #define MAX_BO_CACHE_BUCKET (22) /* 2^22 = 4MB */
 
-/* Fencepost problem, hence the off-by-one */
-#define NR_BO_CACHE_BUCKETS (MAX_BO_CACHE_BUCKET - MIN_BO_CACHE_BUCKET + 1)
+/* Each level is split into 2^BO_CACHE_BUCKET_SPLIT_BITS buckets, so that a
+ * BO is never more than 25% larger than the smallest size in its bucket */
+#define BO_CACHE_BUCKET_SPLIT_BITS (2)
+
+/* Fencepost problem, hence the off-by-one for the largest bucket */
+#define NR_BO_CACHE_BUCKETS \
+        (((MAX_BO_CACHE_BUCKET - MIN_BO_CACHE_BUCKET) << BO_CACHE_BUCKET_SPLIT_BITS) + 1)
+
+/* Per-thread BO cache magazines cover the buckets below 64 KB, with up to
+ * PAN_BO_MAGAZINE_SIZE BOs in each */
+#define PAN_BO_MAGAZINE_BUCKETS ((16 - MIN_BO_CACHE_BUCKET) << BO_CACHE_BUCKET_SPLIT_BITS)
+#define PAN_BO_MAGAZINE_SIZE (4)
+
+/* Small BOs on kbase are sub-allocated from 2 MB slabs, with power-of-two
+ * size classes from 4 KB up to (and excluding) the maximum */
+
+#define PAN_BO_SLAB_SIZE (2 * 1024 * 1024)
+#define MIN_BO_SLAB_ORDER (12) /* 2^12 = 4KB */
+#define MAX_BO_SLAB_ORDER (16) /* 2^16 = 64KB */
+#define NR_BO_SLAB_ORDERS (MAX_BO_SLAB_ORDER - MIN_BO_SLAB_ORDER + 1)
+
+/* BOs from this size on are backed by 2 MB pages on kbase, which saves GPU
+ * page table walks for large render targets and textures. Their size is
+ * rounded up to whole large pages. */
+
+#define PAN_LARGE_PAGE_SIZE (2 * 1024 * 1024)
+#define PAN_LARGE_PAGE_MIN_SIZE (8 * 1024 * 1024)
+
+/* Number of locks protecting BO usage lists */
+#define PAN_BO_USAGE_LOCKS 64
 
 struct pan_blitter {
         struct {
@@ -90,7 +118,8 @@ enum pan_indirect_draw_flags {
         PAN_INDIRECT_DRAW_PRIMITIVE_RESTART = 1 << 3,
         PAN_INDIRECT_DRAW_UPDATE_PRIM_SIZE = 1 << 4,
         PAN_INDIRECT_DRAW_IDVS = 1 << 5,
-        PAN_INDIRECT_DRAW_LAST_FLAG = PAN_INDIRECT_DRAW_IDVS,
+        PAN_INDIRECT_DRAW_DRAW_COUNT = 1 << 6,
+        PAN_INDIRECT_DRAW_LAST_FLAG = PAN_INDIRECT_DRAW_DRAW_COUNT,
         PAN_INDIRECT_DRAW_FLAGS_MASK = (PAN_INDIRECT_DRAW_LAST_FLAG << 1) - 1,
         PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX = PAN_INDIRECT_DRAW_LAST_FLAG << 1,
         PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_2B_INDEX,
@@ -98,6 +127,13 @@ enum pan_indirect_draw_flags {
         PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX_PRIM_RESTART,
         PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_2B_INDEX_PRIM_RESTART,
         PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_3B_INDEX_PRIM_RESTART,
+        PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX_DRAW_COUNT,
+        PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_2B_INDEX_DRAW_COUNT,
+        PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_4B_INDEX_DRAW_COUNT,
+        PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX_PRIM_RESTART_DRAW_COUNT,
+        PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_2B_INDEX_PRIM_RESTART_DRAW_COUNT,
+        PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_4B_INDEX_PRIM_RESTART_DRAW_COUNT,
+        PAN_INDIRECT_DRAW_RENDER_CONDITION,
         PAN_INDIRECT_DRAW_NUM_SHADERS,
 };
 
@@ -140,6 +176,8 @@ struct pan_indirect_dispatch {
 };
 
 /** Implementation-defined tiler features */
+struct disk_cache;
+
 struct panfrost_tiler_features {
         /** Number of bytes per tiler bin */
         unsigned bin_size;
@@ -209,6 +247,14 @@ struct panfrost_device {
         /* Does the kernel support dma-buf fence import/export? */
         bool has_dmabuf_fence;
 
+        /* Frequency in Hz of the system timestamp written by the GPU, or zero
+         * if it isn't known, in which case timestamps can't be converted to
+         * nanoseconds */
+        uint64_t timestamp_frequency;
+
+        /* Maximum GPU clock frequency in kHz, or zero if unknown */
+        unsigned max_freq_khz;
+
         /* Table of formats, indexed by a PIPE format */
         const struct panfrost_format *formats;
 
@@ -222,8 +268,10 @@ struct panfrost_device {
 
         struct renderonly *ro;
 
-        /* Hold this while updating usage field of BOs */
-        pthread_mutex_t bo_usage_lock;
+        /* Hold the lock for a BO, as returned by pan_bo_usage_lock, while
+         * accessing its usage field. The locks are sharded by GEM handle so
+         * that contexts submitting at the same time rarely contend. */
+        pthread_mutex_t bo_usage_lock[PAN_BO_USAGE_LOCKS];
 
         pthread_mutex_t bo_map_lock;
         struct stable_array bo_map;
@@ -237,14 +285,65 @@ struct panfrost_device {
                  */
                 struct list_head lru;
 
-                /* The BO cache is a set of buckets with power-of-two sizes
-                 * ranging from 2^12 (4096, the page size) to
-                 * 2^(12 + MAX_BO_CACHE_BUCKETS).
+                /* The BO cache is a set of buckets with sizes ranging from
+                 * 2^12 (4096, the page size) to 2^MAX_BO_CACHE_BUCKET, with
+                 * four buckets for each power of two.
                  * Each bucket is a linked list of free panfrost_bo objects. */
 
                 struct list_head buckets[NR_BO_CACHE_BUCKETS];
+
+                /* Fetch statistics for each bucket, written to the BO log */
+                uint64_t hits[NR_BO_CACHE_BUCKETS];
+                uint64_t misses[NR_BO_CACHE_BUCKETS];
+
+                /* Fetches served by the magazines or the buckets, and those
+                 * needing a new allocation, updated atomically for the
+                 * driver queries */
+                uint64_t fetch_hits;
+                uint64_t fetch_misses;
+
+                /* Total size of the cached BOs, and the limit after which
+                 * the least recently used BOs are evicted */
+                size_t size;
+                size_t max_size;
+
+                /* PSI trigger for memory pressure, or -1. It is polled at
+                 * most once a second, and half of the cache is evicted when
+                 * it fires. */
+                int psi_fd;
+                uint64_t last_pressure_check;
+
+                /* BOs unused for longer than this are evicted */
+                uint64_t retention_ms;
+
+                /* Optional thread evicting stale BOs even when nothing is
+                 * put in the cache */
+                bool trim_thread_enabled;
+                bool trim_thread_stop;
+                pthread_t trim_thread;
+                pthread_mutex_t trim_lock;
+                pthread_cond_t trim_cond;
+
+                /* Per-thread magazines in front of the buckets. The list is
+                 * protected by magazine_lock. */
+                bool magazines_enabled;
+                pthread_key_t magazine_key;
+                pthread_mutex_t magazine_lock;
+                struct list_head magazines;
         } bo_cache;
 
+        struct {
+                /* Protects the slab lists and the free masks of the slabs */
+                pthread_mutex_t lock;
+
+                /* Lists of panfrost_bo_slab, one per size class */
+                struct list_head slabs[NR_BO_SLAB_ORDERS];
+        } bo_slab;
+
+        /* Optional on-disk cache for the internal shaders below, owned by
+         * the driver */
+        struct disk_cache *disk_cache;
+
         struct pan_blitter blitter;
         struct pan_blend_shaders blend_shaders;
         struct pan_indirect_draw_shaders indirect_draw_shaders;
@@ -275,6 +374,9 @@ struct panfrost_device {
         struct kbase_ mali;
 
         FILE *bo_log;
+
+        /* Binary capture of the submissions, with PAN_MESA_DEBUG=capture */
+        struct pan_capture *capture;
 };
 
 void
@@ -304,6 +406,9 @@ panfrost_query_sample_position(
 unsigned
 panfrost_query_l2_slices(struct panfrost_device *dev);
 
+uint64_t
+panfrost_query_timestamp(void);
+
 static inline struct panfrost_bo *
 pan_lookup_bo(struct panfrost_device *dev, uint32_t gem_handle)
 {
@@ -316,6 +421,12 @@ pan_lookup_bo_existing(struct panfrost_device *dev, uint32_t gem_handle)
         return stable_array_get_existing(&dev->bo_map, struct panfrost_bo, gem_handle);
 }
 
+static inline pthread_mutex_t *
+pan_bo_usage_lock(struct panfrost_device *dev, uint32_t gem_handle)
+{
+        return &dev->bo_usage_lock[gem_handle % PAN_BO_USAGE_LOCKS];
+}
+
 static inline bool
 pan_is_bifrost(const struct panfrost_device *dev)
 {
@@ -35,6 +35,10 @@
 #include "genxml/gen_macros.h"
 #include "pan_device.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Tiler structure size computation */
 
 unsigned
@@ -43,29 +47,51 @@ panfrost_tiler_header_size(unsigned width, unsigned height, unsigned mask, bool
 unsigned
 panfrost_tiler_full_size(unsigned width, unsigned height, unsigned mask, bool hierarchy);
 
+unsigned
+panfrost_tiler_primitive_size(unsigned width, unsigned height,
+                              unsigned primitives);
+
+unsigned
+panfrost_hierarchy_levels_for_size(unsigned primitive_size);
+
 unsigned
 panfrost_choose_hierarchy_mask(
         unsigned width, unsigned height,
-        unsigned vertex_count, bool hierarchy);
+        unsigned vertex_count, unsigned primitive_size,
+        bool hierarchy);
 
 #if defined(PAN_ARCH) && PAN_ARCH <= 5
 static inline unsigned
 panfrost_tiler_get_polygon_list_size(const struct panfrost_device *dev,
                                      unsigned fb_width, unsigned fb_height,
-                                     bool has_draws)
+                                     unsigned primitive_size, bool has_draws)
 {
         if (!has_draws)
                 return MALI_MIDGARD_TILER_MINIMUM_HEADER_SIZE + 4;
 
         bool hierarchy = !dev->model->quirks.no_hierarchical_tiling;
         unsigned hierarchy_mask =
-                panfrost_choose_hierarchy_mask(fb_width, fb_height, 1, hierarchy);
+                panfrost_choose_hierarchy_mask(fb_width, fb_height, 1,
+                                               primitive_size, hierarchy);
 
         return panfrost_tiler_full_size(fb_width, fb_height, hierarchy_mask, hierarchy) +
                 panfrost_tiler_header_size(fb_width, fb_height, hierarchy_mask, hierarchy);
 }
 #endif
 
+/* Compute job splitting */
+
+unsigned
+panfrost_compute_task_split(unsigned core_count,
+                            unsigned num_x, unsigned num_y, unsigned num_z,
+                            unsigned size_x, unsigned size_y, unsigned size_z,
+                            bool indirect);
+
+void
+panfrost_compute_task_axis(unsigned core_count, unsigned max_threads,
+                           const unsigned grid[3], unsigned wg_threads,
+                           unsigned *axis, unsigned *increment);
+
 /* Stack sizes */
 
 unsigned
@@ -246,4 +272,8 @@ panfrost_make_resource_table(struct panfrost_ptr base, unsigned index,
 }
 #endif
 
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
 #endif
@@ -124,7 +124,7 @@ pan_indirect_dispatch_init(struct panfrost_device *dev)
         struct util_dynarray binary;
 
         util_dynarray_init(&binary, NULL);
-        GENX(pan_shader_compile)(b.shader, &inputs, &binary, &shader_info);
+        GENX(pan_shader_compile_cached)(dev, b.shader, &inputs, &binary, &shader_info);
 
         ralloc_free(b.shader);
 
@@ -31,6 +31,7 @@
 #include "pan_pool.h"
 #include "pan_util.h"
 #include "compiler/nir/nir_builder.h"
+#include "util/u_dynarray.h"
 #include "util/u_memory.h"
 #include "util/macros.h"
 
@@ -60,6 +61,8 @@ struct draw_data {
         nir_ssa_def *index_bias;
         nir_ssa_def *draw_ctx;
         nir_ssa_def *min_max_ctx;
+        nir_ssa_def *draw_count_ptr;
+        nir_ssa_def *draw_id;
 };
 
 struct instance_size {
@@ -175,6 +178,23 @@ struct indirect_draw_inputs {
         uint32_t draw_buf_stride;
         uint32_t restart_index;
         uint32_t attrib_count;
+        uint32_t draw_id;
+} PACKED;
+
+/* Render condition shader inputs, also stored in FAU. */
+
+struct render_condition_inputs {
+        /* Pointer to the 64-bit counters of the query */
+        mali_ptr counters;
+
+        /* Jobs to turn into NULL jobs, zero if unused */
+        mali_ptr vertex_job;
+        mali_ptr tiler_job;
+        uint32_t counter_count;
+
+        /* Non-zero to skip the jobs if any counter isn't zero, rather than
+         * if they all are */
+        uint32_t inverted;
 } PACKED;
 
 #define get_input_field(b, name) \
@@ -297,6 +317,11 @@ extract_inputs(struct indirect_draw_shader_builder *builder)
         builder->draw.draw_buf = get_input_field(b, draw_buf);
         builder->draw.draw_buf_stride = get_input_field(b, draw_buf_stride);
 
+        if (builder->flags & PAN_INDIRECT_DRAW_DRAW_COUNT) {
+                builder->draw.draw_count_ptr = get_input_field(b, draw_count_ptr);
+                builder->draw.draw_id = get_input_field(b, draw_id);
+        }
+
         if (builder->index_size) {
                 builder->draw.index_buf = get_input_field(b, index_buf);
                 builder->draw.min_max_ctx = get_input_field(b, min_max_ctx);
@@ -326,6 +351,24 @@ extract_inputs(struct indirect_draw_shader_builder *builder)
                       get_draw_ctx_field(builder, varying_mem), 3);
 }
 
+/* Draws at or past the count stored in the count buffer draw nothing */
+
+static nir_ssa_def *
+get_draw_vertex_count(struct indirect_draw_shader_builder *builder,
+                      nir_ssa_def *vertex_count)
+{
+        nir_builder *b = &builder->b;
+
+        if (!(builder->flags & PAN_INDIRECT_DRAW_DRAW_COUNT))
+                return vertex_count;
+
+        nir_ssa_def *draw_count =
+                load_global(b, builder->draw.draw_count_ptr, 1, 32);
+
+        return nir_bcsel(b, nir_ult(b, builder->draw.draw_id, draw_count),
+                         vertex_count, nir_imm_int(b, 0));
+}
+
 static void
 init_shader_builder(struct indirect_draw_shader_builder *builder,
                     const struct panfrost_device *dev,
@@ -343,13 +386,17 @@ init_shader_builder(struct indirect_draw_shader_builder *builder,
                 builder->b =
                         nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
                                                        GENX(pan_shader_get_compiler_options)(),
-                                                       "indirect_draw_min_max_index(index_size=%d)",
-                                                       builder->index_size);
+                                                       "indirect_draw_min_max_index(index_size=%d%s%s)",
+                                                       builder->index_size,
+                                                       flags & PAN_INDIRECT_DRAW_PRIMITIVE_RESTART ?
+                                                       ",primitive_restart" : "",
+                                                       flags & PAN_INDIRECT_DRAW_DRAW_COUNT ?
+                                                       ",draw_count" : "");
         } else {
                 builder->b =
                         nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
                                                        GENX(pan_shader_get_compiler_options)(),
-                                                       "indirect_draw(index_size=%d%s%s%s%s)",
+                                                       "indirect_draw(index_size=%d%s%s%s%s%s)",
                                                        builder->index_size,
                                                        flags & PAN_INDIRECT_DRAW_HAS_PSIZ ?
                                                        ",psiz" : "",
@@ -358,7 +405,9 @@ init_shader_builder(struct indirect_draw_shader_builder *builder,
                                                        flags & PAN_INDIRECT_DRAW_UPDATE_PRIM_SIZE ?
                                                        ",update_primitive_size" : "",
                                                        flags & PAN_INDIRECT_DRAW_IDVS ?
-                                                       ",idvs" : "");
+                                                       ",idvs" : "",
+                                                       flags & PAN_INDIRECT_DRAW_DRAW_COUNT ?
+                                                       ",draw_count" : "");
         }
 
         extract_inputs(builder);
@@ -825,6 +874,64 @@ set_null_job(struct indirect_draw_shader_builder *builder,
         store_global(b, w4, val, 1);
 }
 
+#define get_render_condition_field(b, name) \
+        nir_load_push_constant(b, \
+               1, sizeof(((struct render_condition_inputs *)0)->name) * 8, \
+               nir_imm_int(b, 0), \
+               .base = offsetof(struct render_condition_inputs, name))
+
+/* ORs the counters together, and turns the jobs into NULL jobs if the result
+ * matches the inverted flag, i.e. if the condition fails. */
+static void
+render_condition(struct indirect_draw_shader_builder *builder)
+{
+        nir_builder *b = &builder->b;
+        nir_ssa_def *counters = get_render_condition_field(b, counters);
+        nir_ssa_def *count = get_render_condition_field(b, counter_count);
+
+        nir_variable *any_var =
+                nir_local_variable_create(b->impl, glsl_uint_type(), "any");
+        nir_store_var(b, any_var, nir_imm_int(b, 0), 1);
+        nir_variable *idx_var =
+                nir_local_variable_create(b->impl, glsl_uint_type(), "idx");
+        nir_store_var(b, idx_var, nir_imm_int(b, 0), 1);
+
+        LOOP {
+                nir_ssa_def *idx = nir_load_var(b, idx_var);
+                IF (nir_uge(b, idx, count))
+                        BREAK;
+                ENDIF
+
+                nir_ssa_def *addr =
+                        get_address(b, counters,
+                                    nir_imul_imm(b, idx, sizeof(uint64_t)));
+                nir_ssa_def *val = load_global(b, addr, 2, 32);
+
+                val = nir_ior(b, nir_channel(b, val, 0), nir_channel(b, val, 1));
+                nir_store_var(b, any_var,
+                              nir_ior(b, nir_load_var(b, any_var), val), 1);
+                nir_store_var(b, idx_var, nir_iadd_imm(b, idx, 1), 1);
+        }
+
+        nir_ssa_def *passed =
+                nir_b2i32(b, nir_ine_imm(b, nir_load_var(b, any_var), 0));
+        nir_ssa_def *inverted =
+                nir_b2i32(b, nir_ine_imm(b, get_render_condition_field(b, inverted), 0));
+
+        IF (nir_ieq(b, passed, inverted))
+                nir_ssa_def *vertex_job = get_render_condition_field(b, vertex_job);
+                nir_ssa_def *tiler_job = get_render_condition_field(b, tiler_job);
+
+                IF (nir_ine_imm(b, vertex_job, 0))
+                        set_null_job(builder, vertex_job);
+                ENDIF
+
+                IF (nir_ine_imm(b, tiler_job, 0))
+                        set_null_job(builder, tiler_job);
+                ENDIF
+        ENDIF
+}
+
 static void
 get_instance_size(struct indirect_draw_shader_builder *builder)
 {
@@ -841,6 +948,12 @@ get_instance_size(struct indirect_draw_shader_builder *builder)
         nir_ssa_def *min = get_min_max_ctx_field(builder, min);
         nir_ssa_def *max = get_min_max_ctx_field(builder, max);
 
+        /* Put the context back in its initial state, so the min/max search
+         * can run again if the job chain is submitted more than once.
+         */
+        store_global(b, builder->draw.min_max_ctx,
+                     nir_imm_ivec2(b, UINT32_MAX, 0), 2);
+
         /* We handle unaligned indices here to avoid the extra complexity in
          * the min/max search job.
          */
@@ -950,6 +1063,9 @@ patch(struct indirect_draw_shader_builder *builder)
                 builder->draw.vertex_start = get_draw_field(b, draw_ptr, start);
         }
 
+        builder->draw.vertex_count =
+                get_draw_vertex_count(builder, builder->draw.vertex_count);
+
         assert(builder->draw.vertex_count->num_components);
 
         nir_ssa_def *num_vertices =
@@ -1011,7 +1127,9 @@ get_index_min_max(struct indirect_draw_shader_builder *builder)
 
         nir_ssa_def *draw_ptr = builder->draw.draw_buf;
 
-        builder->draw.vertex_count = get_draw_field(b, draw_ptr, count);
+        builder->draw.vertex_count =
+                get_draw_vertex_count(builder,
+                                      get_draw_field(b, draw_ptr, count));
         builder->draw.vertex_start = get_draw_field(b, draw_ptr, start);
 
         nir_ssa_def *thread_id = nir_channel(b, nir_load_global_invocation_id(b, 32), 0);
@@ -1093,28 +1211,25 @@ get_shader_id(unsigned flags, unsigned index_size, bool index_min_max_search)
                 return flags;
         }
 
-        return ((flags & PAN_INDIRECT_DRAW_PRIMITIVE_RESTART) ?
-                PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX_PRIM_RESTART :
-                PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX) +
-               util_logbase2(index_size);
+        unsigned id;
+
+        if (flags & PAN_INDIRECT_DRAW_DRAW_COUNT) {
+                id = (flags & PAN_INDIRECT_DRAW_PRIMITIVE_RESTART) ?
+                     PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX_PRIM_RESTART_DRAW_COUNT :
+                     PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX_DRAW_COUNT;
+        } else {
+                id = (flags & PAN_INDIRECT_DRAW_PRIMITIVE_RESTART) ?
+                     PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX_PRIM_RESTART :
+                     PAN_INDIRECT_DRAW_MIN_MAX_SEARCH_1B_INDEX;
+        }
+
+        return id + util_logbase2(index_size);
 }
 
 static void
-create_indirect_draw_shader(struct panfrost_device *dev,
-                            unsigned flags, unsigned index_size,
-                            bool index_min_max_search)
+upload_shader(struct panfrost_device *dev, unsigned shader_id,
+              nir_shader *shader, size_t inputs_size)
 {
-        assert(flags < PAN_INDIRECT_DRAW_NUM_SHADERS);
-        struct indirect_draw_shader_builder builder;
-        init_shader_builder(&builder, dev, flags, index_size, index_min_max_search);
-
-        nir_builder *b = &builder.b;
-
-        if (index_min_max_search)
-                get_index_min_max(&builder);
-        else
-                patch(&builder);
-
         struct panfrost_compile_inputs inputs = {
                 .gpu_id = dev->gpu_id,
                 .fixed_sysval_ubo = -1,
@@ -1124,16 +1239,14 @@ create_indirect_draw_shader(struct panfrost_device *dev,
         struct util_dynarray binary;
 
         util_dynarray_init(&binary, NULL);
-        GENX(pan_shader_compile)(b->shader, &inputs, &binary, &shader_info);
+        GENX(pan_shader_compile_cached)(dev, shader, &inputs, &binary, &shader_info);
 
         assert(!shader_info.tls_size);
         assert(!shader_info.wls_size);
         assert(!shader_info.sysvals.sysval_count);
 
-        shader_info.push.count =
-                DIV_ROUND_UP(sizeof(struct indirect_draw_inputs), 4);
+        shader_info.push.count = DIV_ROUND_UP(inputs_size, 4);
 
-        unsigned shader_id = get_shader_id(flags, index_size, index_min_max_search);
         struct pan_indirect_draw_shader *draw_shader =
                 &dev->indirect_draw_shaders.shaders[shader_id];
         void *state = dev->indirect_draw_shaders.states->ptr.cpu +
@@ -1157,10 +1270,50 @@ create_indirect_draw_shader(struct panfrost_device *dev,
                                    (shader_id * pan_size(RENDERER_STATE));
         }
         pthread_mutex_unlock(&dev->indirect_draw_shaders.lock);
+}
+
+static void
+create_indirect_draw_shader(struct panfrost_device *dev,
+                            unsigned flags, unsigned index_size,
+                            bool index_min_max_search)
+{
+        assert(flags < PAN_INDIRECT_DRAW_NUM_SHADERS);
+        struct indirect_draw_shader_builder builder;
+        init_shader_builder(&builder, dev, flags, index_size, index_min_max_search);
+
+        nir_builder *b = &builder.b;
+
+        if (index_min_max_search)
+                get_index_min_max(&builder);
+        else
+                patch(&builder);
+
+        upload_shader(dev, get_shader_id(flags, index_size, index_min_max_search),
+                      b->shader, sizeof(struct indirect_draw_inputs));
 
         ralloc_free(b->shader);
 }
 
+static void
+create_render_condition_shader(struct panfrost_device *dev)
+{
+        struct indirect_draw_shader_builder builder;
+
+        memset(&builder, 0, sizeof(builder));
+        builder.dev = dev;
+        builder.b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                               GENX(pan_shader_get_compiler_options)(),
+                                               "render_condition");
+
+        render_condition(&builder);
+
+        upload_shader(dev, PAN_INDIRECT_DRAW_RENDER_CONDITION,
+                      builder.b.shader, sizeof(struct render_condition_inputs));
+
+        ralloc_free(builder.b.shader);
+}
+
 static mali_ptr
 get_renderer_state(struct panfrost_device *dev, unsigned flags,
                    unsigned index_size, bool index_min_max_search)
@@ -1178,6 +1331,20 @@ get_renderer_state(struct panfrost_device *dev, unsigned flags,
         return info->rsd;
 }
 
+static mali_ptr
+get_render_condition_state(struct panfrost_device *dev)
+{
+        struct pan_indirect_draw_shader *info =
+                &dev->indirect_draw_shaders.shaders[PAN_INDIRECT_DRAW_RENDER_CONDITION];
+
+        if (!info->rsd) {
+                create_render_condition_shader(dev);
+                assert(info->rsd);
+        }
+
+        return info->rsd;
+}
+
 static mali_ptr
 get_tls(const struct panfrost_device *dev)
 {
@@ -1257,6 +1424,9 @@ panfrost_emit_index_min_max_search(struct pan_pool *pool,
                         pan_pool_upload_aligned(pool, inputs, sizeof(*inputs), 16);
         }
 
+        if (draw_info->jobs)
+                util_dynarray_append(draw_info->jobs, void *, job.cpu);
+
         return panfrost_add_job(pool, scoreboard, MALI_JOB_TYPE_COMPUTE,
                                 false, false, 0, 0, &job, false);
 }
@@ -1308,6 +1478,11 @@ GENX(panfrost_emit_indirect_draw)(struct pan_pool *pool,
                 .attrib_count = draw_info->attrib_count,
         };
 
+        if (draw_info->flags & PAN_INDIRECT_DRAW_DRAW_COUNT) {
+                inputs.draw_count_ptr = draw_info->draw_count_ptr;
+                inputs.draw_id = draw_info->draw_id;
+        }
+
         if (draw_info->index_size) {
                 inputs.restart_index = draw_info->restart_index;
 
@@ -1349,11 +1524,65 @@ GENX(panfrost_emit_indirect_draw)(struct pan_pool *pool,
                 memcpy(ctx->cpu, &draw_ctx, sizeof(draw_ctx));
         }
 
+        if (draw_info->jobs)
+                util_dynarray_append(draw_info->jobs, void *, job.cpu);
+
         return panfrost_add_job(pool, scoreboard, MALI_JOB_TYPE_COMPUTE,
                                 false, true, local_dep, global_dep,
                                 &job, false);
 }
 
+unsigned
+GENX(panfrost_emit_render_condition)(struct pan_pool *pool,
+                                     struct pan_scoreboard *scoreboard,
+                                     const struct pan_render_condition_info *info)
+{
+        struct panfrost_device *dev = pool->dev;
+
+        panfrost_indirect_draw_alloc_deps(dev);
+
+        struct render_condition_inputs inputs = {
+                .counters = info->counters,
+                .vertex_job = info->vertex_job,
+                .tiler_job = info->tiler_job,
+                .counter_count = info->counter_count,
+                .inverted = info->inverted,
+        };
+
+        struct panfrost_ptr job =
+                pan_pool_alloc_desc(pool, COMPUTE_JOB);
+        void *invocation =
+                pan_section_ptr(job.cpu, COMPUTE_JOB, INVOCATION);
+        panfrost_pack_work_groups_compute(invocation,
+                                          1, 1, 1, 1, 1, 1,
+                                          false, false);
+
+        pan_section_pack(job.cpu, COMPUTE_JOB, PARAMETERS, cfg) {
+                cfg.job_task_split = 2;
+        }
+
+        pan_section_pack(job.cpu, COMPUTE_JOB, DRAW, cfg) {
+                cfg.state = get_render_condition_state(dev);
+                cfg.thread_storage = get_tls(pool->dev);
+                cfg.push_uniforms =
+                        pan_pool_upload_aligned(pool, &inputs, sizeof(inputs), 16);
+        }
+
+        /* The patched job headers must not be prefetched before this job
+         * is done, like with indirect draws */
+        return panfrost_add_job(pool, scoreboard, MALI_JOB_TYPE_COMPUTE,
+                                false, true, 0, 0, &job, false);
+}
+
+void
+GENX(panfrost_reset_indirect_draw_ctx)(struct panfrost_device *dev,
+                                       const struct panfrost_ptr *ctx)
+{
+        struct indirect_draw_context *draw_ctx = ctx->cpu;
+
+        draw_ctx->varying_mem = dev->indirect_draw_shaders.varying_heap->ptr.gpu;
+}
+
 void
 GENX(panfrost_init_indirect_draw_shaders)(struct panfrost_device *dev,
                                           struct pan_pool *bin_pool)
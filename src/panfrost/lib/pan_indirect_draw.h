@@ -29,6 +29,7 @@
 struct pan_device;
 struct pan_scoreboard;
 struct pan_pool;
+struct util_dynarray;
 
 struct pan_indirect_draw_info {
         mali_ptr draw_buf;
@@ -46,6 +47,18 @@ struct pan_indirect_draw_info {
         unsigned flags;
         unsigned index_size;
         unsigned last_indirect_draw;
+
+        /* With PAN_INDIRECT_DRAW_DRAW_COUNT, the draw is skipped unless
+         * draw_id is lower than the uint32_t at draw_count_ptr.
+         */
+        mali_ptr draw_count_ptr;
+        uint32_t draw_id;
+
+        /* If not NULL, the CPU pointers to the compute jobs emitted are
+         * appended to it, for callers submitting the job chain more than
+         * once to reset their headers.
+         */
+        struct util_dynarray *jobs;
 };
 
 unsigned
@@ -54,6 +67,35 @@ GENX(panfrost_emit_indirect_draw)(struct pan_pool *pool,
                                   const struct pan_indirect_draw_info *draw_info,
                                   struct panfrost_ptr *ctx);
 
+struct pan_render_condition_info {
+        /* 64-bit counters of an occlusion query, the condition passes if
+         * any of them isn't zero */
+        mali_ptr counters;
+        unsigned counter_count;
+
+        /* Pass if all the counters are zero instead */
+        bool inverted;
+
+        /* Jobs turned into NULL jobs if the condition fails, zero if
+         * unused */
+        mali_ptr vertex_job;
+        mali_ptr tiler_job;
+};
+
+/* Emits a compute job skipping the jobs of a draw unless the render condition
+ * passes. Returns its job index, which the jobs must depend on. */
+unsigned
+GENX(panfrost_emit_render_condition)(struct pan_pool *pool,
+                                     struct pan_scoreboard *scoreboard,
+                                     const struct pan_render_condition_info *info);
+
+/* Restores the context shared by the indirect draws of a job chain, before
+ * submitting it again.
+ */
+void
+GENX(panfrost_reset_indirect_draw_ctx)(struct panfrost_device *dev,
+                                       const struct panfrost_ptr *ctx);
+
 void
 GENX(panfrost_init_indirect_draw_shaders)(struct panfrost_device *dev,
                                           struct pan_pool *bin_pool);
@@ -58,6 +58,13 @@ uint64_t pan_best_modifiers[PAN_MODIFIER_COUNT] = {
                 AFBC_FORMAT_MOD_SPARSE |
                 AFBC_FORMAT_MOD_YTR),
 
+        /* Only for display engines that can't scan out anything else */
+        DRM_FORMAT_MOD_ARM_AFBC(
+                AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                AFBC_FORMAT_MOD_SPARSE |
+                AFBC_FORMAT_MOD_SPLIT |
+                AFBC_FORMAT_MOD_YTR),
+
         DRM_FORMAT_MOD_ARM_AFBC(
                 AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
                 AFBC_FORMAT_MOD_SPARSE),
@@ -272,19 +279,6 @@ panfrost_from_legacy_stride(unsigned legacy_stride,
         }
 }
 
-/* Computes the offset into a texture at a particular level/face. Add to
- * the base address of a texture to get the address to that level/face */
-
-unsigned
-panfrost_texture_offset(const struct pan_image_layout *layout,
-                        unsigned level, unsigned array_idx,
-                        unsigned surface_idx)
-{
-        return layout->slices[level].offset +
-               (array_idx * layout->array_stride) +
-               (surface_idx * layout->slices[level].surface_stride);
-}
-
 bool
 pan_image_layout_init(struct pan_image_layout *layout,
                       const struct pan_image_explicit_layout *explicit_layout)
@@ -302,7 +296,12 @@ pan_image_layout_init(struct pan_image_layout *layout,
         if (explicit_layout && (explicit_layout->offset & 63))
                 return false;
 
-        unsigned fmt_blocksize = util_format_get_blocksize(layout->format);
+        /* Look the format up once rather than for every level */
+        const struct util_format_description *desc =
+                util_format_description(layout->format);
+        unsigned fmt_blocksize = MAX2(desc->block.bits / 8, 1);
+        unsigned fmt_block_w = desc->block.width;
+        unsigned fmt_block_h = desc->block.height;
 
         /* MSAA is implemented as a 3D texture with z corresponding to the
          * sample #, horrifyingly enough */
@@ -333,8 +332,8 @@ pan_image_layout_init(struct pan_image_layout *layout,
         for (unsigned l = 0; l < layout->nr_slices; ++l) {
                 struct pan_image_slice_layout *slice = &layout->slices[l];
 
-                unsigned effective_width = ALIGN_POT(util_format_get_nblocksx(layout->format, width), align_w);
-                unsigned effective_height = ALIGN_POT(util_format_get_nblocksy(layout->format, height), align_h);
+                unsigned effective_width = ALIGN_POT(DIV_ROUND_UP(width, fmt_block_w), align_w);
+                unsigned effective_height = ALIGN_POT(DIV_ROUND_UP(height, fmt_block_h), align_h);
 
                 /* Align levels to cache-line as a performance improvement for
                  * linear/tiled and as a requirement for AFBC */
@@ -25,17 +25,22 @@
  */
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <xf86drm.h>
 
 #include "util/u_math.h"
 #include "util/macros.h"
 #include "util/hash_table.h"
 #include "util/u_thread.h"
+#include "util/u_debug.h"
+#include "util/os_misc.h"
 #include "drm-uapi/panfrost_drm.h"
+#include "panfrost/base/include/mali_kbase_gpuprops.h"
 #include "dma-uapi/dma-buf.h"
 #include "pan_encoder.h"
 #include "pan_device.h"
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_texture.h"
 #include "wrap.h"
 #include "pan_util.h"
@@ -295,6 +300,83 @@ panfrost_query_optimal_tib_size(const struct panfrost_device *dev)
         return dev->model->tilebuffer_size / 2;
 }
 
+/* The system timestamp of the GPU counts at the frequency of the architected
+ * timer of the SoC, which userspace can read directly on Arm CPUs. */
+
+static uint64_t
+panfrost_query_timestamp_frequency(void)
+{
+#if defined(__aarch64__)
+        uint64_t freq;
+        __asm__ volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+        return freq;
+#elif defined(__arm__)
+        uint32_t freq;
+        __asm__ volatile("mrc p15, 0, %0, c14, c0, 0" : "=r" (freq));
+        return freq;
+#else
+        return 0;
+#endif
+}
+
+/* Read the architected timer, counting in the same time base as the system
+ * timestamps written by the GPU. Zero if it can't be read. */
+
+uint64_t
+panfrost_query_timestamp(void)
+{
+#if defined(__aarch64__)
+        uint64_t ticks;
+        __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r" (ticks));
+        return ticks;
+#elif defined(__arm__)
+        uint32_t lo, hi;
+        __asm__ volatile("isb; mrrc p15, 1, %0, %1, c14" : "=r" (lo), "=r" (hi));
+        return ((uint64_t) hi << 32) | lo;
+#else
+        return 0;
+#endif
+}
+
+/* Only kbase reports the clock of the GPU */
+
+static unsigned
+panfrost_query_max_freq_khz(struct panfrost_device *dev)
+{
+        uint64_t value;
+
+        if (dev->kbase &&
+            dev->mali.get_mali_gpuprop(&dev->mali,
+                                       KBASE_GPUPROP_GPU_FREQ_KHZ_MAX,
+                                       &value))
+                return value;
+
+        return 0;
+}
+
+/* Registers a PSI trigger for memory stalls, so that the BO cache can be
+ * trimmed before the system starts swapping or killing processes. Returns -1
+ * if PSI is not available. */
+
+static int
+panfrost_open_memory_pressure(void)
+{
+        int fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1)
+                return -1;
+
+        /* 150 ms of stalls within 2 s, the smallest window unprivileged
+         * processes are allowed to use */
+        const char trigger[] = "some 150000 2000000";
+
+        if (write(fd, trigger, sizeof(trigger)) != sizeof(trigger)) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
 void
 panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
 {
@@ -332,6 +414,8 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
         dev->compressed_formats = panfrost_query_compressed_formats(dev);
         dev->tiler_features = panfrost_query_tiler_features(dev);
         dev->has_afbc = panfrost_query_afbc(dev, dev->arch);
+        dev->timestamp_frequency = panfrost_query_timestamp_frequency();
+        dev->max_freq_khz = panfrost_query_max_freq_khz(dev);
 
         if (dev->arch <= 6)
                 dev->formats = panfrost_pipe_format_v6;
@@ -342,7 +426,8 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
 
         stable_array_init(&dev->bo_map, struct panfrost_bo);
 
-        pthread_mutex_init(&dev->bo_usage_lock, NULL);
+        for (unsigned i = 0; i < ARRAY_SIZE(dev->bo_usage_lock); ++i)
+                pthread_mutex_init(&dev->bo_usage_lock[i], NULL);
         pthread_mutex_init(&dev->bo_map_lock, NULL);
         pthread_mutex_init(&dev->bo_cache.lock, NULL);
         list_inithead(&dev->bo_cache.lru);
@@ -350,10 +435,32 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
         for (unsigned i = 0; i < ARRAY_SIZE(dev->bo_cache.buckets); ++i)
                 list_inithead(&dev->bo_cache.buckets[i]);
 
+        uint64_t system_memory = 0;
+        os_get_total_physical_memory(&system_memory);
+
+        /* Default to 1/16 of system memory, with at least 16 MB */
+        size_t cache_mb = MAX2(system_memory >> 24, 16);
+        cache_mb = debug_get_num_option("PAN_BO_CACHE_SIZE_MB", cache_mb);
+        dev->bo_cache.max_size = cache_mb << 20;
+        dev->bo_cache.psi_fd = panfrost_open_memory_pressure();
+        dev->bo_cache.retention_ms =
+                debug_get_num_option("PAN_BO_CACHE_RETENTION_MS", 1000);
+
+        pthread_mutex_init(&dev->bo_slab.lock, NULL);
+        for (unsigned i = 0; i < ARRAY_SIZE(dev->bo_slab.slabs); ++i)
+                list_inithead(&dev->bo_slab.slabs[i]);
+
+        panfrost_bo_magazines_init(dev);
+
+        if (debug_get_bool_option("PAN_BO_CACHE_TRIM_THREAD", false))
+                panfrost_bo_cache_start_trim_thread(dev);
+
         /* Initialize pandecode before we start allocating */
         if (dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC))
                 pandecode_initialize(!(dev->debug & PAN_DBG_TRACE));
 
+        pan_capture_init(dev);
+
         /* Tiler heap is internally required by the tiler, which can only be
          * active for a single job chain at once, so a single heap can be
          * shared across batches/contextes */
@@ -378,10 +485,17 @@ panfrost_close_device(struct panfrost_device *dev)
                 pthread_mutex_destroy(&dev->submit_lock);
                 panfrost_bo_unreference(dev->tiler_heap);
                 panfrost_bo_unreference(dev->sample_positions);
+                panfrost_bo_cache_stop_trim_thread(dev);
                 panfrost_bo_cache_evict_all(dev);
+                panfrost_bo_magazines_fini(dev);
+                pan_capture_fini(dev);
                 pthread_mutex_destroy(&dev->bo_cache.lock);
+                if (dev->bo_cache.psi_fd != -1)
+                        close(dev->bo_cache.psi_fd);
+                pthread_mutex_destroy(&dev->bo_slab.lock);
                 pthread_mutex_destroy(&dev->bo_map_lock);
-                pthread_mutex_destroy(&dev->bo_usage_lock);
+                for (unsigned i = 0; i < ARRAY_SIZE(dev->bo_usage_lock); ++i)
+                        pthread_mutex_destroy(&dev->bo_usage_lock[i]);
                 stable_array_fini(&dev->bo_map);
         }
 
@@ -25,6 +25,9 @@
 #include "pan_device.h"
 #include "pan_shader.h"
 #include "pan_format.h"
+#include "compiler/nir/nir_serialize.h"
+#include "util/blob.h"
+#include "util/disk_cache.h"
 
 #if PAN_ARCH <= 5
 #include "panfrost/midgard/midgard_compile.h"
@@ -220,3 +223,91 @@ GENX(pan_shader_compile)(nir_shader *s,
         }
 #endif
 }
+
+#ifdef ENABLE_SHADER_CACHE
+static bool
+pan_shader_cache_key(struct disk_cache *cache, nir_shader *nir,
+                     const struct panfrost_compile_inputs *inputs,
+                     cache_key key)
+{
+        /* The sysval layout is only known through a pointer */
+        if (!cache || inputs->fixed_sysval_layout)
+                return false;
+
+        struct panfrost_compile_inputs hashed = *inputs;
+        hashed.debug = NULL;
+
+        struct blob blob;
+        blob_init(&blob);
+        nir_serialize(&blob, nir, true);
+        blob_write_bytes(&blob, &hashed, sizeof(hashed));
+        disk_cache_compute_key(cache, blob.data, blob.size, key);
+        blob_finish(&blob);
+
+        return true;
+}
+#endif
+
+/* Compile an internal shader, going through the device's disk cache when it
+ * has one. The cache key covers the NIR and the compile inputs, so it must be
+ * computed before compiling, as the compile alters both. */
+
+void
+GENX(pan_shader_compile_cached)(struct panfrost_device *dev,
+                                nir_shader *s,
+                                struct panfrost_compile_inputs *inputs,
+                                struct util_dynarray *binary,
+                                struct pan_shader_info *info)
+{
+#ifdef ENABLE_SHADER_CACHE
+        struct disk_cache *cache = dev->disk_cache;
+        cache_key key;
+        bool cached = pan_shader_cache_key(cache, s, inputs, key);
+
+        if (cached) {
+                size_t size;
+                void *buffer = disk_cache_get(cache, key, &size);
+
+                if (buffer) {
+                        struct blob_reader blob;
+                        blob_reader_init(&blob, buffer, size);
+
+                        uint32_t binary_size = blob_read_uint32(&blob);
+                        const void *data = blob_read_bytes(&blob, binary_size);
+                        blob_copy_bytes(&blob, info, sizeof(*info));
+
+                        bool hit = !blob.overrun && blob.current == blob.end;
+
+                        if (hit)
+                                memcpy(util_dynarray_grow_bytes(binary, 1, binary_size),
+                                       data, binary_size);
+
+                        free(buffer);
+
+                        if (hit)
+                                return;
+                }
+        }
+
+        unsigned start = binary->size;
+#endif
+
+        GENX(pan_shader_compile)(s, inputs, binary, info);
+
+#ifdef ENABLE_SHADER_CACHE
+        if (cached) {
+                struct blob blob;
+                blob_init(&blob);
+
+                /* Same layout as the driver's shader cache entries: size of
+                 * the binary, the binary, then the shader info */
+                blob_write_uint32(&blob, binary->size - start);
+                blob_write_bytes(&blob, (uint8_t *) binary->data + start,
+                                 binary->size - start);
+                blob_write_bytes(&blob, info, sizeof(*info));
+
+                disk_cache_put(cache, key, blob.data, blob.size, NULL);
+                blob_finish(&blob);
+        }
+#endif
+}
@@ -44,6 +44,13 @@ GENX(pan_shader_compile)(nir_shader *nir,
                          struct util_dynarray *binary,
                          struct pan_shader_info *info);
 
+void
+GENX(pan_shader_compile_cached)(struct panfrost_device *dev,
+                                nir_shader *nir,
+                                struct panfrost_compile_inputs *inputs,
+                                struct util_dynarray *binary,
+                                struct pan_shader_info *info);
+
 #if PAN_ARCH >= 6 && PAN_ARCH <= 7
 enum mali_register_file_format
 GENX(pan_fixup_blend_type)(nir_alu_type T_size, enum pipe_format format);
@@ -44,7 +44,7 @@
 extern "C" {
 #endif
 
-#define PAN_MODIFIER_COUNT 7
+#define PAN_MODIFIER_COUNT 8
 extern uint64_t pan_best_modifiers[PAN_MODIFIER_COUNT];
 
 struct pan_image_slice_crc {
@@ -160,6 +160,9 @@ panfrost_afbc_format(unsigned arch, enum pipe_format format);
 bool
 panfrost_afbc_can_ytr(enum pipe_format format);
 
+bool
+panfrost_afbc_can_split(unsigned arch, enum pipe_format format);
+
 bool
 panfrost_afbc_can_tile(const struct panfrost_device *dev);
 
@@ -208,10 +211,19 @@ unsigned
 panfrost_get_layer_stride(const struct pan_image_layout *layout,
                           unsigned level);
 
-unsigned
+/* Computes the offset into a texture at a particular level/face. Add to
+ * the base address of a texture to get the address to that level/face.
+ * Inline, since every transfer computes a few of these. */
+
+static inline unsigned
 panfrost_texture_offset(const struct pan_image_layout *layout,
                         unsigned level, unsigned array_idx,
-                        unsigned surface_idx);
+                        unsigned surface_idx)
+{
+        return layout->slices[level].offset +
+               (array_idx * layout->array_stride) +
+               (surface_idx * layout->slices[level].surface_stride);
+}
 
 struct pan_pool;
 struct pan_scoreboard;
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+#include "util/u_queue.h"
+#include "util/u_thread.h"
+#include "pan_device.h"
+#include "pan_thread.h"
+
+/* Cores are told apart by the capacity the kernel gives them, or by their
+ * maximum frequency on kernels without it. Cores with the highest value are
+ * the big cores. */
+
+static struct {
+        bool heterogeneous;
+        util_affinity_mask big, little;
+} pan_cpu_topology;
+
+static once_flag pan_cpu_topology_once = ONCE_FLAG_INIT;
+
+static const char *pan_cpu_capacity_files[] = {
+        "cpu_capacity",
+        "cpufreq/cpuinfo_max_freq",
+};
+
+static unsigned
+pan_read_cpu_capacity(unsigned cpu, const char *file)
+{
+        char path[128];
+        unsigned value = 0;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/%s",
+                 cpu, file);
+
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+                return 0;
+
+        if (fscanf(fp, "%u", &value) != 1)
+                value = 0;
+
+        fclose(fp);
+        return value;
+}
+
+static void
+pan_detect_cpu_topology(void)
+{
+        unsigned nr_cpus = MIN2(util_get_cpu_caps()->nr_cpus, UTIL_MAX_CPUS);
+        unsigned capacity[UTIL_MAX_CPUS];
+
+        for (unsigned f = 0; f < ARRAY_SIZE(pan_cpu_capacity_files); ++f) {
+                unsigned min = ~0, max = 0;
+
+                for (unsigned i = 0; i < nr_cpus; ++i) {
+                        capacity[i] = pan_read_cpu_capacity(i, pan_cpu_capacity_files[f]);
+                        min = MIN2(min, capacity[i]);
+                        max = MAX2(max, capacity[i]);
+                }
+
+                /* Try the next source if a core is missing */
+                if (min == 0)
+                        continue;
+
+                if (min == max)
+                        return;
+
+                for (unsigned i = 0; i < nr_cpus; ++i) {
+                        uint32_t *mask = capacity[i] == max ?
+                                         pan_cpu_topology.big :
+                                         pan_cpu_topology.little;
+
+                        mask[i / 32] |= 1u << (i % 32);
+                }
+
+                pan_cpu_topology.heterogeneous = true;
+                return;
+        }
+}
+
+bool
+pan_cpu_is_heterogeneous(void)
+{
+        call_once(&pan_cpu_topology_once, pan_detect_cpu_topology);
+        return pan_cpu_topology.heterogeneous;
+}
+
+void
+pan_thread_set_class(thrd_t thread, enum pan_thread_class cls)
+{
+        if (cls == PAN_THREAD_BACKGROUND) {
+#if defined(__linux__) && defined(SCHED_IDLE)
+                /* Only lowers the priority, so needs no privileges */
+                struct sched_param param = { 0 };
+                pthread_setschedparam(thread, SCHED_IDLE, &param);
+#endif
+        }
+
+        if (!pan_cpu_is_heterogeneous())
+                return;
+
+        const uint32_t *mask = (cls == PAN_THREAD_BACKGROUND) ?
+                               pan_cpu_topology.little :
+                               pan_cpu_topology.big;
+
+        util_set_thread_affinity(thread, mask, NULL, UTIL_MAX_CPUS);
+}
+
+void
+pan_queue_set_class(struct util_queue *queue, enum pan_thread_class cls)
+{
+        if (!util_queue_is_initialized(queue))
+                return;
+
+        simple_mtx_lock(&queue->finish_lock);
+
+        for (unsigned i = 0; i < queue->num_threads; ++i)
+                pan_thread_set_class(queue->threads[i], cls);
+
+        simple_mtx_unlock(&queue->finish_lock);
+}
+
+/* Threads started when opening the device, before the driver configuration
+ * is known */
+
+void
+panfrost_place_device_threads(struct panfrost_device *dev)
+{
+        if (dev->mali.event_thread_enabled)
+                pan_thread_set_class(dev->mali.event_thread, PAN_THREAD_LATENCY);
+
+        if (dev->bo_cache.trim_thread_enabled)
+                pan_thread_set_class(dev->bo_cache.trim_thread, PAN_THREAD_BACKGROUND);
+}
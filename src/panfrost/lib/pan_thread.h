@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_THREAD_H__
+#define __PAN_THREAD_H__
+
+#include <stdbool.h>
+#include "c11/threads.h"
+
+struct panfrost_device;
+struct util_queue;
+
+/* Kinds of work done by the internal threads of the driver. On CPUs mixing
+ * big and little cores, latency sensitive and CPU heavy work is kept on the
+ * big cores, and background work on the little ones. Nothing changes on
+ * CPUs with a single kind of core. */
+
+enum pan_thread_class {
+        /* Waiting on GPU events, must wake up quickly */
+        PAN_THREAD_LATENCY,
+
+        /* Shader compiles and tiling */
+        PAN_THREAD_COMPUTE,
+
+        /* Cache trimming, also run at idle priority */
+        PAN_THREAD_BACKGROUND,
+};
+
+bool
+pan_cpu_is_heterogeneous(void);
+
+void
+pan_thread_set_class(thrd_t thread, enum pan_thread_class cls);
+
+void
+pan_queue_set_class(struct util_queue *queue, enum pan_thread_class cls);
+
+void
+panfrost_place_device_threads(struct panfrost_device *dev);
+
+#endif
@@ -349,16 +349,50 @@ panfrost_choose_tile_size(
         return exp_w | (exp_h << 6);
 }
 
-/* In the future, a heuristic to choose a tiler hierarchy mask would go here.
- * At the moment, we just default to 0xFF, which enables all possible hierarchy
- * levels. Overall this yields good performance but presumably incurs a cost in
- * memory bandwidth / power consumption / etc, at least on smaller scenes that
- * don't really need all the smaller levels enabled */
+/* Estimate the bounding box size of the primitives of a render pass from the
+ * number of primitives drawn, with the equal-size, no-overdraw assumption
+ * described above. A right triangle of area A has a bounding box of area 2A.
+ * Returns 0 when the primitive count is unknown. */
+
+unsigned
+panfrost_tiler_primitive_size(unsigned width, unsigned height,
+                              unsigned primitives)
+{
+        if (!primitives)
+                return 0;
+
+        uint64_t area = ((uint64_t) width * height * 2) / primitives;
+        return sqrtf(area);
+}
+
+/* Tiles much smaller than the primitives only cost polygon list memory and
+ * tiler bandwidth, so for primitives of the given size (0 if unknown), mask
+ * out the levels with tiles smaller than a quarter of a primitive. The levels
+ * from 256x256 up are always kept, as there will be smaller primitives too. */
+
+unsigned
+panfrost_hierarchy_levels_for_size(unsigned primitive_size)
+{
+        unsigned min_tile = MIN2(primitive_size / 4, 256);
+
+        if (min_tile <= MIN_TILE_SIZE)
+                return ~0;
+
+        min_tile = 1 << util_logbase2(min_tile);
+        return ~((min_tile / MIN_TILE_SIZE) - 1);
+}
+
+/* Without an estimate of the primitive size, we default to 0xFF, which
+ * enables all possible hierarchy levels. Overall this yields good performance
+ * but presumably incurs a cost in memory bandwidth / power consumption / etc,
+ * at least on smaller scenes that don't really need all the smaller levels
+ * enabled */
 
 unsigned
 panfrost_choose_hierarchy_mask(
         unsigned width, unsigned height,
-        unsigned vertex_count, bool hierarchy)
+        unsigned vertex_count, unsigned primitive_size,
+        bool hierarchy)
 {
         /* If there is no geometry, we don't bother enabling anything */
 
@@ -368,7 +402,5 @@ panfrost_choose_hierarchy_mask(
         if (!hierarchy)
                 return panfrost_choose_tile_size(width, height, vertex_count);
 
-        /* Otherwise, default everything on. TODO: Proper tests */
-
-        return 0xFF;
+        return 0xFF & panfrost_hierarchy_levels_for_size(primitive_size);
 }
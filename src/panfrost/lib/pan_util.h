@@ -37,7 +37,7 @@
 #define PAN_DBG_DEQP            0x0004
 #define PAN_DBG_DIRTY           0x0008
 #define PAN_DBG_SYNC            0x0010
-/* 0x20 unused */
+#define PAN_DBG_REPLAY          0x0020
 #define PAN_DBG_NOFP16          0x0040
 #define PAN_DBG_NO_CRC          0x0080
 #define PAN_DBG_GL3             0x0100
@@ -57,6 +57,12 @@
 #define PAN_DBG_UNCACHED_CPU  0x200000
 #define PAN_DBG_LOG           0x400000
 #define PAN_DBG_GOFASTER      0x800000
+#define PAN_DBG_GROW_VARYINGS 0x1000000
+#define PAN_DBG_AFBC_PACK     0x2000000
+#define PAN_DBG_CAPTURE       0x4000000
+#define PAN_DBG_FAULT_DUMP    0x8000000
+#define PAN_DBG_SUBMIT_PROFILE 0x10000000
+#define PAN_DBG_NO_PRECOMPILE 0x20000000
 
 struct panfrost_device;
 
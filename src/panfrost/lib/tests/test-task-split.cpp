@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_encoder.h"
+
+#include <gtest/gtest.h>
+
+static const unsigned grids[][3] = {
+   { 1, 1, 1 },    { 3, 1, 1 },    { 8, 1, 1 },     { 64, 1, 1 },
+   { 1, 64, 1 },   { 1, 1, 64 },   { 4096, 1, 1 },  { 1, 1, 4096 },
+   { 16, 16, 1 },  { 256, 256, 1 }, { 2, 2, 2 },    { 32, 1, 32 },
+};
+
+static const unsigned core_counts[] = { 1, 2, 4, 8, 16 };
+
+static unsigned
+target_tasks(unsigned cores, const unsigned grid[3])
+{
+   return MIN2(cores * 2, grid[0] * grid[1] * grid[2]);
+}
+
+TEST(TaskSplit, SmallGridSpreadsOverCores)
+{
+   /* 8 workgroups of 8x8 on 4 cores: one workgroup per task */
+   EXPECT_EQ(panfrost_compute_task_split(4, 8, 1, 1, 8, 8, 1, false), 6);
+}
+
+TEST(TaskSplit, LargeGridMergesWorkgroups)
+{
+   EXPECT_EQ(panfrost_compute_task_split(4, 4096, 1, 1, 64, 1, 1, false), 9);
+   EXPECT_EQ(panfrost_compute_task_split(4, 1, 1, 1, 64, 1, 1, true), 9);
+}
+
+TEST(TaskSplit, SweepGridShapes)
+{
+   for (unsigned cores : core_counts) {
+      for (auto &grid : grids) {
+         unsigned split = panfrost_compute_task_split(
+            cores, grid[0], grid[1], grid[2], 16, 4, 1, false);
+
+         /* Tasks hold whole workgroups */
+         ASSERT_GE(split, 6);
+
+         unsigned per_task = 1 << (split - 6);
+         unsigned count = grid[0] * grid[1] * grid[2];
+
+         EXPECT_GE(DIV_ROUND_UP(count, per_task), target_tasks(cores, grid))
+            << cores << " cores, grid " << grid[0] << "x" << grid[1] << "x"
+            << grid[2];
+      }
+   }
+}
+
+TEST(TaskAxis, NarrowGrids)
+{
+   unsigned axis, increment;
+
+   unsigned x[3] = { 64, 1, 1 };
+   panfrost_compute_task_axis(4, 1024, x, 64, &axis, &increment);
+   EXPECT_EQ(axis, 0);
+   EXPECT_EQ(increment, 8);
+
+   unsigned z[3] = { 1, 1, 64 };
+   panfrost_compute_task_axis(4, 1024, z, 64, &axis, &increment);
+   EXPECT_EQ(axis, 2);
+   EXPECT_EQ(increment, 8);
+}
+
+TEST(TaskAxis, SweepGridShapes)
+{
+   for (unsigned cores : core_counts) {
+      for (auto &grid : grids) {
+         unsigned axis, increment;
+         panfrost_compute_task_axis(cores, 1024, grid, 64, &axis, &increment);
+
+         ASSERT_LT(axis, 3);
+         ASSERT_GE(increment, 1);
+
+         unsigned lower = 64, outer = 1;
+
+         for (unsigned i = 0; i < axis; ++i)
+            lower *= grid[i];
+
+         for (unsigned i = axis + 1; i < 3; ++i)
+            outer *= grid[i];
+
+         unsigned tasks = DIV_ROUND_UP(grid[axis], increment) * outer;
+
+         EXPECT_GE(tasks, target_tasks(cores, grid))
+            << cores << " cores, grid " << grid[0] << "x" << grid[1] << "x"
+            << grid[2];
+
+         EXPECT_LE(lower * increment, 1024)
+            << cores << " cores, grid " << grid[0] << "x" << grid[1] << "x"
+            << grid[2];
+      }
+   }
+}
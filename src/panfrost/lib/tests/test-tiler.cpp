@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_encoder.h"
+
+#include <gtest/gtest.h>
+
+TEST(Hierarchy, UnknownPrimitiveSize)
+{
+   EXPECT_EQ(panfrost_tiler_primitive_size(1920, 1080, 0), 0);
+   EXPECT_EQ(panfrost_choose_hierarchy_mask(1920, 1080, 1, 0, true), 0xFF);
+}
+
+TEST(Hierarchy, NoGeometry)
+{
+   EXPECT_EQ(panfrost_choose_hierarchy_mask(1920, 1080, 0, 0, true), 0x00);
+}
+
+TEST(Hierarchy, SmallPrimitivesUseAllLevels)
+{
+   /* A million triangles on a 1080p framebuffer are a few pixels each */
+   unsigned size = panfrost_tiler_primitive_size(1920, 1080, 1000000);
+
+   EXPECT_LT(size, 16);
+   EXPECT_EQ(panfrost_choose_hierarchy_mask(1920, 1080, 1, size, true), 0xFF);
+}
+
+TEST(Hierarchy, LargePrimitivesDropSmallLevels)
+{
+   /* A fullscreen quad */
+   unsigned size = panfrost_tiler_primitive_size(1920, 1080, 2);
+
+   EXPECT_EQ(size, 1440);
+
+   /* Levels from 256x256 up are kept */
+   EXPECT_EQ(panfrost_choose_hierarchy_mask(1920, 1080, 1, size, true), 0xF0);
+}
+
+TEST(Hierarchy, MediumPrimitives)
+{
+   /* 64x64 pixel bounding boxes keep the levels from 16x16 up */
+   EXPECT_EQ(panfrost_hierarchy_levels_for_size(64) & 0xFF, 0xFF);
+
+   /* 128x128 pixel bounding boxes keep the levels from 32x32 up */
+   EXPECT_EQ(panfrost_hierarchy_levels_for_size(128) & 0xFF, 0xFE);
+
+   /* Levels are only dropped for whole powers of two */
+   EXPECT_EQ(panfrost_hierarchy_levels_for_size(255) & 0xFF, 0xFE);
+   EXPECT_EQ(panfrost_hierarchy_levels_for_size(256) & 0xFF, 0xFC);
+}
+
+TEST(Hierarchy, FlatTilingIgnoresPrimitiveSize)
+{
+   EXPECT_EQ(panfrost_choose_hierarchy_mask(1920, 1080, 1, 1440, false),
+             panfrost_choose_hierarchy_mask(1920, 1080, 1, 0, false));
+}
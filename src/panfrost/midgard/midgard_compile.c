@@ -366,7 +366,7 @@ optimise_nir(nir_shader *nir, unsigned quirks, bool is_blend, bool is_blit)
                 NIR_PASS_V(nir, nir_io_add_const_offset_to_base,
                            nir_var_shader_in | nir_var_shader_out);
                 NIR_PASS_V(nir, nir_io_add_intrinsic_xfb_info);
-                NIR_PASS_V(nir, pan_lower_xfb);
+                NIR_PASS_V(nir, pan_lower_xfb, false);
         }
 
         NIR_PASS(progress, nir, midgard_nir_lower_algebraic_early);
@@ -3358,31 +3358,43 @@ midgard_compile_shader_nir(nir_shader *nir,
         if (binary->size)
                 memset(util_dynarray_grow(binary, uint8_t, 16), 0, 16);
 
-        if ((midgard_debug & MIDGARD_DBG_SHADERDB || inputs->debug) &&
-            !nir->info.internal) {
-                unsigned nr_bundles = 0, nr_ins = 0;
+        unsigned nr_bundles = 0, nr_ins = 0;
 
-                /* Count instructions and bundles */
+        /* Count instructions and bundles */
 
-                mir_foreach_block(ctx, _block) {
-                        midgard_block *block = (midgard_block *) _block;
-                        nr_bundles += util_dynarray_num_elements(
-                                              &block->bundles, midgard_bundle);
+        mir_foreach_block(ctx, _block) {
+                midgard_block *block = (midgard_block *) _block;
+                nr_bundles += util_dynarray_num_elements(
+                                      &block->bundles, midgard_bundle);
 
-                        mir_foreach_bundle_in_block(block, bun)
-                                nr_ins += bun->instruction_count;
-                }
+                mir_foreach_bundle_in_block(block, bun)
+                        nr_ins += bun->instruction_count;
+        }
+
+        /* Calculate thread count. There are certain cutoffs by
+         * register count for thread count */
 
-                /* Calculate thread count. There are certain cutoffs by
-                 * register count for thread count */
+        unsigned nr_registers = info->work_reg_count;
 
-                unsigned nr_registers = info->work_reg_count;
+        unsigned nr_threads =
+                (nr_registers <= 4) ? 4 :
+                (nr_registers <= 8) ? 2 :
+                1;
 
-                unsigned nr_threads =
-                        (nr_registers <= 4) ? 4 :
-                        (nr_registers <= 8) ? 2 :
-                        1;
+        /* There is no cycle model for Midgard yet */
+        info->stats = (struct pan_shader_stats) {
+                .instrs = nr_ins,
+                .bundles = nr_bundles,
+                .code_size = ctx->quadword_count * 16,
+                .work_regs = nr_registers,
+                .threads = nr_threads,
+                .loops = ctx->loop_count,
+                .spills = ctx->spills,
+                .fills = ctx->fills,
+        };
 
+        if ((midgard_debug & MIDGARD_DBG_SHADERDB || inputs->debug) &&
+            !nir->info.internal) {
                 char *shaderdb = NULL;
 
                 /* Dump stats */
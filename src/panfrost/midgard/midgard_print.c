@@ -359,10 +359,47 @@ mir_print_block(midgard_block *block)
         printf("\n\n");
 }
 
+/* Summarizes how densely the scheduler packed ALU bundles. There are five
+ * ALU units plus the branch unit per bundle. */
+
+static void
+mir_print_bundle_density(compiler_context *ctx)
+{
+        unsigned nr_bundles = 0, nr_alu_bundles = 0, nr_alu = 0;
+        unsigned nr_constants = 0, nr_padding = 0;
+
+        mir_foreach_block(ctx, _block) {
+                midgard_block *block = (midgard_block *) _block;
+
+                if (!block->scheduled)
+                        return;
+
+                mir_foreach_bundle_in_block(block, bundle) {
+                        nr_bundles++;
+
+                        if (!IS_ALU(bundle->tag))
+                                continue;
+
+                        nr_alu_bundles++;
+                        nr_alu += bundle->instruction_count;
+                        nr_constants += bundle->has_embedded_constants;
+                        nr_padding += bundle->padding;
+                }
+        }
+
+        printf("/* %u bundles, %u ALU bundles, %.2f instructions per ALU "
+               "bundle, %u with constants, %u bytes of padding */\n\n",
+               nr_bundles, nr_alu_bundles,
+               nr_alu_bundles ? ((float) nr_alu / nr_alu_bundles) : 0.0,
+               nr_constants, nr_padding);
+}
+
 void
 mir_print_shader(compiler_context *ctx)
 {
         mir_foreach_block(ctx, block) {
                 mir_print_block((midgard_block *) block);
         }
+
+        mir_print_bundle_density(ctx);
 }
@@ -443,14 +443,17 @@ mir_adjust_constant(midgard_instruction *ins, unsigned src,
                                 reuse_bytes++;
                         }
 
-                        /* Select the place where existing bytes can be
-                         * reused so we leave empty slots to others
+                        /* Select the place where the most existing bytes
+                         * can be reused so we leave empty slots to others.
+                         * A full match can't be beaten.
                          */
                         if (j == type_size &&
                             (reuse_bytes > best_reuse_bytes || best_place < 0)) {
                                 best_reuse_bytes = reuse_bytes;
                                 best_place = i;
-                                break;
+
+                                if (reuse_bytes == type_size)
+                                        break;
                         }
                 }
 
@@ -460,7 +463,7 @@ mir_adjust_constant(midgard_instruction *ins, unsigned src,
                 if (best_place < 0)
                         return false;
 
-                memcpy(&bundle_constants[i], constantp, type_size);
+                memcpy(&bundle_constants[best_place], constantp, type_size);
                 *bundle_constant_mask |= type_mask << best_place;
                 comp_mapping[comp] = best_place >> type_shift;
         }
@@ -611,6 +614,22 @@ mir_has_unit(midgard_instruction *ins, unsigned unit)
         return false;
 }
 
+/* Number of units an ALU instruction could be scheduled to. When filling a
+ * unit, preferring the least flexible instruction leaves the flexible ones
+ * for the units filled later, packing bundles more densely. */
+
+static unsigned
+mir_unit_flexibility(midgard_instruction *ins)
+{
+        unsigned units = mir_is_add_2(ins) ? UNITS_MOST :
+                         (alu_opcode_props[ins->op].props & UNITS_ALL);
+
+        if (!mir_is_scalar(ins))
+                units &= UNITS_ANY_VECTOR;
+
+        return util_bitcount(units);
+}
+
 /* Net change in liveness if an instruction were scheduled. Loosely based on
  * ir3's scheduler. */
 
@@ -679,6 +698,7 @@ mir_choose_instruction(
 
         signed best_index = -1;
         signed best_effect = INT_MAX;
+        unsigned best_flexibility = ~0;
         bool best_conditional = false;
 
         /* Enforce a simple metric limiting distance to keep down register
@@ -763,10 +783,19 @@ mir_choose_instruction(
                 if (effect > best_effect)
                         continue;
 
-                if (effect == best_effect && (signed) i < best_index)
+                /* Among equals, look ahead to the units still to be filled */
+                unsigned flexibility = (alu && !branch && unit != ~0) ?
+                        mir_unit_flexibility(instructions[i]) : 0;
+
+                if (effect == best_effect && flexibility > best_flexibility)
+                        continue;
+
+                if (effect == best_effect && flexibility == best_flexibility &&
+                    (signed) i < best_index)
                         continue;
 
                 best_effect = effect;
+                best_flexibility = flexibility;
                 best_index = i;
                 best_conditional = conditional;
         }
@@ -33,7 +33,7 @@
  * registers available, requiring a balance.
  *
  * We use a heuristic to determine the ideal count, implemented by
- * mir_work_heuristic, which returns the ideal number of work registers.
+ * mir_uniform_heuristic, which returns the ideal number of uniform registers.
  */
 
 static bool
@@ -201,8 +201,65 @@ mir_estimate_pressure(compiler_context *ctx)
         return DIV_ROUND_UP(max_live, 16);
 }
 
+/* Threads per core for a number of work registers, see midgard_compile */
+
+static unsigned
+mir_threads_for_work(unsigned work_count)
+{
+        return (work_count <= 4) ? 4 : (work_count <= 8) ? 2 : 1;
+}
+
+/* Counts the loads of each of the first qwords mir_pick_ubo would push, in
+ * the order it pushes them, returning how many qwords were considered */
+
 static unsigned
-mir_work_heuristic(compiler_context *ctx, struct mir_ubo_analysis *analysis)
+mir_count_push_loads(compiler_context *ctx, struct mir_ubo_analysis *analysis,
+                     unsigned *loads, unsigned max_qwords)
+{
+        unsigned ubos[16], vec4s[16];
+        unsigned count = 0;
+
+        assert(max_qwords <= ARRAY_SIZE(ubos));
+
+        for (signed ubo = analysis->nr_blocks - 1; ubo >= 0; --ubo) {
+                unsigned vec4;
+                BITSET_FOREACH_SET(vec4, analysis->blocks[ubo].uses, MAX_UBO_QWORDS) {
+                        if (count == max_qwords)
+                                break;
+
+                        ubos[count] = ubo;
+                        vec4s[count++] = vec4;
+                }
+        }
+
+        memset(loads, 0, count * sizeof(*loads));
+
+        mir_foreach_instr_global(ctx, ins) {
+                if (!mir_is_direct_aligned_ubo(ins)) continue;
+
+                unsigned ubo = midgard_unpack_ubo_index_imm(ins->load_store);
+                unsigned vec4 = ins->constants.u32[0] / 16;
+
+                for (unsigned i = 0; i < count; ++i) {
+                        if (ubos[i] == ubo && vec4s[i] == vec4) {
+                                loads[i]++;
+                                break;
+                        }
+                }
+        }
+
+        return count;
+}
+
+/* Pick the number of uniform registers to promote UBO reads to. Uniform
+ * registers are taken from the top of the work register file, so every
+ * uniform past 8 costs a work register. The splits from 8 to 16 uniforms are
+ * scored on the threads they allow and the UBO loads they leave, rejecting
+ * those that leave too few work registers for the estimated pressure, which
+ * would cost spills or fewer threads. */
+
+static unsigned
+mir_uniform_heuristic(compiler_context *ctx, struct mir_ubo_analysis *analysis)
 {
         unsigned uniform_count = mir_promoteable_uniform_count(analysis);
 
@@ -210,24 +267,45 @@ mir_work_heuristic(compiler_context *ctx, struct mir_ubo_analysis *analysis)
          * allow as many work registers as needed */
 
         if (uniform_count <= 8)
-                return 16;
+                return 8;
+
+        /* The relation between the pressure estimate and the actual register
+         * pressure is a little murkier than we might like (due to scheduling,
+         * pipeline registers, failure to pack vector registers, load/store
+         * registers, texture registers...), hence the margin */
+
+        unsigned needed = mir_estimate_pressure(ctx) + 2;
 
-        /* Otherwise, estimate the register pressure */
+        unsigned loads[16];
+        unsigned count = mir_count_push_loads(ctx, analysis, loads, 16);
 
-        unsigned pressure = mir_estimate_pressure(ctx);
+        unsigned best = 8, best_threads = 0, best_saved = 0;
+        unsigned saved = 0;
 
-        /* Prioritize not spilling above all else. The relation between the
-         * pressure estimate and the actual register pressure is a little
-         * murkier than we might like (due to scheduling, pipeline registers,
-         * failure to pack vector registers, load/store registers, texture
-         * registers...), hence why this is a heuristic parameter */
+        for (unsigned uniforms = 1; uniforms <= 16; ++uniforms) {
+                if (uniforms <= count)
+                        saved += loads[uniforms - 1];
+
+                if (uniforms < 8)
+                        continue;
 
-        if (pressure > 6)
-                return 16;
+                unsigned work = 24 - uniforms;
 
-        /* If there's no chance of spilling, prioritize UBOs and thread count */
+                /* Prioritize not spilling above all else */
+                if (needed > work && uniforms > 8)
+                        break;
+
+                unsigned threads = mir_threads_for_work(MIN2(needed, work));
+
+                if (threads > best_threads ||
+                    (threads == best_threads && saved > best_saved)) {
+                        best = uniforms;
+                        best_threads = threads;
+                        best_saved = saved;
+                }
+        }
 
-        return 8;
+        return best;
 }
 
 /* Bitset of indices that will be used as a special register -- inputs to a
@@ -273,8 +351,7 @@ midgard_promote_uniforms(compiler_context *ctx)
 
         struct mir_ubo_analysis analysis = mir_analyze_ranges(ctx);
 
-        unsigned work_count = mir_work_heuristic(ctx, &analysis);
-        unsigned promoted_count = 24 - work_count;
+        unsigned promoted_count = mir_uniform_heuristic(ctx, &analysis);
 
         /* Ensure we are 16 byte aligned to avoid underallocations */
         mir_pick_ubo(&ctx->info->push, &analysis, promoted_count);
@@ -23,9 +23,15 @@
 
 #include "pan_perf.h"
 
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <pan_perf_metrics.h>
 #include <lib/pan_device.h>
 #include <drm-uapi/panfrost_drm.h>
+#include <base/include/mali_kbase_hwcnt_reader.h>
 
 #define PAN_COUNTERS_PER_CATEGORY 64
 #define PAN_SHADER_CORE_INDEX 3
@@ -86,6 +92,116 @@ panfrost_perf_init(struct panfrost_perf *perf, struct panfrost_device *dev)
    perf->category_offset[1] = PAN_COUNTERS_PER_CATEGORY * 1;
    perf->category_offset[2] = PAN_COUNTERS_PER_CATEGORY * 2;
    perf->category_offset[3] = PAN_COUNTERS_PER_CATEGORY * (2 + l2_slices);
+
+   perf->kbase.fd = -1;
+}
+
+/* kbase dumps the blocks in the same order as panfrost, with the command
+ * stream front-end in place of the job manager on CSF GPUs. Samples hold the
+ * counter increments since the previous dump, like panfrost's. */
+
+#define PAN_KBASE_HWCNT_BUFFERS 32
+
+static int
+panfrost_perf_kbase_enable(struct panfrost_perf *perf)
+{
+   struct kbase_ *k = &perf->dev->mali;
+
+   if (perf->kbase.fd >= 0)
+      return 0;
+
+   int fd = k->hwcnt_reader_setup(k, PAN_KBASE_HWCNT_BUFFERS);
+   if (fd < 0)
+      return -ENODEV;
+
+   uint32_t size = 0;
+   if (ioctl(fd, KBASE_HWCNT_READER_GET_BUFFER_SIZE, &size) < 0 || !size) {
+      close(fd);
+      return -errno;
+   }
+
+   void *map = mmap(NULL, size * PAN_KBASE_HWCNT_BUFFERS, PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED) {
+      close(fd);
+      return -errno;
+   }
+
+   perf->kbase.fd = fd;
+   perf->kbase.map = map;
+   perf->kbase.buffer_size = size;
+   return 0;
+}
+
+static int
+panfrost_perf_kbase_disable(struct panfrost_perf *perf)
+{
+   if (perf->kbase.fd < 0)
+      return 0;
+
+   munmap(perf->kbase.map, perf->kbase.buffer_size * PAN_KBASE_HWCNT_BUFFERS);
+   close(perf->kbase.fd);
+   perf->kbase.fd = -1;
+   return 0;
+}
+
+/* Copies the oldest sample of the ring to counter_values, the reader doesn't
+ * block when the ring is empty but fails with EAGAIN */
+static int
+panfrost_perf_kbase_read(struct panfrost_perf *perf, uint64_t *timestamp_ns)
+{
+   int fd = perf->kbase.fd;
+
+   struct kbase_hwcnt_reader_metadata meta = { 0 };
+   if (ioctl(fd, KBASE_HWCNT_READER_GET_BUFFER, &meta) < 0)
+      return -errno;
+
+   size_t size = MIN2(perf->kbase.buffer_size,
+                      perf->n_counter_values * sizeof(uint32_t));
+   memcpy(perf->counter_values,
+          (uint8_t *)perf->kbase.map + meta.buffer_idx * perf->kbase.buffer_size,
+          size);
+
+   ioctl(fd, KBASE_HWCNT_READER_PUT_BUFFER, &meta);
+
+   if (timestamp_ns)
+      *timestamp_ns = meta.timestamp;
+
+   return 0;
+}
+
+static int
+panfrost_perf_kbase_dump(struct panfrost_perf *perf)
+{
+   if (perf->kbase.fd < 0)
+      return -EINVAL;
+
+   if (ioctl(perf->kbase.fd, KBASE_HWCNT_READER_DUMP, 0) < 0)
+      return -errno;
+
+   return panfrost_perf_kbase_read(perf, NULL);
+}
+
+int
+panfrost_perf_start_sampling(struct panfrost_perf *perf, uint64_t period_ns)
+{
+   if (!perf->dev->kbase || perf->kbase.fd < 0)
+      return -ENOSYS;
+
+   uint32_t interval = MIN2(period_ns, UINT32_MAX);
+   if (ioctl(perf->kbase.fd, KBASE_HWCNT_READER_SET_INTERVAL, interval) < 0)
+      return -errno;
+
+   return 0;
+}
+
+int
+panfrost_perf_read_sample(struct panfrost_perf *perf, uint64_t *timestamp_ns)
+{
+   if (!perf->dev->kbase || perf->kbase.fd < 0)
+      return -ENOSYS;
+
+   return panfrost_perf_kbase_read(perf, timestamp_ns);
 }
 
 static int
@@ -98,18 +214,27 @@ panfrost_perf_query(struct panfrost_perf *perf, uint32_t enable)
 int
 panfrost_perf_enable(struct panfrost_perf *perf)
 {
+   if (perf->dev->kbase)
+      return panfrost_perf_kbase_enable(perf);
+
    return panfrost_perf_query(perf, 1 /* enable */);
 }
 
 int
 panfrost_perf_disable(struct panfrost_perf *perf)
 {
+   if (perf->dev->kbase)
+      return panfrost_perf_kbase_disable(perf);
+
    return panfrost_perf_query(perf, 0 /* disable */);
 }
 
 int
 panfrost_perf_dump(struct panfrost_perf *perf)
 {
+   if (perf->dev->kbase)
+      return panfrost_perf_kbase_dump(perf);
+
    // Dump performance counter values to the memory buffer pointed to by counter_values
    struct drm_panfrost_perfcnt_dump perfcnt_dump = {(uint64_t)(uintptr_t)perf->counter_values};
    return drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_DUMP, &perfcnt_dump);
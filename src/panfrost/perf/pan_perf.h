@@ -93,6 +93,14 @@ struct panfrost_perf {
 
    /* Offsets of categories */
    unsigned category_offset[PAN_PERF_MAX_CATEGORIES];
+
+   /* On kbase, counters are read through a hardware counter reader, which
+    * dumps into a ring of sample buffers mapped from its fd */
+   struct {
+      int fd;
+      void *map;
+      uint32_t buffer_size;
+   } kbase;
 };
 
 uint32_t
@@ -111,6 +119,17 @@ panfrost_perf_disable(struct panfrost_perf *perf);
 int
 panfrost_perf_dump(struct panfrost_perf *perf);
 
+/* Starts sampling the counters every period_ns into the ring of the kbase
+ * reader, only supported on kbase. Samples are timestamped by the kernel
+ * with the raw monotonic clock. */
+int
+panfrost_perf_start_sampling(struct panfrost_perf *perf, uint64_t period_ns);
+
+/* Reads the oldest periodic sample into counter_values, returns -EAGAIN when
+ * there is none */
+int
+panfrost_perf_read_sample(struct panfrost_perf *perf, uint64_t *timestamp_ns);
+
 #if defined(__cplusplus)
 } // extern "C"
 #endif
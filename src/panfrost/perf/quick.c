@@ -1,10 +1,15 @@
 #include <stdio.h>
+#include <fcntl.h>
 #include <lib/pan_device.h>
 #include "pan_perf.h"
 
 int main(void) {
         int fd = drmOpenWithType("panfrost", NULL, DRM_NODE_RENDER);
 
+        /* GPUs driven by kbase have no DRM node */
+        if (fd < 0)
+                fd = open("/dev/mali0", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+
         if (fd < 0) {
                 fprintf(stderr, "No panfrost device\n");
                 exit(1);
@@ -21,7 +26,8 @@ int main(void) {
         
         if (ret < 0) {
                 fprintf(stderr, "failed to enable counters (%d)\n", ret);
-                fprintf(stderr, "try `# echo Y > /sys/module/panfrost/parameters/unstable_ioctls`\n");
+                if (!dev.kbase)
+                        fprintf(stderr, "try `# echo Y > /sys/module/panfrost/parameters/unstable_ioctls`\n");
 
                 exit(1);
         }
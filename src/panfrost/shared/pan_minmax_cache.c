@@ -27,97 +27,182 @@
 /* Index buffer min/max cache. We need to calculate the min/max for arbitrary
  * slices (start, start + count) of the index buffer at drawtime. As this can
  * be quite expensive, we cache. Conceptually, we just use a hash table mapping
- * the key (start, count) to the value (min, max). In practice, mesa's hash
- * table implementation is higher overhead than we would like and makes
- * handling memory usage a little complicated. So we use this data structure
- * instead. Searching is O(n) to the size, but the size is capped at the
- * PANFROST_MINMAX_SIZE constant (so this is a tradeoff between cache hit/miss
- * ratio and cache search speed). Note that keys are adjacent so we get cache
- * line alignment benefits. Insertion is O(1) and in-order until the cache
- * fills up, after that it evicts the oldest cached value in a ring facilitated
- * by index.
+ * the key (index size, start, count) to the value (min, max). In practice,
+ * mesa's hash table implementation is higher overhead than we would like and
+ * makes handling memory usage a little complicated. So we use a fixed-size
+ * set-associative cache instead: the key is hashed to a set of
+ * PANFROST_MINMAX_WAYS entries, so lookups and insertions only search that
+ * set, and a full set evicts its entries in a ring. Keys of a set are
+ * adjacent so we get cache line alignment benefits.
  */
 
 #include "pan_minmax_cache.h"
+#include "util/u_math.h"
+
+static inline uint64_t
+panfrost_minmax_key(unsigned start, unsigned count)
+{
+        return (((uint64_t)count) << 32) | start;
+}
+
+static inline unsigned
+panfrost_minmax_set(uint64_t key)
+{
+        uint32_t hash = (uint32_t)(key ^ (key >> 29)) * 0x9e3779b1;
+
+        return hash >> (32 - util_logbase2(PANFROST_MINMAX_SETS));
+}
 
 bool
-panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache, unsigned start, unsigned count,
+panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache, unsigned index_size,
+                     unsigned start, unsigned count,
                      unsigned *min_index, unsigned *max_index)
 {
-        uint64_t ht_key = (((uint64_t)count) << 32) | start;
-        bool found = false;
+        uint64_t ht_key = panfrost_minmax_key(start, count);
 
         if (!cache)
            return false;
 
-        for (unsigned i = 0; i < cache->size; ++i) {
-                if (cache->keys[i] == ht_key) {
+        unsigned first = panfrost_minmax_set(ht_key) * PANFROST_MINMAX_WAYS;
+
+        for (unsigned i = first; i < first + PANFROST_MINMAX_WAYS; ++i) {
+                if (cache->keys[i] == ht_key &&
+                    cache->index_size[i] == index_size) {
                         uint64_t hit = cache->values[i];
 
                         *min_index = hit & 0xffffffff;
                         *max_index = hit >> 32;
-                        found = true;
-                        break;
+                        return true;
                 }
         }
 
-        return found;
+        return false;
 }
 
 void
-panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache, unsigned start, unsigned count,
+panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache, unsigned index_size,
+                     unsigned start, unsigned count,
                      unsigned min_index, unsigned max_index)
 {
-        uint64_t ht_key = (((uint64_t)count) << 32) | start;
+        uint64_t ht_key = panfrost_minmax_key(start, count);
         uint64_t value = min_index | (((uint64_t)max_index) << 32);
-        unsigned index = 0;
 
         if (!cache)
                 return;
 
-        if (cache->size == PANFROST_MINMAX_SIZE) {
-                index = cache->index++;
-                cache->index = cache->index % PANFROST_MINMAX_SIZE;
-        } else {
-                index = cache->size++;
+        unsigned set = panfrost_minmax_set(ht_key);
+        unsigned first = set * PANFROST_MINMAX_WAYS;
+        unsigned index = ~0;
+
+        /* Prefer an empty way, otherwise evict the oldest */
+        for (unsigned i = first; i < first + PANFROST_MINMAX_WAYS; ++i) {
+                if (!cache->index_size[i]) {
+                        index = i;
+                        break;
+                }
         }
 
-        cache->keys[index] =  ht_key;
-        cache->values[index] = value;
+        if (index == ~0) {
+                index = first + cache->next[set];
+                cache->next[set] = (cache->next[set] + 1) % PANFROST_MINMAX_WAYS;
+        }
 
+        cache->keys[index] = ht_key;
+        cache->values[index] = value;
+        cache->index_size[index] = index_size;
 }
 
-/* If we've been caching min/max indices and we update the index
- * buffer, that may invalidate the min/max. Check what's been cached vs
- * what we've written, and throw out invalid entries. */
+/* If we've been caching min/max indices and we update the index buffer, that
+ * may invalidate the min/max. Throw out the entries whose slice intersects the
+ * bytes [offset, offset + size) written, keeping the others. */
 
 void
-panfrost_minmax_cache_invalidate(struct panfrost_minmax_cache *cache, struct pipe_transfer *transfer)
+panfrost_minmax_cache_invalidate_range(struct panfrost_minmax_cache *cache,
+                                       unsigned offset, unsigned size)
 {
-        /* Ensure there is a cache to invalidate and a write */
         if (!cache)
                 return;
 
-        if (!(transfer->usage & PIPE_MAP_WRITE))
-                return;
+        uint64_t end = (uint64_t)offset + size;
 
-        unsigned valid_count = 0;
+        for (unsigned i = 0; i < PANFROST_MINMAX_SIZE; ++i) {
+                unsigned index_size = cache->index_size[i];
 
-        for (unsigned i = 0; i < cache->size; ++i) {
-                uint64_t key = cache->keys[i];
+                if (!index_size)
+                        continue;
 
-                uint32_t start = key & 0xffffffff;
-                uint32_t count = key >> 32;
+                uint64_t key = cache->keys[i];
+                uint64_t start = (key & 0xffffffff) * index_size;
+                uint64_t count = (key >> 32) * index_size;
 
                 /* 1D range intersection */
-                bool invalid = MAX2(transfer->box.x, start) < MIN2(transfer->box.x + transfer->box.width, start + count);
-                if (!invalid) {
-                        cache->keys[valid_count] = key;
-                        cache->values[valid_count] = cache->values[i];
-                        valid_count++;
-                }
+                if (MAX2(offset, start) < MIN2(end, start + count))
+                        cache->index_size[i] = 0;
         }
+}
+
+void
+panfrost_minmax_cache_invalidate(struct panfrost_minmax_cache *cache, struct pipe_transfer *transfer)
+{
+        /* Ensure there is a write */
+        if (!(transfer->usage & PIPE_MAP_WRITE))
+                return;
 
-        cache->size = valid_count;
-        cache->index = 0;
+        panfrost_minmax_cache_invalidate_range(cache, transfer->box.x,
+                                               transfer->box.width);
+}
+
+#define PAN_MINMAX_SEARCH(sz)                                                  \
+static void                                                                    \
+panfrost_minmax_search_u##sz(const uint##sz##_t *indices, unsigned count,      \
+                             bool restart, uint32_t restart_index,             \
+                             unsigned *min_index, unsigned *max_index)         \
+{                                                                              \
+        unsigned min = ~0, max = 0;                                            \
+                                                                               \
+        for (unsigned i = 0; i < count; ++i) {                                 \
+                if (restart && indices[i] == restart_index)                    \
+                        continue;                                              \
+                                                                               \
+                min = MIN2(min, indices[i]);                                   \
+                max = MAX2(max, indices[i]);                                   \
+        }                                                                      \
+                                                                               \
+        *min_index = min;                                                      \
+        *max_index = max;                                                      \
+}
+
+PAN_MINMAX_SEARCH(8)
+PAN_MINMAX_SEARCH(16)
+PAN_MINMAX_SEARCH(32)
+
+#undef PAN_MINMAX_SEARCH
+
+void
+panfrost_minmax_search(const void *indices, unsigned index_size, unsigned count,
+                       bool restart, uint32_t restart_index,
+                       unsigned *min_index, unsigned *max_index)
+{
+#ifdef PAN_MINMAX_NEON
+        if (panfrost_minmax_search_neon(indices, index_size, count, restart,
+                                        restart_index, min_index, max_index))
+                return;
+#endif
+
+        switch (index_size) {
+        case 1:
+                panfrost_minmax_search_u8(indices, count, restart, restart_index,
+                                          min_index, max_index);
+                break;
+        case 2:
+                panfrost_minmax_search_u16(indices, count, restart, restart_index,
+                                           min_index, max_index);
+                break;
+        case 4:
+                panfrost_minmax_search_u32(indices, count, restart, restart_index,
+                                           min_index, max_index);
+                break;
+        default:
+                unreachable("Invalid index size");
+        }
 }
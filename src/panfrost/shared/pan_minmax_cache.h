@@ -27,26 +27,69 @@
 #ifndef H_PAN_MINMAX_CACHE
 #define H_PAN_MINMAX_CACHE
 
+#include "util/detect_arch.h"
 #include "util/u_transfer.h"
 
-#define PANFROST_MINMAX_SIZE 64
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The cache is set-associative: a (start, count) key hashes to one of the
+ * PANFROST_MINMAX_SETS sets and may be held by any of its ways. */
+#define PANFROST_MINMAX_WAYS 4
+#define PANFROST_MINMAX_SETS 16
+#define PANFROST_MINMAX_SIZE (PANFROST_MINMAX_WAYS * PANFROST_MINMAX_SETS)
 
 struct panfrost_minmax_cache {
         uint64_t keys[PANFROST_MINMAX_SIZE];
         uint64_t values[PANFROST_MINMAX_SIZE];
-        unsigned size;
-        unsigned index;
+
+        /* Index size of each entry in bytes, 0 for an empty entry */
+        uint8_t index_size[PANFROST_MINMAX_SIZE];
+
+        /* Way of each set to evict next */
+        uint8_t next[PANFROST_MINMAX_SETS];
 };
 
 bool
-panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache, unsigned start, unsigned count,
+panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache, unsigned index_size,
+                     unsigned start, unsigned count,
                      unsigned *min_index, unsigned *max_index);
 
 void
-panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache, unsigned start, unsigned count,
+panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache, unsigned index_size,
+                     unsigned start, unsigned count,
                      unsigned min_index, unsigned max_index);
 
+void
+panfrost_minmax_cache_invalidate_range(struct panfrost_minmax_cache *cache,
+                                       unsigned offset, unsigned size);
+
 void
 panfrost_minmax_cache_invalidate(struct panfrost_minmax_cache *cache, struct pipe_transfer *transfer);
 
+/* Scan count indices of index_size bytes for their bounds, ignoring
+ * restart_index if restart is set. If every index is skipped, min_index is
+ * left at ~0 and max_index at 0. */
+void
+panfrost_minmax_search(const void *indices, unsigned index_size, unsigned count,
+                       bool restart, uint32_t restart_index,
+                       unsigned *min_index, unsigned *max_index);
+
+#if (DETECT_ARCH_AARCH64 || DETECT_ARCH_ARM) && !defined(__SOFTFP__)
+#define PAN_MINMAX_NEON
+
+/* NEON version of the above for 16 and 32-bit indices, used internally when
+ * available. Returns false if the CPU lacks NEON or the index size is
+ * unsupported, in which case nothing was read. */
+bool
+panfrost_minmax_search_neon(const void *indices, unsigned index_size, unsigned count,
+                            bool restart, uint32_t restart_index,
+                            unsigned *min_index, unsigned *max_index);
+#endif
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
 #endif
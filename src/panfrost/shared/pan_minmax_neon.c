@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include "pan_minmax_cache.h"
+
+#ifdef PAN_MINMAX_NEON
+
+/* armhf builds default to vfp, not neon, and refuses to compile neon intrinsics
+ * unless you tell it "no really".
+ */
+#if DETECT_ARCH_ARM
+#pragma GCC target ("fpu=neon")
+#endif
+
+#include <arm_neon.h>
+#include "util/macros.h"
+#include "util/u_cpu_detect.h"
+
+/* Index buffers usually live in write-combined memory, where every load is a
+ * trip to DRAM, so the scan reads 64 bytes at a time to make the most of each
+ * burst. Restart indices are masked out of each vector rather than branched
+ * around: OR-ing with the comparison mask makes them all-ones, which cannot
+ * lower the minimum, and clearing them makes them zero, which cannot raise
+ * the maximum.
+ */
+
+static inline uint16_t
+pan_vminv_u16(uint16x8_t v)
+{
+#if DETECT_ARCH_AARCH64
+        return vminvq_u16(v);
+#else
+        uint16x4_t r = vpmin_u16(vget_low_u16(v), vget_high_u16(v));
+        r = vpmin_u16(r, r);
+        r = vpmin_u16(r, r);
+        return vget_lane_u16(r, 0);
+#endif
+}
+
+static inline uint16_t
+pan_vmaxv_u16(uint16x8_t v)
+{
+#if DETECT_ARCH_AARCH64
+        return vmaxvq_u16(v);
+#else
+        uint16x4_t r = vpmax_u16(vget_low_u16(v), vget_high_u16(v));
+        r = vpmax_u16(r, r);
+        r = vpmax_u16(r, r);
+        return vget_lane_u16(r, 0);
+#endif
+}
+
+static inline uint32_t
+pan_vminv_u32(uint32x4_t v)
+{
+#if DETECT_ARCH_AARCH64
+        return vminvq_u32(v);
+#else
+        uint32x2_t r = vpmin_u32(vget_low_u32(v), vget_high_u32(v));
+        r = vpmin_u32(r, r);
+        return vget_lane_u32(r, 0);
+#endif
+}
+
+static inline uint32_t
+pan_vmaxv_u32(uint32x4_t v)
+{
+#if DETECT_ARCH_AARCH64
+        return vmaxvq_u32(v);
+#else
+        uint32x2_t r = vpmax_u32(vget_low_u32(v), vget_high_u32(v));
+        r = vpmax_u32(r, r);
+        return vget_lane_u32(r, 0);
+#endif
+}
+
+/* Generate a scanner for sz-bit indices, lanes to a vector. The restart
+ * flag is a compile-time constant after inlining, so the masking vanishes
+ * from the loop when restart is disabled. */
+#define PAN_MINMAX_SEARCH_NEON(sz, lanes, suffix)                              \
+static ALWAYS_INLINE void                                                      \
+pan_minmax_accumulate_u##sz(uint##sz##x##lanes##_t v, bool restart,            \
+                            uint##sz##x##lanes##_t vrestart,                   \
+                            uint##sz##x##lanes##_t *vmin,                      \
+                            uint##sz##x##lanes##_t *vmax)                      \
+{                                                                              \
+        if (restart) {                                                         \
+                uint##sz##x##lanes##_t mask = vceqq_u##sz(v, vrestart);        \
+                *vmin = vminq_u##sz(*vmin, vorrq_u##sz(v, mask));              \
+                *vmax = vmaxq_u##sz(*vmax, vbicq_u##sz(v, mask));              \
+        } else {                                                               \
+                *vmin = vminq_u##sz(*vmin, v);                                 \
+                *vmax = vmaxq_u##sz(*vmax, v);                                 \
+        }                                                                      \
+}                                                                              \
+                                                                               \
+static ALWAYS_INLINE void                                                      \
+pan_minmax_search_u##sz(const uint##sz##_t *indices, unsigned count,           \
+                        bool restart, uint##sz##_t restart_index,              \
+                        unsigned *min_index, unsigned *max_index)              \
+{                                                                              \
+        const unsigned per_iter = 4 * (lanes);                                 \
+        uint##sz##x##lanes##_t vrestart = vdupq_n_##suffix(restart_index);     \
+        uint##sz##x##lanes##_t vmin0 = vdupq_n_##suffix(~(uint##sz##_t)0);     \
+        uint##sz##x##lanes##_t vmax0 = vdupq_n_##suffix(0);                    \
+        uint##sz##x##lanes##_t vmin1 = vmin0, vmax1 = vmax0;                   \
+        unsigned i = 0;                                                        \
+                                                                               \
+        /* Two independent accumulators to hide the min/max latency */         \
+        for (; i + per_iter <= count; i += per_iter) {                         \
+                const uint##sz##_t *p = indices + i;                           \
+                                                                               \
+                pan_minmax_accumulate_u##sz(vld1q_##suffix(p), restart,        \
+                                            vrestart, &vmin0, &vmax0);         \
+                pan_minmax_accumulate_u##sz(vld1q_##suffix(p + (lanes)),       \
+                                            restart, vrestart, &vmin1, &vmax1);\
+                pan_minmax_accumulate_u##sz(vld1q_##suffix(p + 2 * (lanes)),   \
+                                            restart, vrestart, &vmin0, &vmax0);\
+                pan_minmax_accumulate_u##sz(vld1q_##suffix(p + 3 * (lanes)),   \
+                                            restart, vrestart, &vmin1, &vmax1);\
+        }                                                                      \
+                                                                               \
+        for (; i + (lanes) <= count; i += (lanes)) {                           \
+                pan_minmax_accumulate_u##sz(vld1q_##suffix(indices + i),       \
+                                            restart, vrestart,                 \
+                                            &vmin0, &vmax0);                   \
+        }                                                                      \
+                                                                               \
+        unsigned min = pan_vminv_u##sz(vminq_u##sz(vmin0, vmin1));             \
+        unsigned max = pan_vmaxv_u##sz(vmaxq_u##sz(vmax0, vmax1));             \
+                                                                               \
+        for (; i < count; ++i) {                                               \
+                if (restart && indices[i] == restart_index)                    \
+                        continue;                                              \
+                                                                               \
+                min = MIN2(min, indices[i]);                                   \
+                max = MAX2(max, indices[i]);                                   \
+        }                                                                      \
+                                                                               \
+        /* Nothing counted: widen to the scalar path's empty minimum */       \
+        if (min > max)                                                         \
+                min = ~0;                                                      \
+                                                                               \
+        *min_index = min;                                                      \
+        *max_index = max;                                                      \
+}
+
+PAN_MINMAX_SEARCH_NEON(16, 8, u16)
+PAN_MINMAX_SEARCH_NEON(32, 4, u32)
+
+#undef PAN_MINMAX_SEARCH_NEON
+
+bool
+panfrost_minmax_search_neon(const void *indices, unsigned index_size, unsigned count,
+                            bool restart, uint32_t restart_index,
+                            unsigned *min_index, unsigned *max_index)
+{
+#if DETECT_ARCH_ARM
+        if (!util_get_cpu_caps()->has_neon)
+                return false;
+#endif
+
+        /* A restart index that doesn't fit the indices never matches */
+        if (index_size == 2 && restart_index > UINT16_MAX)
+                restart = false;
+
+        switch (index_size) {
+        case 2:
+                if (restart)
+                        pan_minmax_search_u16(indices, count, true, restart_index,
+                                              min_index, max_index);
+                else
+                        pan_minmax_search_u16(indices, count, false, 0,
+                                              min_index, max_index);
+                return true;
+        case 4:
+                if (restart)
+                        pan_minmax_search_u32(indices, count, true, restart_index,
+                                              min_index, max_index);
+                else
+                        pan_minmax_search_u32(indices, count, false, 0,
+                                              min_index, max_index);
+                return true;
+        default:
+                return false;
+        }
+}
+
+#endif
@@ -27,7 +27,9 @@
 #ifndef H_PANFROST_TILING
 #define H_PANFROST_TILING
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <util/detect_arch.h>
 #include <util/format/u_format.h>
 
 #ifdef __cplusplus
@@ -74,6 +76,28 @@ void panfrost_store_tiled_image(void *dst, const void *src,
                                 uint32_t src_stride,
                                 enum pipe_format format);
 
+#if (DETECT_ARCH_AARCH64 || DETECT_ARCH_ARM) && !defined(__SOFTFP__)
+#define PAN_TILING_NEON
+
+/**
+ * NEON implementation of the access of whole 16x16 tiles, used internally by
+ * the load and store routines above when available.
+ *
+ * @tiled Tiled image
+ * @linear Linear image, pointing at pixel (x, y) of the region
+ * @x @y @w @h Region of interest in pixels, aligned to the tile size
+ * @bpp Bits per pixel, a power of two from 8 to 128
+ *
+ * Returns false if the CPU lacks NEON or the bpp is unsupported, in which
+ * case nothing was accessed.
+ */
+bool panfrost_access_tiled_image_neon(void *tiled, void *linear,
+                                      unsigned x, unsigned y,
+                                      unsigned w, unsigned h,
+                                      uint32_t tiled_stride,
+                                      uint32_t linear_stride,
+                                      unsigned bpp, bool is_store);
+#endif
 
 #ifdef __cplusplus
 } /* extern C */
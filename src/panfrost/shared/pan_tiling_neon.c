@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include "pan_tiling.h"
+
+#ifdef PAN_TILING_NEON
+
+/* armhf builds default to vfp, not neon, and refuses to compile neon intrinsics
+ * unless you tell it "no really".
+ */
+#if DETECT_ARCH_ARM
+#pragma GCC target ("fpu=neon")
+#endif
+
+#include <arm_neon.h>
+#include "util/macros.h"
+#include "util/u_cpu_detect.h"
+
+/*
+ * NEON versions of the aligned u-interleaved accesses in pan_tiling.c, working
+ * on whole 16x16 tiles.
+ *
+ * The low 4 bits of the index within a tile only depend on the low 2 bits of
+ * X and Y, so a tile is a sequence of 16 blocks of 4x4 pixels, each stored
+ * contiguously. Within a block, and likewise for the order of the blocks
+ * within the tile, the pixels are stored as:
+ *
+ *    (0,0) (1,0) (1,1) (0,1)  (2,0) (3,0) (3,1) (2,1)
+ *    (2,2) (3,2) (3,3) (2,3)  (0,2) (1,2) (1,3) (0,3)
+ *
+ * Each group of 4 is two pixels of a row followed by the two pixels below in
+ * reverse order, which is a reversal of adjacent elements of the second row
+ * followed by an interleave of the two rows. That maps directly onto
+ * VREV/VZIP, and readily inverts to VUZP/VREV for loads.
+ */
+
+/* Merge [x0 x1 x2 x3] and [y0 y1 y2 y3] into [x0 x1 y1 y0] [x2 x3 y3 y2] */
+
+static ALWAYS_INLINE void
+pan_u_merge_u32(uint32x4_t x, uint32x4_t y, uint32x4_t *lo, uint32x4_t *hi)
+{
+   uint32x4_t yr = vrev64q_u32(y);
+
+   *lo = vcombine_u32(vget_low_u32(x), vget_low_u32(yr));
+   *hi = vcombine_u32(vget_high_u32(x), vget_high_u32(yr));
+}
+
+static ALWAYS_INLINE void
+pan_u_split_u32(uint32x4_t lo, uint32x4_t hi, uint32x4_t *x, uint32x4_t *y)
+{
+   *x = vcombine_u32(vget_low_u32(lo), vget_low_u32(hi));
+   *y = vrev64q_u32(vcombine_u32(vget_high_u32(lo), vget_high_u32(hi)));
+}
+
+static ALWAYS_INLINE uint64x2_t
+pan_swap_u64(uint64x2_t v)
+{
+   return vextq_u64(v, v, 1);
+}
+
+/* The 8 and 16 bpp kernels handle a row of 4 blocks at once, to use full
+ * registers for the linear rows. The others handle one block. */
+
+static ALWAYS_INLINE void
+pan_blocks_8(uint8_t *tiled, uint8_t *linear, unsigned stride,
+             const unsigned *slots, bool is_store)
+{
+   uint32x4_t blocks[4];
+
+   if (is_store) {
+      uint8x16_t a = vld1q_u8(linear + 0 * stride);
+      uint8x16_t b = vld1q_u8(linear + 1 * stride);
+      uint8x16_t c = vld1q_u8(linear + 2 * stride);
+      uint8x16_t d = vld1q_u8(linear + 3 * stride);
+
+      uint16x8x2_t top = vzipq_u16(vreinterpretq_u16_u8(a),
+                                   vreinterpretq_u16_u8(vrev16q_u8(b)));
+      uint16x8x2_t bot = vzipq_u16(vreinterpretq_u16_u8(c),
+                                   vreinterpretq_u16_u8(vrev16q_u8(d)));
+
+      for (unsigned i = 0; i < 2; ++i) {
+         pan_u_merge_u32(vreinterpretq_u32_u16(top.val[i]),
+                         vreinterpretq_u32_u16(bot.val[i]),
+                         &blocks[2 * i], &blocks[2 * i + 1]);
+      }
+
+      for (unsigned i = 0; i < 4; ++i)
+         vst1q_u32((uint32_t *) (tiled + slots[i] * 16), blocks[i]);
+   } else {
+      uint16x8_t top[2], bot[2];
+
+      for (unsigned i = 0; i < 4; ++i)
+         blocks[i] = vld1q_u32((const uint32_t *) (tiled + slots[i] * 16));
+
+      for (unsigned i = 0; i < 2; ++i) {
+         uint32x4_t t, b;
+         pan_u_split_u32(blocks[2 * i], blocks[2 * i + 1], &t, &b);
+         top[i] = vreinterpretq_u16_u32(t);
+         bot[i] = vreinterpretq_u16_u32(b);
+      }
+
+      uint16x8x2_t ab = vuzpq_u16(top[0], top[1]);
+      uint16x8x2_t cd = vuzpq_u16(bot[0], bot[1]);
+
+      vst1q_u8(linear + 0 * stride, vreinterpretq_u8_u16(ab.val[0]));
+      vst1q_u8(linear + 1 * stride, vrev16q_u8(vreinterpretq_u8_u16(ab.val[1])));
+      vst1q_u8(linear + 2 * stride, vreinterpretq_u8_u16(cd.val[0]));
+      vst1q_u8(linear + 3 * stride, vrev16q_u8(vreinterpretq_u8_u16(cd.val[1])));
+   }
+}
+
+static ALWAYS_INLINE void
+pan_blocks_16(uint8_t *tiled, uint8_t *linear, unsigned stride,
+              const unsigned *slots, bool is_store)
+{
+   /* Each half of the rows covers two blocks, and a pair of rows gives
+    * [Q0 Q1] [Q2 Q3] in 64-bit groups of 4 pixels, so a block is the top Q
+    * pair followed by the bottom one swapped. */
+   for (unsigned h = 0; h < 2; ++h) {
+      uint8_t *l = linear + h * 16;
+      uint64_t *b0 = (uint64_t *) (tiled + slots[2 * h + 0] * 32);
+      uint64_t *b1 = (uint64_t *) (tiled + slots[2 * h + 1] * 32);
+
+      if (is_store) {
+         uint16x8_t a = vld1q_u16((const uint16_t *) (l + 0 * stride));
+         uint16x8_t b = vld1q_u16((const uint16_t *) (l + 1 * stride));
+         uint16x8_t c = vld1q_u16((const uint16_t *) (l + 2 * stride));
+         uint16x8_t d = vld1q_u16((const uint16_t *) (l + 3 * stride));
+
+         uint32x4x2_t top = vzipq_u32(vreinterpretq_u32_u16(a),
+                                      vreinterpretq_u32_u16(vrev32q_u16(b)));
+         uint32x4x2_t bot = vzipq_u32(vreinterpretq_u32_u16(c),
+                                      vreinterpretq_u32_u16(vrev32q_u16(d)));
+
+         vst1q_u64(b0 + 0, vreinterpretq_u64_u32(top.val[0]));
+         vst1q_u64(b0 + 2, pan_swap_u64(vreinterpretq_u64_u32(bot.val[0])));
+         vst1q_u64(b1 + 0, vreinterpretq_u64_u32(top.val[1]));
+         vst1q_u64(b1 + 2, pan_swap_u64(vreinterpretq_u64_u32(bot.val[1])));
+      } else {
+         uint32x4_t t0 = vreinterpretq_u32_u64(vld1q_u64(b0 + 0));
+         uint32x4_t d0 = vreinterpretq_u32_u64(pan_swap_u64(vld1q_u64(b0 + 2)));
+         uint32x4_t t1 = vreinterpretq_u32_u64(vld1q_u64(b1 + 0));
+         uint32x4_t d1 = vreinterpretq_u32_u64(pan_swap_u64(vld1q_u64(b1 + 2)));
+
+         uint32x4x2_t ab = vuzpq_u32(t0, t1);
+         uint32x4x2_t cd = vuzpq_u32(d0, d1);
+
+         vst1q_u16((uint16_t *) (l + 0 * stride), vreinterpretq_u16_u32(ab.val[0]));
+         vst1q_u16((uint16_t *) (l + 1 * stride), vrev32q_u16(vreinterpretq_u16_u32(ab.val[1])));
+         vst1q_u16((uint16_t *) (l + 2 * stride), vreinterpretq_u16_u32(cd.val[0]));
+         vst1q_u16((uint16_t *) (l + 3 * stride), vrev32q_u16(vreinterpretq_u16_u32(cd.val[1])));
+      }
+   }
+}
+
+static ALWAYS_INLINE void
+pan_block_32(uint8_t *tiled, uint8_t *linear, unsigned stride, bool is_store)
+{
+   uint32_t *t = (uint32_t *) tiled;
+   uint32x4_t a, b, c, d, q0, q1, q2, q3;
+
+   if (is_store) {
+      a = vld1q_u32((const uint32_t *) (linear + 0 * stride));
+      b = vld1q_u32((const uint32_t *) (linear + 1 * stride));
+      c = vld1q_u32((const uint32_t *) (linear + 2 * stride));
+      d = vld1q_u32((const uint32_t *) (linear + 3 * stride));
+
+      pan_u_merge_u32(a, b, &q0, &q1);
+      pan_u_merge_u32(c, d, &q3, &q2);
+
+      vst1q_u32(t + 0, q0);
+      vst1q_u32(t + 4, q1);
+      vst1q_u32(t + 8, q2);
+      vst1q_u32(t + 12, q3);
+   } else {
+      q0 = vld1q_u32(t + 0);
+      q1 = vld1q_u32(t + 4);
+      q2 = vld1q_u32(t + 8);
+      q3 = vld1q_u32(t + 12);
+
+      pan_u_split_u32(q0, q1, &a, &b);
+      pan_u_split_u32(q3, q2, &c, &d);
+
+      vst1q_u32((uint32_t *) (linear + 0 * stride), a);
+      vst1q_u32((uint32_t *) (linear + 1 * stride), b);
+      vst1q_u32((uint32_t *) (linear + 2 * stride), c);
+      vst1q_u32((uint32_t *) (linear + 3 * stride), d);
+   }
+}
+
+/* For 64 and 128 bpp, pixels are whole registers or pairs of them, so the
+ * block is a permutation of register-sized pieces */
+
+static ALWAYS_INLINE void
+pan_block_64(uint8_t *tiled, uint8_t *linear, unsigned stride, bool is_store)
+{
+   uint64_t *t = (uint64_t *) tiled;
+
+   for (unsigned r = 0; r < 4; r += 2) {
+      uint64_t *top = (uint64_t *) (linear + r * stride);
+      uint64_t *bot = (uint64_t *) (linear + (r + 1) * stride);
+
+      /* Rows 0-1 give the first two groups left to right, rows 2-3 give the
+       * last two right to left */
+      for (unsigned i = 0; i < 2; ++i) {
+         unsigned x = (r == 0) ? (2 * i) : (2 - 2 * i);
+         uint64_t *out = t + (r * 4) + (i * 4);
+
+         if (is_store) {
+            vst1q_u64(out + 0, vld1q_u64(top + x));
+            vst1q_u64(out + 2, pan_swap_u64(vld1q_u64(bot + x)));
+         } else {
+            vst1q_u64(top + x, vld1q_u64(out + 0));
+            vst1q_u64(bot + x, pan_swap_u64(vld1q_u64(out + 2)));
+         }
+      }
+   }
+}
+
+static ALWAYS_INLINE void
+pan_block_128(uint8_t *tiled, uint8_t *linear, unsigned stride, bool is_store)
+{
+   static const uint8_t order[16][2] = {
+      { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 },
+      { 2, 0 }, { 3, 0 }, { 3, 1 }, { 2, 1 },
+      { 2, 2 }, { 3, 2 }, { 3, 3 }, { 2, 3 },
+      { 0, 2 }, { 1, 2 }, { 1, 3 }, { 0, 3 },
+   };
+
+   for (unsigned i = 0; i < 16; ++i) {
+      uint32_t *t = (uint32_t *) (tiled + i * 16);
+      uint32_t *l = (uint32_t *) (linear + order[i][1] * stride +
+                                  order[i][0] * 16);
+
+      if (is_store)
+         vst1q_u32(t, vld1q_u32(l));
+      else
+         vst1q_u32(l, vld1q_u32(t));
+   }
+}
+
+/* Index of the block at (bx, by) within the tile, see the pixel order above */
+
+static ALWAYS_INLINE unsigned
+pan_block_slot(unsigned bx, unsigned by)
+{
+   unsigned slot = (bx & 1) ^ (by & 1);
+
+   slot |= (by & 1) << 1;
+   slot |= (((bx >> 1) ^ (by >> 1)) & 1) << 2;
+   slot |= (by >> 1) << 3;
+
+   return slot;
+}
+
+static ALWAYS_INLINE void
+pan_access_tile_neon(uint8_t *tiled, uint8_t *linear, unsigned stride,
+                     unsigned bpp, bool is_store)
+{
+   unsigned block_size = 16 * (bpp / 8);
+
+   for (unsigned by = 0; by < 4; ++by) {
+      uint8_t *row = linear + (4 * by * stride);
+      unsigned slots[4];
+
+      for (unsigned bx = 0; bx < 4; ++bx)
+         slots[bx] = pan_block_slot(bx, by);
+
+      if (bpp == 8) {
+         pan_blocks_8(tiled, row, stride, slots, is_store);
+      } else if (bpp == 16) {
+         pan_blocks_16(tiled, row, stride, slots, is_store);
+      } else {
+         for (unsigned bx = 0; bx < 4; ++bx) {
+            uint8_t *t = tiled + slots[bx] * block_size;
+            uint8_t *l = row + bx * 4 * (bpp / 8);
+
+            if (bpp == 32)
+               pan_block_32(t, l, stride, is_store);
+            else if (bpp == 64)
+               pan_block_64(t, l, stride, is_store);
+            else
+               pan_block_128(t, l, stride, is_store);
+         }
+      }
+   }
+}
+
+#define PAN_ACCESS_TILES_NEON(bpp) \
+static void \
+pan_access_tiles_neon_##bpp(uint8_t *tiled, uint8_t *linear, \
+                            unsigned x, unsigned y, \
+                            unsigned w, unsigned h, \
+                            uint32_t tiled_stride, uint32_t linear_stride, \
+                            bool is_store) \
+{ \
+   const unsigned tile_size = 256 * (bpp / 8); \
+\
+   for (unsigned ty = 0; ty < h; ty += 16) { \
+      uint8_t *t = tiled + ((y + ty) >> 4) * tiled_stride + \
+                   (x >> 4) * tile_size; \
+      uint8_t *l = linear + ty * linear_stride; \
+\
+      for (unsigned tx = 0; tx < w; tx += 16) { \
+         pan_access_tile_neon(t, l, linear_stride, bpp, is_store); \
+         t += tile_size; \
+         l += 16 * (bpp / 8); \
+      } \
+   } \
+}
+
+PAN_ACCESS_TILES_NEON(8)
+PAN_ACCESS_TILES_NEON(16)
+PAN_ACCESS_TILES_NEON(32)
+PAN_ACCESS_TILES_NEON(64)
+PAN_ACCESS_TILES_NEON(128)
+
+bool
+panfrost_access_tiled_image_neon(void *tiled, void *linear,
+                                 unsigned x, unsigned y,
+                                 unsigned w, unsigned h,
+                                 uint32_t tiled_stride,
+                                 uint32_t linear_stride,
+                                 unsigned bpp, bool is_store)
+{
+   /* CPU detect for NEON support.  On arm64, it's implied. */
+#if DETECT_ARCH_ARM
+   if (!util_get_cpu_caps()->has_neon)
+      return false;
+#endif
+
+   switch (bpp) {
+   case 8:
+      pan_access_tiles_neon_8(tiled, linear, x, y, w, h,
+                              tiled_stride, linear_stride, is_store);
+      return true;
+   case 16:
+      pan_access_tiles_neon_16(tiled, linear, x, y, w, h,
+                               tiled_stride, linear_stride, is_store);
+      return true;
+   case 32:
+      pan_access_tiles_neon_32(tiled, linear, x, y, w, h,
+                               tiled_stride, linear_stride, is_store);
+      return true;
+   case 64:
+      pan_access_tiles_neon_64(tiled, linear, x, y, w, h,
+                               tiled_stride, linear_stride, is_store);
+      return true;
+   case 128:
+      pan_access_tiles_neon_128(tiled, linear, x, y, w, h,
+                                tiled_stride, linear_stride, is_store);
+      return true;
+   default:
+      return false;
+   }
+}
+
+#endif /* PAN_TILING_NEON */
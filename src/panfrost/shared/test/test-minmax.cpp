@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_tiling.h"
+
+#include "pan_minmax_cache.h"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+template <typename T>
+static void
+ref_minmax(const std::vector<T> &indices, bool restart, uint32_t restart_index,
+           unsigned *min, unsigned *max)
+{
+   *min = ~0;
+   *max = 0;
+
+   for (T i : indices) {
+      if (restart && i == restart_index)
+         continue;
+
+      *min = MIN2(*min, i);
+      *max = MAX2(*max, i);
+   }
+}
+
+template <typename T>
+static void
+test(unsigned count, bool restart, uint32_t restart_index, unsigned seed)
+{
+   std::vector<T> indices(count);
+
+   srand(seed);
+   for (unsigned i = 0; i < count; ++i) {
+      /* Throw in restart indices and extremes to exercise the masking */
+      switch (rand() % 8) {
+      case 0:
+         indices[i] = restart_index;
+         break;
+      case 1:
+         indices[i] = (T)~0;
+         break;
+      default:
+         indices[i] = 1 + rand() % 1000;
+         break;
+      }
+   }
+
+   unsigned ref_min, ref_max, min, max;
+   ref_minmax(indices, restart, restart_index, &ref_min, &ref_max);
+   panfrost_minmax_search(indices.data(), sizeof(T), count, restart,
+                          restart_index, &min, &max);
+
+   EXPECT_EQ(min, ref_min) << "count " << count << " restart " << restart;
+   EXPECT_EQ(max, ref_max) << "count " << count << " restart " << restart;
+}
+
+template <typename T>
+static void
+test_all(uint32_t restart_index)
+{
+   /* Cover the unrolled loop, the single vector loop and the scalar tail */
+   for (unsigned count = 0; count < 80; ++count) {
+      test<T>(count, false, restart_index, count);
+      test<T>(count, true, restart_index, count);
+   }
+
+   test<T>(4099, false, restart_index, 0);
+   test<T>(4099, true, restart_index, 0);
+}
+
+TEST(MinMax, UInt8) { test_all<uint8_t>(UINT8_MAX); }
+TEST(MinMax, UInt16) { test_all<uint16_t>(UINT16_MAX); }
+TEST(MinMax, UInt32) { test_all<uint32_t>(UINT32_MAX); }
+TEST(MinMax, UInt16NonMaxRestart) { test_all<uint16_t>(0); }
+TEST(MinMax, UInt32NonMaxRestart) { test_all<uint32_t>(7); }
+
+TEST(MinMax, AllRestart)
+{
+   std::vector<uint16_t> indices(37, UINT16_MAX);
+   unsigned min, max;
+
+   panfrost_minmax_search(indices.data(), 2, indices.size(), true, UINT16_MAX,
+                          &min, &max);
+
+   EXPECT_EQ(min, ~0u);
+   EXPECT_EQ(max, 0u);
+}
@@ -230,6 +230,22 @@ TEST(UInterleavedTiling, PartialAccess)
    test_ldst(23, 17, 3, 1, 13, 7, 369 * 16, PIPE_FORMAT_R32G32B32A32_UNORM);
 }
 
+/* Tile-aligned regions take the whole-tile fast paths */
+TEST(UInterleavedTiling, AlignedAccess)
+{
+   test_ldst(64, 48, 16, 16, 48, 32, 64 * 1, PIPE_FORMAT_R8_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 64 * 2, PIPE_FORMAT_R8G8_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 64 * 4, PIPE_FORMAT_R32_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 64 * 8, PIPE_FORMAT_R32G32_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 64 * 16, PIPE_FORMAT_R32G32B32A32_UINT);
+
+   test_ldst(64, 48, 16, 16, 48, 32, 369 * 1, PIPE_FORMAT_R8_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 369 * 2, PIPE_FORMAT_R8G8_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 369 * 4, PIPE_FORMAT_R32_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 369 * 8, PIPE_FORMAT_R32G32_UINT);
+   test_ldst(64, 48, 16, 16, 48, 32, 369 * 16, PIPE_FORMAT_R32G32B32A32_UINT);
+}
+
 TEST(UInterleavedTiling, ETC)
 {
    /* Block alignment assumed */
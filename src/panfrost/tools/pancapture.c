@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Decoder for the captures written by panfrost with PAN_MESA_DEBUG=capture,
+ * and the dumps written with PAN_MESA_DEBUG=faultdump. Decoded as
+ * PAN_MESA_DEBUG=trace would have done, to the files named by
+ * PANDECODE_DUMP_FILE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "pan_capture.h"
+
+static void
+print_help(const char *progname, FILE *file)
+{
+   fprintf(file,
+           "Usage: %s [OPTION] inputfile\n"
+           "Decode a Panfrost capture or fault dump.\n\n"
+           "    -h, --help             display this help and exit\n"
+           "    -s, --stats            only print the number of records\n"
+           "Example:\n"
+           "    PANDECODE_DUMP_FILE=stderr %s /tmp/pancapture.1234\n",
+           progname, progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+   bool stats = false;
+   int c;
+
+   const struct option longopts[] = {
+      { "stats", no_argument, NULL, 's' },
+      { "help", no_argument, NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+   };
+
+   while ((c = getopt_long(argc, argv, "sh", longopts, NULL)) != -1) {
+      switch (c) {
+      case 'h':
+         print_help(argv[0], stdout);
+         return EXIT_SUCCESS;
+      case 's':
+         stats = true;
+         break;
+      default:
+         print_help(argv[0], stderr);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (optind >= argc) {
+      print_help(argv[0], stderr);
+      return EXIT_FAILURE;
+   }
+
+   bool ok = pan_capture_decode(argv[optind], stats);
+
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,609 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Microbenchmarks for the CPU hot paths of the driver: tiled image access,
+ * descriptor packing, BO allocation, dependency tracking and the index
+ * bounds cache. Each benchmark runs for at least --time milliseconds, and
+ * prints its result as one line of JSON, so that runs can be compared:
+ *
+ *    panfrost_bench [--filter tiling/] [--time 200] > results.jsonl
+ *
+ * The BO benchmarks need a GPU and are skipped without one. The compiler is
+ * benchmarked by panfrost_compiler --repeat, on a corpus of shader_tests.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util/macros.h"
+#include "util/os_time.h"
+#include "util/u_dynarray.h"
+#include "util/format/u_format.h"
+
+#define PAN_ARCH 10
+#include "genxml/gen_macros.h"
+
+#include "pan_bo.h"
+#include "pan_device.h"
+#include "pan_minmax_cache.h"
+#include "pan_tiling.h"
+#include "pan_util.h"
+
+typedef void (*bench_func)(void *data, unsigned iterations);
+
+static const char *filter = NULL;
+static int64_t min_ns = 200 * 1000 * 1000;
+
+/* Written by the benchmarks so that the work isn't optimised away */
+uint32_t bench_sink[64];
+
+/* Runs func with doubling iteration counts until it takes at least min_ns,
+ * then reports the last run. bytes is the data processed per iteration, if
+ * a throughput makes sense. */
+
+static void
+bench_run(const char *name, bench_func func, void *data, uint64_t bytes)
+{
+        unsigned iterations = 1;
+        int64_t ns;
+
+        if (filter && !strstr(name, filter))
+                return;
+
+        for (;;) {
+                int64_t start = os_time_get_nano();
+                func(data, iterations);
+                ns = os_time_get_nano() - start;
+
+                if (ns >= min_ns || iterations >= (1u << 30))
+                        break;
+
+                iterations *= 2;
+        }
+
+        printf("{\"name\": \"%s\", \"iterations\": %u, \"ns_per_iter\": %.2f",
+               name, iterations, (double) ns / iterations);
+
+        if (bytes) {
+                printf(", \"mib_per_s\": %.1f",
+                       (double) bytes * iterations * 1000000000.0 /
+                       ((double) ns * 1024 * 1024));
+        }
+
+        printf("}\n");
+        fflush(stdout);
+}
+
+/* Tiled image access, on a whole image and on an unaligned region */
+
+struct tiling_bench {
+        enum pipe_format format;
+        bool store;
+        unsigned x, y, w, h;
+        void *tiled, *linear;
+        uint32_t tiled_stride, linear_stride;
+};
+
+static void
+bench_tiling(void *data, unsigned iterations)
+{
+        struct tiling_bench *b = data;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                if (b->store) {
+                        panfrost_store_tiled_image(b->tiled, b->linear,
+                                                   b->x, b->y, b->w, b->h,
+                                                   b->tiled_stride,
+                                                   b->linear_stride,
+                                                   b->format);
+                } else {
+                        panfrost_load_tiled_image(b->linear, b->tiled,
+                                                  b->x, b->y, b->w, b->h,
+                                                  b->linear_stride,
+                                                  b->tiled_stride,
+                                                  b->format);
+                }
+        }
+}
+
+static void
+run_tiling(void)
+{
+        static const enum pipe_format formats[] = {
+                PIPE_FORMAT_R8_UINT,
+                PIPE_FORMAT_R8G8_UINT,
+                PIPE_FORMAT_R8G8B8A8_UNORM,
+                PIPE_FORMAT_R32G32_UINT,
+                PIPE_FORMAT_R32G32B32A32_UINT,
+                PIPE_FORMAT_ETC2_RGB8,
+        };
+
+        const unsigned size = 1024;
+
+        for (unsigned f = 0; f < ARRAY_SIZE(formats); ++f) {
+                enum pipe_format format = formats[f];
+                const struct util_format_description *desc =
+                        util_format_description(format);
+                unsigned bw = desc->block.width, bh = desc->block.height;
+                unsigned bpp = desc->block.bits / 8;
+                unsigned blocks = (size / bw) * (size / bh);
+
+                struct tiling_bench b = {
+                        .format = format,
+                        .tiled = calloc(blocks, bpp),
+                        .linear = calloc(blocks, bpp),
+                        .linear_stride = (size / bw) * bpp,
+                        .tiled_stride = (size / bw) * 16 * bpp,
+                };
+
+                /* Regions are in pixels and aligned to the block size, the
+                 * unaligned region is not aligned to the tiles */
+                for (unsigned aligned = 0; aligned < 2; ++aligned) {
+                        b.x = aligned ? 0 : 3 * bw;
+                        b.y = aligned ? 0 : 5 * bh;
+                        b.w = aligned ? size : size - 7 * bw;
+                        b.h = aligned ? size : size - 9 * bh;
+
+                        uint64_t bytes = (uint64_t) (b.w / bw) * (b.h / bh) * bpp;
+
+                        for (unsigned store = 0; store < 2; ++store) {
+                                char name[128];
+                                snprintf(name, sizeof(name), "tiling/%s/%s/%s",
+                                         store ? "store" : "load",
+                                         aligned ? "aligned" : "unaligned",
+                                         util_format_short_name(format));
+
+                                b.store = store;
+                                bench_run(name, bench_tiling, &b, bytes);
+                        }
+                }
+
+                free(b.tiled);
+                free(b.linear);
+        }
+}
+
+/* Descriptor packing, with fields varying between iterations as they would
+ * between draws */
+
+static void
+bench_pack_sampler(void *data, unsigned iterations)
+{
+        struct mali_sampler_packed out;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                pan_pack(&out, SAMPLER, cfg) {
+                        cfg.wrap_mode_s = MALI_WRAP_MODE_REPEAT;
+                        cfg.wrap_mode_t = MALI_WRAP_MODE_CLAMP_TO_EDGE;
+                        cfg.mipmap_mode = MALI_MIPMAP_MODE_TRILINEAR;
+                        cfg.minimum_lod = i & 0xff;
+                        cfg.maximum_lod = 0x1000;
+                        cfg.lod_bias = i & 0x7f;
+                        cfg.compare_function = MALI_FUNC_LEQUAL;
+                        cfg.maximum_anisotropy = (i & 15) + 1;
+                }
+
+                bench_sink[i & 63] = out.opaque[i & 7];
+        }
+}
+
+static void
+bench_pack_depth_stencil(void *data, unsigned iterations)
+{
+        struct mali_depth_stencil_packed out;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                pan_pack(&out, DEPTH_STENCIL, cfg) {
+                        cfg.front_compare_function = MALI_FUNC_LEQUAL;
+                        cfg.back_compare_function = MALI_FUNC_LEQUAL;
+                        cfg.stencil_test_enable = i & 1;
+                        cfg.front_write_mask = 0xff;
+                        cfg.back_write_mask = 0xff;
+                        cfg.front_reference_value = i & 0xff;
+                        cfg.depth_write_enable = true;
+                        cfg.depth_function = MALI_FUNC_LESS;
+                        cfg.depth_units = (float) i;
+                        cfg.depth_factor = 1.0f;
+                }
+
+                bench_sink[i & 63] = out.opaque[i & 7];
+        }
+}
+
+static void
+bench_pack_blend(void *data, unsigned iterations)
+{
+        struct mali_blend_packed out;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                pan_pack(&out, BLEND, cfg) {
+                        cfg.round_to_fb_precision = true;
+                        cfg.constant = i & 0xffff;
+                        cfg.internal.mode = MALI_BLEND_MODE_FIXED_FUNCTION;
+                        cfg.internal.fixed_function.num_comps = 4;
+                        cfg.internal.fixed_function.rt = i & 7;
+                }
+
+                bench_sink[i & 63] = out.opaque[i & 3];
+        }
+}
+
+static void
+bench_pack_buffer(void *data, unsigned iterations)
+{
+        struct mali_buffer_packed out;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                pan_pack(&out, BUFFER, cfg) {
+                        cfg.address = 0x10000000ull + i * 256;
+                        cfg.size = 256;
+                }
+
+                bench_sink[i & 63] = out.opaque[i & 7];
+        }
+}
+
+static void
+bench_pack_shader_program(void *data, unsigned iterations)
+{
+        struct mali_shader_program_packed out;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                pan_pack(&out, SHADER_PROGRAM, cfg) {
+                        cfg.stage = MALI_SHADER_STAGE_FRAGMENT;
+                        cfg.primary_shader = true;
+                        cfg.register_allocation =
+                                MALI_SHADER_REGISTER_ALLOCATION_32_PER_THREAD;
+                        cfg.binary = 0x20000000ull + i * 128;
+                }
+
+                bench_sink[i & 63] = out.opaque[i & 7];
+        }
+}
+
+static void
+run_pack(void)
+{
+        bench_run("pack/sampler", bench_pack_sampler, NULL, 0);
+        bench_run("pack/depth-stencil", bench_pack_depth_stencil, NULL, 0);
+        bench_run("pack/blend", bench_pack_blend, NULL, 0);
+        bench_run("pack/buffer", bench_pack_buffer, NULL, 0);
+        bench_run("pack/shader-program", bench_pack_shader_program, NULL, 0);
+}
+
+/* BO creation and release, which is a cache fetch in the steady state
+ * unless the cache is disabled */
+
+struct bo_bench {
+        struct panfrost_device *dev;
+        size_t size;
+        uint32_t flags;
+};
+
+static void
+bench_bo(void *data, unsigned iterations)
+{
+        struct bo_bench *b = data;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                struct panfrost_bo *bo =
+                        panfrost_bo_create(b->dev, b->size, b->flags, "Bench");
+
+                if (!bo)
+                        abort();
+
+                panfrost_bo_unreference(bo);
+        }
+}
+
+static void
+run_bo(void)
+{
+        static const size_t sizes[] = { 4096, 65536, 1 << 20 };
+
+        int fd = drmOpenWithType("panfrost", NULL, DRM_NODE_RENDER);
+
+        /* GPUs driven by kbase have no DRM node */
+        if (fd < 0)
+                fd = open("/dev/mali0", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+
+        if (fd < 0) {
+                fprintf(stderr, "No panfrost device, skipping BO benchmarks\n");
+                return;
+        }
+
+        struct panfrost_device dev = { 0 };
+        panfrost_open_device(NULL, fd, &dev);
+
+        if (!dev.model) {
+                fprintf(stderr, "Unknown GPU, skipping BO benchmarks\n");
+                panfrost_close_device(&dev);
+                return;
+        }
+
+        for (unsigned nocache = 0; nocache < 2; ++nocache) {
+                if (nocache)
+                        dev.debug |= PAN_DBG_NO_CACHE;
+
+                for (unsigned i = 0; i < ARRAY_SIZE(sizes); ++i) {
+                        for (unsigned invisible = 0; invisible < 2; ++invisible) {
+                                struct bo_bench b = {
+                                        .dev = &dev,
+                                        .size = sizes[i],
+                                        .flags = invisible ? PAN_BO_INVISIBLE : 0,
+                                };
+
+                                char name[128];
+                                snprintf(name, sizeof(name), "bo/%s/%s/%zu",
+                                         nocache ? "nocache" : "cache",
+                                         invisible ? "invisible" : "mapped",
+                                         sizes[i]);
+
+                                bench_run(name, bench_bo, &b, 0);
+                        }
+                }
+        }
+
+        dev.debug &= ~PAN_DBG_NO_CACHE;
+        panfrost_close_device(&dev);
+}
+
+/* Dependency lists of BOs, built from scratch in a shuffled queue order, and
+ * updated in place once built */
+
+struct deps_bench {
+        struct util_dynarray deps;
+        uint32_t *queues;
+        unsigned count;
+};
+
+static void
+bench_deps_build(void *data, unsigned iterations)
+{
+        struct deps_bench *b = data;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                util_dynarray_clear(&b->deps);
+
+                for (unsigned j = 0; j < b->count; ++j) {
+                        struct panfrost_usage u = {
+                                .queue = b->queues[j],
+                                .write = j & 1,
+                                .seqnum = i,
+                        };
+
+                        panfrost_add_dep_after(&b->deps, u, 0);
+                }
+        }
+}
+
+static void
+bench_deps_update(void *data, unsigned iterations)
+{
+        struct deps_bench *b = data;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                unsigned j = i % b->count;
+                struct panfrost_usage u = {
+                        .queue = b->queues[j],
+                        .write = j & 1,
+                        .seqnum = i,
+                };
+
+                bench_sink[i & 63] = panfrost_add_dep_after(&b->deps, u, 0);
+        }
+}
+
+static void
+run_deps(void)
+{
+        static const unsigned counts[] = { 4, 64, 1024 };
+
+        for (unsigned c = 0; c < ARRAY_SIZE(counts); ++c) {
+                struct deps_bench b = {
+                        .count = counts[c],
+                        .queues = malloc(counts[c] * sizeof(uint32_t)),
+                };
+
+                util_dynarray_init(&b.deps, NULL);
+
+                /* Fixed shuffle, so that runs are comparable */
+                srand(1);
+                for (unsigned i = 0; i < b.count; ++i)
+                        b.queues[i] = i;
+                for (unsigned i = b.count - 1; i > 0; --i) {
+                        unsigned j = rand() % (i + 1);
+                        uint32_t tmp = b.queues[i];
+
+                        b.queues[i] = b.queues[j];
+                        b.queues[j] = tmp;
+                }
+
+                char name[128];
+                snprintf(name, sizeof(name), "deps/build/%u", b.count);
+                bench_run(name, bench_deps_build, &b, 0);
+
+                snprintf(name, sizeof(name), "deps/update/%u", b.count);
+                bench_run(name, bench_deps_update, &b, 0);
+
+                util_dynarray_fini(&b.deps);
+                free(b.queues);
+        }
+}
+
+/* Index bounds: lookups in a full cache, and the search done on a miss */
+
+struct minmax_bench {
+        struct panfrost_minmax_cache cache;
+
+        /* Starts of the cached ranges */
+        unsigned hits[PANFROST_MINMAX_SIZE];
+        unsigned num_hits;
+
+        void *indices;
+        unsigned index_size, count;
+};
+
+static void
+bench_minmax_hit(void *data, unsigned iterations)
+{
+        struct minmax_bench *b = data;
+        unsigned min, max;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                unsigned start = b->hits[i % b->num_hits];
+
+                if (!panfrost_minmax_cache_get(&b->cache, 2, start, 64,
+                                               &min, &max))
+                        abort();
+
+                bench_sink[i & 63] = min;
+        }
+}
+
+static void
+bench_minmax_miss(void *data, unsigned iterations)
+{
+        struct minmax_bench *b = data;
+        unsigned min, max;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                /* Never added */
+                bench_sink[i & 63] =
+                        panfrost_minmax_cache_get(&b->cache, 2, i * 64 + 1, 63,
+                                                  &min, &max);
+        }
+}
+
+static void
+bench_minmax_search(void *data, unsigned iterations)
+{
+        struct minmax_bench *b = data;
+        unsigned min, max;
+
+        for (unsigned i = 0; i < iterations; ++i) {
+                panfrost_minmax_search(b->indices, b->index_size, b->count,
+                                       false, 0, &min, &max);
+                bench_sink[i & 63] = min + max;
+        }
+}
+
+static void
+run_minmax(void)
+{
+        struct minmax_bench b = { .count = 1 << 20 };
+
+        /* Fill the cache. Ranges may hash to the same set and evict each
+         * other, so only look up the ones which stayed. */
+        for (unsigned i = 0; i < PANFROST_MINMAX_SIZE; ++i)
+                panfrost_minmax_cache_add(&b.cache, 2, i * 64, 64, i, i + 63);
+
+        for (unsigned i = 0; i < PANFROST_MINMAX_SIZE; ++i) {
+                unsigned min, max;
+
+                if (panfrost_minmax_cache_get(&b.cache, 2, i * 64, 64,
+                                              &min, &max))
+                        b.hits[b.num_hits++] = i * 64;
+        }
+
+        if (b.num_hits)
+                bench_run("minmax/cache/hit", bench_minmax_hit, &b, 0);
+
+        bench_run("minmax/cache/miss", bench_minmax_miss, &b, 0);
+
+        for (unsigned size = 1; size <= 4; size *= 2) {
+                b.index_size = size;
+                b.indices = malloc(b.count * size);
+
+                for (unsigned i = 0; i < b.count; ++i) {
+                        uint32_t v = (i * 2654435761u) >> (32 - size * 8);
+                        memcpy((uint8_t *) b.indices + i * size, &v, size);
+                }
+
+                char name[128];
+                snprintf(name, sizeof(name), "minmax/search/u%u", size * 8);
+                bench_run(name, bench_minmax_search, &b,
+                          (uint64_t) b.count * size);
+
+                free(b.indices);
+        }
+}
+
+static void
+print_help(const char *progname, FILE *file)
+{
+        fprintf(file,
+                "Usage: %s [OPTION]\n"
+                "Run the Panfrost CPU microbenchmarks, printing JSON lines.\n\n"
+                "    -f, --filter STR       only run benchmarks whose name contains STR\n"
+                "    -t, --time MS          minimum time of each benchmark (default 200)\n"
+                "    -h, --help             display this help and exit\n",
+                progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+        int c;
+
+        const struct option longopts[] = {
+                { "filter", required_argument, NULL, 'f' },
+                { "time", required_argument, NULL, 't' },
+                { "help", no_argument, NULL, 'h' },
+                { NULL, 0, NULL, 0 }
+        };
+
+        while ((c = getopt_long(argc, argv, "f:t:h", longopts, NULL)) != -1) {
+                switch (c) {
+                case 'f':
+                        filter = optarg;
+                        break;
+                case 't':
+                        min_ns = strtoll(optarg, NULL, 0) * 1000 * 1000;
+                        break;
+                case 'h':
+                        print_help(argv[0], stdout);
+                        return EXIT_SUCCESS;
+                default:
+                        print_help(argv[0], stderr);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        run_tiling();
+        run_pack();
+        run_deps();
+        run_minmax();
+
+        run_bo();
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Standalone compiler for shader-db style regression tracking. Compiles every
+ * shader_test file found in the given files and directories, in parallel,
+ * and prints the statistics of each compiled shader as one line of JSON:
+ *
+ *    panfrost_compiler [--gpu G52] [-j 8] shaders/ > stats.jsonl
+ *
+ * Midgard and Bifrost/Valhall are both supported, chosen by the GPU. Each
+ * file is compiled in its own process, as the GLSL standalone compiler is
+ * not thread-safe. The exit status is nonzero if any file failed to compile.
+ *
+ * With --repeat N, each shader is instead compiled N times and the compile
+ * time is printed rather than the statistics, to benchmark the backend on a
+ * fixed corpus. Use -j 1 for stable timings.
+ */
+
+#include <ftw.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "main/mtypes.h"
+#include "compiler/glsl/standalone.h"
+#include "compiler/glsl/glsl_to_nir.h"
+#include "compiler/glsl/gl_nir.h"
+#include "compiler/nir_types.h"
+#include "util/os_time.h"
+#include "util/u_dynarray.h"
+#include "bifrost/bifrost_compile.h"
+#include "midgard/midgard_compile.h"
+
+static unsigned gpu_id = 0x7212;
+static unsigned repeat = 0;
+
+static const struct {
+        const char *name;
+        unsigned id;
+} gpus[] = {
+        { "T720",  0x720 },
+        { "T760",  0x750 },
+        { "T820",  0x820 },
+        { "T860",  0x860 },
+        { "T880",  0x880 },
+        { "G71",   0x6000 },
+        { "G72",   0x6200 },
+        { "G51",   0x7000 },
+        { "G76",   0x7100 },
+        { "G52",   0x7200 },
+        { "G31",   0x7300 },
+        { "G77",   0x9000 },
+        { "G57",   0x9100 },
+        { "G78",   0x9200 },
+        { "G68",   0x9400 },
+        { "G78AE", 0x9500 },
+};
+
+static unsigned
+gpu_arch(void)
+{
+        /* Midgard IDs are 0xTXX0, Bifrost and later 0xAXXX */
+        return (gpu_id >= 0x1000) ? (gpu_id >> 12) :
+               (gpu_id >= 0x800) ? 5 : 4;
+}
+
+static int
+st_packed_uniforms_type_size(const struct glsl_type *type, bool bindless)
+{
+        return glsl_count_dword_slots(type, bindless);
+}
+
+static int
+glsl_type_size(const struct glsl_type *type, bool bindless)
+{
+        return glsl_count_attribute_slots(type, false);
+}
+
+/* Lower GLSL IR linked by the standalone compiler to the NIR the drivers
+ * hand to the backend compilers */
+
+static nir_shader *
+shader_to_nir(struct gl_context *ctx, struct gl_shader_program *prog,
+              gl_shader_stage stage)
+{
+        const nir_shader_compiler_options *options =
+                (gpu_arch() >= 6) ? &bifrost_nir_options : &midgard_nir_options;
+
+        nir_shader *nir = glsl_to_nir(&ctx->Const, prog, stage, options);
+
+        nir_assign_var_locations(nir, nir_var_shader_in, &nir->num_inputs,
+                                 glsl_type_size);
+        nir_assign_var_locations(nir, nir_var_shader_out, &nir->num_outputs,
+                                 glsl_type_size);
+        nir_assign_var_locations(nir, nir_var_uniform, &nir->num_uniforms,
+                                 glsl_type_size);
+
+        NIR_PASS_V(nir, nir_lower_global_vars_to_local);
+        NIR_PASS_V(nir, nir_lower_io_to_temporaries,
+                   nir_shader_get_entrypoint(nir), true, true);
+        NIR_PASS_V(nir, nir_opt_copy_prop_vars);
+        NIR_PASS_V(nir, nir_opt_combine_stores, nir_var_all);
+
+        NIR_PASS_V(nir, nir_lower_system_values);
+        NIR_PASS_V(nir, gl_nir_lower_samplers, prog);
+        NIR_PASS_V(nir, nir_split_var_copies);
+        NIR_PASS_V(nir, nir_lower_var_copies);
+
+        NIR_PASS_V(nir, nir_lower_io, nir_var_uniform,
+                   st_packed_uniforms_type_size, (nir_lower_io_options)0);
+        NIR_PASS_V(nir, nir_lower_uniforms_to_ubo, true, false);
+
+        /* before buffers and vars_to_ssa */
+        NIR_PASS_V(nir, gl_nir_lower_images, true);
+
+        NIR_PASS_V(nir, gl_nir_lower_buffers, prog);
+        NIR_PASS_V(nir, nir_opt_constant_folding);
+
+        return nir;
+}
+
+static void
+backend_compile(nir_shader *nir, struct util_dynarray *binary,
+                struct pan_shader_info *info)
+{
+        struct panfrost_compile_inputs inputs = {
+                .gpu_id = gpu_id,
+                .fixed_sysval_ubo = -1,
+        };
+
+        if (gpu_arch() >= 6)
+                bifrost_compile_shader_nir(nir, &inputs, binary, info);
+        else
+                midgard_compile_shader_nir(nir, &inputs, binary, info);
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+        uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+        return (x > y) - (x < y);
+}
+
+/* The backend compilers modify the NIR they are given, so every run gets a
+ * fresh clone. Only the backend is timed. */
+
+static void
+time_nir(nir_shader *nir, const char *name, FILE *out)
+{
+        uint64_t *ns = calloc(repeat, sizeof(*ns));
+
+        for (unsigned i = 0; i < repeat; ++i) {
+                nir_shader *clone = nir_shader_clone(NULL, nir);
+                struct pan_shader_info info = { 0 };
+                struct util_dynarray binary;
+
+                util_dynarray_init(&binary, NULL);
+
+                int64_t start = os_time_get_nano();
+                backend_compile(clone, &binary, &info);
+                ns[i] = os_time_get_nano() - start;
+
+                util_dynarray_fini(&binary);
+                ralloc_free(clone);
+        }
+
+        qsort(ns, repeat, sizeof(*ns), cmp_u64);
+
+        fprintf(out, "{\"name\": ");
+        pan_print_json_string(out, name);
+        fprintf(out, ", \"stage\": \"%s\", \"repeat\": %u, "
+                "\"compile_ns_min\": %" PRIu64 ", "
+                "\"compile_ns_median\": %" PRIu64 "}\n",
+                gl_shader_stage_name(nir->info.stage), repeat, ns[0],
+                ns[repeat / 2]);
+
+        free(ns);
+}
+
+static bool
+compile_nir(nir_shader *nir, const char *name, FILE *out)
+{
+        struct pan_shader_info info = { 0 };
+        struct util_dynarray binary;
+
+        if (repeat) {
+                time_nir(nir, name, out);
+                return true;
+        }
+
+        util_dynarray_init(&binary, NULL);
+        backend_compile(nir, &binary, &info);
+
+        info.stage = nir->info.stage;
+        pan_shader_stats_print_json(out, name, &info);
+
+        util_dynarray_fini(&binary);
+        return true;
+}
+
+/* shader_test sections holding GLSL, by the file extension the standalone
+ * compiler uses to infer the stage */
+
+static const struct {
+        const char *section;
+        const char *ext;
+        gl_shader_stage stage;
+} sections[] = {
+        { "[vertex shader]",   "vert", MESA_SHADER_VERTEX },
+        { "[fragment shader]", "frag", MESA_SHADER_FRAGMENT },
+        { "[compute shader]",  "comp", MESA_SHADER_COMPUTE },
+};
+
+/* Split a shader_test into one source file per stage in dir. Returns the
+ * number of stages found. */
+
+static unsigned
+split_shader_test(const char *path, const char *dir, char **files,
+                  gl_shader_stage *stages)
+{
+        FILE *in = fopen(path, "r");
+        FILE *out = NULL;
+        unsigned count = 0;
+        char *line = NULL;
+        size_t len = 0;
+
+        if (!in)
+                return 0;
+
+        while (getline(&line, &len, in) != -1) {
+                if (line[0] != '[') {
+                        if (out)
+                                fputs(line, out);
+
+                        continue;
+                }
+
+                if (out) {
+                        fclose(out);
+                        out = NULL;
+                }
+
+                for (unsigned i = 0; i < ARRAY_SIZE(sections); ++i) {
+                        if (strncmp(line, sections[i].section,
+                                    strlen(sections[i].section)))
+                                continue;
+
+                        if (count == MESA_SHADER_STAGES)
+                                break;
+
+                        if (asprintf(&files[count], "%s/%u.%s", dir, count,
+                                     sections[i].ext) < 0)
+                                break;
+
+                        stages[count] = sections[i].stage;
+                        out = fopen(files[count++], "w");
+                        break;
+                }
+        }
+
+        if (out)
+                fclose(out);
+
+        free(line);
+        fclose(in);
+        return count;
+}
+
+static bool
+compile_shader_test(const char *path, FILE *out)
+{
+        char dir[] = "/tmp/panfrost_compiler.XXXXXX";
+        char *files[MESA_SHADER_STAGES] = { NULL };
+        gl_shader_stage stages[MESA_SHADER_STAGES];
+        bool ok = true;
+
+        if (!mkdtemp(dir))
+                return false;
+
+        unsigned count = split_shader_test(path, dir, files, stages);
+
+        if (count) {
+                struct standalone_options options = {
+                        .glsl_version = 460,
+                        .do_link = true,
+                        .lower_precision = true
+                };
+
+                static struct gl_context local_ctx;
+
+                struct gl_shader_program *prog =
+                        standalone_compile_shader(&options, count, files,
+                                                  &local_ctx);
+
+                if (prog && prog->data->LinkStatus) {
+                        for (unsigned i = 0; i < count; ++i) {
+                                struct gl_linked_shader *shader =
+                                        prog->_LinkedShaders[stages[i]];
+
+                                if (!shader)
+                                        continue;
+
+                                shader->Program->info.stage = stages[i];
+                                ok &= compile_nir(shader_to_nir(&local_ctx, prog, stages[i]),
+                                                  path, out);
+                        }
+                } else {
+                        fprintf(stderr, "%s: failed to compile GLSL\n", path);
+                        ok = false;
+                }
+        }
+
+        for (unsigned i = 0; i < count; ++i) {
+                unlink(files[i]);
+                free(files[i]);
+        }
+
+        rmdir(dir);
+        return ok;
+}
+
+static struct util_dynarray tests;
+
+static int
+collect_shader_test(const char *path, const struct stat *st, int type,
+                    struct FTW *ftw)
+{
+        const char *ext = strrchr(path, '.');
+
+        if (type == FTW_F && ext && !strcmp(ext, ".shader_test"))
+                util_dynarray_append(&tests, char *, strdup(path));
+
+        return 0;
+}
+
+/* Compile a file in a child process. Statistics are buffered and written
+ * with a single write, so lines from parallel children don't interleave. */
+
+static pid_t
+spawn(const char *path)
+{
+        fflush(stdout);
+        pid_t pid = fork();
+
+        if (pid != 0)
+                return pid;
+
+        char *buf = NULL;
+        size_t size = 0;
+        FILE *out = open_memstream(&buf, &size);
+        bool ok = compile_shader_test(path, out);
+
+        fclose(out);
+
+        if (size && write(STDOUT_FILENO, buf, size) != size)
+                ok = false;
+
+        free(buf);
+        _exit(ok ? 0 : 1);
+}
+
+int
+main(int argc, char **argv)
+{
+        unsigned jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        int c;
+
+        static struct option longopts[] = {
+                { "id", required_argument, NULL, 'i' },
+                { "gpu", required_argument, NULL, 'g' },
+                { "jobs", required_argument, NULL, 'j' },
+                { "repeat", required_argument, NULL, 'r' },
+                { NULL, 0, NULL, 0 }
+        };
+
+        while ((c = getopt_long(argc, argv, "i:g:j:r:", longopts, NULL)) != -1) {
+                switch (c) {
+                case 'i':
+                        gpu_id = strtol(optarg, NULL, 0);
+                        break;
+                case 'g':
+                        gpu_id = 0;
+
+                        /* Compatibility with the Arm compiler */
+                        if (strncmp(optarg, "Mali-", 5) == 0) optarg += 5;
+
+                        for (unsigned i = 0; i < ARRAY_SIZE(gpus); ++i) {
+                                if (!strcmp(gpus[i].name, optarg))
+                                        gpu_id = gpus[i].id;
+                        }
+
+                        break;
+                case 'j':
+                        jobs = atoi(optarg);
+                        break;
+                case 'r':
+                        repeat = atoi(optarg);
+                        break;
+                default:
+                        return 1;
+                }
+        }
+
+        if (!gpu_id) {
+                fprintf(stderr, "Unknown GPU\n");
+                return 1;
+        }
+
+        if (optind >= argc) {
+                fprintf(stderr, "Usage: %s [--gpu NAME | --id ID] [-j JOBS] [--repeat N] "
+                        "<shader_test files or directories>\n", argv[0]);
+                return 1;
+        }
+
+        util_dynarray_init(&tests, NULL);
+
+        for (int i = optind; i < argc; ++i)
+                nftw(argv[i], collect_shader_test, 16, 0);
+
+        unsigned running = 0, failed = 0;
+        jobs = MAX2(jobs, 1);
+
+        util_dynarray_foreach(&tests, char *, path) {
+                if (running == jobs) {
+                        int status;
+                        wait(&status);
+                        failed += !WIFEXITED(status) || WEXITSTATUS(status);
+                        running--;
+                }
+
+                if (spawn(*path) < 0)
+                        failed++;
+                else
+                        running++;
+
+                free(*path);
+        }
+
+        while (running--) {
+                int status;
+                wait(&status);
+                failed += !WIFEXITED(status) || WEXITSTATUS(status);
+        }
+
+        util_dynarray_fini(&tests);
+
+        if (failed)
+                fprintf(stderr, "%u files failed to compile\n", failed);
+
+        return failed ? 1 : 0;
+}
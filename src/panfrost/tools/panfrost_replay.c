@@ -0,0 +1,776 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Replays a capture written with PAN_MESA_DEBUG=capture on a CSF GPU through
+ * kbase, and reports how long each frame took. Since no driver is involved,
+ * this measures the command streams themselves, on a fixed workload.
+ *
+ *    panfrost_replay [--ring-size MB] capture
+ *
+ * The BOs are mapped at the addresses they had when captured. Their contents
+ * are restored as recorded, waiting for the GPU to go idle before memory it
+ * may be using is overwritten, so frames with many updates are serialised
+ * more than they were originally. Frame times include restoring memory, the
+ * time spent doing that is reported separately.
+ *
+ * Tiler heaps are created by the kernel, so their addresses change: they are
+ * patched in the command streams, and in any word of the BOs pointing into a
+ * heap chunk.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "drm-uapi/panfrost_drm.h"
+#include "util/hash_table.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+#include "util/u_dynarray.h"
+
+#define PAN_ARCH 10
+#include "genxml/gen_macros.h"
+
+#include "pan_base.h"
+#include "pan_capture.h"
+
+#define REPLAY_MAX_QUEUES 8
+#define REPLAY_TIMEOUT_NS (10ull * 1000 * 1000 * 1000)
+
+/* The driver does not keep state in these registers between submissions */
+#define REPLAY_REG_ADDR  0x5c
+#define REPLAY_REG_VALUE 0x5e
+
+/* Enough for the event write signalling a submission, padded to 64 bytes */
+#define REPLAY_TAIL_INSTRS 8
+
+struct replay_mem {
+        base_va va;
+        size_t size;
+        void *cpu;
+        bool exec;
+        bool event;
+
+        /* Freed in the capture, but kept mapped until the address is
+         * needed again, so that freeing doesn't need the GPU to be idle */
+        bool freed;
+};
+
+struct replay_queue {
+        unsigned id;
+        struct kbase_cs cs;
+        struct base_ptr ring;
+        struct kbase_syncobj *syncobj;
+        uint64_t seqnum;
+
+        /* Ring offsets, insert is where the next submission goes, and
+         * everything before waited is known to have been executed */
+        uint64_t insert;
+        uint64_t waited;
+};
+
+struct replay_heap {
+        bool valid;
+        struct pan_capture_tiler_heap old;
+        base_va context_va;
+        base_va chunk_va;
+};
+
+struct replay {
+        kbase k;
+        struct kbase_context *ctx;
+        unsigned ring_size;
+
+        struct hash_table_u64 *mems;
+        struct util_dynarray mem_list;
+
+        struct replay_queue queues[REPLAY_MAX_QUEUES];
+        unsigned num_queues;
+
+        struct replay_heap heaps[KBASE_MAX_TILER_HEAPS];
+
+        /* Whether the GPU may still be executing submitted work */
+        bool busy;
+
+        unsigned frame_submits;
+        uint64_t frame_restore_ns;
+};
+
+static bool
+replay_wait_idle(struct replay *r)
+{
+        kbase k = r->k;
+
+        if (!r->busy)
+                return true;
+
+        for (unsigned i = 0; i < r->num_queues; ++i) {
+                struct replay_queue *q = &r->queues[i];
+
+                if (q->waited == q->insert)
+                        continue;
+
+                if (!k->cs_wait(k, &q->cs, q->insert, q->syncobj,
+                                REPLAY_TIMEOUT_NS)) {
+                        fprintf(stderr, "GPU hang on queue %u\n", q->id);
+                        return false;
+                }
+
+                q->waited = q->insert;
+        }
+
+        r->busy = false;
+        return true;
+}
+
+static void
+replay_unmap(struct replay *r, struct replay_mem *mem)
+{
+        munmap(mem->cpu, mem->size);
+        r->k->free(r->k, mem->va);
+        _mesa_hash_table_u64_remove(r->mems, mem->va);
+        mem->cpu = NULL;
+}
+
+/* Releases the memory of BOs freed in the capture, must be idle */
+static void
+replay_release_freed(struct replay *r)
+{
+        util_dynarray_foreach(&r->mem_list, struct replay_mem *, mem) {
+                if ((*mem)->cpu && (*mem)->freed)
+                        replay_unmap(r, *mem);
+        }
+}
+
+static struct replay_mem *
+replay_find_containing(struct replay *r, base_va va, size_t size)
+{
+        util_dynarray_foreach(&r->mem_list, struct replay_mem *, mem) {
+                if ((*mem)->cpu && va >= (*mem)->va &&
+                    va + size <= (*mem)->va + (*mem)->size)
+                        return *mem;
+        }
+
+        return NULL;
+}
+
+/* Returns the memory at va, mapping it if needed. *fresh is set if the
+ * memory was just allocated, and so can't be in use by the GPU. */
+static struct replay_mem *
+replay_map(struct replay *r, base_va va, size_t size, bool exec, bool event,
+           bool *fresh)
+{
+        kbase k = r->k;
+        struct replay_mem *mem = _mesa_hash_table_u64_search(r->mems, va);
+
+        *fresh = false;
+
+        if (mem && mem->size == size && mem->exec == exec &&
+            mem->event == event) {
+                mem->freed = false;
+                return mem;
+        }
+
+        if (mem) {
+                if (!replay_wait_idle(r))
+                        return NULL;
+
+                replay_unmap(r, mem);
+        }
+
+        unsigned flags = exec ? 0 : PANFROST_BO_NOEXEC;
+        if (event)
+                flags |= MALI_BO_EVENT;
+
+        struct base_ptr ptr = k->alloc_at(k, va, size, flags);
+
+        /* The address may be taken by BOs which were freed since */
+        if (!ptr.cpu) {
+                if (!replay_wait_idle(r))
+                        return NULL;
+
+                replay_release_freed(r);
+                ptr = k->alloc_at(k, va, size, flags);
+        }
+
+        if (!ptr.cpu) {
+                fprintf(stderr, "Failed to map %zu bytes at %"PRIx64"\n",
+                        size, va);
+                return NULL;
+        }
+
+        mem = calloc(1, sizeof(*mem));
+        *mem = (struct replay_mem) {
+                .va = va,
+                .size = size,
+                .cpu = ptr.cpu,
+                .exec = exec,
+                .event = event,
+        };
+
+        _mesa_hash_table_u64_insert(r->mems, va, mem);
+        util_dynarray_append(&r->mem_list, struct replay_mem *, mem);
+
+        *fresh = true;
+        return mem;
+}
+
+static void
+replay_relocate_bo(struct replay *r, uint64_t *words, size_t count)
+{
+        for (unsigned h = 0; h < ARRAY_SIZE(r->heaps); ++h) {
+                struct replay_heap *heap = &r->heaps[h];
+
+                if (!heap->valid || heap->old.chunk_va == heap->chunk_va)
+                        continue;
+
+                uint64_t start = heap->old.chunk_va;
+                uint64_t end = start + heap->old.chunk_size;
+
+                for (size_t i = 0; i < count; ++i) {
+                        if (words[i] >= start && words[i] <= end)
+                                words[i] = words[i] - start + heap->chunk_va;
+                }
+        }
+}
+
+static void
+replay_relocate_cs(struct replay *r, uint64_t *ins, size_t count)
+{
+        for (size_t i = 0; i < count; ++i) {
+                /* Heap contexts are set with a 48-bit move */
+                if ((ins[i] >> 56) != 1)
+                        continue;
+
+                uint64_t value = ins[i] & BITFIELD64_MASK(48);
+
+                for (unsigned h = 0; h < ARRAY_SIZE(r->heaps); ++h) {
+                        struct replay_heap *heap = &r->heaps[h];
+
+                        if (heap->valid && value == heap->old.context_va) {
+                                ins[i] = (ins[i] & ~BITFIELD64_MASK(48)) |
+                                        heap->context_va;
+                        }
+                }
+        }
+}
+
+static bool
+replay_context(struct replay *r)
+{
+        if (r->ctx)
+                return true;
+
+        r->ctx = r->k->context_create(r->k, 0);
+
+        if (!r->ctx)
+                fprintf(stderr, "Failed to create a context\n");
+
+        return r->ctx;
+}
+
+static bool
+read_data(FILE *fp, void *data, size_t size)
+{
+        if (fread(data, 1, size, fp) == size)
+                return true;
+
+        fprintf(stderr, "Truncated capture\n");
+        return false;
+}
+
+static bool
+replay_bo(struct replay *r, FILE *fp, const struct pan_capture_record *rec)
+{
+        bool exec = rec->flags & PAN_CAPTURE_BO_EXECUTE;
+        bool fresh;
+
+        struct replay_mem *mem = replay_map(r, rec->va, rec->size, exec,
+                                            false, &fresh);
+
+        if (!mem)
+                return false;
+
+        if (!rec->data_size)
+                return true;
+
+        if (rec->data_size != rec->size) {
+                fprintf(stderr, "BO at %"PRIx64" has a bad size\n", rec->va);
+                return false;
+        }
+
+        if (!fresh && !replay_wait_idle(r))
+                return false;
+
+        if (!read_data(fp, mem->cpu, rec->size))
+                return false;
+
+        replay_relocate_bo(r, mem->cpu, rec->size / 8);
+        r->k->mem_sync(r->k, mem->va, mem->cpu, rec->size, false);
+
+        return true;
+}
+
+static bool
+replay_event_mem(struct replay *r, FILE *fp,
+                 const struct pan_capture_record *rec)
+{
+        struct replay_mem *mem;
+
+        /* KCPU event memory is only read by the GPU, so it can be updated
+         * while work is running, as the kernel would */
+        if (rec->flags & PAN_CAPTURE_EVENT_KCPU) {
+                mem = replay_find_containing(r, rec->va, rec->data_size);
+
+                if (!mem) {
+                        fprintf(stderr, "KCPU event memory at %"PRIx64
+                                " was never mapped\n", rec->va);
+                        return false;
+                }
+        } else {
+                bool fresh;
+
+                mem = replay_map(r, rec->va, rec->size, false, true, &fresh);
+
+                if (!mem)
+                        return false;
+        }
+
+        void *dst = mem->cpu + (rec->va - mem->va);
+
+        if (!read_data(fp, dst, rec->data_size))
+                return false;
+
+        r->k->mem_sync(r->k, rec->va, dst, rec->data_size, false);
+        return true;
+}
+
+static bool
+replay_tiler_heap(struct replay *r, FILE *fp,
+                  const struct pan_capture_record *rec)
+{
+        struct pan_capture_tiler_heap heap;
+
+        if (rec->data_size != sizeof(heap)) {
+                fprintf(stderr, "Bad tiler heap record\n");
+                return false;
+        }
+
+        if (!read_data(fp, &heap, sizeof(heap)))
+                return false;
+
+        /* Create the heaps with the same chunk size, so that offsets into
+         * the chunks stay valid */
+        if (!r->ctx)
+                r->k->tiler_heap_config.chunk_size = heap.chunk_size;
+
+        if (!replay_context(r))
+                return false;
+
+        if (heap.index >= r->ctx->num_tiler_heaps) {
+                fprintf(stderr, "Capture uses tiler heap %u, only %u exist\n",
+                        heap.index, r->ctx->num_tiler_heaps);
+                return false;
+        }
+
+        r->heaps[heap.index] = (struct replay_heap) {
+                .valid = true,
+                .old = heap,
+                .context_va = r->ctx->tiler_heap_va[heap.index],
+                .chunk_va = r->ctx->tiler_heap_header[heap.index],
+        };
+
+        return true;
+}
+
+static struct replay_queue *
+replay_queue(struct replay *r, unsigned id)
+{
+        kbase k = r->k;
+
+        for (unsigned i = 0; i < r->num_queues; ++i) {
+                if (r->queues[i].id == id)
+                        return &r->queues[i];
+        }
+
+        if (r->num_queues == REPLAY_MAX_QUEUES) {
+                fprintf(stderr, "Too many queues in the capture\n");
+                return NULL;
+        }
+
+        if (!replay_context(r))
+                return NULL;
+
+        struct base_ptr ring = k->alloc(k, r->ring_size, PANFROST_BO_NOEXEC, 0);
+        if (!ring.cpu) {
+                fprintf(stderr, "Failed to allocate a ring\n");
+                return NULL;
+        }
+
+        memset(ring.cpu, 0, r->ring_size);
+        k->mem_sync(k, ring.gpu, ring.cpu, r->ring_size, false);
+
+        struct replay_queue *q = &r->queues[r->num_queues++];
+
+        *q = (struct replay_queue) {
+                .id = id,
+                .cs = k->cs_bind(k, r->ctx, ring.gpu, r->ring_size, 1),
+                .ring = ring,
+                .syncobj = k->syncobj_create(k),
+        };
+
+        return q;
+}
+
+/* Copies to the ring, wrapping around at the end */
+static void
+replay_ring_write(struct replay *r, struct replay_queue *q,
+                  const void *data, size_t size)
+{
+        size_t offset = q->insert % r->ring_size;
+        size_t first = MIN2(size, r->ring_size - offset);
+
+        memcpy(q->ring.cpu + offset, data, first);
+        memcpy(q->ring.cpu, data + first, size - first);
+
+        r->k->mem_sync(r->k, q->ring.gpu + offset, q->ring.cpu + offset,
+                       first, false);
+        if (size > first)
+                r->k->mem_sync(r->k, q->ring.gpu, q->ring.cpu, size - first,
+                               false);
+
+        q->insert += size;
+}
+
+static bool
+replay_cs(struct replay *r, const struct pan_capture_record *rec)
+{
+        kbase k = r->k;
+        struct replay_queue *q = replay_queue(r, rec->flags);
+
+        if (!q)
+                return false;
+
+        /* The command stream lives in the captured ring BO */
+        struct replay_mem *src = replay_find_containing(r, rec->va, rec->size);
+
+        if (!src) {
+                fprintf(stderr, "Command stream at %"PRIx64" was not "
+                        "captured\n", rec->va);
+                return false;
+        }
+
+        size_t total = rec->size + REPLAY_TAIL_INSTRS * 8;
+
+        if (total > r->ring_size) {
+                fprintf(stderr, "Submission of %zu bytes does not fit the "
+                        "ring\n", total);
+                return false;
+        }
+
+        if (q->insert + total - q->waited > r->ring_size) {
+                if (!k->cs_wait(k, &q->cs, q->insert, q->syncobj,
+                                REPLAY_TIMEOUT_NS)) {
+                        fprintf(stderr, "GPU hang on queue %u\n", q->id);
+                        return false;
+                }
+
+                q->waited = q->insert;
+        }
+
+        uint64_t *ins = malloc(rec->size);
+        memcpy(ins, src->cpu + (rec->va - src->va), rec->size);
+        replay_relocate_cs(r, ins, rec->size / 8);
+        replay_ring_write(r, q, ins, rec->size);
+        free(ins);
+
+        /* Signal our own event slot, which the submission is waited on
+         * through, rather than the one of the captured queue */
+        ++q->seqnum;
+
+        uint64_t tail[REPLAY_TAIL_INSTRS] = { 0 };
+        pan_command_stream c = {
+                .ptr = tail,
+                .begin = tail,
+                .end = tail + REPLAY_TAIL_INSTRS,
+        };
+
+        pan_emit_cs_48(&c, REPLAY_REG_ADDR,
+                       kbase_event_va(k, q->cs.event_mem_offset));
+        pan_emit_cs_64(&c, REPLAY_REG_VALUE, q->seqnum + 1);
+        pan_pack_ins(&c, CS_EVSTR_64, cfg) {
+                cfg.unk_2 = (3 << 3);
+                cfg.value = REPLAY_REG_VALUE;
+                cfg.addr = REPLAY_REG_ADDR;
+        }
+
+        replay_ring_write(r, q, tail, sizeof(tail));
+
+        if (!k->cs_submit(k, &q->cs, q->insert, q->syncobj, q->seqnum)) {
+                fprintf(stderr, "Submission failed\n");
+                return false;
+        }
+
+        r->busy = true;
+        r->frame_submits++;
+        return true;
+}
+
+static void
+replay_fini(struct replay *r)
+{
+        kbase k = r->k;
+
+        replay_wait_idle(r);
+
+        for (unsigned i = 0; i < r->num_queues; ++i) {
+                struct replay_queue *q = &r->queues[i];
+
+                k->syncobj_destroy(k, q->syncobj);
+                k->cs_term(k, &q->cs);
+                munmap(q->ring.cpu, r->ring_size);
+                k->free(k, q->ring.gpu);
+        }
+
+        util_dynarray_foreach(&r->mem_list, struct replay_mem *, mem) {
+                if ((*mem)->cpu)
+                        replay_unmap(r, *mem);
+                free(*mem);
+        }
+
+        util_dynarray_fini(&r->mem_list);
+        _mesa_hash_table_u64_destroy(r->mems);
+
+        if (r->ctx)
+                k->context_destroy(k, r->ctx);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+        double x = *(const double *) a, y = *(const double *) b;
+        return (x > y) - (x < y);
+}
+
+static void
+print_help(const char *progname, FILE *file)
+{
+        fprintf(file,
+                "Usage: %s [OPTION] capture\n"
+                "Replay a Panfrost capture on kbase and time each frame.\n\n"
+                "    -h, --help             display this help and exit\n"
+                "    -r, --ring-size MB     size of the ring of each queue\n"
+                "    -s, --skip N           leave N frames out of the summary\n",
+                progname);
+}
+
+int
+main(int argc, char **argv)
+{
+        unsigned ring_mb = 16;
+        unsigned skip = 1;
+        int c;
+
+        const struct option longopts[] = {
+                { "ring-size", required_argument, NULL, 'r' },
+                { "skip", required_argument, NULL, 's' },
+                { "help", no_argument, NULL, 'h' },
+                { NULL, 0, NULL, 0 }
+        };
+
+        while ((c = getopt_long(argc, argv, "r:s:h", longopts, NULL)) != -1) {
+                switch (c) {
+                case 'h':
+                        print_help(argv[0], stdout);
+                        return EXIT_SUCCESS;
+                case 'r':
+                        ring_mb = atoi(optarg);
+                        break;
+                case 's':
+                        skip = atoi(optarg);
+                        break;
+                default:
+                        print_help(argv[0], stderr);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (optind >= argc || !ring_mb) {
+                print_help(argv[0], stderr);
+                return EXIT_FAILURE;
+        }
+
+        FILE *fp = fopen(argv[optind], "rb");
+        if (!fp) {
+                perror("failed to open capture");
+                return EXIT_FAILURE;
+        }
+
+        struct pan_capture_record rec;
+
+        if (fread(&rec, sizeof(rec), 1, fp) != 1 ||
+            rec.magic != PAN_CAPTURE_MAGIC ||
+            rec.type != PAN_CAPTURE_RECORD_HEADER ||
+            rec.size != PAN_CAPTURE_VERSION) {
+                fprintf(stderr, "Not a Panfrost capture of version %u\n",
+                        PAN_CAPTURE_VERSION);
+                return EXIT_FAILURE;
+        }
+
+        uint32_t gpu_id = rec.va;
+
+        int fd = open("/dev/mali0", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+        if (fd == -1) {
+                perror("open(\"/dev/mali0\")");
+                return EXIT_FAILURE;
+        }
+
+        struct kbase_ k;
+        if (!kbase_open(&k, fd, 4, false)) {
+                fprintf(stderr, "failed to open kbase device\n");
+                return EXIT_FAILURE;
+        }
+
+        if (!k.cs_submit) {
+                fprintf(stderr, "only CSF GPUs are supported\n");
+                k.close(&k);
+                return EXIT_FAILURE;
+        }
+
+        uint64_t prod_id = 0;
+        k.get_pan_gpuprop(&k, DRM_PANFROST_PARAM_GPU_PROD_ID, &prod_id);
+
+        if (prod_id != gpu_id) {
+                fprintf(stderr, "Warning: captured on GPU %"PRIx32", "
+                        "replaying on %"PRIx64"\n", gpu_id, prod_id);
+        }
+
+        struct replay r = {
+                .k = &k,
+                .ring_size = ring_mb << 20,
+                .mems = _mesa_hash_table_u64_create(NULL),
+        };
+
+        util_dynarray_init(&r.mem_list, NULL);
+
+        struct util_dynarray frame_times;
+        util_dynarray_init(&frame_times, NULL);
+
+        uint64_t frame_start = os_time_get_nano();
+        bool ok = true;
+
+        while (ok && fread(&rec, sizeof(rec), 1, fp) == 1) {
+                if (rec.magic != PAN_CAPTURE_MAGIC) {
+                        fprintf(stderr, "Corrupted record\n");
+                        ok = false;
+                        break;
+                }
+
+                uint64_t restore_start = os_time_get_nano();
+
+                switch (rec.type) {
+                case PAN_CAPTURE_RECORD_BO:
+                        ok = replay_bo(&r, fp, &rec);
+                        r.frame_restore_ns += os_time_get_nano() - restore_start;
+                        break;
+                case PAN_CAPTURE_RECORD_EVENT_MEM:
+                        ok = replay_event_mem(&r, fp, &rec);
+                        r.frame_restore_ns += os_time_get_nano() - restore_start;
+                        break;
+                case PAN_CAPTURE_RECORD_FREE: {
+                        struct replay_mem *mem =
+                                _mesa_hash_table_u64_search(r.mems, rec.va);
+                        if (mem)
+                                mem->freed = true;
+                        break;
+                }
+                case PAN_CAPTURE_RECORD_TILER_HEAP:
+                        ok = replay_tiler_heap(&r, fp, &rec);
+                        break;
+                case PAN_CAPTURE_RECORD_CS:
+                        ok = replay_cs(&r, &rec);
+                        break;
+                case PAN_CAPTURE_RECORD_JC:
+                        fprintf(stderr, "Job manager captures can't be "
+                                "replayed\n");
+                        ok = false;
+                        break;
+                case PAN_CAPTURE_RECORD_FRAME: {
+                        ok = replay_wait_idle(&r);
+
+                        uint64_t now = os_time_get_nano();
+                        double ms = (now - frame_start) / 1e6;
+                        unsigned frame = util_dynarray_num_elements(&frame_times, double);
+
+                        printf("frame %u: %.3f ms, %u submissions, "
+                               "%.3f ms restoring memory%s\n",
+                               frame, ms, r.frame_submits,
+                               r.frame_restore_ns / 1e6, ok ? "" : " (FAILED)");
+
+                        util_dynarray_append(&frame_times, double, ms);
+                        r.frame_submits = 0;
+                        r.frame_restore_ns = 0;
+                        frame_start = now;
+                        break;
+                }
+                default:
+                        /* Skip record types from newer versions */
+                        ok = !fseek(fp, rec.data_size, SEEK_CUR);
+                        break;
+                }
+        }
+
+        unsigned frames = util_dynarray_num_elements(&frame_times, double);
+
+        if (frames > skip) {
+                double *times = util_dynarray_element(&frame_times, double, skip);
+                unsigned count = frames - skip;
+                double sum = 0;
+
+                qsort(times, count, sizeof(double), cmp_double);
+
+                for (unsigned i = 0; i < count; ++i)
+                        sum += times[i];
+
+                printf("%u frames: min %.3f ms, median %.3f ms, "
+                       "mean %.3f ms, max %.3f ms\n",
+                       count, times[0], times[count / 2], sum / count,
+                       times[count - 1]);
+        }
+
+        replay_fini(&r);
+        util_dynarray_fini(&frame_times);
+        fclose(fp);
+        k.close(&k);
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures CSF submission throughput against the number of submitting
+ * threads. Each thread has its own context, queue and syncobj, like separate
+ * GL contexts in one process would. The submitted command streams only
+ * contain NOPs, so this mostly measures the userspace bookkeeping and
+ * locking in cs_submit and the cost of the kick ioctl.
+ *
+ *    panfrost_submit_bench [max threads] [submits per thread]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util/macros.h"
+#include "util/u_debug.h"
+
+#include "pan_base.h"
+
+/* Size of a single submission: eight NOP instructions */
+#define SUBMIT_SIZE 64
+
+struct bench_thread {
+        pthread_t thread;
+        kbase k;
+        unsigned submits;
+        bool ok;
+};
+
+static pthread_barrier_t start_barrier;
+
+static void *
+bench_thread(void *data)
+{
+        struct bench_thread *t = data;
+        kbase k = t->k;
+
+        struct kbase_context *ctx = k->context_create(k, 0);
+        if (!ctx) {
+                pthread_barrier_wait(&start_barrier);
+                return NULL;
+        }
+
+        /* Make the ring big enough that it never wraps, so there is no need
+         * to wait for the GPU to catch up */
+        unsigned size = ALIGN_POT((t->submits + 1) * SUBMIT_SIZE,
+                                  k->page_size);
+
+        struct base_ptr ring = k->alloc(k, size, 0, 0);
+        if (!ring.cpu) {
+                k->context_destroy(k, ctx);
+                pthread_barrier_wait(&start_barrier);
+                return NULL;
+        }
+
+        /* A zeroed command stream is all NOPs */
+        memset(ring.cpu, 0, size);
+        k->mem_sync(k, ring.gpu, ring.cpu, size, false);
+
+        struct kbase_cs cs = k->cs_bind(k, ctx, ring.gpu, size, 1);
+        struct kbase_syncobj *o = k->syncobj_create(k);
+
+        pthread_barrier_wait(&start_barrier);
+
+        t->ok = true;
+
+        for (unsigned i = 0; i < t->submits; ++i) {
+                if (!k->cs_submit(k, &cs, (i + 1) * SUBMIT_SIZE, o, i + 1)) {
+                        t->ok = false;
+                        break;
+                }
+        }
+
+        k->syncobj_destroy(k, o);
+        k->cs_term(k, &cs);
+        k->context_destroy(k, ctx);
+        munmap(ring.cpu, size);
+        k->free(k, ring.gpu);
+
+        return NULL;
+}
+
+static double
+time_diff(struct timespec a, struct timespec b)
+{
+        return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static bool
+run(kbase k, unsigned thread_count, unsigned submits)
+{
+        struct bench_thread *threads = calloc(thread_count, sizeof(*threads));
+        struct timespec start, end;
+
+        pthread_barrier_init(&start_barrier, NULL, thread_count + 1);
+
+        for (unsigned i = 0; i < thread_count; ++i) {
+                threads[i] = (struct bench_thread) {
+                        .k = k,
+                        .submits = submits,
+                };
+
+                pthread_create(&threads[i].thread, NULL, bench_thread,
+                               &threads[i]);
+        }
+
+        pthread_barrier_wait(&start_barrier);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        bool ok = true;
+        for (unsigned i = 0; i < thread_count; ++i) {
+                pthread_join(threads[i].thread, NULL);
+                ok &= threads[i].ok;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        pthread_barrier_destroy(&start_barrier);
+
+        double elapsed = time_diff(start, end);
+        uint64_t total = (uint64_t) thread_count * submits;
+
+        printf("%2u threads: %9"PRIu64" submits in %7.3f s, "
+               "%10.0f submits/s, %7.3f us/submit/thread%s\n",
+               thread_count, total, elapsed, total / elapsed,
+               elapsed * 1e6 / submits, ok ? "" : " (FAILED)");
+
+        free(threads);
+        return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+        unsigned max_threads = argc > 1 ? atoi(argv[1]) : 8;
+        unsigned submits = argc > 2 ? atoi(argv[2]) : 10000;
+
+        /* The fake GPU of PAN_KBASE_NOOP does not need a device */
+        bool noop = debug_get_bool_option("PAN_KBASE_NOOP", false);
+        int fd = noop ? -1 :
+                open("/dev/mali0", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+
+        if (fd == -1 && !noop) {
+                perror("open(\"/dev/mali0\")");
+                return 1;
+        }
+
+        struct kbase_ k;
+        if (!kbase_open(&k, fd, 4, false)) {
+                fprintf(stderr, "failed to open kbase device\n");
+                return 1;
+        }
+
+        if (!k.cs_submit) {
+                fprintf(stderr, "only CSF GPUs are supported\n");
+                k.close(&k);
+                return 1;
+        }
+
+        bool ok = true;
+        for (unsigned t = 1; t <= max_threads; t *= 2)
+                ok &= run(&k, t, submits);
+
+        k.close(&k);
+        return ok ? 0 : 1;
+}
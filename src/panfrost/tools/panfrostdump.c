@@ -51,6 +51,7 @@
 #include <drm-uapi/panfrost_drm.h>
 
 #include "decode.h"
+#include "pan_capture.h"
 
 /* Same as panfrost_dump_object_header, but with field
  * entries in host byte order
@@ -199,7 +200,8 @@ print_help(const char *progname, FILE *file)
 {
    fprintf(file,
            "Usage: %s [OPTION] inputfile\n"
-           "Decode Panfrost coredump file.\n\n"
+           "Decode Panfrost coredump file, or a dump written with\n"
+           "PAN_MESA_DEBUG=faultdump.\n\n"
            "    -h, --help             display this help and exit\n"
            "    -a, --addr             print BO physical addresses\n"
            "    -r, --regs             print Panfrost HW registers\n"
@@ -249,6 +251,10 @@ main(int argc, char *argv[])
       }
    }
 
+   /* Fault dumps written by the driver itself */
+   if (pan_capture_probe(argv[optind]))
+      return pan_capture_decode(argv[optind], false) ? EXIT_SUCCESS : EXIT_FAILURE;
+
    i = j = k = 0;
 
    atexit(cleanup);
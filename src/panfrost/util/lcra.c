@@ -31,6 +31,7 @@
 #include <limits.h>
 #include "util/macros.h"
 #include "util/u_math.h"
+#include "util/bitset.h"
 #include "lcra.h"
 
 /* This module is the reference implementation of "Linearly Constrained
@@ -155,9 +156,41 @@ lcra_test_linear(struct lcra_state *l, unsigned *solutions, unsigned i)
         return true;
 }
 
+/* Mark the solutions in [base, base + size) that the constraints of node i
+ * forbid given the solutions so far. Bit b of the constraint with node j forbids
+ * solutions[j] + 15 - b, so each row is walked once per node rather than once
+ * per candidate. */
+static void
+lcra_forbidden(struct lcra_state *l, unsigned i, unsigned base, unsigned size,
+               BITSET_WORD *forbidden)
+{
+        unsigned *row = &l->linear[i * l->node_count];
+
+        memset(forbidden, 0, BITSET_WORDS(size) * sizeof(BITSET_WORD));
+
+        for (unsigned j = 0; j < l->node_count; ++j) {
+                if (!row[j] || l->solutions[j] == ~0) continue;
+
+                u_foreach_bit(b, row[j]) {
+                        signed c = (signed) l->solutions[j] + 15 - b;
+
+                        if (c >= (signed) base && c < (signed) (base + size))
+                                BITSET_SET(forbidden, c - base);
+                }
+        }
+}
+
 bool
 lcra_solve(struct lcra_state *l)
 {
+        unsigned max_size = 0;
+
+        for (unsigned c = 0; c < l->class_count; ++c)
+                max_size = MAX2(max_size, l->class_size[c]);
+
+        BITSET_WORD *forbidden = calloc(BITSET_WORDS(max_size),
+                                        sizeof(BITSET_WORD));
+
         for (unsigned step = 0; step < l->node_count; ++step) {
                 if (l->solutions[step] != ~0) continue;
                 if (l->alignment[step] == 0) continue;
@@ -176,10 +209,17 @@ lcra_solve(struct lcra_state *l)
                 unsigned m_max = k_max / P;
                 bool succ = false;
 
+                lcra_forbidden(l, step, class_start, r_max, forbidden);
+
                 for (unsigned m = 0; m < m_max; ++m) {
                         for (unsigned n = 0; n < Q; ++n) {
-                                l->solutions[step] = ((m * P + n) << shift) + class_start;
-                                succ = lcra_test_linear(l, l->solutions, step);
+                                unsigned offset = (m * P + n) << shift;
+                                l->solutions[step] = offset + class_start;
+
+                                if (offset < r_max)
+                                        succ = !BITSET_TEST(forbidden, offset);
+                                else
+                                        succ = lcra_test_linear(l, l->solutions, step);
 
                                 if (succ) break;
                         }
@@ -190,10 +230,12 @@ lcra_solve(struct lcra_state *l)
                 /* Out of registers - prepare to spill */
                 if (!succ) {
                         l->spill_class = l->class[step];
+                        free(forbidden);
                         return false;
                 }
         }
 
+        free(forbidden);
         return true;
 }
 
@@ -130,6 +130,77 @@ pan_print_alu_type(nir_alu_type t, FILE *fp)
         fprintf(fp, "%u", size);
 }
 
+/* Combine the statistics of shaders executing together, like the two halves
+ * of an IDVS vertex shader */
+
+void
+pan_shader_stats_merge(struct pan_shader_stats *dst,
+                       const struct pan_shader_stats *src)
+{
+        dst->instrs += src->instrs;
+        dst->position_instrs += src->position_instrs;
+        dst->varying_instrs += src->varying_instrs;
+        dst->bundles += src->bundles;
+        dst->code_size += src->code_size;
+        dst->cycles += src->cycles;
+        dst->cycles_arith += src->cycles_arith;
+        dst->cycles_texture += src->cycles_texture;
+        dst->cycles_varying += src->cycles_varying;
+        dst->cycles_ldst += src->cycles_ldst;
+        dst->work_regs = MAX2(dst->work_regs, src->work_regs);
+        dst->threads = dst->threads ? MIN2(dst->threads, src->threads) :
+                       src->threads;
+        dst->loops = MAX2(dst->loops, src->loops);
+        dst->spills += src->spills;
+        dst->fills += src->fills;
+}
+
+/* Print str as a JSON string, with quotes */
+
+void
+pan_print_json_string(FILE *fp, const char *str)
+{
+        fputc('"', fp);
+
+        for (const char *c = str; *c; ++c) {
+                if (*c == '"' || *c == '\\')
+                        fprintf(fp, "\\%c", *c);
+                else if ((unsigned char) *c < 0x20)
+                        fprintf(fp, "\\u%04x", *c);
+                else
+                        fputc(*c, fp);
+        }
+
+        fputc('"', fp);
+}
+
+/* Print the statistics of a shader as a single line of JSON, for shader-db
+ * style tooling to consume. The keys are stable. */
+
+void
+pan_shader_stats_print_json(FILE *fp, const char *name,
+                            const struct pan_shader_info *info)
+{
+        const struct pan_shader_stats *stats = &info->stats;
+
+        fprintf(fp, "{\"name\": ");
+        pan_print_json_string(fp, name);
+        fprintf(fp, ", \"stage\": \"%s\", \"instrs\": %u, \"bundles\": %u, "
+                "\"code_size\": %u, \"cycles\": %f, \"cycles_arith\": %f, "
+                "\"cycles_texture\": %f, \"cycles_varying\": %f, "
+                "\"cycles_ldst\": %f, \"work_regs\": %u, \"threads\": %u, "
+                "\"loops\": %u, \"spills\": %u, \"fills\": %u, "
+                "\"tls_size\": %u, \"position_instrs\": %u, "
+                "\"varying_instrs\": %u}\n",
+                gl_shader_stage_name(info->stage), stats->instrs,
+                stats->bundles, stats->code_size, stats->cycles,
+                stats->cycles_arith, stats->cycles_texture,
+                stats->cycles_varying, stats->cycles_ldst, stats->work_regs,
+                stats->threads, stats->loops, stats->spills, stats->fills,
+                info->tls_size, stats->position_instrs,
+                stats->varying_instrs);
+}
+
 /* Could optimize with a better data structure if anyone cares, TODO: profile */
 
 unsigned
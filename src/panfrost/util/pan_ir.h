@@ -109,6 +109,7 @@ enum {
         PAN_SYSVAL_BLEND_CONSTANTS = 16,
         PAN_SYSVAL_XFB = 17,
         PAN_SYSVAL_NUM_VERTICES = 18,
+        PAN_SYSVAL_XFB_INDICES = 19,
 };
 
 #define PAN_TXS_SYSVAL_ID(texidx, dim, is_array)          \
@@ -206,6 +207,14 @@ struct panfrost_compile_inputs {
          */
         uint32_t fixed_varying_mask;
 
+        /* Used on Valhall.
+         *
+         * Bit mask of general varyings (bit 0 is VARYING_SLOT_VAR0) that the
+         * vertex shader writes as fp16, taking 8 bytes rather than 16 in the
+         * varying buffer. Set on both stages of a linked pipeline.
+         */
+        uint32_t fp16_varying_mask;
+
         union {
                 struct {
                         bool static_rt_conv;
@@ -271,6 +280,37 @@ struct midgard_shader_info {
         unsigned first_tag;
 };
 
+/* Statistics about a compiled shader, in a form common to all compilers so
+ * they can be compared across architectures and exported for regression
+ * tracking. Cycle counts are normalized estimates from the compiler's static
+ * model, or zero if the compiler has no model. */
+
+struct pan_shader_stats {
+        unsigned instrs;
+
+        /* Instructions of the position and varying shaders of an IDVS
+         * vertex shader, included in instrs */
+        unsigned position_instrs, varying_instrs;
+
+        /* Midgard bundles or Bifrost clauses, zero on Valhall */
+        unsigned bundles;
+
+        /* Bytes of machine code */
+        unsigned code_size;
+
+        float cycles;
+        float cycles_arith;
+        float cycles_texture;
+        float cycles_varying;
+        float cycles_ldst;
+
+        unsigned work_regs;
+        unsigned threads;
+        unsigned loops;
+        unsigned spills;
+        unsigned fills;
+};
+
 struct pan_shader_info {
         gl_shader_stage stage;
         unsigned work_reg_count;
@@ -381,6 +421,13 @@ struct pan_shader_info {
 
         uint32_t ubo_mask;
 
+        /* Set if every sysval read was promoted to a push constant, so the
+         * sysval UBO itself is never read by the shader (Bifrost+) */
+        bool sysvals_pushed;
+
+        /* For IDVS, the position and varying shaders combined */
+        struct pan_shader_stats stats;
+
         union {
                 struct bifrost_shader_info bifrost;
                 struct midgard_shader_info midgard;
@@ -493,6 +540,14 @@ pan_dest_index(nir_dest *dst)
 /* IR printing helpers */
 void pan_print_alu_type(nir_alu_type t, FILE *fp);
 
+void pan_shader_stats_merge(struct pan_shader_stats *dst,
+                            const struct pan_shader_stats *src);
+
+void pan_print_json_string(FILE *fp, const char *str);
+
+void pan_shader_stats_print_json(FILE *fp, const char *name,
+                                 const struct pan_shader_info *info);
+
 /* Until it can be upstreamed.. */
 bool pan_has_source_mod(nir_alu_src *src, nir_op op);
 bool pan_has_dest_mod(nir_dest **dest, nir_op op);
@@ -511,7 +566,7 @@ bool pan_nir_lower_64bit_intrin(nir_shader *shader);
 
 bool pan_lower_helper_invocation(nir_shader *shader);
 bool pan_lower_sample_pos(nir_shader *shader);
-bool pan_lower_xfb(nir_shader *nir);
+bool pan_lower_xfb(nir_shader *nir, bool fetch_indices);
 
 void pan_nir_collect_varyings(nir_shader *s, struct pan_shader_info *info);
 
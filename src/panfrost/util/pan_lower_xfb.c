@@ -91,9 +91,101 @@ lower_xfb(nir_builder *b, nir_instr *instr, UNUSED void *data)
         return progress;
 }
 
+static bool
+lower_xfb_vertex(nir_builder *b, nir_instr *instr, void *data)
+{
+        nir_ssa_def **vertex = data;
+
+        if (instr->type != nir_instr_type_intrinsic)
+                return false;
+
+        nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+        b->cursor = nir_before_instr(instr);
+
+        if (intr->intrinsic == nir_intrinsic_load_vertex_id) {
+                nir_ssa_def_rewrite_uses(&intr->dest.ssa, vertex[0]);
+        } else if (intr->intrinsic == nir_intrinsic_load_input) {
+                nir_ssa_def *attr =
+                        nir_load_attribute_pan(b, intr->num_components,
+                                               nir_dest_bit_size(intr->dest),
+                                               vertex[1],
+                                               nir_load_instance_id(b),
+                                               intr->src[0].ssa,
+                                               .base = nir_intrinsic_base(intr),
+                                               .component = nir_intrinsic_component(intr),
+                                               .dest_type = nir_intrinsic_dest_type(intr),
+                                               .io_semantics = nir_intrinsic_io_semantics(intr));
+
+                nir_ssa_def_rewrite_uses(&intr->dest.ssa, attr);
+        } else {
+                return false;
+        }
+
+        nir_instr_remove(instr);
+        return true;
+}
+
+/* Indexed draws are not unrolled for transform feedback. Instead, each
+ * invocation fetches the index at its position in the draw, and loads the
+ * attributes of that vertex. Outputs are still written at the position in the
+ * draw. Non-indexed draws skip the fetch with a uniform branch. */
+static void
+lower_xfb_indices(nir_shader *nir)
+{
+        nir_function_impl *impl = nir_shader_get_entrypoint(nir);
+        nir_builder b;
+
+        nir_builder_init(&b, impl);
+        b.cursor = nir_before_cf_list(&impl->body);
+
+        nir_ssa_def *params = nir_load_xfb_indices_pan(&b);
+        nir_ssa_def *size = nir_channel(&b, params, 2);
+        nir_ssa_def *position = nir_load_vertex_id_zero_base(&b);
+        nir_ssa_def *first = nir_load_first_vertex(&b);
+
+        nir_push_if(&b, nir_ine_imm(&b, size, 0));
+        nir_ssa_def *addr =
+                nir_iadd(&b, nir_pack_64_2x32(&b, nir_channels(&b, params, 0x3)),
+                         nir_u2u64(&b, nir_imul(&b, position, size)));
+
+        /* Load the word containing 8 or 16-bit indices, and shift them out */
+        nir_ssa_def *word =
+                nir_load_global(&b, nir_iand_imm(&b, addr, ~3ull), 4, 1, 32);
+        nir_ssa_def *shift =
+                nir_ishl_imm(&b, nir_u2u32(&b, nir_iand_imm(&b, addr, 3)), 3);
+        nir_ssa_def *mask =
+                nir_ushr(&b, nir_imm_int(&b, ~0),
+                         nir_isub(&b, nir_imm_int(&b, 32),
+                                  nir_ishl_imm(&b, size, 3)));
+        nir_ssa_def *index = nir_iand(&b, nir_ushr(&b, word, shift), mask);
+        nir_ssa_def *indexed = nir_iadd(&b, index, nir_channel(&b, params, 3));
+        nir_push_else(&b, NULL);
+        nir_ssa_def *linear = nir_iadd(&b, position, first);
+        nir_pop_if(&b, NULL);
+
+        nir_ssa_def *vertex[2];
+        vertex[0] = nir_if_phi(&b, indexed, linear);
+        vertex[1] = nir_isub(&b, vertex[0], first);
+
+        BITSET_SET(nir->info.system_values_read, SYSTEM_VALUE_VERTEX_ID_ZERO_BASE);
+        BITSET_SET(nir->info.system_values_read, SYSTEM_VALUE_FIRST_VERTEX);
+        BITSET_SET(nir->info.system_values_read, SYSTEM_VALUE_INSTANCE_ID);
+
+        nir_metadata_preserve(impl, nir_metadata_none);
+
+        /* The fetch above only uses the zero-based vertex ID, so it is left
+         * alone when rewriting the vertex ID and attribute loads */
+        nir_shader_instructions_pass(nir, lower_xfb_vertex,
+                                     nir_metadata_block_index |
+                                     nir_metadata_dominance, vertex);
+}
+
 bool
-pan_lower_xfb(nir_shader *nir)
+pan_lower_xfb(nir_shader *nir, bool fetch_indices)
 {
+        if (fetch_indices)
+                lower_xfb_indices(nir);
+
         return nir_shader_instructions_pass(nir, lower_xfb,
                                             nir_metadata_block_index |
                                             nir_metadata_dominance, NULL);
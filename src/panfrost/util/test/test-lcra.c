@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "panfrost/util/lcra.h"
+
+/* lcra_solve used to test one candidate at a time, walking the whole row of
+ * constraints of the node for each. Check that testing candidates against
+ * the forbidden set built once per node gives the same results on random
+ * constraints. */
+
+static uint32_t rng_state;
+
+static uint32_t
+rng(void)
+{
+   /* xorshift32, so that the cases are the same everywhere */
+   rng_state ^= rng_state << 13;
+   rng_state ^= rng_state >> 17;
+   rng_state ^= rng_state << 5;
+   return rng_state;
+}
+
+static bool
+ref_test_linear(struct lcra_state *l, const unsigned *solutions, unsigned i)
+{
+   uint32_t *row = &l->linear[i * l->node_count];
+   signed constant = solutions[i];
+
+   for (unsigned j = 0; j < l->node_count; ++j) {
+      if (solutions[j] == ~0) continue;
+
+      signed lhs = (signed) solutions[j] - constant;
+
+      if (lhs < -15 || lhs > 15)
+         continue;
+
+      if (row[j] & (1 << (lhs + 15)))
+         return false;
+   }
+
+   return true;
+}
+
+/* Returns the class that failed, or -1 */
+static signed
+ref_solve(struct lcra_state *l, unsigned *solutions)
+{
+   for (unsigned step = 0; step < l->node_count; ++step) {
+      if (solutions[step] != ~0) continue;
+      if (l->alignment[step] == 0) continue;
+
+      unsigned _class = l->class[step];
+      unsigned class_start = l->class_start[_class];
+
+      unsigned BA = l->alignment[step];
+      unsigned shift = (BA & 0xffff) - 1;
+      unsigned bound = BA >> 16;
+
+      unsigned P = bound >> shift;
+      unsigned Q = l->modulus[step];
+      unsigned r_max = l->class_size[_class];
+      unsigned k_max = r_max >> shift;
+      unsigned m_max = k_max / P;
+      bool succ = false;
+
+      for (unsigned m = 0; m < m_max; ++m) {
+         for (unsigned n = 0; n < Q; ++n) {
+            solutions[step] = ((m * P + n) << shift) + class_start;
+            succ = ref_test_linear(l, solutions, step);
+
+            if (succ) break;
+         }
+
+         if (succ) break;
+      }
+
+      if (!succ)
+         return _class;
+   }
+
+   return -1;
+}
+
+/* Random constraints between node_count nodes in the register classes used
+ * by Midgard, averaging density per node. Some nodes are forced to a
+ * register, as r1 is. */
+static struct lcra_state *
+random_equations(unsigned node_count, unsigned density)
+{
+   struct lcra_state *l = lcra_alloc_equations(node_count, 4);
+
+   l->class_start[0] = 0;
+   l->class_start[1] = 16 * 26;
+   l->class_start[2] = 16 * 28;
+   l->class_start[3] = (rng() & 1) ? 0 : 16 * 28;
+
+   l->class_size[0] = 16 * (4 + rng() % 13);
+   l->class_size[1] = 16 * 2;
+   l->class_size[2] = 16 * 2;
+   l->class_size[3] = 16 * 2;
+
+   lcra_set_disjoint_class(l, 2, 3);
+
+   for (unsigned i = 0; i < node_count; ++i) {
+      /* A few nodes are unused */
+      if (rng() % 16 == 0)
+         continue;
+
+      l->class[i] = (rng() % 4) ? 0 : 1 + rng() % 3;
+
+      /* 2 to 16 byte alignment, 8 byte bounds only for 16-bit values */
+      unsigned align = 1 + rng() % 4;
+      unsigned bound = (align == 1 && (rng() & 1)) ? 8 : 16;
+
+      lcra_set_alignment(l, i, align, bound);
+      lcra_restrict_range(l, i, 1 + rng() % bound);
+
+      if (rng() % 16 == 0) {
+         unsigned c = l->class[i];
+         unsigned offset = (rng() % l->class_size[c]) & ~((1 << align) - 1);
+
+         l->solutions[i] = l->class_start[c] + offset;
+      }
+   }
+
+   for (unsigned n = 0; n < node_count * density; ++n) {
+      unsigned i = rng() % node_count;
+      unsigned j = rng() % node_count;
+
+      lcra_add_node_interference(l, i, (rng() & 0xffff) | 1,
+                                 j, (rng() & 0xffff) | 1);
+   }
+
+   return l;
+}
+
+int
+main(int argc, const char **argv)
+{
+   unsigned nr_pass = 0, nr_fail = 0, nr_solved = 0;
+
+   rng_state = 1;
+
+   for (unsigned iter = 0; iter < 1000; ++iter) {
+      unsigned node_count = 1 + rng() % 96;
+      struct lcra_state *l = random_equations(node_count, rng() % 6);
+
+      unsigned *ref = malloc(node_count * sizeof(unsigned));
+      memcpy(ref, l->solutions, node_count * sizeof(unsigned));
+
+      signed ref_spill = ref_solve(l, ref);
+      bool success = lcra_solve(l);
+      bool match = (success == (ref_spill < 0));
+
+      if (match && !success)
+         match = (l->spill_class == ref_spill);
+
+      for (unsigned i = 0; i < node_count; ++i)
+         match &= (l->solutions[i] == ref[i]);
+
+      if (match) {
+         nr_pass++;
+      } else {
+         nr_fail++;
+         fprintf(stderr, "Case %u: solutions differ from the reference\n",
+                 iter);
+      }
+
+      nr_solved += success;
+
+      free(ref);
+      lcra_free(l);
+   }
+
+   /* Make sure both outcomes are covered */
+   if (nr_solved < 100 || nr_solved > 900) {
+      fprintf(stderr, "%u of the cases were solved, expected a mix\n",
+              nr_solved);
+      nr_fail++;
+   }
+
+   printf("Passed %u/%u\n", nr_pass, nr_pass + nr_fail);
+   return nr_fail ? 1 : 0;
+}
@@ -108,6 +108,33 @@ panvk_set_dyn_ssbo_pointers(struct panvk_descriptor_state *desc_state,
    desc_state->sysvals_ptr = 0;
 }
 
+/* Drops the descriptor tables built from the previously bound sets, for
+ * them to be rebuilt with a new set of this layout on the next draw or
+ * dispatch.
+ */
+void
+panvk_cmd_invalidate_descriptors(struct panvk_descriptor_state *desc_state,
+                                 const struct panvk_descriptor_set_layout *layout)
+{
+   if (layout->num_dyn_ssbos)
+      desc_state->dirty |= PANVK_DYNAMIC_SSBO;
+
+   if (layout->num_ubos || layout->num_dyn_ubos ||
+       layout->num_dyn_ssbos || layout->desc_ubo_size)
+      desc_state->ubos = 0;
+
+   if (layout->num_textures)
+      desc_state->textures = 0;
+
+   if (layout->num_samplers)
+      desc_state->samplers = 0;
+
+   if (layout->num_imgs) {
+      desc_state->vs_attrib_bufs = desc_state->non_vs_attrib_bufs = 0;
+      desc_state->vs_attribs = desc_state->non_vs_attribs = 0;
+   }
+}
+
 void
 panvk_CmdBindDescriptorSets(VkCommandBuffer commandBuffer,
                             VkPipelineBindPoint pipelineBindPoint,
@@ -160,23 +187,7 @@ panvk_CmdBindDescriptorSets(VkCommandBuffer commandBuffer,
                                      set);
       }
 
-      if (set->layout->num_dyn_ssbos)
-         descriptors_state->dirty |= PANVK_DYNAMIC_SSBO;
-
-      if (set->layout->num_ubos || set->layout->num_dyn_ubos ||
-          set->layout->num_dyn_ssbos || set->layout->desc_ubo_size)
-         descriptors_state->ubos = 0;
-
-      if (set->layout->num_textures)
-         descriptors_state->textures = 0;
-
-      if (set->layout->num_samplers)
-         descriptors_state->samplers = 0;
-
-      if (set->layout->num_imgs) {
-         descriptors_state->vs_attrib_bufs = descriptors_state->non_vs_attrib_bufs = 0;
-         descriptors_state->vs_attribs = descriptors_state->non_vs_attribs = 0;
-      }
+      panvk_cmd_invalidate_descriptors(descriptors_state, set->layout);
    }
 
    assert(dynoffset_idx == dynamicOffsetCount);
@@ -437,6 +448,8 @@ panvk_cmd_fb_info_set_subpass(struct panvk_cmd_buffer *cmdbuf)
    fbinfo->rt_count = subpass->color_count;
    memset(&fbinfo->bifrost.pre_post.dcds, 0, sizeof(fbinfo->bifrost.pre_post.dcds));
 
+   fbinfo->zs.discard.z = fbinfo->zs.discard.s = false;
+
    for (unsigned cb = 0; cb < subpass->color_count; cb++) {
       int idx = subpass->color_attachments[cb].idx;
       view = idx != VK_ATTACHMENT_UNUSED ?
@@ -446,6 +459,7 @@ panvk_cmd_fb_info_set_subpass(struct panvk_cmd_buffer *cmdbuf)
       fbinfo->rts[cb].view = &view->pview;
       fbinfo->rts[cb].clear = subpass->color_attachments[cb].clear;
       fbinfo->rts[cb].preload = subpass->color_attachments[cb].preload;
+      fbinfo->rts[cb].discard = false;
       fbinfo->rts[cb].crc_valid = &cmdbuf->state.fb.crc_valid[cb];
 
       memcpy(fbinfo->rts[cb].clear_value, clears[idx].color,
@@ -477,6 +491,54 @@ panvk_cmd_fb_info_set_subpass(struct panvk_cmd_buffer *cmdbuf)
    }
 }
 
+static bool
+panvk_attachment_discarded(const struct panvk_cmd_buffer *cmdbuf,
+                           uint32_t idx, bool stencil)
+{
+   const struct panvk_render_pass *pass = cmdbuf->state.pass;
+   const struct panvk_render_pass_attachment *att = &pass->attachments[idx];
+   unsigned subpass_idx = cmdbuf->state.subpass - pass->subpasses;
+   VkAttachmentStoreOp op = stencil ? att->stencil_store_op : att->store_op;
+
+   return subpass_idx == att->last_used_in_subpass &&
+          op != VK_ATTACHMENT_STORE_OP_STORE;
+}
+
+/* Each subpass is a batch of its own, so attachments are written back at the
+ * end of every subpass using them, except the last one if their store op
+ * doesn't store them. Batches split within a subpass must write everything
+ * back, so this is only called before closing the last batch of a subpass.
+ */
+void
+panvk_cmd_fb_info_set_discards(struct panvk_cmd_buffer *cmdbuf)
+{
+   const struct panvk_subpass *subpass = cmdbuf->state.subpass;
+   struct pan_fb_info *fbinfo = &cmdbuf->state.fb.info;
+
+   for (unsigned cb = 0; cb < subpass->color_count; cb++) {
+      uint32_t idx = subpass->color_attachments[cb].idx;
+
+      if (idx != VK_ATTACHMENT_UNUSED && fbinfo->rts[cb].view)
+         fbinfo->rts[cb].discard = panvk_attachment_discarded(cmdbuf, idx, false);
+   }
+
+   uint32_t idx = subpass->zs_attachment.idx;
+
+   if (idx == VK_ATTACHMENT_UNUSED)
+      return;
+
+   bool discard_z = panvk_attachment_discarded(cmdbuf, idx, false);
+   bool discard_s = panvk_attachment_discarded(cmdbuf, idx, true);
+
+   /* Both aspects of a combined depth/stencil view are written together */
+   if (fbinfo->zs.view.zs &&
+       util_format_is_depth_and_stencil(fbinfo->zs.view.zs->format))
+      discard_z = discard_s = discard_z && discard_s;
+
+   fbinfo->zs.discard.z = discard_z;
+   fbinfo->zs.discard.s = discard_s;
+}
+
 void
 panvk_cmd_fb_info_init(struct panvk_cmd_buffer *cmdbuf)
 {
@@ -502,6 +564,10 @@ panvk_CmdBeginRenderPass2(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_render_pass, pass, pRenderPassBegin->renderPass);
    VK_FROM_HANDLE(panvk_framebuffer, fb, pRenderPassBegin->framebuffer);
 
+   /* Transfers recorded outside render passes leave their batch open */
+   panvk_arch_dispatch(cmdbuf->device->physical_device->pdev.arch,
+                       cmd_close_batch, cmdbuf);
+
    cmdbuf->state.pass = pass;
    cmdbuf->state.subpass = pass->subpasses;
    cmdbuf->state.framebuffer = fb;
@@ -521,6 +587,169 @@ panvk_CmdBeginRenderPass2(VkCommandBuffer commandBuffer,
    panvk_cmd_fb_info_set_subpass(cmdbuf);
 }
 
+static void
+panvk_rendering_attachment_init(struct panvk_render_pass_attachment *att,
+                                struct panvk_subpass_attachment *subpass_att,
+                                struct panvk_attachment_info *fb_att,
+                                const VkRenderingAttachmentInfo *info,
+                                uint32_t idx, bool resuming,
+                                bool suspending)
+{
+   VK_FROM_HANDLE(panvk_image_view, iview, info->imageView);
+
+   att->format = iview->pview.format;
+   att->samples = iview->vk.image->samples;
+   att->load_op = resuming ? VK_ATTACHMENT_LOAD_OP_LOAD : info->loadOp;
+   att->stencil_load_op = att->load_op;
+   att->store_op = suspending ? VK_ATTACHMENT_STORE_OP_STORE : info->storeOp;
+   att->stencil_store_op = att->store_op;
+   att->initial_layout = info->imageLayout;
+   att->final_layout = info->imageLayout;
+   att->first_used_in_subpass = 0;
+   att->last_used_in_subpass = 0;
+
+   *subpass_att = (struct panvk_subpass_attachment) {
+      .idx = idx,
+      .layout = info->imageLayout,
+      .clear = att->load_op == VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .preload = att->load_op == VK_ATTACHMENT_LOAD_OP_LOAD,
+   };
+
+   fb_att->iview = iview;
+}
+
+/* Dynamic rendering is implemented with a render pass of a single subpass and
+ * a framebuffer built from the VkRenderingInfo, so the rest of the driver
+ * doesn't have to tell the two apart. Resolve attachments are ignored, like
+ * those of render passes. */
+void
+panvk_CmdBeginRendering(VkCommandBuffer commandBuffer,
+                        const VkRenderingInfo *pRenderingInfo)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   const VkRenderingAttachmentInfo *zs_info =
+      pRenderingInfo->pDepthAttachment &&
+      pRenderingInfo->pDepthAttachment->imageView != VK_NULL_HANDLE ?
+      pRenderingInfo->pDepthAttachment : pRenderingInfo->pStencilAttachment;
+   bool resuming = pRenderingInfo->flags & VK_RENDERING_RESUMING_BIT;
+   bool suspending = pRenderingInfo->flags & VK_RENDERING_SUSPENDING_BIT;
+   uint32_t color_count = pRenderingInfo->colorAttachmentCount;
+   uint32_t att_count = 0;
+
+   if (zs_info && zs_info->imageView == VK_NULL_HANDLE)
+      zs_info = NULL;
+
+   for (uint32_t i = 0; i < color_count; i++) {
+      if (pRenderingInfo->pColorAttachments[i].imageView != VK_NULL_HANDLE)
+         att_count++;
+   }
+
+   if (zs_info)
+      att_count++;
+
+   struct panvk_render_pass *pass;
+   struct panvk_render_pass_attachment *atts;
+   struct panvk_subpass_attachment *color_atts;
+   struct panvk_framebuffer *fb;
+   struct panvk_clear_value *clears;
+   VkClearValue clear_values[MAX_RTS + 1];
+
+   VK_MULTIALLOC(ma);
+   vk_multialloc_add_size(&ma, &pass, struct panvk_render_pass,
+                          sizeof(*pass) + sizeof(pass->subpasses[0]));
+   vk_multialloc_add(&ma, &atts, struct panvk_render_pass_attachment, att_count);
+   vk_multialloc_add(&ma, &color_atts, struct panvk_subpass_attachment, color_count);
+   vk_multialloc_add_size(&ma, &fb, struct panvk_framebuffer,
+                          sizeof(*fb) + att_count * sizeof(fb->attachments[0]));
+   vk_multialloc_add(&ma, &clears, struct panvk_clear_value, att_count);
+
+   if (!vk_multialloc_zalloc(&ma, &cmdbuf->vk.pool->alloc,
+                             VK_SYSTEM_ALLOCATION_SCOPE_COMMAND)) {
+      vk_command_buffer_set_error(&cmdbuf->vk, VK_ERROR_OUT_OF_HOST_MEMORY);
+      return;
+   }
+
+   struct panvk_subpass *subpass = &pass->subpasses[0];
+
+   pass->attachment_count = att_count;
+   pass->subpass_count = 1;
+   pass->attachments = atts;
+   subpass->color_count = color_count;
+   subpass->color_attachments = color_atts;
+   subpass->view_mask = pRenderingInfo->viewMask;
+   subpass->zs_attachment.idx = VK_ATTACHMENT_UNUSED;
+
+   /* Sized like the smallest attachment, as a VkFramebuffer would be */
+   fb->width = fb->height = UINT32_MAX;
+   fb->layers = pRenderingInfo->layerCount;
+   fb->attachment_count = att_count;
+
+   uint32_t idx = 0;
+   for (uint32_t i = 0; i < color_count; i++) {
+      const VkRenderingAttachmentInfo *info = &pRenderingInfo->pColorAttachments[i];
+
+      if (info->imageView == VK_NULL_HANDLE) {
+         color_atts[i].idx = VK_ATTACHMENT_UNUSED;
+         continue;
+      }
+
+      panvk_rendering_attachment_init(&atts[idx], &color_atts[i],
+                                      &fb->attachments[idx], info, idx,
+                                      resuming, suspending);
+      clear_values[idx] = info->clearValue;
+      subpass->active_color_attachments |= BITFIELD_BIT(i);
+      idx++;
+   }
+
+   if (zs_info) {
+      panvk_rendering_attachment_init(&atts[idx], &subpass->zs_attachment,
+                                      &fb->attachments[idx], zs_info, idx,
+                                      resuming, suspending);
+      clear_values[idx].depthStencil.depth =
+         pRenderingInfo->pDepthAttachment ?
+         pRenderingInfo->pDepthAttachment->clearValue.depthStencil.depth : 0;
+      clear_values[idx].depthStencil.stencil =
+         pRenderingInfo->pStencilAttachment ?
+         pRenderingInfo->pStencilAttachment->clearValue.depthStencil.stencil : 0;
+      if (pRenderingInfo->pStencilAttachment &&
+          pRenderingInfo->pStencilAttachment->imageView != VK_NULL_HANDLE &&
+          !resuming)
+         atts[idx].stencil_load_op = pRenderingInfo->pStencilAttachment->loadOp;
+      if (pRenderingInfo->pStencilAttachment &&
+          pRenderingInfo->pStencilAttachment->imageView != VK_NULL_HANDLE &&
+          !suspending)
+         atts[idx].stencil_store_op = pRenderingInfo->pStencilAttachment->storeOp;
+   }
+
+   for (uint32_t i = 0; i < att_count; i++) {
+      const struct panvk_image_view *iview = fb->attachments[i].iview;
+
+      fb->width = MIN2(fb->width, iview->vk.extent.width);
+      fb->height = MIN2(fb->height, iview->vk.extent.height);
+   }
+
+   /* No attachments: the render area is all we have */
+   if (!att_count) {
+      fb->width = pRenderingInfo->renderArea.offset.x +
+                  pRenderingInfo->renderArea.extent.width;
+      fb->height = pRenderingInfo->renderArea.offset.y +
+                   pRenderingInfo->renderArea.extent.height;
+   }
+
+   cmdbuf->state.rendering = pass;
+   cmdbuf->state.pass = pass;
+   cmdbuf->state.subpass = subpass;
+   cmdbuf->state.framebuffer = fb;
+   cmdbuf->state.render_area = pRenderingInfo->renderArea;
+   cmdbuf->state.clear = clears;
+   panvk_arch_dispatch(cmdbuf->device->physical_device->pdev.arch,
+                       cmd_close_batch, cmdbuf);
+   panvk_cmd_open_batch(cmdbuf);
+   panvk_cmd_prepare_clear_values(cmdbuf, clear_values);
+   panvk_cmd_fb_info_init(cmdbuf);
+   panvk_cmd_fb_info_set_subpass(cmdbuf);
+}
+
 void
 panvk_cmd_preload_fb_after_batch_split(struct panvk_cmd_buffer *cmdbuf)
 {
@@ -260,10 +260,101 @@ panvk_CreateDescriptorPool(VkDevice _device,
       }
    }
 
+   list_inithead(&pool->sets);
+
+   pool->linear = !(pCreateInfo->flags &
+                    VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+   if (pool->linear) {
+      util_dynarray_init(&pool->host.blocks, NULL);
+      panvk_bo_pool_init(&pool->desc_bo_pool);
+      panvk_pool_init(&pool->desc_mem, &device->physical_device->pdev,
+                      &pool->desc_bo_pool, 0, 16 * 1024,
+                      "Descriptor pool", false);
+   }
+
    *pDescriptorPool = panvk_descriptor_pool_to_handle(pool);
    return VK_SUCCESS;
 }
 
+#define PANVK_DESC_POOL_HOST_BLOCK_SIZE (16 * 1024)
+
+void *
+panvk_descriptor_pool_alloc_host(struct panvk_device *device,
+                                 struct panvk_descriptor_pool *pool,
+                                 size_t size)
+{
+   assert(pool->linear);
+
+   size = ALIGN_POT(size, 8);
+
+   if (pool->host.offset + size > pool->host.size) {
+      size_t block_size = MAX2(size, PANVK_DESC_POOL_HOST_BLOCK_SIZE);
+      void *block = vk_alloc(&device->vk.alloc, block_size, 8,
+                             VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+      if (!block)
+         return NULL;
+
+      util_dynarray_append(&pool->host.blocks, void *, block);
+      pool->host.cur = block;
+      pool->host.offset = 0;
+      pool->host.size = block_size;
+   }
+
+   void *ptr = (uint8_t *)pool->host.cur + pool->host.offset;
+   pool->host.offset += size;
+   return ptr;
+}
+
+static void
+panvk_descriptor_set_destroy(struct panvk_device *device,
+                             struct panvk_descriptor_pool *pool,
+                             struct panvk_descriptor_set *set)
+{
+   list_del(&set->node);
+
+   if (set->desc_bo)
+      panfrost_bo_unreference(set->desc_bo);
+
+   /* Sets of linear pools are freed with the pool memory */
+   vk_object_base_finish(&set->base);
+   if (!pool->linear)
+      vk_free(&device->vk.alloc, set);
+}
+
+static void
+panvk_descriptor_pool_reset(struct panvk_device *device,
+                            struct panvk_descriptor_pool *pool)
+{
+   list_for_each_entry_safe(struct panvk_descriptor_set, set,
+                            &pool->sets, node)
+      panvk_descriptor_set_destroy(device, pool, set);
+
+   if (pool->linear) {
+      /* Keep the first host block for the next allocations */
+      unsigned num_blocks =
+         util_dynarray_num_elements(&pool->host.blocks, void *);
+
+      for (unsigned i = 1; i < num_blocks; i++) {
+         vk_free(&device->vk.alloc,
+                 *util_dynarray_element(&pool->host.blocks, void *, i));
+      }
+
+      if (num_blocks) {
+         pool->host.blocks.size = sizeof(void *);
+         pool->host.cur = *util_dynarray_element(&pool->host.blocks, void *, 0);
+         pool->host.size = PANVK_DESC_POOL_HOST_BLOCK_SIZE;
+      } else {
+         pool->host.cur = NULL;
+         pool->host.size = 0;
+      }
+      pool->host.offset = 0;
+
+      panvk_pool_reset(&pool->desc_mem);
+   }
+
+   memset(&pool->cur, 0, sizeof(pool->cur));
+}
+
 void
 panvk_DestroyDescriptorPool(VkDevice _device,
                             VkDescriptorPool _pool,
@@ -272,8 +363,20 @@ panvk_DestroyDescriptorPool(VkDevice _device,
    VK_FROM_HANDLE(panvk_device, device, _device);
    VK_FROM_HANDLE(panvk_descriptor_pool, pool, _pool);
 
-   if (pool)
-      vk_object_free(&device->vk, pAllocator, pool);
+   if (!pool)
+      return;
+
+   panvk_descriptor_pool_reset(device, pool);
+
+   if (pool->linear) {
+      util_dynarray_foreach(&pool->host.blocks, void *, block)
+         vk_free(&device->vk.alloc, *block);
+      util_dynarray_fini(&pool->host.blocks);
+      panvk_pool_cleanup(&pool->desc_mem);
+      panvk_bo_pool_cleanup(&pool->desc_bo_pool);
+   }
+
+   vk_object_free(&device->vk, pAllocator, pool);
 }
 
 VkResult
@@ -281,26 +384,11 @@ panvk_ResetDescriptorPool(VkDevice _device,
                           VkDescriptorPool _pool,
                           VkDescriptorPoolResetFlags flags)
 {
+   VK_FROM_HANDLE(panvk_device, device, _device);
    VK_FROM_HANDLE(panvk_descriptor_pool, pool, _pool);
-   memset(&pool->cur, 0, sizeof(pool->cur));
-   return VK_SUCCESS;
-}
 
-static void
-panvk_descriptor_set_destroy(struct panvk_device *device,
-                             struct panvk_descriptor_pool *pool,
-                             struct panvk_descriptor_set *set)
-{
-   vk_free(&device->vk.alloc, set->textures);
-   vk_free(&device->vk.alloc, set->samplers);
-   vk_free(&device->vk.alloc, set->ubos);
-   vk_free(&device->vk.alloc, set->dyn_ubos);
-   vk_free(&device->vk.alloc, set->dyn_ssbos);
-   vk_free(&device->vk.alloc, set->img_fmts);
-   vk_free(&device->vk.alloc, set->img_attrib_bufs);
-   if (set->desc_bo)
-      panfrost_bo_unreference(set->desc_bo);
-   vk_object_free(&device->vk, NULL, set);
+   panvk_descriptor_pool_reset(device, pool);
+   return VK_SUCCESS;
 }
 
 VkResult
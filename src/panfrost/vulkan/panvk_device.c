@@ -31,6 +31,8 @@
 #include "pan_bo.h"
 #include "pan_encoder.h"
 #include "pan_util.h"
+#include "bifrost/bi_quirks.h"
+#include "util/pan_ir.h"
 #include "vk_common_entrypoints.h"
 #include "vk_cmd_enqueue_entrypoints.h"
 
@@ -59,6 +61,9 @@
 
 #include "panvk_cs.h"
 
+/* The GPU device node of vendor kernels, which use kbase rather than DRM */
+#define PANVK_KBASE_PATH "/dev/mali0"
+
 VkResult
 _panvk_device_set_lost(struct panvk_device *device,
                        const char *file, int line,
@@ -120,6 +125,7 @@ static const struct debug_control panvk_debug_options[] = {
    { "afbc", PANVK_DEBUG_AFBC },
    { "linear", PANVK_DEBUG_LINEAR },
    { "dump", PANVK_DEBUG_DUMP },
+   { "subgroups", PANVK_DEBUG_SUBGROUPS },
    { NULL, 0 }
 };
 
@@ -157,6 +163,8 @@ panvk_get_device_extensions(const struct panvk_physical_device *device,
       .KHR_copy_commands2 = true,
       .KHR_storage_buffer_storage_class = true,
       .KHR_descriptor_update_template = true,
+      .KHR_dynamic_rendering = true,
+      .KHR_push_descriptor = true,
 #ifdef PANVK_USE_WSI_PLATFORM
       .KHR_swapchain = true,
 #endif
@@ -172,11 +180,16 @@ VkResult panvk_physical_device_try_create(struct vk_instance *vk_instance,
                                           struct _drmDevice *drm_device,
                                           struct vk_physical_device **out);
 
+static VkResult panvk_enumerate_devices(struct vk_instance *vk_instance);
+
 static void
 panvk_physical_device_finish(struct panvk_physical_device *device)
 {
    panvk_wsi_finish(device);
 
+   if (device->vk.disk_cache)
+      disk_cache_destroy(device->vk.disk_cache);
+
    panvk_arch_dispatch(device->pdev.arch, meta_cleanup, device);
    panfrost_close_device(&device->pdev);
    if (device->master_fd != -1)
@@ -226,8 +239,7 @@ panvk_CreateInstance(const VkInstanceCreateInfo *pCreateInfo,
       return vk_error(NULL, result);
    }
 
-   instance->vk.physical_devices.try_create_for_drm =
-      panvk_physical_device_try_create;
+   instance->vk.physical_devices.enumerate = panvk_enumerate_devices;
    instance->vk.physical_devices.destroy = panvk_destroy_physical_device;
 
    instance->debug_flags = parse_debug_string(getenv("PANVK_DEBUG"),
@@ -256,12 +268,15 @@ panvk_DestroyInstance(VkInstance _instance,
    vk_free(&instance->vk.alloc, instance);
 }
 
+/* Without a DRM device, the GPU is opened through the kbase device node of
+ * vendor kernels */
 static VkResult
 panvk_physical_device_init(struct panvk_physical_device *device,
                            struct panvk_instance *instance,
                            drmDevicePtr drm_device)
 {
-   const char *path = drm_device->nodes[DRM_NODE_RENDER];
+   const char *path =
+      drm_device ? drm_device->nodes[DRM_NODE_RENDER] : PANVK_KBASE_PATH;
    VkResult result = VK_SUCCESS;
    drmVersionPtr version;
    int fd;
@@ -273,29 +288,31 @@ panvk_physical_device_init(struct panvk_physical_device *device,
                        "pass PAN_I_WANT_A_BROKEN_VULKAN_DRIVER=1 if you know what you're doing.");
    }
 
-   fd = open(path, O_RDWR | O_CLOEXEC);
+   fd = open(path, O_RDWR | O_CLOEXEC | (drm_device ? 0 : O_NONBLOCK));
    if (fd < 0) {
       return vk_errorf(instance, VK_ERROR_INCOMPATIBLE_DRIVER,
                        "failed to open device %s", path);
    }
 
-   version = drmGetVersion(fd);
-   if (!version) {
-      close(fd);
-      return vk_errorf(instance, VK_ERROR_INCOMPATIBLE_DRIVER,
-                       "failed to query kernel driver version for device %s",
-                       path);
-   }
+   if (drm_device) {
+      version = drmGetVersion(fd);
+      if (!version) {
+         close(fd);
+         return vk_errorf(instance, VK_ERROR_INCOMPATIBLE_DRIVER,
+                          "failed to query kernel driver version for device %s",
+                          path);
+      }
+
+      if (strcmp(version->name, "panfrost")) {
+         drmFreeVersion(version);
+         close(fd);
+         return vk_errorf(instance, VK_ERROR_INCOMPATIBLE_DRIVER,
+                          "device %s does not use the panfrost kernel driver", path);
+      }
 
-   if (strcmp(version->name, "panfrost")) {
       drmFreeVersion(version);
-      close(fd);
-      return vk_errorf(instance, VK_ERROR_INCOMPATIBLE_DRIVER,
-                       "device %s does not use the panfrost kernel driver", path);
    }
 
-   drmFreeVersion(version);
-
    if (instance->debug_flags & PANVK_DEBUG_STARTUP)
       panvk_logi("Found compatible device '%s'.", path);
 
@@ -323,7 +340,7 @@ panvk_physical_device_init(struct panvk_physical_device *device,
    assert(strlen(path) < ARRAY_SIZE(device->path));
    strncpy(device->path, path, ARRAY_SIZE(device->path));
 
-   if (instance->vk.enabled_extensions.KHR_display) {
+   if (drm_device && instance->vk.enabled_extensions.KHR_display) {
       master_fd = open(drm_device->nodes[DRM_NODE_PRIMARY], O_RDWR | O_CLOEXEC);
       if (master_fd >= 0) {
          /* TODO: free master_fd is accel is not working? */
@@ -338,6 +355,12 @@ panvk_physical_device_init(struct panvk_physical_device *device,
    panfrost_open_device(NULL, fd, &device->pdev);
    fd = -1;
 
+   if (!drm_device && !device->pdev.kbase) {
+      result = vk_errorf(instance, VK_ERROR_INCOMPATIBLE_DRIVER,
+                         "device %s is not a kbase device", path);
+      goto fail_close_device;
+   }
+
    if (device->pdev.arch <= 5) {
       result = vk_errorf(instance, VK_ERROR_INCOMPATIBLE_DRIVER,
                          "%s not supported",
@@ -345,6 +368,10 @@ panvk_physical_device_init(struct panvk_physical_device *device,
       goto fail;
    }
 
+   /* Indirect draws are only patched on the GPU on v7 */
+   device->vk.supported_extensions.KHR_draw_indirect_count =
+      device->pdev.arch >= 7;
+
    panvk_arch_dispatch(device->pdev.arch, meta_init, device);
 
    memset(device->name, 0, sizeof(device->name));
@@ -361,16 +388,38 @@ panvk_physical_device_init(struct panvk_physical_device *device,
    panvk_get_driver_uuid(&device->device_uuid);
    panvk_get_device_uuid(&device->device_uuid);
 
-   device->drm_syncobj_type = vk_drm_syncobj_get_type(device->pdev.fd);
-   /* We don't support timelines in the uAPI yet and we don't want it getting
-    * suddenly turned on by vk_drm_syncobj_get_type() without us adding panvk
-    * code for it first.
+   /* Timeline semaphores are timeline syncobjs when the kernel has them.
+    * The submit ioctl only takes binary syncobjs, so the points waited on
+    * are moved to binary ones at submit time, see panvk_vX_device.c.
+    * Atoms can't wait on syncs, so on kbase and older kernels timelines are
+    * emulated with a binary sync per point.
     */
-   device->drm_syncobj_type.features &= ~VK_SYNC_FEATURE_TIMELINE;
+   const struct vk_sync_type *binary_type;
+
+   if (device->pdev.kbase) {
+      binary_type = &panvk_kbase_sync_type;
+   } else {
+      device->drm_syncobj_type = vk_drm_syncobj_get_type(device->pdev.fd);
+      device->has_syncobj_transfer =
+         device->drm_syncobj_type.features & VK_SYNC_FEATURE_TIMELINE;
+
+      /* A job can wait on several in syncs */
+      device->drm_syncobj_type.features |= VK_SYNC_FEATURE_GPU_MULTI_WAIT;
+      binary_type = &device->drm_syncobj_type;
+   }
+
+   device->sync_types[0] = binary_type;
+
+   if (binary_type->features & VK_SYNC_FEATURE_TIMELINE) {
+      device->sync_types[1] = NULL;
+   } else {
+      device->sync_timeline_type = vk_sync_timeline_get_type(binary_type);
+      device->sync_types[1] = &device->sync_timeline_type.sync;
+      device->sync_types[2] = NULL;
+   }
 
-   device->sync_types[0] = &device->drm_syncobj_type;
-   device->sync_types[1] = NULL;
    device->vk.supported_sync_types = device->sync_types;
+   device->vk.supported_extensions.KHR_timeline_semaphore = true;
 
    result = panvk_wsi_init(device);
    if (result != VK_SUCCESS) {
@@ -378,6 +427,11 @@ panvk_physical_device_init(struct panvk_physical_device *device,
       goto fail_close_device;
    }
 
+   /* The GPU ID is already embedded in the cache UUID */
+   char cache_id[VK_UUID_SIZE * 2 + 1];
+   disk_cache_format_hex_id(cache_id, device->cache_uuid, VK_UUID_SIZE * 2);
+   device->vk.disk_cache = disk_cache_create("panvk", cache_id, 0);
+
    return VK_SUCCESS;
 
 fail_close_device:
@@ -398,8 +452,9 @@ panvk_physical_device_try_create(struct vk_instance *vk_instance,
    struct panvk_instance *instance =
       container_of(vk_instance, struct panvk_instance, vk);
 
-   if (!(drm_device->available_nodes & (1 << DRM_NODE_RENDER)) ||
-       drm_device->bustype != DRM_BUS_PLATFORM)
+   if (drm_device &&
+       (!(drm_device->available_nodes & (1 << DRM_NODE_RENDER)) ||
+        drm_device->bustype != DRM_BUS_PLATFORM))
       return VK_ERROR_INCOMPATIBLE_DRIVER;
 
    struct panvk_physical_device *device =
@@ -418,13 +473,61 @@ panvk_physical_device_try_create(struct vk_instance *vk_instance,
    return VK_SUCCESS;
 }
 
+static VkResult
+panvk_enumerate_devices(struct vk_instance *vk_instance)
+{
+   struct vk_physical_device *pdevice;
+   drmDevicePtr devices[8];
+   VkResult result = VK_SUCCESS;
+   int max_devices = drmGetDevices2(0, devices, ARRAY_SIZE(devices));
+
+   for (int i = 0; i < max_devices; i++) {
+      result = panvk_physical_device_try_create(vk_instance, devices[i],
+                                                &pdevice);
+
+      /* Incompatible DRM device, skip. */
+      if (result == VK_ERROR_INCOMPATIBLE_DRIVER) {
+         result = VK_SUCCESS;
+         continue;
+      }
+
+      if (result != VK_SUCCESS)
+         break;
+
+      list_addtail(&pdevice->link, &vk_instance->physical_devices.list);
+   }
+
+   if (max_devices > 0)
+      drmFreeDevices(devices, max_devices);
+
+   /* Vendor kernels don't have a DRM driver for the GPU */
+   if (result != VK_SUCCESS ||
+       !list_is_empty(&vk_instance->physical_devices.list) ||
+       access(PANVK_KBASE_PATH, F_OK))
+      return result;
+
+   result = panvk_physical_device_try_create(vk_instance, NULL, &pdevice);
+   if (result == VK_ERROR_INCOMPATIBLE_DRIVER)
+      return VK_SUCCESS;
+
+   if (result == VK_SUCCESS)
+      list_addtail(&pdevice->link, &vk_instance->physical_devices.list);
+
+   return result;
+}
+
 void
 panvk_GetPhysicalDeviceFeatures2(VkPhysicalDevice physicalDevice,
                                  VkPhysicalDeviceFeatures2 *pFeatures)
 {
+   VK_FROM_HANDLE(panvk_physical_device, pdevice, physicalDevice);
+   bool gpu_indirects = pdevice->pdev.arch >= 7;
+
    pFeatures->features = (VkPhysicalDeviceFeatures) {
       .robustBufferAccess = true,
       .fullDrawIndexUint32 = true,
+      .multiDrawIndirect = gpu_indirects,
+      .drawIndirectFirstInstance = gpu_indirects,
       .independentBlend = true,
       .logicOp = true,
       .wideLines = true,
@@ -456,7 +559,7 @@ panvk_GetPhysicalDeviceFeatures2(VkPhysicalDevice physicalDevice,
    const VkPhysicalDeviceVulkan12Features core_1_2 = {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
       .samplerMirrorClampToEdge           = false,
-      .drawIndirectCount                  = false,
+      .drawIndirectCount                  = gpu_indirects,
       .storageBuffer8BitAccess            = false,
       .uniformAndStorageBuffer8BitAccess  = false,
       .storagePushConstant8               = false,
@@ -494,7 +597,7 @@ panvk_GetPhysicalDeviceFeatures2(VkPhysicalDevice physicalDevice,
       .shaderSubgroupExtendedTypes        = false,
       .separateDepthStencilLayouts        = false,
       .hostQueryReset                     = false,
-      .timelineSemaphore                  = false,
+      .timelineSemaphore                  = true,
       .bufferDeviceAddress                = false,
       .bufferDeviceAddressCaptureReplay   = false,
       .bufferDeviceAddressMultiDevice     = false,
@@ -503,7 +606,7 @@ panvk_GetPhysicalDeviceFeatures2(VkPhysicalDevice physicalDevice,
       .vulkanMemoryModelAvailabilityVisibilityChains = false,
       .shaderOutputViewportIndex          = false,
       .shaderOutputLayer                  = false,
-      .subgroupBroadcastDynamicId         = false,
+      .subgroupBroadcastDynamicId         = panvk_physical_device_has_subgroups(pdevice),
    };
 
    const VkPhysicalDeviceVulkan13Features core_1_3 = {
@@ -520,7 +623,7 @@ panvk_GetPhysicalDeviceFeatures2(VkPhysicalDevice physicalDevice,
       .synchronization2                   = true,
       .textureCompressionASTC_HDR         = false,
       .shaderZeroInitializeWorkgroupMemory = false,
-      .dynamicRendering                   = false,
+      .dynamicRendering                   = true,
       .shaderIntegerDotProduct            = false,
       .maintenance4                       = false,
    };
@@ -585,6 +688,18 @@ panvk_GetPhysicalDeviceFeatures2(VkPhysicalDevice physicalDevice,
    }
 }
 
+/* Subgroup operations are built on CLPER, which is too limited on the first
+ * Bifrost GPUs. The subgroup ID and count assume warps are filled with
+ * consecutive local invocation indices, which hasn't been confirmed on
+ * hardware, so subgroups are opt-in until then. */
+bool
+panvk_physical_device_has_subgroups(const struct panvk_physical_device *dev)
+{
+   return (dev->instance->debug_flags & PANVK_DEBUG_SUBGROUPS) &&
+          dev->pdev.arch >= 6 &&
+          !(bifrost_get_quirks(dev->pdev.gpu_id) & BIFROST_LIMITED_CLPER);
+}
+
 void
 panvk_GetPhysicalDeviceProperties2(VkPhysicalDevice physicalDevice,
                                    VkPhysicalDeviceProperties2 *pProperties)
@@ -699,8 +814,9 @@ panvk_GetPhysicalDeviceProperties2(VkPhysicalDevice physicalDevice,
       .sampledImageStencilSampleCounts = sample_counts,
       .storageImageSampleCounts = VK_SAMPLE_COUNT_1_BIT,
       .maxSampleMaskWords = 1,
-      .timestampComputeAndGraphics = true,
-      .timestampPeriod = 1,
+      .timestampComputeAndGraphics = pdevice->pdev.timestamp_frequency != 0,
+      .timestampPeriod = pdevice->pdev.timestamp_frequency ?
+                         1000000000.0f / pdevice->pdev.timestamp_frequency : 1,
       .maxClipDistances = 8,
       .maxCullDistances = 8,
       .maxCombinedClipAndCullDistances = 8,
@@ -742,11 +858,27 @@ panvk_GetPhysicalDeviceProperties2(VkPhysicalDevice physicalDevice,
       /* Our buffer size fields allow only this much */
       .maxMemoryAllocationSize               = 0xFFFFFFFFull,
    };
+
+   if (panvk_physical_device_has_subgroups(pdevice)) {
+      core_1_1.subgroupSize = pan_subgroup_size(pdevice->pdev.arch);
+      core_1_1.subgroupSupportedStages = VK_SHADER_STAGE_COMPUTE_BIT;
+      core_1_1.subgroupSupportedOperations =
+         VK_SUBGROUP_FEATURE_BASIC_BIT |
+         VK_SUBGROUP_FEATURE_VOTE_BIT |
+         VK_SUBGROUP_FEATURE_ARITHMETIC_BIT |
+         VK_SUBGROUP_FEATURE_BALLOT_BIT |
+         VK_SUBGROUP_FEATURE_SHUFFLE_BIT |
+         VK_SUBGROUP_FEATURE_SHUFFLE_RELATIVE_BIT |
+         VK_SUBGROUP_FEATURE_CLUSTERED_BIT |
+         VK_SUBGROUP_FEATURE_QUAD_BIT;
+   }
+
    memcpy(core_1_1.driverUUID, pdevice->driver_uuid, VK_UUID_SIZE);
    memcpy(core_1_1.deviceUUID, pdevice->device_uuid, VK_UUID_SIZE);
 
    const VkPhysicalDeviceVulkan12Properties core_1_2 = {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+      .maxTimelineSemaphoreValueDifference = UINT64_MAX,
    };
 
    const VkPhysicalDeviceVulkan13Properties core_1_3 = {
@@ -831,11 +963,16 @@ panvk_GetPhysicalDeviceMemoryProperties2(VkPhysicalDevice physicalDevice,
       .memoryHeapCount = 1,
       .memoryHeaps[0].size = panvk_get_system_heap_size(),
       .memoryHeaps[0].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT,
-      .memoryTypeCount = 1,
-      .memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      .memoryTypes[0].heapIndex = 0,
+      .memoryTypeCount = 2,
+      .memoryTypes[PANVK_MEM_TYPE_DEFAULT].propertyFlags =
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      .memoryTypes[PANVK_MEM_TYPE_DEFAULT].heapIndex = 0,
+      .memoryTypes[PANVK_MEM_TYPE_LAZY].propertyFlags =
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+         VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+      .memoryTypes[PANVK_MEM_TYPE_LAZY].heapIndex = 0,
    };
 }
 
@@ -852,6 +989,17 @@ panvk_queue_init(struct panvk_device *device,
       return result;
    queue->device = device;
 
+   switch (pdev->arch) {
+   case 6: queue->vk.driver_submit = panvk_v6_queue_submit; break;
+   case 7: queue->vk.driver_submit = panvk_v7_queue_submit; break;
+   default: unreachable("Invalid arch");
+   }
+
+   if (pdev->kbase) {
+      queue->kbase_syncobj = pdev->mali.syncobj_create(&pdev->mali);
+      return VK_SUCCESS;
+   }
+
    struct drm_syncobj_create create = {
       .flags = DRM_SYNCOBJ_CREATE_SIGNALED,
    };
@@ -862,12 +1010,6 @@ panvk_queue_init(struct panvk_device *device,
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   switch (pdev->arch) {
-   case 6: queue->vk.driver_submit = panvk_v6_queue_submit; break;
-   case 7: queue->vk.driver_submit = panvk_v7_queue_submit; break;
-   default: unreachable("Invalid arch");
-   }
-
    queue->sync = create.handle;
    return VK_SUCCESS;
 }
@@ -875,9 +1017,128 @@ panvk_queue_init(struct panvk_device *device,
 static void
 panvk_queue_finish(struct panvk_queue *queue)
 {
+   struct panfrost_device *pdev = &queue->device->physical_device->pdev;
+
+   if (queue->kbase_syncobj)
+      pdev->mali.syncobj_destroy(&pdev->mali, queue->kbase_syncobj);
+
    vk_queue_finish(&queue->vk);
 }
 
+static void
+panvk_mem_slab_destroy(struct panvk_device *device,
+                       struct panvk_mem_slab *slab)
+{
+   list_del(&slab->link);
+   util_vma_heap_finish(&slab->heap);
+   panfrost_bo_unreference(slab->bo);
+   vk_free(&device->vk.alloc, slab);
+}
+
+static struct panvk_mem_slab *
+panvk_mem_slab_create(struct panvk_device *device)
+{
+   struct panvk_mem_slab *slab =
+      vk_zalloc(&device->vk.alloc, sizeof(*slab), 8,
+                VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!slab)
+      return NULL;
+
+   slab->bo = panfrost_bo_create(&device->physical_device->pdev,
+                                 PANVK_MEM_SLAB_SIZE, 0,
+                                 "Suballocated memory");
+   if (!slab->bo) {
+      vk_free(&device->vk.alloc, slab);
+      return NULL;
+   }
+
+   util_vma_heap_init(&slab->heap, PANVK_MEM_SUBALLOC_ALIGN,
+                      PANVK_MEM_SLAB_SIZE);
+   list_add(&slab->link, &device->mem_heap.slabs);
+   return slab;
+}
+
+static VkResult
+panvk_mem_suballoc(struct panvk_device *device,
+                   struct panvk_device_memory *mem,
+                   uint64_t size)
+{
+   VkResult result = VK_SUCCESS;
+   uint64_t addr = 0;
+
+   size = align64(size, PANVK_MEM_SUBALLOC_ALIGN);
+
+   mtx_lock(&device->mem_heap.mutex);
+
+   list_for_each_entry(struct panvk_mem_slab, slab,
+                       &device->mem_heap.slabs, link) {
+      addr = util_vma_heap_alloc(&slab->heap, size,
+                                 PANVK_MEM_SUBALLOC_ALIGN);
+      if (addr) {
+         mem->slab = slab;
+         break;
+      }
+   }
+
+   if (!addr) {
+      mem->slab = panvk_mem_slab_create(device);
+      if (!mem->slab) {
+         result = vk_error(device, VK_ERROR_OUT_OF_DEVICE_MEMORY);
+         goto out;
+      }
+
+      addr = util_vma_heap_alloc(&mem->slab->heap, size,
+                                 PANVK_MEM_SUBALLOC_ALIGN);
+      assert(addr);
+   }
+
+   mem->slab->alloc_count++;
+   mem->bo = mem->slab->bo;
+   mem->offset = addr - PANVK_MEM_SUBALLOC_ALIGN;
+   mem->size = size;
+
+out:
+   mtx_unlock(&device->mem_heap.mutex);
+   return result;
+}
+
+static void
+panvk_mem_subfree(struct panvk_device *device,
+                  struct panvk_device_memory *mem)
+{
+   struct panvk_mem_slab *slab = mem->slab;
+
+   mtx_lock(&device->mem_heap.mutex);
+
+   util_vma_heap_free(&slab->heap, mem->offset + PANVK_MEM_SUBALLOC_ALIGN,
+                      mem->size);
+
+   /* Keep the first slab around, so that an application repeatedly
+    * allocating and freeing a single small object doesn't create a BO each
+    * time.
+    */
+   if (!--slab->alloc_count &&
+       !list_is_singular(&device->mem_heap.slabs))
+      panvk_mem_slab_destroy(device, slab);
+
+   mtx_unlock(&device->mem_heap.mutex);
+}
+
+static bool
+panvk_mem_can_suballoc(const VkMemoryAllocateInfo *info)
+{
+   if (info->allocationSize > PANVK_MEM_SUBALLOC_MAX_SIZE)
+      return false;
+
+   /* Exported and dedicated memory gets a BO of its own */
+   const VkExportMemoryAllocateInfo *export_info =
+      vk_find_struct_const(info->pNext, EXPORT_MEMORY_ALLOCATE_INFO);
+   if (export_info && export_info->handleTypes)
+      return false;
+
+   return !vk_find_struct_const(info->pNext, MEMORY_DEDICATED_ALLOCATE_INFO);
+}
+
 VkResult
 panvk_CreateDevice(VkPhysicalDevice physicalDevice,
                    const VkDeviceCreateInfo *pCreateInfo,
@@ -958,6 +1219,20 @@ panvk_CreateDevice(VkPhysicalDevice physicalDevice,
    const struct panfrost_device *pdev = &physical_device->pdev;
    vk_device_set_drm_fd(&device->vk, pdev->fd);
 
+   if (pdev->kbase)
+      panvk_kbase_device_init(device);
+
+   mtx_init(&device->mem_heap.mutex, mtx_plain);
+   list_inithead(&device->mem_heap.slabs);
+
+   struct vk_pipeline_cache_create_info cache_info = {};
+   device->mem_cache = vk_pipeline_cache_create(&device->vk, &cache_info,
+                                                NULL);
+   if (!device->mem_cache) {
+      result = VK_ERROR_OUT_OF_HOST_MEMORY;
+      goto fail;
+   }
+
    for (unsigned i = 0; i < pCreateInfo->queueCreateInfoCount; i++) {
       const VkDeviceQueueCreateInfo *queue_create =
          &pCreateInfo->pQueueCreateInfos[i];
@@ -995,6 +1270,13 @@ fail:
          vk_object_free(&device->vk, NULL, device->queues[i]);
    }
 
+   if (device->mem_cache)
+      vk_pipeline_cache_destroy(device->mem_cache, NULL);
+
+   if (pdev->kbase)
+      panvk_kbase_device_finish(device);
+
+   mtx_destroy(&device->mem_heap.mutex);
    vk_free(&device->vk.alloc, device);
    return result;
 }
@@ -1014,6 +1296,16 @@ panvk_DestroyDevice(VkDevice _device, const VkAllocationCallbacks *pAllocator)
          vk_object_free(&device->vk, NULL, device->queues[i]);
    }
 
+   vk_pipeline_cache_destroy(device->mem_cache, NULL);
+
+   list_for_each_entry_safe(struct panvk_mem_slab, slab,
+                            &device->mem_heap.slabs, link)
+      panvk_mem_slab_destroy(device, slab);
+   mtx_destroy(&device->mem_heap.mutex);
+
+   if (device->physical_device->pdev.kbase)
+      panvk_kbase_device_finish(device);
+
    vk_free(&device->vk.alloc, device);
 }
 
@@ -1033,7 +1325,16 @@ panvk_QueueWaitIdle(VkQueue _queue)
    if (panvk_device_is_lost(queue->device))
       return VK_ERROR_DEVICE_LOST;
 
-   const struct panfrost_device *pdev = &queue->device->physical_device->pdev;
+   struct panfrost_device *pdev = &queue->device->physical_device->pdev;
+
+   if (pdev->kbase) {
+      if (!pdev->mali.syncobj_wait(&pdev->mali, queue->kbase_syncobj,
+                                   INT64_MAX))
+         return panvk_device_set_lost(queue->device, "queue wait failed");
+
+      return VK_SUCCESS;
+   }
+
    struct drm_syncobj_wait wait = {
       .handles = (uint64_t) (uintptr_t)(&queue->sync),
       .count_handles = 1,
@@ -1117,8 +1418,8 @@ panvk_AllocateMemory(VkDevice _device,
       return VK_SUCCESS;
    }
 
-   mem = vk_object_alloc(&device->vk, pAllocator, sizeof(*mem),
-                         VK_OBJECT_TYPE_DEVICE_MEMORY);
+   mem = vk_object_zalloc(&device->vk, pAllocator, sizeof(*mem),
+                          VK_OBJECT_TYPE_DEVICE_MEMORY);
    if (mem == NULL)
       return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
 
@@ -1143,6 +1444,20 @@ panvk_AllocateMemory(VkDevice _device,
       mem->bo = panfrost_bo_import(&device->physical_device->pdev, fd_info->fd);
       /* take ownership and close the fd */
       close(fd_info->fd);
+   } else if (pAllocateInfo->memoryTypeIndex == PANVK_MEM_TYPE_LAZY) {
+      /* Grown on GPU faults, so attachments that never leave the tile
+       * buffer don't get any memory. Not host visible, so never mapped. */
+      mem->bo = panfrost_bo_create(&device->physical_device->pdev,
+                                   pAllocateInfo->allocationSize,
+                                   PAN_BO_GROWABLE | PAN_BO_INVISIBLE,
+                                   "Lazily allocated memory");
+   } else if (panvk_mem_can_suballoc(pAllocateInfo)) {
+      VkResult result =
+         panvk_mem_suballoc(device, mem, pAllocateInfo->allocationSize);
+      if (result != VK_SUCCESS) {
+         vk_object_free(&device->vk, pAllocator, mem);
+         return result;
+      }
    } else {
       mem->bo = panfrost_bo_create(&device->physical_device->pdev,
                                    pAllocateInfo->allocationSize, 0,
@@ -1167,7 +1482,11 @@ panvk_FreeMemory(VkDevice _device,
    if (mem == NULL)
       return;
 
-   panfrost_bo_unreference(mem->bo);
+   if (mem->slab)
+      panvk_mem_subfree(device, mem);
+   else
+      panfrost_bo_unreference(mem->bo);
+
    vk_object_free(&device->vk, pAllocator, mem);
 }
 
@@ -1193,7 +1512,7 @@ panvk_MapMemory(VkDevice _device,
    *ppData = mem->bo->ptr.cpu;
 
    if (*ppData) {
-      *ppData += offset;
+      *ppData += mem->offset + offset;
       return VK_SUCCESS;
    }
 
@@ -1245,8 +1564,12 @@ panvk_GetImageMemoryRequirements2(VkDevice device,
 
    const uint64_t align = 4096;
    const uint64_t size = panvk_image_get_total_size(image);
+   uint32_t types = BITFIELD_BIT(PANVK_MEM_TYPE_DEFAULT);
 
-   pMemoryRequirements->memoryRequirements.memoryTypeBits = 1;
+   if (image->vk.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+      types |= BITFIELD_BIT(PANVK_MEM_TYPE_LAZY);
+
+   pMemoryRequirements->memoryRequirements.memoryTypeBits = types;
    pMemoryRequirements->memoryRequirements.alignment = align;
    pMemoryRequirements->memoryRequirements.size = size;
 }
@@ -1279,7 +1602,7 @@ panvk_BindBufferMemory2(VkDevice device,
 
       if (mem) {
          buffer->bo = mem->bo;
-         buffer->bo_offset = pBindInfos[i].memoryOffset;
+         buffer->bo_offset = mem->offset + pBindInfos[i].memoryOffset;
       } else {
          buffer->bo = NULL;
       }
@@ -1298,7 +1621,7 @@ panvk_BindImageMemory2(VkDevice device,
 
       if (mem) {
          image->pimage.data.bo = mem->bo;
-         image->pimage.data.offset = pBindInfos[i].memoryOffset;
+         image->pimage.data.offset = mem->offset + pBindInfos[i].memoryOffset;
          /* Reset the AFBC headers */
          if (drm_is_afbc(image->pimage.layout.modifier)) {
             void *base = image->pimage.data.bo->ptr.cpu + image->pimage.data.offset;
@@ -1335,6 +1658,11 @@ panvk_CreateEvent(VkDevice _device,
    if (!event)
       return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
 
+   if (pdev->kbase) {
+      *pEvent = panvk_event_to_handle(event);
+      return VK_SUCCESS;
+   }
+
    struct drm_syncobj_create create = {
       .flags = 0,
    };
@@ -1361,8 +1689,12 @@ panvk_DestroyEvent(VkDevice _device,
    if (!event)
       return;
 
-   struct drm_syncobj_destroy destroy = { .handle = event->syncobj };
-   drmIoctl(pdev->fd, DRM_IOCTL_SYNCOBJ_DESTROY, &destroy);
+   if (pdev->kbase) {
+      panvk_kbase_event_reset(device, event);
+   } else {
+      struct drm_syncobj_destroy destroy = { .handle = event->syncobj };
+      drmIoctl(pdev->fd, DRM_IOCTL_SYNCOBJ_DESTROY, &destroy);
+   }
 
    vk_object_free(&device->vk, pAllocator, event);
 }
@@ -1375,6 +1707,11 @@ panvk_GetEventStatus(VkDevice _device, VkEvent _event)
    const struct panfrost_device *pdev = &device->physical_device->pdev;
    bool signaled;
 
+   if (pdev->kbase) {
+      signaled = panvk_kbase_event_wait(device, event, 0);
+      return signaled ? VK_EVENT_SET : VK_EVENT_RESET;
+   }
+
    struct drm_syncobj_wait wait = {
       .handles = (uintptr_t) &event->syncobj,
       .count_handles = 1,
@@ -1403,6 +1740,11 @@ panvk_SetEvent(VkDevice _device, VkEvent _event)
    VK_FROM_HANDLE(panvk_event, event, _event);
    const struct panfrost_device *pdev = &device->physical_device->pdev;
 
+   if (pdev->kbase) {
+      panvk_kbase_event_set(device, event, NULL);
+      return VK_SUCCESS;
+   }
+
    struct drm_syncobj_array objs = {
       .handles = (uint64_t) (uintptr_t) &event->syncobj,
       .count_handles = 1
@@ -1427,6 +1769,11 @@ panvk_ResetEvent(VkDevice _device, VkEvent _event)
    VK_FROM_HANDLE(panvk_event, event, _event);
    const struct panfrost_device *pdev = &device->physical_device->pdev;
 
+   if (pdev->kbase) {
+      panvk_kbase_event_reset(device, event);
+      return VK_SUCCESS;
+   }
+
    struct drm_syncobj_array objs = {
       .handles = (uint64_t) (uintptr_t) &event->syncobj,
       .count_handles = 1
@@ -1599,6 +1946,9 @@ panvk_GetMemoryFdKHR(VkDevice _device,
    assert(pGetFdInfo->handleType == VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT ||
           pGetFdInfo->handleType == VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT);
 
+   /* Exportable memory is never suballocated */
+   assert(!memory->slab);
+
    int prime_fd = panfrost_bo_export(memory->bo);
    if (prime_fd < 0)
       return vk_error(device, VK_ERROR_OUT_OF_DEVICE_MEMORY);
@@ -1623,7 +1973,11 @@ panvk_GetPhysicalDeviceExternalSemaphoreProperties(VkPhysicalDevice physicalDevi
                                                    const VkPhysicalDeviceExternalSemaphoreInfo *pExternalSemaphoreInfo,
                                                    VkExternalSemaphoreProperties *pExternalSemaphoreProperties)
 {
-   if ((pExternalSemaphoreInfo->handleType == VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT ||
+   VK_FROM_HANDLE(panvk_physical_device, device, physicalDevice);
+
+   /* kbase syncs can't be shared */
+   if (!device->pdev.kbase &&
+       (pExternalSemaphoreInfo->handleType == VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT ||
         pExternalSemaphoreInfo->handleType == VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT)) {
       pExternalSemaphoreProperties->exportFromImportedHandleTypes =
          VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT |
@@ -154,6 +154,11 @@ panvk_image_select_mod(VkDevice _device,
    if (pCreateInfo->usage & VK_IMAGE_USAGE_STORAGE_BIT)
       return DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED;
 
+   /* Transient attachments are meant to stay in the tile buffer, and may be
+    * in lazily allocated memory, where AFBC headers can't be initialized */
+   if (pCreateInfo->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+      return DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED;
+
    /* AFBC does not support layered multisampling */
    if (pCreateInfo->samples > 1)
       return DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED;
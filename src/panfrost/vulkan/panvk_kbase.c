@@ -0,0 +1,383 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Synchronization on the kbase backend.
+ *
+ * kbase has no shareable equivalent of DRM syncobjs, so fences, semaphores
+ * and events wrap the kbase_syncobj of the atoms which signal them. JM atoms
+ * can only depend on other atoms, so GPU waits are done on the CPU before
+ * submitting. That's usually free: there's a single queue, and the work it
+ * submits is already ordered by kbase through the BOs it shares.
+ */
+
+#include "panvk_private.h"
+
+#include "util/os_time.h"
+#include "util/timespec.h"
+
+struct panvk_kbase_sync {
+   struct vk_sync base;
+
+   /* Atoms which signal the sync, NULL once it has been signaled on the
+    * CPU or when nothing was submitted to signal it */
+   struct kbase_syncobj *syncobj;
+
+   /* Whether a signal operation was submitted or performed since the last
+    * reset */
+   bool submitted;
+};
+
+static struct panvk_kbase_sync *
+to_panvk_kbase_sync(struct vk_sync *sync)
+{
+   assert(sync->type == &panvk_kbase_sync_type);
+   return container_of(sync, struct panvk_kbase_sync, base);
+}
+
+static kbase
+panvk_kbase(struct vk_device *vk_device)
+{
+   struct panvk_device *device =
+      container_of(vk_device, struct panvk_device, vk);
+
+   return &device->physical_device->pdev.mali;
+}
+
+void
+panvk_kbase_device_init(struct panvk_device *device)
+{
+   mtx_init(&device->kbase_sync.mutex, mtx_plain);
+   u_cnd_monotonic_init(&device->kbase_sync.cond);
+}
+
+void
+panvk_kbase_device_finish(struct panvk_device *device)
+{
+   u_cnd_monotonic_destroy(&device->kbase_sync.cond);
+   mtx_destroy(&device->kbase_sync.mutex);
+}
+
+/* Called with the device sync mutex held */
+static void
+panvk_kbase_sync_set_locked(struct vk_device *vk_device,
+                            struct panvk_kbase_sync *sync,
+                            struct kbase_syncobj *syncobj,
+                            bool submitted)
+{
+   kbase k = panvk_kbase(vk_device);
+
+   if (sync->syncobj)
+      k->syncobj_destroy(k, sync->syncobj);
+
+   sync->syncobj = syncobj;
+   sync->submitted = submitted;
+}
+
+static VkResult
+panvk_kbase_sync_init(struct vk_device *vk_device,
+                      struct vk_sync *vk_sync,
+                      uint64_t initial_value)
+{
+   struct panvk_kbase_sync *sync = to_panvk_kbase_sync(vk_sync);
+
+   sync->syncobj = NULL;
+   sync->submitted = initial_value != 0;
+
+   return VK_SUCCESS;
+}
+
+static void
+panvk_kbase_sync_finish(struct vk_device *vk_device,
+                        struct vk_sync *vk_sync)
+{
+   struct panvk_kbase_sync *sync = to_panvk_kbase_sync(vk_sync);
+   kbase k = panvk_kbase(vk_device);
+
+   if (sync->syncobj)
+      k->syncobj_destroy(k, sync->syncobj);
+}
+
+static VkResult
+panvk_kbase_sync_signal(struct vk_device *vk_device,
+                        struct vk_sync *vk_sync,
+                        uint64_t value)
+{
+   struct panvk_device *device =
+      container_of(vk_device, struct panvk_device, vk);
+
+   mtx_lock(&device->kbase_sync.mutex);
+   panvk_kbase_sync_set_locked(vk_device, to_panvk_kbase_sync(vk_sync),
+                               NULL, true);
+   u_cnd_monotonic_broadcast(&device->kbase_sync.cond);
+   mtx_unlock(&device->kbase_sync.mutex);
+
+   return VK_SUCCESS;
+}
+
+static VkResult
+panvk_kbase_sync_reset(struct vk_device *vk_device,
+                       struct vk_sync *vk_sync)
+{
+   struct panvk_device *device =
+      container_of(vk_device, struct panvk_device, vk);
+
+   mtx_lock(&device->kbase_sync.mutex);
+   panvk_kbase_sync_set_locked(vk_device, to_panvk_kbase_sync(vk_sync),
+                               NULL, false);
+   mtx_unlock(&device->kbase_sync.mutex);
+
+   return VK_SUCCESS;
+}
+
+static VkResult
+panvk_kbase_sync_move(struct vk_device *vk_device,
+                      struct vk_sync *vk_dst,
+                      struct vk_sync *vk_src)
+{
+   struct panvk_device *device =
+      container_of(vk_device, struct panvk_device, vk);
+   struct panvk_kbase_sync *dst = to_panvk_kbase_sync(vk_dst);
+   struct panvk_kbase_sync *src = to_panvk_kbase_sync(vk_src);
+
+   mtx_lock(&device->kbase_sync.mutex);
+   panvk_kbase_sync_set_locked(vk_device, dst, src->syncobj, src->submitted);
+   src->syncobj = NULL;
+   src->submitted = false;
+   u_cnd_monotonic_broadcast(&device->kbase_sync.cond);
+   mtx_unlock(&device->kbase_sync.mutex);
+
+   return VK_SUCCESS;
+}
+
+static unsigned
+panvk_kbase_sync_count_submitted(uint32_t wait_count,
+                                 const struct vk_sync_wait *waits)
+{
+   unsigned count = 0;
+
+   for (uint32_t i = 0; i < wait_count; i++)
+      count += to_panvk_kbase_sync(waits[i].sync)->submitted;
+
+   return count;
+}
+
+static int64_t
+panvk_kbase_sync_timeout(uint64_t abs_timeout_ns)
+{
+   if (abs_timeout_ns >= INT64_MAX)
+      return INT64_MAX;
+
+   uint64_t now = os_time_get_nano();
+   return abs_timeout_ns > now ? abs_timeout_ns - now : 0;
+}
+
+static VkResult
+panvk_kbase_sync_wait_many(struct vk_device *vk_device,
+                           uint32_t wait_count,
+                           const struct vk_sync_wait *waits,
+                           enum vk_sync_wait_flags wait_flags,
+                           uint64_t abs_timeout_ns)
+{
+   struct panvk_device *device =
+      container_of(vk_device, struct panvk_device, vk);
+   kbase k = panvk_kbase(vk_device);
+   bool wait_any = wait_flags & VK_SYNC_WAIT_ANY;
+   unsigned needed = wait_any ? MIN2(wait_count, 1) : wait_count;
+
+   /* First wait for the signal operations to be submitted */
+   mtx_lock(&device->kbase_sync.mutex);
+   while (panvk_kbase_sync_count_submitted(wait_count, waits) < needed) {
+      int ret;
+
+      if (abs_timeout_ns >= INT64_MAX) {
+         ret = u_cnd_monotonic_wait(&device->kbase_sync.cond,
+                                    &device->kbase_sync.mutex);
+      } else {
+         struct timespec abs_timeout_ts = {
+            .tv_sec = abs_timeout_ns / NSEC_PER_SEC,
+            .tv_nsec = abs_timeout_ns % NSEC_PER_SEC,
+         };
+
+         ret = u_cnd_monotonic_timedwait(&device->kbase_sync.cond,
+                                         &device->kbase_sync.mutex,
+                                         &abs_timeout_ts);
+      }
+
+      if (ret == thrd_timedout) {
+         mtx_unlock(&device->kbase_sync.mutex);
+         return VK_TIMEOUT;
+      } else if (ret != thrd_success) {
+         mtx_unlock(&device->kbase_sync.mutex);
+         return vk_errorf(device, VK_ERROR_UNKNOWN, "cnd_wait failed");
+      }
+   }
+
+   if (wait_flags & VK_SYNC_WAIT_PENDING) {
+      mtx_unlock(&device->kbase_sync.mutex);
+      return VK_SUCCESS;
+   }
+
+   /* Then for the GPU. Waits are done on copies of the syncobjs, so that
+    * the syncs can be reset or signaled again in the meantime. */
+   struct kbase_syncobj *syncobjs[wait_count];
+   unsigned count = 0;
+   bool done = false;
+
+   for (uint32_t i = 0; i < wait_count; i++) {
+      struct panvk_kbase_sync *sync = to_panvk_kbase_sync(waits[i].sync);
+
+      if (!sync->submitted)
+         continue;
+
+      if (sync->syncobj)
+         syncobjs[count++] = k->syncobj_dup(k, sync->syncobj);
+      else
+         done = true;
+   }
+   mtx_unlock(&device->kbase_sync.mutex);
+
+   VkResult result = VK_SUCCESS;
+
+   if (wait_any) {
+      /* Poll the syncobjs, sleeping on the first one in between */
+      while (!done && count) {
+         for (unsigned i = 0; i < count && !done; i++)
+            done = k->syncobj_wait(k, syncobjs[i], 0);
+
+         if (done)
+            break;
+
+         int64_t timeout = panvk_kbase_sync_timeout(abs_timeout_ns);
+         if (!timeout) {
+            result = VK_TIMEOUT;
+            break;
+         }
+
+         done = k->syncobj_wait(k, syncobjs[0], MIN2(timeout, 1000000));
+      }
+   } else {
+      for (unsigned i = 0; i < count; i++) {
+         if (!k->syncobj_wait(k, syncobjs[i],
+                              panvk_kbase_sync_timeout(abs_timeout_ns))) {
+            result = VK_TIMEOUT;
+            break;
+         }
+      }
+   }
+
+   for (unsigned i = 0; i < count; i++)
+      k->syncobj_destroy(k, syncobjs[i]);
+
+   return result;
+}
+
+const struct vk_sync_type panvk_kbase_sync_type = {
+   .size = sizeof(struct panvk_kbase_sync),
+   .features = VK_SYNC_FEATURE_BINARY |
+               VK_SYNC_FEATURE_GPU_WAIT |
+               VK_SYNC_FEATURE_GPU_MULTI_WAIT |
+               VK_SYNC_FEATURE_CPU_WAIT |
+               VK_SYNC_FEATURE_CPU_RESET |
+               VK_SYNC_FEATURE_CPU_SIGNAL |
+               VK_SYNC_FEATURE_WAIT_ANY |
+               VK_SYNC_FEATURE_WAIT_PENDING,
+   .init = panvk_kbase_sync_init,
+   .finish = panvk_kbase_sync_finish,
+   .signal = panvk_kbase_sync_signal,
+   .reset = panvk_kbase_sync_reset,
+   .move = panvk_kbase_sync_move,
+   .wait_many = panvk_kbase_sync_wait_many,
+};
+
+void
+panvk_kbase_sync_submitted(struct panvk_device *device,
+                           struct vk_sync *vk_sync,
+                           struct kbase_syncobj *syncobj)
+{
+   kbase k = &device->physical_device->pdev.mali;
+
+   mtx_lock(&device->kbase_sync.mutex);
+   panvk_kbase_sync_set_locked(&device->vk, to_panvk_kbase_sync(vk_sync),
+                               k->syncobj_dup(k, syncobj), true);
+   u_cnd_monotonic_broadcast(&device->kbase_sync.cond);
+   mtx_unlock(&device->kbase_sync.mutex);
+}
+
+/* Events only go through the set and reset states, the spec requires them
+ * to be set before the commands waiting on them execute */
+void
+panvk_kbase_event_set(struct panvk_device *device,
+                      struct panvk_event *event,
+                      struct kbase_syncobj *syncobj)
+{
+   kbase k = &device->physical_device->pdev.mali;
+
+   mtx_lock(&device->kbase_sync.mutex);
+   if (event->kbase_syncobj)
+      k->syncobj_destroy(k, event->kbase_syncobj);
+
+   event->kbase_syncobj = syncobj ? k->syncobj_dup(k, syncobj) : NULL;
+   event->kbase_set = true;
+   mtx_unlock(&device->kbase_sync.mutex);
+}
+
+void
+panvk_kbase_event_reset(struct panvk_device *device,
+                        struct panvk_event *event)
+{
+   kbase k = &device->physical_device->pdev.mali;
+
+   mtx_lock(&device->kbase_sync.mutex);
+   if (event->kbase_syncobj)
+      k->syncobj_destroy(k, event->kbase_syncobj);
+
+   event->kbase_syncobj = NULL;
+   event->kbase_set = false;
+   mtx_unlock(&device->kbase_sync.mutex);
+}
+
+/* Returns whether the event is set, after waiting for the GPU to set it for
+ * at most timeout_ns */
+bool
+panvk_kbase_event_wait(struct panvk_device *device,
+                       struct panvk_event *event,
+                       int64_t timeout_ns)
+{
+   kbase k = &device->physical_device->pdev.mali;
+   struct kbase_syncobj *syncobj = NULL;
+   bool set;
+
+   mtx_lock(&device->kbase_sync.mutex);
+   set = event->kbase_set;
+   if (set && event->kbase_syncobj)
+      syncobj = k->syncobj_dup(k, event->kbase_syncobj);
+   mtx_unlock(&device->kbase_sync.mutex);
+
+   if (syncobj) {
+      set = k->syncobj_wait(k, syncobj, timeout_ns);
+      k->syncobj_destroy(k, syncobj);
+   }
+
+   return set;
+}
@@ -124,9 +124,12 @@ panvk_CreateRenderPass2(VkDevice _device,
                .idx = desc->pInputAttachments[j].attachment,
                .layout = desc->pInputAttachments[j].layout,
             };
-            if (desc->pInputAttachments[j].attachment != VK_ATTACHMENT_UNUSED)
+            if (desc->pInputAttachments[j].attachment != VK_ATTACHMENT_UNUSED) {
                pass->attachments[desc->pInputAttachments[j].attachment]
                   .view_mask |= subpass->view_mask;
+               pass->attachments[desc->pInputAttachments[j].attachment]
+                  .last_used_in_subpass = i;
+            }
          }
       }
 
@@ -144,6 +147,7 @@ panvk_CreateRenderPass2(VkDevice _device,
 
             if (idx != VK_ATTACHMENT_UNUSED) {
                pass->attachments[idx].view_mask |= subpass->view_mask;
+               pass->attachments[idx].last_used_in_subpass = i;
                if (pass->attachments[idx].first_used_in_subpass == ~0) {
                   pass->attachments[idx].first_used_in_subpass = i;
                   if (pass->attachments[idx].load_op == VK_ATTACHMENT_LOAD_OP_CLEAR)
@@ -181,6 +185,7 @@ panvk_CreateRenderPass2(VkDevice _device,
       if (idx != VK_ATTACHMENT_UNUSED) {
          subpass->zs_attachment.layout = desc->pDepthStencilAttachment->layout;
          pass->attachments[idx].view_mask |= subpass->view_mask;
+         pass->attachments[idx].last_used_in_subpass = i;
 
          if (pass->attachments[idx].first_used_in_subpass == ~0) {
             pass->attachments[idx].first_used_in_subpass = i;
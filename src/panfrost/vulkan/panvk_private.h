@@ -46,8 +46,10 @@
 
 #include "c11/threads.h"
 #include "compiler/shader_enums.h"
+#include "util/cnd_monotonic.h"
 #include "util/list.h"
 #include "util/macros.h"
+#include "util/vma.h"
 #include "vk_alloc.h"
 #include "vk_buffer.h"
 #include "vk_command_buffer.h"
@@ -59,9 +61,11 @@
 #include "vk_log.h"
 #include "vk_object.h"
 #include "vk_physical_device.h"
+#include "vk_pipeline_cache.h"
 #include "vk_pipeline_layout.h"
 #include "vk_queue.h"
 #include "vk_sync.h"
+#include "vk_sync_timeline.h"
 #include "wsi_common.h"
 
 #include "drm-uapi/panfrost_drm.h"
@@ -69,6 +73,7 @@
 #include "pan_blend.h"
 #include "pan_cs.h"
 #include "pan_device.h"
+#include "pan_minmax_cache.h"
 #include "panvk_mempool.h"
 #include "pan_texture.h"
 #include "pan_scoreboard.h"
@@ -126,6 +131,14 @@ panvk_logi_v(const char *format, va_list va);
 #define PANVK_META_COPY_IMG2IMG_NUM_FORMATS 14
 #define PANVK_META_COPY_NUM_TEX_TYPES 5
 #define PANVK_META_COPY_BUF2BUF_NUM_BLKSIZES 5
+#define PANVK_META_IMG_RAW_NUM_FORMATS 8
+
+/* Format of the texels of images accessed bit for bit by compute jobs */
+struct panvk_meta_img_raw_format {
+   enum pipe_format format;
+   unsigned compsz;
+   unsigned ncomps;
+};
 
 static inline unsigned
 panvk_meta_copy_tex_type(unsigned dim, bool isarray)
@@ -148,6 +161,13 @@ struct panvk_meta {
       struct panvk_pool desc_pool;
    } blitter;
 
+   /* Binaries of the indirect draw shaders, compiled lazily by
+    * pan_indirect_draw.c under its own lock.
+    */
+   struct {
+      struct panvk_pool bin_pool;
+   } indirect_draw;
+
    struct {
       struct {
          mali_ptr shader;
@@ -155,16 +175,29 @@ struct panvk_meta {
       } color[3]; /* 3 base types */
    } clear_attachment;
 
+   /* Compute clears of images, for 1 to 4 raw components */
+   struct {
+      struct {
+         mali_ptr rsd;
+      } raw[4];
+   } clear_img;
+
    struct {
       struct {
          mali_ptr rsd;
       } buf2img[PANVK_META_COPY_BUF2IMG_NUM_FORMATS];
+      struct {
+         mali_ptr rsd;
+      } buf2img_cs[PANVK_META_IMG_RAW_NUM_FORMATS];
       struct {
          mali_ptr rsd;
       } img2buf[PANVK_META_COPY_NUM_TEX_TYPES][PANVK_META_COPY_IMG2BUF_NUM_FORMATS];
       struct {
          mali_ptr rsd;
       } img2img[2][PANVK_META_COPY_NUM_TEX_TYPES][PANVK_META_COPY_IMG2IMG_NUM_FORMATS];
+      struct {
+         mali_ptr rsd;
+      } img2img_cs[4]; /* 1 to 4 raw components */
       struct {
          mali_ptr rsd;
       } buf2buf[PANVK_META_COPY_BUF2BUF_NUM_BLKSIZES];
@@ -189,7 +222,12 @@ struct panvk_physical_device {
    uint8_t cache_uuid[VK_UUID_SIZE];
 
    struct vk_sync_type drm_syncobj_type;
-   const struct vk_sync_type *sync_types[2];
+   struct vk_sync_timeline_type sync_timeline_type;
+   const struct vk_sync_type *sync_types[3];
+
+   /* Whether DRM_IOCTL_SYNCOBJ_TRANSFER is supported, which comes with
+    * timeline syncobjs */
+   bool has_syncobj_transfer;
 
    struct wsi_device wsi_device;
    struct panvk_meta meta;
@@ -205,6 +243,7 @@ enum panvk_debug_flags {
    PANVK_DEBUG_AFBC = 1 << 4,
    PANVK_DEBUG_LINEAR = 1 << 5,
    PANVK_DEBUG_DUMP = 1 << 6,
+   PANVK_DEBUG_SUBGROUPS = 1 << 7,
 };
 
 struct panvk_instance {
@@ -227,11 +266,8 @@ panvk_physical_device_api_version(struct panvk_physical_device *dev);
 bool
 panvk_physical_device_extension_supported(struct panvk_physical_device *dev,
                                        const char *name);
-
-struct panvk_pipeline_cache {
-   struct vk_object_base base;
-   VkAllocationCallbacks alloc;
-};
+bool
+panvk_physical_device_has_subgroups(const struct panvk_physical_device *dev);
 
 #define PANVK_MAX_QUEUE_FAMILIES 1
 
@@ -239,6 +275,9 @@ struct panvk_queue {
    struct vk_queue vk;
    struct panvk_device *device;
    uint32_t sync;
+
+   /* Atoms submitted by the queue, on kbase */
+   struct kbase_syncobj *kbase_syncobj;
 };
 
 struct panvk_device {
@@ -253,6 +292,22 @@ struct panvk_device {
 
    struct panvk_physical_device *physical_device;
    int _lost;
+
+   /* Used for pipelines created without a VkPipelineCache */
+   struct vk_pipeline_cache *mem_cache;
+
+   /* Protects the state of syncs and events on kbase, the condition is
+    * signaled when a sync is */
+   struct {
+      mtx_t mutex;
+      struct u_cnd_monotonic cond;
+   } kbase_sync;
+
+   /* Slabs the small memory allocations are carved from */
+   struct {
+      mtx_t mutex;
+      struct list_head slabs;
+   } mem_heap;
 };
 
 VkResult _panvk_device_set_lost(struct panvk_device *device,
@@ -290,9 +345,32 @@ struct panvk_batch {
    } tiler;
    struct pan_tls_info tlsinfo;
    unsigned wls_total_size;
+
+   /* Query pool written by the WRITE_VALUE jobs of the batch, if any */
+   struct panfrost_bo *query_bo;
+
+   /* State shared by the draws of the batch patched on the GPU, see
+    * panfrost_emit_indirect_draw(). Their varyings are allocated from the
+    * device varying heap when indirect_draw_ctx.gpu is set.
+    */
+   struct panfrost_ptr indirect_draw_ctx;
+   unsigned indirect_draw_job_id;
+
+   /* Descriptors those draws patch in place, as panvk_patched_desc
+    * entries, to restore before re-issuing the batch.
+    */
+   struct util_dynarray patched_descs;
    bool issued;
 };
 
+/* Followed by size bytes of the original contents of the descriptors at
+ * cpu, padded to 8 bytes.
+ */
+struct panvk_patched_desc {
+   void *cpu;
+   size_t size;
+};
+
 enum panvk_event_op_type {
    PANVK_EVENT_OP_SET,
    PANVK_EVENT_OP_RESET,
@@ -304,9 +382,50 @@ struct panvk_event_op {
    struct panvk_event *event;
 };
 
+/* Bounds of the index buffer ranges searched on the CPU, with and without
+ * primitive restart, and the byte range written by the transfer commands of
+ * the command buffer. The latter can't be read when recording and must be
+ * searched on the GPU.
+ */
+struct panvk_index_range_cache {
+   struct panfrost_minmax_cache minmax[2];
+   uint64_t written_start, written_end;
+};
+
+/* Allocations up to PANVK_MEM_SUBALLOC_MAX_SIZE which aren't shared with
+ * other processes are suballocated from slabs of PANVK_MEM_SLAB_SIZE, so that
+ * they don't each create a kernel object and add a handle to the submits.
+ */
+#define PANVK_MEM_SLAB_SIZE (2 * 1024 * 1024)
+#define PANVK_MEM_SUBALLOC_MAX_SIZE (64 * 1024)
+
+/* Covers the alignment of all the resources */
+#define PANVK_MEM_SUBALLOC_ALIGN 4096
+
+/* Memory types. Lazily allocated memory is only offered to transient
+ * attachments, and gets pages when the GPU first touches them. */
+#define PANVK_MEM_TYPE_DEFAULT 0
+#define PANVK_MEM_TYPE_LAZY 1
+
+struct panvk_mem_slab {
+   struct list_head link;
+   struct panfrost_bo *bo;
+
+   /* Offsets in the BO, biased by PANVK_MEM_SUBALLOC_ALIGN since zero
+    * means failure to util_vma_heap_alloc()
+    */
+   struct util_vma_heap heap;
+   unsigned alloc_count;
+};
+
 struct panvk_device_memory {
    struct vk_object_base base;
    struct panfrost_bo *bo;
+
+   /* Location of the memory in bo, for suballocated memory */
+   struct panvk_mem_slab *slab;
+   uint64_t offset;
+   uint64_t size;
 };
 
 struct panvk_buffer_desc {
@@ -327,7 +446,13 @@ struct panvk_descriptor_set {
    void *img_attrib_bufs;
    uint32_t *img_fmts;
 
+   /* Descriptor UBO contents, in desc_bo if the set owns a BO, or in the
+    * memory of a linear pool or of a command buffer otherwise */
+   struct panfrost_ptr desc_ubo;
    struct panfrost_bo *desc_bo;
+
+   /* Node in the pool's list of sets */
+   struct list_head node;
 };
 
 #define MAX_SETS 4
@@ -478,7 +603,38 @@ struct panvk_descriptor_pool {
    struct vk_object_base base;
    struct panvk_desc_pool_counters max;
    struct panvk_desc_pool_counters cur;
-   struct panvk_descriptor_set *sets;
+
+   /* Sets allocated from the pool, destroyed when it is reset */
+   struct list_head sets;
+
+   /* Pools created without VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+    * can't free individual sets. Their sets are bump-allocated from host
+    * blocks and from desc_mem, which are recycled as a whole on reset.
+    */
+   bool linear;
+   struct {
+      struct util_dynarray blocks;
+      void *cur;
+      size_t offset;
+      size_t size;
+   } host;
+   struct panvk_bo_pool desc_bo_pool;
+   struct panvk_pool desc_mem;
+};
+
+void *
+panvk_descriptor_pool_alloc_host(struct panvk_device *device,
+                                 struct panvk_descriptor_pool *pool,
+                                 size_t size);
+
+/* Storage of the descriptor set pushed with vkCmdPushDescriptorSetKHR() on
+ * a bind point, laid out like the host memory of other sets. The descriptor
+ * UBO is allocated from the command buffer on each push.
+ */
+struct panvk_push_descriptor_set {
+   const struct panvk_descriptor_set_layout *layout;
+   void *host;
+   size_t host_size;
 };
 
 struct panvk_buffer {
@@ -716,6 +872,10 @@ struct panvk_cmd_state {
    const struct panvk_framebuffer *framebuffer;
    VkRect2D render_area;
 
+   /* Render pass, framebuffer and clear values of vkCmdBeginRendering, in a
+    * single allocation */
+   void *rendering;
+
    struct panvk_clear_value *clear;
 
    mali_ptr vpd;
@@ -735,6 +895,7 @@ struct panvk_cmd_pool {
 struct panvk_cmd_bind_point_state {
    struct panvk_descriptor_state desc_state;
    const struct panvk_pipeline *pipeline;
+   struct panvk_push_descriptor_set *push_set;
 };
 
 struct panvk_cmd_buffer {
@@ -753,9 +914,18 @@ struct panvk_cmd_buffer {
 
    uint8_t push_constants[MAX_PUSH_CONSTANTS_SIZE];
    VkShaderStageFlags push_constant_stages;
-   struct panvk_descriptor_set meta_push_descriptors;
 
    struct panvk_cmd_bind_point_state bind_points[MAX_BIND_POINTS];
+
+   /* Fragment RSDs of pipelines with dynamic state, merged with the dynamic
+    * state they were emitted for. Allocated from desc_pool, so dropped with
+    * it on reset. */
+   struct hash_table *fs_rsd_cache;
+
+   /* Min/max index of the index buffer ranges drawn by this command buffer,
+    * keyed by panvk_buffer, see panvk_index_range_cache.
+    */
+   struct hash_table *index_range_cache;
 };
 
 #define panvk_cmd_get_bind_point_state(cmdbuf, bindpoint) \
@@ -770,12 +940,19 @@ struct panvk_cmd_buffer {
 struct panvk_batch *
 panvk_cmd_open_batch(struct panvk_cmd_buffer *cmdbuf);
 
+void
+panvk_cmd_invalidate_descriptors(struct panvk_descriptor_state *desc_state,
+                                 const struct panvk_descriptor_set_layout *layout);
+
 void
 panvk_cmd_fb_info_set_subpass(struct panvk_cmd_buffer *cmdbuf);
 
 void
 panvk_cmd_fb_info_init(struct panvk_cmd_buffer *cmdbuf);
 
+void
+panvk_cmd_fb_info_set_discards(struct panvk_cmd_buffer *cmdbuf);
+
 void
 panvk_cmd_preload_fb_after_batch_split(struct panvk_cmd_buffer *cmdbuf);
 
@@ -787,9 +964,52 @@ panvk_pack_color(struct panvk_clear_value *out,
 struct panvk_event {
    struct vk_object_base base;
    uint32_t syncobj;
+
+   /* On kbase, the atoms which set the event, if it's not set on the CPU */
+   struct kbase_syncobj *kbase_syncobj;
+   bool kbase_set;
 };
 
+extern const struct vk_sync_type panvk_kbase_sync_type;
+
+void
+panvk_kbase_device_init(struct panvk_device *device);
+void
+panvk_kbase_device_finish(struct panvk_device *device);
+
+/* Makes a sync signal when the atoms of the syncobj complete */
+void
+panvk_kbase_sync_submitted(struct panvk_device *device,
+                           struct vk_sync *sync,
+                           struct kbase_syncobj *syncobj);
+
+void
+panvk_kbase_event_set(struct panvk_device *device,
+                      struct panvk_event *event,
+                      struct kbase_syncobj *syncobj);
+void
+panvk_kbase_event_reset(struct panvk_device *device,
+                        struct panvk_event *event);
+bool
+panvk_kbase_event_wait(struct panvk_device *device,
+                       struct panvk_event *event,
+                       int64_t timeout_ns);
+
+/* Queries are 64-bit values written by the GPU, zero meaning unavailable */
+struct panvk_query_pool {
+   struct vk_object_base base;
+   VkQueryType type;
+   uint32_t query_count;
+   struct panfrost_bo *bo;
+};
+
+/* Compiled shaders are pipeline cache objects, keyed on the SHA-1 of
+ * everything that affects the generated code.
+ */
 struct panvk_shader {
+   struct vk_pipeline_cache_object base;
+   unsigned char sha1[20];
+
    struct pan_shader_info info;
    struct util_dynarray binary;
    unsigned sysval_ubo;
@@ -797,20 +1017,16 @@ struct panvk_shader {
    bool has_img_access;
 };
 
+extern const struct vk_pipeline_cache_object_ops panvk_shader_ops;
+
 struct panvk_shader *
-panvk_shader_create(struct panvk_device *dev,
-                    gl_shader_stage stage,
-                    const VkPipelineShaderStageCreateInfo *stage_info,
-                    const struct panvk_pipeline_layout *layout,
-                    unsigned sysval_ubo,
-                    struct pan_blend_state *blend_state,
-                    bool static_blend_constants,
-                    const VkAllocationCallbacks *alloc);
+panvk_shader_alloc(struct panvk_device *dev, const unsigned char *sha1);
 
-void
-panvk_shader_destroy(struct panvk_device *dev,
-                     struct panvk_shader *shader,
-                     const VkAllocationCallbacks *alloc);
+static inline void
+panvk_shader_unref(struct panvk_shader *shader)
+{
+   vk_pipeline_cache_object_unref(&shader->base);
+}
 
 #define RSD_WORDS 16
 #define BLEND_DESC_WORDS 4
@@ -1021,6 +1237,7 @@ struct panvk_render_pass_attachment {
    VkImageLayout final_layout;
    unsigned view_mask;
    unsigned first_used_in_subpass;
+   unsigned last_used_in_subpass;
 };
 
 struct panvk_render_pass {
@@ -1051,9 +1268,9 @@ VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_event, base, VkEvent, VK_OBJECT_TYPE_EVENT)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_framebuffer, base, VkFramebuffer, VK_OBJECT_TYPE_FRAMEBUFFER)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_image, vk.base, VkImage, VK_OBJECT_TYPE_IMAGE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_image_view, vk.base, VkImageView, VK_OBJECT_TYPE_IMAGE_VIEW);
-VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_pipeline_cache, base, VkPipelineCache, VK_OBJECT_TYPE_PIPELINE_CACHE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_pipeline, base, VkPipeline, VK_OBJECT_TYPE_PIPELINE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_pipeline_layout, vk.base, VkPipelineLayout, VK_OBJECT_TYPE_PIPELINE_LAYOUT)
+VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_query_pool, base, VkQueryPool, VK_OBJECT_TYPE_QUERY_POOL)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_render_pass, base, VkRenderPass, VK_OBJECT_TYPE_RENDER_PASS)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_sampler, base, VkSampler, VK_OBJECT_TYPE_SAMPLER)
 
@@ -1074,6 +1291,10 @@ do { \
 #elif PAN_ARCH == 7
 #define panvk_per_arch(name) panvk_arch_name(name, v7)
 #endif
+
+/* The indirect draw shaders of pan_indirect_draw.c are only built for v7 */
+#define PANVK_GPU_INDIRECTS (PAN_ARCH == 7)
+
 #include "panvk_vX_cmd_buffer.h"
 #include "panvk_vX_cs.h"
 #include "panvk_vX_device.h"
@@ -1111,7 +1332,7 @@ panvk_per_arch(shader_create)(struct panvk_device *dev,
                               unsigned sysval_ubo,
                               struct pan_blend_state *blend_state,
                               bool static_blend_constants,
-                              const VkAllocationCallbacks *alloc);
+                              struct vk_pipeline_cache *cache);
 struct nir_shader;
 
 bool
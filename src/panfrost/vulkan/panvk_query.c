@@ -23,13 +23,35 @@
 
 #include "panvk_private.h"
 
+#include "pan_bo.h"
+
 VkResult
 panvk_CreateQueryPool(VkDevice _device,
                       const VkQueryPoolCreateInfo *pCreateInfo,
                       const VkAllocationCallbacks *pAllocator,
                       VkQueryPool *pQueryPool)
 {
-   panvk_stub();
+   VK_FROM_HANDLE(panvk_device, device, _device);
+   struct panvk_query_pool *pool =
+      vk_object_zalloc(&device->vk, pAllocator, sizeof(*pool),
+                       VK_OBJECT_TYPE_QUERY_POOL);
+   if (!pool)
+      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+
+   pool->type = pCreateInfo->queryType;
+   pool->query_count = pCreateInfo->queryCount;
+   pool->bo = panfrost_bo_create(&device->physical_device->pdev,
+                                 pool->query_count * sizeof(uint64_t), 0,
+                                 "Query pool");
+   if (!pool->bo) {
+      vk_object_free(&device->vk, pAllocator, pool);
+      return vk_error(device, VK_ERROR_OUT_OF_DEVICE_MEMORY);
+   }
+
+   /* Queries start out unavailable */
+   memset(pool->bo->ptr.cpu, 0, pool->query_count * sizeof(uint64_t));
+
+   *pQueryPool = panvk_query_pool_to_handle(pool);
    return VK_SUCCESS;
 }
 
@@ -38,7 +60,24 @@ panvk_DestroyQueryPool(VkDevice _device,
                        VkQueryPool _pool,
                        const VkAllocationCallbacks *pAllocator)
 {
-   panvk_stub();
+   VK_FROM_HANDLE(panvk_device, device, _device);
+   VK_FROM_HANDLE(panvk_query_pool, pool, _pool);
+
+   if (!pool)
+      return;
+
+   panfrost_bo_unreference(pool->bo);
+   vk_object_free(&device->vk, pAllocator, pool);
+}
+
+static void
+panvk_write_query_value(void *dst, unsigned index, uint64_t value,
+                        VkQueryResultFlags flags)
+{
+   if (flags & VK_QUERY_RESULT_64_BIT)
+      ((uint64_t *)dst)[index] = value;
+   else
+      ((uint32_t *)dst)[index] = value;
 }
 
 VkResult
@@ -51,8 +90,34 @@ panvk_GetQueryPoolResults(VkDevice _device,
                           VkDeviceSize stride,
                           VkQueryResultFlags flags)
 {
-   panvk_stub();
-   return VK_SUCCESS;
+   VK_FROM_HANDLE(panvk_query_pool, pool, queryPool);
+   const uint64_t *values = pool->bo->ptr.cpu;
+   VkResult result = VK_SUCCESS;
+
+   assert(firstQuery + queryCount <= pool->query_count);
+
+   /* The GPU access of the BO is only tracked once submitted, in which case
+    * this waits for the queries to be written */
+   if (flags & VK_QUERY_RESULT_WAIT_BIT)
+      panfrost_bo_wait(pool->bo, INT64_MAX, true);
+
+   for (uint32_t i = 0; i < queryCount; i++) {
+      void *dst = (uint8_t *)pData + i * stride;
+      uint64_t value = values[firstQuery + i];
+
+      /* The timestamp never reads zero once the system counter runs */
+      bool available = value != 0;
+
+      if (available || (flags & VK_QUERY_RESULT_PARTIAL_BIT))
+         panvk_write_query_value(dst, 0, value, flags);
+      else
+         result = VK_NOT_READY;
+
+      if (flags & VK_QUERY_RESULT_WITH_AVAILABILITY_BIT)
+         panvk_write_query_value(dst, 1, available, flags);
+   }
+
+   return result;
 }
 
 void
@@ -68,15 +133,6 @@ panvk_CmdCopyQueryPoolResults(VkCommandBuffer commandBuffer,
    panvk_stub();
 }
 
-void
-panvk_CmdResetQueryPool(VkCommandBuffer commandBuffer,
-                        VkQueryPool queryPool,
-                        uint32_t firstQuery,
-                        uint32_t queryCount)
-{
-   panvk_stub();
-}
-
 void
 panvk_CmdBeginQuery(VkCommandBuffer commandBuffer,
                     VkQueryPool queryPool,
@@ -93,12 +149,3 @@ panvk_CmdEndQuery(VkCommandBuffer commandBuffer,
 {
    panvk_stub();
 }
-
-void
-panvk_CmdWriteTimestamp2(VkCommandBuffer commandBuffer,
-                         VkPipelineStageFlags2 stage,
-                         VkQueryPool queryPool,
-                         uint32_t query)
-{
-   panvk_stub();
-}
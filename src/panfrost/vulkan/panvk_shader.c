@@ -28,13 +28,95 @@
 
 #include "pan_shader.h"
 
+#include "util/blob.h"
 #include "vk_util.h"
 
-void
-panvk_shader_destroy(struct panvk_device *dev,
-                     struct panvk_shader *shader,
-                     const VkAllocationCallbacks *alloc)
+struct panvk_shader *
+panvk_shader_alloc(struct panvk_device *dev, const unsigned char *sha1)
 {
+   struct panvk_shader *shader =
+      vk_zalloc(&dev->vk.alloc, sizeof(*shader), 8,
+                VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!shader)
+      return NULL;
+
+   memcpy(shader->sha1, sha1, sizeof(shader->sha1));
+   vk_pipeline_cache_object_init(&dev->vk, &shader->base, &panvk_shader_ops,
+                                 shader->sha1, sizeof(shader->sha1));
+   util_dynarray_init(&shader->binary, NULL);
+   return shader;
+}
+
+static void
+panvk_shader_destroy(struct vk_pipeline_cache_object *object)
+{
+   struct panvk_shader *shader =
+      container_of(object, struct panvk_shader, base);
+
    util_dynarray_fini(&shader->binary);
-   vk_free2(&dev->vk.alloc, alloc, shader);
+   vk_pipeline_cache_object_finish(&shader->base);
+   vk_free(&object->device->alloc, shader);
+}
+
+static bool
+panvk_shader_serialize(struct vk_pipeline_cache_object *object,
+                       struct blob *blob)
+{
+   struct panvk_shader *shader =
+      container_of(object, struct panvk_shader, base);
+
+   blob_write_bytes(blob, &shader->info, sizeof(shader->info));
+   blob_write_uint32(blob, shader->sysval_ubo);
+   blob_write_bytes(blob, &shader->local_size, sizeof(shader->local_size));
+   blob_write_uint8(blob, shader->has_img_access);
+   blob_write_uint32(blob, shader->binary.size);
+   blob_write_bytes(blob, shader->binary.data, shader->binary.size);
+
+   return !blob->out_of_memory;
 }
+
+static struct vk_pipeline_cache_object *
+panvk_shader_deserialize(struct vk_device *vk_dev,
+                         const void *key_data, size_t key_size,
+                         struct blob_reader *blob)
+{
+   struct panvk_device *dev = container_of(vk_dev, struct panvk_device, vk);
+
+   if (key_size != sizeof(((struct panvk_shader *)NULL)->sha1))
+      return NULL;
+
+   struct panvk_shader *shader = panvk_shader_alloc(dev, key_data);
+   if (!shader)
+      return NULL;
+
+   blob_copy_bytes(blob, &shader->info, sizeof(shader->info));
+   shader->sysval_ubo = blob_read_uint32(blob);
+   blob_copy_bytes(blob, &shader->local_size, sizeof(shader->local_size));
+   shader->has_img_access = blob_read_uint8(blob);
+
+   uint32_t binary_size = blob_read_uint32(blob);
+   const void *binary = blob_read_bytes(blob, binary_size);
+
+   if (blob->overrun)
+      goto err_destroy;
+
+   /* The optimized shader can be empty */
+   if (binary_size) {
+      if (!util_dynarray_resize_bytes(&shader->binary, binary_size, 1))
+         goto err_destroy;
+
+      memcpy(shader->binary.data, binary, binary_size);
+   }
+
+   return &shader->base;
+
+err_destroy:
+   panvk_shader_destroy(&shader->base);
+   return NULL;
+}
+
+const struct vk_pipeline_cache_object_ops panvk_shader_ops = {
+   .serialize = panvk_shader_serialize,
+   .deserialize = panvk_shader_deserialize,
+   .destroy = panvk_shader_destroy,
+};
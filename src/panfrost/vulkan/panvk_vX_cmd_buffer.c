@@ -34,7 +34,11 @@
 #include "pan_blitter.h"
 #include "pan_cs.h"
 #include "pan_encoder.h"
+#include "pan_indirect_draw.h"
+#include "pan_minmax_cache.h"
 
+#include "util/hash_table.h"
+#include "util/ralloc.h"
 #include "util/rounding.h"
 #include "util/u_pack_color.h"
 #include "vk_format.h"
@@ -150,6 +154,7 @@ panvk_per_arch(CmdNextSubpass2)(VkCommandBuffer commandBuffer,
 {
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
 
+   panvk_cmd_fb_info_set_discards(cmdbuf);
    panvk_per_arch(cmd_close_batch)(cmdbuf);
 
    cmdbuf->state.subpass++;
@@ -376,6 +381,101 @@ panvk_cmd_prepare_samplers(struct panvk_cmd_buffer *cmdbuf,
    desc_state->samplers = samplers.gpu;
 }
 
+/* Dynamic state a fragment RSD depends on. State which isn't dynamic in the
+ * pipeline is left zeroed, so that it doesn't cause spurious misses. */
+struct panvk_fs_rsd_key {
+   const struct panvk_pipeline *pipeline;
+   float depth_bias[3];
+   float blend_constants[4];
+   uint8_t stencil[6];
+};
+
+static uint32_t
+panvk_fs_rsd_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, sizeof(struct panvk_fs_rsd_key));
+}
+
+static bool
+panvk_fs_rsd_key_equal(const void *a, const void *b)
+{
+   return !memcmp(a, b, sizeof(struct panvk_fs_rsd_key));
+}
+
+static void
+panvk_fs_rsd_key_init(const struct panvk_pipeline *pipeline,
+                      const struct panvk_cmd_state *state,
+                      struct panvk_fs_rsd_key *key)
+{
+   memset(key, 0, sizeof(*key));
+   key->pipeline = pipeline;
+
+   if (pipeline->dynamic_state_mask & (1 << VK_DYNAMIC_STATE_DEPTH_BIAS)) {
+      key->depth_bias[0] = state->rast.depth_bias.constant_factor;
+      key->depth_bias[1] = state->rast.depth_bias.slope_factor;
+      key->depth_bias[2] = state->rast.depth_bias.clamp;
+   }
+
+   if (pipeline->dynamic_state_mask & (1 << VK_DYNAMIC_STATE_BLEND_CONSTANTS))
+      memcpy(key->blend_constants, state->blend.constants,
+             sizeof(key->blend_constants));
+
+   if (pipeline->dynamic_state_mask & (1 << VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK)) {
+      key->stencil[0] = state->zs.s_front.compare_mask;
+      key->stencil[1] = state->zs.s_back.compare_mask;
+   }
+
+   if (pipeline->dynamic_state_mask & (1 << VK_DYNAMIC_STATE_STENCIL_WRITE_MASK)) {
+      key->stencil[2] = state->zs.s_front.write_mask;
+      key->stencil[3] = state->zs.s_back.write_mask;
+   }
+
+   if (pipeline->dynamic_state_mask & (1 << VK_DYNAMIC_STATE_STENCIL_REFERENCE)) {
+      key->stencil[4] = state->zs.s_front.ref;
+      key->stencil[5] = state->zs.s_back.ref;
+   }
+}
+
+static mali_ptr
+panvk_emit_dyn_fs_rsd(struct panvk_cmd_buffer *cmdbuf,
+                      const struct panvk_pipeline *pipeline)
+{
+   struct panfrost_ptr rsd =
+      pan_pool_alloc_desc_aggregate(&cmdbuf->desc_pool.base,
+                                    PAN_DESC(RENDERER_STATE),
+                                    PAN_DESC_ARRAY(pipeline->blend.state.rt_count,
+                                                   BLEND));
+
+   struct mali_renderer_state_packed rsd_dyn;
+   struct mali_renderer_state_packed *rsd_templ =
+      (struct mali_renderer_state_packed *)&pipeline->fs.rsd_template;
+
+   STATIC_ASSERT(sizeof(pipeline->fs.rsd_template) >= sizeof(*rsd_templ));
+
+   panvk_per_arch(emit_dyn_fs_rsd)(pipeline, &cmdbuf->state, &rsd_dyn);
+   pan_merge(rsd_dyn, (*rsd_templ), RENDERER_STATE);
+   memcpy(rsd.cpu, &rsd_dyn, sizeof(rsd_dyn));
+
+   void *bd = rsd.cpu + pan_size(RENDERER_STATE);
+   for (unsigned i = 0; i < pipeline->blend.state.rt_count; i++) {
+      if (pipeline->blend.constant[i].index != (uint8_t)~0) {
+         struct mali_blend_packed bd_dyn;
+         struct mali_blend_packed *bd_templ =
+            (struct mali_blend_packed *)&pipeline->blend.bd_template[i];
+
+         STATIC_ASSERT(sizeof(pipeline->blend.bd_template[0]) >= sizeof(*bd_templ));
+         panvk_per_arch(emit_blend_constant)(cmdbuf->device, pipeline, i,
+                                             cmdbuf->state.blend.constants,
+                                             &bd_dyn);
+         pan_merge(bd_dyn, (*bd_templ), BLEND);
+         memcpy(bd, &bd_dyn, sizeof(bd_dyn));
+      }
+      bd += pan_size(BLEND);
+   }
+
+   return rsd.gpu;
+}
+
 static void
 panvk_draw_prepare_fs_rsd(struct panvk_cmd_buffer *cmdbuf,
                           struct panvk_draw_info *draw)
@@ -388,41 +488,35 @@ panvk_draw_prepare_fs_rsd(struct panvk_cmd_buffer *cmdbuf,
       return;
    }
 
+   /* Engines tend to cycle between a few pipelines and dynamic states, so
+    * look for a RSD emitted earlier in the command buffer before packing a
+    * new one. */
    if (!cmdbuf->state.fs_rsd) {
-      struct panfrost_ptr rsd =
-         pan_pool_alloc_desc_aggregate(&cmdbuf->desc_pool.base,
-                                       PAN_DESC(RENDERER_STATE),
-                                       PAN_DESC_ARRAY(pipeline->blend.state.rt_count,
-                                                      BLEND));
-
-      struct mali_renderer_state_packed rsd_dyn;
-      struct mali_renderer_state_packed *rsd_templ =
-         (struct mali_renderer_state_packed *)&pipeline->fs.rsd_template;
-
-      STATIC_ASSERT(sizeof(pipeline->fs.rsd_template) >= sizeof(*rsd_templ));
-
-      panvk_per_arch(emit_dyn_fs_rsd)(pipeline, &cmdbuf->state, &rsd_dyn);
-      pan_merge(rsd_dyn, (*rsd_templ), RENDERER_STATE);
-      memcpy(rsd.cpu, &rsd_dyn, sizeof(rsd_dyn));
-
-      void *bd = rsd.cpu + pan_size(RENDERER_STATE);
-      for (unsigned i = 0; i < pipeline->blend.state.rt_count; i++) {
-         if (pipeline->blend.constant[i].index != (uint8_t)~0) {
-            struct mali_blend_packed bd_dyn;
-            struct mali_blend_packed *bd_templ =
-               (struct mali_blend_packed *)&pipeline->blend.bd_template[i];
-
-            STATIC_ASSERT(sizeof(pipeline->blend.bd_template[0]) >= sizeof(*bd_templ));
-            panvk_per_arch(emit_blend_constant)(cmdbuf->device, pipeline, i,
-                                                cmdbuf->state.blend.constants,
-                                                &bd_dyn);
-            pan_merge(bd_dyn, (*bd_templ), BLEND);
-            memcpy(bd, &bd_dyn, sizeof(bd_dyn));
-         }
-         bd += pan_size(BLEND);
+      struct panvk_fs_rsd_key key;
+
+      panvk_fs_rsd_key_init(pipeline, &cmdbuf->state, &key);
+
+      if (!cmdbuf->fs_rsd_cache) {
+         cmdbuf->fs_rsd_cache =
+            _mesa_hash_table_create(NULL, panvk_fs_rsd_key_hash,
+                                    panvk_fs_rsd_key_equal);
       }
 
-      cmdbuf->state.fs_rsd = rsd.gpu;
+      uint32_t hash = panvk_fs_rsd_key_hash(&key);
+      struct hash_entry *entry =
+         _mesa_hash_table_search_pre_hashed(cmdbuf->fs_rsd_cache, hash, &key);
+
+      if (entry) {
+         cmdbuf->state.fs_rsd = (mali_ptr)(uintptr_t)entry->data;
+      } else {
+         struct panvk_fs_rsd_key *stored =
+            ralloc(cmdbuf->fs_rsd_cache, struct panvk_fs_rsd_key);
+
+         *stored = key;
+         cmdbuf->state.fs_rsd = panvk_emit_dyn_fs_rsd(cmdbuf, pipeline);
+         _mesa_hash_table_insert_pre_hashed(cmdbuf->fs_rsd_cache, hash, stored,
+                                            (void *)(uintptr_t)cmdbuf->state.fs_rsd);
+      }
    }
 
    draw->fs_rsd = cmdbuf->state.fs_rsd;
@@ -475,6 +569,21 @@ panvk_draw_prepare_tiler_context(struct panvk_cmd_buffer *cmdbuf,
    draw->tiler_ctx = &batch->tiler.ctx;
 }
 
+static float
+panvk_draw_line_width(const struct panvk_cmd_buffer *cmdbuf)
+{
+   const struct panvk_pipeline *pipeline = panvk_cmd_get_pipeline(cmdbuf, GRAPHICS);
+
+   if (pipeline->ia.topology == MALI_DRAW_MODE_LINES ||
+       pipeline->ia.topology == MALI_DRAW_MODE_LINE_STRIP ||
+       pipeline->ia.topology == MALI_DRAW_MODE_LINE_LOOP) {
+      return pipeline->dynamic_state_mask & PANVK_DYNAMIC_LINE_WIDTH ?
+             cmdbuf->state.rast.line_width : pipeline->rast.line_width;
+   }
+
+   return 1.0f;
+}
+
 static void
 panvk_draw_prepare_varyings(struct panvk_cmd_buffer *cmdbuf,
                             struct panvk_draw_info *draw)
@@ -505,13 +614,8 @@ panvk_draw_prepare_varyings(struct panvk_cmd_buffer *cmdbuf,
    if (pipeline->ia.writes_point_size) {
       draw->psiz = varyings->buf[varyings->varying[VARYING_SLOT_PSIZ].buf].address +
                        varyings->varying[VARYING_SLOT_POS].offset;
-   } else if (pipeline->ia.topology == MALI_DRAW_MODE_LINES ||
-              pipeline->ia.topology == MALI_DRAW_MODE_LINE_STRIP ||
-              pipeline->ia.topology == MALI_DRAW_MODE_LINE_LOOP) {
-      draw->line_width = pipeline->dynamic_state_mask & PANVK_DYNAMIC_LINE_WIDTH ?
-                         cmdbuf->state.rast.line_width : pipeline->rast.line_width;
    } else {
-      draw->line_width = 1.0f;
+      draw->line_width = panvk_draw_line_width(cmdbuf);
    }
    draw->varying_bufs = bufs.gpu;
 
@@ -719,6 +823,26 @@ panvk_draw_prepare_tiler_job(struct panvk_cmd_buffer *cmdbuf,
    panvk_per_arch(emit_tiler_job)(pipeline, draw, ptr.cpu);
 }
 
+static void
+panvk_draw_add_jobs(struct panvk_cmd_buffer *cmdbuf,
+                    struct panvk_draw_info *draw)
+{
+   const struct panvk_pipeline *pipeline =
+      panvk_cmd_get_pipeline(cmdbuf, GRAPHICS);
+   struct panvk_batch *batch = cmdbuf->state.batch;
+
+   unsigned vjob_id =
+      panfrost_add_job(&cmdbuf->desc_pool.base, &batch->scoreboard,
+                       MALI_JOB_TYPE_VERTEX, false, false, 0, 0,
+                       &draw->jobs.vertex, false);
+
+   if (pipeline->rast.enable) {
+      panfrost_add_job(&cmdbuf->desc_pool.base, &batch->scoreboard,
+                       MALI_JOB_TYPE_TILER, false, false, vjob_id, 0,
+                       &draw->jobs.tiler, false);
+   }
+}
+
 static void
 panvk_cmd_draw(struct panvk_cmd_buffer *cmdbuf,
                struct panvk_draw_info *draw)
@@ -773,20 +897,276 @@ panvk_cmd_draw(struct panvk_cmd_buffer *cmdbuf,
    batch->tlsinfo.tls.size = MAX2(pipeline->tls_size, batch->tlsinfo.tls.size);
    assert(!pipeline->wls_size);
 
-   unsigned vjob_id =
-      panfrost_add_job(&cmdbuf->desc_pool.base, &batch->scoreboard,
-                       MALI_JOB_TYPE_VERTEX, false, false, 0, 0,
-                       &draw->jobs.vertex, false);
+   panvk_draw_add_jobs(cmdbuf, draw);
 
-   if (pipeline->rast.enable) {
-      panfrost_add_job(&cmdbuf->desc_pool.base, &batch->scoreboard,
-                       MALI_JOB_TYPE_TILER, false, false, vjob_id, 0,
-                       &draw->jobs.tiler, false);
+   /* Clear the dirty flags all at once */
+   desc_state->dirty = cmdbuf->state.dirty = 0;
+}
+
+#if PANVK_GPU_INDIRECTS
+/* Indexed draws at least this large whose min/max index isn't cached are
+ * searched on the GPU */
+#define PANVK_GPU_MINMAX_MIN_COUNT 4096
+
+static void
+panvk_batch_save_patched_desc(struct panvk_batch *batch, void *cpu,
+                              size_t size)
+{
+   struct panvk_patched_desc desc = {
+      .cpu = cpu,
+      .size = size,
+   };
+
+   util_dynarray_append(&batch->patched_descs, struct panvk_patched_desc, desc);
+   memcpy(util_dynarray_grow_bytes(&batch->patched_descs, 1, ALIGN_POT(size, 8)),
+          cpu, size);
+}
+
+static void
+panvk_draw_prepare_indirect_varyings(struct panvk_cmd_buffer *cmdbuf,
+                                     struct panvk_draw_info *draw)
+{
+   const struct panvk_pipeline *pipeline = panvk_cmd_get_pipeline(cmdbuf, GRAPHICS);
+   const struct panvk_varyings_info *varyings = &cmdbuf->state.varyings;
+   struct panfrost_ptr bufs =
+      pan_pool_alloc_desc_array(&cmdbuf->desc_pool.base,
+                                PANVK_VARY_BUF_MAX + 1,
+                                ATTRIBUTE_BUFFER);
+
+   panvk_per_arch(emit_indirect_varying_bufs)(varyings, bufs.cpu);
+
+   /* We need an empty entry to stop prefetching on Bifrost */
+   memset(bufs.cpu + (pan_size(ATTRIBUTE_BUFFER) * PANVK_VARY_BUF_MAX), 0,
+          pan_size(ATTRIBUTE_BUFFER));
+
+   /* The position and point size pointers are patched once the buffers are
+    * allocated */
+   if (!pipeline->ia.writes_point_size)
+      draw->line_width = panvk_draw_line_width(cmdbuf);
+
+   draw->varying_bufs = bufs.gpu;
+
+   for (unsigned s = 0; s < MESA_SHADER_STAGES; s++) {
+      if (!varyings->stage[s].count) continue;
+
+      struct panfrost_ptr attribs =
+         pan_pool_alloc_desc_array(&cmdbuf->desc_pool.base,
+                                   varyings->stage[s].count,
+                                   ATTRIBUTE);
+
+      panvk_per_arch(emit_indirect_varyings)(cmdbuf->device, varyings, s,
+                                             attribs.cpu);
+      draw->stages[s].varyings = attribs.gpu;
+   }
+}
+
+/* The vertex attributes are patched for each draw, so they are emitted for
+ * each draw rather than cached in the descriptor state.
+ */
+static void
+panvk_draw_prepare_indirect_attributes(struct panvk_cmd_buffer *cmdbuf,
+                                       struct panvk_draw_info *draw)
+{
+   struct panvk_cmd_bind_point_state *bind_point_state =
+      panvk_cmd_get_bind_point_state(cmdbuf, GRAPHICS);
+   struct panvk_descriptor_state *desc_state = &bind_point_state->desc_state;
+   const struct panvk_pipeline *pipeline = bind_point_state->pipeline;
+   struct panvk_batch *batch = cmdbuf->state.batch;
+   unsigned num_imgs =
+      pipeline->img_access_mask & BITFIELD_BIT(MESA_SHADER_VERTEX) ?
+      pipeline->layout->num_imgs : 0;
+   unsigned vs_attrib_count = pipeline->attribs.attrib_count;
+   unsigned attrib_count = vs_attrib_count + num_imgs;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(draw->stages); i++) {
+      if (i != MESA_SHADER_VERTEX &&
+          (pipeline->img_access_mask & BITFIELD_BIT(i))) {
+         panvk_prepare_non_vs_attribs(cmdbuf, bind_point_state);
+         draw->stages[i].attributes = desc_state->non_vs_attribs;
+         draw->stages[i].attribute_bufs = desc_state->non_vs_attrib_bufs;
+      }
    }
 
+   if (!attrib_count)
+      return;
+
+   unsigned attrib_buf_count = attrib_count * 2;
+   struct panfrost_ptr bufs =
+      pan_pool_alloc_desc_array(&cmdbuf->desc_pool.base,
+                                attrib_buf_count + 1,
+                                ATTRIBUTE_BUFFER);
+   struct panfrost_ptr attribs =
+      pan_pool_alloc_desc_array(&cmdbuf->desc_pool.base, attrib_count,
+                                ATTRIBUTE);
+
+   panvk_per_arch(emit_indirect_attrib_bufs)(&pipeline->attribs,
+                                             cmdbuf->state.vb.bufs,
+                                             cmdbuf->state.vb.count,
+                                             bufs.cpu);
+   panvk_per_arch(emit_indirect_attribs)(cmdbuf->device, &pipeline->attribs,
+                                         cmdbuf->state.vb.bufs,
+                                         cmdbuf->state.vb.count,
+                                         attribs.cpu);
+
+   if (num_imgs) {
+      unsigned bufs_offset = vs_attrib_count * pan_size(ATTRIBUTE_BUFFER) * 2;
+      unsigned attribs_offset = vs_attrib_count * pan_size(ATTRIBUTE);
+
+      panvk_fill_non_vs_attribs(cmdbuf, bind_point_state,
+                                bufs.cpu + bufs_offset, attribs.cpu + attribs_offset,
+                                vs_attrib_count * 2);
+   }
+
+   /* A NULL entry is needed to stop prefecting on Bifrost */
+   memset(bufs.cpu + (pan_size(ATTRIBUTE_BUFFER) * attrib_buf_count), 0,
+          pan_size(ATTRIBUTE_BUFFER));
+
+   /* The buffers and offsets of the attributes are adjusted in place */
+   if (vs_attrib_count) {
+      panvk_batch_save_patched_desc(batch, bufs.cpu,
+                                    vs_attrib_count * pan_size(ATTRIBUTE_BUFFER) * 2);
+      panvk_batch_save_patched_desc(batch, attribs.cpu,
+                                    vs_attrib_count * pan_size(ATTRIBUTE));
+   }
+
+   draw->stages[MESA_SHADER_VERTEX].attributes = attribs.gpu;
+   draw->stages[MESA_SHADER_VERTEX].attribute_bufs = bufs.gpu;
+}
+
+/* Draws with the parameters at draw_buf, in the layout of
+ * VkDrawIndirectCommand, or VkDrawIndexedIndirectCommand for indexed draws.
+ * The jobs are emitted as templates with all the counts zeroed, which the
+ * indirect draw jobs of pan_indirect_draw.c patch once they know the min/max
+ * index. Their varyings are allocated from the device varying heap.
+ * If draw_count_ptr is not zero, the draw is skipped unless draw_id is lower
+ * than the draw count stored there.
+ */
+static void
+panvk_cmd_draw_indirect_gpu(struct panvk_cmd_buffer *cmdbuf,
+                            bool indexed, mali_ptr draw_buf,
+                            mali_ptr draw_count_ptr, uint32_t draw_id)
+{
+   struct panvk_batch *batch = cmdbuf->state.batch;
+   struct panvk_cmd_bind_point_state *bind_point_state =
+      panvk_cmd_get_bind_point_state(cmdbuf, GRAPHICS);
+   struct panvk_descriptor_state *desc_state = &bind_point_state->desc_state;
+   const struct panvk_pipeline *pipeline =
+      panvk_cmd_get_pipeline(cmdbuf, GRAPHICS);
+   /* Up to 4 jobs: the min/max search, the patching job, and the vertex and
+    * tiler jobs of the draw.
+    */
+   if (batch->scoreboard.job_index >= (UINT16_MAX - 4)) {
+      panvk_per_arch(cmd_close_batch)(cmdbuf);
+      panvk_cmd_preload_fb_after_batch_split(cmdbuf);
+      batch = panvk_cmd_open_batch(cmdbuf);
+   }
+
+   if (pipeline->rast.enable)
+      panvk_per_arch(cmd_alloc_fb_desc)(cmdbuf);
+
+   panvk_per_arch(cmd_alloc_tls_desc)(cmdbuf, true);
+
+   unsigned index_size = indexed ? cmdbuf->state.ib.index_size : 0;
+
+   /* The primitive descriptor can't hold a zero count */
+   struct panvk_draw_info draw = {
+      .index_size = index_size,
+      .index_count = 1,
+      .vertex_count = 1,
+      .indices = indexed ?
+                 panvk_buffer_gpu_ptr(cmdbuf->state.ib.buffer,
+                                      cmdbuf->state.ib.offset) : 0,
+   };
+
+   /* The vertex and instance offset sysvals are patched, the draw needs its
+    * own copy of them.
+    */
+   desc_state->sysvals_ptr = 0;
+   desc_state->ubos = 0;
+
+   panvk_cmd_prepare_draw_sysvals(cmdbuf, bind_point_state, &draw);
+   panvk_cmd_prepare_ubos(cmdbuf, bind_point_state);
+   panvk_cmd_prepare_textures(cmdbuf, bind_point_state);
+   panvk_cmd_prepare_samplers(cmdbuf, bind_point_state);
+
+   draw.tls = batch->tls.gpu;
+   draw.fb = batch->fb.desc.gpu;
+   draw.ubos = desc_state->ubos;
+   draw.textures = desc_state->textures;
+   draw.samplers = desc_state->samplers;
+
+   /* The invocation is left zeroed and patched like the counts */
+   panvk_draw_prepare_fs_rsd(cmdbuf, &draw);
+   panvk_draw_prepare_indirect_varyings(cmdbuf, &draw);
+   panvk_draw_prepare_indirect_attributes(cmdbuf, &draw);
+   panvk_draw_prepare_viewport(cmdbuf, &draw);
+   panvk_draw_prepare_tiler_context(cmdbuf, &draw);
+   panvk_draw_prepare_vertex_job(cmdbuf, &draw);
+   panvk_draw_prepare_tiler_job(cmdbuf, &draw);
+   batch->tlsinfo.tls.size = MAX2(pipeline->tls_size, batch->tlsinfo.tls.size);
+   assert(!pipeline->wls_size);
+
+   /* The index pointer is offset in place by the first index */
+   if (indexed) {
+      panvk_batch_save_patched_desc(batch,
+                                    pan_section_ptr(draw.jobs.tiler.cpu,
+                                                    TILER_JOB, PRIMITIVE),
+                                    pan_size(PRIMITIVE));
+   }
+
+   mali_ptr sysvals = desc_state->sysvals_ptr;
+   struct pan_indirect_draw_info draw_info = {
+      .last_indirect_draw = batch->indirect_draw_job_id,
+      .draw_buf = draw_buf,
+      .index_buf = draw.indices,
+      .first_vertex_sysval = sysvals ?
+         sysvals + offsetof(struct panvk_sysvals, first_vertex) : 0,
+      .base_vertex_sysval = sysvals ?
+         sysvals + offsetof(struct panvk_sysvals, base_vertex) : 0,
+      .base_instance_sysval = sysvals ?
+         sysvals + offsetof(struct panvk_sysvals, base_instance) : 0,
+      .vertex_job = draw.jobs.vertex.gpu,
+      .tiler_job = draw.jobs.tiler.gpu,
+      .attrib_bufs = draw.stages[MESA_SHADER_VERTEX].attribute_bufs,
+      .attribs = draw.stages[MESA_SHADER_VERTEX].attributes,
+      .attrib_count = pipeline->attribs.attrib_count,
+      .varying_bufs = draw.varying_bufs,
+      .index_size = index_size / 8,
+      .jobs = &batch->jobs,
+   };
+
+   if (pipeline->ia.writes_point_size) {
+      draw_info.flags |= PAN_INDIRECT_DRAW_HAS_PSIZ |
+                         PAN_INDIRECT_DRAW_UPDATE_PRIM_SIZE;
+   }
+
+   if (indexed && pipeline->ia.primitive_restart) {
+      draw_info.restart_index = BITFIELD_MASK(index_size);
+      draw_info.flags |= PAN_INDIRECT_DRAW_PRIMITIVE_RESTART;
+   }
+
+   if (draw_count_ptr) {
+      draw_info.draw_count_ptr = draw_count_ptr;
+      draw_info.draw_id = draw_id;
+      draw_info.flags |= PAN_INDIRECT_DRAW_DRAW_COUNT;
+   }
+
+   batch->indirect_draw_job_id =
+      GENX(panfrost_emit_indirect_draw)(&cmdbuf->desc_pool.base,
+                                        &batch->scoreboard,
+                                        &draw_info,
+                                        &batch->indirect_draw_ctx);
+
+   panvk_draw_add_jobs(cmdbuf, &draw);
+
    /* Clear the dirty flags all at once */
    desc_state->dirty = cmdbuf->state.dirty = 0;
+
+   /* Don't let the next draws use the patched sysvals */
+   desc_state->sysvals_ptr = 0;
+   desc_state->ubos = 0;
 }
+#endif
 
 void
 panvk_per_arch(CmdDraw)(VkCommandBuffer commandBuffer,
@@ -831,31 +1211,54 @@ panvk_index_minmax_search(struct panvk_cmd_buffer *cmdbuf,
    assert(cmdbuf->state.ib.buffer->bo);
    assert(cmdbuf->state.ib.buffer->bo->ptr.cpu);
 
-   *max = 0;
+   unsigned index_size = cmdbuf->state.ib.index_size / 8;
+   uint32_t restart_index = BITFIELD_MASK(cmdbuf->state.ib.index_size);
 
-   /* TODO: Use panfrost_minmax_cache */
-   /* TODO: Read full cacheline of data to mitigate the uncached
-    * mapping slowness.
-    */
-   switch (cmdbuf->state.ib.index_size) {
-#define MINMAX_SEARCH_CASE(sz) \
-   case sz: { \
-      uint ## sz ## _t *indices = ptr; \
-      *min = UINT ## sz ## _MAX; \
-      for (uint32_t i = 0; i < count; i++) { \
-         if (restart && indices[i + start] == UINT ## sz ##_MAX) continue; \
-         *min = MIN2(indices[i + start], *min); \
-         *max = MAX2(indices[i + start], *max); \
-      } \
-      break; \
-   }
-   MINMAX_SEARCH_CASE(32)
-   MINMAX_SEARCH_CASE(16)
-   MINMAX_SEARCH_CASE(8)
-#undef MINMAX_SEARCH_CASE
-   default:
-      unreachable("Invalid index size");
-   }
+   panfrost_minmax_search((uint8_t *)ptr + start * index_size, index_size,
+                          count, restart, restart_index, min, max);
+}
+
+/* The index ranges are tracked per BO, in case several buffers alias the
+ * same memory.
+ */
+static struct panvk_index_range_cache *
+panvk_cmd_get_index_range_cache(struct panvk_cmd_buffer *cmdbuf,
+                                const struct panfrost_bo *bo)
+{
+   if (!cmdbuf->index_range_cache)
+      cmdbuf->index_range_cache = _mesa_pointer_hash_table_create(NULL);
+
+   struct hash_entry *entry =
+      _mesa_hash_table_search(cmdbuf->index_range_cache, bo);
+
+   if (entry)
+      return entry->data;
+
+   struct panvk_index_range_cache *cache =
+      rzalloc(cmdbuf->index_range_cache, struct panvk_index_range_cache);
+
+   cache->written_start = UINT64_MAX;
+   _mesa_hash_table_insert(cmdbuf->index_range_cache, bo, cache);
+   return cache;
+}
+
+void
+panvk_per_arch(cmd_invalidate_index_ranges)(struct panvk_cmd_buffer *cmdbuf,
+                                            const struct panvk_buffer *buffer,
+                                            VkDeviceSize offset,
+                                            VkDeviceSize size)
+{
+   struct panvk_index_range_cache *cache =
+      panvk_cmd_get_index_range_cache(cmdbuf, buffer->bo);
+   uint64_t start = buffer->bo_offset + offset;
+
+   size = vk_buffer_range(&buffer->vk, offset, size);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(cache->minmax); i++)
+      panfrost_minmax_cache_invalidate_range(&cache->minmax[i], start, size);
+
+   cache->written_start = MIN2(cache->written_start, start);
+   cache->written_end = MAX2(cache->written_end, start + size);
 }
 
 void
@@ -875,9 +1278,48 @@ panvk_per_arch(CmdDrawIndexed)(VkCommandBuffer commandBuffer,
    const struct panvk_pipeline *pipeline =
       panvk_cmd_get_pipeline(cmdbuf, GRAPHICS);
    bool primitive_restart = pipeline->ia.primitive_restart;
+   const struct panvk_buffer *ib = cmdbuf->state.ib.buffer;
+   unsigned index_size = cmdbuf->state.ib.index_size / 8;
+
+   /* Keyed by the index of the first index in the BO */
+   unsigned start =
+      (ib->bo_offset + cmdbuf->state.ib.offset) / index_size + firstIndex;
+   struct panvk_index_range_cache *cache =
+      panvk_cmd_get_index_range_cache(cmdbuf, ib->bo);
+   struct panfrost_minmax_cache *minmax = &cache->minmax[primitive_restart];
+
+   if (!panfrost_minmax_cache_get(minmax, index_size, start, indexCount,
+                                  &min_vertex, &max_vertex)) {
+#if PANVK_GPU_INDIRECTS
+      /* Indices written by this command buffer can't be read yet, and large
+       * ones are better searched on the GPU */
+      uint64_t start_byte = (uint64_t)start * index_size;
+      uint64_t end_byte = start_byte + (uint64_t)indexCount * index_size;
+      bool written = MAX2(cache->written_start, start_byte) <
+                     MIN2(cache->written_end, end_byte);
+
+      if (written || indexCount >= PANVK_GPU_MINMAX_MIN_COUNT) {
+         const VkDrawIndexedIndirectCommand params = {
+            .indexCount = indexCount,
+            .instanceCount = instanceCount,
+            .firstIndex = firstIndex,
+            .vertexOffset = vertexOffset,
+            .firstInstance = firstInstance,
+         };
+         mali_ptr draw_buf =
+            pan_pool_upload_aligned(&cmdbuf->desc_pool.base, &params,
+                                    sizeof(params), 16);
+
+         panvk_cmd_draw_indirect_gpu(cmdbuf, true, draw_buf, 0, 0);
+         return;
+      }
+#endif
 
-   panvk_index_minmax_search(cmdbuf, firstIndex, indexCount, primitive_restart,
-                             &min_vertex, &max_vertex);
+      panvk_index_minmax_search(cmdbuf, firstIndex, indexCount,
+                                primitive_restart, &min_vertex, &max_vertex);
+      panfrost_minmax_cache_add(minmax, index_size, start, indexCount,
+                                min_vertex, max_vertex);
+   }
 
    unsigned vertex_range = max_vertex - min_vertex + 1;
    struct panvk_draw_info draw = {
@@ -901,6 +1343,93 @@ panvk_per_arch(CmdDrawIndexed)(VkCommandBuffer commandBuffer,
    panvk_cmd_draw(cmdbuf, &draw);
 }
 
+#if PANVK_GPU_INDIRECTS
+/* With a count buffer, max_draw_count draws are emitted, and those past the
+ * count read by the GPU are turned into null jobs.
+ */
+static void
+panvk_cmd_draw_indirect(struct panvk_cmd_buffer *cmdbuf, bool indexed,
+                        const struct panvk_buffer *buffer, VkDeviceSize offset,
+                        const struct panvk_buffer *count_buffer,
+                        VkDeviceSize count_offset,
+                        uint32_t max_draw_count, uint32_t stride)
+{
+   mali_ptr draw_count_ptr =
+      count_buffer ? panvk_buffer_gpu_ptr(count_buffer, count_offset) : 0;
+
+   for (uint32_t i = 0; i < max_draw_count; i++) {
+      panvk_cmd_draw_indirect_gpu(cmdbuf, indexed,
+                                  panvk_buffer_gpu_ptr(buffer, offset),
+                                  draw_count_ptr, i);
+      offset += stride;
+   }
+}
+
+void
+panvk_per_arch(CmdDrawIndirect)(VkCommandBuffer commandBuffer,
+                                VkBuffer _buffer,
+                                VkDeviceSize offset,
+                                uint32_t drawCount,
+                                uint32_t stride)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_buffer, buffer, _buffer);
+
+   panvk_cmd_draw_indirect(cmdbuf, false, buffer, offset, NULL, 0,
+                           drawCount, stride);
+}
+
+void
+panvk_per_arch(CmdDrawIndexedIndirect)(VkCommandBuffer commandBuffer,
+                                       VkBuffer _buffer,
+                                       VkDeviceSize offset,
+                                       uint32_t drawCount,
+                                       uint32_t stride)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_buffer, buffer, _buffer);
+
+   panvk_cmd_draw_indirect(cmdbuf, true, buffer, offset, NULL, 0,
+                           drawCount, stride);
+}
+
+void
+panvk_per_arch(CmdDrawIndirectCount)(VkCommandBuffer commandBuffer,
+                                     VkBuffer _buffer,
+                                     VkDeviceSize offset,
+                                     VkBuffer _countBuffer,
+                                     VkDeviceSize countBufferOffset,
+                                     uint32_t maxDrawCount,
+                                     uint32_t stride)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_buffer, buffer, _buffer);
+   VK_FROM_HANDLE(panvk_buffer, count_buffer, _countBuffer);
+
+   panvk_cmd_draw_indirect(cmdbuf, false, buffer, offset,
+                           count_buffer, countBufferOffset,
+                           maxDrawCount, stride);
+}
+
+void
+panvk_per_arch(CmdDrawIndexedIndirectCount)(VkCommandBuffer commandBuffer,
+                                            VkBuffer _buffer,
+                                            VkDeviceSize offset,
+                                            VkBuffer _countBuffer,
+                                            VkDeviceSize countBufferOffset,
+                                            uint32_t maxDrawCount,
+                                            uint32_t stride)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_buffer, buffer, _buffer);
+   VK_FROM_HANDLE(panvk_buffer, count_buffer, _countBuffer);
+
+   panvk_cmd_draw_indirect(cmdbuf, true, buffer, offset,
+                           count_buffer, countBufferOffset,
+                           maxDrawCount, stride);
+}
+#endif
+
 VkResult
 panvk_per_arch(EndCommandBuffer)(VkCommandBuffer commandBuffer)
 {
@@ -917,6 +1446,7 @@ panvk_per_arch(CmdEndRenderPass2)(VkCommandBuffer commandBuffer,
 {
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
 
+   panvk_cmd_fb_info_set_discards(cmdbuf);
    panvk_per_arch(cmd_close_batch)(cmdbuf);
    vk_free(&cmdbuf->vk.pool->alloc, cmdbuf->state.clear);
    cmdbuf->state.batch = NULL;
@@ -936,6 +1466,22 @@ panvk_per_arch(CmdEndRenderPass)(VkCommandBuffer cmd)
    panvk_per_arch(CmdEndRenderPass2)(cmd, &einfo);
 }
 
+void
+panvk_per_arch(CmdEndRendering)(VkCommandBuffer commandBuffer)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+
+   panvk_cmd_fb_info_set_discards(cmdbuf);
+   panvk_per_arch(cmd_close_batch)(cmdbuf);
+   vk_free(&cmdbuf->vk.pool->alloc, cmdbuf->state.rendering);
+   cmdbuf->state.batch = NULL;
+   cmdbuf->state.rendering = NULL;
+   cmdbuf->state.pass = NULL;
+   cmdbuf->state.subpass = NULL;
+   cmdbuf->state.framebuffer = NULL;
+   cmdbuf->state.clear = NULL;
+}
+
 
 void
 panvk_per_arch(CmdPipelineBarrier2)(VkCommandBuffer commandBuffer,
@@ -1063,6 +1609,73 @@ panvk_per_arch(CmdWaitEvents2)(VkCommandBuffer commandBuffer,
    }
 }
 
+/* Query values are written by WRITE_VALUE jobs in a batch of their own, which
+ * is submitted after the work recorded before it has completed */
+static void
+panvk_cmd_write_queries(struct panvk_cmd_buffer *cmdbuf,
+                        struct panvk_query_pool *pool,
+                        uint32_t first, uint32_t count,
+                        enum mali_write_value_type type)
+{
+   bool reopen = cmdbuf->state.batch != NULL;
+
+   if (reopen) {
+      panvk_per_arch(cmd_close_batch)(cmdbuf);
+      panvk_cmd_preload_fb_after_batch_split(cmdbuf);
+   }
+
+   struct panvk_batch *batch = panvk_cmd_open_batch(cmdbuf);
+
+   for (uint32_t i = first; i < first + count; i++) {
+      struct panfrost_ptr job =
+         pan_pool_alloc_desc(&cmdbuf->desc_pool.base, WRITE_VALUE_JOB);
+
+      pan_section_pack(job.cpu, WRITE_VALUE_JOB, PAYLOAD, payload) {
+         payload.address = pool->bo->ptr.gpu + i * sizeof(uint64_t);
+         payload.type = type;
+      }
+
+      util_dynarray_append(&batch->jobs, void *, job.cpu);
+      panfrost_add_job(&cmdbuf->desc_pool.base, &batch->scoreboard,
+                       MALI_JOB_TYPE_WRITE_VALUE, false, false, 0, 0,
+                       &job, false);
+   }
+
+   batch->query_bo = pool->bo;
+   panvk_per_arch(cmd_close_batch)(cmdbuf);
+
+   if (reopen)
+      panvk_cmd_open_batch(cmdbuf);
+}
+
+void
+panvk_per_arch(CmdResetQueryPool)(VkCommandBuffer commandBuffer,
+                                  VkQueryPool queryPool,
+                                  uint32_t firstQuery,
+                                  uint32_t queryCount)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_query_pool, pool, queryPool);
+
+   panvk_cmd_write_queries(cmdbuf, pool, firstQuery, queryCount,
+                           MALI_WRITE_VALUE_TYPE_ZERO);
+}
+
+void
+panvk_per_arch(CmdWriteTimestamp2)(VkCommandBuffer commandBuffer,
+                                   VkPipelineStageFlags2 stage,
+                                   VkQueryPool queryPool,
+                                   uint32_t query)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_query_pool, pool, queryPool);
+
+   /* Batches execute in order, so the timestamp is taken after all of the
+    * previous work whatever the stage */
+   panvk_cmd_write_queries(cmdbuf, pool, query, 1,
+                           MALI_WRITE_VALUE_TYPE_SYSTEM_TIMESTAMP);
+}
+
 static void
 panvk_reset_cmdbuf(struct vk_command_buffer *vk_cmdbuf,
                    VkCommandBufferResetFlags flags)
@@ -1076,6 +1689,7 @@ panvk_reset_cmdbuf(struct vk_command_buffer *vk_cmdbuf,
       list_del(&batch->node);
       util_dynarray_fini(&batch->jobs);
       util_dynarray_fini(&batch->event_ops);
+      util_dynarray_fini(&batch->patched_descs);
 
       vk_free(&cmdbuf->vk.pool->alloc, batch);
    }
@@ -1084,8 +1698,18 @@ panvk_reset_cmdbuf(struct vk_command_buffer *vk_cmdbuf,
    panvk_pool_reset(&cmdbuf->tls_pool);
    panvk_pool_reset(&cmdbuf->varying_pool);
 
-   for (unsigned i = 0; i < MAX_BIND_POINTS; i++)
+   _mesa_hash_table_destroy(cmdbuf->fs_rsd_cache, NULL);
+   cmdbuf->fs_rsd_cache = NULL;
+   _mesa_hash_table_destroy(cmdbuf->index_range_cache, NULL);
+   cmdbuf->index_range_cache = NULL;
+
+   for (unsigned i = 0; i < MAX_BIND_POINTS; i++) {
       memset(&cmdbuf->bind_points[i].desc_state.sets, 0, sizeof(cmdbuf->bind_points[0].desc_state.sets));
+
+      /* The descriptor UBO of the push set was freed with the desc pool */
+      if (cmdbuf->bind_points[i].push_set)
+         cmdbuf->bind_points[i].push_set->layout = NULL;
+   }
 }
 
 static void
@@ -1099,10 +1723,22 @@ panvk_destroy_cmdbuf(struct vk_command_buffer *vk_cmdbuf)
       list_del(&batch->node);
       util_dynarray_fini(&batch->jobs);
       util_dynarray_fini(&batch->event_ops);
+      util_dynarray_fini(&batch->patched_descs);
 
       vk_free(&cmdbuf->vk.pool->alloc, batch);
    }
 
+   for (unsigned i = 0; i < MAX_BIND_POINTS; i++) {
+      struct panvk_push_descriptor_set *push = cmdbuf->bind_points[i].push_set;
+
+      if (push) {
+         vk_free(&cmdbuf->vk.pool->alloc, push->host);
+         vk_free(&cmdbuf->vk.pool->alloc, push);
+      }
+   }
+
+   _mesa_hash_table_destroy(cmdbuf->fs_rsd_cache, NULL);
+   _mesa_hash_table_destroy(cmdbuf->index_range_cache, NULL);
    panvk_pool_cleanup(&cmdbuf->desc_pool);
    panvk_pool_cleanup(&cmdbuf->tls_pool);
    panvk_pool_cleanup(&cmdbuf->varying_pool);
@@ -1241,8 +1877,11 @@ panvk_per_arch(CmdDispatch)(VkCommandBuffer commandBuffer,
    batch->tlsinfo.tls.size = pipeline->tls_size;
    batch->tlsinfo.wls.size = pipeline->wls_size;
    if (batch->tlsinfo.wls.size) {
+      batch->tlsinfo.wls.instances =
+         pan_wls_instances(pdev, &pipeline->cs.local_size, &dispatch.wg_count);
       batch->wls_total_size =
-         pan_wls_mem_size(pdev, &dispatch.wg_count, batch->tlsinfo.wls.size);
+         pan_wls_mem_size(pdev, &pipeline->cs.local_size, &dispatch.wg_count,
+                          batch->tlsinfo.wls.size);
    }
 
    panvk_per_arch(cmd_close_batch)(cmdbuf);
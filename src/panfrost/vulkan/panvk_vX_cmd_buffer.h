@@ -50,3 +50,11 @@ panvk_per_arch(cmd_alloc_tls_desc)(struct panvk_cmd_buffer *cmdbuf, bool gfx);
 
 void
 panvk_per_arch(cmd_prepare_tiler_context)(struct panvk_cmd_buffer *cmdbuf);
+
+/* Records a write of the command buffer to a buffer range, which may hold
+ * indices */
+void
+panvk_per_arch(cmd_invalidate_index_ranges)(struct panvk_cmd_buffer *cmdbuf,
+                                            const struct panvk_buffer *buffer,
+                                            VkDeviceSize offset,
+                                            VkDeviceSize size);
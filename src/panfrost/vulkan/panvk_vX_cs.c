@@ -100,12 +100,13 @@ static void
 panvk_emit_varying(const struct panvk_device *dev,
                    const struct panvk_varyings_info *varyings,
                    gl_shader_stage stage, unsigned idx,
-                   void *attrib)
+                   bool indirect, void *attrib)
 {
    gl_varying_slot loc = varyings->stage[stage].loc[idx];
 
    pan_pack(attrib, ATTRIBUTE, cfg) {
-      cfg.buffer_index = varyings->varying[loc].buf;
+      cfg.buffer_index = indirect ? panvk_varying_buf_id(loc) :
+                         varyings->varying[loc].buf;
       cfg.offset = varyings->varying[loc].offset;
       cfg.format = panvk_varying_hw_format(dev, varyings, stage, idx);
    }
@@ -120,7 +121,19 @@ panvk_per_arch(emit_varyings)(const struct panvk_device *dev,
    struct mali_attribute_packed *attrib = descs;
 
    for (unsigned i = 0; i < varyings->stage[stage].count; i++)
-      panvk_emit_varying(dev, varyings, stage, i, attrib++);
+      panvk_emit_varying(dev, varyings, stage, i, false, attrib++);
+}
+
+void
+panvk_per_arch(emit_indirect_varyings)(const struct panvk_device *dev,
+                                       const struct panvk_varyings_info *varyings,
+                                       gl_shader_stage stage,
+                                       void *descs)
+{
+   struct mali_attribute_packed *attrib = descs;
+
+   for (unsigned i = 0; i < varyings->stage[stage].count; i++)
+      panvk_emit_varying(dev, varyings, stage, i, true, attrib++);
 }
 
 static void
@@ -221,6 +234,93 @@ panvk_emit_attrib_buf(const struct panvk_attribs_info *info,
    }
 }
 
+#if PANVK_GPU_INDIRECTS
+/* The indirect draw shaders allocate the varying buffers from the device
+ * varying heap, they expect them at the PAN_VARY_* slots rather than
+ * compacted, with only the stride filled.
+ */
+void
+panvk_per_arch(emit_indirect_varying_bufs)(const struct panvk_varyings_info *varyings,
+                                           void *descs)
+{
+   struct mali_attribute_buffer_packed *buf = descs;
+
+   STATIC_ASSERT(PANVK_VARY_BUF_GENERAL == PAN_VARY_GENERAL);
+   STATIC_ASSERT(PANVK_VARY_BUF_POSITION == PAN_VARY_POSITION);
+   STATIC_ASSERT(PANVK_VARY_BUF_PSIZ == PAN_VARY_PSIZ);
+
+   for (unsigned i = 0; i < PANVK_VARY_BUF_MAX; i++) {
+      unsigned stride = 0;
+
+      if (varyings->buf_mask & (1 << i))
+         stride = varyings->buf[panvk_varying_buf_index(varyings, i)].stride;
+
+      pan_pack(buf + i, ATTRIBUTE_BUFFER, cfg) {
+         cfg.stride = stride;
+      }
+   }
+}
+
+/* Attribute buffers of the draws patched on the GPU: one per attribute,
+ * with the type, divisor and first instance offset left to the indirect
+ * draw shaders, which find the instance divisor in the continuation.
+ */
+void
+panvk_per_arch(emit_indirect_attrib_bufs)(const struct panvk_attribs_info *info,
+                                          const struct panvk_attrib_buf *bufs,
+                                          unsigned buf_count,
+                                          void *descs)
+{
+   struct mali_attribute_buffer_packed *buf = descs;
+
+   for (unsigned i = 0; i < info->attrib_count; i++) {
+      unsigned buf_idx = info->attrib[i].buf;
+      const struct panvk_attrib_buf_info *buf_info = &info->buf[buf_idx];
+
+      assert(buf_idx < buf_count);
+      mali_ptr addr = bufs[buf_idx].address & ~63ULL;
+      unsigned size = bufs[buf_idx].size + (bufs[buf_idx].address & 63);
+
+      pan_pack(buf, ATTRIBUTE_BUFFER, cfg) {
+         cfg.type = MALI_ATTRIBUTE_TYPE_1D;
+         /* instance_divisor == 0 means all instances share the same value */
+         cfg.stride = buf_info->per_instance && !buf_info->instance_divisor ?
+                      0 : buf_info->stride;
+         cfg.pointer = addr;
+         cfg.size = size;
+      }
+
+      pan_pack(buf + 1, ATTRIBUTE_BUFFER_CONTINUATION_NPOT, cfg) {
+         cfg.divisor = buf_info->per_instance ? buf_info->instance_divisor : 0;
+      }
+
+      buf += 2;
+   }
+}
+
+void
+panvk_per_arch(emit_indirect_attribs)(const struct panvk_device *dev,
+                                      const struct panvk_attribs_info *attribs,
+                                      const struct panvk_attrib_buf *bufs,
+                                      unsigned buf_count,
+                                      void *descs)
+{
+   const struct panfrost_device *pdev = &dev->physical_device->pdev;
+   struct mali_attribute_packed *attrib = descs;
+
+   for (unsigned i = 0; i < attribs->attrib_count; i++) {
+      unsigned buf_idx = attribs->attrib[i].buf;
+
+      pan_pack(attrib++, ATTRIBUTE, cfg) {
+         cfg.buffer_index = i * 2;
+         cfg.offset = attribs->attrib[i].offset +
+                      (bufs[buf_idx].address & 63);
+         cfg.format = pdev->formats[attribs->attrib[i].format].hw;
+      }
+   }
+}
+#endif
+
 void
 panvk_per_arch(emit_attrib_bufs)(const struct panvk_attribs_info *info,
                                  const struct panvk_attrib_buf *bufs,
@@ -48,6 +48,31 @@ void
 panvk_per_arch(emit_varying_bufs)(const struct panvk_varyings_info *varyings,
                                   void *descs);
 
+#if PANVK_GPU_INDIRECTS
+void
+panvk_per_arch(emit_indirect_varyings)(const struct panvk_device *dev,
+                                       const struct panvk_varyings_info *varyings,
+                                       gl_shader_stage stage,
+                                       void *descs);
+
+void
+panvk_per_arch(emit_indirect_varying_bufs)(const struct panvk_varyings_info *varyings,
+                                           void *descs);
+
+void
+panvk_per_arch(emit_indirect_attrib_bufs)(const struct panvk_attribs_info *info,
+                                          const struct panvk_attrib_buf *bufs,
+                                          unsigned buf_count,
+                                          void *descs);
+
+void
+panvk_per_arch(emit_indirect_attribs)(const struct panvk_device *dev,
+                                      const struct panvk_attribs_info *attribs,
+                                      const struct panvk_attrib_buf *bufs,
+                                      unsigned buf_count,
+                                      void *descs);
+#endif
+
 void
 panvk_per_arch(emit_attrib_bufs)(const struct panvk_attribs_info *info,
                                  const struct panvk_attrib_buf *bufs,
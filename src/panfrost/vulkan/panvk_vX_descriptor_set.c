@@ -232,92 +232,73 @@ panvk_write_sampler_desc_raw(struct panvk_descriptor_set *set,
                              uint32_t binding, uint32_t elem,
                              struct panvk_sampler *sampler);
 
-static VkResult
-panvk_per_arch(descriptor_set_create)(struct panvk_device *device,
-                                      struct panvk_descriptor_pool *pool,
-                                      const struct panvk_descriptor_set_layout *layout,
-                                      struct panvk_descriptor_set **out_set)
+/* Host storage of a descriptor set and its descriptor arrays, which are
+ * laid out after the set structure.
+ */
+static size_t
+panvk_descriptor_set_host_size(const struct panvk_descriptor_set_layout *layout)
 {
-   struct panvk_descriptor_set *set;
-
-   /* TODO: Allocate from the pool! */
-   set = vk_object_zalloc(&device->vk, NULL,
-                          sizeof(struct panvk_descriptor_set),
-                          VK_OBJECT_TYPE_DESCRIPTOR_SET);
-   if (!set)
-      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
-
-   set->layout = layout;
-
-   if (layout->num_ubos) {
-      set->ubos = vk_zalloc(&device->vk.alloc,
-                            pan_size(UNIFORM_BUFFER) * layout->num_ubos, 8,
-                            VK_OBJECT_TYPE_DESCRIPTOR_SET);
-      if (!set->ubos)
-         goto err_free_set;
-   }
-
-   if (layout->num_dyn_ubos) {
-      set->dyn_ubos = vk_zalloc(&device->vk.alloc,
-                            sizeof(*set->dyn_ubos) * layout->num_dyn_ubos, 8,
-                            VK_OBJECT_TYPE_DESCRIPTOR_SET);
-      if (!set->dyn_ubos)
-         goto err_free_set;
-   }
+   return ALIGN_POT(sizeof(struct panvk_descriptor_set), 8) +
+          ALIGN_POT(pan_size(UNIFORM_BUFFER) * layout->num_ubos, 8) +
+          sizeof(struct panvk_buffer_desc) * layout->num_dyn_ubos +
+          sizeof(struct panvk_buffer_desc) * layout->num_dyn_ssbos +
+          ALIGN_POT(pan_size(SAMPLER) * layout->num_samplers, 8) +
+          ALIGN_POT(pan_size(TEXTURE) * layout->num_textures, 8) +
+          ALIGN_POT(sizeof(uint32_t) * layout->num_imgs, 8) +
+          ALIGN_POT(pan_size(ATTRIBUTE_BUFFER) * 2 * layout->num_imgs, 8);
+}
 
-   if (layout->num_dyn_ssbos) {
-      set->dyn_ssbos = vk_zalloc(&device->vk.alloc,
-                            sizeof(*set->dyn_ssbos) * layout->num_dyn_ssbos, 8,
-                            VK_OBJECT_TYPE_DESCRIPTOR_SET);
-      if (!set->dyn_ssbos)
-         goto err_free_set;
-   }
+static void *
+panvk_descriptor_set_carve(uint8_t **ptr, size_t size)
+{
+   if (!size)
+      return NULL;
 
-   if (layout->num_samplers) {
-      set->samplers = vk_zalloc(&device->vk.alloc,
-                                pan_size(SAMPLER) * layout->num_samplers, 8,
-                                VK_OBJECT_TYPE_DESCRIPTOR_SET);
-      if (!set->samplers)
-         goto err_free_set;
-   }
+   void *ret = *ptr;
+   *ptr += ALIGN_POT(size, 8);
+   return ret;
+}
 
-   if (layout->num_textures) {
-      set->textures =
-         vk_zalloc(&device->vk.alloc, pan_size(TEXTURE) * layout->num_textures,
-                   8, VK_OBJECT_TYPE_DESCRIPTOR_SET);
-      if (!set->textures)
-         goto err_free_set;
-   }
+/* Points the descriptor arrays of a set at the zeroed host memory following
+ * it, sized with panvk_descriptor_set_host_size().
+ */
+static void
+panvk_descriptor_set_init_host(struct panvk_descriptor_set *set,
+                               const struct panvk_descriptor_set_layout *layout)
+{
+   uint8_t *ptr = (uint8_t *)set + ALIGN_POT(sizeof(*set), 8);
 
-   if (layout->num_imgs) {
-      set->img_fmts =
-         vk_zalloc(&device->vk.alloc,
-                   sizeof(*set->img_fmts) * layout->num_imgs,
-                   8, VK_OBJECT_TYPE_DESCRIPTOR_SET);
-      if (!set->img_fmts)
-         goto err_free_set;
-
-      set->img_attrib_bufs =
-         vk_zalloc(&device->vk.alloc,
-                   pan_size(ATTRIBUTE_BUFFER) * 2 * layout->num_imgs,
-                   8, VK_OBJECT_TYPE_DESCRIPTOR_SET);
-      if (!set->img_attrib_bufs)
-         goto err_free_set;
-   }
+   set->layout = layout;
+   set->ubos =
+      panvk_descriptor_set_carve(&ptr, pan_size(UNIFORM_BUFFER) * layout->num_ubos);
+   set->dyn_ubos =
+      panvk_descriptor_set_carve(&ptr, sizeof(*set->dyn_ubos) * layout->num_dyn_ubos);
+   set->dyn_ssbos =
+      panvk_descriptor_set_carve(&ptr, sizeof(*set->dyn_ssbos) * layout->num_dyn_ssbos);
+   set->samplers =
+      panvk_descriptor_set_carve(&ptr, pan_size(SAMPLER) * layout->num_samplers);
+   set->textures =
+      panvk_descriptor_set_carve(&ptr, pan_size(TEXTURE) * layout->num_textures);
+   set->img_fmts =
+      panvk_descriptor_set_carve(&ptr, sizeof(*set->img_fmts) * layout->num_imgs);
+   set->img_attrib_bufs =
+      panvk_descriptor_set_carve(&ptr, pan_size(ATTRIBUTE_BUFFER) * 2 * layout->num_imgs);
+}
 
-   if (layout->desc_ubo_size) {
-      set->desc_bo = panfrost_bo_create(&device->physical_device->pdev,
-                                        layout->desc_ubo_size,
-                                        0, "Descriptor set");
-      if (!set->desc_bo)
-         goto err_free_set;
+static void
+panvk_descriptor_set_init_desc_ubo(struct panvk_descriptor_set *set)
+{
+   const struct panvk_descriptor_set_layout *layout = set->layout;
+   struct mali_uniform_buffer_packed *ubos = set->ubos;
 
-      struct mali_uniform_buffer_packed *ubos = set->ubos;
+   panvk_per_arch(emit_ubo)(set->desc_ubo.gpu, layout->desc_ubo_size,
+                            &ubos[layout->desc_ubo_index]);
+}
 
-      panvk_per_arch(emit_ubo)(set->desc_bo->ptr.gpu,
-                               layout->desc_ubo_size,
-                               &ubos[layout->desc_ubo_index]);
-   }
+static void
+panvk_descriptor_set_init_immutable_samplers(struct panvk_descriptor_set *set)
+{
+   const struct panvk_descriptor_set_layout *layout = set->layout;
 
    for (unsigned i = 0; i < layout->binding_count; i++) {
       if (!layout->bindings[i].immutable_samplers)
@@ -329,22 +310,66 @@ panvk_per_arch(descriptor_set_create)(struct panvk_device *device,
          panvk_write_sampler_desc_raw(set, i, j, sampler);
       }
    }
+}
+
+static VkResult
+panvk_per_arch(descriptor_set_create)(struct panvk_device *device,
+                                      struct panvk_descriptor_pool *pool,
+                                      const struct panvk_descriptor_set_layout *layout,
+                                      struct panvk_descriptor_set **out_set)
+{
+   size_t host_size = panvk_descriptor_set_host_size(layout);
+   struct panvk_descriptor_set *set;
+
+   if (pool->linear) {
+      set = panvk_descriptor_pool_alloc_host(device, pool, host_size);
+      if (!set)
+         return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+
+      memset(set, 0, host_size);
+   } else {
+      set = vk_zalloc(&device->vk.alloc, host_size, 8,
+                      VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+      if (!set)
+         return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+   }
+
+   vk_object_base_init(&device->vk, &set->base, VK_OBJECT_TYPE_DESCRIPTOR_SET);
+   set->pool = pool;
+   panvk_descriptor_set_init_host(set, layout);
+
+   if (layout->desc_ubo_size) {
+      if (pool->linear) {
+         set->desc_ubo = pan_pool_alloc_aligned(&pool->desc_mem.base,
+                                                layout->desc_ubo_size, 16);
+      } else {
+         set->desc_bo = panfrost_bo_create(&device->physical_device->pdev,
+                                           layout->desc_ubo_size,
+                                           0, "Descriptor set");
+         if (set->desc_bo)
+            set->desc_ubo = set->desc_bo->ptr;
+      }
+
+      if (!set->desc_ubo.cpu) {
+         vk_object_base_finish(&set->base);
+         if (!pool->linear)
+            vk_free(&device->vk.alloc, set);
+         return vk_error(device, VK_ERROR_OUT_OF_DEVICE_MEMORY);
+      }
+
+      /* Sets of linear pools can reuse memory of sets destroyed by a pool
+       * reset */
+      if (pool->linear)
+         memset(set->desc_ubo.cpu, 0, layout->desc_ubo_size);
 
+      panvk_descriptor_set_init_desc_ubo(set);
+   }
+
+   panvk_descriptor_set_init_immutable_samplers(set);
+
+   list_addtail(&set->node, &pool->sets);
    *out_set = set;
    return VK_SUCCESS;
-
-err_free_set:
-   vk_free(&device->vk.alloc, set->textures);
-   vk_free(&device->vk.alloc, set->samplers);
-   vk_free(&device->vk.alloc, set->ubos);
-   vk_free(&device->vk.alloc, set->dyn_ubos);
-   vk_free(&device->vk.alloc, set->dyn_ssbos);
-   vk_free(&device->vk.alloc, set->img_fmts);
-   vk_free(&device->vk.alloc, set->img_attrib_bufs);
-   if (set->desc_bo)
-      panfrost_bo_unreference(set->desc_bo);
-   vk_object_free(&device->vk, NULL, set);
-   return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
 }
 
 VkResult
@@ -386,7 +411,7 @@ panvk_desc_ubo_data(struct panvk_descriptor_set *set,
    const struct panvk_descriptor_set_binding_layout *binding_layout =
       &set->layout->bindings[binding];
 
-   return (char *)set->desc_bo->ptr.cpu +
+   return (char *)set->desc_ubo.cpu +
           binding_layout->desc_ubo_offset +
           elem * binding_layout->desc_ubo_stride;
 }
@@ -697,6 +722,112 @@ panvk_copy_dyn_ssbo_desc(struct panvk_descriptor_set *dst_set,
       *panvk_dyn_ssbo_desc(src_set, src_binding, src_elem);
 }
 
+static void
+panvk_descriptor_set_write(struct panvk_device *dev,
+                           struct panvk_descriptor_set *set,
+                           const VkWriteDescriptorSet *write)
+{
+   switch (write->descriptorType) {
+   case VK_DESCRIPTOR_TYPE_SAMPLER:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_sampler_desc(dev, set,
+                                  write->dstBinding,
+                                  write->dstArrayElement + j,
+                                  &write->pImageInfo[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_sampler_desc(dev, set,
+                                  write->dstBinding,
+                                  write->dstArrayElement + j,
+                                  &write->pImageInfo[j]);
+         panvk_write_tex_desc(dev, set,
+                              write->dstBinding,
+                              write->dstArrayElement + j,
+                              &write->pImageInfo[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_tex_desc(dev, set,
+                              write->dstBinding,
+                              write->dstArrayElement + j,
+                              &write->pImageInfo[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+   case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_img_desc(dev, set,
+                              write->dstBinding,
+                              write->dstArrayElement + j,
+                              &write->pImageInfo[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_tex_buf_desc(dev, set,
+                                  write->dstBinding,
+                                  write->dstArrayElement + j,
+                                  write->pTexelBufferView[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_img_buf_desc(dev, set,
+                                  write->dstBinding,
+                                  write->dstArrayElement + j,
+                                  write->pTexelBufferView[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_ubo_desc(dev, set,
+                              write->dstBinding,
+                              write->dstArrayElement + j,
+                              &write->pBufferInfo[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_dyn_ubo_desc(dev, set,
+                                  write->dstBinding,
+                                  write->dstArrayElement + j,
+                                  &write->pBufferInfo[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_ssbo_desc(dev, set,
+                               write->dstBinding,
+                               write->dstArrayElement + j,
+                               &write->pBufferInfo[j]);
+      }
+      break;
+
+   case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+      for (uint32_t j = 0; j < write->descriptorCount; j++) {
+         panvk_write_dyn_ssbo_desc(dev, set,
+                                   write->dstBinding,
+                                   write->dstArrayElement + j,
+                                   &write->pBufferInfo[j]);
+      }
+      break;
+
+   default:
+      unreachable("Unsupported descriptor type");
+   }
+}
+
 void
 panvk_per_arch(UpdateDescriptorSets)(VkDevice _device,
                                      uint32_t descriptorWriteCount,
@@ -710,105 +841,7 @@ panvk_per_arch(UpdateDescriptorSets)(VkDevice _device,
       const VkWriteDescriptorSet *write = &pDescriptorWrites[i];
       VK_FROM_HANDLE(panvk_descriptor_set, set, write->dstSet);
 
-      switch (write->descriptorType) {
-      case VK_DESCRIPTOR_TYPE_SAMPLER:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_sampler_desc(dev, set,
-                                     write->dstBinding,
-                                     write->dstArrayElement + j,
-                                     &write->pImageInfo[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_sampler_desc(dev, set,
-                                     write->dstBinding,
-                                     write->dstArrayElement + j,
-                                     &write->pImageInfo[j]);
-            panvk_write_tex_desc(dev, set,
-                                 write->dstBinding,
-                                 write->dstArrayElement + j,
-                                 &write->pImageInfo[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_tex_desc(dev, set,
-                                 write->dstBinding,
-                                 write->dstArrayElement + j,
-                                 &write->pImageInfo[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
-      case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_img_desc(dev, set,
-                                 write->dstBinding,
-                                 write->dstArrayElement + j,
-                                 &write->pImageInfo[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_tex_buf_desc(dev, set,
-                                     write->dstBinding,
-                                     write->dstArrayElement + j,
-                                     write->pTexelBufferView[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_img_buf_desc(dev, set,
-                                     write->dstBinding,
-                                     write->dstArrayElement + j,
-                                     write->pTexelBufferView[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_ubo_desc(dev, set,
-                                 write->dstBinding,
-                                 write->dstArrayElement + j,
-                                 &write->pBufferInfo[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_dyn_ubo_desc(dev, set,
-                                     write->dstBinding,
-                                     write->dstArrayElement + j,
-                                     &write->pBufferInfo[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_ssbo_desc(dev, set,
-                                  write->dstBinding,
-                                  write->dstArrayElement + j,
-                                  &write->pBufferInfo[j]);
-         }
-         break;
-
-      case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
-         for (uint32_t j = 0; j < write->descriptorCount; j++) {
-            panvk_write_dyn_ssbo_desc(dev, set,
-                                      write->dstBinding,
-                                      write->dstArrayElement + j,
-                                      &write->pBufferInfo[j]);
-         }
-         break;
-
-      default:
-         unreachable("Unsupported descriptor type");
-      }
+      panvk_descriptor_set_write(dev, set, write);
    }
 
    for (unsigned i = 0; i < descriptorCopyCount; i++) {
@@ -921,17 +954,12 @@ panvk_per_arch(UpdateDescriptorSets)(VkDevice _device,
    }
 }
 
-void
-panvk_per_arch(UpdateDescriptorSetWithTemplate)(VkDevice _device,
-                                                VkDescriptorSet descriptorSet,
-                                                VkDescriptorUpdateTemplate descriptorUpdateTemplate,
-                                                const void *data)
+static void
+panvk_descriptor_set_write_template(struct panvk_device *dev,
+                                    struct panvk_descriptor_set *set,
+                                    const struct vk_descriptor_update_template *template,
+                                    const void *data)
 {
-   VK_FROM_HANDLE(panvk_device, dev, _device);
-   VK_FROM_HANDLE(panvk_descriptor_set, set, descriptorSet);
-   VK_FROM_HANDLE(vk_descriptor_update_template, template,
-                  descriptorUpdateTemplate);
-
    const struct panvk_descriptor_set_layout *layout = set->layout;
 
    for (uint32_t i = 0; i < template->entry_count; i++) {
@@ -943,31 +971,44 @@ panvk_per_arch(UpdateDescriptorSetWithTemplate)(VkDevice _device,
       switch (entry->type) {
       case VK_DESCRIPTOR_TYPE_SAMPLER:
       case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
-      case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+      case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE: {
+         /* The descriptors of an entry are consecutive in the set, so the
+          * destinations are only looked up once and the pre-packed sampler
+          * and texture descriptors are copied straight from the objects.
+          */
+         bool write_sampler =
+            entry->type != VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE &&
+            !binding_layout->immutable_samplers;
+         bool write_tex = entry->type != VK_DESCRIPTOR_TYPE_SAMPLER;
+         struct mali_sampler_packed *samplers = write_sampler ?
+            panvk_sampler_desc(set, entry->binding, entry->array_element) :
+            NULL;
+         struct mali_texture_packed *textures = write_tex ?
+            panvk_tex_desc(set, entry->binding, entry->array_element) :
+            NULL;
+         uint8_t *img_descs = write_tex ?
+            panvk_desc_ubo_data(set, entry->binding, entry->array_element) :
+            NULL;
+
          for (unsigned j = 0; j < entry->array_count; j++) {
             const VkDescriptorImageInfo *info =
                data + entry->offset + j * entry->stride;
 
-            if ((entry->type == VK_DESCRIPTOR_TYPE_SAMPLER ||
-                 entry->type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) &&
-                !binding_layout->immutable_samplers) {
-
-               panvk_write_sampler_desc(dev, set,
-                                        entry->binding,
-                                        entry->array_element + j,
-                                        info);
+            if (write_sampler) {
+               VK_FROM_HANDLE(panvk_sampler, sampler, info->sampler);
+               memcpy(&samplers[j], sampler->desc, sizeof(sampler->desc));
             }
 
-            if (entry->type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
-                entry->type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
-
-               panvk_write_tex_desc(dev, set,
-                                    entry->binding,
-                                    entry->array_element + j,
-                                    info);
+            if (write_tex) {
+               VK_FROM_HANDLE(panvk_image_view, view, info->imageView);
+               memcpy(&textures[j], view->descs.tex, pan_size(TEXTURE));
+               panvk_fill_image_desc((struct panvk_image_desc *)
+                                     (img_descs + j * binding_layout->desc_ubo_stride),
+                                     view);
             }
          }
          break;
+      }
 
       case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
       case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
@@ -1058,3 +1099,149 @@ panvk_per_arch(UpdateDescriptorSetWithTemplate)(VkDevice _device,
       }
    }
 }
+
+void
+panvk_per_arch(UpdateDescriptorSetWithTemplate)(VkDevice _device,
+                                                VkDescriptorSet descriptorSet,
+                                                VkDescriptorUpdateTemplate descriptorUpdateTemplate,
+                                                const void *data)
+{
+   VK_FROM_HANDLE(panvk_device, dev, _device);
+   VK_FROM_HANDLE(panvk_descriptor_set, set, descriptorSet);
+   VK_FROM_HANDLE(vk_descriptor_update_template, template,
+                  descriptorUpdateTemplate);
+
+   panvk_descriptor_set_write_template(dev, set, template, data);
+}
+
+static struct panvk_descriptor_set *
+panvk_cmd_push_descriptors(struct panvk_cmd_buffer *cmdbuf,
+                           VkPipelineBindPoint bind_point,
+                           const struct panvk_pipeline_layout *playout,
+                           uint32_t set_idx)
+{
+   struct panvk_cmd_bind_point_state *bind_point_state =
+      &cmdbuf->bind_points[bind_point];
+   const struct panvk_descriptor_set_layout *layout =
+      vk_to_panvk_descriptor_set_layout(playout->vk.set_layouts[set_idx]);
+   size_t host_size = panvk_descriptor_set_host_size(layout);
+   struct panvk_push_descriptor_set *push = bind_point_state->push_set;
+
+   if (!push) {
+      push = vk_zalloc(&cmdbuf->vk.pool->alloc, sizeof(*push), 8,
+                       VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+      if (!push) {
+         vk_command_buffer_set_error(&cmdbuf->vk,
+                                     VK_ERROR_OUT_OF_HOST_MEMORY);
+         return NULL;
+      }
+
+      bind_point_state->push_set = push;
+   }
+
+   if (push->host_size < host_size) {
+      void *host = vk_realloc(&cmdbuf->vk.pool->alloc, push->host,
+                              host_size, 8,
+                              VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+      if (!host) {
+         vk_command_buffer_set_error(&cmdbuf->vk,
+                                     VK_ERROR_OUT_OF_HOST_MEMORY);
+         return NULL;
+      }
+
+      push->host = host;
+      push->host_size = host_size;
+      push->layout = NULL;
+   }
+
+   /* Descriptors which are not written by this push keep their value if
+    * the layout didn't change. The host arrays are only read when the
+    * descriptor tables get built, but the descriptor UBO is read by the GPU
+    * when the previous draws run, so it is reallocated on each push.
+    */
+   struct panvk_descriptor_set *set = push->host;
+   bool keep = push->layout == layout;
+   struct panfrost_ptr old_desc_ubo = keep ? set->desc_ubo :
+                                      (struct panfrost_ptr){ 0 };
+
+   if (!keep) {
+      memset(set, 0, host_size);
+      panvk_descriptor_set_init_host(set, layout);
+      push->layout = layout;
+   }
+
+   if (layout->desc_ubo_size) {
+      set->desc_ubo = pan_pool_alloc_aligned(&cmdbuf->desc_pool.base,
+                                             layout->desc_ubo_size, 16);
+      if (old_desc_ubo.cpu)
+         memcpy(set->desc_ubo.cpu, old_desc_ubo.cpu, layout->desc_ubo_size);
+      else
+         memset(set->desc_ubo.cpu, 0, layout->desc_ubo_size);
+
+      panvk_descriptor_set_init_desc_ubo(set);
+   }
+
+   if (!keep)
+      panvk_descriptor_set_init_immutable_samplers(set);
+
+   return set;
+}
+
+static void
+panvk_cmd_bind_push_descriptors(struct panvk_cmd_buffer *cmdbuf,
+                                VkPipelineBindPoint bind_point,
+                                uint32_t set_idx,
+                                struct panvk_descriptor_set *set)
+{
+   struct panvk_descriptor_state *desc_state =
+      &cmdbuf->bind_points[bind_point].desc_state;
+
+   desc_state->sets[set_idx] = set;
+   panvk_cmd_invalidate_descriptors(desc_state, set->layout);
+}
+
+void
+panvk_per_arch(CmdPushDescriptorSetKHR)(VkCommandBuffer commandBuffer,
+                                        VkPipelineBindPoint pipelineBindPoint,
+                                        VkPipelineLayout layout,
+                                        uint32_t set,
+                                        uint32_t descriptorWriteCount,
+                                        const VkWriteDescriptorSet *pDescriptorWrites)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_pipeline_layout, playout, layout);
+
+   struct panvk_descriptor_set *push_set =
+      panvk_cmd_push_descriptors(cmdbuf, pipelineBindPoint, playout, set);
+   if (!push_set)
+      return;
+
+   for (unsigned i = 0; i < descriptorWriteCount; i++)
+      panvk_descriptor_set_write(cmdbuf->device, push_set, &pDescriptorWrites[i]);
+
+   panvk_cmd_bind_push_descriptors(cmdbuf, pipelineBindPoint, set, push_set);
+}
+
+void
+panvk_per_arch(CmdPushDescriptorSetWithTemplateKHR)(VkCommandBuffer commandBuffer,
+                                                    VkDescriptorUpdateTemplate descriptorUpdateTemplate,
+                                                    VkPipelineLayout layout,
+                                                    uint32_t set,
+                                                    const void *pData)
+{
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(vk_descriptor_update_template, template,
+                  descriptorUpdateTemplate);
+   VK_FROM_HANDLE(panvk_pipeline_layout, playout, layout);
+
+   struct panvk_descriptor_set *push_set =
+      panvk_cmd_push_descriptors(cmdbuf, template->bind_point, playout, set);
+   if (!push_set)
+      return;
+
+   panvk_descriptor_set_write_template(cmdbuf->device, push_set, template,
+                                       pData);
+
+   panvk_cmd_bind_push_descriptors(cmdbuf, template->bind_point, set,
+                                   push_set);
+}
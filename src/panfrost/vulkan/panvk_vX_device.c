@@ -29,12 +29,58 @@
 #include "genxml/gen_macros.h"
 
 #include "decode.h"
+#include "pan_indirect_draw.h"
 
 #include "panvk_private.h"
 #include "panvk_cs.h"
 
 #include "vk_drm_syncobj.h"
 
+static void
+panvk_queue_submit_ioctl(struct panvk_queue *queue,
+                         struct drm_panfrost_submit *submit,
+                         struct kbase_atom_batch *atoms)
+{
+   struct panfrost_device *pdev = &queue->device->physical_device->pdev;
+   unsigned debug = queue->device->physical_device->instance->debug_flags;
+   int ret;
+
+   if (pdev->kbase) {
+      /* The in syncs were waited for on the CPU, and kbase orders the atoms
+       * through the BOs they use. The access of each BO isn't tracked, so
+       * they are all considered written. */
+      pdev->mali.handle_events(&pdev->mali);
+      if (atoms) {
+         ret = pdev->mali.submit_queue(&pdev->mali, atoms, submit->jc,
+                                       submit->requirements,
+                                       queue->kbase_syncobj,
+                                       (int32_t *)(uintptr_t)submit->bo_handles,
+                                       NULL, submit->bo_handle_count);
+      } else {
+         ret = pdev->mali.submit(&pdev->mali, submit->jc, submit->requirements,
+                                 queue->kbase_syncobj,
+                                 (int32_t *)(uintptr_t)submit->bo_handles,
+                                 NULL, submit->bo_handle_count);
+      }
+      assert(ret != -1);
+   } else {
+      ret = drmIoctl(pdev->fd, DRM_IOCTL_PANFROST_SUBMIT, submit);
+      assert(!ret);
+   }
+
+   if (debug & (PANVK_DEBUG_TRACE | PANVK_DEBUG_SYNC)) {
+      if (pdev->kbase) {
+         ret = pdev->mali.syncobj_wait(&pdev->mali, queue->kbase_syncobj,
+                                       INT64_MAX);
+         assert(ret);
+      } else {
+         ret = drmSyncobjWait(pdev->fd, &submit->out_sync, 1, INT64_MAX, 0,
+                              NULL);
+         assert(!ret);
+      }
+   }
+}
+
 static void
 panvk_queue_submit_batch(struct panvk_queue *queue,
                          struct panvk_batch *batch,
@@ -45,18 +91,53 @@ panvk_queue_submit_batch(struct panvk_queue *queue,
    const struct panvk_device *dev = queue->device;
    unsigned debug = dev->physical_device->instance->debug_flags;
    const struct panfrost_device *pdev = &dev->physical_device->pdev;
-   int ret;
 
-   /* Reset the batch if it's already been issued */
+   /* Reset the batch if it's already been issued. The job manager writes
+    * the completion status back to the job headers and skips the jobs which
+    * are already done when a chain is submitted again, so the headers can't
+    * be left untouched. Only the exception status and first incomplete task
+    * are written back on completion, and they share a 64-bit word which can
+    * be cleared with a single store. The fault pointer is only meaningful
+    * with a fault exception status.
+    */
    if (batch->issued) {
       util_dynarray_foreach(&batch->jobs, void *, job)
-         memset((*job), 0, 4 * 4);
+         *(uint64_t *)(*job) = 0;
 
       /* Reset the tiler before re-issuing the batch */
       if (batch->tiler.descs.cpu) {
          memcpy(batch->tiler.descs.cpu, batch->tiler.templ,
                 pan_size(TILER_CONTEXT) + pan_size(TILER_HEAP));
       }
+
+#if PANVK_GPU_INDIRECTS
+      /* And the draws patched on the GPU, along with the top of the varying
+       * heap they allocate from */
+      if (batch->indirect_draw_ctx.cpu) {
+         GENX(panfrost_reset_indirect_draw_ctx)(&dev->physical_device->pdev,
+                                                &batch->indirect_draw_ctx);
+      }
+
+      void *end = util_dynarray_end(&batch->patched_descs);
+      for (void *ptr = util_dynarray_begin(&batch->patched_descs); ptr < end;) {
+         const struct panvk_patched_desc *desc = ptr;
+
+         memcpy(desc->cpu, desc + 1, desc->size);
+         ptr += sizeof(*desc) + ALIGN_POT(desc->size, 8);
+      }
+#endif
+   }
+
+   /* On kbase, the vertex/tiler and fragment chains go to the kernel with a
+    * single ioctl, implicit sync on the batch BOs ordering the fragment atom
+    * after the tiler one. Not when the CPU waits for each chain. */
+   struct panfrost_device *kpdev = &dev->physical_device->pdev;
+   struct kbase_atom_batch atoms, *queued = NULL;
+
+   if (kpdev->kbase && kpdev->mali.submit_queue &&
+       !(debug & (PANVK_DEBUG_TRACE | PANVK_DEBUG_SYNC))) {
+      kbase_atom_batch_init(&atoms);
+      queued = &atoms;
    }
 
    if (batch->scoreboard.first_job) {
@@ -69,13 +150,7 @@ panvk_queue_submit_batch(struct panvk_queue *queue,
          .jc = batch->scoreboard.first_job,
       };
 
-      ret = drmIoctl(pdev->fd, DRM_IOCTL_PANFROST_SUBMIT, &submit);
-      assert(!ret);
-
-      if (debug & (PANVK_DEBUG_TRACE | PANVK_DEBUG_SYNC)) {
-         ret = drmSyncobjWait(pdev->fd, &submit.out_sync, 1, INT64_MAX, 0, NULL);
-         assert(!ret);
-      }
+      panvk_queue_submit_ioctl(queue, &submit, queued);
 
       if (debug & PANVK_DEBUG_TRACE)
          GENX(pandecode_jc)(batch->scoreboard.first_job, pdev->gpu_id);
@@ -101,12 +176,7 @@ panvk_queue_submit_batch(struct panvk_queue *queue,
          submit.in_sync_count = nr_in_fences;
       }
 
-      ret = drmIoctl(pdev->fd, DRM_IOCTL_PANFROST_SUBMIT, &submit);
-      assert(!ret);
-      if (debug & (PANVK_DEBUG_TRACE | PANVK_DEBUG_SYNC)) {
-         ret = drmSyncobjWait(pdev->fd, &submit.out_sync, 1, INT64_MAX, 0, NULL);
-         assert(!ret);
-      }
+      panvk_queue_submit_ioctl(queue, &submit, queued);
 
       if (debug & PANVK_DEBUG_TRACE)
          GENX(pandecode_jc)(batch->fragment_job, pdev->gpu_id);
@@ -115,18 +185,38 @@ panvk_queue_submit_batch(struct panvk_queue *queue,
          pandecode_dump_mappings();
    }
 
+   if (queued) {
+      ASSERTED bool ok = kpdev->mali.submit_batch(&kpdev->mali, queued);
+      assert(ok);
+      kbase_atom_batch_fini(queued);
+   }
+
    if (debug & PANVK_DEBUG_TRACE)
       pandecode_next_frame();
 
    batch->issued = true;
 }
 
+/* Makes the fence of the last submission signal syncobj, at the given point
+ * for timeline syncobjs */
 static void
-panvk_queue_transfer_sync(struct panvk_queue *queue, uint32_t syncobj)
+panvk_queue_transfer_sync(struct panvk_queue *queue, uint32_t syncobj,
+                          uint64_t point)
 {
-   const struct panfrost_device *pdev = &queue->device->physical_device->pdev;
+   const struct panvk_physical_device *phys_dev = queue->device->physical_device;
+   const struct panfrost_device *pdev = &phys_dev->pdev;
    int ret;
 
+   /* One ioctl instead of going through a sync file */
+   if (phys_dev->has_syncobj_transfer) {
+      ret = drmSyncobjTransfer(pdev->fd, syncobj, point, queue->sync, 0, 0);
+      assert(!ret);
+      return;
+   }
+
+   /* Timeline syncobjs come with the transfer ioctl */
+   assert(point == 0);
+
    struct drm_syncobj_handle handle = {
       .handle = queue->sync,
       .flags = DRM_SYNCOBJ_HANDLE_TO_FD_FLAGS_EXPORT_SYNC_FILE,
@@ -145,8 +235,12 @@ panvk_queue_transfer_sync(struct panvk_queue *queue, uint32_t syncobj)
 }
 
 static void
-panvk_add_wait_event_syncobjs(struct panvk_batch *batch, uint32_t *in_fences, unsigned *nr_in_fences)
+panvk_add_wait_event_syncobjs(struct panvk_queue *queue,
+                              struct panvk_batch *batch,
+                              uint32_t *in_fences, unsigned *nr_in_fences)
 {
+   const struct panfrost_device *pdev = &queue->device->physical_device->pdev;
+
    util_dynarray_foreach(&batch->event_ops, struct panvk_event_op, op) {
       switch (op->type) {
       case PANVK_EVENT_OP_SET:
@@ -156,7 +250,10 @@ panvk_add_wait_event_syncobjs(struct panvk_batch *batch, uint32_t *in_fences, un
          /* Nothing to do yet */
          break;
       case PANVK_EVENT_OP_WAIT:
-         in_fences[(*nr_in_fences)++] = op->event->syncobj;
+         if (pdev->kbase)
+            panvk_kbase_event_wait(queue->device, op->event, INT64_MAX);
+         else
+            in_fences[(*nr_in_fences)++] = op->event->syncobj;
          break;
       default:
          unreachable("bad panvk_event_op type\n");
@@ -172,12 +269,21 @@ panvk_signal_event_syncobjs(struct panvk_queue *queue, struct panvk_batch *batch
    util_dynarray_foreach(&batch->event_ops, struct panvk_event_op, op) {
       switch (op->type) {
       case PANVK_EVENT_OP_SET: {
-         panvk_queue_transfer_sync(queue, op->event->syncobj);
+         if (pdev->kbase)
+            panvk_kbase_event_set(queue->device, op->event,
+                                  queue->kbase_syncobj);
+         else
+            panvk_queue_transfer_sync(queue, op->event->syncobj, 0);
          break;
       }
       case PANVK_EVENT_OP_RESET: {
          struct panvk_event *event = op->event;
 
+         if (pdev->kbase) {
+            panvk_kbase_event_reset(queue->device, event);
+            break;
+         }
+
          struct drm_syncobj_array objs = {
             .handles = (uint64_t) (uintptr_t) &event->syncobj,
             .count_handles = 1
@@ -196,6 +302,53 @@ panvk_signal_event_syncobjs(struct panvk_queue *queue, struct panvk_batch *batch
    }
 }
 
+/* The submit ioctl only waits on binary syncobjs, so the fence of a timeline
+ * point is moved to a temporary one. Timelines aren't emulated in that case,
+ * so the runtime only calls queue_submit once every point waited on has a
+ * fence, and the kernel resolves the dependency without the CPU. */
+static uint32_t
+panvk_queue_point_syncobj(struct panvk_queue *queue, uint32_t timeline,
+                          uint64_t point)
+{
+   const struct panfrost_device *pdev = &queue->device->physical_device->pdev;
+   uint32_t syncobj;
+   int ret;
+
+   ret = drmSyncobjCreate(pdev->fd, 0, &syncobj);
+   assert(!ret);
+
+   ret = drmSyncobjTransfer(pdev->fd, syncobj, 0, timeline, point, 0);
+   assert(!ret);
+
+   return syncobj;
+}
+
+static int
+panvk_cmp_bo_handles(const void *a, const void *b)
+{
+   uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+   return (x > y) - (x < y);
+}
+
+/* Removes duplicate BO handles, returning the new number of handles */
+static unsigned
+panvk_merge_bo_handles(uint32_t *bos, unsigned nr_bos)
+{
+   if (nr_bos < 2)
+      return nr_bos;
+
+   qsort(bos, nr_bos, sizeof(*bos), panvk_cmp_bo_handles);
+
+   unsigned count = 1;
+   for (unsigned i = 1; i < nr_bos; i++) {
+      if (bos[i] != bos[count - 1])
+         bos[count++] = bos[i];
+   }
+
+   return count;
+}
+
 VkResult
 panvk_per_arch(queue_submit)(struct vk_queue *vk_queue,
                              struct vk_queue_submit *submit)
@@ -204,95 +357,149 @@ panvk_per_arch(queue_submit)(struct vk_queue *vk_queue,
       container_of(vk_queue, struct panvk_queue, vk);
    const struct panfrost_device *pdev = &queue->device->physical_device->pdev;
 
-   unsigned nr_semaphores = submit->wait_count + 1;
-   uint32_t semaphores[nr_semaphores];
-
-   semaphores[0] = queue->sync;
-   for (unsigned i = 0; i < submit->wait_count; i++) {
-      assert(vk_sync_type_is_drm_syncobj(submit->waits[i].sync->type));
-      struct vk_drm_syncobj *syncobj =
-         vk_sync_as_drm_syncobj(submit->waits[i].sync);
-
-      semaphores[i + 1] = syncobj->syncobj;
+   unsigned nr_semaphores = 0, nr_point_syncobjs = 0;
+   uint32_t semaphores[submit->wait_count + 1];
+   uint32_t point_syncobjs[submit->wait_count + 1];
+
+   if (pdev->kbase) {
+      /* Atoms can't wait on syncs, see panvk_kbase.c */
+      VkResult result =
+         vk_sync_wait_many(&queue->device->vk, submit->wait_count,
+                           submit->waits, VK_SYNC_WAIT_COMPLETE, UINT64_MAX);
+      if (result != VK_SUCCESS)
+         return result;
+   } else {
+      semaphores[nr_semaphores++] = queue->sync;
+      for (unsigned i = 0; i < submit->wait_count; i++) {
+         assert(vk_sync_type_is_drm_syncobj(submit->waits[i].sync->type));
+         struct vk_drm_syncobj *syncobj =
+            vk_sync_as_drm_syncobj(submit->waits[i].sync);
+
+         if (submit->waits[i].sync->flags & VK_SYNC_IS_TIMELINE) {
+            /* Point 0 is always signaled */
+            if (!submit->waits[i].wait_value)
+               continue;
+
+            uint32_t point =
+               panvk_queue_point_syncobj(queue, syncobj->syncobj,
+                                         submit->waits[i].wait_value);
+
+            point_syncobjs[nr_point_syncobjs++] = point;
+            semaphores[nr_semaphores++] = point;
+         } else {
+            semaphores[nr_semaphores++] = syncobj->syncobj;
+         }
+      }
    }
 
+   struct util_dynarray bos;
+   util_dynarray_init(&bos, NULL);
+
    for (uint32_t j = 0; j < submit->command_buffer_count; ++j) {
       struct panvk_cmd_buffer *cmdbuf =
          container_of(submit->command_buffers[j], struct panvk_cmd_buffer, vk);
 
-      list_for_each_entry(struct panvk_batch, batch, &cmdbuf->batches, node) {
-         /* FIXME: should be done at the batch level */
-         unsigned nr_bos =
-            panvk_pool_num_bos(&cmdbuf->desc_pool) +
-            panvk_pool_num_bos(&cmdbuf->varying_pool) +
-            panvk_pool_num_bos(&cmdbuf->tls_pool) +
-            (batch->fb.info ? batch->fb.info->attachment_count : 0) +
-            (batch->blit.src ? 1 : 0) +
-            (batch->blit.dst ? 1 : 0) +
-            (batch->scoreboard.first_tiler ? 1 : 0) + 1;
-         unsigned bo_idx = 0;
-         uint32_t bos[nr_bos];
-
-         panvk_pool_get_bo_handles(&cmdbuf->desc_pool, &bos[bo_idx]);
-         bo_idx += panvk_pool_num_bos(&cmdbuf->desc_pool);
+      /* The pool BOs are shared by all the batches of the command buffer,
+       * only collect them once */
+      unsigned nr_pool_bos =
+         panvk_pool_num_bos(&cmdbuf->desc_pool) +
+         panvk_pool_num_bos(&cmdbuf->varying_pool) +
+         panvk_pool_num_bos(&cmdbuf->tls_pool);
+      util_dynarray_clear(&bos);
+      uint32_t *pool_bos =
+         util_dynarray_grow(&bos, uint32_t, nr_pool_bos);
+
+      panvk_pool_get_bo_handles(&cmdbuf->desc_pool, pool_bos);
+      pool_bos += panvk_pool_num_bos(&cmdbuf->desc_pool);
+      panvk_pool_get_bo_handles(&cmdbuf->varying_pool, pool_bos);
+      pool_bos += panvk_pool_num_bos(&cmdbuf->varying_pool);
+      panvk_pool_get_bo_handles(&cmdbuf->tls_pool, pool_bos);
+
+      nr_pool_bos = panvk_merge_bo_handles(util_dynarray_begin(&bos),
+                                           nr_pool_bos);
 
-         panvk_pool_get_bo_handles(&cmdbuf->varying_pool, &bos[bo_idx]);
-         bo_idx += panvk_pool_num_bos(&cmdbuf->varying_pool);
-
-         panvk_pool_get_bo_handles(&cmdbuf->tls_pool, &bos[bo_idx]);
-         bo_idx += panvk_pool_num_bos(&cmdbuf->tls_pool);
+      list_for_each_entry(struct panvk_batch, batch, &cmdbuf->batches, node) {
+         bos.size = nr_pool_bos * sizeof(uint32_t);
 
          if (batch->fb.info) {
             for (unsigned i = 0; i < batch->fb.info->attachment_count; i++) {
-               bos[bo_idx++] = batch->fb.info->attachments[i].iview->pview.image->data.bo->gem_handle;
+               util_dynarray_append(&bos, uint32_t,
+                                    batch->fb.info->attachments[i].iview->pview.image->data.bo->gem_handle);
             }
          }
 
          if (batch->blit.src)
-            bos[bo_idx++] = batch->blit.src->gem_handle;
+            util_dynarray_append(&bos, uint32_t, batch->blit.src->gem_handle);
 
          if (batch->blit.dst)
-            bos[bo_idx++] = batch->blit.dst->gem_handle;
+            util_dynarray_append(&bos, uint32_t, batch->blit.dst->gem_handle);
+
+         /* Lets vkGetQueryPoolResults wait for the writes */
+         if (batch->query_bo) {
+            util_dynarray_append(&bos, uint32_t, batch->query_bo->gem_handle);
+            batch->query_bo->gpu_access |= PAN_BO_ACCESS_WRITE;
+         }
 
          if (batch->scoreboard.first_tiler)
-            bos[bo_idx++] = pdev->tiler_heap->gem_handle;
-
-         bos[bo_idx++] = pdev->sample_positions->gem_handle;
-         assert(bo_idx == nr_bos);
-
-         /* Merge identical BO entries. */
-         for (unsigned x = 0; x < nr_bos; x++) {
-            for (unsigned y = x + 1; y < nr_bos; ) {
-               if (bos[x] == bos[y])
-                  bos[y] = bos[--nr_bos];
-               else
-                  y++;
-            }
+            util_dynarray_append(&bos, uint32_t, pdev->tiler_heap->gem_handle);
+
+         /* Varyings of the draws patched on the GPU */
+         if (batch->indirect_draw_ctx.gpu) {
+            util_dynarray_append(&bos, uint32_t,
+                                 pdev->indirect_draw_shaders.varying_heap->gem_handle);
          }
 
+         util_dynarray_append(&bos, uint32_t, pdev->sample_positions->gem_handle);
+
+         unsigned nr_bos =
+            panvk_merge_bo_handles(util_dynarray_begin(&bos),
+                                   util_dynarray_num_elements(&bos, uint32_t));
+
          unsigned nr_in_fences = 0;
          unsigned max_wait_event_syncobjs =
             util_dynarray_num_elements(&batch->event_ops,
                                        struct panvk_event_op);
-         uint32_t in_fences[nr_semaphores + max_wait_event_syncobjs];
+         uint32_t in_fences[nr_semaphores + max_wait_event_syncobjs + 1];
          memcpy(in_fences, semaphores, nr_semaphores * sizeof(*in_fences));
          nr_in_fences += nr_semaphores;
 
-         panvk_add_wait_event_syncobjs(batch, in_fences, &nr_in_fences);
+         panvk_add_wait_event_syncobjs(queue, batch, in_fences, &nr_in_fences);
+
+         panvk_queue_submit_batch(queue, batch, util_dynarray_begin(&bos),
+                                  nr_bos, in_fences, nr_in_fences);
 
-         panvk_queue_submit_batch(queue, batch, bos, nr_bos, in_fences, nr_in_fences);
+         /* Once something was submitted, the following submissions are
+          * ordered after the semaphore waits through queue->sync */
+         if (nr_semaphores &&
+             (batch->scoreboard.first_job || batch->fragment_job))
+            nr_semaphores = 1;
 
          panvk_signal_event_syncobjs(queue, batch);
       }
    }
 
+   util_dynarray_fini(&bos);
+
+   /* The submissions hold references to the fences */
+   for (unsigned i = 0; i < nr_point_syncobjs; i++) {
+      ASSERTED int ret = drmSyncobjDestroy(pdev->fd, point_syncobjs[i]);
+      assert(!ret);
+   }
+
    /* Transfer the out fence to signal semaphores */
    for (unsigned i = 0; i < submit->signal_count; i++) {
+      if (pdev->kbase) {
+         panvk_kbase_sync_submitted(queue->device, submit->signals[i].sync,
+                                    queue->kbase_syncobj);
+         continue;
+      }
+
       assert(vk_sync_type_is_drm_syncobj(submit->signals[i].sync->type));
       struct vk_drm_syncobj *syncobj =
          vk_sync_as_drm_syncobj(submit->signals[i].sync);
 
-      panvk_queue_transfer_sync(queue, syncobj->syncobj);
+      panvk_queue_transfer_sync(queue, syncobj->syncobj,
+                                submit->signals[i].signal_value);
    }
 
    return VK_SUCCESS;
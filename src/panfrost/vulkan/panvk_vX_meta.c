@@ -25,6 +25,7 @@
 
 #include "nir/nir_builder.h"
 #include "pan_encoder.h"
+#include "pan_indirect_draw.h"
 #include "pan_shader.h"
 
 #include "panvk_private.h"
@@ -48,6 +49,199 @@ panvk_per_arch(meta_emit_viewport)(struct pan_pool *pool,
    return vp.gpu;
 }
 
+/* Raw formats images are accessed with from compute jobs, indexed by the
+ * position of the texel size in this table. Texels are copied bit for bit,
+ * with the conversions done by the attribute unit on store being no-ops.
+ */
+const struct panvk_meta_img_raw_format
+panvk_per_arch(meta_img_raw_fmts)[PANVK_META_IMG_RAW_NUM_FORMATS] = {
+   { PIPE_FORMAT_R8_UINT, 1, 1 },
+   { PIPE_FORMAT_R16_UINT, 2, 1 },
+   { PIPE_FORMAT_R8G8B8_UINT, 1, 3 },
+   { PIPE_FORMAT_R32_UINT, 4, 1 },
+   { PIPE_FORMAT_R16G16B16_UINT, 2, 3 },
+   { PIPE_FORMAT_R32G32_UINT, 4, 2 },
+   { PIPE_FORMAT_R32G32B32_UINT, 4, 3 },
+   { PIPE_FORMAT_R32G32B32A32_UINT, 4, 4 },
+};
+
+int
+panvk_per_arch(meta_img_raw_format_idx)(unsigned texelsize)
+{
+   for (unsigned i = 0; i < PANVK_META_IMG_RAW_NUM_FORMATS; i++) {
+      const struct panvk_meta_img_raw_format *fmt =
+         &panvk_per_arch(meta_img_raw_fmts)[i];
+
+      if (fmt->compsz * fmt->ncomps == texelsize)
+         return i;
+   }
+
+   return -1;
+}
+
+/* Whether a compute job can access the texels of an image through an
+ * attribute buffer. AFBC images can only be written by the tile writeback,
+ * and multisampled or block-compressed images don't map to a single texel
+ * per invocation.
+ */
+bool
+panvk_per_arch(meta_img_compute_accessible)(const struct panvk_image *img)
+{
+   const struct pan_image_layout *layout = &img->pimage.layout;
+   const struct util_format_description *desc =
+      util_format_description(layout->format);
+   unsigned texelsize = util_format_get_blocksize(layout->format);
+
+   if (drm_is_afbc(layout->modifier) || layout->nr_samples > 1 ||
+       desc->block.width != 1 || desc->block.height != 1)
+      return false;
+
+   if (panvk_per_arch(meta_img_raw_format_idx)(texelsize) < 0)
+      return false;
+
+   /* The interleaved attribute layout only handles power-of-two texels */
+   return layout->modifier == DRM_FORMAT_MOD_LINEAR ||
+          util_is_power_of_two_nonzero(texelsize);
+}
+
+/* Emits the attribute buffers and attributes giving access to a mip level
+ * of each image, as a 3D image whose third coordinate is the array layer,
+ * or the depth slice of 3D images. Image i is bound to attribute i.
+ */
+void
+panvk_per_arch(meta_emit_img_attribs)(struct pan_pool *pool,
+                                      const struct panvk_image **imgs,
+                                      const unsigned *levels,
+                                      unsigned count,
+                                      mali_ptr *attribs,
+                                      mali_ptr *attrib_bufs)
+{
+   struct panfrost_device *pdev = pool->dev;
+   struct panfrost_ptr bufs =
+      pan_pool_alloc_desc_array(pool, (count * 2) + 1, ATTRIBUTE_BUFFER);
+   struct panfrost_ptr attrs =
+      pan_pool_alloc_desc_array(pool, count, ATTRIBUTE);
+   uint8_t *buf = bufs.cpu;
+
+   for (unsigned i = 0; i < count; i++) {
+      const struct pan_image *pimage = &imgs[i]->pimage;
+      const struct pan_image_layout *layout = &pimage->layout;
+      unsigned level = levels[i];
+      unsigned texelsize = util_format_get_blocksize(layout->format);
+      int fmtidx = panvk_per_arch(meta_img_raw_format_idx)(texelsize);
+      unsigned offset =
+         pimage->data.offset + panfrost_texture_offset(layout, level, 0, 0);
+
+      assert(fmtidx >= 0);
+
+      pan_pack(buf, ATTRIBUTE_BUFFER, cfg) {
+         cfg.type = layout->modifier == DRM_FORMAT_MOD_LINEAR ?
+                    MALI_ATTRIBUTE_TYPE_3D_LINEAR :
+                    MALI_ATTRIBUTE_TYPE_3D_INTERLEAVED;
+         cfg.pointer = pimage->data.bo->ptr.gpu + offset;
+         cfg.stride = texelsize;
+         cfg.size = pimage->data.bo->size - offset;
+      }
+
+      buf += pan_size(ATTRIBUTE_BUFFER);
+      pan_pack(buf, ATTRIBUTE_BUFFER_CONTINUATION_3D, cfg) {
+         cfg.s_dimension = u_minify(layout->width, level);
+         cfg.t_dimension = u_minify(layout->height, level);
+         cfg.r_dimension =
+            layout->dim == MALI_TEXTURE_DIMENSION_3D ?
+            u_minify(layout->depth, level) : layout->array_size;
+         cfg.row_stride = layout->slices[level].row_stride;
+         if (cfg.r_dimension > 1)
+            cfg.slice_stride = panfrost_get_layer_stride(layout, level);
+      }
+
+      buf += pan_size(ATTRIBUTE_BUFFER);
+
+      pan_pack(attrs.cpu + (i * pan_size(ATTRIBUTE)), ATTRIBUTE, cfg) {
+         cfg.buffer_index = i * 2;
+         cfg.format =
+            pdev->formats[panvk_per_arch(meta_img_raw_fmts)[fmtidx].format].hw;
+      }
+   }
+
+   /* Terminating buffer */
+   memset(buf, 0, pan_size(ATTRIBUTE_BUFFER));
+
+   *attribs = attrs.gpu;
+   *attrib_bufs = bufs.gpu;
+}
+
+struct panfrost_ptr
+panvk_per_arch(meta_emit_compute_job)(struct pan_pool *desc_pool,
+                                      struct pan_scoreboard *scoreboard,
+                                      const struct pan_compute_dim *num_wg,
+                                      const struct pan_compute_dim *wg_sz,
+                                      mali_ptr attribs, mali_ptr attrib_bufs,
+                                      mali_ptr push_constants,
+                                      mali_ptr rsd, mali_ptr tsd)
+{
+   struct panfrost_ptr job =
+      pan_pool_alloc_desc(desc_pool, COMPUTE_JOB);
+
+   void *invoc = pan_section_ptr(job.cpu,
+                                 COMPUTE_JOB,
+                                 INVOCATION);
+   panfrost_pack_work_groups_compute(invoc, num_wg->x, num_wg->y, num_wg->z,
+                                     wg_sz->x, wg_sz->y, wg_sz->z,
+                                     false, false);
+
+   pan_section_pack(job.cpu, COMPUTE_JOB, PARAMETERS, cfg) {
+      cfg.job_task_split = 8;
+   }
+
+   pan_section_pack(job.cpu, COMPUTE_JOB, DRAW, cfg) {
+      cfg.thread_storage = tsd;
+      cfg.state = rsd;
+      cfg.push_uniforms = push_constants;
+      cfg.attributes = attribs;
+      cfg.attribute_buffers = attrib_bufs;
+   }
+
+   panfrost_add_job(desc_pool, scoreboard, MALI_JOB_TYPE_COMPUTE,
+                    false, false, 0, 0, &job, false);
+   return job;
+}
+
+/* Returns a batch to record a transfer job in. Transfers outside render
+ * passes don't depend on each other unless a barrier separates them, and
+ * barriers split batches, so consecutive transfers share the open batch
+ * instead of paying for a batch each. The batch is left open: it is closed
+ * by the next command needing its own batch.
+ */
+struct panvk_batch *
+panvk_per_arch(meta_get_compute_batch)(struct panvk_cmd_buffer *cmdbuf,
+                                       struct panfrost_bo *src,
+                                       struct panfrost_bo *dst)
+{
+   struct panvk_batch *batch = cmdbuf->state.batch;
+
+   if (batch &&
+       (batch->fb.desc.cpu ||
+        batch->scoreboard.job_index >= (UINT16_MAX - 1) ||
+        (src && batch->blit.src && batch->blit.src != src) ||
+        (dst && batch->blit.dst && batch->blit.dst != dst))) {
+      panvk_per_arch(cmd_close_batch)(cmdbuf);
+      batch = NULL;
+   }
+
+   if (!batch)
+      batch = panvk_cmd_open_batch(cmdbuf);
+
+   panvk_per_arch(cmd_alloc_tls_desc)(cmdbuf, false);
+
+   if (src)
+      batch->blit.src = src;
+   if (dst)
+      batch->blit.dst = dst;
+
+   return batch;
+}
+
 void
 panvk_per_arch(meta_init)(struct panvk_physical_device *dev)
 {
@@ -58,11 +252,23 @@ panvk_per_arch(meta_init)(struct panvk_physical_device *dev)
    panvk_per_arch(meta_blit_init)(dev);
    panvk_per_arch(meta_copy_init)(dev);
    panvk_per_arch(meta_clear_init)(dev);
+
+#if PANVK_GPU_INDIRECTS
+   panvk_pool_init(&dev->meta.indirect_draw.bin_pool, &dev->pdev, NULL,
+                   PAN_BO_EXECUTE, 16 * 1024,
+                   "panvk_meta indirect draw binary pool", false);
+   GENX(panfrost_init_indirect_draw_shaders)(&dev->pdev,
+                                             &dev->meta.indirect_draw.bin_pool.base);
+#endif
 }
 
 void
 panvk_per_arch(meta_cleanup)(struct panvk_physical_device *dev)
 {
+#if PANVK_GPU_INDIRECTS
+   GENX(panfrost_cleanup_indirect_draw_shaders)(&dev->pdev);
+   panvk_pool_cleanup(&dev->meta.indirect_draw.bin_pool);
+#endif
    panvk_per_arch(meta_blit_cleanup)(dev);
    panvk_pool_cleanup(&dev->meta.desc_pool);
    panvk_pool_cleanup(&dev->meta.bin_pool);
@@ -40,6 +40,37 @@ panvk_per_arch(meta_emit_viewport)(struct pan_pool *pool,
                                    uint16_t minx, uint16_t miny,
                                    uint16_t maxx, uint16_t maxy);
 
+extern const struct panvk_meta_img_raw_format
+panvk_per_arch(meta_img_raw_fmts)[PANVK_META_IMG_RAW_NUM_FORMATS];
+
+int
+panvk_per_arch(meta_img_raw_format_idx)(unsigned texelsize);
+
+bool
+panvk_per_arch(meta_img_compute_accessible)(const struct panvk_image *img);
+
+void
+panvk_per_arch(meta_emit_img_attribs)(struct pan_pool *pool,
+                                      const struct panvk_image **imgs,
+                                      const unsigned *levels,
+                                      unsigned count,
+                                      mali_ptr *attribs,
+                                      mali_ptr *attrib_bufs);
+
+struct panfrost_ptr
+panvk_per_arch(meta_emit_compute_job)(struct pan_pool *desc_pool,
+                                      struct pan_scoreboard *scoreboard,
+                                      const struct pan_compute_dim *num_wg,
+                                      const struct pan_compute_dim *wg_sz,
+                                      mali_ptr attribs, mali_ptr attrib_bufs,
+                                      mali_ptr push_constants,
+                                      mali_ptr rsd, mali_ptr tsd);
+
+struct panvk_batch *
+panvk_per_arch(meta_get_compute_batch)(struct panvk_cmd_buffer *cmdbuf,
+                                       struct panfrost_bo *src,
+                                       struct panfrost_bo *dst);
+
 void
 panvk_per_arch(meta_clear_init)(struct panvk_physical_device *dev);
 
@@ -330,6 +330,172 @@ panvk_meta_clear_attachment(struct panvk_cmd_buffer *cmdbuf,
    util_dynarray_append(&batch->jobs, void *, job.cpu);
 }
 
+#define PANVK_META_CLEAR_CS_WG_SIZE 16
+
+struct panvk_meta_clear_img_cs_info {
+   unsigned extent[3];
+   unsigned first_layer;
+   uint32_t texel[4];
+} PACKED;
+
+static mali_ptr
+panvk_meta_clear_img_cs_shader(struct panfrost_device *pdev,
+                               struct pan_pool *bin_pool,
+                               unsigned ncomps,
+                               struct pan_shader_info *shader_info)
+{
+   nir_builder b =
+      nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                     GENX(pan_shader_get_compiler_options)(),
+                                     "panvk_meta_clear_img_cs(ncomps=%d)",
+                                     ncomps);
+
+   b.shader->info.workgroup_size[0] = PANVK_META_CLEAR_CS_WG_SIZE;
+   b.shader->info.workgroup_size[1] = PANVK_META_CLEAR_CS_WG_SIZE;
+   b.shader->info.workgroup_size[2] = 1;
+   b.shader->info.num_images = 1;
+   BITSET_SET(b.shader->info.images_used, 0);
+
+   nir_ssa_def *coord = nir_load_global_invocation_id(&b, 32);
+   nir_ssa_def *extent =
+      nir_load_push_constant(&b, 3, 32, nir_imm_int(&b, 0),
+                             .base = offsetof(struct panvk_meta_clear_img_cs_info, extent),
+                             .range = ~0);
+
+   nir_push_if(&b, nir_ball(&b, nir_ult(&b, coord, extent)));
+   {
+      nir_ssa_def *first_layer =
+         nir_load_push_constant(&b, 1, 32, nir_imm_int(&b, 0),
+                                .base = offsetof(struct panvk_meta_clear_img_cs_info, first_layer),
+                                .range = ~0);
+      nir_ssa_def *texel =
+         nir_load_push_constant(&b, ncomps, 32, nir_imm_int(&b, 0),
+                                .base = offsetof(struct panvk_meta_clear_img_cs_info, texel),
+                                .range = ~0);
+      nir_ssa_def *imgcoord =
+         nir_vec4(&b, nir_channel(&b, coord, 0), nir_channel(&b, coord, 1),
+                  nir_iadd(&b, nir_channel(&b, coord, 2), first_layer),
+                  nir_imm_int(&b, 0));
+
+      nir_image_store(&b, nir_imm_int(&b, 0), imgcoord,
+                      nir_ssa_undef(&b, 1, 32), texel,
+                      nir_imm_int(&b, 0),
+                      .image_dim = GLSL_SAMPLER_DIM_3D,
+                      .access = ACCESS_NON_READABLE,
+                      .src_type = nir_type_uint32);
+   }
+   nir_pop_if(&b, NULL);
+
+   struct panfrost_compile_inputs inputs = {
+      .gpu_id = pdev->gpu_id,
+      .is_blit = true,
+      .no_ubo_to_push = true,
+   };
+
+   struct util_dynarray binary;
+
+   util_dynarray_init(&binary, NULL);
+   GENX(pan_shader_compile)(b.shader, &inputs, &binary, shader_info);
+   shader_info->push.count = DIV_ROUND_UP(sizeof(struct panvk_meta_clear_img_cs_info), 4);
+
+   mali_ptr shader =
+      pan_pool_upload_aligned(bin_pool, binary.data, binary.size, 128);
+
+   util_dynarray_fini(&binary);
+   ralloc_free(b.shader);
+
+   return shader;
+}
+
+/* Clears of images compute jobs can write to are done with a job per level
+ * storing the packed clear value, instead of a fragment job per level and
+ * layer. Partial depth/stencil clears need to preserve the other aspect, so
+ * they keep going through the tile buffer.
+ */
+static bool
+panvk_meta_clear_img_use_compute(const struct panvk_image *img,
+                                 const VkImageSubresourceRange *range)
+{
+   return panvk_per_arch(meta_img_compute_accessible)(img) &&
+          range->aspectMask == img->vk.aspects &&
+          util_format_pack_description(img->pimage.layout.format);
+}
+
+static void
+panvk_meta_clear_img_cs(struct panvk_cmd_buffer *cmdbuf,
+                        const struct panvk_image *img,
+                        const void *texel,
+                        const VkImageSubresourceRange *range)
+{
+   struct panvk_meta *meta = &cmdbuf->device->physical_device->meta;
+   const struct pan_image_layout *layout = &img->pimage.layout;
+   unsigned texelsize = util_format_get_blocksize(layout->format);
+   int fmtidx = panvk_per_arch(meta_img_raw_format_idx)(texelsize);
+
+   assert(fmtidx >= 0);
+
+   const struct panvk_meta_img_raw_format *rawfmt =
+      &panvk_per_arch(meta_img_raw_fmts)[fmtidx];
+   struct panvk_meta_clear_img_cs_info info = { 0 };
+
+   /* Split the packed texel in the components of the raw format */
+   for (unsigned i = 0; i < rawfmt->ncomps; i++) {
+      const uint8_t *comp = (const uint8_t *)texel + (i * rawfmt->compsz);
+
+      switch (rawfmt->compsz) {
+      case 1: info.texel[i] = *comp; break;
+      case 2: info.texel[i] = *(const uint16_t *)comp; break;
+      case 4: info.texel[i] = *(const uint32_t *)comp; break;
+      default: unreachable("Invalid component size");
+      }
+   }
+
+   mali_ptr rsd = meta->clear_img.raw[rawfmt->ncomps - 1].rsd;
+   unsigned level_count = vk_image_subresource_level_count(&img->vk, range);
+   unsigned layer_count = vk_image_subresource_layer_count(&img->vk, range);
+   bool is_3d = layout->dim == MALI_TEXTURE_DIMENSION_3D;
+
+   for (unsigned level = range->baseMipLevel;
+        level < range->baseMipLevel + level_count; level++) {
+      info.extent[0] = u_minify(layout->width, level);
+      info.extent[1] = u_minify(layout->height, level);
+      info.extent[2] = is_3d ? u_minify(layout->depth, level) : layer_count;
+      info.first_layer = is_3d ? 0 : range->baseArrayLayer;
+
+      mali_ptr pushconsts =
+         pan_pool_upload_aligned(&cmdbuf->desc_pool.base, &info,
+                                 sizeof(info), 16);
+
+      const struct panvk_image *imgs[] = { img };
+      mali_ptr attribs, attrib_bufs;
+
+      panvk_per_arch(meta_emit_img_attribs)(&cmdbuf->desc_pool.base, imgs,
+                                            &level, 1, &attribs, &attrib_bufs);
+
+      struct panvk_batch *batch =
+         panvk_per_arch(meta_get_compute_batch)(cmdbuf, NULL,
+                                                img->pimage.data.bo);
+
+      struct pan_compute_dim wg_sz = {
+         PANVK_META_CLEAR_CS_WG_SIZE, PANVK_META_CLEAR_CS_WG_SIZE, 1,
+      };
+      struct pan_compute_dim num_wg = {
+         DIV_ROUND_UP(info.extent[0], wg_sz.x),
+         DIV_ROUND_UP(info.extent[1], wg_sz.y),
+         info.extent[2],
+      };
+      struct panfrost_ptr job =
+         panvk_per_arch(meta_emit_compute_job)(&cmdbuf->desc_pool.base,
+                                               &batch->scoreboard,
+                                               &num_wg, &wg_sz,
+                                               attribs, attrib_bufs,
+                                               pushconsts, rsd,
+                                               batch->tls.gpu);
+
+      util_dynarray_append(&batch->jobs, void *, job.cpu);
+   }
+}
+
 static void
 panvk_meta_clear_color_img(struct panvk_cmd_buffer *cmdbuf,
                            struct panvk_image *img,
@@ -391,10 +557,17 @@ panvk_per_arch(CmdClearColorImage)(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
    VK_FROM_HANDLE(panvk_image, img, image);
 
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
+   for (unsigned i = 0; i < rangeCount; i++) {
+      if (panvk_meta_clear_img_use_compute(img, &pRanges[i])) {
+         uint8_t texel[16] = { 0 };
 
-   for (unsigned i = 0; i < rangeCount; i++)
-      panvk_meta_clear_color_img(cmdbuf, img, pColor, &pRanges[i]);
+         util_format_pack_rgba(img->pimage.layout.format, texel, pColor, 1);
+         panvk_meta_clear_img_cs(cmdbuf, img, texel, &pRanges[i]);
+      } else {
+         panvk_per_arch(cmd_close_batch)(cmdbuf);
+         panvk_meta_clear_color_img(cmdbuf, img, pColor, &pRanges[i]);
+      }
+   }
 }
 
 static void
@@ -466,11 +639,24 @@ panvk_per_arch(CmdClearDepthStencilImage)(VkCommandBuffer commandBuffer,
 {
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
    VK_FROM_HANDLE(panvk_image, img, image);
+   enum pipe_format fmt = img->pimage.layout.format;
+
+   for (unsigned i = 0; i < rangeCount; i++) {
+      if (panvk_meta_clear_img_use_compute(img, &pRanges[i])) {
+         uint8_t texel[16] = { 0 };
+         uint8_t stencil = pDepthStencil->stencil;
 
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
+         if (pRanges[i].aspectMask & VK_IMAGE_ASPECT_DEPTH_BIT)
+            util_format_pack_z_float(fmt, texel, &pDepthStencil->depth, 1);
+         if (pRanges[i].aspectMask & VK_IMAGE_ASPECT_STENCIL_BIT)
+            util_format_pack_s_8uint(fmt, texel, &stencil, 1);
 
-   for (unsigned i = 0; i < rangeCount; i++)
-      panvk_meta_clear_zs_img(cmdbuf, img, pDepthStencil, &pRanges[i]);
+         panvk_meta_clear_img_cs(cmdbuf, img, texel, &pRanges[i]);
+      } else {
+         panvk_per_arch(cmd_close_batch)(cmdbuf);
+         panvk_meta_clear_zs_img(cmdbuf, img, pDepthStencil, &pRanges[i]);
+      }
+   }
 }
 
 void
@@ -530,8 +716,28 @@ panvk_meta_clear_attachment_init(struct panvk_physical_device *dev)
             &dev->meta.clear_attachment.color[GLSL_TYPE_FLOAT].shader_info);
 }
 
+static void
+panvk_meta_clear_img_init(struct panvk_physical_device *dev)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(dev->meta.clear_img.raw); i++) {
+      struct pan_shader_info shader_info;
+      mali_ptr shader =
+         panvk_meta_clear_img_cs_shader(&dev->pdev, &dev->meta.bin_pool.base,
+                                        i + 1, &shader_info);
+      struct panfrost_ptr rsd =
+         pan_pool_alloc_desc(&dev->meta.desc_pool.base, RENDERER_STATE);
+
+      pan_pack(rsd.cpu, RENDERER_STATE, cfg) {
+         pan_shader_prepare_rsd(&shader_info, shader, &cfg);
+      }
+
+      dev->meta.clear_img.raw[i].rsd = rsd.gpu;
+   }
+}
+
 void
 panvk_per_arch(meta_clear_init)(struct panvk_physical_device *dev)
 {
    panvk_meta_clear_attachment_init(dev);
+   panvk_meta_clear_img_init(dev);
 }
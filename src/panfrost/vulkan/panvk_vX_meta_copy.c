@@ -570,12 +570,188 @@ panvk_meta_copy_img_mask(enum pipe_format imgfmt, VkImageAspectFlags aspectMask)
    }
 }
 
+#define PANVK_META_COPY_CS_WG_SIZE 16
+
+struct panvk_meta_copy_img2img_cs_info {
+   unsigned src_offset[3];
+   unsigned dst_offset[3];
+   unsigned extent[3];
+} PACKED;
+
+#define panvk_meta_copy_img2img_cs_get_info_vec3(b, field) \
+        nir_load_push_constant((b), 3, 32, nir_imm_int(b, 0), \
+                     .base = offsetof(struct panvk_meta_copy_img2img_cs_info, field), \
+                     .range = ~0)
+
+static mali_ptr
+panvk_meta_copy_img2img_cs_shader(struct panfrost_device *pdev,
+                                  struct pan_pool *bin_pool,
+                                  unsigned ncomps,
+                                  struct pan_shader_info *shader_info)
+{
+   nir_builder b =
+      nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                     GENX(pan_shader_get_compiler_options)(),
+                                     "panvk_meta_copy_img2img_cs(ncomps=%d)",
+                                     ncomps);
+
+   b.shader->info.workgroup_size[0] = PANVK_META_COPY_CS_WG_SIZE;
+   b.shader->info.workgroup_size[1] = PANVK_META_COPY_CS_WG_SIZE;
+   b.shader->info.workgroup_size[2] = 1;
+   b.shader->info.num_images = 2;
+   BITSET_SET(b.shader->info.images_used, 0);
+   BITSET_SET(b.shader->info.images_used, 1);
+
+   nir_ssa_def *coord = nir_load_global_invocation_id(&b, 32);
+   nir_ssa_def *extent =
+      panvk_meta_copy_img2img_cs_get_info_vec3(&b, extent);
+
+   nir_push_if(&b, nir_ball(&b, nir_ult(&b, coord, extent)));
+   {
+      nir_ssa_def *srccoord =
+         nir_iadd(&b, coord,
+                  panvk_meta_copy_img2img_cs_get_info_vec3(&b, src_offset));
+      nir_ssa_def *dstcoord =
+         nir_iadd(&b, coord,
+                  panvk_meta_copy_img2img_cs_get_info_vec3(&b, dst_offset));
+
+      /* Both images have the same raw format, texels are copied as is */
+      nir_ssa_def *texel =
+         nir_image_load(&b, ncomps, 32, nir_imm_int(&b, 0),
+                        nir_pad_vector_imm_int(&b, srccoord, 0, 4),
+                        nir_ssa_undef(&b, 1, 32), nir_imm_int(&b, 0),
+                        .image_dim = GLSL_SAMPLER_DIM_3D,
+                        .access = ACCESS_NON_WRITEABLE,
+                        .dest_type = nir_type_uint32);
+
+      nir_image_store(&b, nir_imm_int(&b, 1),
+                      nir_pad_vector_imm_int(&b, dstcoord, 0, 4),
+                      nir_ssa_undef(&b, 1, 32), texel,
+                      nir_imm_int(&b, 0),
+                      .image_dim = GLSL_SAMPLER_DIM_3D,
+                      .access = ACCESS_NON_READABLE,
+                      .src_type = nir_type_uint32);
+   }
+   nir_pop_if(&b, NULL);
+
+   struct panfrost_compile_inputs inputs = {
+      .gpu_id = pdev->gpu_id,
+      .is_blit = true,
+      .no_ubo_to_push = true,
+   };
+
+   struct util_dynarray binary;
+
+   util_dynarray_init(&binary, NULL);
+   GENX(pan_shader_compile)(b.shader, &inputs, &binary, shader_info);
+   shader_info->push.count = DIV_ROUND_UP(sizeof(struct panvk_meta_copy_img2img_cs_info), 4);
+
+   mali_ptr shader =
+      pan_pool_upload_aligned(bin_pool, binary.data, binary.size, 128);
+
+   util_dynarray_fini(&binary);
+   ralloc_free(b.shader);
+
+   return shader;
+}
+
+/* Same-size copies of full texels between images compute jobs can access
+ * are done without going through the tile buffer, see
+ * panvk_meta_copy_buf2img_use_compute().
+ */
+static bool
+panvk_meta_copy_img2img_use_compute(const struct panvk_image *src,
+                                    const struct panvk_image *dst,
+                                    const VkImageCopy2 *region)
+{
+   return panvk_per_arch(meta_img_compute_accessible)(src) &&
+          panvk_per_arch(meta_img_compute_accessible)(dst) &&
+          region->srcSubresource.aspectMask == src->vk.aspects &&
+          region->dstSubresource.aspectMask == dst->vk.aspects &&
+          util_format_get_blocksize(src->pimage.layout.format) ==
+          util_format_get_blocksize(dst->pimage.layout.format);
+}
+
+static void
+panvk_meta_copy_img2img_cs(struct panvk_cmd_buffer *cmdbuf,
+                           const struct panvk_image *src,
+                           const struct panvk_image *dst,
+                           const VkImageCopy2 *region)
+{
+   unsigned texelsize = util_format_get_blocksize(src->pimage.layout.format);
+   int fmtidx = panvk_per_arch(meta_img_raw_format_idx)(texelsize);
+
+   assert(fmtidx >= 0);
+
+   unsigned ncomps = panvk_per_arch(meta_img_raw_fmts)[fmtidx].ncomps;
+   mali_ptr rsd =
+      cmdbuf->device->physical_device->meta.copy.img2img_cs[ncomps - 1].rsd;
+
+   struct panvk_meta_copy_img2img_cs_info info = {
+      .src_offset = {
+         MAX2(region->srcOffset.x, 0),
+         MAX2(region->srcOffset.y, 0),
+         MAX2(region->srcSubresource.baseArrayLayer, region->srcOffset.z),
+      },
+      .dst_offset = {
+         MAX2(region->dstOffset.x, 0),
+         MAX2(region->dstOffset.y, 0),
+         MAX2(region->dstSubresource.baseArrayLayer, region->dstOffset.z),
+      },
+      .extent = {
+         region->extent.width,
+         region->extent.height,
+         MAX2(region->dstSubresource.layerCount, region->extent.depth),
+      },
+   };
+
+   mali_ptr pushconsts =
+      pan_pool_upload_aligned(&cmdbuf->desc_pool.base, &info, sizeof(info), 16);
+
+   const struct panvk_image *imgs[] = { src, dst };
+   unsigned levels[] = {
+      region->srcSubresource.mipLevel,
+      region->dstSubresource.mipLevel,
+   };
+   mali_ptr attribs, attrib_bufs;
+
+   panvk_per_arch(meta_emit_img_attribs)(&cmdbuf->desc_pool.base, imgs, levels,
+                                         2, &attribs, &attrib_bufs);
+
+   struct panvk_batch *batch =
+      panvk_per_arch(meta_get_compute_batch)(cmdbuf, src->pimage.data.bo,
+                                             dst->pimage.data.bo);
+
+   struct pan_compute_dim wg_sz = {
+      PANVK_META_COPY_CS_WG_SIZE, PANVK_META_COPY_CS_WG_SIZE, 1,
+   };
+   struct pan_compute_dim num_wg = {
+      DIV_ROUND_UP(info.extent[0], wg_sz.x),
+      DIV_ROUND_UP(info.extent[1], wg_sz.y),
+      info.extent[2],
+   };
+   struct panfrost_ptr job =
+      panvk_per_arch(meta_emit_compute_job)(&cmdbuf->desc_pool.base,
+                                            &batch->scoreboard,
+                                            &num_wg, &wg_sz,
+                                            attribs, attrib_bufs,
+                                            pushconsts, rsd,
+                                            batch->tls.gpu);
+
+   util_dynarray_append(&batch->jobs, void *, job.cpu);
+}
+
 static void
 panvk_meta_copy_img2img(struct panvk_cmd_buffer *cmdbuf,
                         const struct panvk_image *src,
                         const struct panvk_image *dst,
                         const VkImageCopy2 *region)
 {
+   if (panvk_meta_copy_img2img_use_compute(src, dst, region)) {
+      panvk_meta_copy_img2img_cs(cmdbuf, src, dst, region);
+      return;
+   }
+
    struct panfrost_device *pdev = &cmdbuf->device->physical_device->pdev;
    struct pan_fb_info *fbinfo = &cmdbuf->state.fb.info;
    struct panvk_meta_copy_img2img_format_info key = {
@@ -763,6 +939,20 @@ panvk_meta_copy_img2img_init(struct panvk_physical_device *dev, bool is_ms)
    }
 }
 
+static void
+panvk_meta_copy_img2img_cs_init(struct panvk_physical_device *dev)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(dev->meta.copy.img2img_cs); i++) {
+      struct pan_shader_info shader_info;
+      mali_ptr shader =
+         panvk_meta_copy_img2img_cs_shader(&dev->pdev, &dev->meta.bin_pool.base,
+                                           i + 1, &shader_info);
+      dev->meta.copy.img2img_cs[i].rsd =
+         panvk_meta_copy_to_buf_emit_rsd(&dev->pdev, &dev->meta.desc_pool.base,
+                                         shader, &shader_info, false);
+   }
+}
+
 void
 panvk_per_arch(CmdCopyImage2)(VkCommandBuffer commandBuffer,
                               const VkCopyImageInfo2 *pCopyImageInfo)
@@ -1018,12 +1208,216 @@ panvk_meta_copy_buf2img_format_idx(struct panvk_meta_copy_format_info key)
    unreachable("Invalid image format\n");
 }
 
+struct panvk_meta_copy_buf2img_cs_info {
+   struct {
+      mali_ptr ptr;
+      struct {
+         unsigned line;
+         unsigned surf;
+      } stride;
+   } buf;
+   struct {
+      unsigned offset[3];
+      unsigned extent[3];
+   } img;
+} PACKED;
+
+#define panvk_meta_copy_buf2img_cs_get_info_vec3(b, field) \
+        nir_load_push_constant((b), 3, 32, nir_imm_int(b, 0), \
+                     .base = offsetof(struct panvk_meta_copy_buf2img_cs_info, field), \
+                     .range = ~0)
+
+#define panvk_meta_copy_buf2img_cs_get_info_field(b, field) \
+        nir_load_push_constant((b), 1, \
+                     sizeof(((struct panvk_meta_copy_buf2img_cs_info *)0)->field) * 8, \
+                     nir_imm_int(b, 0), \
+                     .base = offsetof(struct panvk_meta_copy_buf2img_cs_info, field), \
+                     .range = ~0)
+
+/* The compute variant stores raw texels through an attribute buffer, so it
+ * only depends on the texel size, not on the renderability of the format.
+ */
+static mali_ptr
+panvk_meta_copy_buf2img_cs_shader(struct panfrost_device *pdev,
+                                  struct pan_pool *bin_pool,
+                                  const struct panvk_meta_img_raw_format *fmt,
+                                  struct pan_shader_info *shader_info)
+{
+   nir_builder b =
+      nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                     GENX(pan_shader_get_compiler_options)(),
+                                     "panvk_meta_copy_buf2img_cs(texelsz=%d)",
+                                     fmt->compsz * fmt->ncomps);
+
+   b.shader->info.workgroup_size[0] = PANVK_META_COPY_CS_WG_SIZE;
+   b.shader->info.workgroup_size[1] = PANVK_META_COPY_CS_WG_SIZE;
+   b.shader->info.workgroup_size[2] = 1;
+   b.shader->info.num_images = 1;
+   BITSET_SET(b.shader->info.images_used, 0);
+
+   nir_ssa_def *coord = nir_load_global_invocation_id(&b, 32);
+   nir_ssa_def *extent =
+      panvk_meta_copy_buf2img_cs_get_info_vec3(&b, img.extent);
+
+   nir_push_if(&b, nir_ball(&b, nir_ult(&b, coord, extent)));
+   {
+      nir_ssa_def *bufptr =
+         panvk_meta_copy_buf2img_cs_get_info_field(&b, buf.ptr);
+      nir_ssa_def *buflinestride =
+         panvk_meta_copy_buf2img_cs_get_info_field(&b, buf.stride.line);
+      nir_ssa_def *bufsurfstride =
+         panvk_meta_copy_buf2img_cs_get_info_field(&b, buf.stride.surf);
+
+      nir_ssa_def *offset =
+         nir_imul_imm(&b, nir_channel(&b, coord, 0), fmt->compsz * fmt->ncomps);
+      offset = nir_iadd(&b, offset,
+                        nir_imul(&b, nir_channel(&b, coord, 1), buflinestride));
+      offset = nir_iadd(&b, offset,
+                        nir_imul(&b, nir_channel(&b, coord, 2), bufsurfstride));
+      bufptr = nir_iadd(&b, bufptr, nir_u2u64(&b, offset));
+
+      nir_ssa_def *texel =
+         nir_load_global(&b, bufptr, fmt->compsz, fmt->ncomps, fmt->compsz * 8);
+
+      /* Image stores take 32-bit sources */
+      texel = nir_u2u32(&b, texel);
+
+      nir_ssa_def *imgcoord =
+         nir_iadd(&b, coord,
+                  panvk_meta_copy_buf2img_cs_get_info_vec3(&b, img.offset));
+
+      nir_image_store(&b, nir_imm_int(&b, 0),
+                      nir_pad_vector_imm_int(&b, imgcoord, 0, 4),
+                      nir_ssa_undef(&b, 1, 32), texel,
+                      nir_imm_int(&b, 0),
+                      .image_dim = GLSL_SAMPLER_DIM_3D,
+                      .access = ACCESS_NON_READABLE,
+                      .src_type = nir_type_uint32);
+   }
+   nir_pop_if(&b, NULL);
+
+   struct panfrost_compile_inputs inputs = {
+      .gpu_id = pdev->gpu_id,
+      .is_blit = true,
+      .no_ubo_to_push = true,
+   };
+
+   struct util_dynarray binary;
+
+   util_dynarray_init(&binary, NULL);
+   GENX(pan_shader_compile)(b.shader, &inputs, &binary, shader_info);
+   shader_info->push.count = DIV_ROUND_UP(sizeof(struct panvk_meta_copy_buf2img_cs_info), 4);
+
+   mali_ptr shader =
+      pan_pool_upload_aligned(bin_pool, binary.data, binary.size, 128);
+
+   util_dynarray_fini(&binary);
+   ralloc_free(b.shader);
+
+   return shader;
+}
+
+/* Copies are done with compute jobs when the image can be written texel by
+ * texel, which is the case of the images neither AFBC-compressed nor
+ * multisampled, as long as all the aspects of a texel are copied. Depth or
+ * stencil-only copies to combined depth/stencil images would need a
+ * read-modify-write of the texels, so they keep going through the tile
+ * buffer.
+ */
+static bool
+panvk_meta_copy_buf2img_use_compute(const struct panvk_image *img,
+                                    const VkBufferImageCopy2 *region)
+{
+   enum pipe_format imgfmt = img->pimage.layout.format;
+   unsigned mask = panvk_meta_copy_img_mask(imgfmt,
+                                            region->imageSubresource.aspectMask);
+
+   return panvk_per_arch(meta_img_compute_accessible)(img) &&
+          region->imageSubresource.aspectMask == img->vk.aspects &&
+          panvk_meta_copy_buf_texelsize(panvk_meta_copy_buf2img_format(imgfmt),
+                                        mask) ==
+          util_format_get_blocksize(imgfmt);
+}
+
+static void
+panvk_meta_copy_buf2img_cs(struct panvk_cmd_buffer *cmdbuf,
+                           const struct panvk_buffer *buf,
+                           const struct panvk_image *img,
+                           const VkBufferImageCopy2 *region)
+{
+   unsigned texelsize = util_format_get_blocksize(img->pimage.layout.format);
+   int fmtidx = panvk_per_arch(meta_img_raw_format_idx)(texelsize);
+
+   assert(fmtidx >= 0);
+   assert(region->imageSubresource.layerCount == 1 ||
+          region->imageExtent.depth == 1);
+   assert(region->imageOffset.z >= 0);
+
+   mali_ptr rsd =
+      cmdbuf->device->physical_device->meta.copy.buf2img_cs[fmtidx].rsd;
+
+   const struct vk_image_buffer_layout buflayout =
+      vk_image_buffer_copy_layout(&img->vk, region);
+   struct panvk_meta_copy_buf2img_cs_info info = {
+      .buf.ptr = panvk_buffer_gpu_ptr(buf, region->bufferOffset),
+      .buf.stride.line = buflayout.row_stride_B,
+      .buf.stride.surf = buflayout.image_stride_B,
+      .img.offset = {
+         MAX2(region->imageOffset.x, 0),
+         MAX2(region->imageOffset.y, 0),
+         MAX2(region->imageSubresource.baseArrayLayer, region->imageOffset.z),
+      },
+      .img.extent = {
+         region->imageExtent.width,
+         region->imageExtent.height,
+         MAX2(region->imageSubresource.layerCount, region->imageExtent.depth),
+      },
+   };
+
+   mali_ptr pushconsts =
+      pan_pool_upload_aligned(&cmdbuf->desc_pool.base, &info, sizeof(info), 16);
+
+   const struct panvk_image *imgs[] = { img };
+   unsigned levels[] = { region->imageSubresource.mipLevel };
+   mali_ptr attribs, attrib_bufs;
+
+   panvk_per_arch(meta_emit_img_attribs)(&cmdbuf->desc_pool.base, imgs, levels,
+                                         1, &attribs, &attrib_bufs);
+
+   struct panvk_batch *batch =
+      panvk_per_arch(meta_get_compute_batch)(cmdbuf, buf->bo,
+                                             img->pimage.data.bo);
+
+   struct pan_compute_dim wg_sz = {
+      PANVK_META_COPY_CS_WG_SIZE, PANVK_META_COPY_CS_WG_SIZE, 1,
+   };
+   struct pan_compute_dim num_wg = {
+      DIV_ROUND_UP(info.img.extent[0], wg_sz.x),
+      DIV_ROUND_UP(info.img.extent[1], wg_sz.y),
+      info.img.extent[2],
+   };
+   struct panfrost_ptr job =
+      panvk_per_arch(meta_emit_compute_job)(&cmdbuf->desc_pool.base,
+                                            &batch->scoreboard,
+                                            &num_wg, &wg_sz,
+                                            attribs, attrib_bufs,
+                                            pushconsts, rsd,
+                                            batch->tls.gpu);
+
+   util_dynarray_append(&batch->jobs, void *, job.cpu);
+}
+
 static void
 panvk_meta_copy_buf2img(struct panvk_cmd_buffer *cmdbuf,
                         const struct panvk_buffer *buf,
                         const struct panvk_image *img,
                         const VkBufferImageCopy2 *region)
 {
+   if (panvk_meta_copy_buf2img_use_compute(img, region)) {
+      panvk_meta_copy_buf2img_cs(cmdbuf, buf, img, region);
+      return;
+   }
+
    struct pan_fb_info *fbinfo = &cmdbuf->state.fb.info;
    unsigned minx = MAX2(region->imageOffset.x, 0);
    unsigned miny = MAX2(region->imageOffset.y, 0);
@@ -1156,6 +1550,17 @@ panvk_meta_copy_buf2img_init(struct panvk_physical_device *dev)
                                          panvk_meta_copy_buf2img_fmts[i].mask,
                                          false);
    }
+
+   for (unsigned i = 0; i < PANVK_META_IMG_RAW_NUM_FORMATS; i++) {
+      struct pan_shader_info shader_info;
+      mali_ptr shader =
+         panvk_meta_copy_buf2img_cs_shader(&dev->pdev, &dev->meta.bin_pool.base,
+                                           &panvk_per_arch(meta_img_raw_fmts)[i],
+                                           &shader_info);
+      dev->meta.copy.buf2img_cs[i].rsd =
+         panvk_meta_copy_to_buf_emit_rsd(&dev->pdev, &dev->meta.desc_pool.base,
+                                         shader, &shader_info, false);
+   }
 }
 
 void
@@ -1520,17 +1925,9 @@ panvk_meta_copy_img2buf(struct panvk_cmd_buffer *cmdbuf,
    mali_ptr sampler =
       panvk_meta_copy_img_emit_sampler(pdev, &cmdbuf->desc_pool.base);
 
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
-
-   struct panvk_batch *batch = panvk_cmd_open_batch(cmdbuf);
-
-   struct pan_tls_info tlsinfo = { 0 };
-
-   batch->blit.src = img->pimage.data.bo;
-   batch->blit.dst = buf->bo;
-   batch->tls =
-      pan_pool_alloc_desc(&cmdbuf->desc_pool.base, LOCAL_STORAGE);
-   GENX(pan_emit_tls)(&tlsinfo, batch->tls.cpu);
+   struct panvk_batch *batch =
+      panvk_per_arch(meta_get_compute_batch)(cmdbuf, img->pimage.data.bo,
+                                             buf->bo);
 
    mali_ptr tsd = batch->tls.gpu;
 
@@ -1556,8 +1953,6 @@ panvk_meta_copy_img2buf(struct panvk_cmd_buffer *cmdbuf,
                                        pushconsts, rsd, tsd);
 
    util_dynarray_append(&batch->jobs, void *, job.cpu);
-
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
 }
 
 static void
@@ -1607,7 +2002,12 @@ panvk_per_arch(CmdCopyImageToBuffer2)(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_image, img, pCopyImageToBufferInfo->srcImage);
 
    for (unsigned i = 0; i < pCopyImageToBufferInfo->regionCount; i++) {
-      panvk_meta_copy_img2buf(cmdbuf, buf, img, &pCopyImageToBufferInfo->pRegions[i]);
+      const VkBufferImageCopy2 *region = &pCopyImageToBufferInfo->pRegions[i];
+
+      panvk_per_arch(cmd_invalidate_index_ranges)(cmdbuf, buf,
+                                                  region->bufferOffset,
+                                                  VK_WHOLE_SIZE);
+      panvk_meta_copy_img2buf(cmdbuf, buf, img, region);
    }
 }
 
@@ -1710,11 +2110,8 @@ panvk_meta_copy_buf2buf(struct panvk_cmd_buffer *cmdbuf,
    mali_ptr pushconsts =
       pan_pool_upload_aligned(&cmdbuf->desc_pool.base, &info, sizeof(info), 16);
 
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
-
-   struct panvk_batch *batch = panvk_cmd_open_batch(cmdbuf);
-
-   panvk_per_arch(cmd_alloc_tls_desc)(cmdbuf, false);
+   struct panvk_batch *batch =
+      panvk_per_arch(meta_get_compute_batch)(cmdbuf, src->bo, dst->bo);
 
    mali_ptr tsd = batch->tls.gpu;
 
@@ -1728,10 +2125,6 @@ panvk_meta_copy_buf2buf(struct panvk_cmd_buffer *cmdbuf,
                                       0, 0, pushconsts, rsd, tsd);
 
    util_dynarray_append(&batch->jobs, void *, job.cpu);
-
-   batch->blit.src = src->bo;
-   batch->blit.dst = dst->bo;
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
 }
 
 void
@@ -1743,7 +2136,12 @@ panvk_per_arch(CmdCopyBuffer2)(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_buffer, dst, pCopyBufferInfo->dstBuffer);
 
    for (unsigned i = 0; i < pCopyBufferInfo->regionCount; i++) {
-      panvk_meta_copy_buf2buf(cmdbuf, src, dst, &pCopyBufferInfo->pRegions[i]);
+      const VkBufferCopy2 *region = &pCopyBufferInfo->pRegions[i];
+
+      panvk_per_arch(cmd_invalidate_index_ranges)(cmdbuf, dst,
+                                                  region->dstOffset,
+                                                  region->size);
+      panvk_meta_copy_buf2buf(cmdbuf, src, dst, region);
    }
 }
 
@@ -1864,11 +2262,8 @@ panvk_meta_fill_buf(struct panvk_cmd_buffer *cmdbuf,
    mali_ptr pushconsts =
       pan_pool_upload_aligned(&cmdbuf->desc_pool.base, &info, sizeof(info), 16);
 
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
-
-   struct panvk_batch *batch = panvk_cmd_open_batch(cmdbuf);
-
-   panvk_per_arch(cmd_alloc_tls_desc)(cmdbuf, false);
+   struct panvk_batch *batch =
+      panvk_per_arch(meta_get_compute_batch)(cmdbuf, NULL, dst->bo);
 
    mali_ptr tsd = batch->tls.gpu;
 
@@ -1881,9 +2276,6 @@ panvk_meta_fill_buf(struct panvk_cmd_buffer *cmdbuf,
                                       0, 0, pushconsts, rsd, tsd);
 
    util_dynarray_append(&batch->jobs, void *, job.cpu);
-
-   batch->blit.dst = dst->bo;
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
 }
 
 void
@@ -1896,6 +2288,7 @@ panvk_per_arch(CmdFillBuffer)(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
    VK_FROM_HANDLE(panvk_buffer, dst, dstBuffer);
 
+   panvk_per_arch(cmd_invalidate_index_ranges)(cmdbuf, dst, dstOffset, fillSize);
    panvk_meta_fill_buf(cmdbuf, dst, fillSize, dstOffset, data);
 }
 
@@ -1917,11 +2310,8 @@ panvk_meta_update_buf(struct panvk_cmd_buffer *cmdbuf,
    mali_ptr pushconsts =
       pan_pool_upload_aligned(&cmdbuf->desc_pool.base, &info, sizeof(info), 16);
 
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
-
-   struct panvk_batch *batch = panvk_cmd_open_batch(cmdbuf);
-
-   panvk_per_arch(cmd_alloc_tls_desc)(cmdbuf, false);
+   struct panvk_batch *batch =
+      panvk_per_arch(meta_get_compute_batch)(cmdbuf, NULL, dst->bo);
 
    mali_ptr tsd = batch->tls.gpu;
 
@@ -1935,9 +2325,6 @@ panvk_meta_update_buf(struct panvk_cmd_buffer *cmdbuf,
                                       0, 0, pushconsts, rsd, tsd);
 
    util_dynarray_append(&batch->jobs, void *, job.cpu);
-
-   batch->blit.dst = dst->bo;
-   panvk_per_arch(cmd_close_batch)(cmdbuf);
 }
 
 void
@@ -1950,6 +2337,7 @@ panvk_per_arch(CmdUpdateBuffer)(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
    VK_FROM_HANDLE(panvk_buffer, dst, dstBuffer);
 
+   panvk_per_arch(cmd_invalidate_index_ranges)(cmdbuf, dst, dstOffset, dataSize);
    panvk_meta_update_buf(cmdbuf, dst, dstOffset, dataSize, pData);
 }
 
@@ -1958,6 +2346,7 @@ panvk_per_arch(meta_copy_init)(struct panvk_physical_device *dev)
 {
    panvk_meta_copy_img2img_init(dev, false);
    panvk_meta_copy_img2img_init(dev, true);
+   panvk_meta_copy_img2img_cs_init(dev);
    panvk_meta_copy_buf2img_init(dev);
    panvk_meta_copy_img2buf_init(dev);
    panvk_meta_copy_buf2buf_init(dev);
@@ -46,7 +46,7 @@
 struct panvk_pipeline_builder
 {
    struct panvk_device *device;
-   struct panvk_pipeline_cache *cache;
+   struct vk_pipeline_cache *cache;
    const VkAllocationCallbacks *alloc;
    struct {
       const VkGraphicsPipelineCreateInfo *gfx;
@@ -95,7 +95,7 @@ panvk_pipeline_builder_finish(struct panvk_pipeline_builder *builder)
    for (uint32_t i = 0; i < MESA_SHADER_STAGES; i++) {
       if (!builder->shaders[i])
          continue;
-      panvk_shader_destroy(builder->device, builder->shaders[i], builder->alloc);
+      panvk_shader_unref(builder->shaders[i]);
    }
 }
 
@@ -139,7 +139,7 @@ panvk_pipeline_builder_compile_shaders(struct panvk_pipeline_builder *builder,
                                              &pipeline->blend.state,
                                              panvk_pipeline_static_state(pipeline,
                                                                          VK_DYNAMIC_STATE_BLEND_CONSTANTS),
-                                             builder->alloc);
+                                             builder->cache);
       if (!shader)
          return VK_ERROR_OUT_OF_HOST_MEMORY;
  
@@ -917,7 +917,7 @@ panvk_pipeline_builder_build(struct panvk_pipeline_builder *builder,
 static void
 panvk_pipeline_builder_init_graphics(struct panvk_pipeline_builder *builder,
                                      struct panvk_device *dev,
-                                     struct panvk_pipeline_cache *cache,
+                                     struct vk_pipeline_cache *cache,
                                      const VkGraphicsPipelineCreateInfo *create_info,
                                      const VkAllocationCallbacks *alloc)
 {
@@ -940,13 +940,39 @@ panvk_pipeline_builder_init_graphics(struct panvk_pipeline_builder *builder,
       builder->samples = create_info->pMultisampleState->rasterizationSamples;
 
       const struct panvk_render_pass *pass = panvk_render_pass_from_handle(create_info->renderPass);
+
+      builder->active_color_attachments = 0;
+
+      if (!pass) {
+         /* Dynamic rendering: the formats come from the create info */
+         const VkPipelineRenderingCreateInfo *rendering =
+            vk_find_struct_const(create_info->pNext,
+                                 PIPELINE_RENDERING_CREATE_INFO);
+
+         if (!rendering)
+            return;
+
+         builder->use_depth_stencil_attachment =
+            rendering->depthAttachmentFormat != VK_FORMAT_UNDEFINED ||
+            rendering->stencilAttachmentFormat != VK_FORMAT_UNDEFINED;
+
+         for (uint32_t i = 0; i < rendering->colorAttachmentCount; i++) {
+            VkFormat fmt = rendering->pColorAttachmentFormats[i];
+            if (fmt == VK_FORMAT_UNDEFINED)
+               continue;
+
+            builder->active_color_attachments |= 1 << i;
+            builder->color_attachment_formats[i] = vk_format_to_pipe_format(fmt);
+         }
+         return;
+      }
+
       const struct panvk_subpass *subpass = &pass->subpasses[create_info->subpass];
 
       builder->use_depth_stencil_attachment =
          subpass->zs_attachment.idx != VK_ATTACHMENT_UNUSED;
 
       assert(subpass->color_count <= create_info->pColorBlendState->attachmentCount);
-      builder->active_color_attachments = 0;
       for (uint32_t i = 0; i < subpass->color_count; i++) {
          uint32_t idx = subpass->color_attachments[i].idx;
          if (idx == VK_ATTACHMENT_UNUSED)
@@ -967,7 +993,10 @@ panvk_per_arch(CreateGraphicsPipelines)(VkDevice device,
                                         VkPipeline *pPipelines)
 {
    VK_FROM_HANDLE(panvk_device, dev, device);
-   VK_FROM_HANDLE(panvk_pipeline_cache, cache, pipelineCache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, pipelineCache);
+
+   if (!cache)
+      cache = dev->mem_cache;
 
    for (uint32_t i = 0; i < count; i++) {
       struct panvk_pipeline_builder builder;
@@ -996,7 +1025,7 @@ panvk_per_arch(CreateGraphicsPipelines)(VkDevice device,
 static void
 panvk_pipeline_builder_init_compute(struct panvk_pipeline_builder *builder,
                                     struct panvk_device *dev,
-                                    struct panvk_pipeline_cache *cache,
+                                    struct vk_pipeline_cache *cache,
                                     const VkComputePipelineCreateInfo *create_info,
                                     const VkAllocationCallbacks *alloc)
 {
@@ -1020,7 +1049,10 @@ panvk_per_arch(CreateComputePipelines)(VkDevice device,
                                        VkPipeline *pPipelines)
 {
    VK_FROM_HANDLE(panvk_device, dev, device);
-   VK_FROM_HANDLE(panvk_pipeline_cache, cache, pipelineCache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, pipelineCache);
+
+   if (!cache)
+      cache = dev->mem_cache;
 
    for (uint32_t i = 0; i < count; i++) {
       struct panvk_pipeline_builder builder;
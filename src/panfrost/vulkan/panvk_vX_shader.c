@@ -37,6 +37,7 @@
 #include "nir_conversion_builder.h"
 #include "spirv/nir_spirv.h"
 #include "util/mesa-sha1.h"
+#include "vk_pipeline.h"
 #include "vk_shader_module.h"
 
 #include "pan_shader.h"
@@ -91,6 +92,25 @@ panvk_inline_blend_constants(nir_builder *b, nir_instr *instr, void *data)
    return true;
 }
 
+/* Update the equation of a lowered render target to force a color
+ * replacement, the blending being done in the shader.
+ */
+static void
+panvk_blend_force_replace(struct pan_blend_rt_state *rt_state)
+{
+   rt_state->equation.color_mask = 0xf;
+   rt_state->equation.rgb_func = BLEND_FUNC_ADD;
+   rt_state->equation.rgb_src_factor = BLEND_FACTOR_ZERO;
+   rt_state->equation.rgb_invert_src_factor = true;
+   rt_state->equation.rgb_dst_factor = BLEND_FACTOR_ZERO;
+   rt_state->equation.rgb_invert_dst_factor = false;
+   rt_state->equation.alpha_func = BLEND_FUNC_ADD;
+   rt_state->equation.alpha_src_factor = BLEND_FACTOR_ZERO;
+   rt_state->equation.alpha_invert_src_factor = true;
+   rt_state->equation.alpha_dst_factor = BLEND_FACTOR_ZERO;
+   rt_state->equation.alpha_invert_dst_factor = false;
+}
+
 static void
 panvk_lower_blend(struct panfrost_device *pdev,
                   nir_shader *nir,
@@ -140,18 +160,7 @@ panvk_lower_blend(struct panfrost_device *pdev,
          options.rt[rt].alpha.invert_dst_factor = rt_state->equation.alpha_invert_dst_factor;
       }
 
-      /* Update the equation to force a color replacement */
-      rt_state->equation.color_mask = 0xf;
-      rt_state->equation.rgb_func = BLEND_FUNC_ADD;
-      rt_state->equation.rgb_src_factor = BLEND_FACTOR_ZERO;
-      rt_state->equation.rgb_invert_src_factor = true;
-      rt_state->equation.rgb_dst_factor = BLEND_FACTOR_ZERO;
-      rt_state->equation.rgb_invert_dst_factor = false;
-      rt_state->equation.alpha_func = BLEND_FUNC_ADD;
-      rt_state->equation.alpha_src_factor = BLEND_FACTOR_ZERO;
-      rt_state->equation.alpha_invert_src_factor = true;
-      rt_state->equation.alpha_dst_factor = BLEND_FACTOR_ZERO;
-      rt_state->equation.alpha_invert_dst_factor = false;
+      panvk_blend_force_replace(rt_state);
       lower_blend = true;
 
       inputs->bifrost.static_rt_conv = true;
@@ -215,31 +224,82 @@ shared_type_info(const struct glsl_type *type, unsigned *size, unsigned *align)
    *align = comp_size * (length == 3 ? 4 : length);
 }
 
-struct panvk_shader *
-panvk_per_arch(shader_create)(struct panvk_device *dev,
-                              gl_shader_stage stage,
-                              const VkPipelineShaderStageCreateInfo *stage_info,
-                              const struct panvk_pipeline_layout *layout,
-                              unsigned sysval_ubo,
-                              struct pan_blend_state *blend_state,
-                              bool static_blend_constants,
-                              const VkAllocationCallbacks *alloc)
+static void
+panvk_shader_hash(struct panvk_device *dev,
+                  gl_shader_stage stage,
+                  const VkPipelineShaderStageCreateInfo *stage_info,
+                  const struct panvk_pipeline_layout *layout,
+                  unsigned sysval_ubo,
+                  const struct pan_blend_state *blend_state,
+                  bool static_blend_constants,
+                  unsigned char *sha1)
+{
+   struct panfrost_device *pdev = &dev->physical_device->pdev;
+   unsigned char stage_sha1[20];
+   struct mesa_sha1 ctx;
+
+   vk_pipeline_hash_shader_stage(stage_info, stage_sha1);
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, stage_sha1, sizeof(stage_sha1));
+   _mesa_sha1_update(&ctx, layout->sha1, sizeof(layout->sha1));
+   _mesa_sha1_update(&ctx, &layout->num_sets, sizeof(layout->num_sets));
+   _mesa_sha1_update(&ctx, &pdev->gpu_id, sizeof(pdev->gpu_id));
+   _mesa_sha1_update(&ctx, &sysval_ubo, sizeof(sysval_ubo));
+
+   bool robust = dev->vk.enabled_features.robustBufferAccess;
+   _mesa_sha1_update(&ctx, &robust, sizeof(robust));
+
+   /* Blending might be lowered to the fragment shader */
+   if (stage == MESA_SHADER_FRAGMENT) {
+      _mesa_sha1_update(&ctx, &blend_state->logicop_enable,
+                        sizeof(blend_state->logicop_enable));
+      _mesa_sha1_update(&ctx, &blend_state->logicop_func,
+                        sizeof(blend_state->logicop_func));
+      _mesa_sha1_update(&ctx, &blend_state->rt_count,
+                        sizeof(blend_state->rt_count));
+      _mesa_sha1_update(&ctx, blend_state->rts,
+                        blend_state->rt_count * sizeof(blend_state->rts[0]));
+      _mesa_sha1_update(&ctx, &static_blend_constants,
+                        sizeof(static_blend_constants));
+      if (static_blend_constants) {
+         _mesa_sha1_update(&ctx, blend_state->constants,
+                           sizeof(blend_state->constants));
+      }
+   }
+
+   _mesa_sha1_final(&ctx, sha1);
+}
+
+static struct panvk_shader *
+panvk_shader_compile(struct panvk_device *dev,
+                     gl_shader_stage stage,
+                     const VkPipelineShaderStageCreateInfo *stage_info,
+                     const struct panvk_pipeline_layout *layout,
+                     unsigned sysval_ubo,
+                     struct pan_blend_state *blend_state,
+                     bool static_blend_constants,
+                     const unsigned char *sha1)
 {
    VK_FROM_HANDLE(vk_shader_module, module, stage_info->module);
    struct panfrost_device *pdev = &dev->physical_device->pdev;
+   bool subgroups = panvk_physical_device_has_subgroups(dev->physical_device);
    struct panvk_shader *shader;
 
-   shader = vk_zalloc2(&dev->vk.alloc, alloc, sizeof(*shader), 8,
-                       VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   shader = panvk_shader_alloc(dev, sha1);
    if (!shader)
       return NULL;
 
-   util_dynarray_init(&shader->binary, NULL);
-
    /* TODO these are made-up */
    const struct spirv_to_nir_options spirv_options = {
       .caps = {
          .variable_pointers = true,
+         .subgroup_basic = subgroups,
+         .subgroup_vote = subgroups,
+         .subgroup_arithmetic = subgroups,
+         .subgroup_ballot = subgroups,
+         .subgroup_shuffle = subgroups,
+         .subgroup_quad = subgroups,
       },
       .ubo_addr_format = nir_address_format_32bit_index_offset,
       .ssbo_addr_format = dev->vk.enabled_features.robustBufferAccess ?
@@ -255,7 +315,7 @@ panvk_per_arch(shader_create)(struct panvk_device *dev,
                                              GENX(pan_shader_get_compiler_options)(),
                                              NULL, &nir);
    if (result != VK_SUCCESS) {
-      vk_free2(&dev->vk.alloc, alloc, shader);
+      panvk_shader_unref(shader);
       return NULL;
    }
 
@@ -394,3 +454,46 @@ panvk_per_arch(shader_create)(struct panvk_device *dev,
 
    return shader;
 }
+
+struct panvk_shader *
+panvk_per_arch(shader_create)(struct panvk_device *dev,
+                              gl_shader_stage stage,
+                              const VkPipelineShaderStageCreateInfo *stage_info,
+                              const struct panvk_pipeline_layout *layout,
+                              unsigned sysval_ubo,
+                              struct pan_blend_state *blend_state,
+                              bool static_blend_constants,
+                              struct vk_pipeline_cache *cache)
+{
+   struct panfrost_device *pdev = &dev->physical_device->pdev;
+   unsigned char sha1[20];
+
+   panvk_shader_hash(dev, stage, stage_info, layout, sysval_ubo,
+                     blend_state, static_blend_constants, sha1);
+
+   struct vk_pipeline_cache_object *object =
+      vk_pipeline_cache_lookup_object(cache, sha1, sizeof(sha1),
+                                      &panvk_shader_ops, NULL);
+   if (object) {
+      /* Compiling the shader would have updated the blend state of the
+       * render targets whose blending is done in the shader.
+       */
+      if (stage == MESA_SHADER_FRAGMENT) {
+         for (unsigned rt = 0; rt < blend_state->rt_count; rt++) {
+            if (panvk_per_arch(blend_needs_lowering)(pdev, blend_state, rt))
+               panvk_blend_force_replace(&blend_state->rts[rt]);
+         }
+      }
+
+      return container_of(object, struct panvk_shader, base);
+   }
+
+   struct panvk_shader *shader =
+      panvk_shader_compile(dev, stage, stage_info, layout, sysval_ubo,
+                           blend_state, static_blend_constants, sha1);
+   if (!shader)
+      return NULL;
+
+   object = vk_pipeline_cache_add_object(cache, &shader->base);
+   return container_of(object, struct panvk_shader, base);
+}
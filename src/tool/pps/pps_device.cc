@@ -9,6 +9,7 @@
 
 #include "pps_device.h"
 
+#include <algorithm>
 #include <cassert>
 #include <fcntl.h>
 #include <memory>
@@ -62,6 +63,23 @@ std::optional<DrmDevice> create_drm_device(int fd, int32_t gpu_num)
    return ret;
 }
 
+/// Mali GPUs driven by the kbase kernel driver have no DRM node, they come
+/// after the DRM devices and are handled by the panfrost driver
+/// @return A kbase device, nullopt if there is none
+std::optional<DrmDevice> create_kbase_device(int32_t gpu_num)
+{
+   int fd = open("/dev/mali0", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+   if (fd < 0) {
+      return std::nullopt;
+   }
+
+   auto ret = DrmDevice();
+   ret.fd = fd;
+   ret.gpu_num = gpu_num;
+   ret.name = "panfrost";
+   return ret;
+}
+
 std::vector<DrmDevice> DrmDevice::create_all()
 {
    std::vector<DrmDevice> ret = {};
@@ -69,6 +87,9 @@ std::vector<DrmDevice> DrmDevice::create_all()
    drmDevicePtr devices[MAX_DRM_DEVICES] = {};
    int num_devices = drmGetDevices2(0, devices, MAX_DRM_DEVICES);
    if (num_devices <= 0) {
+      if (auto kbase_device = create_kbase_device(0)) {
+         ret.emplace_back(std::move(kbase_device.value()));
+      }
       return ret;
    }
 
@@ -85,6 +106,11 @@ std::vector<DrmDevice> DrmDevice::create_all()
    }
 
    drmFreeDevices(devices, num_devices);
+
+   if (auto kbase_device = create_kbase_device(num_devices)) {
+      ret.emplace_back(std::move(kbase_device.value()));
+   }
+
    return ret;
 }
 
@@ -103,6 +129,8 @@ std::optional<DrmDevice> DrmDevice::create(int32_t gpu_num)
       drmDevicePtr device = devices[gpu_num];
       int fd = open(device->nodes[DRM_NODE_RENDER], O_RDWR);
       ret = create_drm_device(fd, gpu_num);
+   } else if (gpu_num == std::max(num_devices, 0)) {
+      ret = create_kbase_device(gpu_num);
    }
 
    drmFreeDevices(devices, num_devices);
@@ -491,6 +491,34 @@
    DRI_CONF_OPT_B(v3d_nonmsaa_texture_size_limit, def, \
                   "Report the non-MSAA-only texture size limit")
 
+/**
+ * \brief panfrost specific configuration options
+ */
+
+#define DRI_CONF_PAN_TILER_HEAP_CHUNK_SIZE(def) \
+   DRI_CONF_OPT_I(pan_tiler_heap_chunk_size, def, 256, 16384, \
+                  "Size in KB of the chunks tiler heaps grow by (CSF GPUs)")
+
+#define DRI_CONF_PAN_TILER_HEAP_INITIAL_CHUNKS(def) \
+   DRI_CONF_OPT_I(pan_tiler_heap_initial_chunks, def, 1, 200, \
+                  "Number of chunks allocated when a tiler heap is created (CSF GPUs)")
+
+#define DRI_CONF_PAN_TILER_HEAP_MAX_CHUNKS(def) \
+   DRI_CONF_OPT_I(pan_tiler_heap_max_chunks, def, 1, 2000, \
+                  "Number of chunks a tiler heap can grow to before rendering incrementally (CSF GPUs)")
+
+#define DRI_CONF_PAN_TILER_HEAP_ADAPTIVE(def) \
+   DRI_CONF_OPT_B(pan_tiler_heap_adaptive, def, \
+                  "Recreate tiler heaps with a higher chunk limit when a context uses most of it (CSF GPUs)")
+
+#define DRI_CONF_PAN_MEDIUMP_INT16(def) \
+   DRI_CONF_OPT_B(pan_mediump_int16, def, \
+                  "Lower mediump integer operations to 16-bit (Bifrost and newer)")
+
+#define DRI_CONF_PAN_THREAD_AFFINITY(def) \
+   DRI_CONF_OPT_B(pan_thread_affinity, def, \
+                  "Keep driver threads on big or little cores depending on their work (big.LITTLE CPUs)")
+
 /**
  * \brief virgl specific configuration options
  */